@@ -0,0 +1,42 @@
+#!/bin/sh
+#
+# Copyright 2016 The Bazel Authors. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+set -eu
+
+# Records the install base key and the names of the entries of a Bazel
+# binary in its zip comment, so that the client can read them from the end
+# of the file instead of scanning the whole central directory on every
+# invocation (see ReadInstallIndex() in src/main/cpp/blaze.cc).
+
+BINARY=$1
+
+TMP_DIR=${TMPDIR:-/tmp}
+INDEX_DIR="$(mktemp -d ${TMP_DIR%%/}/bazel-index.XXXXXXXX)"
+trap "rm -fr ${INDEX_DIR}" EXIT
+
+{
+  echo "install_base_key $(unzip -p ${BINARY} install_base_key)"
+  unzip -Z1 ${BINARY}
+} > ${INDEX_DIR}/index
+
+# A zip comment is at most 64K long. Without the index, the client falls back
+# to scanning the central directory.
+if [ $(wc -c < ${INDEX_DIR}/index) -lt 60000 ]; then
+  # zip insists on the .zip extension.
+  cp ${BINARY} ${INDEX_DIR}/binary.zip
+  zip -qz ${INDEX_DIR}/binary.zip < ${INDEX_DIR}/index
+  cp ${INDEX_DIR}/binary.zip ${BINARY}
+fi
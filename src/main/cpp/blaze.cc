@@ -27,7 +27,6 @@
 
 #include <assert.h>
 #include <ctype.h>
-#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
@@ -40,11 +39,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/resource.h>
-#include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
@@ -55,9 +54,13 @@
 #include <grpc++/client_context.h>
 #include <grpc++/create_channel.h>
 #include <grpc++/security/credentials.h>
+#include <grpc++/support/channel_arguments.h>
 
 #include <algorithm>
 #include <chrono>  // NOLINT (gRPC requires this)
+#include <condition_variable>  // NOLINT
+#include <deque>
+#include <memory>
 #include <mutex>  // NOLINT
 #include <set>
 #include <string>
@@ -75,10 +78,12 @@
 #include "src/main/cpp/util/errors.h"
 #include "src/main/cpp/util/exit_code.h"
 #include "src/main/cpp/util/file.h"
+#include "src/main/cpp/util/histogram.h"
 #include "src/main/cpp/util/md5.h"
 #include "src/main/cpp/util/numbers.h"
 #include "src/main/cpp/util/port.h"
 #include "src/main/cpp/util/strings.h"
+#include "src/main/cpp/util/trace.h"
 #include "src/main/cpp/workspace_layout.h"
 #include "third_party/ijar/zip.h"
 
@@ -102,6 +107,7 @@ static void WriteFileToStreamOrDie(FILE *stream, const char *file_name);
 static string BuildServerRequest();
 static int GetServerPid(const string &server_dir);
 static void VerifyJavaVersionAndSetJvm();
+static void CreateSecureOutputRoot(const string &path);
 
 // The following is a treatise on how the interaction between the client and the
 // server works.
@@ -201,6 +207,12 @@ class BlazeServer {
   // this object will be in connected state.
   virtual bool Connect() = 0;
 
+  // Same as Connect(), but the server may not be checked to be responsive
+  // until Communicate() sends it the command, which then starts a new server
+  // if it was not. Use it for the server that is expected to be running
+  // already, not for one still starting up.
+  virtual bool ConnectToRunningServer() { return Connect(); }
+
   // Disconnects from an existing server. Only call this when this object is in
   // connected state. After this call returns, the object will be in connected
   // state.
@@ -235,6 +247,7 @@ static void InitGlobals(OptionProcessor *option_processor) {
   globals->extract_data_time = 0;
   globals->command_wait_time = 0;
   globals->restart_reason = NO_RESTART;
+  globals->shared_install_base = false;
   globals->option_processor = option_processor;
   globals->options = NULL;  // Initialized after parsing with option_processor.
 }
@@ -261,6 +274,46 @@ class AfUnixBlazeServer : public BlazeServer {
   int server_socket_;
 };
 
+// Writes the output of a command to stdout and stderr on a separate thread,
+// so that a slow terminal or pipe does not keep the client from reading the
+// responses of the server. Consecutive chunks for the same file descriptor
+// are written with a single writev(). When too much output is queued, Write()
+// waits, and the server is then slowed down by the flow control of gRPC.
+// The buffers of the chunks written are handed back to the caller, so that
+// the strings of the response being read into keep their capacity.
+class OutputForwarder {
+ public:
+  OutputForwarder();
+
+  // Writes all the queued output and stops the thread.
+  ~OutputForwarder();
+
+  // Queues the data to be written to given file descriptor, leaving "data"
+  // empty, possibly with the buffer of an already written chunk.
+  void Write(int fd, string *data);
+
+ private:
+  static const size_t kMaxQueuedBytes = 4 * 1024 * 1024;
+  static const size_t kMaxChunksPerWrite = 64;
+  static const size_t kMaxSpareBuffers = 8;
+
+  // Writer thread body.
+  void WriteLoop();
+  // Writes the chunks to the file descriptor, ignoring the errors just like
+  // the single writes did.
+  static void WriteChunks(int fd, const vector<string> &chunks);
+
+  std::deque<std::pair<int, string> > chunks_;
+  // Emptied chunks, to be swapped in for the data passed to Write().
+  vector<string> spare_buffers_;
+  size_t queued_bytes_;
+  bool stopping_;
+  std::mutex mutex_;
+  std::condition_variable queued_cond_;
+  std::condition_variable written_cond_;
+  std::thread writer_;
+};
+
 // Communication method that uses gRPC on a socket bound to localhost. More
 // documentation is in command_server.proto .
 class GrpcBlazeServer : public BlazeServer {
@@ -269,30 +322,59 @@ class GrpcBlazeServer : public BlazeServer {
   virtual ~GrpcBlazeServer();
 
   virtual bool Connect();
+  virtual bool ConnectToRunningServer();
   virtual void Disconnect();
   virtual unsigned int Communicate();
   virtual void KillRunningServer();
   virtual void Cancel();
 
  private:
-  enum CancelThreadAction { NOTHING, JOIN, CANCEL, COMMAND_ID_RECEIVED };
+  enum CancelThreadAction {
+    NOTHING, JOIN, CANCEL, COMMAND_ID_RECEIVED, COMMAND_DONE
+  };
+
+  // Implements Connect() and ConnectToRunningServer(). Without the ping, the
+  // server only has to be a running process.
+  bool Connect(bool ping);
 
   std::unique_ptr<command_server::CommandServer::Stub> client_;
   std::string request_cookie_;
   std::string response_cookie_;
+  // Whether the server has answered with response_cookie_, either to the ping
+  // of Connect() or to the command.
+  bool verified_;
   std::string command_id_;
 
-  // protects command_id_ . Although we always set it before making the cancel
-  // thread do something with it, the mutex is still useful because it provides
-  // a memory fence.
+  // protects command_id_ and command_done_. Although we always set
+  // command_id_ before making the cancel thread do something with it, the
+  // mutex is still useful because it provides a memory fence.
   std::mutex cancel_thread_mutex_;
+  // Set by the cancel thread when it is done with the command.
+  bool command_done_;
+  std::condition_variable command_done_cond_;
 
   int recv_socket_;  // Socket the cancel thread reads actions from
   int send_socket_;  // Socket the main thread writes actions to
+  // Started by the first Communicate(), serves all the commands.
+  std::thread cancel_thread_;
 
+  // Creates recv_socket_ and send_socket_.
+  void CreateCancelPipe();
   void CancelThread();
   void SendAction(CancelThreadAction action);
+  // Waits for the cancel thread to be done with the current command, i.e.
+  // for any cancel request in flight to be sent.
+  void EndCancelThreadCommand();
   void SendCancelMessage();
+
+  // The latencies of the RPCs to the server. cancel_latency_ is guarded by
+  // cancel_thread_mutex_.
+  blaze_util::LatencyHistogram ping_latency_;
+  blaze_util::LatencyHistogram first_response_latency_;
+  blaze_util::LatencyHistogram response_gap_latency_;
+  blaze_util::LatencyHistogram cancel_latency_;
+  // Writes them to the output base and prints them if asked to.
+  void ReportRpcLatencies();
 };
 
 
@@ -369,10 +451,87 @@ class GetInstallKeyFileProcessor : public devtools_ijar::ZipExtractorProcessor {
   string *install_base_key_;
 };
 
+// Reads the install base key and the names of the embedded files from the
+// index the build stores in the zip comment of the Blaze binary (see
+// src/add-install-index.sh), which takes a single read from the end of the
+// file. Returns false if there is no usable index, e.g. because the binary
+// was built some other way.
+static bool ReadInstallIndex(const string &self_path, string *install_md5,
+                             vector<string> *extracted_binaries) {
+  // The end of central directory record, followed by the comment.
+  static const size_t kEndOfCentralDirSize = 22;
+  static const size_t kMaxCommentSize = 0xffff;
+  static const char kKeyPrefix[] = "install_base_key ";
+
+  int fd = open(self_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat buf;
+  if (fstat(fd, &buf) < 0 ||
+      buf.st_size < static_cast<off_t>(kEndOfCentralDirSize)) {
+    close(fd);
+    return false;
+  }
+  size_t tail_size = std::min(static_cast<size_t>(buf.st_size),
+                              kEndOfCentralDirSize + kMaxCommentSize);
+  string tail(tail_size, '\0');
+  ssize_t read_size = pread(fd, &tail[0], tail_size, buf.st_size - tail_size);
+  close(fd);
+  if (read_size != static_cast<ssize_t>(tail_size)) {
+    return false;
+  }
+
+  // Find the end of central directory record whose comment extends to the end
+  // of the file, same as devtools_ijar::FindZipCentralDirectory().
+  const unsigned char *tail_bytes =
+      reinterpret_cast<const unsigned char *>(tail.data());
+  size_t eocd = tail_size - kEndOfCentralDirSize;
+  for (;; --eocd) {
+    const unsigned char *p = tail_bytes + eocd;
+    if (p[0] == 'P' && p[1] == 'K' && p[2] == 5 && p[3] == 6 &&
+        eocd + kEndOfCentralDirSize + (p[20] | (p[21] << 8)) == tail_size) {
+      break;
+    }
+    if (eocd == 0) {
+      return false;
+    }
+  }
+  size_t entries = tail_bytes[eocd + 10] | (tail_bytes[eocd + 11] << 8);
+
+  // The comment has the key on the first line and then the names of the
+  // entries, one per line, in the order of the central directory.
+  vector<string> lines =
+      blaze_util::Split(tail.substr(eocd + kEndOfCentralDirSize), '\n');
+  for (string &line : lines) {
+    if (!line.empty() && line[line.size() - 1] == '\r') {
+      line.resize(line.size() - 1);
+    }
+  }
+  while (!lines.empty() && lines.back().empty()) {
+    lines.pop_back();
+  }
+  const size_t prefix_length = sizeof(kKeyPrefix) - 1;
+  // A zip modified after the index was written is likely to have a different
+  // number of entries.
+  if (lines.size() != entries + 1 ||
+      lines[0].compare(0, prefix_length, kKeyPrefix) != 0 ||
+      lines[0].size() != prefix_length + 32) {
+    return false;
+  }
+  *install_md5 = lines[0].substr(prefix_length);
+  extracted_binaries->assign(lines.begin() + 1, lines.end());
+  return true;
+}
+
 // Returns the install base (the root concatenated with the contents of the file
 // 'install_base_key' contained as a ZIP entry in the Blaze binary); as a side
 // effect, it also populates the extracted_binaries global variable.
 static string GetInstallBase(const string &root, const string &self_path) {
+  if (ReadInstallIndex(self_path, &globals->install_md5,
+                       &globals->extracted_binaries)) {
+    return root + "/" + globals->install_md5;
+  }
   GetInstallKeyFileProcessor processor(&globals->install_md5);
   std::unique_ptr<devtools_ijar::ZipExtractor> extractor(
       devtools_ijar::ZipExtractor::Create(self_path.c_str(), &processor));
@@ -393,6 +552,60 @@ static string GetInstallBase(const string &root, const string &self_path) {
   return root + "/" + globals->install_md5;
 }
 
+// Returns true if "buf" describes a directory that only root or this user
+// can have written to, so that it can be trusted like the user's own install
+// base.
+static bool IsTrustedInstallBase(const struct stat &buf) {
+  return S_ISDIR(buf.st_mode) &&
+         (buf.st_uid == 0 || buf.st_uid == geteuid()) &&
+         (buf.st_mode & 022) == 0;
+}
+
+static void WarnUntrustedInstallBase(const string &install_base) {
+  fprintf(stderr,
+          "WARNING: ignoring the shared install base %s: it is not a "
+          "directory owned by root or by you that only its owner can write "
+          "to.\n",
+          install_base.c_str());
+}
+
+// Returns the install base below --shared_install_root to use instead of the
+// user's own one, or an empty string if there is none. An existing one is
+// used if it can be trusted (see IsTrustedInstallBase()), a missing one if
+// this user can create it there; ExtractData() extracts it then. Needs
+// globals->install_md5.
+static string GetSharedInstallBase() {
+  const string &root = globals->options->shared_install_root;
+  if (root.empty()) {
+    return "";
+  }
+  // Others must not be able to swap the install base for one of their own.
+  struct stat buf;
+  if (stat(root.c_str(), &buf) == -1) {
+    return "";
+  }
+  if ((buf.st_mode & 022) != 0 && (buf.st_mode & S_ISVTX) == 0) {
+    fprintf(stderr,
+            "WARNING: ignoring --shared_install_root=%s: it is writable by "
+            "others and does not have the sticky bit.\n",
+            root.c_str());
+    return "";
+  }
+
+  string install_base = root + "/" + globals->install_md5;
+  if (lstat(install_base.c_str(), &buf) == 0) {
+    if (IsTrustedInstallBase(buf)) {
+      return install_base;
+    }
+    WarnUntrustedInstallBase(install_base);
+    return "";
+  }
+  if (errno == ENOENT && access(root.c_str(), W_OK) == 0) {
+    return install_base;
+  }
+  return "";
+}
+
 // Escapes colons by replacing them with '_C' and underscores by replacing them
 // with '_U'. E.g. "name:foo_bar" becomes "name_Cfoo_Ubar"
 static string EscapeForOptionSource(const string& input) {
@@ -423,6 +636,16 @@ static vector<string> GetArgumentArray() {
 
   result.push_back("-Xverify:none");
 
+  // Before the user options, so that --host_jvm_args can override it.
+  if (globals->options->server_transparent_huge_pages) {
+    if (TransparentHugePagesEnabled()) {
+      result.push_back("-XX:+UseTransparentHugePages");
+    } else {
+      fprintf(stderr, "WARNING: --server_transparent_huge_pages ignored, "
+              "transparent huge pages are not enabled.\n");
+    }
+  }
+
   vector<string> user_options;
 
   user_options.insert(user_options.begin(),
@@ -484,6 +707,9 @@ static vector<string> GetArgumentArray() {
   if (!globals->options->batch) {
     result.push_back("--max_idle_secs");
     result.push_back(ToString(globals->options->max_idle_secs));
+    if (globals->options->shutdown_on_memory_pressure) {
+      result.push_back("--shutdown_on_memory_pressure");
+    }
   } else {
     // --batch must come first in the arguments to Java main() because
     // the code expects it to be at args[0] if it's been set.
@@ -572,6 +798,21 @@ static vector<string> GetArgumentArray() {
 // Add common command options for logging to the given argument array.
 static void AddLoggingArgs(vector<string>* args) {
   args->push_back("--startup_time=" + ToString(globals->startup_time));
+  if (!globals->startup_phases.empty()) {
+    // The start times are given relative to now, when the request is sent,
+    // since the clocks of the client and the server are not comparable.
+    uint64_t now = MonotonicClock();
+    string phases;
+    for (const StartupPhase &phase : globals->startup_phases) {
+      if (!phases.empty()) {
+        phases += ',';
+      }
+      phases += phase.name + ":" +
+                ToString((now - phase.start_time) / 1000000LL) + ":" +
+                ToString((phase.end_time - phase.start_time) / 1000000LL);
+    }
+    args->push_back("--client_startup_phases=" + phases);
+  }
   if (globals->command_wait_time != 0) {
     args->push_back("--command_wait_time=" +
                     ToString(globals->command_wait_time));
@@ -591,6 +832,21 @@ static void AddLoggingArgs(vector<string>* args) {
       string("--binary_path=") + globals->binary_path);
 }
 
+// Records a phase of the client startup that began at start_time (as returned
+// by MonotonicClock()) and ends now. Returns the current time, i.e. the start
+// time of the next phase.
+static uint64_t EndStartupPhase(const char *name, uint64_t start_time) {
+  uint64_t end_time = MonotonicClock();
+  StartupPhase phase = {name, start_time, end_time};
+  globals->startup_phases.push_back(phase);
+  if (blaze_util::TracingEnabled()) {
+    int64_t now = blaze_util::TraceNow();
+    blaze_util::TraceSpanAt(
+        name, now - static_cast<int64_t>(end_time - start_time) / 1000, now);
+  }
+  return end_time;
+}
+
 // Join the elements of the specified array with NUL's (\0's), akin to the
 // format of /proc/$PID/cmdline.
 static string GetArgumentString(const vector<string>& argument_array) {
@@ -599,6 +855,29 @@ static string GetArgumentString(const vector<string>& argument_array) {
   return result;
 }
 
+// Returns the MD5 of the JVM argument array, leaving out the arguments which
+// may differ without the server having to be restarted, see
+// ServerNeedsToBeKilled().
+static string GetStartupConfigurationDigest(
+    const vector<string>& argument_array) {
+  static const char option_sources[] = "--option_sources=";
+  Md5Digest digest;
+  for (size_t i = 0; i < argument_array.size(); ++i) {
+    const string& arg = argument_array[i];
+    if (arg.compare(0, sizeof(option_sources) - 1, option_sources) == 0) {
+      continue;
+    }
+    // Include the terminating NUL so that the argument boundaries count.
+    digest.Update(arg.c_str(), arg.size() + 1);
+    if (arg == "--max_idle_secs") {
+      i++;
+    }
+  }
+  unsigned char buf[Md5Digest::kDigestLength];
+  digest.Finish(buf);
+  return digest.String();
+}
+
 // Do a chdir into the workspace, and die if it fails.
 static void GoToWorkspace() {
   if (WorkspaceLayout::InWorkspace(globals->workspace) &&
@@ -608,6 +887,37 @@ static void GoToWorkspace() {
   }
 }
 
+// The output of GetJvmVersion() for the JVM of the server, if it was already
+// run by ExtractData().
+static bool jvm_version_known = false;
+static string known_jvm_version;
+
+// Returns GetJvmVersion() of the given JVM. The version is recorded in the
+// output base, and "java -version" is only run again if the binary is not
+// the same any more, as identified by its path, inode, size and
+// modification time.
+static string GetCachedJvmVersion(const string &exe) {
+  struct stat buf;
+  if (stat(exe.c_str(), &buf) == -1) {
+    return GetJvmVersion(exe);
+  }
+  string cache_file =
+      blaze_util::JoinPath(globals->options->output_base, "jvm.version");
+  string key = exe + "\n" + ToString(buf.st_dev) + ":" +
+               ToString(buf.st_ino) + ":" + ToString(buf.st_size) + ":" +
+               ToString(buf.st_mtime) + "\n";
+  string cached;
+  if (ReadFile(cache_file, &cached) && cached.size() > key.size() &&
+      cached.compare(0, key.size(), key) == 0) {
+    return cached.substr(key.size());
+  }
+  string jvm_version = GetJvmVersion(exe);
+  if (!jvm_version.empty()) {
+    WriteFile(key + jvm_version, cache_file);
+  }
+  return jvm_version;
+}
+
 // Check the java version if a java version specification is bundled. On
 // success, returns the executable path of the java command.
 static void VerifyJavaVersionAndSetJvm() {
@@ -621,7 +931,8 @@ static void VerifyJavaVersionAndSetJvm() {
   if (ReadFile(version_spec_file, &version_spec)) {
     blaze_util::StripWhitespace(&version_spec);
     // A version specification is given, get version of java.
-    string jvm_version = GetJvmVersion(exe);
+    string jvm_version =
+        jvm_version_known ? known_jvm_version : GetCachedJvmVersion(exe);
 
     // Compare that jvm_version is found and at least the one specified.
     if (jvm_version.size() == 0) {
@@ -639,6 +950,183 @@ static void VerifyJavaVersionAndSetJvm() {
   globals->jvm_path = exe;
 }
 
+// Returns the major version of a JVM version as returned by GetJvmVersion(),
+// e.g. 8 for "1.8.0_112" and 11 for "11.0.2", or 0 if it cannot be parsed.
+static int JvmMajorVersion(const string &jvm_version) {
+  vector<string> parts = blaze_util::Split(jvm_version, '.');
+  if (parts.empty()) {
+    return 0;
+  }
+  int major = blaze_util::strto32(parts[0].c_str(), NULL, 10);
+  if (major == 1 && parts.size() > 1) {
+    major = blaze_util::strto32(parts[1].c_str(), NULL, 10);
+  }
+  return major;
+}
+
+// Returns whether any of the --host_jvm_args starts with one of "prefixes".
+static bool HasHostJvmArg(const vector<string> &prefixes) {
+  for (const string &arg : globals->options->host_jvm_args) {
+    for (const string &prefix : prefixes) {
+      if (arg.compare(0, prefix.size(), prefix) == 0) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static string GetServerPeakMemoryFile() {
+  return blaze_util::JoinPath(globals->options->output_base,
+                              "server_peak_memory");
+}
+
+// Returns the peak memory in bytes the servers of this output base were seen
+// using, or 0 if none was recorded.
+static uint64_t ReadServerPeakMemory() {
+  string content;
+  if (!ReadFile(GetServerPeakMemoryFile(), &content)) {
+    return 0;
+  }
+  return strtoull(content.c_str(), NULL, 10);
+}
+
+// Records the peak memory of the running server, so that the next server of
+// this output base gets a heap large enough for what this one needed. The
+// file is only rewritten when the peak grew noticeably.
+static void RecordServerPeakMemory() {
+  if (!globals->options->server_auto_jvm_args || globals->server_pid <= 0) {
+    return;
+  }
+  uint64_t peak = GetProcessPeakMemory(globals->server_pid);
+  uint64_t recorded = ReadServerPeakMemory();
+  if (peak > recorded + recorded / 16) {
+    WriteFile(ToString(peak), GetServerPeakMemoryFile());
+  }
+}
+
+// Returns the heap size and garbage collector arguments fitted to the memory
+// and CPUs this process may use, honoring cgroup limits. The heap gets a
+// quarter of the memory, more if a previous server peaked higher, but never
+// more than half. The peak is of the whole process, not only of its heap, so
+// this errs on the large side. Whatever --host_jvm_args sets is left alone.
+static vector<string> GetAutoJvmArgs() {
+  vector<string> args;
+  if (!globals->options->server_auto_jvm_args) {
+    return args;
+  }
+
+  uint64_t memory = GetAvailableMemory();
+  if (memory > 0 &&
+      !HasHostJvmArg({"-Xmx", "-XX:MaxHeapSize=", "-XX:MaxRAM"})) {
+    uint64_t heap = std::min(std::max(memory / 4, ReadServerPeakMemory()),
+                             memory / 2);
+    args.push_back("-Xmx" + ToString(heap >> 20) + "m");
+  }
+
+  int cpus = GetAvailableCpus();
+  if (cpus > 0 &&
+      !HasHostJvmArg({"-XX:+UseSerialGC", "-XX:+UseParallelGC",
+                      "-XX:+UseParallelOldGC", "-XX:+UseConcMarkSweepGC",
+                      "-XX:+UseG1GC", "-XX:+UseZGC", "-XX:+UseShenandoahGC",
+                      "-XX:+UseEpsilonGC"})) {
+    if (cpus < 2) {
+      args.push_back("-XX:+UseSerialGC");
+    } else if (JvmMajorVersion(GetCachedJvmVersion(globals->jvm_path)) >= 9) {
+      args.push_back("-XX:+UseG1GC");
+    } else {
+      args.push_back("-XX:+UseParallelGC");
+    }
+  }
+  // The JVM sizes this from the CPUs of the machine, not of the cgroup.
+  if (cpus >= 2 && !HasHostJvmArg({"-XX:ParallelGCThreads="})) {
+    int threads = cpus <= 8 ? cpus : 8 + (cpus - 8) * 5 / 8;
+    args.push_back("-XX:ParallelGCThreads=" + ToString(threads));
+  }
+  return args;
+}
+
+// Returns the JVM arguments for a class data sharing archive of the classes
+// the server loads, which speeds up its startup. The archive is built over
+// consecutive server starts: the first records the classes it loads, the
+// second dumps them into an archive in the background and the later ones
+// use the archive. Everything is kept in <output_base>/cds and started over
+// when the install base or the JVM changes. This needs application class
+// data sharing, i.e. JDK 11 or later.
+static vector<string> GetClassDataSharingArgs() {
+  vector<string> args;
+  string jvm_version = GetCachedJvmVersion(globals->jvm_path);
+  if (JvmMajorVersion(jvm_version) < 11) {
+    return args;
+  }
+
+  string cds_dir = blaze_util::JoinPath(globals->options->output_base, "cds");
+  string key_file = blaze_util::JoinPath(cds_dir, "key");
+  string class_list = blaze_util::JoinPath(cds_dir, "classes.lst");
+  string archive = blaze_util::JoinPath(cds_dir, "server.jsa");
+  string dump_failed = blaze_util::JoinPath(cds_dir, "dump_failed");
+  string key = globals->install_md5 + "\n" + globals->jvm_path + "\n" +
+               jvm_version + "\n";
+  string recorded_key;
+  if (!ReadFile(key_file, &recorded_key) || recorded_key != key) {
+    UnlinkPath(class_list);
+    UnlinkPath(archive);
+    UnlinkPath(dump_failed);
+    if (MakeDirectories(cds_dir, 0755) == -1 || !WriteFile(key, key_file)) {
+      return args;
+    }
+  }
+
+  struct stat buf;
+  if (stat(dump_failed.c_str(), &buf) == 0) {
+    // The JVM cannot create the archive, do not try again with it.
+  } else if (stat(archive.c_str(), &buf) == 0) {
+    args.push_back("-Xshare:auto");
+    args.push_back("-XX:SharedArchiveFile=" + archive);
+  } else if (stat(class_list.c_str(), &buf) == 0) {
+    // The archive is written to a temporary file and only renamed into place
+    // when it is complete.
+    string jar = blaze::ConvertPath(blaze_util::JoinPath(
+        blaze_util::JoinPath(globals->options->install_base,
+                             "_embedded_binaries"),
+        globals->extracted_binaries[0]));
+    vector<string> dump_args = {
+        "sh", "-c",
+        "tmp=$1 out=$2 failed=$3; shift 3; "
+        "if \"$@\"; then mv -f \"$tmp\" \"$out\"; "
+        "else rm -f \"$tmp\"; : > \"$failed\"; fi",
+        "sh", archive + "." + ToString(getpid()), archive, dump_failed,
+        globals->jvm_path, "-Xshare:dump",
+        "-XX:SharedClassListFile=" + class_list,
+        "-XX:SharedArchiveFile=" + archive + "." + ToString(getpid()),
+        "-cp", jar};
+    ExecuteInBackground("/bin/sh", dump_args,
+                        blaze_util::JoinPath(cds_dir, "dump.log"));
+  } else {
+    args.push_back("-XX:DumpLoadedClassList=" + class_list);
+  }
+  return args;
+}
+
+// Marks the output and install bases as not to be indexed again, in case the
+// marks were removed since they were created, and warns if desktop search
+// indexes them anyway: their files change all the time during builds, and
+// indexing them competes with the build for the disk and the CPU.
+static void CheckOutputTreeIndexing() {
+  const string bases[] = {globals->options->output_base,
+                          globals->options->install_base};
+  for (const string &base : bases) {
+    ExcludePathFromIndexing(base);
+    if (IsPathIndexed(base)) {
+      fprintf(stderr,
+              "WARNING: '%s' is indexed by desktop search, which slows down "
+              "builds. Consider excluding it (e.g. in the Privacy settings "
+              "of Spotlight).\n",
+              base.c_str());
+    }
+  }
+}
+
 // Starts the Blaze server.  Returns a readable fd connected to the server.
 // This is currently used only to detect liveness.
 static void StartServer(BlazeServerStartup** server_startup) {
@@ -651,6 +1139,18 @@ static void StartServer(BlazeServerStartup** server_startup) {
   // file stays there, but that is not a problem, since we always check the
   // server, too.
   WriteFile(argument_string, server_dir + "/cmdline");
+  WriteFile(GetStartupConfigurationDigest(jvm_args_vector),
+            server_dir + "/cmdline.md5");
+
+  // These change from one start to the next, so they are not part of
+  // GetArgumentArray(), which is compared to the cmdline file to decide
+  // whether the server has to be restarted.
+  vector<string> cds_args = GetClassDataSharingArgs();
+  jvm_args_vector.insert(jvm_args_vector.begin() + 1, cds_args.begin(),
+                         cds_args.end());
+  vector<string> auto_args = GetAutoJvmArgs();
+  jvm_args_vector.insert(jvm_args_vector.begin() + 1, auto_args.begin(),
+                         auto_args.end());
 
   // unless we restarted for a new-version, mark this as initial start
   if (globals->restart_reason == NO_RESTART) {
@@ -665,6 +1165,8 @@ static void StartServer(BlazeServerStartup** server_startup) {
 
   ExecuteDaemon(exe, jvm_args_vector, globals->jvm_log_file.c_str(),
                 server_dir, server_startup);
+  // While the server starts up.
+  CheckOutputTreeIndexing();
 }
 
 // Replace this process with blaze in standalone/batch mode.
@@ -700,6 +1202,9 @@ static void StartStandalone(BlazeServer* server) {
             globals->options->product_name.c_str(), product.c_str());
   }
   vector<string> jvm_args_vector = GetArgumentArray();
+  vector<string> auto_args = GetAutoJvmArgs();
+  jvm_args_vector.insert(jvm_args_vector.begin() + 1, auto_args.begin(),
+                         auto_args.end());
   if (command != "") {
     jvm_args_vector.push_back(command);
     AddLoggingArgs(&jvm_args_vector);
@@ -790,54 +1295,115 @@ static int ServerEof() {
   return GetExitCodeForAbruptExit(*globals);
 }
 
-// Reads a single char from the specified stream.
-static int ReadServerChar(int fd, unsigned char *result) {
-  if (read(fd, result, 1) != 1) {
-    return ServerEof();
-  }
-  return 0;
-}
-
-static int ReadServerInt(int fd, unsigned int *result) {
-  unsigned char buffer[4];
-  unsigned char *p = buffer;
-  int remaining = 4;
+// The response of the server, read in chunks so that the tags and lengths
+// do not take a read() each.
+struct ServerInput {
+  explicit ServerInput(int fd) : fd(fd), begin(0), end(0) {
+    forward_in_kernel[STDOUT_FILENO] = true;
+    forward_in_kernel[STDERR_FILENO] = true;
+  }
+
+  int fd;
+  // The bytes read but not consumed yet are [begin, end).
+  size_t begin;
+  size_t end;
+  // Whether the output to stdout and stderr can be forwarded with
+  // ForwardSocketData().
+  bool forward_in_kernel[3];
+  char buffer[65536];
+};
 
-  while (remaining > 0) {
-    int bytes_read = read(fd, p, remaining);
+// The outputs shorter than this are read and written, as the two system calls
+// the forwarding within the kernel can take are not worth it.
+static const size_t kMinForwardInKernel = 16384;
+
+// Reads more bytes into the buffer, so that it holds at least "count" bytes.
+static int FillServerInput(ServerInput *input, size_t count) {
+  if (input->begin > 0) {
+    memmove(input->buffer, input->buffer + input->begin,
+            input->end - input->begin);
+    input->end -= input->begin;
+    input->begin = 0;
+  }
+  while (input->end < count) {
+    ssize_t bytes_read = read(input->fd, input->buffer + input->end,
+                              sizeof(input->buffer) - input->end);
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
     if (bytes_read <= 0) {
       return ServerEof();
     }
+    input->end += bytes_read;
+  }
+  return 0;
+}
 
-    remaining -= bytes_read;
-    p += bytes_read;
+// Reads a single char from the server.
+static int ReadServerChar(ServerInput *input, unsigned char *result) {
+  if (input->begin == input->end) {
+    int exit_code = FillServerInput(input, 1);
+    if (exit_code != 0) {
+      return exit_code;
+    }
   }
+  *result = input->buffer[input->begin++];
+  return 0;
+}
 
+static int ReadServerInt(ServerInput *input, unsigned int *result) {
+  if (input->end - input->begin < 4) {
+    int exit_code = FillServerInput(input, 4);
+    if (exit_code != 0) {
+      return exit_code;
+    }
+  }
+  const unsigned char *buffer =
+      reinterpret_cast<unsigned char *>(input->buffer + input->begin);
   *result = (buffer[0] << 24) + (buffer[1] << 16) + (buffer[2] << 8)
       + buffer[3];
+  input->begin += 4;
   return 0;
 }
 
-static char server_output_buffer[8192];
-
-// Forwards the output of the server to the specified file handle.
-static int ForwardServerOutput(int socket, int output) {
+// Forwards the output of the server to the specified file handle. The
+// output not read yet is moved within the kernel when possible, e.g. to a
+// pipe.
+static int ForwardServerOutput(ServerInput *input, int output) {
   unsigned int remaining;
-  int exit_code = ReadServerInt(socket, &remaining);
+  int exit_code = ReadServerInt(input, &remaining);
   if (exit_code != 0) {
     return exit_code;
   }
   while (remaining > 0) {
-    int bytes = remaining > 8192 ? 8192 : remaining;
-    bytes = read(socket, server_output_buffer, bytes);
-    if (bytes <= 0) {
-      return ServerEof();
+    if (input->begin == input->end) {
+      if (remaining >= kMinForwardInKernel &&
+          input->forward_in_kernel[output]) {
+        ssize_t bytes = ForwardSocketData(input->fd, output, remaining);
+        if (bytes > 0) {
+          remaining -= bytes;
+          continue;
+        } else if (bytes == 0) {
+          return ServerEof();
+        } else if (errno != EINTR) {
+          // Not supported for this output, e.g. a terminal.
+          input->forward_in_kernel[output] = false;
+        }
+        continue;
+      }
+      exit_code = FillServerInput(input, 1);
+      if (exit_code != 0) {
+        return exit_code;
+      }
     }
 
-    remaining -= bytes;
-    if (write(output, server_output_buffer, bytes) != bytes) {
+    size_t bytes = std::min<size_t>(remaining, input->end - input->begin);
+    if (write(output, input->buffer + input->begin, bytes) !=
+        static_cast<ssize_t>(bytes)) {
       // Not much we can do if this doesn't work, just placate the compiler.
     }
+    input->begin += bytes;
+    remaining -= bytes;
   }
 
   return 0;
@@ -847,6 +1413,7 @@ unsigned int AfUnixBlazeServer::Communicate() {
   assert(connected_);
 
   const string request = BuildServerRequest();
+  const uint64_t request_time = MonotonicClock();
 
   // Send request (Request is written in a single chunk.)
   char request_size[4];
@@ -863,19 +1430,19 @@ unsigned int AfUnixBlazeServer::Communicate() {
   }
 
   // Wait until we receive some response from the server.
-  // (We do this by calling select() with a timeout.)
+  // (We do this by calling poll() with a timeout; unlike select(), it works
+  // with any file descriptor number.)
   // If we don't receive a response within 3 seconds, print a message,
   // so that the user has some idea what is going on.
   while (true) {
-    fd_set fdset;
-    FD_ZERO(&fdset);
-    FD_SET(server_socket_, &fdset);
-    struct timeval timeout;
-    timeout.tv_sec = 3;
-    timeout.tv_usec = 0;
-    int result = select(server_socket_ + 1, &fdset, NULL, &fdset, &timeout);
+    struct pollfd pfd;
+    pfd.fd = server_socket_;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int result = poll(&pfd, 1, 3000);
     if (result > 0) {
-      // Data is ready on socket.  Go ahead and read it.
+      // Data is ready on socket (or it is closed).  Go ahead and read it.
+      EndStartupPhase("first_response", request_time);
       break;
     } else if (result == 0) {
       // Timeout.  Print a message, then go ahead and read from
@@ -888,12 +1455,13 @@ unsigned int AfUnixBlazeServer::Communicate() {
       // Error.  For EINTR we try again, all other errors are fatal.
       if (errno != EINTR) {
         pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
-             "select() on server socket failed");
+             "poll() on server socket failed");
       }
     }
   }
 
   // Read and demux the response.
+  ServerInput input(server_socket_);
   const int TAG_STDOUT = 1;
   const int TAG_STDERR = 2;
   const int TAG_CONTROL = 3;
@@ -901,7 +1469,7 @@ unsigned int AfUnixBlazeServer::Communicate() {
   for (;;) {
     // Read the tag
     unsigned char tag;
-    exit_code = ReadServerChar(server_socket_, &tag);
+    exit_code = ReadServerChar(&input, &tag);
     if (exit_code != 0) {
       return exit_code;
     }
@@ -909,7 +1477,7 @@ unsigned int AfUnixBlazeServer::Communicate() {
     switch (tag) {
       // stdout
       case TAG_STDOUT:
-        exit_code = ForwardServerOutput(server_socket_, STDOUT_FILENO);
+        exit_code = ForwardServerOutput(&input, STDOUT_FILENO);
         if (exit_code != 0) {
           return exit_code;
         }
@@ -917,7 +1485,7 @@ unsigned int AfUnixBlazeServer::Communicate() {
 
       // stderr
       case TAG_STDERR:
-        exit_code = ForwardServerOutput(server_socket_, STDERR_FILENO);
+        exit_code = ForwardServerOutput(&input, STDERR_FILENO);
         if (exit_code != 0) {
           return exit_code;
         }
@@ -926,7 +1494,7 @@ unsigned int AfUnixBlazeServer::Communicate() {
       // Control stream. Currently only used for reporting the exit code.
       case TAG_CONTROL:
         unsigned int length;
-        exit_code = ReadServerInt(server_socket_, &length);
+        exit_code = ReadServerInt(&input, &length);
         if (exit_code != 0) {
           // We cannot read the length field. The return value of ReadSeverInt()
           // is the result of ServerEof(), so we bail out early so that we don't
@@ -938,7 +1506,7 @@ unsigned int AfUnixBlazeServer::Communicate() {
           return ServerEof();
         }
         unsigned int server_exit_code;
-        exit_code = ReadServerInt(server_socket_, &server_exit_code);
+        exit_code = ReadServerInt(&input, &server_exit_code);
         return exit_code != 0 ? exit_code : server_exit_code;
 
       default:
@@ -1008,6 +1576,19 @@ static int GetServerPid(const string &server_dir) {
   return result;
 }
 
+// Applies the scheduling startup options to this process, so that the server
+// (or the batch mode JVM) started from it inherits them.
+static void SetServerScheduling() {
+  SetScheduling(globals->options->batch_cpu_scheduling,
+                globals->options->io_nice_level);
+  SetCgroup(globals->options->server_cgroup,
+            globals->options->server_cgroup_settings);
+  SetCpuAffinity(globals->options->server_cpu_affinity);
+  if (globals->options->server_numa_interleave) {
+    SetNumaInterleave();
+  }
+}
+
 // Starts up a new server and connects to it. Exits if it didn't work not.
 static void StartServerAndConnect(BlazeServer *server) {
   string server_dir = globals->options->output_base + "/server";
@@ -1035,25 +1616,51 @@ static void StartServerAndConnect(BlazeServer *server) {
     }
   }
 
-  SetScheduling(globals->options->batch_cpu_scheduling,
-                globals->options->io_nice_level);
+  SetServerScheduling();
 
+  // The server is ready when it has written its command_port file (or
+  // created its socket), so where it is possible, the client is woken up as
+  // soon as a file appears in the server directory instead of polling.
+  int watch_fd = WatchDirectory(server_dir);
   BlazeServerStartup* server_startup;
+  uint64_t phase_start = MonotonicClock();
   StartServer(&server_startup);
-  // Give the server one minute to start up.
-  for (int ii = 0; ii < 600; ++ii) {
-    // 60s; enough time to connect with debugger
+  phase_start = EndStartupPhase("start_server", phase_start);
+  // Give the server one minute to start up; enough time to connect with a
+  // debugger. A dot is printed for every second waited.
+  uint64_t start_time = MonotonicClock();
+  uint64_t seconds_waited = 0;
+  for (;;) {
     if (server->Connect()) {
-      if (ii) {
+      EndStartupPhase("wait_for_server", phase_start);
+      if (seconds_waited) {
         fputc('\n', stderr);
         fflush(stderr);
       }
+      if (watch_fd >= 0) {
+        close(watch_fd);
+      }
       delete server_startup;
       return;
     }
-    fputc('.', stderr);
-    fflush(stderr);
-    poll(NULL, 0, 1000);  // sleep 100ms.  (usleep(3) is obsolete.)
+    uint64_t elapsed_seconds = (MonotonicClock() - start_time) / 1000000000LL;
+    if (elapsed_seconds >= 60) {
+      break;
+    }
+    for (; seconds_waited < elapsed_seconds; ++seconds_waited) {
+      fputc('.', stderr);
+      fflush(stderr);
+    }
+    if (watch_fd >= 0) {
+      struct pollfd watch = {watch_fd, POLLIN, 0};
+      if (poll(&watch, 1, 100) > 0) {
+        char events[4096];
+        while (read(watch_fd, events, sizeof(events)) > 0) {
+        }
+      }
+    } else {
+      poll(NULL, 0, 100);  // sleep 100ms.  (usleep(3) is obsolete.)
+    }
     if (!server_startup->IsStillAlive()) {
       fprintf(stderr, "\nunexpected pipe read status: %s\n"
           "Server presumed dead. Now printing '%s':\n",
@@ -1067,9 +1674,20 @@ static void StartServerAndConnect(BlazeServer *server) {
       socket_file.c_str());
 }
 
-// Poll until the given process denoted by pid goes away. Return false if this
+// Wait until the given process denoted by pid goes away. Return false if this
 // does not occur within wait_time_secs.
 static bool WaitForServerDeath(pid_t pid, int wait_time_secs) {
+  int process_fd = OpenProcessDescriptor(pid);
+  if (process_fd != -1) {
+    // Readable as soon as the process terminates, no need to poll.
+    struct pollfd pfd = {process_fd, POLLIN, 0};
+    int result;
+    while ((result = poll(&pfd, 1, wait_time_secs * 1000)) == -1 &&
+           errno == EINTR) {
+    }
+    close(process_fd);
+    return result == 1;
+  }
   for (int ii = 0; ii < wait_time_secs * 10; ++ii) {
     if (kill(pid, 0) == -1) {
       if (errno == ESRCH) {
@@ -1134,69 +1752,220 @@ static void SyncFile(const char *file_path) {
 #endif
 }
 
-// Walks the temporary directory recursively and collects full file paths.
-static void CollectExtractedFiles(const string &dir_path, vector<string> &files) {
-  DIR *dir;
-  struct dirent *ent;
-
-  if ((dir = opendir(dir_path.c_str())) == NULL) {
-    die(blaze_exit_code::INTERNAL_ERROR, "opendir failed");
+// A devtools_ijar::ZipExtractorProcessor to extract the files from the blaze
+// zip.
+//
+// The files are inflated and written by a pool of threads, the directories
+// are created by the thread reading the zip before the files in them are
+// handed out. The stored files (e.g., the jars) are copied from the zip by
+// the kernel where it can, which on file systems that share data between
+// files writes none of it. Each file gets the given modification time before
+// it is closed. Call Finish() once the whole zip has been processed.
+class ExtractBlazeZipProcessor : public devtools_ijar::ZipExtractorProcessor {
+ public:
+  ExtractBlazeZipProcessor(const string &zip_path,
+                           const string &embedded_binaries, int threads,
+                           time_t mtime)
+      : embedded_binaries_(embedded_binaries),
+        mtime_(mtime),
+        max_pending_(4 * threads),
+        zip_fd_(open(zip_path.c_str(), O_RDONLY)),
+        finishing_(false) {
+    if (threads > 1) {
+      for (int i = 0; i < threads; ++i) {
+        writers_.emplace_back(&ExtractBlazeZipProcessor::WriteLoop, this);
+      }
+    }
   }
 
-  while ((ent = readdir(dir)) != NULL) {
-    if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
-      continue;
+  virtual ~ExtractBlazeZipProcessor() {
+    Finish();
+    if (zip_fd_ >= 0) {
+      close(zip_fd_);
     }
+  }
 
-    string filename(blaze_util::JoinPath(dir_path, ent->d_name));
-    bool is_directory;
-    if (ent->d_type == DT_UNKNOWN) {
-      struct stat buf;
-      if (lstat(filename.c_str(), &buf) == -1) {
-        die(blaze_exit_code::INTERNAL_ERROR, "stat failed");
-      }
-      is_directory = S_ISDIR(buf.st_mode);
+  virtual bool Accept(const char *filename, const devtools_ijar::u4 attr) {
+    return !devtools_ijar::zipattr_is_dir(attr);
+  }
+
+  virtual void Process(const char *filename, const devtools_ijar::u4 attr,
+                       const devtools_ijar::u1 *data, const size_t size) {
+    string path = NewFile(filename);
+    if (writers_.empty()) {
+      WriteFile(path, data, size);
     } else {
-      is_directory = (ent->d_type == DT_DIR);
+      Submit(new Job(path, data, size, false, size));
     }
+  }
 
-    if (is_directory) {
-      CollectExtractedFiles(filename, files);
+  virtual bool ProcessCompressed(const char *filename,
+                                 const devtools_ijar::u4 attr,
+                                 const devtools_ijar::u1 *data,
+                                 const size_t compressed_size,
+                                 const size_t uncompressed_size) {
+    if (writers_.empty()) {
+      return false;
+    }
+    // The data is copied, it is only valid during the call.
+    Submit(new Job(NewFile(filename), data, compressed_size, true,
+                   uncompressed_size));
+    return true;
+  }
+
+  virtual bool ProcessStored(const char *filename,
+                             const devtools_ijar::u4 attr,
+                             const devtools_ijar::u8 offset,
+                             const size_t size) {
+    if (zip_fd_ < 0) {
+      return false;
+    }
+    string path = NewFile(filename);
+    if (writers_.empty()) {
+      CopyFile(path, offset, size);
     } else {
-      files.push_back(filename);
+      Job *job = new Job(path, NULL, 0, false, size);
+      job->zip_offset = offset;
+      Submit(job);
     }
+    return true;
   }
 
-  closedir(dir);
-}
+  // Waits for the files to be written.
+  void Finish() {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      finishing_ = true;
+    }
+    submitted_cond_.notify_all();
+    for (auto &writer : writers_) {
+      writer.join();
+    }
+    writers_.clear();
+  }
 
-// A devtools_ijar::ZipExtractorProcessor to extract the files from the blaze
-// zip.
-class ExtractBlazeZipProcessor : public devtools_ijar::ZipExtractorProcessor {
- public:
-  explicit ExtractBlazeZipProcessor(const string &embedded_binaries)
-      : embedded_binaries_(embedded_binaries) {}
+  // The paths of the extracted files and of the directories created for
+  // them below embedded_binaries.
+  const vector<string> &files() const { return files_; }
+  const set<string> &directories() const { return directories_; }
 
-  virtual bool Accept(const char *filename, const devtools_ijar::u4 attr) {
-    return !devtools_ijar::zipattr_is_dir(attr);
+ private:
+  struct Job {
+    Job(const string &path, const devtools_ijar::u1 *data, size_t length,
+        bool compressed, size_t size)
+        : path(path), data(data, data + length), compressed(compressed),
+          size(size), zip_offset(-1) {}
+    string path;
+    vector<devtools_ijar::u1> data;  // Deflated if "compressed".
+    bool compressed;
+    size_t size;  // The uncompressed size recorded in the zip.
+    // If not -1, the data is not in "data", it is copied from this offset
+    // in the zip.
+    off_t zip_offset;
+  };
+
+  // Creates the directories for the file, returns its path.
+  string NewFile(const char *filename) {
+    string path = blaze_util::JoinPath(embedded_binaries_, filename);
+    string directory = blaze_util::Dirname(path);
+    if (directory != embedded_binaries_ &&
+        directories_.count(directory) == 0) {
+      if (MakeDirectories(directory, 0777) == -1) {
+        pdie(blaze_exit_code::INTERNAL_ERROR,
+             "couldn't create '%s'", path.c_str());
+      }
+      // Record the directory and its parents up to embedded_binaries.
+      while (directory != embedded_binaries_ && !directory.empty() &&
+             directory != "/" &&
+             directories_.insert(directory).second) {
+        directory = blaze_util::Dirname(directory);
+      }
+    }
+    files_.push_back(path);
+    return path;
+  }
+
+  // Queues the job, waiting if too many are pending.
+  void Submit(Job *job) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    taken_cond_.wait(lock, [this] { return jobs_.size() < max_pending_; });
+    jobs_.emplace_back(job);
+    submitted_cond_.notify_one();
+  }
+
+  void WriteLoop() {
+    devtools_ijar::Inflater inflater;
+    vector<devtools_ijar::u1> inflated;
+    for (;;) {
+      std::unique_ptr<Job> job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        submitted_cond_.wait(lock,
+                             [this] { return finishing_ || !jobs_.empty(); });
+        if (jobs_.empty()) {
+          return;
+        }
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+      taken_cond_.notify_one();
+      if (job->zip_offset >= 0) {
+        CopyFile(job->path, job->zip_offset, job->size);
+      } else if (!job->compressed) {
+        WriteFile(job->path, job->data.data(), job->data.size());
+      } else if (inflater.Inflate(job->data.data(), job->data.size(),
+                                  job->size, &inflated)) {
+        WriteFile(job->path, inflated.data(), inflated.size());
+      } else {
+        die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+            "\nFailed to inflate %s", job->path.c_str());
+      }
+    }
   }
 
-  virtual void Process(const char *filename, const devtools_ijar::u4 attr,
-                       const devtools_ijar::u1 *data, const size_t size) {
-    string path = blaze_util::JoinPath(embedded_binaries_, filename);
-    if (MakeDirectories(blaze_util::Dirname(path), 0777) == -1) {
-      pdie(blaze_exit_code::INTERNAL_ERROR,
-           "couldn't create '%s'", path.c_str());
+  void WriteFile(const string &path, const devtools_ijar::u1 *data,
+                 size_t size) {
+    int fd = OpenFile(path);
+    if (write(fd, data, size) != size) {
+      die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+          "\nError writing zipped file to %s", path.c_str());
+    }
+    CloseFile(path, fd);
+  }
+
+  // Writes the "size" bytes at "offset" in the zip to the file.
+  void CopyFile(const string &path, off_t offset, size_t size) {
+    int fd = OpenFile(path);
+    if (!CopyFileRange(zip_fd_, offset, fd, size)) {
+      // Start over, reading the data.
+      vector<devtools_ijar::u1> data(size);
+      ssize_t expected = size;
+      if (pread(zip_fd_, data.data(), size, offset) != expected ||
+          ftruncate(fd, 0) == -1 || lseek(fd, 0, SEEK_SET) == -1 ||
+          write(fd, data.data(), size) != expected) {
+        die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+            "\nError writing zipped file to %s", path.c_str());
+      }
     }
+    CloseFile(path, fd);
+  }
+
+  int OpenFile(const string &path) {
     int fd = open(path.c_str(), O_CREAT | O_WRONLY, 0755);
     if (fd < 0) {
       die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
           "\nFailed to open extraction file: %s", strerror(errno));
     }
+    return fd;
+  }
 
-    if (write(fd, data, size) != size) {
-      die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
-          "\nError writing zipped file to %s", path.c_str());
+  void CloseFile(const string &path, int fd) {
+    // Set the time while the file is still open, rather than looking it up
+    // again by its path.
+    struct timeval times[2] = {{mtime_, 0}, {mtime_, 0}};
+    if (futimes(fd, times) == -1) {
+      pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+           "failed to set timestamp on '%s'", path.c_str());
     }
     if (close(fd) != 0) {
       die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
@@ -1204,15 +1973,52 @@ class ExtractBlazeZipProcessor : public devtools_ijar::ZipExtractorProcessor {
     }
   }
 
- private:
   const string embedded_binaries_;
+  const time_t mtime_;
+  const size_t max_pending_;
+  // The zip the stored files are copied from, -1 if it cannot be opened.
+  const int zip_fd_;
+  vector<string> files_;
+  set<string> directories_;
+
+  std::deque<std::unique_ptr<Job> > jobs_;
+  bool finishing_;
+  std::mutex mutex_;
+  std::condition_variable submitted_cond_;
+  std::condition_variable taken_cond_;
+  vector<std::thread> writers_;
 };
 
+// Makes the path readable (and searchable) by everyone, and writable by no
+// one.
+static void MakeReadOnly(const string &path) {
+  if (chmod(path.c_str(), 0555) == -1) {
+    pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+         "failed to make '%s' read-only", path.c_str());
+  }
+}
+
 // Actually extracts the embedded data files into the tree whose root
-// is 'embedded_binaries'.
+// is 'embedded_binaries'. With "read_only", the files and directories are
+// made readable by everyone and writable by no one, whatever the umask.
 static void ActuallyExtractData(const string &argv0,
-                                const string &embedded_binaries) {
-  ExtractBlazeZipProcessor processor(embedded_binaries);
+                                const string &embedded_binaries,
+                                bool read_only) {
+  // Set the time of the extracted files to a distantly futuristic value so
+  // we can observe tampering.
+  // Note that keeping the default timestamp set by unzip (1970-01-01) and using
+  // that to detect tampering is not enough, because we also need the timestamp
+  // to change between Blaze releases so that the metadata cache knows that
+  // the files may have changed. This is important for actions that use
+  // embedded binaries as artifacts.
+  const time_t TEN_YEARS_IN_SEC = 3600 * 24 * 365 * 10;
+  time_t future_time = time(NULL) + TEN_YEARS_IN_SEC;
+
+  // Writing the files is mostly waiting for the disk, so there is no point
+  // in more threads than that.
+  int threads = std::min(8U, std::max(1U, std::thread::hardware_concurrency()));
+  ExtractBlazeZipProcessor processor(argv0, embedded_binaries, threads,
+                                     future_time);
   if (MakeDirectories(embedded_binaries, 0777) == -1) {
     pdie(blaze_exit_code::INTERNAL_ERROR, "couldn't create '%s'",
          embedded_binaries.c_str());
@@ -1232,55 +2038,31 @@ static void ActuallyExtractData(const string &argv0,
         "\nFailed to extract %s as a zip file: %s",
         globals->options->product_name.c_str(), extractor->GetError());
   }
+  processor.Finish();
 
-  const time_t TEN_YEARS_IN_SEC = 3600 * 24 * 365 * 10;
-  time_t future_time = time(NULL) + TEN_YEARS_IN_SEC;
-
-  // Set the timestamps of the extracted files to the future and make sure (or
-  // at least as sure as we can...) that the files we have written are actually
-  // on the disk.
-
-  vector<string> extracted_files;
-  CollectExtractedFiles(embedded_binaries, extracted_files);
-
-  set<string> synced_directories;
-  for (vector<string>::iterator it = extracted_files.begin(); it != extracted_files.end(); it++) {
-
-    const char *extracted_path = it->c_str();
-
-    // Set the time to a distantly futuristic value so we can observe tampering.
-    // Note that keeping the default timestamp set by unzip (1970-01-01) and using
-    // that to detect tampering is not enough, because we also need the timestamp
-    // to change between Blaze releases so that the metadata cache knows that
-    // the files may have changed. This is important for actions that use
-    // embedded binaries as artifacts.
-    struct utimbuf times = { future_time, future_time };
-    if (utime(extracted_path, &times) == -1) {
-      pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
-           "failed to set timestamp on '%s'", extracted_path);
+  if (read_only) {
+    for (const string &file : processor.files()) {
+      MakeReadOnly(file);
     }
+    for (const string &directory : processor.directories()) {
+      MakeReadOnly(directory);
+    }
+    MakeReadOnly(embedded_binaries);
+  }
 
-    SyncFile(extracted_path);
-
-    string directory = blaze_util::Dirname(extracted_path);
-
-    // Now walk up until embedded_binaries and sync every directory in between.
-    // synced_directories is used to avoid syncing the same directory twice.
-    // The !directory.empty() and directory != "/" conditions are not strictly
-    // needed, but it makes this loop more robust, because otherwise, if due to
-    // some glitch, directory was not under embedded_binaries, it would get
-    // into an infinite loop.
-    while (directory != embedded_binaries &&
-           synced_directories.count(directory) == 0 &&
-           !directory.empty() &&
-           directory != "/") {
+  // Make sure (or at least as sure as we can...) that the files we have
+  // written are actually on the disk. Syncing the whole file system at once
+  // is much faster than syncing every file and directory, where it is
+  // possible.
+  if (!SyncFileSystem(embedded_binaries)) {
+    for (const string &file : processor.files()) {
+      SyncFile(file.c_str());
+    }
+    for (const string &directory : processor.directories()) {
       SyncFile(directory.c_str());
-      synced_directories.insert(directory);
-      directory = blaze_util::Dirname(directory);
     }
+    SyncFile(embedded_binaries.c_str());
   }
-
-  SyncFile(embedded_binaries.c_str());
 }
 
 // Installs Blaze by extracting the embedded data files, iff necessary.
@@ -1288,7 +2070,8 @@ static void ActuallyExtractData(const string &argv0,
 // no-one has modified the extracted files beneath this directory once
 // it is in place. Concurrency during extraction is handled by
 // extracting in a tmp dir and then renaming it into place where it
-// becomes visible automically at the new path.
+// becomes visible automically at the new path. A shared install base is
+// extracted the same way, read-only, so that the other users can trust it.
 // Populates globals->extracted_binaries with their extracted locations.
 static void ExtractData(const string &self_path) {
   // If the install dir doesn't exist, create it, if it does, we know it's good.
@@ -1299,20 +2082,54 @@ static void ExtractData(const string &self_path) {
     string tmp_install = globals->options->install_base + ".tmp." +
         ToString(getpid());
     string tmp_binaries = tmp_install + "/_embedded_binaries";
-    ActuallyExtractData(self_path, tmp_binaries);
+    // Running "java -version" for VerifyJavaVersionAndSetJvm() takes about
+    // as long as starting a JVM, so it is done while the files are written.
+    std::thread jvm_version_probe;
+    if (std::find(globals->extracted_binaries.begin(),
+                  globals->extracted_binaries.end(),
+                  "java.version") != globals->extracted_binaries.end()) {
+      string exe = globals->options->GetJvm();
+      jvm_version_probe = std::thread([exe] {
+        known_jvm_version = GetCachedJvmVersion(exe);
+        jvm_version_known = true;
+      });
+    }
+    ActuallyExtractData(self_path, tmp_binaries,
+                        globals->shared_install_base);
+    ExcludePathFromIndexing(tmp_install);
+    if (globals->shared_install_base) {
+      MakeReadOnly(tmp_install);
+    }
 
     uint64_t et = MonotonicClock();
     globals->extract_data_time = (et - st) / 1000000LL;
+    if (jvm_version_probe.joinable()) {
+      jvm_version_probe.join();
+    }
 
     // Now rename the completed installation to its final name. If this
     // fails due to an ENOTEMPTY then we assume another good
-    // installation snuck in before us.
+    // installation snuck in before us. In a shared install root with the
+    // sticky bit, replacing one extracted by another user fails with EPERM
+    // instead.
     if (rename(tmp_install.c_str(), globals->options->install_base.c_str()) == -1
-        && errno != ENOTEMPTY) {
+        && errno != ENOTEMPTY &&
+        !(globals->shared_install_base && errno == EPERM)) {
       pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
            "install base directory '%s' could not be renamed into place",
            tmp_install.c_str());
     }
+    // The shared one that snuck in may not be trustworthy, the user's own
+    // install base is used then.
+    if (globals->shared_install_base &&
+        (lstat(globals->options->install_base.c_str(), &buf) == -1 ||
+         !IsTrustedInstallBase(buf))) {
+      WarnUntrustedInstallBase(globals->options->install_base);
+      globals->options->install_base = globals->options->output_user_root +
+                                       "/install/" + globals->install_md5;
+      globals->shared_install_base = false;
+      ExtractData(self_path);
+    }
   } else {
     if (!S_ISDIR(buf.st_mode)) {
       die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
@@ -1386,19 +2203,31 @@ static void KillRunningServerIfDifferentStartupOptions(BlazeServer* server) {
   }
 
   string cmdline_path = globals->options->output_base + "/server/cmdline";
-  string joined_arguments;
-
-  // No, /proc/$PID/cmdline does not work, because it is limited to 4K. Even
-  // worse, its behavior differs slightly between kernels (in some, when longer
-  // command lines are truncated, the last 4 bytes are replaced with
-  // "..." + NUL.
-  ReadFile(cmdline_path, &joined_arguments);
-  vector<string> arguments = blaze_util::Split(joined_arguments, '\0');
-
-  // These strings contain null-separated command line arguments. If they are
-  // the same, the server can stay alive, otherwise, it needs shuffle off this
-  // mortal coil.
-  if (ServerNeedsToBeKilled(arguments, GetArgumentArray())) {
+  vector<string> argument_array = GetArgumentArray();
+
+  // The server started by this client stores the digest of its arguments,
+  // comparing that is cheaper than comparing the arguments one by one.
+  string server_digest;
+  bool needs_to_be_killed;
+  if (ReadFile(cmdline_path + ".md5", &server_digest)) {
+    needs_to_be_killed =
+        server_digest != GetStartupConfigurationDigest(argument_array);
+  } else {
+    string joined_arguments;
+
+    // No, /proc/$PID/cmdline does not work, because it is limited to 4K. Even
+    // worse, its behavior differs slightly between kernels (in some, when
+    // longer command lines are truncated, the last 4 bytes are replaced with
+    // "..." + NUL.
+    ReadFile(cmdline_path, &joined_arguments);
+    vector<string> arguments = blaze_util::Split(joined_arguments, '\0');
+
+    // These strings contain null-separated command line arguments. If they
+    // are the same, the server can stay alive, otherwise, it needs shuffle off
+    // this mortal coil.
+    needs_to_be_killed = ServerNeedsToBeKilled(arguments, argument_array);
+  }
+  if (needs_to_be_killed) {
     globals->restart_reason = NEW_OPTIONS;
     fprintf(stderr,
             "WARNING: Running %s server needs to be killed, because the "
@@ -1435,9 +2264,12 @@ static void EnsureCorrectRunningVersion(BlazeServer* server) {
            "failed to create installation symlink '%s'",
            installation_path.c_str());
     }
+    // The timestamp of a shared install base is not ours to set if someone
+    // else extracted it.
     const time_t time_now = time(NULL);
     struct utimbuf times = { time_now, time_now };
-    if (utime(globals->options->install_base.c_str(), &times) == -1) {
+    if (utime(globals->options->install_base.c_str(), &times) == -1 &&
+        !globals->shared_install_base) {
       pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
            "failed to set timestamp on '%s'",
            globals->options->install_base.c_str());
@@ -1602,8 +2434,77 @@ static void ComputeWorkspace() {
     pdie(blaze_exit_code::INTERNAL_ERROR, "getcwd() failed");
   }
   globals->cwd = MakeCanonical(cwdbuf);
-  globals->workspace = WorkspaceLayout::GetWorkspace(globals->cwd);
+
+  // Wrapper scripts that already know the workspace can skip the search.
+  const char *workspace = getenv("BAZEL_WORKSPACE");
+  if (workspace != NULL && *workspace != '\0') {
+    globals->workspace = MakeCanonical(workspace);
+    return;
+  }
+
+  // The cache lives in the default output user root: the startup options
+  // that could change it are only known once the workspace is.
+  const char *test_tmpdir = getenv("TEST_TMPDIR");
+  string product_name_lower = PRODUCT_NAME;
+  blaze_util::ToLower(&product_name_lower);
+  string cache_path = blaze_util::JoinPath(
+      blaze_util::JoinPath(
+          test_tmpdir != NULL ? MakeAbsolute(test_tmpdir) : GetOutputRoot(),
+          "_" + product_name_lower + "_" + GetUserName()),
+      "workspace_cache");
+  globals->workspace =
+      WorkspaceLayout::GetCachedWorkspace(globals->cwd, cache_path);
+}
+
+#if !defined(__CYGWIN__)
+// With --local_output_root, moves the default output base to local disk if the
+// output user root is on a network file system, where builds are slow and
+// file locking and timestamps are not to be trusted. The output base at its
+// usual place becomes a symlink to it, so that whatever looks for it there
+// still finds it. An existing output base at the usual place is kept.
+static void PlaceOutputBaseOnLocalDisk() {
+  const string &local_output_root = globals->options->local_output_root;
+  if (local_output_root.empty() ||
+      !IsNetworkFilesystem(globals->options->output_user_root)) {
+    return;
+  }
+
+  const string usual_output_base = globals->options->output_base;
+  struct stat buf;
+  if (lstat(usual_output_base.c_str(), &buf) == 0 && !S_ISLNK(buf.st_mode)) {
+    fprintf(stderr,
+            "WARNING: Output base '%s' is on a network file system. Remove it "
+            "(e.g. with 'clean --expunge') to have it created below "
+            "--local_output_root=%s instead.\n",
+            usual_output_base.c_str(), local_output_root.c_str());
+    return;
+  }
+
+  string product = globals->options->product_name;
+  blaze_util::ToLower(&product);
+  const string local_user_root = blaze_util::JoinPath(
+      local_output_root, "_" + product + "_" + GetUserName());
+  CreateSecureOutputRoot(local_user_root);
+  const string output_base = blaze_util::JoinPath(
+      local_user_root, blaze_util::Basename(usual_output_base));
+
+  string target;
+  if (!ReadDirectorySymlink(usual_output_base, &target) ||
+      target != output_base) {
+    // A stale symlink, e.g. to a local disk that has been wiped or to another
+    // --local_output_root. A concurrent client may be replacing it as well.
+    unlink(usual_output_base.c_str());
+    if (!SymlinkDirectories(output_base, usual_output_base) &&
+        (!ReadDirectorySymlink(usual_output_base, &target) ||
+         target != output_base)) {
+      fprintf(stderr, "WARNING: couldn't create symlink '%s' to the output "
+              "base '%s': %s\n", usual_output_base.c_str(),
+              output_base.c_str(), strerror(errno));
+    }
+  }
+  globals->options->output_base = output_base;
 }
+#endif  // !defined(__CYGWIN__)
 
 // Figure out the base directories based on embedded data, username, cwd, etc.
 // Sets globals->options->install_base, globals->options->output_base,
@@ -1622,6 +2523,12 @@ static void ComputeBaseDirectories(const string &self_path) {
     string install_user_root = globals->options->output_user_root + "/install";
     globals->options->install_base =
         GetInstallBase(install_user_root, self_path);
+    // A machine-wide one is extracted once for all the users.
+    string shared_install_base = GetSharedInstallBase();
+    if (!shared_install_base.empty()) {
+      globals->options->install_base = shared_install_base;
+      globals->shared_install_base = true;
+    }
   } else {
     // We call GetInstallBase anyway to populate extracted_binaries and
     // install_md5.
@@ -1632,6 +2539,7 @@ static void ComputeBaseDirectories(const string &self_path) {
 #if !defined(__CYGWIN__)
     globals->options->output_base = GetHashedBaseDir(
         globals->options->output_user_root, globals->workspace);
+    PlaceOutputBaseOnLocalDisk();
 #else
     globals->options->output_base = GetHashedBaseDirForWindows(
         blaze::GetOutputRoot(), globals->options->product_name,
@@ -1661,12 +2569,56 @@ static void ComputeBaseDirectories(const string &self_path) {
         output_base);
   }
   ExcludePathFromBackup(output_base);
+  ExcludePathFromIndexing(output_base);
 
   globals->options->output_base = MakeCanonical(output_base);
   globals->lockfile = globals->options->output_base + "/lock";
   globals->jvm_log_file = globals->options->output_base + "/server/jvm.out";
 }
 
+// Answers "info <key>" without contacting the server if the value of the key
+// is fully determined by the startup options, i.e. for the keys printing the
+// base directories computed by ComputeBaseDirectories(). Tools like editor
+// plugins and shell prompts ask for these all the time and starting a server
+// just to print a path is a waste. Returns false (and the command is sent to
+// the server as usual) for anything else, including the options of the info
+// command (they only matter for the keys answered by the server).
+static bool AnswerInfoLocally() {
+  if (globals->option_processor->GetCommand() != "info" ||
+      !WorkspaceLayout::InWorkspace(globals->workspace)) {
+    return false;
+  }
+  vector<string> command_arguments;
+  globals->option_processor->GetCommandArguments(&command_arguments);
+  string key;
+  for (const string &arg : command_arguments) {
+    if (arg == "--") {
+      return false;
+    }
+    if (arg[0] == '-') {
+      continue;
+    }
+    if (!key.empty()) {
+      // Let the server complain.
+      return false;
+    }
+    key = arg;
+  }
+
+  string value;
+  if (key == "workspace") {
+    value = globals->workspace;
+  } else if (key == "install_base") {
+    value = globals->options->install_base;
+  } else if (key == "output_base") {
+    value = globals->options->output_base;
+  } else {
+    return false;
+  }
+  printf("%s\n", value.c_str());
+  return true;
+}
+
 static void CheckEnvironment() {
   if (getenv("LD_ASSUME_KERNEL") != NULL) {
     // Fix for bug: if ulimit -s and LD_ASSUME_KERNEL are both
@@ -1738,8 +2690,8 @@ static void CheckBinaryPath(const string& argv0) {
 // Create the user's directory where we keep state, installations etc.
 // Typically, this happens inside a temp directory, so we have to be
 // careful about symlink attacks.
-static void CreateSecureOutputRoot() {
-  const char* root = globals->options->output_user_root.c_str();
+static void CreateSecureOutputRoot(const string &path) {
+  const char* root = path.c_str();
   struct stat fileinfo = {};
 
   if (MakeDirectories(root, 0755) == -1) {
@@ -1784,13 +2736,17 @@ static void CreateSecureOutputRoot() {
 // unexpectedly (in a way that isn't already handled), we can observe the file,
 // if it exists. (If it doesn't, then we know something went horribly wrong.)
 int Main(int argc, const char *argv[], OptionProcessor *option_processor) {
+  blaze_util::StartTracing("client", NULL);
   InitGlobals(option_processor);
   SetupStreams();
 
   // Must be done before command line parsing.
+  uint64_t phase_start = MonotonicClock();
   ComputeWorkspace();
+  phase_start = EndStartupPhase("compute_workspace", phase_start);
   CheckBinaryPath(argv[0]);
   ParseOptions(argc, argv);
+  EndStartupPhase("parse_options", phase_start);
 
 #ifdef __CYGWIN__
   if (globals->options->command_port == -1) {
@@ -1806,29 +2762,43 @@ int Main(int argc, const char *argv[], OptionProcessor *option_processor) {
     die(reexec_options_exit_code, "%s", error.c_str());
   }
   CheckEnvironment();
-  CreateSecureOutputRoot();
+  CreateSecureOutputRoot(globals->options->output_user_root);
 
   const string self_path = GetSelfPath();
+  phase_start = MonotonicClock();
   ComputeBaseDirectories(self_path);
+  phase_start = EndStartupPhase("install_base_key", phase_start);
+  if (AnswerInfoLocally()) {
+    return 0;
+  }
 
+  // The AF_UNIX protocol (--command_port=-1) has its own framing and no
+  // protobuf messages, and gRPC is only initialized by the first channel, so
+  // with it the client does none of the gRPC setup.
   blaze_server = globals->options->command_port >= 0
       ? static_cast<BlazeServer *>(new GrpcBlazeServer())
       : static_cast<BlazeServer *>(new AfUnixBlazeServer());
 
   globals->command_wait_time = blaze_server->AcquireLock();
+  phase_start = EndStartupPhase("lock", phase_start);
 
   WarnFilesystemType(globals->options->output_base);
 
+  phase_start = MonotonicClock();
   ExtractData(self_path);
+  phase_start = EndStartupPhase("extract_data", phase_start);
   VerifyJavaVersionAndSetJvm();
+  phase_start = EndStartupPhase("jvm_version", phase_start);
 
-  blaze_server->Connect();
+  if (blaze_server->ConnectToRunningServer()) {
+    RecordServerPeakMemory();
+  }
   EnsureCorrectRunningVersion(blaze_server);
   KillRunningServerIfDifferentStartupOptions(blaze_server);
+  EndStartupPhase("connect", phase_start);
 
   if (globals->options->batch) {
-    SetScheduling(globals->options->batch_cpu_scheduling,
-                  globals->options->io_nice_level);
+    SetServerScheduling();
     StartStandalone(blaze_server);
   } else {
     SendServerRequest(blaze_server);
@@ -1842,6 +2812,26 @@ static void null_grpc_log_function(gpr_log_func_args *args) {
 GrpcBlazeServer::GrpcBlazeServer() {
   gpr_set_log_function(null_grpc_log_function);
   connected_ = false;
+  verified_ = false;
+  command_done_ = false;
+  // Created by the first Connect(), so that commands that never talk to the
+  // server don't pay for it.
+  recv_socket_ = -1;
+  send_socket_ = -1;
+}
+
+GrpcBlazeServer::~GrpcBlazeServer() {
+  if (cancel_thread_.joinable()) {
+    SendAction(CancelThreadAction::JOIN);
+    cancel_thread_.join();
+  }
+  if (send_socket_ != -1) {
+    close(send_socket_);
+    close(recv_socket_);
+  }
+}
+
+void GrpcBlazeServer::CreateCancelPipe() {
   int fd[2];
   if (pipe(fd) < 0) {
     pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
@@ -1861,28 +2851,49 @@ GrpcBlazeServer::GrpcBlazeServer() {
   }
 }
 
-GrpcBlazeServer::~GrpcBlazeServer() {
-  close(send_socket_);
-  close(recv_socket_);
+bool GrpcBlazeServer::Connect() {
+  return Connect(true);
 }
 
-bool GrpcBlazeServer::Connect() {
+bool GrpcBlazeServer::ConnectToRunningServer() {
+  return Connect(false);
+}
+
+bool GrpcBlazeServer::Connect(bool ping) {
   assert(!connected_);
+  if (send_socket_ == -1) {
+    // The cancel thread may be sent actions as soon as we are connected.
+    CreateCancelPipe();
+  }
 
   std::string server_dir = globals->options->output_base + "/server";
   std::string port;
   std::string ipv4_prefix = "127.0.0.1:";
   std::string ipv6_prefix_1 = "[0:0:0:0:0:0:0:1]:";
   std::string ipv6_prefix_2 = "[::1]:";
+  std::string unix_prefix = "unix:";
 
   if (!ReadFile(server_dir + "/command_port", &port)) {
     return false;
   }
 
-  // Make sure that we are being directed to localhost
-  if (port.compare(0, ipv4_prefix.size(), ipv4_prefix)
-      && port.compare(0, ipv6_prefix_1.size(), ipv6_prefix_1)
-      && port.compare(0, ipv6_prefix_2.size(), ipv6_prefix_2)) {
+  if (port.compare(0, unix_prefix.size(), unix_prefix) == 0) {
+    // A Unix domain socket is only accepted in the server directory, which
+    // is not accessible to other users, and only if it is ours.
+    string socket_path = port.substr(unix_prefix.size());
+    string socket_name = socket_path.substr(
+        std::min(socket_path.size(), server_dir.size() + 1));
+    struct stat buf;
+    if (socket_path.compare(0, server_dir.size() + 1, server_dir + "/") ||
+        socket_name.empty() || socket_name.find('/') != string::npos ||
+        lstat(socket_path.c_str(), &buf) == -1 || !S_ISSOCK(buf.st_mode) ||
+        buf.st_uid != geteuid()) {
+      return false;
+    }
+  } else if (port.compare(0, ipv4_prefix.size(), ipv4_prefix)
+             && port.compare(0, ipv6_prefix_1.size(), ipv6_prefix_1)
+             && port.compare(0, ipv6_prefix_2.size(), ipv6_prefix_2)) {
+    // Make sure that we are being directed to localhost
     return false;
   }
 
@@ -1894,11 +2905,40 @@ bool GrpcBlazeServer::Connect() {
     return false;
   }
 
-  std::shared_ptr<grpc::Channel> channel(grpc::CreateChannel(
-      port, grpc::InsecureChannelCredentials()));
+  // The address is a literal one, which the ipv4: and ipv6: schemes of gRPC
+  // parse directly. Without a scheme, it would go to the DNS resolver, which
+  // calls getaddrinfo() on a thread started just for that.
+  std::string target = port;
+  if (port.compare(0, ipv4_prefix.size(), ipv4_prefix) == 0) {
+    target = "ipv4:" + port;
+  } else if (port.compare(0, unix_prefix.size(), unix_prefix)) {
+    target = "ipv6:" + port;
+  }
+  // The default stream window of 64KB has large outputs (test logs, query
+  // results) wait for a window update every 64KB, and the default limit on
+  // the size of a message could refuse a large response.
+  grpc::ChannelArguments channel_args;
+  channel_args.SetInt(GRPC_ARG_HTTP2_STREAM_LOOKAHEAD_BYTES,
+                      globals->options->grpc_stream_window_kb * 1024);
+  channel_args.SetInt(GRPC_ARG_MAX_MESSAGE_LENGTH, INT_MAX);
+  std::shared_ptr<grpc::Channel> channel(grpc::CreateCustomChannel(
+      target, grpc::InsecureChannelCredentials(), channel_args));
   std::unique_ptr<command_server::CommandServer::Stub> client(
       command_server::CommandServer::NewStub(channel));
 
+  if (!ping) {
+    // The channel connects lazily, so a running server is as much as can be
+    // checked without a round trip.
+    int server_pid = GetServerPid(server_dir);
+    if (server_pid > 0 && kill(server_pid, 0) == 0) {
+      globals->server_pid = server_pid;
+      this->client_ = std::move(client);
+      verified_ = false;
+      connected_ = true;
+      return true;
+    }
+  }
+
   grpc::ClientContext context;
   context.set_deadline(
       std::chrono::system_clock::now() + std::chrono::seconds(10));
@@ -1907,7 +2947,11 @@ bool GrpcBlazeServer::Connect() {
   command_server::PingResponse response;
   request.set_cookie(request_cookie_);
 
+  const uint64_t ping_time = MonotonicClock();
   grpc::Status status = client->Ping(&context, request, &response);
+  if (status.ok()) {
+    ping_latency_.Add(MonotonicClock() - ping_time);
+  }
 
   if (!status.ok() || response.cookie() != response_cookie_) {
     return false;
@@ -1921,6 +2965,7 @@ bool GrpcBlazeServer::Connect() {
   }
 
   this->client_ = std::move(client);
+  verified_ = true;
   connected_ = true;
   return true;
 }
@@ -1941,14 +2986,18 @@ bool GrpcBlazeServer::Connect() {
 // - CANCEL. If the command ID is already available, a cancel request is sent.
 // - COMMAND_ID_RECEIVED. The client learned the command ID from the server.
 //   If there is a pending cancellation request, it is acted upon.
+// - COMMAND_DONE. The command has finished, forget about it and about any
+//   pending cancellation request.
 //
 // The only data the cancellation thread shares with the main thread is the
-// file descriptor for receiving commands and command_id_, the latter of which
-// is protected by a mutex, which mainly serves as a memory fence.
+// file descriptor for receiving commands, command_id_ and command_done_,
+// the latter two of which are protected by a mutex.
 //
-// The cancellation thread is joined at the end of the execution of the command.
-// The main thread wakes it up just so that it can finish (using the JOIN
-// action)
+// The cancellation thread is started by the first command and serves all the
+// commands run by this client (there is more than one if the command has to
+// be sent to a newly started server, see Communicate()). At the end of the
+// execution of a command, the main thread waits for the cancel thread to
+// handle COMMAND_DONE, so that no cancel request is sent after that.
 //
 // It's conceivable that the server is busy and thus it cannot service the
 // cancellation request. In that case, we simply ignore the failure and the both
@@ -1960,42 +3009,61 @@ void GrpcBlazeServer::CancelThread() {
   bool cancel = false;
   bool command_id_received = false;
   while (running) {
-    char buf;
-    int bytes_read = read(recv_socket_, &buf, 1);
+    char buf[16];
+    int bytes_read = read(recv_socket_, buf, sizeof buf);
     if (bytes_read == -1 && errno == EINTR) {
       continue;
-    } else if (bytes_read != 1) {
+    } else if (bytes_read <= 0) {
       pdie(blaze_exit_code::INTERNAL_ERROR,
            "Cannot communicate with cancel thread");
     }
 
-    switch (buf) {
-      case CancelThreadAction::NOTHING:
-        break;
-
-      case CancelThreadAction::JOIN:
-        running = false;
-        break;
-
-      case CancelThreadAction::COMMAND_ID_RECEIVED:
-        command_id_received = true;
-        if (cancel) {
-          SendCancelMessage();
+    for (int i = 0; i < bytes_read && running; ++i) {
+      switch (buf[i]) {
+        case CancelThreadAction::NOTHING:
+          break;
+
+        case CancelThreadAction::JOIN:
+          running = false;
+          break;
+
+        case CancelThreadAction::COMMAND_ID_RECEIVED:
+          command_id_received = true;
+          if (cancel) {
+            SendCancelMessage();
+            cancel = false;
+          }
+          break;
+
+        case CancelThreadAction::CANCEL:
+          if (command_id_received) {
+            SendCancelMessage();
+          } else {
+            cancel = true;
+          }
+          break;
+
+        case CancelThreadAction::COMMAND_DONE:
+          command_id_received = false;
           cancel = false;
-        }
-        break;
-
-      case CancelThreadAction::CANCEL:
-        if (command_id_received) {
-          SendCancelMessage();
-        } else {
-          cancel = true;
-        }
-        break;
+          {
+            std::unique_lock<std::mutex> lock(cancel_thread_mutex_);
+            command_done_ = true;
+          }
+          command_done_cond_.notify_all();
+          break;
+      }
     }
   }
 }
 
+void GrpcBlazeServer::EndCancelThreadCommand() {
+  std::unique_lock<std::mutex> lock(cancel_thread_mutex_);
+  command_done_ = false;
+  SendAction(CancelThreadAction::COMMAND_DONE);
+  command_done_cond_.wait(lock, [this] { return command_done_; });
+}
+
 void GrpcBlazeServer::SendCancelMessage() {
   std::unique_lock<std::mutex> lock(cancel_thread_mutex_);
 
@@ -2007,7 +3075,9 @@ void GrpcBlazeServer::SendCancelMessage() {
                        std::chrono::seconds(10));
   command_server::CancelResponse response;
   // There isn't a lot we can do if this request fails
+  const uint64_t cancel_time = MonotonicClock();
   grpc::Status status = client_->Cancel(&context, request, &response);
+  cancel_latency_.Add(MonotonicClock() - cancel_time);
   if (!status.ok()) {
     fprintf(stderr, "\nCould not interrupt server (%s)\n\n",
             status.error_message().c_str());
@@ -2039,6 +3109,104 @@ void GrpcBlazeServer::KillRunningServer() {
   connected_ = false;
 }
 
+OutputForwarder::OutputForwarder() : queued_bytes_(0), stopping_(false) {
+  writer_ = std::thread(&OutputForwarder::WriteLoop, this);
+}
+
+OutputForwarder::~OutputForwarder() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  queued_cond_.notify_one();
+  writer_.join();
+}
+
+void OutputForwarder::Write(int fd, string *data) {
+  if (data->empty()) {
+    return;
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    // A chunk larger than the limit is queued when nothing else is.
+    written_cond_.wait(lock, [this, data] {
+      return queued_bytes_ == 0 ||
+             queued_bytes_ + data->size() <= kMaxQueuedBytes;
+    });
+    queued_bytes_ += data->size();
+    chunks_.emplace_back(fd, string());
+    chunks_.back().second.swap(*data);
+    if (!spare_buffers_.empty()) {
+      data->swap(spare_buffers_.back());
+      spare_buffers_.pop_back();
+    }
+  }
+  queued_cond_.notify_one();
+}
+
+void OutputForwarder::WriteLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    queued_cond_.wait(lock, [this] { return !chunks_.empty() || stopping_; });
+    if (chunks_.empty()) {
+      return;
+    }
+    int fd = chunks_.front().first;
+    vector<string> chunks;
+    size_t bytes = 0;
+    while (!chunks_.empty() && chunks_.front().first == fd &&
+           chunks.size() < kMaxChunksPerWrite) {
+      chunks.emplace_back();
+      chunks.back().swap(chunks_.front().second);
+      bytes += chunks.back().size();
+      chunks_.pop_front();
+    }
+    lock.unlock();
+    WriteChunks(fd, chunks);
+    lock.lock();
+    for (string &chunk : chunks) {
+      if (spare_buffers_.size() == kMaxSpareBuffers) {
+        break;
+      }
+      chunk.clear();
+      spare_buffers_.emplace_back();
+      spare_buffers_.back().swap(chunk);
+    }
+    queued_bytes_ -= bytes;
+    written_cond_.notify_one();
+  }
+}
+
+void OutputForwarder::WriteChunks(int fd, const vector<string> &chunks) {
+  struct iovec iov[kMaxChunksPerWrite];
+  size_t count = 0;
+  for (const string &chunk : chunks) {
+    iov[count].iov_base = const_cast<char *>(chunk.data());
+    iov[count].iov_len = chunk.size();
+    ++count;
+  }
+  struct iovec *next = iov;
+  while (count > 0) {
+    ssize_t written = writev(fd, next, count);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return;
+    }
+    // Skip what was written, the rest is written by the next writev().
+    while (count > 0 && static_cast<size_t>(written) >= next->iov_len) {
+      written -= next->iov_len;
+      ++next;
+      --count;
+    }
+    if (count > 0) {
+      next->iov_base = static_cast<char *>(next->iov_base) + written;
+      next->iov_len -= written;
+    }
+  }
+}
+
 unsigned int GrpcBlazeServer::Communicate() {
   assert(connected_);
 
@@ -2051,6 +3219,10 @@ unsigned int GrpcBlazeServer::Communicate() {
 
   globals->option_processor->GetCommandArguments(&arg_vector);
 
+  // The command is only sent here, but there is no earlier hint for the
+  // server to start on it: by the time the server is reachable, all that is
+  // left before this point are the version and startup option checks above,
+  // which are local and take far less time than the command.
   command_server::RunRequest request;
   request.set_cookie(request_cookie_);
   request.set_block_for_lock(globals->options->block_for_lock);
@@ -2061,6 +3233,7 @@ unsigned int GrpcBlazeServer::Communicate() {
 
   grpc::ClientContext context;
   command_server::RunResponse response;
+  const uint64_t request_time = MonotonicClock();
   std::unique_ptr<grpc::ClientReader<command_server::RunResponse>> reader(
       client_->Run(&context, request));
 
@@ -2069,27 +3242,40 @@ unsigned int GrpcBlazeServer::Communicate() {
   // (one during server startup and one emitted by the server)
   blaze::ReleaseLock(&blaze_lock_);
 
-  std::thread cancel_thread(&GrpcBlazeServer::CancelThread, this);
+  if (!cancel_thread_.joinable()) {
+    cancel_thread_ = std::thread(&GrpcBlazeServer::CancelThread, this);
+  }
+  std::unique_ptr<OutputForwarder> output(new OutputForwarder());
   bool command_id_set = false;
+  bool rejected = false;
+  bool first_response = true;
+  uint64_t response_time = request_time;
   while (reader->Read(&response)) {
+    const uint64_t now = MonotonicClock();
+    if (first_response) {
+      EndStartupPhase("first_response", request_time);
+      first_response_latency_.Add(now - request_time);
+      first_response = false;
+    } else {
+      response_gap_latency_.Add(now - response_time);
+    }
+    response_time = now;
     if (response.cookie() != response_cookie_) {
+      if (!verified_) {
+        // Not the server that wrote the cookies, which did not run the
+        // command either.
+        rejected = true;
+        break;
+      }
+      output.reset();
       fprintf(stderr, "\nServer response cookie invalid, exiting\n");
+      ReportRpcLatencies();
       return blaze_exit_code::INTERNAL_ERROR;
     }
+    verified_ = true;
 
-    if (response.standard_output().size() > 0) {
-      if (write(1, response.standard_output().c_str(),
-                response.standard_output().size()) <= 0) {
-        // Placate the compiler.
-      }
-    }
-
-    if (response.standard_error().size() > 0) {
-      if (write(2, response.standard_error().c_str(),
-            response.standard_error().size()) <= 0) {
-        // Placate the compiler.
-      }
-    }
+    output->Write(1, response.mutable_standard_output());
+    output->Write(2, response.mutable_standard_error());
 
     if (!command_id_set && response.command_id().size() > 0) {
       std::unique_lock<std::mutex> lock(cancel_thread_mutex_);
@@ -2099,9 +3285,36 @@ unsigned int GrpcBlazeServer::Communicate() {
     }
   }
 
-  SendAction(CancelThreadAction::JOIN);
-  cancel_thread.join();
+  output.reset();
+  EndCancelThreadCommand();
 
+  if (!verified_) {
+    // ConnectToRunningServer() did not ping the server. If it turns out not
+    // to be there (or not to be the one that wrote the cookies), the command
+    // has not been run, so start a new server and send the command there.
+    if (rejected) {
+      context.TryCancel();
+    }
+    grpc::Status status = reader->Finish();
+    reader.reset();
+    if (rejected || status.error_code() == grpc::StatusCode::UNAVAILABLE) {
+      if (VerboseLogging()) {
+        fprintf(stderr, "Server not responsive (%s), starting a new one.\n",
+                status.error_message().c_str());
+      }
+      // Signals are only handled when connected, see SendServerRequest().
+      sigset_t sigset, old_sigset;
+      sigfillset(&sigset);
+      sigprocmask(SIG_BLOCK, &sigset, &old_sigset);
+      Disconnect();
+      globals->command_wait_time += AcquireLock();
+      StartServerAndConnect(this);
+      sigprocmask(SIG_SETMASK, &old_sigset, NULL);
+      return Communicate();
+    }
+  }
+
+  ReportRpcLatencies();
   if (!response.finished()) {
     fprintf(stderr, "\nServer finished RPC without an explicit exit code\n\n");
     return GetExitCodeForAbruptExit(*globals);
@@ -2110,6 +3323,46 @@ unsigned int GrpcBlazeServer::Communicate() {
   return response.exit_code();
 }
 
+void GrpcBlazeServer::ReportRpcLatencies() {
+  blaze_util::LatencyHistogram cancel_latency;
+  {
+    std::unique_lock<std::mutex> lock(cancel_thread_mutex_);
+    cancel_latency = cancel_latency_;
+  }
+  struct {
+    const char *name;
+    const blaze_util::LatencyHistogram &histogram;
+  } rpcs[] = {
+      {"ping", ping_latency_},
+      {"run_first_response", first_response_latency_},
+      {"run_response_gap", response_gap_latency_},
+      {"cancel", cancel_latency},
+  };
+
+  string content =
+      "# <rpc> <count> <sum us> <max us> <bucket>:<count>..., where bucket i "
+      "counts latencies in [2^(i-1), 2^i) us\n";
+  for (const auto &rpc : rpcs) {
+    content += string(rpc.name) + " " + rpc.histogram.ToString() + "\n";
+  }
+  WriteFile(content, globals->options->output_base + "/client_rpc_latencies");
+
+  if (!globals->options->print_client_rpc_latencies) {
+    return;
+  }
+  fprintf(stderr, "%-20s %8s %10s %10s %10s %10s\n", "RPC latencies (us)",
+          "count", "p50", "p90", "p99", "max");
+  for (const auto &rpc : rpcs) {
+    const blaze_util::LatencyHistogram &histogram = rpc.histogram;
+    fprintf(stderr, "%-20s %8llu %10llu %10llu %10llu %10llu\n", rpc.name,
+            static_cast<unsigned long long>(histogram.Count()),
+            static_cast<unsigned long long>(histogram.PercentileMicros(0.5)),
+            static_cast<unsigned long long>(histogram.PercentileMicros(0.9)),
+            static_cast<unsigned long long>(histogram.PercentileMicros(0.99)),
+            static_cast<unsigned long long>(histogram.MaxMicros()));
+  }
+}
+
 void GrpcBlazeServer::Disconnect() {
   assert(connected_);
 
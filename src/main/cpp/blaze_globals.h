@@ -39,6 +39,13 @@ enum RestartReason {
   NEW_OPTIONS
 };
 
+// A phase of the client startup, timed with MonotonicClock().
+struct StartupPhase {
+  string name;
+  uint64_t start_time;
+  uint64_t end_time;
+};
+
 struct GlobalVariables {
   // Used to make concurrent invocations of this program safe.
   string lockfile;  // = <output_base>/lock
@@ -89,12 +96,20 @@ struct GlobalVariables {
   // The reason for the server restart.
   RestartReason restart_reason;
 
+  // The phases of the client startup, in the order they ended. Passed to the
+  // server, which adds them to the profile.
+  vector<StartupPhase> startup_phases;
+
   // The absolute path of the blaze binary.
   string binary_path;
 
   // MD5 hash of the Blaze binary (includes deploy.jar, extracted binaries, and
   // anything else that ends up under the install_base).
   string install_md5;
+
+  // True if the install_base is the one below --shared_install_root, which
+  // other users use as well.
+  bool shared_install_base;
 };
 
 }  // namespace blaze
@@ -81,15 +81,27 @@ string MakeAbsolute(const string &path) {
   return cwdbuf + separator + path;
 }
 
-// Runs "stat" on `path`. Returns -1 and sets errno if stat fails or
-// `path` isn't a directory. If check_perms is true, this will also
-// make sure that `path` is owned by the current user and has `mode`
-// permissions (observing the umask). It attempts to run chmod to
-// correct the mode if necessary. If `path` is a symlink, this will
-// check ownership of the link, not the underlying directory.
-static int GetDirectoryStat(const string& path, mode_t mode, bool check_perms) {
-  struct stat filestat = {};
-  if (stat(path.c_str(), &filestat) == -1) {
+// Returns the umask of the process. umask() can only be read by setting it,
+// so this reads it once; the client never changes it.
+static mode_t GetUmask() {
+  static const mode_t mask = [] {
+    mode_t result = umask(022);
+    umask(result);
+    return result;
+  }();
+  return mask;
+}
+
+// Checks the existing directory at `path`, whose lstat() result is
+// `linkstat`. Returns -1 and sets errno if `path` isn't a directory or a
+// symlink to one. This also makes sure that `path` is owned by the current
+// user and has `mode` permissions (observing the umask). It attempts to run
+// chmod to correct the mode if necessary. If `path` is a symlink, this
+// checks ownership of the link, not the underlying directory.
+static int CheckDirectory(const string& path, mode_t mode,
+                          const struct stat& linkstat) {
+  struct stat filestat = linkstat;
+  if (S_ISLNK(linkstat.st_mode) && stat(path.c_str(), &filestat) == -1) {
     return -1;
   }
 
@@ -98,72 +110,55 @@ static int GetDirectoryStat(const string& path, mode_t mode, bool check_perms) {
     return -1;
   }
 
-  if (check_perms) {
-    // If this is a symlink, run checks on the link. (If we did lstat above
-    // then it would return false for ISDIR).
-    struct stat linkstat = {};
-    if (lstat(path.c_str(), &linkstat) != 0) {
-      return -1;
-    }
-    if (linkstat.st_uid != geteuid()) {
-      // The directory isn't owned by me.
-      errno = EACCES;
-      return -1;
-    }
-
-    mode_t mask = umask(022);
-    umask(mask);
-    mode = (mode & ~mask);
-    if ((filestat.st_mode & 0777) != mode
-        && chmod(path.c_str(), mode) == -1) {
-      // errno set by chmod.
-      return -1;
-    }
+  if (linkstat.st_uid != geteuid()) {
+    // The directory isn't owned by me.
+    errno = EACCES;
+    return -1;
   }
-  return 0;
-}
 
-static int MakeDirectories(const string& path, mode_t mode, bool childmost) {
-  if (path.empty() || path == "/") {
-    errno = EACCES;
+  mode = (mode & ~GetUmask());
+  if ((filestat.st_mode & 0777) != mode
+      && chmod(path.c_str(), mode) == -1) {
+    // errno set by chmod.
     return -1;
   }
+  return 0;
+}
 
-  int retval = GetDirectoryStat(path, mode, childmost);
-  if (retval == 0) {
+// Creates `path` and its missing parents. The parents are created
+// optimistically, so that an existing one costs a single failed mkdir()
+// and the search for the deepest existing ancestor only goes up where
+// mkdir() fails with ENOENT. Their permissions are not checked; if one
+// isn't a directory, creating the next one down the chain fails.
+static int CreateDirectories(const string& path, mode_t mode) {
+  if (mkdir(path.c_str(), mode) == 0) {
     return 0;
   }
-
   if (errno == ENOENT) {
-    // Path does not exist, attempt to create its parents, then it.
     string parent = blaze_util::Dirname(path);
-    if (MakeDirectories(parent, mode, false) == -1) {
-      // errno set by stat.
+    if (parent.empty() || parent == path || parent == "/") {
       return -1;
     }
-
-    if (mkdir(path.c_str(), mode) == -1) {
-      if (errno == EEXIST) {
-        if (childmost) {
-          // If there are multiple bazel calls at the same time then the
-          // directory could be created between the MakeDirectories and mkdir
-          // calls. This is okay, but we still have to check the permissions.
-          return GetDirectoryStat(path, mode, childmost);
-        } else {
-          // If this isn't the childmost directory, we don't care what the
-          // permissions were. If it's not even a directory then that error will
-          // get caught when we attempt to create the next directory down the
-          // chain.
-          return 0;
-        }
-      }
-      // errno set by mkdir.
+    if (CreateDirectories(parent, mode) == -1) {
       return -1;
     }
+    if (mkdir(path.c_str(), mode) == 0) {
+      return 0;
+    }
+  }
+  if (errno == EEXIST) {
+    // If there are multiple bazel calls at the same time then the directory
+    // could be created by another one. That is okay.
     return 0;
   }
-
-  return retval;
+  // Some file systems report errors such as EACCES for existing directories.
+  int saved_errno = errno;
+  struct stat filestat = {};
+  if (stat(path.c_str(), &filestat) == 0 && S_ISDIR(filestat.st_mode)) {
+    return 0;
+  }
+  errno = saved_errno;
+  return -1;
 }
 
 // mkdir -p path. Returns 0 if the path was created or already exists and could
@@ -172,7 +167,36 @@ static int MakeDirectories(const string& path, mode_t mode, bool childmost) {
 // permissions. It also checks that the directory or symlink is owned by us.
 // On failure, this returns -1 and sets errno.
 int MakeDirectories(const string& path, mode_t mode) {
-  return MakeDirectories(path, mode, true);
+  if (path.empty() || path == "/") {
+    errno = EACCES;
+    return -1;
+  }
+
+  // Most of the time the directory already exists, so start by looking at
+  // it: that takes a single lstat(), and its result is needed anyway.
+  struct stat linkstat = {};
+  if (lstat(path.c_str(), &linkstat) == 0) {
+    return CheckDirectory(path, mode, linkstat);
+  }
+  if (errno != ENOENT) {
+    return -1;
+  }
+
+  string parent = blaze_util::Dirname(path);
+  if (!parent.empty() && parent != "/" &&
+      CreateDirectories(parent, mode) == -1) {
+    return -1;
+  }
+  if (mkdir(path.c_str(), mode) == 0) {
+    return 0;
+  }
+  if (errno == EEXIST && lstat(path.c_str(), &linkstat) == 0) {
+    // The directory was created by a concurrent call, we still have to check
+    // the permissions.
+    return CheckDirectory(path, mode, linkstat);
+  }
+  // errno set by mkdir or lstat.
+  return -1;
 }
 
 // Replaces 'contents' with contents of 'fd' file descriptor.
@@ -235,6 +259,12 @@ bool IsEmacsTerminal() {
   return emacs == "t" || inside_emacs != "";
 }
 
+bool IsRemoteTerminal() {
+  // sshd sets SSH_CONNECTION for every session, and SSH_TTY if it has a
+  // terminal.
+  return getenv("SSH_CONNECTION") != nullptr || getenv("SSH_TTY") != nullptr;
+}
+
 // Returns true iff both stdout and stderr are connected to a
 // terminal, and it can support color and cursor movement
 // (this is computed heuristically based on the values of
@@ -70,6 +70,10 @@ bool IsEmacsTerminal();
 // Returns true iff the current terminal can support color and cursor movement.
 bool IsStandardTerminal();
 
+// Returns true iff the client runs in an ssh session, where every terminal
+// update has to cross the network.
+bool IsRemoteTerminal();
+
 // Returns the number of columns of the terminal to which stdout is
 // connected, or 80 if there is no such terminal.
 int GetTerminalColumns();
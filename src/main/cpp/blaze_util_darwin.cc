@@ -12,13 +12,22 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <errno.h>
+#include <fcntl.h>
 #include <libproc.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/param.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysctl.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include <CoreFoundation/CoreFoundation.h>
+#include <CoreServices/CoreServices.h>
+#include <algorithm>
 #include <cstdio>
 
 #include "src/main/cpp/blaze_util.h"
@@ -114,6 +123,14 @@ void WarnFilesystemType(const string& output_base) {
   }
 }
 
+bool IsNetworkFilesystem(const string& path) {
+  struct statfs buf = {};
+  if (statfs(path.c_str(), &buf) < 0) {
+    return false;
+  }
+  return (buf.f_flags & MNT_LOCAL) == 0;
+}
+
 pid_t GetPeerProcessId(int socket) {
   pid_t pid = 0;
   socklen_t len = sizeof(pid_t);
@@ -149,6 +166,40 @@ void SetScheduling(bool batch_cpu_scheduling, int io_nice_level) {
   // stubbed out so we can compile for Darwin.
 }
 
+void SetCgroup(const string& cgroup, const vector<string>& settings) {
+  // There are no cgroups on Darwin.
+}
+
+void SetCpuAffinity(const string& cpus) {
+  // Darwin only has affinity hints for threads.
+}
+
+void SetNumaInterleave() {
+  // There are no NUMA memory policies on Darwin.
+}
+
+uint64_t GetAvailableMemory() {
+  uint64_t memory;
+  size_t size = sizeof(memory);
+  if (sysctlbyname("hw.memsize", &memory, &size, NULL, 0) != 0) {
+    return 0;
+  }
+  return memory;
+}
+
+int GetAvailableCpus() {
+  return std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+uint64_t GetProcessPeakMemory(int pid) {
+  // Only the current resident size is known.
+  return 0;
+}
+
+bool TransparentHugePagesEnabled() {
+  return false;
+}
+
 string GetProcessCWD(int pid) {
   struct proc_vnodepathinfo info = {};
   if (proc_pidinfo(
@@ -162,16 +213,59 @@ bool IsSharedLibrary(const string &filename) {
   return blaze_util::ends_with(filename, ".dylib");
 }
 
+static const char kJavaHome[] = "/usr/libexec/java_home";
+static const char kJavaVirtualMachines[] = "/Library/Java/JavaVirtualMachines";
+
+// Returns the key under which the output of java_home is cached: it changes
+// when java_home itself or the set of installed JDKs changes.
+static string JavaHomeCacheKey() {
+  string key;
+  for (const char *path : {kJavaHome, kJavaVirtualMachines}) {
+    struct stat st;
+    if (stat(path, &st) == 0) {
+      key += ToString(st.st_ino) + ":" + ToString(st.st_mtime);
+    }
+    key += "\n";
+  }
+  return key;
+}
+
+// Returns the file that caches the output of java_home, in the default output
+// user root, or "" if that directory is not private to the current user.
+static string JavaHomeCacheFile() {
+  string dir = blaze_util::JoinPath(GetOutputRoot(), "_bazel_" + GetUserName());
+  struct stat st;
+  if (lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) ||
+      st.st_uid != geteuid() || (st.st_mode & 022) != 0) {
+    return "";
+  }
+  return blaze_util::JoinPath(dir, "java_home");
+}
+
 string GetDefaultHostJavabase() {
   const char *java_home = getenv("JAVA_HOME");
   if (java_home) {
     return std::string(java_home);
   }
 
-  FILE *output = popen("/usr/libexec/java_home -v 1.7+", "r");
+  // Running java_home takes a noticeable part of the client startup, so its
+  // result is reused as long as the JDK installation does not change.
+  string key = JavaHomeCacheKey();
+  string cache_file = JavaHomeCacheFile();
+  string cached;
+  if (!cache_file.empty() && ReadFile(cache_file, &cached) &&
+      cached.size() > key.size() && cached.compare(0, key.size(), key) == 0) {
+    string javabase = cached.substr(key.size());
+    struct stat st;
+    if (stat(javabase.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+      return javabase;
+    }
+  }
+
+  FILE *output = popen((string(kJavaHome) + " -v 1.7+").c_str(), "r");
   if (output == NULL) {
     pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
-         "Could not run /usr/libexec/java_home");
+         "Could not run %s", kJavaHome);
   }
 
   char buf[512];
@@ -179,18 +273,23 @@ string GetDefaultHostJavabase() {
   pclose(output);
   if (result == NULL) {
     die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
-        "No output from /usr/libexec/java_home");
+        "No output from %s", kJavaHome);
   }
 
   string javabase = buf;
   if (javabase.empty()) {
     die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
-        "Empty output from /usr/libexec/java_home - "
-        "install a JDK, or install a JRE and point your JAVA_HOME to it");
+        "Empty output from %s - "
+        "install a JDK, or install a JRE and point your JAVA_HOME to it",
+        kJavaHome);
   }
 
   // The output ends with a \n, trim it off.
-  return javabase.substr(0, javabase.length()-1);
+  javabase = javabase.substr(0, javabase.length()-1);
+  if (!cache_file.empty()) {
+    WriteFile(key + javabase, cache_file);
+  }
+  return javabase;
 }
 
 void WriteSystemSpecificProcessIdentifier(const string& server_dir) {
@@ -204,6 +303,10 @@ bool KillServerProcess(
   return true;
 }
 
+int OpenProcessDescriptor(int pid) {
+  return -1;
+}
+
 // Sets a flag on path to exclude the path from Apple's automatic backup service
 // (Time Machine)
 void ExcludePathFromBackup(const string &path) {
@@ -230,4 +333,62 @@ void ExcludePathFromBackup(const string &path) {
   }
 }
 
+// Spotlight does not index directories containing a .metadata_never_index
+// file. Time Machine's exclusion is an extended attribute, which is set by
+// ExcludePathFromBackup().
+void ExcludePathFromIndexing(const string &path) {
+  string marker = blaze_util::JoinPath(path, ".metadata_never_index");
+  int fd = open(marker.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+  if (fd >= 0) {
+    close(fd);
+  } else if (errno != EEXIST && errno != EACCES && errno != EROFS) {
+    fprintf(stderr, "Warning: unable to exclude '%s' from Spotlight: %s\n",
+            path.c_str(), strerror(errno));
+  }
+  if (access(path.c_str(), W_OK) == 0) {
+    ExcludePathFromBackup(path);
+  }
+}
+
+// Asks Spotlight for any one file under path; it answers from its index, so
+// it finds one only if it indexes them.
+bool IsPathIndexed(const string &path) {
+  CFScopedReleaser<CFStringRef> cf_path(CFStringCreateWithCString(
+      kCFAllocatorDefault, path.c_str(), kCFStringEncodingUTF8));
+  CFScopedReleaser<MDQueryRef> query(MDQueryCreate(
+      kCFAllocatorDefault, CFSTR("kMDItemFSName == \"*\""), NULL, NULL));
+  if (!cf_path.isValid() || !query.isValid()) {
+    return false;
+  }
+  const void *scopes[] = {cf_path.get()};
+  CFScopedReleaser<CFArrayRef> cf_scopes(
+      CFArrayCreate(kCFAllocatorDefault, scopes, 1, &kCFTypeArrayCallBacks));
+  if (!cf_scopes.isValid()) {
+    return false;
+  }
+  MDQuerySetSearchScope(query, cf_scopes, 0);
+  MDQuerySetMaxCount(query, 1);
+  if (!MDQueryExecute(query, kMDQuerySynchronous)) {
+    return false;
+  }
+  return MDQueryGetResultCount(query) > 0;
+}
+
+bool SyncFileSystem(const string &path) {
+  return false;
+}
+
+bool CopyFileRange(int in, off_t offset, int out, size_t size) {
+  return false;
+}
+
+int WatchDirectory(const string &path) {
+  return -1;
+}
+
+ssize_t ForwardSocketData(int in, int out, size_t count) {
+  errno = ENOSYS;
+  return -1;
+}
+
 }   // namespace blaze.
@@ -27,6 +27,8 @@
 #include <unistd.h>
 #include <libprocstat.h>  // must be included after <sys/...> headers
 
+#include <algorithm>
+
 #include "src/main/cpp/blaze_util.h"
 #include "src/main/cpp/blaze_util_platform.h"
 #include "src/main/cpp/util/errors.h"
@@ -71,6 +73,14 @@ void WarnFilesystemType(const string &output_base) {
   }
 }
 
+bool IsNetworkFilesystem(const string &path) {
+  struct statfs buf = {};
+  if (statfs(path.c_str(), &buf) < 0) {
+    return false;
+  }
+  return (buf.f_flags & MNT_LOCAL) == 0;
+}
+
 string GetSelfPath() {
   char buffer[PATH_MAX] = {};
   ssize_t bytes = readlink("/proc/curproc/file", buffer, sizeof(buffer));
@@ -116,6 +126,40 @@ void SetScheduling(bool batch_cpu_scheduling, int io_nice_level) {
   }
 }
 
+void SetCgroup(const string& cgroup, const std::vector<string>& settings) {
+  // There are no cgroups on FreeBSD.
+}
+
+void SetCpuAffinity(const string& cpus) {
+  // TODO(bazel-team): Use cpuset_setaffinity.
+}
+
+void SetNumaInterleave() {
+  // TODO(bazel-team): Implement NUMA memory policies on FreeBSD.
+}
+
+uint64_t GetAvailableMemory() {
+  unsigned long memory;  // NOLINT
+  size_t size = sizeof(memory);
+  if (sysctlbyname("hw.physmem", &memory, &size, NULL, 0) != 0) {
+    return 0;
+  }
+  return memory;
+}
+
+int GetAvailableCpus() {
+  return std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+uint64_t GetProcessPeakMemory(int pid) {
+  // TODO(bazel-team): Implement this on FreeBSD.
+  return 0;
+}
+
+bool TransparentHugePagesEnabled() {
+  return false;
+}
+
 string GetProcessCWD(int pid) {
   if (kill(pid, 0) < 0) return "";
   auto procstat = procstat_open_sysctl();
@@ -165,8 +209,37 @@ bool KillServerProcess(
   return true;
 }
 
+int OpenProcessDescriptor(int pid) {
+  return -1;
+}
+
 // Not supported.
 void ExcludePathFromBackup(const string &path) {
 }
 
+// Not supported.
+void ExcludePathFromIndexing(const string &path) {
+}
+
+bool IsPathIndexed(const string &path) {
+  return false;
+}
+
+bool SyncFileSystem(const string &path) {
+  return false;
+}
+
+bool CopyFileRange(int in, off_t offset, int out, size_t size) {
+  return false;
+}
+
+int WatchDirectory(const string &path) {
+  return -1;
+}
+
+ssize_t ForwardSocketData(int in, int out, size_t count) {
+  errno = ENOSYS;
+  return -1;
+}
+
 }  // namespace blaze
@@ -15,24 +15,34 @@
 #include <errno.h>  // errno, ENAMETOOLONG
 #include <limits.h>
 #include <linux/magic.h>
+#include <linux/mempolicy.h>
+#include <poll.h>
 #include <pwd.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>  // strerror
 #include <sys/fcntl.h>
+#include <sys/inotify.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/statfs.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include "src/main/cpp/blaze_util.h"
 #include "src/main/cpp/blaze_util_platform.h"
 #include "src/main/cpp/util/errors.h"
 #include "src/main/cpp/util/exit_code.h"
 #include "src/main/cpp/util/file.h"
+#include "src/main/cpp/util/numbers.h"
 #include "src/main/cpp/util/port.h"
 #include "src/main/cpp/util/strings.h"
+#include "src/main/cpp/util/thread_pool.h"
 
 namespace blaze {
 
@@ -80,6 +90,42 @@ void WarnFilesystemType(const string& output_base) {
   }
 }
 
+// File system types missing from older <linux/magic.h> headers.
+#ifndef CIFS_MAGIC_NUMBER
+#define CIFS_MAGIC_NUMBER 0xFF534D42
+#endif
+#ifndef SMB2_MAGIC_NUMBER
+#define SMB2_MAGIC_NUMBER 0xFE534D42
+#endif
+#ifndef AFS_FS_MAGIC
+#define AFS_FS_MAGIC 0x6B414653
+#endif
+#ifndef CEPH_SUPER_MAGIC
+#define CEPH_SUPER_MAGIC 0x00C36400
+#endif
+
+bool IsNetworkFilesystem(const string& path) {
+  struct statfs buf = {};
+  if (statfs(path.c_str(), &buf) < 0) {
+    return false;
+  }
+  // f_type is signed on some architectures and the CIFS magic numbers don't
+  // fit.
+  switch (static_cast<uint32_t>(buf.f_type)) {
+    case NFS_SUPER_MAGIC:
+    case SMB_SUPER_MAGIC:
+    case CIFS_MAGIC_NUMBER:
+    case SMB2_MAGIC_NUMBER:
+    case CODA_SUPER_MAGIC:
+    case AFS_SUPER_MAGIC:
+    case AFS_FS_MAGIC:
+    case CEPH_SUPER_MAGIC:
+      return true;
+    default:
+      return false;
+  }
+}
+
 string GetSelfPath() {
   char buffer[PATH_MAX] = {};
   ssize_t bytes = readlink("/proc/self/exe", buffer, sizeof(buffer));
@@ -138,6 +184,197 @@ void SetScheduling(bool batch_cpu_scheduling, int io_nice_level) {
   }
 }
 
+// Writes the value to the cgroup interface file. Not WriteFile(), these
+// files must not be unlinked or truncated.
+static bool WriteCgroupFile(const string& path, const string& value) {
+  int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return false;
+  }
+  bool ok = write(fd, value.data(), value.size()) ==
+      static_cast<ssize_t>(value.size());
+  return close(fd) == 0 && ok;
+}
+
+void SetCgroup(const string& cgroup, const vector<string>& settings) {
+  if (cgroup.empty()) {
+    return;
+  }
+  if (MakeDirectories(cgroup, 0755) == -1) {
+    pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+         "Cannot create cgroup '%s'", cgroup.c_str());
+  }
+  for (const auto& setting : settings) {
+    size_t equals = setting.find('=');
+    string file = blaze_util::JoinPath(cgroup, setting.substr(0, equals));
+    if (!WriteCgroupFile(file, setting.substr(equals + 1))) {
+      pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+           "Cannot apply the cgroup setting '%s' to '%s'", setting.c_str(),
+           cgroup.c_str());
+    }
+  }
+  if (!WriteCgroupFile(blaze_util::JoinPath(cgroup, "cgroup.procs"),
+                       ToString(getpid()))) {
+    pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+         "Cannot move the process into cgroup '%s'", cgroup.c_str());
+  }
+}
+
+// Parses a list in the format of cpuset lists (e.g. "0-3,8"), the numbers
+// have to be less than limit.
+static bool ParseCpuList(const string& list, int limit, vector<int>* result) {
+  for (const auto& range : blaze_util::Split(list, ',')) {
+    size_t dash = range.find('-');
+    int first, last;
+    if (!blaze_util::safe_strto32(range.substr(0, dash), &first) ||
+        !blaze_util::safe_strto32(
+            dash == string::npos ? range : range.substr(dash + 1), &last) ||
+        first < 0 || first > last || last >= limit) {
+      return false;
+    }
+    for (int i = first; i <= last; ++i) {
+      result->push_back(i);
+    }
+  }
+  return !result->empty();
+}
+
+void SetCpuAffinity(const string& cpus) {
+  if (cpus.empty()) {
+    return;
+  }
+  vector<int> cpu_list;
+  if (!ParseCpuList(cpus, CPU_SETSIZE, &cpu_list)) {
+    die(blaze_exit_code::BAD_ARGV,
+        "Invalid argument to --server_cpu_affinity: '%s'", cpus.c_str());
+  }
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (int cpu : cpu_list) {
+    CPU_SET(cpu, &cpu_set);
+  }
+  if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+    pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+         "sched_setaffinity(%s) failed", cpus.c_str());
+  }
+}
+
+void SetNumaInterleave() {
+  // The same as "numactl --interleave=all". The node mask must not have bits
+  // beyond the nodes the kernel supports, hence the list of possible nodes.
+  string possible;
+  vector<int> nodes;
+  if (!ReadFile("/sys/devices/system/node/possible", &possible)) {
+    return;  // Not a NUMA kernel.
+  }
+  blaze_util::StripWhitespace(&possible);
+  static const int kMaxNodes = 4096;
+  if (!ParseCpuList(possible, kMaxNodes, &nodes)) {
+    die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+        "Cannot parse the NUMA nodes '%s'", possible.c_str());
+  }
+  static const int kBitsPerWord = 8 * sizeof(unsigned long);  // NOLINT
+  vector<unsigned long> node_mask(kMaxNodes / kBitsPerWord);  // NOLINT
+  int max_node = 0;
+  for (int node : nodes) {
+    node_mask[node / kBitsPerWord] |= 1UL << (node % kBitsPerWord);
+    max_node = std::max(max_node, node);
+  }
+  // The kernel ignores the last bit of maxnode.
+  if (syscall(SYS_set_mempolicy, MPOL_INTERLEAVE, node_mask.data(),
+              max_node + 2) != 0) {
+    pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+         "set_mempolicy(MPOL_INTERLEAVE) failed");
+  }
+}
+
+// Returns the contents of the interface file 'name' of the cgroup of the
+// current process and of its ancestors, closest first. 'hierarchy' is where
+// the cgroup hierarchy is mounted and 'controller' the controller it is for
+// (cgroup v1), or empty for the unified hierarchy (cgroup v2).
+static vector<string> ReadCgroupFiles(const string& hierarchy,
+                                      const string& controller,
+                                      const string& name) {
+  vector<string> result;
+  string cgroups;
+  if (!ReadFile("/proc/self/cgroup", &cgroups)) {
+    return result;
+  }
+  // Lines are "<hierarchy id>:<controller,...>:<cgroup path>".
+  for (const auto& line : blaze_util::Split(cgroups, '\n')) {
+    size_t first = line.find(':');
+    size_t second =
+        first == string::npos ? string::npos : line.find(':', first + 1);
+    if (second == string::npos) {
+      continue;
+    }
+    vector<string> controllers =
+        blaze_util::Split(line.substr(first + 1, second - first - 1), ',');
+    if (controller.empty() ? !controllers.empty()
+                           : std::find(controllers.begin(), controllers.end(),
+                                       controller) == controllers.end()) {
+      continue;
+    }
+    string path = line.substr(second + 1);
+    for (;;) {
+      string content;
+      if (ReadFile(hierarchy + path + "/" + name, &content)) {
+        blaze_util::StripWhitespace(&content);
+        result.push_back(content);
+      }
+      if (path.empty() || path == "/") {
+        break;
+      }
+      path = blaze_util::Dirname(path);
+    }
+    break;
+  }
+  return result;
+}
+
+uint64_t GetAvailableMemory() {
+  uint64_t memory = static_cast<uint64_t>(sysconf(_SC_PHYS_PAGES)) *
+                    sysconf(_SC_PAGESIZE);
+  // "max" (cgroup v2) and the huge value of cgroup v1 mean no limit.
+  vector<string> limits = ReadCgroupFiles("/sys/fs/cgroup", "", "memory.max");
+  vector<string> high = ReadCgroupFiles("/sys/fs/cgroup", "", "memory.high");
+  limits.insert(limits.end(), high.begin(), high.end());
+  vector<string> v1_limits = ReadCgroupFiles(
+      "/sys/fs/cgroup/memory", "memory", "memory.limit_in_bytes");
+  limits.insert(limits.end(), v1_limits.begin(), v1_limits.end());
+  for (const auto& limit : limits) {
+    char* end;
+    uint64_t value = strtoull(limit.c_str(), &end, 10);
+    if (end != limit.c_str() && *end == '\0' && value > 0 &&
+        value < memory) {
+      memory = value;
+    }
+  }
+  return memory;
+}
+
+int GetAvailableCpus() {
+  return blaze_util::AvailableCpus();
+}
+
+uint64_t GetProcessPeakMemory(int pid) {
+  string status;
+  if (!ReadFile("/proc/" + ToString(pid) + "/status", &status)) {
+    return 0;
+  }
+  size_t line = status.find("\nVmHWM:");
+  if (line == string::npos) {
+    return 0;
+  }
+  return strtoull(status.c_str() + line + 7, NULL, 10) * 1024;  // In kB.
+}
+
+bool TransparentHugePagesEnabled() {
+  string enabled;
+  return ReadFile("/sys/kernel/mm/transparent_hugepage/enabled", &enabled) &&
+      enabled.find("[never]") == string::npos;
+}
+
 string GetProcessCWD(int pid) {
   char server_cwd[PATH_MAX] = {};
   if (readlink(
@@ -260,10 +497,16 @@ void WriteSystemSpecificProcessIdentifier(const string& server_dir) {
 // close(), all of which are safe to call from signal handlers.
 bool KillServerProcess(
     int pid, const string& output_base, const string& install_base) {
+  // Opened before the start time is checked, so that it refers to the
+  // checked process even if the PID is reused.
+  int process_fd = OpenProcessDescriptor(pid);
   char start_time[256];
   if (!GetStartTime(pid, start_time, sizeof(start_time))) {
     // Cannot read PID file from /proc . Process died meantime, all is good. No
     // stale server is present.
+    if (process_fd != -1) {
+      close(process_fd);
+    }
     return false;
   }
 
@@ -277,11 +520,22 @@ bool KillServerProcess(
   // start time files yet.
   if (file_present && recorded_start_time != start_time) {
     // This is a different process.
+    if (process_fd != -1) {
+      close(process_fd);
+    }
     return false;
   }
 
   // Kill the process and make sure it's dead before proceeding.
   killpg(pid, SIGKILL);
+  if (process_fd != -1) {
+    // Wait for the server itself without polling, then for the rest of its
+    // process group below (which is usually gone by then).
+    struct pollfd pfd = {process_fd, POLLIN, 0};
+    while (poll(&pfd, 1, 10000) == -1 && errno == EINTR) {
+    }
+    close(process_fd);
+  }
   int check_killed_retries = 10;
   while (killpg(pid, 0) == 0) {
     if (check_killed_retries-- > 0) {
@@ -295,8 +549,83 @@ bool KillServerProcess(
   return true;
 }
 
+int OpenProcessDescriptor(int pid) {
+#ifdef SYS_pidfd_open
+  // Linux 5.3 or later. Older kernels fail with ENOSYS.
+  return syscall(SYS_pidfd_open, pid, 0);
+#else
+  return -1;
+#endif
+}
+
 // Not supported.
 void ExcludePathFromBackup(const string &path) {
 }
 
+// Not supported.
+void ExcludePathFromIndexing(const string &path) {
+}
+
+bool IsPathIndexed(const string &path) {
+  return false;
+}
+
+bool SyncFileSystem(const string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  bool synced = syncfs(fd) == 0;
+  close(fd);
+  return synced;
+}
+
+bool CopyFileRange(int in, off_t offset, int out, size_t size) {
+#ifdef __NR_copy_file_range
+  // Called through syscall(), glibc only has a wrapper since 2.27.
+  loff_t in_offset = offset;
+  while (size > 0) {
+    ssize_t copied =
+        syscall(__NR_copy_file_range, in, &in_offset, out, NULL, size, 0);
+    if (copied < 0 && errno == EINTR) {
+      continue;
+    }
+    if (copied <= 0) {
+      return false;
+    }
+    size -= copied;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+int WatchDirectory(const string &path) {
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  if (inotify_add_watch(fd, path.c_str(),
+                        IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+ssize_t ForwardSocketData(int in, int out, size_t count) {
+  // splice() needs a pipe on one side. Going through an intermediate pipe for
+  // a file would not save anything, the file system copies the data anyway.
+  struct stat statbuf;
+  if (fstat(out, &statbuf) != 0) {
+    return -1;
+  }
+  if (!S_ISFIFO(statbuf.st_mode)) {
+    errno = EINVAL;
+    return -1;
+  }
+  return splice(in, NULL, out, NULL, count, SPLICE_F_MOVE);
+}
+
 }  // namespace blaze
@@ -22,8 +22,10 @@
 
 #include <windows.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstdio>
+#include <memory>
 #include <thread>  // NOLINT (to slience Google-internal linter)
 
 #include "src/main/cpp/blaze_util.h"
@@ -66,6 +68,10 @@ static void PrintError(const string& op) {
 void WarnFilesystemType(const string& output_base) {
 }
 
+bool IsNetworkFilesystem(const string& path) {
+  return false;
+}
+
 string GetSelfPath() {
   char buffer[PATH_MAX] = {};
   if (!GetModuleFileName(0, buffer, sizeof(buffer))) {
@@ -109,6 +115,40 @@ void SetScheduling(bool batch_cpu_scheduling, int io_nice_level) {
   // TODO(bazel-team): There should be a similar function on Windows.
 }
 
+void SetCgroup(const string& cgroup, const vector<string>& settings) {
+  // There are no cgroups on Windows.
+}
+
+void SetCpuAffinity(const string& cpus) {
+  // TODO(bazel-team): Use SetProcessAffinityMask.
+}
+
+void SetNumaInterleave() {
+  // TODO(bazel-team): Implement NUMA memory policies on Windows.
+}
+
+uint64_t GetAvailableMemory() {
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (!GlobalMemoryStatusEx(&status)) {
+    return 0;
+  }
+  return status.ullTotalPhys;
+}
+
+int GetAvailableCpus() {
+  return std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+uint64_t GetProcessPeakMemory(int pid) {
+  // TODO(bazel-team): Implement this on Windows.
+  return 0;
+}
+
+bool TransparentHugePagesEnabled() {
+  return false;
+}
+
 string GetProcessCWD(int pid) {
   char server_cwd[PATH_MAX] = {};
   if (readlink(
@@ -289,51 +329,31 @@ string RunProgram(
   return result;
 }
 
-// If we pass DETACHED_PROCESS to CreateProcess(), cmd.exe appropriately
-// returns the command prompt when the client terminates. msys2, however, in
-// its infinite wisdom, waits until the *server* terminates and cannot be
-// convinced otherwise.
-//
-// So, we first pretend to be a POSIX daemon so that msys2 knows about our
-// intentions and *then* we call CreateProcess(). Life ain't easy.
-static bool DaemonizeOnWindows() {
-  if (fork() > 0) {
-    // We are the original client process.
-    return true;
-  }
-
-  if (fork() > 0) {
-    // We are the child of the original client process. Terminate so that the
-    // actual server is not a child process of the client.
-    exit(0);
+// Keeps an eye on the server process through its handle, so that the client
+// notices at once if the server dies during startup.
+class ProcessHandleBlazeServerStartup : public BlazeServerStartup {
+ public:
+  explicit ProcessHandleBlazeServerStartup(HANDLE process)
+      : process_(process) {}
+  virtual ~ProcessHandleBlazeServerStartup() { CloseHandle(process_); }
+  virtual bool IsStillAlive() {
+    return WaitForSingleObject(process_, 0) == WAIT_TIMEOUT;
   }
 
-  setsid();
-  // Contrary to the POSIX version, we are not closing the three standard file
-  // descriptors here. CreateProcess() will take care of that and it's useful
-  // to see the error messages in ExecuteDaemon() on the console of the client.
-  return false;
-}
-
-// Keeping an eye on the server process on Windows is not implemented yet.
-// TODO(lberki): Implement this, because otherwise if we can't start up a server
-// process, the client will hang until it times out.
-class DummyBlazeServerStartup : public BlazeServerStartup {
- public:
-  DummyBlazeServerStartup() {}
-  virtual ~DummyBlazeServerStartup() {}
-  virtual bool IsStillAlive() { return true; }
+ private:
+  HANDLE process_;
 };
 
+// If the server inherited every inheritable handle of the client, msys2
+// would wait until the *server* terminates before returning the command
+// prompt, because the server would keep its terminal pipes open. We used to
+// fork twice and call setsid() to avoid that, which is slow under msys2 and
+// loses the server's process handle. Instead, the server only inherits its
+// standard handles, listed explicitly with PROC_THREAD_ATTRIBUTE_HANDLE_LIST,
+// and is started directly from the client.
 void ExecuteDaemon(const string& exe, const std::vector<string>& args_vector,
                    const string& daemon_output, const string& server_dir,
                    BlazeServerStartup** server_startup) {
-  if (DaemonizeOnWindows()) {
-    // We are the client process
-    *server_startup = new DummyBlazeServerStartup();
-    return;
-  }
-
   SECURITY_ATTRIBUTES sa;
   sa.nLength = sizeof(SECURITY_ATTRIBUTES);
   // We redirect stdout and stderr by telling CreateProcess to use a file handle
@@ -364,13 +384,34 @@ void ExecuteDaemon(const string& exe, const std::vector<string>& args_vector,
     pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR, "SetHandleInformation");
   }
 
-  PROCESS_INFORMATION processInfo = {0};
-  STARTUPINFO startupInfo = {0};
+  // The only handles the server inherits.
+  HANDLE inherited_handles[] = {pipe_read, output_file};
+  SIZE_T attribute_list_size = 0;
+  InitializeProcThreadAttributeList(NULL, 1, 0, &attribute_list_size);
+  std::unique_ptr<char[]> attribute_list_buffer(new char[attribute_list_size]);
+  LPPROC_THREAD_ATTRIBUTE_LIST attribute_list =
+      reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(
+          attribute_list_buffer.get());
+  if (!InitializeProcThreadAttributeList(attribute_list, 1, 0,
+                                         &attribute_list_size) ||
+      !UpdateProcThreadAttribute(attribute_list, 0,
+                                 PROC_THREAD_ATTRIBUTE_HANDLE_LIST,
+                                 inherited_handles, sizeof(inherited_handles),
+                                 NULL, NULL)) {
+    pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+         "ExecuteDaemon: error %u setting up the inherited handles",
+         GetLastError());
+  }
 
-  startupInfo.hStdInput = pipe_read;
-  startupInfo.hStdError = output_file;
-  startupInfo.hStdOutput = output_file;
-  startupInfo.dwFlags |= STARTF_USESTDHANDLES;
+  PROCESS_INFORMATION processInfo = {0};
+  STARTUPINFOEX startupInfo = {0};
+
+  startupInfo.StartupInfo.cb = sizeof(startupInfo);
+  startupInfo.StartupInfo.hStdInput = pipe_read;
+  startupInfo.StartupInfo.hStdError = output_file;
+  startupInfo.StartupInfo.hStdOutput = output_file;
+  startupInfo.StartupInfo.dwFlags |= STARTF_USESTDHANDLES;
+  startupInfo.lpAttributeList = attribute_list;
   CmdLine cmdline;
   CreateCommandLine(&cmdline, exe, args_vector);
 
@@ -387,10 +428,11 @@ void ExecuteDaemon(const string& exe, const std::vector<string>& args_vector,
       NULL,  // _In_opt_    LPSECURITY_ATTRIBUTES lpThreadAttributes,
       TRUE,  // _In_        BOOL                  bInheritHandles,
       //                 _In_        DWORD                 dwCreationFlags,
-      DETACHED_PROCESS | CREATE_NEW_PROCESS_GROUP,
+      DETACHED_PROCESS | CREATE_NEW_PROCESS_GROUP |
+          EXTENDED_STARTUPINFO_PRESENT,
       NULL,           // _In_opt_    LPVOID                lpEnvironment,
       NULL,           // _In_opt_    LPCTSTR               lpCurrentDirectory,
-      &startupInfo,   // _In_        LPSTARTUPINFO         lpStartupInfo,
+      &startupInfo.StartupInfo,  // _In_  LPSTARTUPINFO    lpStartupInfo,
       &processInfo);  // _Out_       LPPROCESS_INFORMATION lpProcessInformation
 
   if (!ok) {
@@ -399,6 +441,7 @@ void ExecuteDaemon(const string& exe, const std::vector<string>& args_vector,
          GetLastError(), cmdline.cmdline);
   }
 
+  DeleteProcThreadAttributeList(attribute_list);
   CloseHandle(output_file);
   CloseHandle(pipe_write);
   CloseHandle(pipe_read);
@@ -410,10 +453,8 @@ void ExecuteDaemon(const string& exe, const std::vector<string>& args_vector,
     fprintf(stderr, "Cannot write PID file %s\n", pid_file.c_str());
   }
 
-  CloseHandle(processInfo.hProcess);
   CloseHandle(processInfo.hThread);
-
-  exit(0);
+  *server_startup = new ProcessHandleBlazeServerStartup(processInfo.hProcess);
 }
 
 void BatchWaiterThread(HANDLE java_handle) {
@@ -459,6 +500,12 @@ static bool IsFailureDueToNestedJobsNotSupported(HANDLE process) {
       || version_info.dwMajorVersion == 6 && version_info.dwMinorVersion <= 1;
 }
 
+bool ExecuteInBackground(const string& exe,
+                         const std::vector<string>& args_vector,
+                         const string& output) {
+  return false;
+}
+
 // Run the given program in the current working directory,
 // using the given argument vector.
 void ExecuteProgram(
@@ -780,8 +827,37 @@ bool KillServerProcess(
   return result;
 }
 
+int OpenProcessDescriptor(int pid) {
+  return -1;
+}
+
 // Not supported.
 void ExcludePathFromBackup(const string &path) {
 }
 
+// Not supported.
+void ExcludePathFromIndexing(const string &path) {
+}
+
+bool IsPathIndexed(const string &path) {
+  return false;
+}
+
+bool SyncFileSystem(const string &path) {
+  return false;
+}
+
+bool CopyFileRange(int in, off_t offset, int out, size_t size) {
+  return false;
+}
+
+int WatchDirectory(const string &path) {
+  return -1;
+}
+
+ssize_t ForwardSocketData(int in, int out, size_t count) {
+  errno = ENOSYS;
+  return -1;
+}
+
 }  // namespace blaze
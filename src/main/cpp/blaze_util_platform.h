@@ -18,6 +18,7 @@
 #include <stdint.h>
 
 #include <string>
+#include <vector>
 
 namespace blaze {
 
@@ -33,6 +34,10 @@ pid_t GetPeerProcessId(int socket);
 // Warn about dubious filesystem types, such as NFS, case-insensitive (?).
 void WarnFilesystemType(const std::string& output_base);
 
+// Returns true if the given path is on a network file system, such as NFS or
+// SMB, and false if it is local or its file system type can't be determined.
+bool IsNetworkFilesystem(const std::string& path);
+
 // Wrapper around clock_gettime(CLOCK_MONOTONIC) that returns the time
 // as a uint64_t nanoseconds since epoch.
 uint64_t MonotonicClock();
@@ -45,6 +50,38 @@ uint64_t ProcessClock();
 // on Linux, so it should only be called when necessary.
 void SetScheduling(bool batch_cpu_scheduling, int io_nice_level);
 
+// Moves the current process (and so its future children) into the given
+// cgroup directory, which is created if needed, after writing the
+// "<interface file>=<value>" settings into it.
+void SetCgroup(const std::string& cgroup,
+               const std::vector<std::string>& settings);
+
+// Restricts the current process (and so its future children) to the CPUs in
+// the given cpuset list (e.g. "0-3,8").
+void SetCpuAffinity(const std::string& cpus);
+
+// Makes the memory of the current process (and so of its future children)
+// interleaved across all NUMA nodes. Does nothing on non-NUMA systems.
+void SetNumaInterleave();
+
+// Returns the memory in bytes that the current process (and so its future
+// children) can use: the physical memory, or the memory limit of its cgroup
+// if that is lower. Returns 0 if it is not known.
+uint64_t GetAvailableMemory();
+
+// Returns the number of CPUs that the current process (and so its future
+// children) can use: the ones it may run on, or fewer if the CPU quota of
+// its cgroup is lower.
+int GetAvailableCpus();
+
+// Returns the peak resident set size in bytes of the process, 0 if it is not
+// known.
+uint64_t GetProcessPeakMemory(int pid);
+
+// Returns true if transparent huge pages can be used (in "always" or
+// "madvise" mode, the JVM madvises its heap).
+bool TransparentHugePagesEnabled();
+
 // Returns the cwd for a process.
 std::string GetProcessCWD(int pid);
 
@@ -74,6 +111,14 @@ void ExecuteDaemon(const string& exe, const std::vector<string>& args_vector,
                    const string& daemon_output, const string& server_dir,
                    BlazeServerStartup** server_startup);
 
+// Starts a program in the background, detached from the client the same way
+// as a daemon, with its standard output and standard error redirected to the
+// file "output", and does not wait for it. Returns false if that is not
+// supported.
+bool ExecuteInBackground(const string& exe,
+                         const std::vector<string>& args_vector,
+                         const string& output);
+
 // Executes a subprocess and returns its standard output and standard error.
 // If this fails, exits with the appropriate error code.
 string RunProgram(const string& exe, const std::vector<string>& args_vector);
@@ -129,9 +174,49 @@ void ReleaseLock(BlazeLock* blaze_lock);
 bool KillServerProcess(
     int pid, const string& output_base, const string& install_base);
 
+// Returns a file descriptor which becomes readable when the given process
+// terminates, or -1 if that is not supported or the process does not exist.
+// The caller has to close it.
+// This function can be called from a signal handler!
+int OpenProcessDescriptor(int pid);
+
 // Mark path as being excluded from backups (if supported by operating system).
 void ExcludePathFromBackup(const string &path);
 
+// Marks the directory 'path' as not to be indexed by desktop search (if
+// supported by the operating system) and excludes it from backups. Best
+// effort: a read-only directory is silently left as it is.
+void ExcludePathFromIndexing(const string &path);
+
+// Returns true if desktop search has indexed files below 'path' nonetheless,
+// false if it has not or that cannot be told.
+bool IsPathIndexed(const string &path);
+
+// Writes everything cached for the file system containing 'path' to the
+// disk, as sync() does for all the file systems. Returns false if that is
+// not supported, the files then have to be synced one by one.
+bool SyncFileSystem(const string &path);
+
+// Copies 'size' bytes at 'offset' in the file 'in' to the file 'out', from
+// its current position, without going through user space (and without
+// writing the data at all where the file system can share it between the
+// files). Returns false if that is not supported, the data has then to be
+// copied by reading and writing it; 'out' may have been written to.
+bool CopyFileRange(int in, off_t offset, int out, size_t size);
+
+// Returns a non-blocking file descriptor that becomes readable when a file is
+// created, written or moved into the directory 'path', or -1 if that is not
+// supported. Read the descriptor to clear the notification; close it when
+// done.
+int WatchDirectory(const string &path);
+
+// Moves up to 'count' bytes from the socket 'in' to 'out' within the kernel,
+// without copying them to the user space. Returns the number of bytes moved,
+// 0 at the end of the input, or -1 with errno set. If that is not supported
+// for 'out' (only pipes are on Linux), nothing is consumed from 'in', so the
+// data can be read and written instead.
+ssize_t ForwardSocketData(int in, int out, size_t count);
+
 }  // namespace blaze
 
 #endif  // BAZEL_SRC_MAIN_CPP_BLAZE_UTIL_PLATFORM_H_
@@ -17,6 +17,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include <algorithm>
 #include <cassert>
@@ -26,6 +28,7 @@
 #include "src/main/cpp/blaze_util.h"
 #include "src/main/cpp/blaze_util_platform.h"
 #include "src/main/cpp/util/file.h"
+#include "src/main/cpp/util/md5.h"
 #include "src/main/cpp/util/strings.h"
 #include "src/main/cpp/workspace_layout.h"
 
@@ -53,12 +56,13 @@ blaze_exit_code::ExitCode OptionProcessor::RcFile::Parse(
     const string& workspace,
     vector<RcFile*>* rcfiles,
     map<string, vector<RcOption> >* rcoptions,
+    string* startup_info,
     string* error) {
   list<string> initial_import_stack;
   initial_import_stack.push_back(filename_);
   return Parse(
       workspace, filename_, index_, rcfiles, rcoptions, &initial_import_stack,
-      error);
+      startup_info, error);
 }
 
 blaze_exit_code::ExitCode OptionProcessor::RcFile::Parse(
@@ -68,6 +72,7 @@ blaze_exit_code::ExitCode OptionProcessor::RcFile::Parse(
     vector<RcFile*>* rcfiles,
     map<string, vector<RcOption> >* rcoptions,
     list<string>* import_stack,
+    string* startup_info,
     string* error) {
   string filename(filename_ref);  // file
   string contents;
@@ -83,23 +88,33 @@ blaze_exit_code::ExitCode OptionProcessor::RcFile::Parse(
   blaze_util::Replace("\\\n", "", &contents);
   vector<string> startup_options;
 
-  vector<string> lines = blaze_util::Split(contents, '\n');
-  for (int line = 0; line < lines.size(); ++line) {
-    blaze_util::StripWhitespace(&lines[line]);
-
-    // Check for an empty line.
-    if (lines[line].empty()) {
-      continue;
+  vector<string> words;
+  size_t line_start = 0;
+  while (line_start < contents.size()) {
+    size_t line_end = contents.find('\n', line_start);
+    if (line_end == string::npos) {
+      line_end = contents.size();
     }
 
-    vector<string> words;
+    // Strip whitespace from both ends of the line.
+    const char *line = contents.data() + line_start;
+    const char *line_limit = contents.data() + line_end;
+    while (line < line_limit && blaze_util::ascii_isspace(*line)) {
+      ++line;
+    }
+    while (line < line_limit && blaze_util::ascii_isspace(line_limit[-1])) {
+      --line_limit;
+    }
+    line_start = line_end + 1;
+    size_t line_length = line_limit - line;
 
     // This will treat "#" as a comment, and properly
     // quote single and double quotes, and treat '\'
-    // as an escape character.
+    // as an escape character. Empty lines yield no words.
     // TODO(bazel-team): This function silently ignores
     // dangling backslash escapes and missing end-quotes.
-    blaze_util::Tokenize(lines[line], '#', &words);
+    words.clear();
+    blaze_util::Tokenize(line, line_length, '#', &words);
 
     if (words.empty()) {
       // Could happen if line starts with "#"
@@ -116,7 +131,7 @@ blaze_exit_code::ExitCode OptionProcessor::RcFile::Parse(
                   workspace, &words[1]))) {
         blaze_util::StringPrintf(error,
             "Invalid import declaration in .blazerc file '%s': '%s'",
-            filename.c_str(), lines[line].c_str());
+            filename.c_str(), string(line, line_length).c_str());
         return blaze_exit_code::BAD_ARGV;
       }
       if (std::find(import_stack->begin(), import_stack->end(), words[1]) !=
@@ -136,7 +151,7 @@ blaze_exit_code::ExitCode OptionProcessor::RcFile::Parse(
       blaze_exit_code::ExitCode parse_exit_code =
         RcFile::Parse(workspace, rcfiles->back()->Filename(),
                       rcfiles->back()->Index(),
-                      rcfiles, rcoptions, import_stack, error);
+                      rcfiles, rcoptions, import_stack, startup_info, error);
       if (parse_exit_code != blaze_exit_code::SUCCESS) {
         return parse_exit_code;
       }
@@ -154,8 +169,12 @@ blaze_exit_code::ExitCode OptionProcessor::RcFile::Parse(
   if (!startup_options.empty()) {
     string startup_args;
     blaze_util::JoinStrings(startup_options, ' ', &startup_args);
-    fprintf(stderr, "INFO: Reading 'startup' options from %s: %s\n",
-            filename.c_str(), startup_args.c_str());
+    string message;
+    blaze_util::StringPrintf(&message,
+        "INFO: Reading 'startup' options from %s: %s\n",
+        filename.c_str(), startup_args.c_str());
+    fputs(message.c_str(), stderr);
+    startup_info->append(message);
   }
   return blaze_exit_code::SUCCESS;
 }
@@ -268,17 +287,29 @@ blaze_exit_code::ExitCode OptionProcessor::ParseOptions(
   // blazercs, all while preserving order. Duplicates can arise if e.g. the
   // binary's path *is* the depot path.
   set<string> blazerc_paths;
+  vector<string> top_level_blazerc_paths;
+  string cache_key = workspace;
   for (const auto& candidate_blazerc_path : candidate_blazerc_paths) {
     if (!candidate_blazerc_path.empty()
         && (blazerc_paths.insert(candidate_blazerc_path).second)) {
-      blazercs_.push_back(
-          new RcFile(candidate_blazerc_path, blazercs_.size()));
+      top_level_blazerc_paths.push_back(candidate_blazerc_path);
+      cache_key += '\0';
+      cache_key += candidate_blazerc_path;
+    }
+  }
+  string cache_path = RcCachePath(cache_key);
+  if (!ReadRcCache(cache_path, cache_key)) {
+    string startup_info;
+    for (const auto& blazerc_path : top_level_blazerc_paths) {
+      blazercs_.push_back(new RcFile(blazerc_path, blazercs_.size()));
       blaze_exit_code::ExitCode parse_exit_code =
-          blazercs_.back()->Parse(workspace, &blazercs_, &rcoptions_, error);
+          blazercs_.back()->Parse(workspace, &blazercs_, &rcoptions_,
+                                  &startup_info, error);
       if (parse_exit_code != blaze_exit_code::SUCCESS) {
         return parse_exit_code;
       }
     }
+    WriteRcCache(cache_path, cache_key, startup_info);
   }
 
   blaze_exit_code::ExitCode parse_startup_options_exit_code =
@@ -317,6 +348,129 @@ blaze_exit_code::ExitCode OptionProcessor::ParseOptions(
   return ParseOptions(args, workspace, cwd, error);
 }
 
+// The format of the blazerc cache is a sequence of NUL terminated fields:
+// the version and the key, then for every blazerc file (in the index order)
+// "file", its name and its FileStamp(), then for every option "option", the
+// index of the blazerc file, the command and the option, then "info" and the
+// messages about the startup options.
+static const char kRcCacheVersion[] = "rc_cache_v1";
+
+// Returns a string which changes when given file does (its size,
+// modification time and inode number) in stamp. Also sets is_recent if the
+// file was modified so recently that the next modification might not change
+// the stamp.
+static bool FileStamp(const string& path, string* stamp, bool* is_recent) {
+  struct stat buf;
+  if (stat(path.c_str(), &buf) != 0) {
+    return false;
+  }
+  blaze_util::StringPrintf(stamp, "%lld:%lld:%llu",
+                           static_cast<long long>(buf.st_size),
+                           static_cast<long long>(buf.st_mtime),
+                           static_cast<unsigned long long>(buf.st_ino));
+  *is_recent = buf.st_mtime + 2 >= time(NULL);
+  return true;
+}
+
+string OptionProcessor::RcCachePath(const string& cache_key) const {
+  unsigned char buf[blaze_util::Md5Digest::kDigestLength];
+  blaze_util::Md5Digest digest;
+  digest.Update(cache_key.data(), cache_key.size());
+  digest.Finish(buf);
+  return blaze_util::JoinPath(
+      parsed_startup_options_->output_user_root,
+      "rc_cache/" + digest.String());
+}
+
+bool OptionProcessor::ReadRcCache(const string& cache_path,
+                                  const string& cache_key) {
+  // The key itself consists of NUL terminated fields.
+  string header = string(kRcCacheVersion) + '\0' + cache_key + '\0';
+  string contents;
+  if (!ReadFile(cache_path, &contents) ||
+      contents.compare(0, header.size(), header) != 0 ||
+      contents[contents.size() - 1] != '\0') {
+    return false;
+  }
+  // Not blaze_util::Split(), empty fields are significant.
+  vector<string> fields;
+  for (size_t start = header.size(); start < contents.size();) {
+    size_t end = contents.find('\0', start);
+    fields.push_back(contents.substr(start, end - start));
+    start = end + 1;
+  }
+
+  vector<RcFile*> rcfiles;
+  map<string, vector<RcOption> > rcoptions;
+  bool valid = true;
+  size_t i = 0;
+  while (valid && i < fields.size() && fields[i] != "info") {
+    if (fields[i] == "file" && i + 2 < fields.size()) {
+      string stamp;
+      bool is_recent;
+      valid = FileStamp(fields[i + 1], &stamp, &is_recent) &&
+          stamp == fields[i + 2];
+      rcfiles.push_back(new RcFile(fields[i + 1], rcfiles.size()));
+      i += 3;
+    } else if (fields[i] == "option" && i + 3 < fields.size()) {
+      int index = atoi(fields[i + 1].c_str());
+      valid = index >= 0 && static_cast<size_t>(index) < rcfiles.size();
+      rcoptions[fields[i + 2]].push_back(RcOption(index, fields[i + 3]));
+      i += 4;
+    } else {
+      valid = false;
+    }
+  }
+  if (!valid || i + 2 != fields.size()) {
+    for (auto rcfile : rcfiles) {
+      delete rcfile;
+    }
+    return false;
+  }
+
+  fputs(fields[i + 1].c_str(), stderr);
+  blazercs_.swap(rcfiles);
+  rcoptions_.swap(rcoptions);
+  return true;
+}
+
+void OptionProcessor::WriteRcCache(const string& cache_path,
+                                   const string& cache_key,
+                                   const string& startup_info) const {
+  string contents = string(kRcCacheVersion) + '\0' + cache_key + '\0';
+  for (auto rcfile : blazercs_) {
+    string stamp;
+    bool is_recent;
+    // A file modified at about the same time as it was read could have been
+    // modified after it was read, don't trust its stamp.
+    if (!FileStamp(rcfile->Filename(), &stamp, &is_recent) || is_recent) {
+      return;
+    }
+    contents += "file";
+    contents += '\0' + rcfile->Filename() + '\0' + stamp + '\0';
+  }
+  for (const auto& command_options : rcoptions_) {
+    for (const auto& rcoption : command_options.second) {
+      contents += "option";
+      contents += '\0' + ToString(rcoption.rcfile_index()) + '\0' +
+          command_options.first + '\0' + rcoption.option() + '\0';
+    }
+  }
+  contents += "info";
+  contents += '\0' + startup_info + '\0';
+
+  // The cache is only an optimization, failing to write it is not an error.
+  string cache_dir = blaze_util::Dirname(cache_path);
+  if (MakeDirectories(cache_dir, 0755) == -1) {
+    return;
+  }
+  string tmp_path = cache_path + ".tmp." + ToString(getpid());
+  if (!WriteFile(contents, tmp_path) ||
+      rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+    UnlinkPath(tmp_path);
+  }
+}
+
 static bool IsArg(const string& arg) {
   return blaze_util::starts_with(arg, "-") && (arg != "--help")
       && (arg != "-help") && (arg != "-h");
@@ -387,6 +541,10 @@ blaze_exit_code::ExitCode OptionProcessor::ParseStartupOptions(string *error) {
   return blaze_exit_code::SUCCESS;
 }
 
+// The minimum number of seconds between progress messages when the client
+// runs in an ssh session, unless the user chose a value.
+static const char kRemoteProgressRateLimit[] = "0.5";
+
 // Appends the command and arguments from argc/argv to the end of arg_vector,
 // and also splices in some additional terminal and environment options between
 // the command and the arguments. NB: Keep the options added here in sync with
@@ -399,6 +557,13 @@ void OptionProcessor::AddRcfileArgsAndOptions(bool batch, const string& cwd) {
   command_arguments_.push_back(
       "--default_override=0:common=--terminal_columns=" +
       ToString(GetTerminalColumns()));
+  // Over ssh, frequent progress redraws cost more bandwidth and terminal time
+  // than they are worth, so ask the server for fewer of them by default.
+  if (IsStandardTerminal() && IsRemoteTerminal()) {
+    command_arguments_.push_back(
+        "--default_override=0:common=--show_progress_rate_limit=" +
+        string(kRemoteProgressRateLimit));
+  }
 
   // Push the options mapping .blazerc numbers to filenames.
   for (int i_blazerc = 0; i_blazerc < blazercs_.size(); i_blazerc++) {
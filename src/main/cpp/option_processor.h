@@ -83,10 +83,13 @@ class OptionProcessor {
   class RcFile {
    public:
     RcFile(const string& filename, int index);
+    // Parses the file and the files it imports. The messages printed about
+    // the startup options are also appended to startup_info.
     blaze_exit_code::ExitCode Parse(
         const string& workspace,
         std::vector<RcFile*>* rcfiles,
         std::map<string, std::vector<RcOption> >* rcoptions,
+        string* startup_info,
         string* error);
     const string& Filename() const { return filename_; }
     const int Index() const { return index_; }
@@ -99,12 +102,24 @@ class OptionProcessor {
                                            std::map<string,
                                            std::vector<RcOption> >* rcoptions,
                                            std::list<string>* import_stack,
+                                           string* startup_info,
                                            string* error);
 
     string filename_;
     int index_;
   };
 
+  // The parsed blazerc files are cached in the output user root, keyed by the
+  // workspace and the top level blazerc files. The cache is used as long as
+  // none of the files it was created from (including the imported ones) has
+  // changed, which saves reading and tokenizing them on every invocation.
+  string RcCachePath(const string& cache_key) const;
+  // Fills blazercs_ and rcoptions_ from the cache and prints the startup
+  // option messages, returns false if the cache is missing or stale.
+  bool ReadRcCache(const string& cache_path, const string& cache_key);
+  void WriteRcCache(const string& cache_path, const string& cache_key,
+                    const string& startup_info) const;
+
   void AddRcfileArgsAndOptions(bool batch, const string& cwd);
   blaze_exit_code::ExitCode ParseStartupOptions(string *error);
 
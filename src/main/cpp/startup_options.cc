@@ -69,8 +69,14 @@ void StartupOptions::Init() {
   allow_configurable_attributes = false;
   fatal_event_bus_exceptions = false;
   io_nice_level = -1;
+  server_numa_interleave = false;
+  server_transparent_huge_pages = false;
+  server_auto_jvm_args = true;
   // 3 hours (but only 15 seconds if used within a test)
   max_idle_secs = testing ? 15 : (3 * 3600);
+  grpc_stream_window_kb = 1024;
+  print_client_rpc_latencies = false;
+  shutdown_on_memory_pressure = false;
   oom_more_eagerly_threshold = 100;
   command_port = 0;
   oom_more_eagerly = false;
@@ -105,6 +111,14 @@ blaze_exit_code::ExitCode StartupOptions::ProcessArg(
                                      "--output_user_root")) != NULL) {
     output_user_root = MakeAbsolute(value);
     option_sources["output_user_root"] = rcfile;
+  } else if ((value = GetUnaryOption(arg, next_arg,
+                                     "--shared_install_root")) != NULL) {
+    shared_install_root = MakeAbsolute(value);
+    option_sources["shared_install_root"] = rcfile;
+  } else if ((value = GetUnaryOption(arg, next_arg,
+                                     "--local_output_root")) != NULL) {
+    local_output_root = MakeAbsolute(value);
+    option_sources["local_output_root"] = rcfile;
   } else if (GetNullaryOption(arg, "--deep_execroot")) {
     deep_execroot = true;
     option_sources["deep_execroot"] = rcfile;
@@ -167,6 +181,12 @@ blaze_exit_code::ExitCode StartupOptions::ProcessArg(
   } else if (GetNullaryOption(arg, "--nobatch_cpu_scheduling")) {
     batch_cpu_scheduling = false;
     option_sources["batch_cpu_scheduling"] = rcfile;
+  } else if (GetNullaryOption(arg, "--print_client_rpc_latencies")) {
+    print_client_rpc_latencies = true;
+    option_sources["print_client_rpc_latencies"] = rcfile;
+  } else if (GetNullaryOption(arg, "--noprint_client_rpc_latencies")) {
+    print_client_rpc_latencies = false;
+    option_sources["print_client_rpc_latencies"] = rcfile;
   } else if (GetNullaryOption(arg, "--allow_configurable_attributes")) {
     allow_configurable_attributes = true;
     option_sources["allow_configurable_attributes"] = rcfile;
@@ -189,6 +209,50 @@ blaze_exit_code::ExitCode StartupOptions::ProcessArg(
       return blaze_exit_code::BAD_ARGV;
     }
     option_sources["io_nice_level"] = rcfile;
+  } else if ((value = GetUnaryOption(arg, next_arg,
+                                     "--server_cgroup")) != NULL) {
+    server_cgroup = MakeAbsolute(value);
+    option_sources["server_cgroup"] = rcfile;
+  } else if ((value = GetUnaryOption(arg, next_arg,
+                                     "--server_cgroup_setting")) != NULL) {
+    const char* equals = strchr(value, '=');
+    if (equals == NULL || equals == value ||
+        memchr(value, '/', equals - value) != NULL) {
+      blaze_util::StringPrintf(error,
+          "Invalid argument to --server_cgroup_setting: '%s'. Must be of the "
+          "form <interface file>=<value>.", value);
+      return blaze_exit_code::BAD_ARGV;
+    }
+    server_cgroup_settings.push_back(value);
+    option_sources["server_cgroup_setting"] = rcfile;  // NB: This is incorrect
+  } else if ((value = GetUnaryOption(arg, next_arg,
+                                     "--server_cpu_affinity")) != NULL) {
+    server_cpu_affinity = value;
+    option_sources["server_cpu_affinity"] = rcfile;
+  } else if (GetNullaryOption(arg, "--server_numa_interleave")) {
+    server_numa_interleave = true;
+    option_sources["server_numa_interleave"] = rcfile;
+  } else if (GetNullaryOption(arg, "--noserver_numa_interleave")) {
+    server_numa_interleave = false;
+    option_sources["server_numa_interleave"] = rcfile;
+  } else if (GetNullaryOption(arg, "--server_transparent_huge_pages")) {
+    server_transparent_huge_pages = true;
+    option_sources["server_transparent_huge_pages"] = rcfile;
+  } else if (GetNullaryOption(arg, "--noserver_transparent_huge_pages")) {
+    server_transparent_huge_pages = false;
+    option_sources["server_transparent_huge_pages"] = rcfile;
+  } else if (GetNullaryOption(arg, "--shutdown_on_memory_pressure")) {
+    shutdown_on_memory_pressure = true;
+    option_sources["shutdown_on_memory_pressure"] = rcfile;
+  } else if (GetNullaryOption(arg, "--noshutdown_on_memory_pressure")) {
+    shutdown_on_memory_pressure = false;
+    option_sources["shutdown_on_memory_pressure"] = rcfile;
+  } else if (GetNullaryOption(arg, "--server_auto_jvm_args")) {
+    server_auto_jvm_args = true;
+    option_sources["server_auto_jvm_args"] = rcfile;
+  } else if (GetNullaryOption(arg, "--noserver_auto_jvm_args")) {
+    server_auto_jvm_args = false;
+    option_sources["server_auto_jvm_args"] = rcfile;
   } else if ((value = GetUnaryOption(arg, next_arg,
                                      "--max_idle_secs")) != NULL) {
     if (!blaze_util::safe_strto32(value, &max_idle_secs) ||
@@ -198,6 +262,18 @@ blaze_exit_code::ExitCode StartupOptions::ProcessArg(
       return blaze_exit_code::BAD_ARGV;
     }
     option_sources["max_idle_secs"] = rcfile;
+  } else if ((value = GetUnaryOption(arg, next_arg,
+                                     "--grpc_stream_window_kb")) != NULL) {
+    // gRPC refuses windows of 5 bytes or less, and HTTP/2 ones of 2GB or
+    // more.
+    if (!blaze_util::safe_strto32(value, &grpc_stream_window_kb) ||
+        grpc_stream_window_kb < 1 ||
+        grpc_stream_window_kb >= 2 * 1024 * 1024) {
+      blaze_util::StringPrintf(error,
+          "Invalid argument to --grpc_stream_window_kb: '%s'.", value);
+      return blaze_exit_code::BAD_ARGV;
+    }
+    option_sources["grpc_stream_window_kb"] = rcfile;
   } else if (GetNullaryOption(arg, "-x")) {
     fprintf(stderr, "WARNING: The -x startup option is now ignored "
             "and will be removed in a future release\n");
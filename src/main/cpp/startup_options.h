@@ -133,6 +133,16 @@ class StartupOptions {
   // output_base.
   string output_user_root;
 
+  // If not empty, the machine-wide directory in which the install bases are
+  // looked for (and extracted, if it is writable) before the one in
+  // output_user_root. Used only for computing install_base.
+  string shared_install_root;
+
+  // If not empty, the local directory below which the default output base is
+  // put if output_user_root is on a network file system, with a symlink to it
+  // at its usual place. Used only for computing output_base.
+  string local_output_root;
+
   // Whether to put the execroot at $OUTPUT_BASE/$WORKSPACE_NAME (if false) or
   // $OUTPUT_BASE/execroot/$WORKSPACE_NAME (if true).
   bool deep_execroot;
@@ -160,8 +170,42 @@ class StartupOptions {
   // for best-effort scheduling. 0 is highest priority, 7 is lowest.
   int io_nice_level;
 
+  // If not empty, the cgroup (v2) directory the server is started in. It is
+  // created if it does not exist.
+  string server_cgroup;
+
+  // "<interface file>=<value>" settings (e.g. "cpu.weight=50" or
+  // "memory.high=8G") written to server_cgroup before the server is started.
+  std::vector<string> server_cgroup_settings;
+
+  // If not empty, the list of CPUs the server is restricted to, in the format
+  // of cpuset lists (e.g. "0-3,8").
+  string server_cpu_affinity;
+
+  // If true, the server memory is interleaved across all NUMA nodes.
+  bool server_numa_interleave;
+
+  // If true, the server heap is backed by transparent huge pages where the
+  // kernel supports them.
+  bool server_transparent_huge_pages;
+
+  // If true, the client sizes the server heap and picks its garbage collector
+  // and GC threads, except where --host_jvm_args already does.
+  bool server_auto_jvm_args;
+
   int max_idle_secs;
 
+  // How far ahead of the client the server may send on each gRPC stream, in
+  // KB: the HTTP/2 flow-control window the client grants it.
+  int grpc_stream_window_kb;
+
+  // If true, the client prints the latencies of its RPCs to the server when
+  // the command is done. They are written to the output base either way.
+  bool print_client_rpc_latencies;
+
+  // If true, an idle server outlives max_idle_secs until memory gets short.
+  bool shutdown_on_memory_pressure;
+
   bool oom_more_eagerly;
 
   int oom_more_eagerly_threshold;
@@ -0,0 +1,69 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/main/cpp/util/histogram.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+namespace blaze_util {
+
+using std::string;
+
+LatencyHistogram::LatencyHistogram() : count_(0), sum_us_(0), max_us_(0) {
+  std::fill(buckets_, buckets_ + kBuckets, 0);
+}
+
+void LatencyHistogram::Add(uint64_t nanos) {
+  uint64_t us = nanos / 1000;
+  int bucket = 0;
+  while (bucket < kBuckets - 1 && (us >> bucket) != 0) {
+    bucket++;
+  }
+  buckets_[bucket]++;
+  count_++;
+  sum_us_ += us;
+  max_us_ = std::max(max_us_, us);
+}
+
+uint64_t LatencyHistogram::PercentileMicros(double q) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  // The nearest rank, counting from 1.
+  uint64_t rank = static_cast<uint64_t>(ceil(q * count_));
+  rank = std::min(count_, std::max<uint64_t>(1, rank));
+  uint64_t seen = 0;
+  for (int i = 0; i < kBuckets - 1; i++) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      return std::min(max_us_, (static_cast<uint64_t>(1) << i) - 1);
+    }
+  }
+  return max_us_;
+}
+
+string LatencyHistogram::ToString() const {
+  string result = std::to_string(count_) + " " + std::to_string(sum_us_) +
+                  " " + std::to_string(max_us_);
+  for (int i = 0; i < kBuckets; i++) {
+    if (buckets_[i] != 0) {
+      result += " " + std::to_string(i) + ":" + std::to_string(buckets_[i]);
+    }
+  }
+  return result;
+}
+
+}  // namespace blaze_util
@@ -0,0 +1,61 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BAZEL_SRC_MAIN_CPP_UTIL_HISTOGRAM_H_
+#define BAZEL_SRC_MAIN_CPP_UTIL_HISTOGRAM_H_
+
+#include <stdint.h>
+
+#include <string>
+
+namespace blaze_util {
+
+// A histogram of latencies, in buckets of powers of two microseconds: bucket 0
+// counts the latencies below 1us and bucket i those in [2^(i-1), 2^i) us. The
+// last bucket also counts everything longer. Not thread-safe.
+class LatencyHistogram {
+ public:
+  // Enough for latencies of more than half an hour.
+  static const int kBuckets = 32;
+
+  LatencyHistogram();
+
+  // Adds a latency, in nanoseconds as returned by differences of
+  // MonotonicClock().
+  void Add(uint64_t nanos);
+
+  uint64_t Count() const { return count_; }
+  uint64_t SumMicros() const { return sum_us_; }
+  uint64_t MaxMicros() const { return max_us_; }
+
+  // Returns an upper bound of the latency of the fraction 'q' of the samples
+  // (e.g. 0.9 for the 90th percentile), i.e. the end of its bucket, but never
+  // more than the maximum. Returns 0 if there are no samples.
+  uint64_t PercentileMicros(double q) const;
+
+  // Returns the compact form of the histogram: the count, sum and maximum,
+  // followed by "<bucket>:<count>" for each non-empty bucket, separated by
+  // spaces, e.g. "3 1500 1000 9:2 10:1".
+  std::string ToString() const;
+
+ private:
+  uint64_t buckets_[kBuckets];
+  uint64_t count_;
+  uint64_t sum_us_;
+  uint64_t max_us_;
+};
+
+}  // namespace blaze_util
+
+#endif  // BAZEL_SRC_MAIN_CPP_UTIL_HISTOGRAM_H_
@@ -43,6 +43,9 @@
 #include <string.h>  // for memcpy
 #include <stddef.h>  // for ofsetof
 
+#include <algorithm>
+#include <vector>
+
 #if !_STRING_ARCH_unaligned
 # ifdef _LP64
 #  define UNALIGNED_P(p) (reinterpret_cast<uint64_t>(p) % \
@@ -333,6 +336,252 @@ void Md5Digest::Transform(
   state[3] = d;
 }
 
+// Multi-buffer MD5: the words of the state and of the blocks of up to kLanes
+// buffers are interleaved in vectors, so that each instruction of a round
+// advances all of them. F, G, H, I and ROTATE_LEFT from Transform work on the
+// vectors as well.
+#if defined(__GNUC__)
+
+typedef uint32_t Md5Lanes4 __attribute__((vector_size(16)));
+#if defined(__x86_64__) || defined(__i386__)
+typedef uint32_t Md5Lanes8 __attribute__((vector_size(32)));
+#endif
+
+#define LANE_STEP(f, a, b, c, d, x, s, ac) { \
+      (a) += f((b), (c), (d)) + (x) + static_cast<uint32_t>(ac); \
+      (a) = ROTATE_LEFT((a), (s)); \
+      (a) += (b); \
+    }
+
+// Always inlined, so that it is compiled for the instruction set of the caller.
+template <typename V>
+static inline __attribute__((always_inline)) void TransformLanes(
+    V* state, const V* x) {
+  V a = state[0];
+  V b = state[1];
+  V c = state[2];
+  V d = state[3];
+
+  // Round 1
+  LANE_STEP(F, a, b, c, d, x[ 0], S11, 0xd76aa478);
+  LANE_STEP(F, d, a, b, c, x[ 1], S12, 0xe8c7b756);
+  LANE_STEP(F, c, d, a, b, x[ 2], S13, 0x242070db);
+  LANE_STEP(F, b, c, d, a, x[ 3], S14, 0xc1bdceee);
+  LANE_STEP(F, a, b, c, d, x[ 4], S11, 0xf57c0faf);
+  LANE_STEP(F, d, a, b, c, x[ 5], S12, 0x4787c62a);
+  LANE_STEP(F, c, d, a, b, x[ 6], S13, 0xa8304613);
+  LANE_STEP(F, b, c, d, a, x[ 7], S14, 0xfd469501);
+  LANE_STEP(F, a, b, c, d, x[ 8], S11, 0x698098d8);
+  LANE_STEP(F, d, a, b, c, x[ 9], S12, 0x8b44f7af);
+  LANE_STEP(F, c, d, a, b, x[10], S13, 0xffff5bb1);
+  LANE_STEP(F, b, c, d, a, x[11], S14, 0x895cd7be);
+  LANE_STEP(F, a, b, c, d, x[12], S11, 0x6b901122);
+  LANE_STEP(F, d, a, b, c, x[13], S12, 0xfd987193);
+  LANE_STEP(F, c, d, a, b, x[14], S13, 0xa679438e);
+  LANE_STEP(F, b, c, d, a, x[15], S14, 0x49b40821);
+
+  // Round 2
+  LANE_STEP(G, a, b, c, d, x[ 1], S21, 0xf61e2562);
+  LANE_STEP(G, d, a, b, c, x[ 6], S22, 0xc040b340);
+  LANE_STEP(G, c, d, a, b, x[11], S23, 0x265e5a51);
+  LANE_STEP(G, b, c, d, a, x[ 0], S24, 0xe9b6c7aa);
+  LANE_STEP(G, a, b, c, d, x[ 5], S21, 0xd62f105d);
+  LANE_STEP(G, d, a, b, c, x[10], S22,  0x2441453);
+  LANE_STEP(G, c, d, a, b, x[15], S23, 0xd8a1e681);
+  LANE_STEP(G, b, c, d, a, x[ 4], S24, 0xe7d3fbc8);
+  LANE_STEP(G, a, b, c, d, x[ 9], S21, 0x21e1cde6);
+  LANE_STEP(G, d, a, b, c, x[14], S22, 0xc33707d6);
+  LANE_STEP(G, c, d, a, b, x[ 3], S23, 0xf4d50d87);
+  LANE_STEP(G, b, c, d, a, x[ 8], S24, 0x455a14ed);
+  LANE_STEP(G, a, b, c, d, x[13], S21, 0xa9e3e905);
+  LANE_STEP(G, d, a, b, c, x[ 2], S22, 0xfcefa3f8);
+  LANE_STEP(G, c, d, a, b, x[ 7], S23, 0x676f02d9);
+  LANE_STEP(G, b, c, d, a, x[12], S24, 0x8d2a4c8a);
+
+  // Round 3
+  LANE_STEP(H, a, b, c, d, x[ 5], S31, 0xfffa3942);
+  LANE_STEP(H, d, a, b, c, x[ 8], S32, 0x8771f681);
+  LANE_STEP(H, c, d, a, b, x[11], S33, 0x6d9d6122);
+  LANE_STEP(H, b, c, d, a, x[14], S34, 0xfde5380c);
+  LANE_STEP(H, a, b, c, d, x[ 1], S31, 0xa4beea44);
+  LANE_STEP(H, d, a, b, c, x[ 4], S32, 0x4bdecfa9);
+  LANE_STEP(H, c, d, a, b, x[ 7], S33, 0xf6bb4b60);
+  LANE_STEP(H, b, c, d, a, x[10], S34, 0xbebfbc70);
+  LANE_STEP(H, a, b, c, d, x[13], S31, 0x289b7ec6);
+  LANE_STEP(H, d, a, b, c, x[ 0], S32, 0xeaa127fa);
+  LANE_STEP(H, c, d, a, b, x[ 3], S33, 0xd4ef3085);
+  LANE_STEP(H, b, c, d, a, x[ 6], S34,  0x4881d05);
+  LANE_STEP(H, a, b, c, d, x[ 9], S31, 0xd9d4d039);
+  LANE_STEP(H, d, a, b, c, x[12], S32, 0xe6db99e5);
+  LANE_STEP(H, c, d, a, b, x[15], S33, 0x1fa27cf8);
+  LANE_STEP(H, b, c, d, a, x[ 2], S34, 0xc4ac5665);
+
+  // Round 4
+  LANE_STEP(I, a, b, c, d, x[ 0], S41, 0xf4292244);
+  LANE_STEP(I, d, a, b, c, x[ 7], S42, 0x432aff97);
+  LANE_STEP(I, c, d, a, b, x[14], S43, 0xab9423a7);
+  LANE_STEP(I, b, c, d, a, x[ 5], S44, 0xfc93a039);
+  LANE_STEP(I, a, b, c, d, x[12], S41, 0x655b59c3);
+  LANE_STEP(I, d, a, b, c, x[ 3], S42, 0x8f0ccc92);
+  LANE_STEP(I, c, d, a, b, x[10], S43, 0xffeff47d);
+  LANE_STEP(I, b, c, d, a, x[ 1], S44, 0x85845dd1);
+  LANE_STEP(I, a, b, c, d, x[ 8], S41, 0x6fa87e4f);
+  LANE_STEP(I, d, a, b, c, x[15], S42, 0xfe2ce6e0);
+  LANE_STEP(I, c, d, a, b, x[ 6], S43, 0xa3014314);
+  LANE_STEP(I, b, c, d, a, x[13], S44, 0x4e0811a1);
+  LANE_STEP(I, a, b, c, d, x[ 4], S41, 0xf7537e82);
+  LANE_STEP(I, d, a, b, c, x[11], S42, 0xbd3af235);
+  LANE_STEP(I, c, d, a, b, x[ 2], S43, 0x2ad7d2bb);
+  LANE_STEP(I, b, c, d, a, x[ 9], S44, 0xeb86d391);
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+}
+
+#undef LANE_STEP
+
+// Digests the buffers in "order" (indices into bufs, lengths and digests)
+// kLanes at a time.
+template <typename V, int kLanes>
+static inline __attribute__((always_inline)) void Md5Lanes(
+    const unsigned char* const* bufs, const size_t* lengths,
+    const size_t* order, size_t count, unsigned char (*digests)[16]) {
+  static const unsigned char kZeroBlock[64] = {0};
+  for (size_t group = 0; group < count; group += kLanes) {
+    const size_t n = count - group < kLanes ? count - group : kLanes;
+    const unsigned char* data[kLanes];
+    size_t full_blocks[kLanes];
+    size_t num_blocks[kLanes];
+    // The last one or two blocks of each buffer with the padding and length.
+    unsigned char tail[kLanes][128];
+    size_t max_blocks = 0;
+    for (size_t lane = 0; lane < kLanes; lane++) {
+      size_t length = lane < n ? lengths[order[group + lane]] : 0;
+      data[lane] = lane < n ? bufs[order[group + lane]] : NULL;
+      full_blocks[lane] = length / 64;
+      size_t rest = length % 64;
+      size_t tail_length = rest < 56 ? 64 : 128;
+      num_blocks[lane] = lane < n ? full_blocks[lane] + tail_length / 64 : 0;
+      if (num_blocks[lane] > max_blocks) {
+        max_blocks = num_blocks[lane];
+      }
+      if (lane < n) {
+        memcpy(tail[lane], data[lane] + full_blocks[lane] * 64, rest);
+        memcpy(tail[lane] + rest, kPadding, tail_length - 8 - rest);
+        uint32_t bits[2] = {static_cast<uint32_t>(length << 3),
+                            static_cast<uint32_t>(
+                                static_cast<uint64_t>(length) >> 29)};
+        memcpy(tail[lane] + tail_length - 8, bits, 8);
+      }
+    }
+
+    uint32_t words[4][kLanes];
+    for (size_t lane = 0; lane < kLanes; lane++) {
+      words[0][lane] = 0x67452301;
+      words[1][lane] = 0xefcdab89;
+      words[2][lane] = 0x98badcfe;
+      words[3][lane] = 0x10325476;
+    }
+    V state[4];
+    memcpy(state, words, sizeof(state));
+
+    for (size_t block = 0; block < max_blocks; block++) {
+      uint32_t x_words[16][kLanes];
+      bool all_active = true;
+      for (size_t lane = 0; lane < kLanes; lane++) {
+        const unsigned char* p;
+        if (block < full_blocks[lane]) {
+          p = data[lane] + block * 64;
+        } else if (block < num_blocks[lane]) {
+          p = tail[lane] + (block - full_blocks[lane]) * 64;
+        } else {
+          p = kZeroBlock;
+          all_active = false;
+        }
+        for (int i = 0; i < 16; i++) {
+          memcpy(&x_words[i][lane], p + 4 * i, 4);
+        }
+      }
+      V x[16];
+      memcpy(x, x_words, sizeof(x));
+      if (all_active) {
+        TransformLanes(state, x);
+      } else {
+        // Keep the state of the lanes whose buffers are done.
+        uint32_t before[4][kLanes];
+        memcpy(before, state, sizeof(before));
+        TransformLanes(state, x);
+        memcpy(words, state, sizeof(words));
+        for (size_t lane = 0; lane < kLanes; lane++) {
+          if (block >= num_blocks[lane]) {
+            for (int i = 0; i < 4; i++) {
+              words[i][lane] = before[i][lane];
+            }
+          }
+        }
+        memcpy(state, words, sizeof(state));
+      }
+    }
+
+    memcpy(words, state, sizeof(words));
+    for (size_t lane = 0; lane < n; lane++) {
+      uint32_t r[4] = {words[0][lane], words[1][lane], words[2][lane],
+                       words[3][lane]};
+      memcpy(digests[order[group + lane]], r, sizeof(r));
+    }
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static void Md5LanesAvx2(
+    const unsigned char* const* bufs, const size_t* lengths,
+    const size_t* order, size_t count, unsigned char (*digests)[16]) {
+  Md5Lanes<Md5Lanes8, 8>(bufs, lengths, order, count, digests);
+}
+#endif
+
+#endif  // defined(__GNUC__)
+
+namespace {
+// Orders buffer indices by length, so that the buffers digested together
+// take about the same number of blocks.
+struct LengthLess {
+  const size_t* lengths;
+  bool operator()(size_t a, size_t b) const { return lengths[a] < lengths[b]; }
+};
+}  // namespace
+
+void Md5Batch(const void* const* bufs, const size_t* lengths, size_t count,
+              unsigned char (*digests)[Md5Digest::kDigestLength]) {
+  const unsigned char* const* data =
+      reinterpret_cast<const unsigned char* const*>(bufs);
+#if defined(__GNUC__)
+  std::vector<size_t> order(count);
+  for (size_t i = 0; i < count; i++) {
+    order[i] = i;
+  }
+  LengthLess less = {lengths};
+  std::sort(order.begin(), order.end(), less);
+  const size_t* order_ptr = count > 0 ? &order[0] : NULL;
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("avx2")) {
+    Md5LanesAvx2(data, lengths, order_ptr, count, digests);
+    return;
+  }
+#endif
+  Md5Lanes<Md5Lanes4, 4>(data, lengths, order_ptr, count, digests);
+#else
+  Md5Digest digest;
+  for (size_t i = 0; i < count; i++) {
+    digest.Reset();
+    digest.Update(data[i], lengths[i]);
+    digest.Finish(digests[i]);
+  }
+#endif
+}
+
 string Md5Digest::String() const {
   string result;
   b2a_hex(reinterpret_cast<const uint8_t*>(state), &result, 16);
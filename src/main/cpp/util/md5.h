@@ -18,6 +18,8 @@
 #ifndef BAZEL_SRC_MAIN_CPP_UTIL_MD5_H_
 #define BAZEL_SRC_MAIN_CPP_UTIL_MD5_H_
 
+#include <stddef.h>
+
 #include <string>
 
 namespace blaze_util {
@@ -63,6 +65,14 @@ class Md5Digest {
   unsigned int ctx_buffer_len;
 };
 
+// Computes the MD5 digests of "count" independent buffers into "digests":
+// digests[i] is the digest of the lengths[i] bytes at bufs[i]. Several buffers
+// are digested in lockstep with SIMD instructions where available (8 at a time
+// with AVX2, 4 with SSE2 or NEON), which makes this much faster than an
+// Md5Digest per buffer for many small buffers.
+void Md5Batch(const void* const* bufs, const size_t* lengths, size_t count,
+              unsigned char (*digests)[Md5Digest::kDigestLength]);
+
 }  // namespace blaze_util
 
 #endif  // BAZEL_SRC_MAIN_CPP_UTIL_MD5_H_
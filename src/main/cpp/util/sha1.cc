@@ -0,0 +1,382 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/main/cpp/util/sha1.h"
+
+#include <string.h>
+
+#include <vector>
+
+#include "src/main/cpp/util/sha_lanes.h"
+
+namespace blaze_util {
+
+static const uint32_t kInitialState[5] = {
+  0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+};
+
+// The constant added in each round, one per 20 rounds.
+static const uint32_t kRoundConstants[4] = {
+  0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6
+};
+
+static inline uint32_t RotateLeft(uint32_t x, int n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+typedef void TransformFunc(uint32_t *state, const unsigned char *blocks,
+                           size_t count);
+
+static void TransformPortable(uint32_t *state, const unsigned char *blocks,
+                              size_t count) {
+  for (; count > 0; count--, blocks += 64) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+      w[i] = sha_lanes::LoadBigEndian(blocks + 4 * i);
+    }
+    for (int i = 16; i < 80; i++) {
+      w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4];
+    for (int i = 0; i < 80; i++) {
+      uint32_t f;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+      } else {
+        f = b ^ c ^ d;
+      }
+      uint32_t t = RotateLeft(a, 5) + f + e + kRoundConstants[i / 20] + w[i];
+      e = d;
+      d = c;
+      c = RotateLeft(b, 30);
+      b = a;
+      a = t;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+  }
+}
+
+#if defined(BLAZE_SHA_NI)
+// Each sha1rnds4 does four rounds; its immediate selects the function and
+// constant of rounds 20 * f to 20 * f + 19. sha1nexte adds E, derived from the
+// A of four rounds before, to the next four words, and sha1msg1 and sha1msg2
+// compute the message schedule four words at a time: group g, for g >= 4, is
+// msg2(msg1(W[g - 4], W[g - 3]) ^ W[g - 2], W[g - 1]). The words are kept in
+// the reverse order of the block, as the instructions expect.
+#define SHA1_NI_ROUNDS(g, f)                                                  \
+  {                                                                           \
+    if ((g) < 4) {                                                            \
+      w[(g) & 3] = _mm_shuffle_epi8(                                          \
+          _mm_loadu_si128(                                                    \
+              reinterpret_cast<const __m128i *>(blocks + 16 * (g))),          \
+          kByteSwap);                                                         \
+    } else {                                                                  \
+      w[(g) & 3] = _mm_sha1msg2_epu32(                                        \
+          _mm_xor_si128(_mm_sha1msg1_epu32(w[(g) & 3], w[((g) + 1) & 3]),     \
+                        w[((g) + 2) & 3]),                                    \
+          w[((g) + 3) & 3]);                                                  \
+    }                                                                         \
+    __m128i e = (g) == 0 ? _mm_add_epi32(e0, w[0])                            \
+                         : _mm_sha1nexte_epu32(prev_abcd, w[(g) & 3]);        \
+    prev_abcd = abcd;                                                         \
+    abcd = _mm_sha1rnds4_epu32(abcd, e, (f));                                 \
+  }
+
+__attribute__((target("sha,sse4.1"))) static void TransformShaNi(
+    uint32_t *state, const unsigned char *blocks, size_t count) {
+  const __m128i kByteSwap =
+      _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+  __m128i abcd = _mm_shuffle_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(state)), 0x1b);
+  __m128i e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+  for (; count > 0; count--, blocks += 64) {
+    const __m128i abcd_save = abcd;
+    __m128i prev_abcd = abcd;
+    __m128i w[4];
+    SHA1_NI_ROUNDS(0, 0);
+    SHA1_NI_ROUNDS(1, 0);
+    SHA1_NI_ROUNDS(2, 0);
+    SHA1_NI_ROUNDS(3, 0);
+    SHA1_NI_ROUNDS(4, 0);
+    SHA1_NI_ROUNDS(5, 1);
+    SHA1_NI_ROUNDS(6, 1);
+    SHA1_NI_ROUNDS(7, 1);
+    SHA1_NI_ROUNDS(8, 1);
+    SHA1_NI_ROUNDS(9, 1);
+    SHA1_NI_ROUNDS(10, 2);
+    SHA1_NI_ROUNDS(11, 2);
+    SHA1_NI_ROUNDS(12, 2);
+    SHA1_NI_ROUNDS(13, 2);
+    SHA1_NI_ROUNDS(14, 2);
+    SHA1_NI_ROUNDS(15, 3);
+    SHA1_NI_ROUNDS(16, 3);
+    SHA1_NI_ROUNDS(17, 3);
+    SHA1_NI_ROUNDS(18, 3);
+    SHA1_NI_ROUNDS(19, 3);
+    e0 = _mm_sha1nexte_epu32(prev_abcd, e0);
+    abcd = _mm_add_epi32(abcd, abcd_save);
+  }
+
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(state),
+                   _mm_shuffle_epi32(abcd, 0x1b));
+  state[4] = _mm_extract_epi32(e0, 3);
+}
+
+#undef SHA1_NI_ROUNDS
+#endif  // defined(BLAZE_SHA_NI)
+
+#if defined(BLAZE_SHA_ARMV8)
+// sha1c, sha1p and sha1m do four rounds with the choose, parity and majority
+// functions, sha1h derives the next E from A, and sha1su0 and sha1su1 compute
+// the message schedule four words at a time.
+static void TransformArmv8(uint32_t *state, const unsigned char *blocks,
+                           size_t count) {
+  uint32x4_t abcd = vld1q_u32(state);
+  uint32_t e0 = state[4];
+  for (; count > 0; count--, blocks += 64) {
+    const uint32x4_t abcd_save = abcd;
+    uint32_t e = e0;
+    uint32x4_t w[4];
+    for (int g = 0; g < 20; g++) {
+      if (g < 4) {
+        w[g] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(blocks + 16 * g)));
+      } else {
+        w[g & 3] = vsha1su1q_u32(
+            vsha1su0q_u32(w[g & 3], w[(g + 1) & 3], w[(g + 2) & 3]),
+            w[(g + 3) & 3]);
+      }
+      uint32x4_t msg = vaddq_u32(w[g & 3], vdupq_n_u32(kRoundConstants[g / 5]));
+      uint32_t next_e = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+      if (g < 5) {
+        abcd = vsha1cq_u32(abcd, e, msg);
+      } else if (g >= 10 && g < 15) {
+        abcd = vsha1mq_u32(abcd, e, msg);
+      } else {
+        abcd = vsha1pq_u32(abcd, e, msg);
+      }
+      e = next_e;
+    }
+    abcd = vaddq_u32(abcd, abcd_save);
+    e0 += e;
+  }
+  vst1q_u32(state, abcd);
+  state[4] = e0;
+}
+#endif  // defined(BLAZE_SHA_ARMV8)
+
+static TransformFunc *SelectTransform() {
+#if defined(BLAZE_SHA_NI)
+  if (sha_lanes::HasShaNi()) {
+    return TransformShaNi;
+  }
+#elif defined(BLAZE_SHA_ARMV8)
+  return TransformArmv8;
+#endif
+  return TransformPortable;
+}
+
+// Returns the fastest transform this CPU can run.
+static TransformFunc *GetTransform() {
+  static TransformFunc *const transform = SelectTransform();
+  return transform;
+}
+
+Sha1Digest::Sha1Digest() {
+  Reset();
+}
+
+void Sha1Digest::Reset() {
+  memcpy(state, kInitialState, sizeof(state));
+  length = 0;
+  ctx_buffer_len = 0;
+}
+
+void Sha1Digest::Update(const void *buf, unsigned int buf_length) {
+  const unsigned char *input = reinterpret_cast<const unsigned char*>(buf);
+  length += buf_length;
+
+  if (ctx_buffer_len > 0) {
+    unsigned int n = sizeof(ctx_buffer) - ctx_buffer_len;
+    if (n > buf_length) {
+      n = buf_length;
+    }
+    memcpy(ctx_buffer + ctx_buffer_len, input, n);
+    ctx_buffer_len += n;
+    input += n;
+    buf_length -= n;
+    if (ctx_buffer_len < sizeof(ctx_buffer)) {
+      return;
+    }
+    Transform(ctx_buffer, 1);
+    ctx_buffer_len = 0;
+  }
+
+  // Hash whole blocks straight from the input.
+  size_t blocks = buf_length / sizeof(ctx_buffer);
+  if (blocks > 0) {
+    Transform(input, blocks);
+    input += blocks * sizeof(ctx_buffer);
+    buf_length -= blocks * sizeof(ctx_buffer);
+  }
+
+  memcpy(ctx_buffer, input, buf_length);
+  ctx_buffer_len = buf_length;
+}
+
+void Sha1Digest::Finish(unsigned char digest[20]) {
+  const uint64_t bits = length * 8;
+
+  // The padding is the same as for SHA-256: a one bit and zeros up to 8 bytes
+  // short of a block, then the length in bits, big-endian.
+  ctx_buffer[ctx_buffer_len++] = 0x80;
+  if (ctx_buffer_len > sizeof(ctx_buffer) - 8) {
+    memset(ctx_buffer + ctx_buffer_len, 0, sizeof(ctx_buffer) - ctx_buffer_len);
+    Transform(ctx_buffer, 1);
+    ctx_buffer_len = 0;
+  }
+  memset(ctx_buffer + ctx_buffer_len, 0,
+         sizeof(ctx_buffer) - 8 - ctx_buffer_len);
+  for (int i = 0; i < 8; i++) {
+    ctx_buffer[56 + i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+  }
+  Transform(ctx_buffer, 1);
+  ctx_buffer_len = 0;
+
+  for (int i = 0; i < 5; i++) {
+    digest[4 * i + 0] = static_cast<unsigned char>(state[i] >> 24);
+    digest[4 * i + 1] = static_cast<unsigned char>(state[i] >> 16);
+    digest[4 * i + 2] = static_cast<unsigned char>(state[i] >> 8);
+    digest[4 * i + 3] = static_cast<unsigned char>(state[i]);
+  }
+}
+
+void Sha1Digest::Transform(const unsigned char *blocks, size_t count) {
+  GetTransform()(state, blocks, count);
+}
+
+#if defined(__GNUC__)
+
+// A macro rather than a function, which would pass vectors by value.
+#define ROTATE_LEFT_LANES(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+// TransformPortable on the lanes of ShaLanes, with the message schedule kept
+// to 16 words.
+struct Sha1TransformLanes {
+  template <typename V>
+  inline __attribute__((always_inline)) void operator()(
+      V *state, const V *block) const {
+    V w[16];
+    for (int i = 0; i < 16; i++) {
+      w[i] = block[i];
+    }
+    V a = state[0], b = state[1], c = state[2], d = state[3];
+    V e = state[4];
+    for (int i = 0; i < 80; i++) {
+      if (i >= 16) {
+        V x = w[(i - 3) & 15] ^ w[(i - 8) & 15] ^ w[(i - 14) & 15] ^ w[i & 15];
+        w[i & 15] = ROTATE_LEFT_LANES(x, 1);
+      }
+      V f;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+      } else {
+        f = b ^ c ^ d;
+      }
+      V t = ROTATE_LEFT_LANES(a, 5) + f + e + kRoundConstants[i / 20] +
+            w[i & 15];
+      e = d;
+      d = c;
+      c = ROTATE_LEFT_LANES(b, 30);
+      b = a;
+      a = t;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+  }
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static void Sha1LanesAvx2(
+    const unsigned char* const* bufs, const size_t* lengths,
+    const size_t* order, size_t count, unsigned char* digests) {
+  sha_lanes::ShaLanes<sha_lanes::Lanes8, 8, 5>(
+      kInitialState, Sha1TransformLanes(), bufs, lengths, order, count,
+      digests);
+}
+#endif
+
+#undef ROTATE_LEFT_LANES
+
+#endif  // defined(__GNUC__)
+
+void Sha1Batch(const void* const* bufs, const size_t* lengths, size_t count,
+               unsigned char (*digests)[Sha1Digest::kDigestLength]) {
+  const unsigned char* const* data =
+      reinterpret_cast<const unsigned char* const*>(bufs);
+#if defined(__GNUC__)
+  // The SHA instructions digest one buffer faster than the lanes do several.
+  if (GetTransform() == TransformPortable) {
+    unsigned char* out = reinterpret_cast<unsigned char*>(digests);
+    std::vector<size_t> order = sha_lanes::OrderByLength(lengths, count);
+    const size_t* order_ptr = count > 0 ? &order[0] : NULL;
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) {
+      Sha1LanesAvx2(data, lengths, order_ptr, count, out);
+      return;
+    }
+#endif
+    sha_lanes::ShaLanes<sha_lanes::Lanes4, 4, 5>(
+        kInitialState, Sha1TransformLanes(), data, lengths, order_ptr, count,
+        out);
+    return;
+  }
+#endif
+  Sha1Digest digest;
+  for (size_t i = 0; i < count; i++) {
+    digest.Reset();
+    digest.Update(data[i], lengths[i]);
+    digest.Finish(digests[i]);
+  }
+}
+
+string Sha1Digest::String() const {
+  static const char hex_char[] = "0123456789abcdef";
+  string result;
+  for (int i = 0; i < 5; i++) {
+    for (int shift = 28; shift >= 0; shift -= 4) {
+      result += hex_char[(state[i] >> shift) & 0xf];
+    }
+  }
+  return result;
+}
+
+}  // namespace blaze_util
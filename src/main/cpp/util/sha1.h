@@ -0,0 +1,74 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Provides a SHA-1 implementation (FIPS 180-4), the digest function of the
+// ContentDigest of the remote execution protocol.
+//
+// Like md5.h, this saves us from linking the huge OpenSSL library.
+
+#ifndef BAZEL_SRC_MAIN_CPP_UTIL_SHA1_H_
+#define BAZEL_SRC_MAIN_CPP_UTIL_SHA1_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+namespace blaze_util {
+
+using std::string;
+
+// Computes a SHA-1 digest incrementally, with the same interface as
+// Md5Digest.
+class Sha1Digest {
+ public:
+  Sha1Digest();
+
+  // the SHA-1 digest is always 160 bits = 20 bytes
+  static const int kDigestLength = 20;
+
+  // Resets the context so that it can be used to calculate another digest.
+  void Reset();
+
+  // Add <code>length</code> bytes of <code>buf</code> to the digest.
+  void Update(const void *buf, unsigned int length);
+
+  // Retrieve the computed digest as a 20 byte array.
+  void Finish(unsigned char *digest);
+
+  // Produces a hexadecimal string representation of the digest computed by
+  // Finish in the form: [0-9a-f]{40}
+  string String() const;
+
+ private:
+  // Digests "count" consecutive 64-byte blocks, with the SHA instructions of
+  // the CPU if it has them.
+  void Transform(const unsigned char *blocks, size_t count);
+
+  uint32_t state[5];
+  uint64_t length;               // number of bytes added so far
+  unsigned char ctx_buffer[64];  // input buffer
+  unsigned int ctx_buffer_len;
+};
+
+// Computes the SHA-1 digests of "count" independent buffers into "digests",
+// like Md5Batch. Several buffers are digested in lockstep with SIMD
+// instructions (8 at a time with AVX2, 4 with SSE2 or NEON), unless the CPU
+// has SHA instructions, which digest them one by one faster than that.
+void Sha1Batch(const void* const* bufs, const size_t* lengths, size_t count,
+               unsigned char (*digests)[Sha1Digest::kDigestLength]);
+
+}  // namespace blaze_util
+
+#endif  // BAZEL_SRC_MAIN_CPP_UTIL_SHA1_H_
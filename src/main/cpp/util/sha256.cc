@@ -0,0 +1,379 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/main/cpp/util/sha256.h"
+
+#include <string.h>
+
+#include <vector>
+
+#include "src/main/cpp/util/sha_lanes.h"
+
+namespace blaze_util {
+
+static const uint32_t kRoundConstants[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t kInitialState[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c,
+  0x1f83d9ab, 0x5be0cd19
+};
+
+static inline uint32_t RotateRight(uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+typedef void TransformFunc(uint32_t *state, const unsigned char *blocks,
+                           size_t count);
+
+static void TransformPortable(uint32_t *state, const unsigned char *blocks,
+                              size_t count) {
+  for (; count > 0; count--, blocks += 64) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+      w[i] = sha_lanes::LoadBigEndian(blocks + 4 * i);
+    }
+    for (int i = 16; i < 64; i++) {
+      uint32_t s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^
+                    (w[i - 15] >> 3);
+      uint32_t s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19) ^
+                    (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+      uint32_t s1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+      uint32_t ch = (e & f) ^ (~e & g);
+      uint32_t t1 = h + s1 + ch + kRoundConstants[i] + w[i];
+      uint32_t s0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+      uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+      uint32_t t2 = s0 + maj;
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+#if defined(BLAZE_SHA_NI)
+// Each sha256rnds2 does two rounds on the state split into ABEF and CDGH, and
+// sha256msg1 and sha256msg2 compute the message schedule four words at a
+// time: group g of four words, for g >= 4, is
+// msg2(msg1(W[g - 4], W[g - 3]) + (W[g - 2]:W[g - 1] shifted by a word),
+// W[g - 1]).
+__attribute__((target("sha,sse4.1"))) static void TransformShaNi(
+    uint32_t *state, const unsigned char *blocks, size_t count) {
+  const __m128i kByteSwap =
+      _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state));
+  __m128i state1 =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(state + 4));
+  tmp = _mm_shuffle_epi32(tmp, 0xb1);                  // CDAB
+  state1 = _mm_shuffle_epi32(state1, 0x1b);            // EFGH
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);    // ABEF
+  state1 = _mm_blend_epi16(state1, tmp, 0xf0);         // CDGH
+
+  for (; count > 0; count--, blocks += 64) {
+    const __m128i abef_save = state0;
+    const __m128i cdgh_save = state1;
+    __m128i w[4];
+    for (int g = 0; g < 16; g++) {
+      if (g < 4) {
+        w[g] = _mm_shuffle_epi8(
+            _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(blocks + 16 * g)),
+            kByteSwap);
+      } else {
+        __m128i next = _mm_sha256msg1_epu32(w[g & 3], w[(g + 1) & 3]);
+        next = _mm_add_epi32(
+            next, _mm_alignr_epi8(w[(g + 3) & 3], w[(g + 2) & 3], 4));
+        w[g & 3] = _mm_sha256msg2_epu32(next, w[(g + 3) & 3]);
+      }
+      __m128i msg = _mm_add_epi32(
+          w[g & 3], _mm_loadu_si128(reinterpret_cast<const __m128i *>(
+                        kRoundConstants + 4 * g)));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+      msg = _mm_shuffle_epi32(msg, 0x0e);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+    }
+    state0 = _mm_add_epi32(state0, abef_save);
+    state1 = _mm_add_epi32(state1, cdgh_save);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1b);               // FEBA
+  state1 = _mm_shuffle_epi32(state1, 0xb1);            // DCHG
+  state0 = _mm_blend_epi16(tmp, state1, 0xf0);         // DCBA
+  state1 = _mm_alignr_epi8(state1, tmp, 8);            // HGFE
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(state), state0);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(state + 4), state1);
+}
+#endif  // defined(BLAZE_SHA_NI)
+
+#if defined(BLAZE_SHA_ARMV8)
+// sha256h and sha256h2 do four rounds on the two halves of the state, and
+// sha256su0 and sha256su1 compute the message schedule four words at a time.
+static void TransformArmv8(uint32_t *state, const unsigned char *blocks,
+                           size_t count) {
+  uint32x4_t state0 = vld1q_u32(state);
+  uint32x4_t state1 = vld1q_u32(state + 4);
+  for (; count > 0; count--, blocks += 64) {
+    const uint32x4_t abcd_save = state0;
+    const uint32x4_t efgh_save = state1;
+    uint32x4_t w[4];
+    for (int g = 0; g < 16; g++) {
+      if (g < 4) {
+        w[g] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(blocks + 16 * g)));
+      } else {
+        w[g & 3] = vsha256su1q_u32(vsha256su0q_u32(w[g & 3], w[(g + 1) & 3]),
+                                   w[(g + 2) & 3], w[(g + 3) & 3]);
+      }
+      uint32x4_t msg = vaddq_u32(w[g & 3], vld1q_u32(kRoundConstants + 4 * g));
+      uint32x4_t abcd = state0;
+      state0 = vsha256hq_u32(state0, state1, msg);
+      state1 = vsha256h2q_u32(state1, abcd, msg);
+    }
+    state0 = vaddq_u32(state0, abcd_save);
+    state1 = vaddq_u32(state1, efgh_save);
+  }
+  vst1q_u32(state, state0);
+  vst1q_u32(state + 4, state1);
+}
+#endif  // defined(BLAZE_SHA_ARMV8)
+
+static TransformFunc *SelectTransform() {
+#if defined(BLAZE_SHA_NI)
+  if (sha_lanes::HasShaNi()) {
+    return TransformShaNi;
+  }
+#elif defined(BLAZE_SHA_ARMV8)
+  return TransformArmv8;
+#endif
+  return TransformPortable;
+}
+
+// Returns the fastest transform this CPU can run.
+static TransformFunc *GetTransform() {
+  static TransformFunc *const transform = SelectTransform();
+  return transform;
+}
+
+Sha256Digest::Sha256Digest() {
+  Reset();
+}
+
+void Sha256Digest::Reset() {
+  memcpy(state, kInitialState, sizeof(state));
+  length = 0;
+  ctx_buffer_len = 0;
+}
+
+void Sha256Digest::Update(const void *buf, unsigned int buf_length) {
+  const unsigned char *input = reinterpret_cast<const unsigned char*>(buf);
+  length += buf_length;
+
+  if (ctx_buffer_len > 0) {
+    unsigned int n = sizeof(ctx_buffer) - ctx_buffer_len;
+    if (n > buf_length) {
+      n = buf_length;
+    }
+    memcpy(ctx_buffer + ctx_buffer_len, input, n);
+    ctx_buffer_len += n;
+    input += n;
+    buf_length -= n;
+    if (ctx_buffer_len < sizeof(ctx_buffer)) {
+      return;
+    }
+    Transform(ctx_buffer, 1);
+    ctx_buffer_len = 0;
+  }
+
+  // Hash whole blocks straight from the input.
+  size_t blocks = buf_length / sizeof(ctx_buffer);
+  if (blocks > 0) {
+    Transform(input, blocks);
+    input += blocks * sizeof(ctx_buffer);
+    buf_length -= blocks * sizeof(ctx_buffer);
+  }
+
+  memcpy(ctx_buffer, input, buf_length);
+  ctx_buffer_len = buf_length;
+}
+
+void Sha256Digest::Finish(unsigned char digest[32]) {
+  const uint64_t bits = length * 8;
+
+  // Pad with a one bit and zeros up to 8 bytes short of a block, then append
+  // the length in bits, big-endian.
+  ctx_buffer[ctx_buffer_len++] = 0x80;
+  if (ctx_buffer_len > sizeof(ctx_buffer) - 8) {
+    memset(ctx_buffer + ctx_buffer_len, 0, sizeof(ctx_buffer) - ctx_buffer_len);
+    Transform(ctx_buffer, 1);
+    ctx_buffer_len = 0;
+  }
+  memset(ctx_buffer + ctx_buffer_len, 0,
+         sizeof(ctx_buffer) - 8 - ctx_buffer_len);
+  for (int i = 0; i < 8; i++) {
+    ctx_buffer[56 + i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+  }
+  Transform(ctx_buffer, 1);
+  ctx_buffer_len = 0;
+
+  for (int i = 0; i < 8; i++) {
+    digest[4 * i + 0] = static_cast<unsigned char>(state[i] >> 24);
+    digest[4 * i + 1] = static_cast<unsigned char>(state[i] >> 16);
+    digest[4 * i + 2] = static_cast<unsigned char>(state[i] >> 8);
+    digest[4 * i + 3] = static_cast<unsigned char>(state[i]);
+  }
+}
+
+void Sha256Digest::Transform(const unsigned char *blocks, size_t count) {
+  GetTransform()(state, blocks, count);
+}
+
+#if defined(__GNUC__)
+
+// A macro rather than a function, which would pass vectors by value.
+#define ROTATE_RIGHT_LANES(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+// TransformPortable on the lanes of ShaLanes, with the message schedule kept
+// to 16 words.
+struct Sha256TransformLanes {
+  template <typename V>
+  inline __attribute__((always_inline)) void operator()(
+      V *state, const V *block) const {
+    V w[16];
+    for (int i = 0; i < 16; i++) {
+      w[i] = block[i];
+    }
+    V a = state[0], b = state[1], c = state[2], d = state[3];
+    V e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+      if (i >= 16) {
+        V w15 = w[(i - 15) & 15];
+        V w2 = w[(i - 2) & 15];
+        V s0 = ROTATE_RIGHT_LANES(w15, 7) ^ ROTATE_RIGHT_LANES(w15, 18) ^
+               (w15 >> 3);
+        V s1 = ROTATE_RIGHT_LANES(w2, 17) ^ ROTATE_RIGHT_LANES(w2, 19) ^
+               (w2 >> 10);
+        w[i & 15] += s0 + w[(i - 7) & 15] + s1;
+      }
+      V s1 = ROTATE_RIGHT_LANES(e, 6) ^ ROTATE_RIGHT_LANES(e, 11) ^
+             ROTATE_RIGHT_LANES(e, 25);
+      V ch = (e & f) ^ (~e & g);
+      V t1 = h + s1 + ch + kRoundConstants[i] + w[i & 15];
+      V s0 = ROTATE_RIGHT_LANES(a, 2) ^ ROTATE_RIGHT_LANES(a, 13) ^
+             ROTATE_RIGHT_LANES(a, 22);
+      V maj = (a & b) ^ (a & c) ^ (b & c);
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + s0 + maj;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static void Sha256LanesAvx2(
+    const unsigned char* const* bufs, const size_t* lengths,
+    const size_t* order, size_t count, unsigned char* digests) {
+  sha_lanes::ShaLanes<sha_lanes::Lanes8, 8, 8>(
+      kInitialState, Sha256TransformLanes(), bufs, lengths, order, count,
+      digests);
+}
+#endif
+
+#undef ROTATE_RIGHT_LANES
+
+#endif  // defined(__GNUC__)
+
+void Sha256Batch(const void* const* bufs, const size_t* lengths, size_t count,
+                 unsigned char (*digests)[Sha256Digest::kDigestLength]) {
+  const unsigned char* const* data =
+      reinterpret_cast<const unsigned char* const*>(bufs);
+#if defined(__GNUC__)
+  // The SHA instructions digest one buffer faster than the lanes do several.
+  if (GetTransform() == TransformPortable) {
+    unsigned char* out = reinterpret_cast<unsigned char*>(digests);
+    std::vector<size_t> order = sha_lanes::OrderByLength(lengths, count);
+    const size_t* order_ptr = count > 0 ? &order[0] : NULL;
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) {
+      Sha256LanesAvx2(data, lengths, order_ptr, count, out);
+      return;
+    }
+#endif
+    sha_lanes::ShaLanes<sha_lanes::Lanes4, 4, 8>(
+        kInitialState, Sha256TransformLanes(), data, lengths, order_ptr,
+        count, out);
+    return;
+  }
+#endif
+  Sha256Digest digest;
+  for (size_t i = 0; i < count; i++) {
+    digest.Reset();
+    digest.Update(data[i], lengths[i]);
+    digest.Finish(digests[i]);
+  }
+}
+
+string Sha256Digest::String() const {
+  static const char hex_char[] = "0123456789abcdef";
+  string result;
+  for (int i = 0; i < 8; i++) {
+    for (int shift = 28; shift >= 0; shift -= 4) {
+      result += hex_char[(state[i] >> shift) & 0xf];
+    }
+  }
+  return result;
+}
+
+}  // namespace blaze_util
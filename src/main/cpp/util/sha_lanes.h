@@ -0,0 +1,200 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// The parts of sha1.cc and sha256.cc that do not depend on the algorithm:
+// detection of the SHA instructions and the multi-buffer driver. Only to be
+// included by these two.
+
+#ifndef BAZEL_SRC_MAIN_CPP_UTIL_SHA_LANES_H_
+#define BAZEL_SRC_MAIN_CPP_UTIL_SHA_LANES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <immintrin.h>
+// The SHA extensions are used if the CPU has them.
+#define BLAZE_SHA_NI 1
+#elif defined(__aarch64__) && \
+    (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2))
+#include <arm_neon.h>
+// Only when compiled for them, e.g. always on OS X; the ARMv8 crypto
+// extensions cannot be detected the same way everywhere.
+#define BLAZE_SHA_ARMV8 1
+#endif
+
+namespace blaze_util {
+namespace sha_lanes {
+
+// Returns true if the CPU has the SHA-NI instructions used by sha1.cc and
+// sha256.cc, and the SSSE3 and SSE4.1 ones that go with them.
+static inline bool HasShaNi() {
+#if defined(BLAZE_SHA_NI)
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+      (ecx & bit_SSSE3) == 0 || (ecx & bit_SSE4_1) == 0) {
+    return false;
+  }
+  if (__get_cpuid_max(0, NULL) < 7) {
+    return false;
+  }
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  return (ebx & (1u << 29)) != 0;
+#else
+  return false;
+#endif
+}
+
+// Returns the big-endian 32-bit word at p.
+static inline uint32_t LoadBigEndian(const unsigned char* p) {
+  return (static_cast<uint32_t>(p[0]) << 24) |
+         (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+// Returns the indices of the "count" buffers ordered by length, so that the
+// buffers digested together take about the same number of blocks.
+static inline std::vector<size_t> OrderByLength(const size_t* lengths,
+                                                size_t count) {
+  std::vector<size_t> order(count);
+  for (size_t i = 0; i < count; i++) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [lengths](size_t a, size_t b) {
+    return lengths[a] < lengths[b];
+  });
+  return order;
+}
+
+#if defined(__GNUC__)
+
+typedef uint32_t Lanes4 __attribute__((vector_size(16)));
+#if defined(__x86_64__) || defined(__i386__)
+typedef uint32_t Lanes8 __attribute__((vector_size(32)));
+#endif
+
+// Digests the buffers in "order" (indices into bufs, lengths and digests, of
+// kStateWords * 4 bytes each) kLanes at a time, as Md5Lanes does for MD5: the
+// words of the states and blocks are interleaved in vectors of type V, on
+// which "transform" runs one block of all the lanes. SHA-1 and SHA-256 pad
+// the same way and store their state big-endian.
+//
+// Always inlined, so that it is compiled for the instruction set of the caller.
+template <typename V, int kLanes, int kStateWords, typename Transform>
+static inline __attribute__((always_inline)) void ShaLanes(
+    const uint32_t* initial_state, const Transform& transform,
+    const unsigned char* const* bufs, const size_t* lengths,
+    const size_t* order, size_t count, unsigned char* digests) {
+  static const unsigned char kZeroBlock[64] = {0};
+  for (size_t group = 0; group < count; group += kLanes) {
+    const size_t n = count - group < kLanes ? count - group : kLanes;
+    const unsigned char* data[kLanes];
+    size_t full_blocks[kLanes];
+    size_t num_blocks[kLanes];
+    // The last one or two blocks of each buffer with the padding and length.
+    unsigned char tail[kLanes][128];
+    size_t max_blocks = 0;
+    for (size_t lane = 0; lane < kLanes; lane++) {
+      size_t length = lane < n ? lengths[order[group + lane]] : 0;
+      data[lane] = lane < n ? bufs[order[group + lane]] : NULL;
+      full_blocks[lane] = length / 64;
+      size_t rest = length % 64;
+      size_t tail_length = rest < 56 ? 64 : 128;
+      num_blocks[lane] = lane < n ? full_blocks[lane] + tail_length / 64 : 0;
+      if (num_blocks[lane] > max_blocks) {
+        max_blocks = num_blocks[lane];
+      }
+      if (lane < n) {
+        memcpy(tail[lane], data[lane] + full_blocks[lane] * 64, rest);
+        tail[lane][rest] = 0x80;
+        memset(tail[lane] + rest + 1, 0, tail_length - 8 - rest - 1);
+        const uint64_t bits = static_cast<uint64_t>(length) * 8;
+        for (int i = 0; i < 8; i++) {
+          tail[lane][tail_length - 8 + i] =
+              static_cast<unsigned char>(bits >> (56 - 8 * i));
+        }
+      }
+    }
+
+    uint32_t words[kStateWords][kLanes];
+    for (int i = 0; i < kStateWords; i++) {
+      for (size_t lane = 0; lane < kLanes; lane++) {
+        words[i][lane] = initial_state[i];
+      }
+    }
+    V state[kStateWords];
+    memcpy(state, words, sizeof(state));
+
+    for (size_t block = 0; block < max_blocks; block++) {
+      uint32_t w_words[16][kLanes];
+      bool all_active = true;
+      for (size_t lane = 0; lane < kLanes; lane++) {
+        const unsigned char* p;
+        if (block < full_blocks[lane]) {
+          p = data[lane] + block * 64;
+        } else if (block < num_blocks[lane]) {
+          p = tail[lane] + (block - full_blocks[lane]) * 64;
+        } else {
+          p = kZeroBlock;
+          all_active = false;
+        }
+        for (int i = 0; i < 16; i++) {
+          w_words[i][lane] = LoadBigEndian(p + 4 * i);
+        }
+      }
+      V w[16];
+      memcpy(w, w_words, sizeof(w));
+      if (all_active) {
+        transform(state, w);
+      } else {
+        // Keep the state of the lanes whose buffers are done.
+        uint32_t before[kStateWords][kLanes];
+        memcpy(before, state, sizeof(before));
+        transform(state, w);
+        memcpy(words, state, sizeof(words));
+        for (size_t lane = 0; lane < kLanes; lane++) {
+          if (block >= num_blocks[lane]) {
+            for (int i = 0; i < kStateWords; i++) {
+              words[i][lane] = before[i][lane];
+            }
+          }
+        }
+        memcpy(state, words, sizeof(state));
+      }
+    }
+
+    memcpy(words, state, sizeof(words));
+    for (size_t lane = 0; lane < n; lane++) {
+      unsigned char* digest = digests + order[group + lane] * kStateWords * 4;
+      for (int i = 0; i < kStateWords; i++) {
+        digest[4 * i + 0] = static_cast<unsigned char>(words[i][lane] >> 24);
+        digest[4 * i + 1] = static_cast<unsigned char>(words[i][lane] >> 16);
+        digest[4 * i + 2] = static_cast<unsigned char>(words[i][lane] >> 8);
+        digest[4 * i + 3] = static_cast<unsigned char>(words[i][lane]);
+      }
+    }
+  }
+}
+
+#endif  // defined(__GNUC__)
+
+}  // namespace sha_lanes
+}  // namespace blaze_util
+
+#endif  // BAZEL_SRC_MAIN_CPP_UTIL_SHA_LANES_H_
@@ -161,14 +161,22 @@ size_t SplitQuotedStringUsing(const string &contents, const char delimeter,
 }
 
 void Replace(const string &oldsub, const string &newsub, string *str) {
-  size_t start = 0;
-  // This is O(n^2) (the complexity of erase() is actually unspecified, but
-  // usually linear).
-  while ((start = str->find(oldsub, start)) != string::npos) {
-    str->erase(start, oldsub.length());
-    str->insert(start, newsub);
-    start += newsub.length();
+  size_t match = oldsub.empty() ? string::npos : str->find(oldsub);
+  if (match == string::npos) {
+    return;
   }
+  // Copy the string once, instead of moving its tail for every match.
+  string result;
+  result.reserve(str->size());
+  size_t start = 0;
+  do {
+    result.append(*str, start, match - start);
+    result.append(newsub);
+    start = match + oldsub.length();
+    match = str->find(oldsub, start);
+  } while (match != string::npos);
+  result.append(*str, start, string::npos);
+  str->swap(result);
 }
 
 void StripWhitespace(string *str) {
@@ -199,42 +207,49 @@ void StripWhitespace(string *str) {
   }
 }
 
-static void GetNextToken(const string &str, const char &comment,
-                  string::const_iterator *iter, vector<string> *words) {
+// Like strchr(), this also treats the terminating NUL as a separator.
+static bool IsSeparator(char c) { return strchr(kSeparator, c) != nullptr; }
+
+// Reads the token at "*iter", appends it to "words" unless it's empty, and
+// advances "*iter" past it. Runs of plain characters are copied at once.
+static void GetNextToken(const char *end, char comment, const char **iter,
+                         vector<string> *words) {
   string output;
-  auto last = *iter;
+  const char *last = *iter;
   char quote = '\0';
   // While not a delimiter.
-  while (last != str.end() && (quote || strchr(kSeparator, *last) == nullptr)) {
-    // Absorb escapes.
+  while (last != end && (quote || !IsSeparator(*last))) {
+    const char *run = last;
+    while (last != end && *last != '\\' &&
+           (quote ? *last != quote
+                  : !IsSeparator(*last) && *last != comment && *last != '\'' &&
+                        *last != '"')) {
+      ++last;
+    }
+    output.append(run, last - run);
+    if (last == end || (!quote && IsSeparator(*last))) {
+      break;
+    }
+
     if (*last == '\\') {
+      // Absorb escapes.
       ++last;
-      if (last == str.end()) {
+      if (last == end) {
         break;
       }
       output += *last++;
-      continue;
-    }
-
-    if (quote) {
+    } else if (quote) {
       if (*last == quote) {
         // Absorb closing quote.
         quote = '\0';
         ++last;
-      } else {
-        output += *last++;
-      }
-    } else {
-      if (*last == comment) {
-        last = str.end();
-        break;
-      }
-      if (*last == '\'' || *last == '"') {
-        // Absorb opening quote.
-        quote = *last++;
-      } else {
-        output += *last++;
       }
+    } else if (*last == comment) {
+      last = end;
+      break;
+    } else if (*last == '\'' || *last == '"') {
+      // Absorb opening quote.
+      quote = *last++;
     }
   }
 
@@ -248,17 +263,22 @@ static void GetNextToken(const string &str, const char &comment,
 void Tokenize(const string &str, const char &comment, vector<string> *words) {
   assert(words);
   words->clear();
+  Tokenize(str.data(), str.size(), comment, words);
+}
 
-  string::const_iterator i = str.begin();
-  while (i != str.end()) {
+void Tokenize(const char *data, size_t size, char comment,
+              vector<string> *words) {
+  const char *end = data + size;
+  const char *i = data;
+  while (i != end) {
     // Skip whitespace.
-    while (i != str.end() && strchr(kSeparator, *i) != nullptr) {
+    while (i != end && IsSeparator(*i)) {
       i++;
     }
-    if (i != str.end() && *i == comment) {
+    if (i != end && *i == comment) {
       break;
     }
-    GetNextToken(str, comment, &i, words);
+    GetNextToken(end, comment, &i, words);
   }
 }
 
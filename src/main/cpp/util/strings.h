@@ -98,6 +98,11 @@ void StripWhitespace(string *str);
 void Tokenize(
     const string &str, const char &comment, std::vector<string> *words);
 
+// Same as above for the "size" bytes at "data", which need not be
+// NUL-terminated, but adds the tokens to words.
+void Tokenize(const char *data, size_t size, char comment,
+              std::vector<string> *words);
+
 // Evaluate a format string and store the result in 'str'.
 void StringPrintf(string *str, const char *format, ...);
 
@@ -0,0 +1,359 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/main/cpp/util/thread_pool.h"
+
+#if defined(__linux__)
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#endif
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+
+namespace blaze_util {
+
+using std::string;
+
+namespace {
+
+// The pool and deque of the worker thread that is running, if any.
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local size_t current_queue = 0;
+
+#if defined(__linux__)
+bool ReadFile(const string& path, string* content) {
+  std::ifstream file(path);
+  if (!file) {
+    return false;
+  }
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  *content = buffer.str();
+  return true;
+}
+
+// Returns the contents of the interface file 'name' of the cgroup of the
+// current process and of its ancestors. 'hierarchy' is where the cgroup
+// hierarchy is mounted and 'controller' the controller it is for (cgroup v1),
+// or empty for the unified hierarchy (cgroup v2).
+std::vector<string> ReadCgroupFiles(const string& hierarchy,
+                                    const string& controller,
+                                    const string& name) {
+  std::vector<string> result;
+  std::ifstream cgroups("/proc/self/cgroup");
+  string line;
+  // Lines are "<hierarchy id>:<controller,...>:<cgroup path>".
+  while (std::getline(cgroups, line)) {
+    size_t first = line.find(':');
+    size_t second =
+        first == string::npos ? string::npos : line.find(':', first + 1);
+    if (second == string::npos) {
+      continue;
+    }
+    string controllers = "," + line.substr(first + 1, second - first - 1) + ",";
+    if (controller.empty() ? controllers != ",,"
+                           : controllers.find("," + controller + ",") ==
+                                 string::npos) {
+      continue;
+    }
+    string path = line.substr(second + 1);
+    for (;;) {
+      string content;
+      if (ReadFile(hierarchy + path + "/" + name, &content)) {
+        result.push_back(content);
+      }
+      size_t slash = path.rfind('/');
+      if (slash == string::npos || path == "/") {
+        break;
+      }
+      path = slash == 0 ? "/" : path.substr(0, slash);
+    }
+    break;
+  }
+  return result;
+}
+#endif
+
+}  // namespace
+
+int AvailableCpus() {
+#if defined(__linux__)
+  cpu_set_t cpu_set;
+  int cpus = sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0
+                 ? CPU_COUNT(&cpu_set)
+                 : static_cast<int>(std::thread::hardware_concurrency());
+  // The quota is "<quota> <period>" or "max <period>" (cgroup v2), or in
+  // separate files with -1 for none (cgroup v1).
+  std::vector<std::pair<long long, long long> > quotas;  // NOLINT
+  for (const auto& quota : ReadCgroupFiles("/sys/fs/cgroup", "", "cpu.max")) {
+    long long value, period;  // NOLINT
+    if (sscanf(quota.c_str(), "%lld %lld", &value, &period) == 2) {
+      quotas.push_back(std::make_pair(value, period));
+    }
+  }
+  std::vector<string> v1_quotas =
+      ReadCgroupFiles("/sys/fs/cgroup/cpu", "cpu", "cpu.cfs_quota_us");
+  std::vector<string> v1_periods =
+      ReadCgroupFiles("/sys/fs/cgroup/cpu", "cpu", "cpu.cfs_period_us");
+  for (size_t i = 0; i < v1_quotas.size() && i < v1_periods.size(); ++i) {
+    quotas.push_back(std::make_pair(atoll(v1_quotas[i].c_str()),
+                                    atoll(v1_periods[i].c_str())));
+  }
+  for (const auto& quota : quotas) {
+    if (quota.first > 0 && quota.second > 0) {
+      cpus = std::min(cpus, static_cast<int>((quota.first + quota.second - 1) /
+                                             quota.second));
+    }
+  }
+#else
+  int cpus = static_cast<int>(std::thread::hardware_concurrency());
+#endif
+  return std::max(1, cpus);
+}
+
+int ThreadCount(int requested) {
+  int cpus = AvailableCpus();
+  return requested <= 0 ? cpus : std::min(requested, cpus);
+}
+
+ThreadPool::ThreadPool(int threads)
+    : queued_(0), pending_(0), stopping_(false) {
+  for (int i = 0; i < std::max(1, threads); ++i) {
+    queues_.emplace_back(new Queue());
+  }
+  for (size_t i = 1; i < queues_.size(); ++i) {
+    workers_.emplace_back(&ThreadPool::Work, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  Wait();
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopping_ = true;
+    work_available_.notify_all();
+  }
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::Schedule(Task task) {
+  size_t index = current_pool == this ? current_queue : 0;
+  ++pending_;
+  {
+    std::unique_lock<std::mutex> lock(queues_[index]->mutex);
+    queues_[index]->tasks.push_back(std::move(task));
+    ++queued_;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  work_available_.notify_one();
+  if (workers_.empty()) {
+    all_done_.notify_all();
+  }
+}
+
+void ThreadPool::Wait() {
+  while (pending_ > 0) {
+    if (RunOne()) {
+      continue;
+    }
+    // The tasks left are running; wait for them or for the ones they add.
+    std::unique_lock<std::mutex> lock(mutex_);
+    all_done_.wait(lock, [this] { return pending_ == 0 || queued_ > 0; });
+  }
+}
+
+bool ThreadPool::RunOne() {
+  Task task;
+  if (!Take(current_pool == this ? current_queue : 0, &task)) {
+    return false;
+  }
+  Run(&task);
+  return true;
+}
+
+bool ThreadPool::Take(size_t self, Task* task) {
+  for (size_t i = 0; i < queues_.size(); ++i) {
+    Queue* queue = queues_[(self + i) % queues_.size()].get();
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (queue->tasks.empty()) {
+      continue;
+    }
+    // A worker takes from its own deque the task it scheduled last, which
+    // keeps what it works on in its caches; all else is taken oldest first.
+    if (i == 0 && self != 0) {
+      *task = std::move(queue->tasks.back());
+      queue->tasks.pop_back();
+    } else {
+      *task = std::move(queue->tasks.front());
+      queue->tasks.pop_front();
+    }
+    --queued_;
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::Run(Task* task) {
+  (*task)();
+  *task = nullptr;  // Releases what it holds before it counts as done.
+  if (--pending_ == 0) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    all_done_.notify_all();
+  }
+}
+
+void ThreadPool::Work(size_t self) {
+  current_pool = this;
+  current_queue = self;
+  for (;;) {
+    Task task;
+    if (Take(self, &task)) {
+      Run(&task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    work_available_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+    if (stopping_ && queued_ == 0) {
+      return;
+    }
+  }
+}
+
+TaskGroup::TaskGroup(ThreadPool* pool) : pool_(pool), pending_(0) {}
+
+TaskGroup::~TaskGroup() { Wait(); }
+
+void TaskGroup::Schedule(ThreadPool::Task task) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++pending_;
+  }
+  pool_->Schedule([this, task] {
+    task();
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (--pending_ == 0) {
+      done_.notify_all();
+    }
+  });
+}
+
+void TaskGroup::Wait() {
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (pending_ == 0) {
+        return;
+      }
+    }
+    if (!pool_->RunOne()) {
+      // The tasks left are running on other threads.
+      std::unique_lock<std::mutex> lock(mutex_);
+      done_.wait(lock, [this] { return pending_ == 0; });
+      return;
+    }
+  }
+}
+
+struct OrderedQueue::Job {
+  Step work;
+  Step finish;
+  int result;
+  bool done;
+  std::atomic<bool> discarded;
+};
+
+OrderedQueue::OrderedQueue(ThreadPool* pool, size_t max_pending)
+    : pool_(pool), max_pending_(std::max<size_t>(1, max_pending)),
+      failed_(false) {}
+
+OrderedQueue::~OrderedQueue() {
+  for (const auto& job : jobs_) {
+    job->discarded = true;
+  }
+  // The jobs still reference this queue.
+  while (!jobs_.empty()) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (jobs_.front()->done) {
+        jobs_.pop_front();
+        continue;
+      }
+    }
+    if (!pool_->RunOne()) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      done_.wait(lock, [this] { return jobs_.front()->done; });
+    }
+  }
+}
+
+int OrderedQueue::Submit(Step work, Step finish) {
+  if (failed_) {
+    return -1;
+  }
+  std::shared_ptr<Job> job(new Job());
+  job->work = std::move(work);
+  job->finish = std::move(finish);
+  job->result = 0;
+  job->done = false;
+  job->discarded = false;
+  jobs_.push_back(job);
+  pool_->Schedule([this, job] {
+    int result = job->discarded ? 0 : job->work();
+    job->work = nullptr;
+    std::unique_lock<std::mutex> lock(mutex_);
+    job->result = result;
+    job->done = true;
+    done_.notify_all();
+  });
+  while (!failed_ && jobs_.size() > max_pending_) {
+    FinishOldest();
+  }
+  return failed_ ? -1 : 0;
+}
+
+int OrderedQueue::Flush() {
+  while (!failed_ && !jobs_.empty()) {
+    FinishOldest();
+  }
+  return failed_ ? -1 : 0;
+}
+
+void OrderedQueue::FinishOldest() {
+  std::shared_ptr<Job> job = jobs_.front();
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (job->done) {
+        break;
+      }
+    }
+    // Rather than idle, run jobs, this one if it has not started yet.
+    if (!pool_->RunOne()) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      done_.wait(lock, [&job] { return job->done; });
+      break;
+    }
+  }
+  jobs_.pop_front();
+  failed_ = job->result < 0 || (job->finish && job->finish() < 0);
+}
+
+}  // namespace blaze_util
@@ -0,0 +1,175 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// A small work-stealing thread pool for the native tools, and a queue that
+// finishes jobs run on it in the order they were submitted.
+
+#ifndef BAZEL_SRC_MAIN_CPP_UTIL_THREAD_POOL_H_
+#define BAZEL_SRC_MAIN_CPP_UTIL_THREAD_POOL_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace blaze_util {
+
+// Returns the number of CPUs this process may use: those of its affinity mask,
+// further limited by the CPU quota of its cgroups on Linux. At least 1.
+int AvailableCpus();
+
+// Returns how many threads a tool should use when asked for 'requested' (e.g.
+// by a --jobs flag): AvailableCpus() if 'requested' is 0 or less, otherwise
+// 'requested' but never more than AvailableCpus(), so that tools running side
+// by side do not oversubscribe the machine.
+int ThreadCount(int requested);
+
+// Runs tasks on a fixed number of threads. Every thread has its own deque of
+// tasks: tasks scheduled from a task go to the deque of the thread running it
+// and are taken from there newest first, while idle threads steal the oldest
+// tasks of the others. Tasks scheduled from outside the pool go to the deque
+// of the thread calling Wait(), which helps running tasks until all are done,
+// and are taken from there oldest first.
+//
+// With one thread, no threads are started and Wait() runs all tasks.
+class ThreadPool {
+ public:
+  typedef std::function<void()> Task;
+
+  // Starts 'threads' - 1 worker threads; the thread calling Wait() is the
+  // last one.
+  explicit ThreadPool(int threads);
+
+  // Waits for all scheduled tasks and stops the threads.
+  ~ThreadPool();
+
+  // Returns the number of threads running tasks, including the one calling
+  // Wait().
+  int threads() const { return static_cast<int>(queues_.size()); }
+
+  // Schedules 'task' to run on some thread. May be called from any thread,
+  // including from tasks.
+  void Schedule(Task task);
+
+  // Runs tasks on the calling thread until all tasks scheduled so far, and
+  // those they schedule, are done. Must not be called from a task.
+  void Wait();
+
+  // Runs one scheduled task on the calling thread, if there is one. Returns
+  // whether it did.
+  bool RunOne();
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  // Takes a task from the deque 'self' or else steals the oldest of another
+  // deque.
+  bool Take(size_t self, Task* task);
+  void Run(Task* task);
+  void Work(size_t self);
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> workers_;
+
+  // Taken to notify the waits below after 'queued_' or 'pending_' changed.
+  std::mutex mutex_;
+  std::condition_variable work_available_;
+  std::condition_variable all_done_;
+  std::atomic<size_t> queued_;   // Tasks in the deques.
+  std::atomic<size_t> pending_;  // Tasks scheduled but not done.
+  bool stopping_;
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+};
+
+// A set of tasks run on a ThreadPool that can be waited for on its own, also
+// from a task: Wait() runs tasks of the pool until those of the group are
+// done, so that nested groups neither block threads nor start new ones.
+class TaskGroup {
+ public:
+  explicit TaskGroup(ThreadPool* pool);
+
+  // Waits for the tasks of the group.
+  ~TaskGroup();
+
+  // Schedules 'task' on the pool as part of this group. May be called from
+  // any thread, including from tasks of the group.
+  void Schedule(ThreadPool::Task task);
+
+  // Runs tasks on the calling thread until all tasks of the group, including
+  // those scheduled meanwhile, are done.
+  void Wait();
+
+ private:
+  ThreadPool* pool_;
+  std::mutex mutex_;
+  std::condition_variable done_;
+  size_t pending_;
+
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+};
+
+// Runs jobs on a ThreadPool and finishes them on the calling thread in the
+// order they were submitted, like a pipeline whose middle stage is parallel.
+// At most 'max_pending' jobs are in flight: Submit() finishes the oldest
+// first when there are more, which bounds the memory they hold.
+class OrderedQueue {
+ public:
+  // A step of a job, returns a negative value on failure.
+  typedef std::function<int()> Step;
+
+  OrderedQueue(ThreadPool* pool, size_t max_pending);
+
+  // Waits for the jobs that are running; the jobs not finished are discarded.
+  ~OrderedQueue();
+
+  // Runs 'work' on the pool and then, unless it fails, 'finish' (which may be
+  // empty) on the calling thread. Returns -1 if this job or one submitted
+  // before has failed already.
+  int Submit(Step work, Step finish);
+
+  // Waits for the submitted jobs and finishes them. Returns -1 if any of them
+  // has failed.
+  int Flush();
+
+ private:
+  struct Job;
+
+  // Waits for the oldest job, helping the pool meanwhile, and finishes it.
+  void FinishOldest();
+
+  ThreadPool* pool_;
+  size_t max_pending_;
+  std::deque<std::shared_ptr<Job>> jobs_;
+  std::mutex mutex_;
+  std::condition_variable done_;
+  bool failed_;
+
+  OrderedQueue(const OrderedQueue&) = delete;
+  OrderedQueue& operator=(const OrderedQueue&) = delete;
+};
+
+}  // namespace blaze_util
+
+#endif  // BAZEL_SRC_MAIN_CPP_UTIL_THREAD_POOL_H_
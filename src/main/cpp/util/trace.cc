@@ -0,0 +1,222 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/main/cpp/util/trace.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <chrono>  // NOLINT
+#include <mutex>   // NOLINT
+#include <string>
+#include <vector>
+
+namespace blaze_util {
+
+using std::string;
+
+const char kTraceDirEnv[] = "BAZEL_NATIVE_TRACE_DIR";
+
+namespace trace_internal {
+std::atomic<bool> enabled(false);
+}  // namespace trace_internal
+
+namespace {
+
+// Beyond this many events, the others are only counted, to bound the memory
+// of long running tools.
+const size_t kMaxEvents = 1 << 20;
+
+struct Event {
+  const char *name;
+  char phase;     // 'X' for spans, 'C' for counters.
+  int64_t time;   // The start of spans.
+  int64_t value;  // The duration of spans.
+  int tid;
+};
+
+std::mutex mutex;
+std::vector<Event> *events = nullptr;
+size_t dropped_events = 0;
+string *trace_path = nullptr;
+string *tool_name = nullptr;
+int pid = 0;
+
+std::atomic<int> next_tid(0);
+thread_local int tid = -1;
+
+int CurrentTid() {
+  if (tid < 0) {
+    tid = pid + next_tid++;
+  }
+  return tid;
+}
+
+void Add(const char *name, char phase, int64_t time, int64_t value) {
+  Event event = {name, phase, time, value, CurrentTid()};
+  std::lock_guard<std::mutex> lock(mutex);
+  if (events == nullptr) {
+    return;  // Finished meanwhile.
+  }
+  if (events->size() < kMaxEvents) {
+    events->push_back(event);
+  } else {
+    ++dropped_events;
+  }
+}
+
+// Writes 's' as a JSON string.
+void WriteString(FILE *file, const char *s) {
+  fputc('"', file);
+  for (; *s != '\0'; ++s) {
+    unsigned char c = static_cast<unsigned char>(*s);
+    if (c == '"' || c == '\\') {
+      fputc('\\', file);
+      fputc(c, file);
+    } else if (c < 0x20) {
+      fprintf(file, "\\u%04x", c);
+    } else {
+      fputc(c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+void FinishTracingAtExit() { FinishTracing(); }
+
+}  // namespace
+
+void StartTracing(const char *tool, const char *path) {
+  string trace;
+  if (path != NULL) {
+    trace = path;
+  } else {
+    const char *dir = getenv(kTraceDirEnv);
+    if (dir == NULL || *dir == '\0') {
+      return;
+    }
+    trace = string(dir) + "/" + tool + "-" + std::to_string(getpid()) +
+            ".trace.json";
+  }
+#if !defined(_WIN32)
+  // The tool may change its working directory before the trace is written.
+  char cwd[PATH_MAX];
+  if (trace[0] != '/' && getcwd(cwd, sizeof(cwd)) != NULL) {
+    trace = string(cwd) + "/" + trace;
+  }
+#endif
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (events != nullptr) {
+    return;
+  }
+  events = new std::vector<Event>();
+  trace_path = new string(trace);
+  tool_name = new string(tool);
+  pid = getpid();
+  atexit(FinishTracingAtExit);
+  trace_internal::enabled = true;
+}
+
+void FinishTracing() {
+  std::vector<Event> *finished;
+  string path;
+  string tool;
+  size_t dropped;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (events == nullptr) {
+      return;
+    }
+    trace_internal::enabled = false;
+    finished = events;
+    events = nullptr;
+    path.swap(*trace_path);
+    tool.swap(*tool_name);
+    dropped = dropped_events;
+  }
+
+  FILE *file = fopen(path.c_str(), "w");
+  if (file == NULL) {
+    fprintf(stderr, "Cannot write trace %s: %s\n", path.c_str(),
+            strerror(errno));
+    delete finished;
+    return;
+  }
+  fprintf(file,
+          "{\"traceEvents\":[\n"
+          "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+          "\"args\":{\"name\":",
+          pid, pid);
+  WriteString(file, tool.c_str());
+  fprintf(file, "}}");
+  for (const Event &event : *finished) {
+    fprintf(file, ",\n{\"name\":");
+    WriteString(file, event.name);
+    if (event.phase == 'X') {
+      fprintf(file,
+              ",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%d}",
+              static_cast<long long>(event.time),   // NOLINT
+              static_cast<long long>(event.value),  // NOLINT
+              pid, event.tid);
+    } else {
+      fprintf(file,
+              ",\"ph\":\"C\",\"ts\":%lld,\"pid\":%d,\"tid\":%d,"
+              "\"args\":{\"value\":%lld}}",
+              static_cast<long long>(event.time), pid, event.tid,  // NOLINT
+              static_cast<long long>(event.value));                // NOLINT
+    }
+  }
+  if (dropped > 0) {
+    fprintf(file,
+            ",\n{\"name\":\"dropped_events\",\"ph\":\"C\",\"ts\":%lld,"
+            "\"pid\":%d,\"tid\":%d,\"args\":{\"value\":%llu}}",
+            static_cast<long long>(TraceNow()), pid, pid,  // NOLINT
+            static_cast<unsigned long long>(dropped));     // NOLINT
+  }
+  fprintf(file, "\n]}\n");
+  if (fclose(file) != 0) {
+    fprintf(stderr, "Cannot write trace %s: %s\n", path.c_str(),
+            strerror(errno));
+  }
+  delete finished;
+}
+
+int64_t TraceNow() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+namespace trace_internal {
+
+void AddSpan(const char *name, int64_t start, int64_t end) {
+  Add(name, 'X', start, end - start);
+}
+
+void AddCounter(const char *name, int64_t value) {
+  Add(name, 'C', TraceNow(), value);
+}
+
+}  // namespace trace_internal
+
+}  // namespace blaze_util
@@ -0,0 +1,114 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// Tracing for the native tools, in the Chrome trace event format.
+//
+// A tool calls StartTracing() once and marks what it does with TRACE_SPAN()
+// and TraceCounter(). Unless tracing was started, these cost a load and a
+// branch. The events are kept in memory and written when the process exits,
+// one per line, e.g.
+//
+//   {"traceEvents":[
+//   {"name":"process_name","ph":"M","pid":42,"tid":42,"args":{"name":"tool"}},
+//   {"name":"scan","ph":"X","ts":1000,"dur":250,"pid":42,"tid":42},
+//   {"name":"files","ph":"C","ts":1250,"pid":42,"tid":42,"args":{"value":7}}
+//   ]}
+//
+// Times are in microseconds of the monotonic clock, which on Linux is also the
+// clock of the server's System.nanoTime(), so that the server can merge the
+// events into its --profile (see NativeTraces.java).
+
+#ifndef BAZEL_SRC_MAIN_CPP_UTIL_TRACE_H_
+#define BAZEL_SRC_MAIN_CPP_UTIL_TRACE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+namespace blaze_util {
+
+// The environment variable naming the directory that tools write their
+// traces to, as <tool>-<pid>.trace.json. Set by the server for the actions it
+// runs while profiling.
+extern const char kTraceDirEnv[];
+
+// Starts tracing if 'path' is not NULL, or else if the environment variable
+// named by kTraceDirEnv is set. 'tool' names the process in the trace. The
+// trace is written at exit(), or by FinishTracing(), to 'path' as resolved
+// now.
+void StartTracing(const char *tool, const char *path);
+
+// Writes the trace and stops tracing.
+void FinishTracing();
+
+// Returns the current time on the clock of the trace, in microseconds.
+int64_t TraceNow();
+
+namespace trace_internal {
+extern std::atomic<bool> enabled;
+void AddSpan(const char *name, int64_t start, int64_t end);
+void AddCounter(const char *name, int64_t value);
+}  // namespace trace_internal
+
+// Returns whether tracing was started.
+inline bool TracingEnabled() {
+  return trace_internal::enabled.load(std::memory_order_relaxed);
+}
+
+// Records the span of time between its construction and its destruction.
+// 'name' must outlive the trace, i.e. usually be a literal.
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char *name)
+      : name_(name), start_(TracingEnabled() ? TraceNow() : -1) {}
+
+  ~TraceSpan() {
+    if (start_ >= 0) {
+      trace_internal::AddSpan(name_, start_, TraceNow());
+    }
+  }
+
+ private:
+  const char *name_;
+  int64_t start_;
+
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+};
+
+// Records a span from 'start' to 'end', as returned by TraceNow(), for the
+// spans that do not fit a scope. 'name' must outlive the trace.
+inline void TraceSpanAt(const char *name, int64_t start, int64_t end) {
+  if (TracingEnabled()) {
+    trace_internal::AddSpan(name, start, end);
+  }
+}
+
+// Records the value of the counter 'name' at this time. 'name' must outlive
+// the trace.
+inline void TraceCounter(const char *name, int64_t value) {
+  if (TracingEnabled()) {
+    trace_internal::AddCounter(name, value);
+  }
+}
+
+#define TRACE_SPAN_CONCAT_(a, b) a##b
+#define TRACE_SPAN_NAME_(line) TRACE_SPAN_CONCAT_(trace_span_, line)
+
+// Records a span from here to the end of the enclosing scope.
+#define TRACE_SPAN(name) \
+  ::blaze_util::TraceSpan TRACE_SPAN_NAME_(__LINE__)(name)
+
+}  // namespace blaze_util
+
+#endif  // BAZEL_SRC_MAIN_CPP_UTIL_TRACE_H_
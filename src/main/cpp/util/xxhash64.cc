@@ -0,0 +1,158 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/main/cpp/util/xxhash64.h"
+
+#include <string.h>
+
+namespace blaze_util {
+
+static const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+static const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t RotateLeft(uint64_t x, int n) {
+  return (x << n) | (x >> (64 - n));
+}
+
+// XXH64 reads its input as little-endian words.
+static inline uint64_t Read64(const unsigned char *p) {
+  uint64_t result = 0;
+  for (int i = 7; i >= 0; i--) {
+    result = (result << 8) | p[i];
+  }
+  return result;
+}
+
+static inline uint32_t Read32(const unsigned char *p) {
+  return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+         (static_cast<uint32_t>(p[2]) << 16) |
+         (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static inline uint64_t Round(uint64_t acc, uint64_t input) {
+  acc += input * kPrime2;
+  acc = RotateLeft(acc, 31);
+  return acc * kPrime1;
+}
+
+static inline uint64_t MergeRound(uint64_t hash, uint64_t lane) {
+  hash ^= Round(0, lane);
+  return hash * kPrime1 + kPrime4;
+}
+
+// Consumes one 32-byte stripe.
+static inline void Consume(uint64_t lanes[4], const unsigned char *p) {
+  lanes[0] = Round(lanes[0], Read64(p));
+  lanes[1] = Round(lanes[1], Read64(p + 8));
+  lanes[2] = Round(lanes[2], Read64(p + 16));
+  lanes[3] = Round(lanes[3], Read64(p + 24));
+}
+
+Xxhash64Digest::Xxhash64Digest() {
+  Reset();
+}
+
+void Xxhash64Digest::Reset() {
+  lanes[0] = kPrime1 + kPrime2;
+  lanes[1] = kPrime2;
+  lanes[2] = 0;
+  lanes[3] = -kPrime1;
+  length = 0;
+  ctx_buffer_len = 0;
+  hash = 0;
+}
+
+void Xxhash64Digest::Update(const void *buf, unsigned int buf_length) {
+  const unsigned char *input = reinterpret_cast<const unsigned char*>(buf);
+  length += buf_length;
+
+  if (ctx_buffer_len > 0) {
+    unsigned int n = sizeof(ctx_buffer) - ctx_buffer_len;
+    if (n > buf_length) {
+      n = buf_length;
+    }
+    memcpy(ctx_buffer + ctx_buffer_len, input, n);
+    ctx_buffer_len += n;
+    input += n;
+    buf_length -= n;
+    if (ctx_buffer_len < sizeof(ctx_buffer)) {
+      return;
+    }
+    Consume(lanes, ctx_buffer);
+    ctx_buffer_len = 0;
+  }
+
+  for (; buf_length >= sizeof(ctx_buffer); buf_length -= sizeof(ctx_buffer)) {
+    Consume(lanes, input);
+    input += sizeof(ctx_buffer);
+  }
+
+  memcpy(ctx_buffer, input, buf_length);
+  ctx_buffer_len = buf_length;
+}
+
+void Xxhash64Digest::Finish(unsigned char digest[8]) {
+  uint64_t h;
+  if (length >= sizeof(ctx_buffer)) {
+    h = RotateLeft(lanes[0], 1) + RotateLeft(lanes[1], 7) +
+        RotateLeft(lanes[2], 12) + RotateLeft(lanes[3], 18);
+    for (int i = 0; i < 4; i++) {
+      h = MergeRound(h, lanes[i]);
+    }
+  } else {
+    h = kPrime5;
+  }
+  h += length;
+
+  const unsigned char *p = ctx_buffer;
+  const unsigned char *end = ctx_buffer + ctx_buffer_len;
+  for (; p + 8 <= end; p += 8) {
+    h ^= Round(0, Read64(p));
+    h = RotateLeft(h, 27) * kPrime1 + kPrime4;
+  }
+  if (p + 4 <= end) {
+    h ^= static_cast<uint64_t>(Read32(p)) * kPrime1;
+    h = RotateLeft(h, 23) * kPrime2 + kPrime3;
+    p += 4;
+  }
+  for (; p < end; p++) {
+    h ^= *p * kPrime5;
+    h = RotateLeft(h, 11) * kPrime1;
+  }
+
+  h ^= h >> 33;
+  h *= kPrime2;
+  h ^= h >> 29;
+  h *= kPrime3;
+  h ^= h >> 32;
+
+  hash = h;
+  for (int i = 0; i < 8; i++) {
+    digest[i] = static_cast<unsigned char>(h >> (56 - 8 * i));
+  }
+}
+
+string Xxhash64Digest::String() const {
+  static const char hex_char[] = "0123456789abcdef";
+  string result;
+  for (int shift = 60; shift >= 0; shift -= 4) {
+    result += hex_char[(hash >> shift) & 0xf];
+  }
+  return result;
+}
+
+}  // namespace blaze_util
@@ -0,0 +1,63 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Provides XXH64, a fast non-cryptographic 64-bit hash
+// (https://github.com/Cyan4973/xxHash), for checksumming large files where
+// collision resistance against an adversary is not needed.
+
+#ifndef BAZEL_SRC_MAIN_CPP_UTIL_XXHASH64_H_
+#define BAZEL_SRC_MAIN_CPP_UTIL_XXHASH64_H_
+
+#include <stdint.h>
+
+#include <string>
+
+namespace blaze_util {
+
+using std::string;
+
+// Computes an XXH64 hash with seed 0 incrementally, with the same interface as
+// Md5Digest.
+class Xxhash64Digest {
+ public:
+  Xxhash64Digest();
+
+  // the XXH64 hash is always 64 bits = 8 bytes
+  static const int kDigestLength = 8;
+
+  // Resets the context so that it can be used to calculate another hash.
+  void Reset();
+
+  // Add <code>length</code> bytes of <code>buf</code> to the hash.
+  void Update(const void *buf, unsigned int length);
+
+  // Retrieve the computed hash as an 8 byte array, most significant byte
+  // first.
+  void Finish(unsigned char *digest);
+
+  // Produces a hexadecimal string representation of the hash computed by
+  // Finish in the form: [0-9a-f]{16}
+  string String() const;
+
+ private:
+  uint64_t lanes[4];
+  uint64_t length;               // number of bytes added so far
+  unsigned char ctx_buffer[32];  // input buffer
+  unsigned int ctx_buffer_len;
+  uint64_t hash;                 // set by Finish
+};
+
+}  // namespace blaze_util
+
+#endif  // BAZEL_SRC_MAIN_CPP_UTIL_XXHASH64_H_
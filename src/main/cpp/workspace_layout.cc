@@ -14,8 +14,12 @@
 #include "src/main/cpp/workspace_layout.h"
 
 #include <assert.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>  // access
 
+#include "src/main/cpp/blaze_util.h"
 #include "src/main/cpp/util/file.h"
 
 namespace blaze {
@@ -43,6 +47,113 @@ string WorkspaceLayout::GetWorkspace(const string &cwd) {
   return "";
 }
 
+// The number of working directories remembered by GetCachedWorkspace.
+static const size_t kMaxCachedWorkspaces = 32;
+
+// An entry of the workspace cache: the workspace found from cwd, and the
+// modification stamps of the directories that were searched before it.
+struct CachedWorkspace {
+  string cwd;
+  string workspace;
+  string stamp;
+};
+
+// Computes the stamp of the directories from cwd up to, but not including,
+// workspace. Returns false if one of them can't be stat()ed, or changed so
+// recently that a later change might not alter its mtime.
+static bool GetDirectoryStamp(const string &cwd, const string &workspace,
+                              string *stamp) {
+  time_t now = time(NULL);
+  stamp->clear();
+  for (string dir = cwd; dir != workspace && !dir.empty() && dir != "/";
+       dir = blaze_util::Dirname(dir)) {
+    struct stat st;
+    if (stat(dir.c_str(), &st) != 0 || st.st_mtime >= now - 1) {
+      return false;
+    }
+    stamp->append(ToString(st.st_ino) + ":" + ToString(st.st_mtime) + " ");
+  }
+  return true;
+}
+
+// Parses the cache file, a sequence of NUL-terminated cwd, workspace and
+// stamp strings, most recently added first.
+static void ReadWorkspaceCache(const string &cache_path,
+                               vector<CachedWorkspace> *entries) {
+  string content;
+  if (!ReadFile(cache_path, &content)) {
+    return;
+  }
+  size_t pos = 0;
+  while (true) {
+    CachedWorkspace entry;
+    string *fields[] = {&entry.cwd, &entry.workspace, &entry.stamp};
+    for (string *field : fields) {
+      size_t end = content.find('\0', pos);
+      if (end == string::npos) {
+        return;
+      }
+      field->assign(content, pos, end - pos);
+      pos = end + 1;
+    }
+    entries->push_back(entry);
+  }
+}
+
+// Replaces the cache file. Several clients may do this at once, so the new
+// contents are written to a temporary file first. Failures are ignored.
+static void WriteWorkspaceCache(const string &cache_path,
+                                const vector<CachedWorkspace> &entries) {
+  string content;
+  for (const CachedWorkspace &entry : entries) {
+    content.append(entry.cwd).push_back('\0');
+    content.append(entry.workspace).push_back('\0');
+    content.append(entry.stamp).push_back('\0');
+  }
+  string tmp_path = cache_path + ".tmp." + ToString(getpid());
+  FILE *out = fopen(tmp_path.c_str(), "w");
+  if (out == NULL) {
+    return;
+  }
+  bool ok = fwrite(content.data(), 1, content.size(), out) == content.size();
+  ok = fclose(out) == 0 && ok;
+  if (!ok || rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+  }
+}
+
+string WorkspaceLayout::GetCachedWorkspace(const string &cwd,
+                                           const string &cache_path) {
+  vector<CachedWorkspace> entries;
+  ReadWorkspaceCache(cache_path, &entries);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (entries[i].cwd != cwd) {
+      continue;
+    }
+    string stamp;
+    if (InWorkspace(entries[i].workspace) &&
+        GetDirectoryStamp(cwd, entries[i].workspace, &stamp) &&
+        stamp == entries[i].stamp) {
+      return entries[i].workspace;
+    }
+    entries.erase(entries.begin() + i);
+    break;
+  }
+
+  CachedWorkspace entry;
+  entry.cwd = cwd;
+  entry.workspace = GetWorkspace(cwd);
+  if (!entry.workspace.empty() &&
+      GetDirectoryStamp(cwd, entry.workspace, &entry.stamp)) {
+    entries.insert(entries.begin(), entry);
+    if (entries.size() > kMaxCachedWorkspaces) {
+      entries.resize(kMaxCachedWorkspaces);
+    }
+    WriteWorkspaceCache(cache_path, entries);
+  }
+  return entry.workspace;
+}
+
 string WorkspaceLayout::RcBasename() {
   return ".bazelrc";
 }
@@ -45,6 +45,15 @@ class WorkspaceLayout {
   // relative or absolute.
   static string GetWorkspace(const string &cwd);
 
+  // Like GetWorkspace, but first looks up cwd in the cache file at
+  // cache_path, and records the result there if it was not found. An entry
+  // is only used if the WORKSPACE file still exists and none of the
+  // directories between cwd and the workspace changed since it was written,
+  // which takes one stat per level instead of an access() per level.
+  // Only found workspaces are cached; cwd must be absolute.
+  static string GetCachedWorkspace(const string &cwd,
+                                   const string &cache_path);
+
   // Returns if workspace is a valid build workspace.
   static bool InWorkspace(const string &workspace);
 
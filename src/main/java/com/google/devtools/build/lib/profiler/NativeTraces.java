@@ -0,0 +1,172 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+package com.google.devtools.build.lib.profiler;
+
+import static java.nio.charset.StandardCharsets.UTF_8;
+
+import com.google.common.annotations.VisibleForTesting;
+import com.google.common.collect.ImmutableList;
+import com.google.devtools.build.lib.vfs.FileSystemUtils;
+import com.google.devtools.build.lib.vfs.Path;
+import java.io.IOException;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicLong;
+import java.util.logging.Logger;
+import java.util.regex.Matcher;
+import java.util.regex.Pattern;
+
+/**
+ * Merges the traces of the native tools into the profile.
+ *
+ * <p>While profiling, actions run with {@link #TRACE_DIR_ENV} naming a directory of their own, to
+ * which the native tools write their traces (see src/main/cpp/util/trace.h). Once the action is
+ * done, the spans and counters of those traces are added to the profile as {@link
+ * ProfilerTask#NATIVE_TOOL} tasks of the thread that ran the action.
+ *
+ * <p>The times of the traces are those of the monotonic clock, which on Linux is also the clock of
+ * {@link System#nanoTime}.
+ */
+public final class NativeTraces {
+  private static final Logger LOG = Logger.getLogger(NativeTraces.class.getName());
+
+  /** The environment variable that tells the native tools where to write their traces. */
+  public static final String TRACE_DIR_ENV = "BAZEL_NATIVE_TRACE_DIR";
+
+  private static final String TRACE_SUFFIX = ".trace.json";
+
+  // The lines of the events, as written by trace.cc.
+  private static final String NAME = "\\{\"name\":\"((?:[^\"\\\\]|\\\\.)*)\"";
+  private static final Pattern PROCESS_NAME =
+      Pattern.compile("^\\{\"name\":\"process_name\",\"ph\":\"M\",.*\"args\":\\{\"name\":\""
+          + "((?:[^\"\\\\]|\\\\.)*)\"\\}\\}");
+  private static final Pattern SPAN =
+      Pattern.compile("^" + NAME + ",\"ph\":\"X\",\"ts\":(\\d+),\"dur\":(\\d+),");
+  private static final Pattern COUNTER =
+      Pattern.compile("^" + NAME + ",\"ph\":\"C\",\"ts\":(\\d+),.*\"args\":\\{\"value\":(-?\\d+)\\}");
+
+  private static final AtomicLong nextTraceDir = new AtomicLong();
+
+  private NativeTraces() {}
+
+  /** An event of a trace, with its times in nanoseconds. */
+  @VisibleForTesting
+  static final class Event {
+    final String description;
+    final long startNanos;
+    final long durationNanos;
+
+    Event(String description, long startNanos, long durationNanos) {
+      this.description = description;
+      this.startNanos = startNanos;
+      this.durationNanos = durationNanos;
+    }
+  }
+
+  /** Returns whether the profiler would record the traces of native tools. */
+  public static boolean isTracing() {
+    Profiler profiler = Profiler.instance();
+    return profiler.isActive() && profiler.isProfiling(ProfilerTask.NATIVE_TOOL);
+  }
+
+  /**
+   * Creates an empty directory below {@code parent} for the traces of an action, to be passed in
+   * {@link #TRACE_DIR_ENV}.
+   */
+  public static Path createTraceDir(Path parent) throws IOException {
+    Path dir = parent.getRelative(Long.toString(nextTraceDir.incrementAndGet()));
+    if (dir.exists()) {
+      FileSystemUtils.deleteTree(dir);
+    }
+    FileSystemUtils.createDirectoryAndParents(dir);
+    return dir;
+  }
+
+  /**
+   * Adds the traces in {@code dir} to the profile and deletes the directory. Traces that cannot be
+   * read are skipped, as they only serve to investigate.
+   */
+  public static void importTraces(Path dir) {
+    try {
+      for (Path trace : dir.getDirectoryEntries()) {
+        if (!trace.getBaseName().endsWith(TRACE_SUFFIX)) {
+          continue;
+        }
+        for (Event event : parse(FileSystemUtils.readContent(trace, UTF_8))) {
+          Profiler.instance()
+              .logSimpleTaskDuration(
+                  event.startNanos, event.durationNanos, ProfilerTask.NATIVE_TOOL,
+                  event.description);
+        }
+      }
+      FileSystemUtils.deleteTree(dir);
+    } catch (IOException e) {
+      LOG.warning("Could not import the native traces in " + dir + ": " + e);
+    }
+  }
+
+  /**
+   * Returns the spans and counters of a trace, the latter as events without duration, described
+   * as "tool: name" and "tool: name = value" respectively.
+   */
+  @VisibleForTesting
+  static ImmutableList<Event> parse(String trace) {
+    ImmutableList.Builder<Event> events = ImmutableList.builder();
+    String tool = "native tool";
+    for (String line : trace.split("\n")) {
+      Matcher matcher = PROCESS_NAME.matcher(line);
+      if (matcher.find()) {
+        tool = unescape(matcher.group(1));
+        continue;
+      }
+      matcher = SPAN.matcher(line);
+      if (matcher.find()) {
+        events.add(
+            new Event(
+                tool + ": " + unescape(matcher.group(1)),
+                TimeUnit.MICROSECONDS.toNanos(Long.parseLong(matcher.group(2))),
+                TimeUnit.MICROSECONDS.toNanos(Long.parseLong(matcher.group(3)))));
+        continue;
+      }
+      matcher = COUNTER.matcher(line);
+      if (matcher.find()) {
+        events.add(
+            new Event(
+                tool + ": " + unescape(matcher.group(1)) + " = " + matcher.group(3),
+                TimeUnit.MICROSECONDS.toNanos(Long.parseLong(matcher.group(2))),
+                0));
+      }
+    }
+    return events.build();
+  }
+
+  private static String unescape(String s) {
+    StringBuilder result = new StringBuilder(s.length());
+    for (int i = 0; i < s.length(); ++i) {
+      char c = s.charAt(i);
+      if (c != '\\' || i + 1 == s.length()) {
+        result.append(c);
+      } else if (s.charAt(i + 1) == 'u' && i + 5 < s.length()) {
+        try {
+          result.append((char) Integer.parseInt(s.substring(i + 2, i + 6), 16));
+          i += 5;
+        } catch (NumberFormatException e) {
+          result.append(c);
+        }
+      } else {
+        result.append(s.charAt(++i));
+      }
+    }
+    return result.toString();
+  }
+}
@@ -16,6 +16,7 @@ package com.google.devtools.build.lib.runtime;
 
 import com.google.common.annotations.VisibleForTesting;
 import com.google.common.base.Function;
+import com.google.common.base.Splitter;
 import com.google.common.collect.ImmutableList;
 import com.google.common.collect.ImmutableMap;
 import com.google.common.collect.Lists;
@@ -352,6 +353,34 @@ public final class BlazeRuntime {
     return projectFileProvider;
   }
 
+  /**
+   * Adds the phases of the launcher startup (see --client_startup_phases) to the profile. The
+   * times of the launcher are relative to when it sent the request, which is taken to be the
+   * start of the execution of the command.
+   */
+  private static void logClientStartupPhases(
+      Profiler profiler, String phases, long execStartTimeNanos) {
+    for (String phase : Splitter.on(',').omitEmptyStrings().split(phases)) {
+      List<String> fields = Splitter.on(':').splitToList(phase);
+      if (fields.size() != 3) {
+        continue;
+      }
+      long startMillis;
+      long durationMillis;
+      try {
+        startMillis = Long.parseLong(fields.get(1));
+        durationMillis = Long.parseLong(fields.get(2));
+      } catch (NumberFormatException e) {
+        continue;
+      }
+      profiler.logSimpleTaskDuration(
+          execStartTimeNanos - startMillis * 1000000L,
+          durationMillis * 1000000L,
+          ProfilerTask.INFO,
+          "launcher " + fields.get(0));
+    }
+  }
+
   /**
    * Hook method called by the BlazeCommandDispatcher prior to the dispatch of
    * each command.
@@ -374,6 +403,7 @@ public final class BlazeRuntime {
           ProfilePhase.LAUNCH.description);
       profiler.logSimpleTaskDuration(execStartTimeNanos, 0, ProfilerTask.PHASE,
           ProfilePhase.INIT.description);
+      logClientStartupPhases(profiler, options.clientStartupPhases, execStartTimeNanos);
     }
 
     if (options.memoryProfilePath != null) {
@@ -807,7 +837,7 @@ public final class BlazeRuntime {
       RPCServer.Factory factory = (RPCServer.Factory) factoryClass.getConstructor().newInstance();
       return factory.create(commandExecutor, runtime.getClock(),
           startupOptions.commandPort, runtime.getServerDirectory(),
-          startupOptions.maxIdleSeconds);
+          startupOptions.maxIdleSeconds, startupOptions.shutdownOnMemoryPressure);
       } catch (ReflectiveOperationException | IllegalArgumentException e) {
         throw new AbruptExitException("gRPC server not compiled in", ExitCode.BLAZE_INTERNAL_ERROR);
       }
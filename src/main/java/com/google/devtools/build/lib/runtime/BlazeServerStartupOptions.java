@@ -19,6 +19,7 @@ import com.google.devtools.build.lib.vfs.PathFragment;
 import com.google.devtools.common.options.Converter;
 import com.google.devtools.common.options.Option;
 import com.google.devtools.common.options.OptionsBase;
+import java.util.List;
 import java.util.Map;
 
 /**
@@ -126,6 +127,36 @@ public class BlazeServerStartupOptions extends OptionsBase {
           + "can be shared between collaborating users.")
   public PathFragment outputUserRoot;
 
+  /* Note: This option is only used by the C++ client, never by the Java server.
+   * It is included here to make sure that the option is documented in the help
+   * output, which is auto-generated by Java code.
+   */
+  @Option(name = "shared_install_root",
+      defaultValue = "null", // NOTE: purely decorative!  See class docstring.
+      category = "server startup",
+      converter = OptionsUtils.PathFragmentConverter.class,
+      valueHelp = "<path>",
+      help = "A machine-wide directory, e.g. set in the master %{product}rc, in which the "
+          + "install base of this %{product} version is looked for before the one in "
+          + "--output_user_root. It is used if it is owned by root or by the user and is not "
+          + "writable by others. If it is missing and the directory is writable, it is extracted "
+          + "there, read-only, for the other users to share.")
+  public PathFragment sharedInstallRoot;
+
+  /* Note: This option is only used by the C++ client, never by the Java server.
+   * It is included here to make sure that the option is documented in the help
+   * output, which is auto-generated by Java code.
+   */
+  @Option(name = "local_output_root",
+      defaultValue = "null", // NOTE: purely decorative!  See class docstring.
+      category = "server startup",
+      converter = OptionsUtils.PathFragmentConverter.class,
+      valueHelp = "<path>",
+      help = "A directory on local disk, e.g. /local, below which the output base is put "
+          + "instead if --output_user_root is on a network file system such as NFS, with a "
+          + "symlink to it at the usual place. Has no effect if --output_base is given.")
+  public PathFragment localOutputRoot;
+
   @Option(name = "workspace_directory",
       defaultValue = "",
       category = "hidden",
@@ -142,6 +173,15 @@ public class BlazeServerStartupOptions extends OptionsBase {
           + "means that the server will never shutdown.")
   public int maxIdleSeconds;
 
+  @Option(name = "shutdown_on_memory_pressure",
+      defaultValue = "false", // NOTE: purely decorative!  See class docstring.
+      category = "server startup",
+      help = "If true, an idle server outlives --max_idle_secs for as long as the machine has "
+          + "memory to spare, as told by /proc/pressure/memory and /proc/meminfo. When memory "
+          + "gets short it first gives its free heap back to the system and only shuts down if "
+          + "that does not help.")
+  public boolean shutdownOnMemoryPressure;
+
   @Option(name = "batch",
       defaultValue = "false", // NOTE: purely decorative!  See class docstring.
       category = "server startup",
@@ -191,6 +231,78 @@ public class BlazeServerStartupOptions extends OptionsBase {
           + "does not perform a system call.")
   public int ioNiceLevel;
 
+  @Option(name = "server_cgroup",
+      defaultValue = "null",  // NOTE: purely decorative!
+      category = "server startup",
+      valueHelp = "<path>",
+      help = "Only on Linux; the cgroup (v2) directory the %{product} server is started in. It is "
+          + "created if it does not exist. The server has to be restarted for a change to take "
+          + "effect.")
+  public String serverCgroup;
+
+  @Option(name = "server_cgroup_setting",
+      defaultValue = "",  // NOTE: purely decorative!
+      category = "server startup",
+      allowMultiple = true,
+      valueHelp = "<interface file>=<value>",
+      help = "Only on Linux; a value written to an interface file of --server_cgroup before the "
+          + "server is started there, e.g. 'cpu.weight=50', 'io.weight=50' or 'memory.high=8G'. "
+          + "May be passed more than once.")
+  public List<String> serverCgroupSettings;
+
+  @Option(name = "server_cpu_affinity",
+      defaultValue = "null",  // NOTE: purely decorative!
+      category = "server startup",
+      valueHelp = "<cpu list>",
+      help = "Only on Linux; restricts the %{product} server to the given CPUs, e.g. '0-3,8'. "
+          + "Pinning the server to the CPUs of a NUMA node usually keeps its memory on that node "
+          + "too.")
+  public String serverCpuAffinity;
+
+  @Option(name = "server_numa_interleave",
+      defaultValue = "false",  // NOTE: purely decorative!
+      category = "server startup",
+      help = "Only on Linux; interleave the memory of the %{product} server across all NUMA "
+          + "nodes, like 'numactl --interleave=all' does. The server has to be restarted for a "
+          + "change to take effect.")
+  public boolean serverNumaInterleave;
+
+  @Option(name = "server_transparent_huge_pages",
+      defaultValue = "false",  // NOTE: purely decorative!
+      category = "server startup",
+      help = "Only on Linux; back the heap of the %{product} server with transparent huge pages "
+          + "(-XX:+UseTransparentHugePages). Ignored with a warning if they are disabled in "
+          + "/sys/kernel/mm/transparent_hugepage/enabled.")
+  public boolean serverTransparentHugePages;
+
+  @Option(name = "server_auto_jvm_args",
+      defaultValue = "true",  // NOTE: purely decorative!
+      category = "server startup",
+      help = "Size the heap of the %{product} server (-Xmx) from the memory available to it and "
+          + "from the peak memory of the previous server, and pick its garbage collector and "
+          + "number of GC threads from the CPUs available to it, honoring cgroup limits. "
+          + "Anything set with --host_jvm_args takes precedence.")
+  public boolean serverAutoJvmArgs;
+
+  @Option(name = "grpc_stream_window_kb",
+      defaultValue = "1024",  // NOTE: purely decorative!
+      category = "server startup",
+      valueHelp = "<KB>",
+      help = "How much output the %{product} server may send ahead of the client on each "
+          + "command, i.e. the HTTP/2 flow-control window the client grants; larger windows "
+          + "stream large outputs, e.g. of 'query --output=proto', with fewer round trips. "
+          + "The whole connection is still limited to 1MB in flight.")
+  public int grpcStreamWindowKb;
+
+  @Option(name = "print_client_rpc_latencies",
+      defaultValue = "false",  // NOTE: purely decorative!
+      category = "server startup",
+      help = "If true, the client prints histograms of the latencies of its calls to the "
+          + "%{product} server when the command is done: pings, the time to the first response "
+          + "of the command, the gaps between its responses and cancellations. They are always "
+          + "written to client_rpc_latencies in the output base.")
+  public boolean printClientRpcLatencies;
+
   @Option(name = "batch_cpu_scheduling",
       defaultValue = "false",  // NOTE: purely decorative!
       category = "server startup",
@@ -220,6 +220,17 @@ public class CommonCommandOptions extends OptionsBase {
   )
   public long extractDataTime;
 
+  @Option(
+    name = "client_startup_phases",
+    defaultValue = "",
+    category = "hidden",
+    help =
+        "The phases of the launcher startup, as a comma-separated list of"
+            + " name:start:duration entries, where start is the time in ms before the request was"
+            + " sent to the blaze server and duration is in ms."
+  )
+  public String clientStartupPhases;
+
   @Option(name = "command_wait_time",
       defaultValue = "0",
       category = "hidden",
@@ -23,6 +23,7 @@ import com.google.devtools.build.lib.util.OsUtils;
 import com.google.devtools.build.lib.vfs.FileSystemUtils;
 import com.google.devtools.build.lib.vfs.Path;
 import com.google.devtools.build.lib.vfs.PathFragment;
+import java.io.ByteArrayOutputStream;
 import java.io.File;
 import java.io.IOException;
 import java.nio.charset.StandardCharsets;
@@ -43,7 +44,13 @@ final class LinuxSandboxRunner extends SandboxRunner {
   private final Path argumentsFilePath;
   private final Set<Path> writableDirs;
   private final Set<Path> inaccessiblePaths;
+  private final Path inputManifestPath;
+  private final Path overlayWorkDir;
+  private final String cgroupParent;
+  private final List<String> cgroupSettings;
+  private final String isolation;
   private final boolean sandboxDebug;
+  private final String innerIds;
 
   LinuxSandboxRunner(
       Path execRoot,
@@ -51,18 +58,40 @@ final class LinuxSandboxRunner extends SandboxRunner {
       Path sandboxExecRoot,
       Set<Path> writableDirs,
       Set<Path> inaccessiblePaths,
+      Path inputManifestPath,
+      Path overlayWorkDir,
+      String cgroupParent,
+      List<String> cgroupSettings,
+      String isolation,
       boolean verboseFailures,
-      boolean sandboxDebug) {
+      boolean sandboxDebug,
+      String innerIds) {
     super(sandboxPath, sandboxExecRoot, verboseFailures);
     this.execRoot = execRoot;
     this.sandboxExecRoot = sandboxExecRoot;
     this.argumentsFilePath = sandboxPath.getRelative("linux-sandbox.params");
     this.writableDirs = writableDirs;
     this.inaccessiblePaths = inaccessiblePaths;
+    this.inputManifestPath = inputManifestPath;
+    this.overlayWorkDir = overlayWorkDir;
+    this.cgroupParent = cgroupParent;
+    this.cgroupSettings = cgroupSettings;
+    this.isolation = isolation;
     this.sandboxDebug = sandboxDebug;
+    this.innerIds = innerIds;
   }
 
   static boolean isSupported(CommandEnvironment commandEnv) {
+    return getInnerIdsIfSupported(commandEnv) != null;
+  }
+
+  /**
+   * Checks whether the linux-sandbox works here. Returns null if it does not, otherwise the uid
+   * and gid of nobody as "uid:gid" for the -u option (or the empty string if there is no such
+   * user), looked up once so that the password database, which can be slow to query, is not read
+   * again for every sandboxed spawn.
+   */
+  static String getInnerIdsIfSupported(CommandEnvironment commandEnv) {
     Path execRoot = commandEnv.getExecRoot();
 
     PathFragment embeddedTool =
@@ -70,7 +99,7 @@ final class LinuxSandboxRunner extends SandboxRunner {
     if (embeddedTool == null) {
       // The embedded tool does not exist, meaning that we don't support sandboxing (e.g., while
       // bootstrapping).
-      return false;
+      return null;
     }
 
     List<String> args = new ArrayList<>();
@@ -81,18 +110,19 @@ final class LinuxSandboxRunner extends SandboxRunner {
     File cwd = execRoot.getPathFile();
 
     Command cmd = new Command(args.toArray(new String[0]), env, cwd);
+    ByteArrayOutputStream stdout = new ByteArrayOutputStream();
     try {
       cmd.execute(
           /* stdin */ new byte[] {},
           Command.NO_OBSERVER,
-          ByteStreams.nullOutputStream(),
+          stdout,
           ByteStreams.nullOutputStream(),
           /* killSubprocessOnInterrupt */ true);
     } catch (CommandException e) {
-      return false;
+      return null;
     }
 
-    return true;
+    return new String(stdout.toByteArray(), StandardCharsets.ISO_8859_1).trim();
   }
 
   @Override
@@ -137,11 +167,43 @@ final class LinuxSandboxRunner extends SandboxRunner {
       fileArgs.add(inaccessiblePath.getPathString());
     }
 
+    // Let the sandbox create the inputs (see ManifestedExecRoot).
+    if (inputManifestPath != null) {
+      fileArgs.add("-M");
+      fileArgs.add(inputManifestPath.getPathString());
+      if (overlayWorkDir != null) {
+        fileArgs.add("-O");
+        fileArgs.add(overlayWorkDir.getPathString());
+      }
+    }
+
+    // Run the spawn in its own cgroup, with limits.
+    if (!cgroupParent.isEmpty()) {
+      fileArgs.add("-c");
+      fileArgs.add(cgroupParent);
+      for (String cgroupSetting : cgroupSettings) {
+        fileArgs.add("-s");
+        fileArgs.add(cgroupSetting);
+      }
+    }
+
+    // Skip the namespaces the spawn does not need.
+    if (!isolation.isEmpty()) {
+      fileArgs.add("-I");
+      fileArgs.add(isolation);
+    }
+
     if (!allowNetwork) {
       // Block network access out of the namespace.
       fileArgs.add("-N");
     }
 
+    // Run as nobody without looking the user up again.
+    if (!innerIds.isEmpty()) {
+      fileArgs.add("-u");
+      fileArgs.add(innerIds);
+    }
+
     FileSystemUtils.writeLinesAs(argumentsFilePath, StandardCharsets.ISO_8859_1, fileArgs);
   }
 }
@@ -30,6 +30,7 @@ import com.google.devtools.build.lib.util.Preconditions;
 import com.google.devtools.build.lib.vfs.Path;
 import com.google.devtools.build.lib.vfs.PathFragment;
 import java.io.IOException;
+import java.util.Map;
 import java.util.Set;
 import java.util.UUID;
 import java.util.concurrent.ExecutorService;
@@ -59,6 +60,7 @@ public class LinuxSandboxedStrategy extends SandboxStrategy {
   private final boolean verboseFailures;
   private final String productName;
   private final boolean fullySupported;
+  private final String innerIds;
 
   private final UUID uuid = UUID.randomUUID();
   private final AtomicInteger execCounter = new AtomicInteger();
@@ -69,7 +71,8 @@ public class LinuxSandboxedStrategy extends SandboxStrategy {
       ExecutorService backgroundWorkers,
       boolean verboseFailures,
       String productName,
-      boolean fullySupported) {
+      boolean fullySupported,
+      String innerIds) {
     super(blazeDirs, verboseFailures, buildRequest.getOptions(SandboxOptions.class));
     this.buildRequest = buildRequest;
     this.sandboxOptions = buildRequest.getOptions(SandboxOptions.class);
@@ -79,6 +82,7 @@ public class LinuxSandboxedStrategy extends SandboxStrategy {
     this.verboseFailures = verboseFailures;
     this.productName = productName;
     this.fullySupported = fullySupported;
+    this.innerIds = innerIds;
   }
 
   /**
@@ -105,10 +109,21 @@ public class LinuxSandboxedStrategy extends SandboxStrategy {
     Set<Path> writableDirs = getWritableDirs(sandboxExecRoot, spawn.getEnvironment());
 
     try {
-      // Build the execRoot for the sandbox.
-      SymlinkedExecRoot symlinkedExecRoot = new SymlinkedExecRoot(sandboxExecRoot);
+      // Build the execRoot for the sandbox. Unless the inputs are left to the linux-sandbox,
+      // this creates a symlink per input file.
+      Path inputManifestPath = null;
+      Path overlayWorkDir = null;
+      SandboxExecRoot sandboxExecRootBuilder;
+      if (fullySupported && sandboxOptions.sandboxInputManifest) {
+        inputManifestPath = sandboxPath.getRelative("inputs.manifest");
+        overlayWorkDir = sandboxPath.getRelative("overlay-work");
+        sandboxExecRootBuilder =
+            new ManifestedExecRoot(sandboxExecRoot, inputManifestPath, overlayWorkDir);
+      } else {
+        sandboxExecRootBuilder = new SymlinkedExecRoot(sandboxExecRoot);
+      }
       ImmutableSet<PathFragment> outputs = SandboxHelpers.getOutputFiles(spawn);
-      symlinkedExecRoot.createFileSystem(
+      sandboxExecRootBuilder.createFileSystem(
           getMounts(spawn, actionExecutionContext), outputs, writableDirs);
 
       final SandboxRunner runner;
@@ -120,8 +135,14 @@ public class LinuxSandboxedStrategy extends SandboxStrategy {
                 sandboxExecRoot,
                 getWritableDirs(sandboxExecRoot, spawn.getEnvironment()),
                 getInaccessiblePaths(),
+                inputManifestPath,
+                overlayWorkDir,
+                sandboxOptions.sandboxCgroupParent,
+                sandboxOptions.sandboxCgroupSettings,
+                getIsolation(spawn.getMnemonic()),
                 verboseFailures,
-                sandboxOptions.sandboxDebug);
+                sandboxOptions.sandboxDebug,
+                innerIds);
       } else {
         runner = new ProcessWrapperRunner(execRoot, sandboxPath, sandboxExecRoot, verboseFailures);
       }
@@ -133,7 +154,7 @@ public class LinuxSandboxedStrategy extends SandboxStrategy {
             Spawns.getTimeoutSeconds(spawn),
             SandboxHelpers.shouldAllowNetwork(buildRequest, spawn));
       } finally {
-        symlinkedExecRoot.copyOutputs(execRoot, outputs);
+        sandboxExecRootBuilder.copyOutputs(execRoot, outputs);
         if (!sandboxOptions.sandboxDebug) {
           SandboxHelpers.lazyCleanup(backgroundWorkers, runner);
         }
@@ -143,4 +164,17 @@ public class LinuxSandboxedStrategy extends SandboxStrategy {
     }
   }
 
+  /**
+   * Returns the isolation profile of the linux-sandbox for spawns with the given mnemonic, or the
+   * empty string for the default. As with --strategy, the last matching setting wins.
+   */
+  private String getIsolation(String mnemonic) {
+    String isolation = "";
+    for (Map.Entry<String, String> entry : sandboxOptions.sandboxIsolation) {
+      if (entry.getKey().equals(mnemonic)) {
+        isolation = entry.getValue();
+      }
+    }
+    return isolation;
+  }
 }
@@ -0,0 +1,103 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.devtools.build.lib.sandbox;
+
+import com.google.common.io.Files;
+import com.google.devtools.build.lib.vfs.FileSystemUtils;
+import com.google.devtools.build.lib.vfs.Path;
+import com.google.devtools.build.lib.vfs.PathFragment;
+import java.io.IOException;
+import java.nio.charset.StandardCharsets;
+import java.util.ArrayList;
+import java.util.Collection;
+import java.util.HashSet;
+import java.util.List;
+import java.util.Map;
+import java.util.Map.Entry;
+import java.util.Set;
+
+/**
+ * Creates an execRoot for a Spawn that only contains the directories for its outputs, and writes
+ * a manifest of its input files, which the linux-sandbox then makes available in the execRoot
+ * (see its -M and -O options). This saves creating a symlink per input file for actions with
+ * many inputs.
+ */
+final class ManifestedExecRoot implements SandboxExecRoot {
+
+  private final Path sandboxExecRoot;
+  private final Path inputManifestPath;
+  private final Path overlayWorkDir;
+
+  public ManifestedExecRoot(Path sandboxExecRoot, Path inputManifestPath, Path overlayWorkDir) {
+    this.sandboxExecRoot = sandboxExecRoot;
+    this.inputManifestPath = inputManifestPath;
+    this.overlayWorkDir = overlayWorkDir;
+  }
+
+  @Override
+  public void createFileSystem(
+      Map<PathFragment, Path> inputs, Collection<PathFragment> outputs, Set<Path> writableDirs)
+      throws IOException {
+    Set<Path> createdDirs = new HashSet<>();
+    FileSystemUtils.createDirectoryAndParentsWithCache(createdDirs, sandboxExecRoot);
+    FileSystemUtils.createDirectoryAndParentsWithCache(createdDirs, overlayWorkDir);
+    writeInputManifest(inputs);
+    createWritableDirectories(createdDirs, writableDirs);
+    createDirectoriesForOutputs(createdDirs, outputs);
+  }
+
+  /** Writes a line per input: its path relative to the execroot, a space, and its target. */
+  private void writeInputManifest(Map<PathFragment, Path> inputs) throws IOException {
+    List<String> lines = new ArrayList<>(inputs.size());
+    for (Entry<PathFragment, Path> entry : inputs.entrySet()) {
+      lines.add(entry.getKey().getPathString() + " " + entry.getValue().getPathString());
+    }
+    FileSystemUtils.writeLinesAs(inputManifestPath, StandardCharsets.ISO_8859_1, lines);
+  }
+
+  private void createWritableDirectories(Set<Path> createdDirs, Set<Path> writableDirs)
+      throws IOException {
+    for (Path writablePath : writableDirs) {
+      if (writablePath.startsWith(sandboxExecRoot)) {
+        FileSystemUtils.createDirectoryAndParentsWithCache(createdDirs, writablePath);
+      }
+    }
+  }
+
+  /** Prepare the output directories in the sandbox. */
+  private void createDirectoriesForOutputs(Set<Path> createdDirs, Collection<PathFragment> outputs)
+      throws IOException {
+    for (PathFragment output : outputs) {
+      FileSystemUtils.createDirectoryAndParentsWithCache(
+          createdDirs, sandboxExecRoot.getRelative(output.getParentDirectory()));
+    }
+  }
+
+  /** Moves all {@code outputs} to {@code execRoot}. */
+  @Override
+  public void copyOutputs(Path execRoot, Collection<PathFragment> outputs) throws IOException {
+    Set<Path> createdDirs = new HashSet<>();
+    for (PathFragment output : outputs) {
+      Path source = sandboxExecRoot.getRelative(output);
+      if (source.isFile() || source.isSymbolicLink()) {
+        FileSystemUtils.createDirectoryAndParentsWithCache(
+            createdDirs, execRoot.getRelative(output.getParentDirectory()));
+
+        Path target = execRoot.getRelative(output);
+        Files.move(source.getPathFile(), target.getPathFile());
+      }
+    }
+  }
+}
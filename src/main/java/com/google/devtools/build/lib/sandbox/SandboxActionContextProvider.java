@@ -51,7 +51,9 @@ final class SandboxActionContextProvider extends ActionContextProvider {
     switch (OS.getCurrent()) {
       case LINUX:
         if (LinuxSandboxedStrategy.isSupported(env)) {
-          boolean fullySupported = LinuxSandboxRunner.isSupported(env);
+          // The ids of nobody, if the linux-sandbox works, see LinuxSandboxRunner.
+          String innerIds = LinuxSandboxRunner.getInnerIdsIfSupported(env);
+          boolean fullySupported = innerIds != null;
           if (!fullySupported
               && !buildRequest.getOptions(SandboxOptions.class).ignoreUnsupportedSandboxing) {
             env.getReporter().handle(Event.warn(SANDBOX_NOT_SUPPORTED_MESSAGE));
@@ -63,7 +65,8 @@ final class SandboxActionContextProvider extends ActionContextProvider {
                   backgroundWorkers,
                   verboseFailures,
                   env.getRuntime().getProductName(),
-                  fullySupported));
+                  fullySupported,
+                  fullySupported ? innerIds : ""));
         }
         break;
       case DARWIN:
@@ -14,9 +14,11 @@
 
 package com.google.devtools.build.lib.sandbox;
 
+import com.google.devtools.common.options.Converters;
 import com.google.devtools.common.options.Option;
 import com.google.devtools.common.options.OptionsBase;
 import java.util.List;
+import java.util.Map;
 
 /**
  * Options for sandboxed execution.
@@ -41,6 +43,54 @@ public class SandboxOptions extends OptionsBase {
   )
   public boolean sandboxDebug;
 
+  @Option(
+    name = "experimental_sandbox_input_manifest",
+    defaultValue = "false",
+    category = "strategy",
+    help =
+        "If true, the Linux sandbox creates the inputs of an action itself, instead of the server "
+            + "creating a symlink per input file in the sandboxed execution root. Where "
+            + "overlayfs can be mounted, they are created in a tmpfs overlaid with it."
+  )
+  public boolean sandboxInputManifest;
+
+  @Option(
+    name = "experimental_sandbox_cgroup_parent",
+    defaultValue = "",
+    category = "strategy",
+    help =
+        "If set to the path of a cgroup v2 directory, the Linux sandbox runs each action in a new "
+            + "cgroup below it, with the settings of --experimental_sandbox_cgroup_setting."
+  )
+  public String sandboxCgroupParent;
+
+  @Option(
+    name = "experimental_sandbox_cgroup_setting",
+    allowMultiple = true,
+    defaultValue = "",
+    category = "strategy",
+    help =
+        "A setting of the cgroup of each sandboxed action, as <file>=<value>, e.g. "
+            + "memory.max=4G, pids.max=1000, cpu.max=\"200000 100000\" or cpuset.cpus=0-3. "
+            + "Requires --experimental_sandbox_cgroup_parent."
+  )
+  public List<String> sandboxCgroupSettings;
+
+  @Option(
+    name = "experimental_sandbox_isolation",
+    allowMultiple = true,
+    converter = Converters.AssignmentConverter.class,
+    defaultValue = "",
+    category = "strategy",
+    help =
+        "The isolation of the Linux sandbox for the actions with the given mnemonic, as "
+            + "<mnemonic>=<profile>, e.g. CppCompile=fs-only. Besides the read-only view of the "
+            + "filesystem, 'full' (the default) gives each action PID, UTS and IPC namespaces, "
+            + "'fs+pid' only a PID namespace and 'fs-only' none of them, which is cheaper but "
+            + "only suited to trusted actions."
+  )
+  public List<Map.Entry<String, String>> sandboxIsolation;
+
   @Option(
     name = "sandbox_block_path",
     allowMultiple = true,
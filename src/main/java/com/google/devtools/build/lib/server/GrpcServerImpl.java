@@ -106,6 +106,9 @@ public class GrpcServerImpl extends RPCServer {
 
   private static final long NANOSECONDS_IN_MS = TimeUnit.MILLISECONDS.toNanos(1);
 
+  // How often an idle server kept alive by --shutdown_on_memory_pressure checks the pressure.
+  private static final long MEMORY_PRESSURE_CHECK_SECONDS = 60;
+
   private class RunningCommand implements AutoCloseable {
     private final Thread thread;
     private final String id;
@@ -140,8 +143,10 @@ public class GrpcServerImpl extends RPCServer {
   public static class Factory implements RPCServer.Factory {
     @Override
     public RPCServer create(CommandExecutor commandExecutor, Clock clock, int port,
-      Path serverDirectory, int maxIdleSeconds) throws IOException {
-      return new GrpcServerImpl(commandExecutor, clock, port, serverDirectory, maxIdleSeconds);
+      Path serverDirectory, int maxIdleSeconds, boolean shutdownOnMemoryPressure)
+      throws IOException {
+      return new GrpcServerImpl(commandExecutor, clock, port, serverDirectory, maxIdleSeconds,
+          shutdownOnMemoryPressure);
     }
   }
 
@@ -413,19 +418,22 @@ public class GrpcServerImpl extends RPCServer {
   private final String responseCookie;
   private final AtomicLong interruptCounter = new AtomicLong(0);
   private final int maxIdleSeconds;
+  private final boolean shutdownOnMemoryPressure;
 
   private Server server;
   private final int port;
   boolean serving;
 
   public GrpcServerImpl(CommandExecutor commandExecutor, Clock clock, int port,
-      Path serverDirectory, int maxIdleSeconds) throws IOException {
+      Path serverDirectory, int maxIdleSeconds, boolean shutdownOnMemoryPressure)
+      throws IOException {
     super(serverDirectory);
     this.commandExecutor = commandExecutor;
     this.clock = clock;
     this.serverDirectory = serverDirectory;
     this.port = port;
     this.maxIdleSeconds = maxIdleSeconds;
+    this.shutdownOnMemoryPressure = shutdownOnMemoryPressure;
     this.serving = false;
 
     this.streamExecutorPool =
@@ -486,11 +494,13 @@ public class GrpcServerImpl extends RPCServer {
     synchronized (runningCommands) {
       boolean idle = runningCommands.isEmpty();
       boolean wasIdle = false;
+      boolean trimmed = false;
       long shutdownTime = -1;
 
       while (true) {
         if (!wasIdle && idle) {
           shutdownTime = BlazeClock.nanoTime() + maxIdleSeconds * 1000L * NANOSECONDS_IN_MS;
+          trimmed = false;
         }
 
         try {
@@ -511,7 +521,26 @@ public class GrpcServerImpl extends RPCServer {
         wasIdle = idle;
         idle = runningCommands.isEmpty();
         if (wasIdle && idle && BlazeClock.nanoTime() >= shutdownTime) {
-          break;
+          if (!shutdownOnMemoryPressure) {
+            break;
+          }
+          // Past --max_idle_secs, stay as long as the machine can spare the memory. Give back
+          // the free heap once when memory gets short, and only exit if that did not help.
+          MemoryPressure.Level pressure = MemoryPressure.current();
+          if (pressure == MemoryPressure.Level.SEVERE
+              || (pressure == MemoryPressure.Level.MODERATE && trimmed)) {
+            log.info("Shutting down idle server due to memory pressure");
+            break;
+          }
+          if (pressure == MemoryPressure.Level.MODERATE) {
+            log.info("Trimming the heap of the idle server due to memory pressure");
+            trimHeap();
+            trimmed = true;
+          } else {
+            trimmed = false;
+          }
+          shutdownTime =
+              BlazeClock.nanoTime() + MEMORY_PRESSURE_CHECK_SECONDS * 1000L * NANOSECONDS_IN_MS;
         }
       }
     }
@@ -519,6 +548,18 @@ public class GrpcServerImpl extends RPCServer {
     server.shutdown();
   }
 
+  /**
+   * Collects all garbage so that the JVM uncommits the heap above -XX:MaxHeapFreeRatio of what is
+   * live and returns it to the system.
+   */
+  private static void trimHeap() {
+    Runtime runtime = Runtime.getRuntime();
+    long before = runtime.totalMemory();
+    System.gc();
+    log.info(String.format("Heap trimmed from %d MB to %d MB", before >> 20,
+        runtime.totalMemory() >> 20));
+  }
+
   @Override
   public void interrupt() {
     synchronized (runningCommands) {
@@ -0,0 +1,137 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.devtools.build.lib.server;
+
+import com.google.common.annotations.VisibleForTesting;
+import com.google.devtools.build.lib.util.ProcMeminfoParser;
+import java.io.IOException;
+import java.nio.charset.StandardCharsets;
+import java.nio.file.Files;
+import java.nio.file.Paths;
+import java.util.logging.Logger;
+
+/**
+ * Tells how badly the machine needs memory, so that an idle server can decide whether to stay,
+ * shrink or go.
+ *
+ * <p>Uses the pressure stall information of Linux 4.20 and later (/proc/pressure/memory), i.e. the
+ * share of time tasks were stalled waiting for memory, and the available memory of /proc/meminfo.
+ * Elsewhere, or if neither can be read, there is never pressure.
+ */
+final class MemoryPressure {
+  private static final Logger LOG = Logger.getLogger(MemoryPressure.class.getName());
+
+  private static final String PSI_FILE = "/proc/pressure/memory";
+
+  /** How badly memory is needed. */
+  enum Level {
+    /** Memory is plentiful. */
+    NONE,
+    /** Memory is getting short; an idle server should give back what it does not need. */
+    MODERATE,
+    /** Memory is short; an idle server should exit. */
+    SEVERE,
+  }
+
+  // Percentages of the last 60 seconds during which some, respectively all, non-idle tasks were
+  // stalled on memory.
+  private static final double MODERATE_SOME_STALL = 10;
+  private static final double SEVERE_FULL_STALL = 5;
+
+  // Fractions of the physical memory that are available.
+  private static final double MODERATE_AVAILABLE = .2;
+  private static final double SEVERE_AVAILABLE = .1;
+
+  private MemoryPressure() {}
+
+  /** Returns the current memory pressure of the machine. */
+  static Level current() {
+    Level level = Level.NONE;
+    try {
+      String psi = new String(Files.readAllBytes(Paths.get(PSI_FILE)), StandardCharsets.US_ASCII);
+      level = max(level, fromStalls(psi));
+    } catch (IOException e) {
+      // Not Linux, or a kernel without pressure stall information.
+    }
+
+    try {
+      ProcMeminfoParser memInfo = new ProcMeminfoParser();
+      long total = memInfo.getTotalKb();
+      long available;
+      try {
+        available = memInfo.getRamKb("MemAvailable");
+      } catch (IllegalArgumentException e) {
+        available = memInfo.getFreeRamKb(); // Kernels before 3.14.
+      }
+      level = max(level, fromAvailable(total, available));
+    } catch (IOException | IllegalArgumentException e) {
+      LOG.info("Could not process /proc/meminfo: " + e);
+    }
+    return level;
+  }
+
+  /**
+   * Returns the pressure told by the contents of /proc/pressure/memory, for example
+   *
+   * <pre>
+   * some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+   * full avg10=0.00 avg60=0.00 avg300=0.00 total=0
+   * </pre>
+   */
+  @VisibleForTesting
+  static Level fromStalls(String psi) {
+    double some = 0;
+    double full = 0;
+    for (String line : psi.split("\n")) {
+      String[] fields = line.trim().split(" ");
+      for (String field : fields) {
+        if (field.startsWith("avg60=")) {
+          double value;
+          try {
+            value = Double.parseDouble(field.substring("avg60=".length()));
+          } catch (NumberFormatException e) {
+            continue;
+          }
+          if (fields[0].equals("some")) {
+            some = value;
+          } else if (fields[0].equals("full")) {
+            full = value;
+          }
+        }
+      }
+    }
+    if (full >= SEVERE_FULL_STALL) {
+      return Level.SEVERE;
+    }
+    return some >= MODERATE_SOME_STALL ? Level.MODERATE : Level.NONE;
+  }
+
+  /** Returns the pressure told by the total and available physical memory. */
+  @VisibleForTesting
+  static Level fromAvailable(long totalKb, long availableKb) {
+    if (totalKb <= 0) {
+      return Level.NONE;
+    }
+    double fractionAvailable = (double) availableKb / totalKb;
+    if (fractionAvailable < SEVERE_AVAILABLE) {
+      return Level.SEVERE;
+    }
+    return fractionAvailable < MODERATE_AVAILABLE ? Level.MODERATE : Level.NONE;
+  }
+
+  private static Level max(Level a, Level b) {
+    return a.compareTo(b) >= 0 ? a : b;
+  }
+}
@@ -36,7 +36,7 @@ public abstract class RPCServer {
    */
   public interface Factory {
     RPCServer create(CommandExecutor commandExecutor, Clock clock, int port, Path serverDirectory,
-        int maxIdleSeconds) throws IOException;
+        int maxIdleSeconds, boolean shutdownOnMemoryPressure) throws IOException;
   }
 
   protected RPCServer(Path serverDirectory) throws IOException {
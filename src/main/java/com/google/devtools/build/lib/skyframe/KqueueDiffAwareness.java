@@ -0,0 +1,114 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+package com.google.devtools.build.lib.skyframe;
+
+import com.google.common.base.Preconditions;
+import com.google.common.collect.ImmutableSet;
+import com.google.devtools.build.lib.UnixJniLoader;
+
+import java.io.File;
+import java.io.IOException;
+import java.nio.file.Path;
+
+/**
+ * A {@link DiffAwareness} that uses kqueue from JNI code to watch the filesystem, in lieu of
+ * {@link WatchServiceDiffAwareness}.
+ *
+ * <p>
+ * On FreeBSD, the WatchService polls, like on OS X, where this is used if FSEvents is not
+ * available. kqueue watches open file descriptors, so the JNI code keeps every directory and file
+ * of the tree open, up to half of the file descriptor limit. When a tree needs more than that, the
+ * next view is broken and the caller checks every file instead.
+ */
+public final class KqueueDiffAwareness extends LocalDiffAwareness {
+
+  private boolean closed;
+
+  // Keep a pointer to a native structure in the JNI code (the event loop needs that structure).
+  private long nativePointer;
+
+  /**
+   * Watch changes on the file system under <code>watchRoot</code>.
+   *
+   * @throws IOException if the tree cannot be watched, e.g. because it has more files than file
+   *     descriptors are allowed for watches
+   */
+  KqueueDiffAwareness(String watchRoot) throws IOException {
+    super(watchRoot);
+    create(watchRootPath.toAbsolutePath().toString());
+
+    // Start a thread that just contains the event loop.
+    Thread thread =
+        new Thread(
+            new Runnable() {
+              @Override
+              public void run() {
+                KqueueDiffAwareness.this.run();
+              }
+            },
+            "kqueue-diff-awareness");
+    thread.setDaemon(true);
+    thread.start();
+  }
+
+  /**
+   * Helper function to start the watch of <code>root</code>, called by the constructor.
+   */
+  private native void create(String root) throws IOException;
+
+  /**
+   * Run the event loop until {@link #close}; frees the native structure on return.
+   */
+  private native void run();
+
+  /**
+   * Close this watch service, this service should not be used any longer after closing.
+   */
+  public synchronized void close() {
+    Preconditions.checkState(!closed);
+    closed = true;
+    doClose();
+  }
+
+  /**
+   * JNI code stopping the event loop.
+   */
+  private synchronized native void doClose();
+
+  /**
+   * JNI code returning the list of absolute path modified since last call, or null if events were
+   * lost or some files could not be watched.
+   */
+  private native String[] poll();
+
+  static {
+    UnixJniLoader.loadJni();
+  }
+
+  @Override
+  public synchronized View getCurrentView() throws BrokenDiffAwarenessException {
+    Preconditions.checkState(!closed);
+    String[] modified = poll();
+    if (modified == null) {
+      close();
+      throw new BrokenDiffAwarenessException(
+          "Events were lost while watching " + watchRootPath + " for changes");
+    }
+    ImmutableSet.Builder<Path> paths = ImmutableSet.builder();
+    for (String path : modified) {
+      paths.add(new File(path).toPath());
+    }
+    return newView(paths.build());
+  }
+}
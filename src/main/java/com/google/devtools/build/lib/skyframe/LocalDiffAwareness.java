@@ -30,11 +30,14 @@ import java.util.Set;
 
 /**
  * File system watcher for local filesystems. It's able to provide a list of changed files between
- * two consecutive calls. On Linux, uses the standard Java WatchService, which uses 'inotify' and,
- * on OS X, uses {@link MacOSXFsEventsDiffAwareness}, which use FSEvents.
+ * two consecutive calls. On Linux, uses {@link LinuxFsNotifyDiffAwareness}, which uses 'fanotify'
+ * or 'inotify' from JNI code, falling back to the standard Java WatchService. On OS X, uses
+ * {@link MacOSXFsEventsDiffAwareness}, which use FSEvents, and on FreeBSD or if FSEvents fails,
+ * {@link KqueueDiffAwareness}, which uses kqueue from JNI code.
  *
  * <p>
- * This is an abstract class, specialized by {@link MacOSXFsEventsDiffAwareness} and
+ * This is an abstract class, specialized by {@link LinuxFsNotifyDiffAwareness},
+ * {@link MacOSXFsEventsDiffAwareness}, {@link KqueueDiffAwareness} and
  * {@link WatchServiceDiffAwareness}.
  */
 public abstract class LocalDiffAwareness implements DiffAwareness {
@@ -70,7 +73,25 @@ public abstract class LocalDiffAwareness implements DiffAwareness {
       }
       // On OSX uses FsEvents due to https://bugs.openjdk.java.net/browse/JDK-7133447
       if (OS.getCurrent() == OS.DARWIN) {
-        return new MacOSXFsEventsDiffAwareness(resolvedPathEntryFragment.toString());
+        try {
+          return new MacOSXFsEventsDiffAwareness(resolvedPathEntryFragment.toString());
+        } catch (IOException e) {
+          // Fall back to kqueue, which is still better than the polling WatchService.
+        }
+      }
+      if (OS.getCurrent() == OS.DARWIN || OS.getCurrent() == OS.FREEBSD) {
+        try {
+          return new KqueueDiffAwareness(resolvedPathEntryFragment.toString());
+        } catch (IOException e) {
+          // Fall back to the WatchService, e.g. if the tree needs too many file descriptors.
+        }
+      }
+      if (OS.getCurrent() == OS.LINUX) {
+        try {
+          return new LinuxFsNotifyDiffAwareness(resolvedPathEntryFragment.toString());
+        } catch (IOException e) {
+          // Fall back to the WatchService, which reports the problem on the first diff.
+        }
       }
 
       WatchService watchService;
@@ -14,11 +14,14 @@
 
 package com.google.devtools.build.lib.skyframe;
 
+import static java.nio.charset.StandardCharsets.UTF_8;
+
 import com.google.common.base.Preconditions;
 import com.google.common.collect.ImmutableSet;
 import com.google.devtools.build.lib.UnixJniLoader;
 
 import java.io.File;
+import java.io.IOException;
 import java.nio.file.Path;
 
 /**
@@ -40,8 +43,10 @@ public final class MacOSXFsEventsDiffAwareness extends LocalDiffAwareness {
   /**
    * Watch changes on the file system under <code>watchRoot</code> with a granularity of
    * <code>delay</code> seconds.
+   *
+   * @throws IOException if FSEvents cannot watch the tree
    */
-  MacOSXFsEventsDiffAwareness(String watchRoot, double latency) {
+  MacOSXFsEventsDiffAwareness(String watchRoot, double latency) throws IOException {
     super(watchRoot);
     create(new String[] {watchRootPath.toAbsolutePath().toString()}, latency);
 
@@ -58,15 +63,17 @@ public final class MacOSXFsEventsDiffAwareness extends LocalDiffAwareness {
 
   /**
    * Watch changes on the file system under <code>watchRoot</code> with a granularity of 5ms.
+   *
+   * @throws IOException if FSEvents cannot watch the tree
    */
-  MacOSXFsEventsDiffAwareness(String watchRoot) {
+  MacOSXFsEventsDiffAwareness(String watchRoot) throws IOException {
     this(watchRoot, 0.005);
   }
 
   /**
    * Helper function to start the watch of <code>paths</code>, called by the constructor.
    */
-  private native void create(String[] paths, double latency);
+  private native void create(String[] paths, double latency) throws IOException;
 
   /**
    * Run the main loop
@@ -88,9 +95,10 @@ public final class MacOSXFsEventsDiffAwareness extends LocalDiffAwareness {
   private synchronized native void doClose();
 
   /**
-   * JNI code returning the list of absolute path modified since last call.
+   * JNI code returning the absolute paths modified since last call, in UTF-8 and each followed by
+   * a NUL byte, or null if FSEvents dropped events since then.
    */
-  private native String[] poll();
+  private native byte[] poll();
 
   static {
     UnixJniLoader.loadJni();
@@ -100,8 +108,18 @@ public final class MacOSXFsEventsDiffAwareness extends LocalDiffAwareness {
   public synchronized View getCurrentView() throws BrokenDiffAwarenessException {
     Preconditions.checkState(!closed);
     ImmutableSet.Builder<Path> paths = ImmutableSet.builder();
-    for (String path : poll()) {
-      paths.add(new File(path).toPath());
+    byte[] packed = poll();
+    if (packed == null) {
+      close();
+      throw new BrokenDiffAwarenessException(
+          "Events were lost while watching " + watchRootPath + " for changes");
+    }
+    int start = 0;
+    for (int i = 0; i < packed.length; i++) {
+      if (packed[i] == 0) {
+        paths.add(new File(new String(packed, start, i - start, UTF_8)).toPath());
+        start = i + 1;
+      }
     }
     return newView(paths.build());
   }
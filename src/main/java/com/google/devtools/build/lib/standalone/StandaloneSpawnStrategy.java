@@ -24,6 +24,7 @@ import com.google.devtools.build.lib.actions.SpawnActionContext;
 import com.google.devtools.build.lib.actions.Spawns;
 import com.google.devtools.build.lib.actions.UserExecException;
 import com.google.devtools.build.lib.cmdline.Label;
+import com.google.devtools.build.lib.profiler.NativeTraces;
 import com.google.devtools.build.lib.rules.apple.AppleConfiguration;
 import com.google.devtools.build.lib.rules.apple.AppleHostInfo;
 import com.google.devtools.build.lib.rules.apple.DottedVersion;
@@ -37,6 +38,7 @@ import com.google.devtools.build.lib.util.OsUtils;
 import com.google.devtools.build.lib.util.io.FileOutErr;
 import com.google.devtools.build.lib.vfs.Path;
 import java.io.File;
+import java.io.IOException;
 import java.util.ArrayList;
 import java.util.List;
 
@@ -100,10 +102,24 @@ public class StandaloneSpawnStrategy implements SpawnActionContext {
     args.addAll(spawn.getArguments());
 
     String cwd = executor.getExecRoot().getPathString();
+    ImmutableMap<String, String> env =
+        locallyDeterminedEnv(execRoot, productName, spawn.getEnvironment());
+    Path traceDir = null;
+    if (NativeTraces.isTracing()) {
+      try {
+        traceDir = NativeTraces.createTraceDir(execRoot.getRelative("_native_traces"));
+        env = ImmutableMap.<String, String>builder()
+            .putAll(env)
+            .put(NativeTraces.TRACE_DIR_ENV, traceDir.getPathString())
+            .build();
+      } catch (IOException e) {
+        // Only the trace is lost.
+      }
+    }
     Command cmd =
         new Command(
             args.toArray(new String[] {}),
-            locallyDeterminedEnv(execRoot, productName, spawn.getEnvironment()),
+            env,
             new File(cwd),
             OS.getCurrent() == OS.WINDOWS && timeoutSeconds >= 0 ? timeoutSeconds * 1000 : -1);
 
@@ -127,6 +143,10 @@ public class StandaloneSpawnStrategy implements SpawnActionContext {
       String message = CommandFailureUtils.describeCommandFailure(
           verboseFailures, spawn.getArguments(), spawn.getEnvironment(), cwd);
       throw new UserExecException(message, e);
+    } finally {
+      if (traceDir != null) {
+        NativeTraces.importTraces(traceDir);
+      }
     }
   }
 
@@ -13,12 +13,15 @@
 // limitations under the License.
 package com.google.devtools.build.lib.unix;
 
+import com.google.common.base.Preconditions;
+import java.io.FileDescriptor;
 import java.io.FileInputStream;
 import java.io.FileOutputStream;
 import java.io.IOException;
 import java.io.InputStream;
 import java.io.OutputStream;
 import java.net.SocketException;
+import java.nio.ByteBuffer;
 
 /**
  * <p>An implementation of client Socket for local (AF_UNIX) sockets.
@@ -50,6 +53,14 @@ public class LocalClientSocket extends LocalSocket {
     connect(address);
   }
 
+  /**
+   * Constructs a client socket for the connected socket file descriptor, see
+   * {@link LocalServerSocket#acceptLocal}.
+   */
+  LocalClientSocket(FileDescriptor fd) {
+    super(fd, State.CONNECTED);
+  }
+
   /**
    * Connect to the specified server.  Blocks until the server accepts the
    * connection.
@@ -110,6 +121,95 @@ public class LocalClientSocket extends LocalSocket {
       };
   }
 
+  /**
+   * Reads from the socket into the remaining bytes of the direct buffer,
+   * without copying them through the heap, and advances its position.
+   *
+   * @return the number of bytes read, or -1 at the end of the stream.
+   * @throws IOException if there was a problem.
+   */
+  public int read(ByteBuffer dst) throws IOException {
+    return receive(dst, null);
+  }
+
+  /**
+   * Like {@link #read}, and stores the file descriptors passed with the bytes
+   * read in <code>fds</code>, in order. The slots left over are set to new,
+   * invalid descriptors. The descriptors that did not fit are closed. The
+   * caller owns the received descriptors, which are close-on-exec.
+   *
+   * @return the number of bytes read, or -1 at the end of the stream.
+   * @throws IOException if there was a problem.
+   */
+  public int receive(ByteBuffer dst, FileDescriptor[] fds)
+      throws IOException {
+    Preconditions.checkArgument(dst.isDirect(), "not a direct buffer");
+    synchronized (this) {
+      checkConnected();
+      checkInputNotShutdown();
+    }
+    if (fds != null) {
+      for (int i = 0; i < fds.length; i++) {
+        fds[i] = new FileDescriptor();
+      }
+    }
+    int read = receive(fd, dst, dst.position(), dst.remaining(), fds); // JNI
+    if (read > 0) {
+      dst.position(dst.position() + read);
+    }
+    return read;
+  }
+
+  /**
+   * Writes the remaining bytes of the direct buffers to the socket, in order
+   * and with a single system call, without copying them through the heap, and
+   * advances their positions. Like {@link
+   * java.nio.channels.GatheringByteChannel#write}, it may write fewer bytes
+   * than remain.
+   *
+   * @return the number of bytes written.
+   * @throws IOException if there was a problem.
+   */
+  public long write(ByteBuffer... srcs) throws IOException {
+    return send(srcs, null);
+  }
+
+  /**
+   * Like {@link #write}, and passes the file descriptors in <code>fds</code>
+   * to the peer with the first byte, e.g. so that it writes an output file
+   * opened here. The descriptors stay open here. At least one byte must
+   * remain to be written when descriptors are passed.
+   *
+   * @return the number of bytes written.
+   * @throws IOException if there was a problem.
+   */
+  public long send(ByteBuffer[] srcs, FileDescriptor[] fds)
+      throws IOException {
+    int[] positions = new int[srcs.length];
+    int[] lengths = new int[srcs.length];
+    long remaining = 0;
+    for (int i = 0; i < srcs.length; i++) {
+      Preconditions.checkArgument(srcs[i].isDirect(), "not a direct buffer");
+      positions[i] = srcs[i].position();
+      lengths[i] = srcs[i].remaining();
+      remaining += lengths[i];
+    }
+    Preconditions.checkArgument(fds == null || fds.length == 0 || remaining > 0,
+        "file descriptors can only be passed with data");
+    synchronized (this) {
+      checkConnected();
+      checkOutputNotShutdown();
+    }
+    long written = send(fd, srcs, positions, lengths, fds); // JNI
+    long left = written;
+    for (int i = 0; i < srcs.length && left > 0; i++) {
+      int advance = (int) Math.min(left, lengths[i]);
+      srcs[i].position(positions[i] + advance);
+      left -= advance;
+    }
+    return written;
+  }
+
   @Override
   public String toString() {
     return "LocalClientSocket(" + address + ")";
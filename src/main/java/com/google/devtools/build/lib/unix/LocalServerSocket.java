@@ -133,17 +133,7 @@ public class LocalServerSocket extends LocalSocket {
    */
   public synchronized Socket accept()
       throws IOException, SocketTimeoutException, InterruptedIOException {
-    if (state != State.LISTENING) {
-      throw new SocketException("socket is not in listening state");
-    }
-
-    // Throws a SocketTimeoutException if timeout.
-    if (soTimeoutMillis != 0) {
-      poll(fd, soTimeoutMillis); // JNI
-    }
-
-    FileDescriptor clientFd = new FileDescriptor();
-    accept(fd, clientFd); // JNI
+    FileDescriptor clientFd = acceptFd();
     final LocalSocketImpl impl = new LocalSocketImpl(clientFd);
     return new Socket(impl) {
         @Override
@@ -166,6 +156,32 @@ public class LocalServerSocket extends LocalSocket {
       };
   }
 
+  /**
+   * Like {@link #accept}, but returns the new socket as a {@link
+   * LocalClientSocket}, which can also read and write direct buffers and pass
+   * file descriptors.
+   */
+  public synchronized LocalClientSocket acceptLocal()
+      throws IOException, SocketTimeoutException, InterruptedIOException {
+    return new LocalClientSocket(acceptFd());
+  }
+
+  private FileDescriptor acceptFd()
+      throws IOException, SocketTimeoutException, InterruptedIOException {
+    if (state != State.LISTENING) {
+      throw new SocketException("socket is not in listening state");
+    }
+
+    // Throws a SocketTimeoutException if timeout.
+    if (soTimeoutMillis != 0) {
+      poll(fd, soTimeoutMillis); // JNI
+    }
+
+    FileDescriptor clientFd = new FileDescriptor();
+    accept(fd, clientFd); // JNI
+    return clientFd;
+  }
+
   @Override
   public String toString() {
     return "LocalServerSocket(" + address + ")";
@@ -20,6 +20,7 @@ import java.io.IOException;
 import java.io.InterruptedIOException;
 import java.net.SocketException;
 import java.net.SocketTimeoutException;
+import java.nio.ByteBuffer;
 
 /**
  * Abstract superclass for client and server local sockets.
@@ -51,6 +52,14 @@ abstract class LocalSocket implements Closeable {
     this.state = State.NEW;
   }
 
+  /**
+   * Constructs a local socket for the open socket file descriptor.
+   */
+  protected LocalSocket(FileDescriptor fd, State state) {
+    this.fd = fd;
+    this.state = state;
+  }
+
   /**
    * Returns the address of the endpoint this socket is bound to.
    *
@@ -213,4 +222,35 @@ abstract class LocalSocket implements Closeable {
   // Client operations:
   protected static native void connect(FileDescriptor client, String filename)
       throws IOException;
+
+  // Data operations on direct ByteBuffers, see LocalClientSocket. The file
+  // descriptors are passed with SCM_RIGHTS, at most 64 per message.
+
+  /**
+   * Reads up to length bytes at position in the direct buffer, storing the
+   * file descriptors passed with them in fds, which may be null. Returns the
+   * number of bytes read, or -1 at the end of the stream.
+   */
+  static native int receive(FileDescriptor fd, ByteBuffer buffer, int position,
+                            int length, FileDescriptor[] fds)
+      throws IOException;
+  /**
+   * Writes the lengths[i] bytes at positions[i] in the direct buffers with a
+   * single sendmsg(), passing the file descriptors in fds, which may be null,
+   * with the first byte. Returns the number of bytes written.
+   */
+  static native long send(FileDescriptor fd, ByteBuffer[] buffers,
+                          int[] positions, int[] lengths, FileDescriptor[] fds)
+      throws IOException;
+
+  // Selector operations, see LocalSocketSelector:
+  static native long selectorCreate() throws IOException;
+  static native void selectorAdd(long selector, FileDescriptor fd, int key)
+      throws IOException;
+  static native void selectorRemove(long selector, FileDescriptor fd)
+      throws IOException;
+  static native int selectorWait(long selector, int[] readyKeys,
+                                 long timeoutMillis)
+      throws IOException;
+  static native void selectorClose(long selector);
 }
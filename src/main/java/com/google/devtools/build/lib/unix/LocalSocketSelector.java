@@ -0,0 +1,102 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.devtools.build.lib.unix;
+
+import java.io.Closeable;
+import java.io.FileDescriptor;
+import java.io.IOException;
+
+/**
+ * Waits for any of a set of local sockets to become readable, so that one thread can serve many
+ * connections. It is backed by epoll on Linux and by poll() elsewhere.
+ *
+ * <p>Unlike {@link LocalServerSocket#accept} with a timeout, waiting does not throw when the
+ * timeout elapses; it just reports no ready socket. Sockets may be added and removed while
+ * another thread waits.
+ */
+public final class LocalSocketSelector implements Closeable {
+
+  private long nativeSelector;
+
+  public LocalSocketSelector() throws IOException {
+    nativeSelector = LocalSocket.selectorCreate();
+  }
+
+  /**
+   * Adds the listening {@code socket} to the set, to be reported with {@code key} when a client
+   * connects.
+   */
+  public void add(LocalServerSocket socket, int key) throws IOException {
+    add(socket.fd, key);
+  }
+
+  /**
+   * Adds the connected {@code socket} to the set, to be reported with {@code key} when there is
+   * input or it was hung up.
+   */
+  public void add(LocalClientSocket socket, int key) throws IOException {
+    add(socket.fd, key);
+  }
+
+  /** Removes {@code socket} from the set; must be called before closing it. */
+  public void remove(LocalServerSocket socket) throws IOException {
+    remove(socket.fd);
+  }
+
+  /** Removes {@code socket} from the set; must be called before closing it. */
+  public void remove(LocalClientSocket socket) throws IOException {
+    remove(socket.fd);
+  }
+
+  synchronized void add(FileDescriptor fd, int key) throws IOException {
+    checkNotClosed();
+    LocalSocket.selectorAdd(nativeSelector, fd, key);
+  }
+
+  synchronized void remove(FileDescriptor fd) throws IOException {
+    checkNotClosed();
+    LocalSocket.selectorRemove(nativeSelector, fd);
+  }
+
+  /**
+   * Waits up to {@code timeoutMillis} milliseconds, or forever if negative, for sockets of the set
+   * to become ready, and stores the keys of up to {@code readyKeys.length} of them there.
+   *
+   * @return the number of keys stored, 0 if the timeout elapsed or a signal arrived
+   */
+  public int select(int[] readyKeys, long timeoutMillis) throws IOException {
+    long selector;
+    synchronized (this) {
+      checkNotClosed();
+      selector = nativeSelector;
+    }
+    return LocalSocket.selectorWait(selector, readyKeys, timeoutMillis);
+  }
+
+  /** Frees the selector; must not be called while another thread is in {@link #select}. */
+  @Override
+  public synchronized void close() {
+    if (nativeSelector != 0) {
+      LocalSocket.selectorClose(nativeSelector);
+      nativeSelector = 0;
+    }
+  }
+
+  private void checkNotClosed() throws IOException {
+    if (nativeSelector == 0) {
+      throw new IOException("selector is closed");
+    }
+  }
+}
@@ -21,9 +21,16 @@ import com.google.devtools.build.lib.UnixJniLoader;
 import java.io.File;
 import java.io.FileNotFoundException;
 import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.StandardCharsets;
+import java.util.Arrays;
+import java.util.SortedMap;
+import java.util.TreeMap;
 import java.util.logging.Level;
 import java.util.logging.LogManager;
 import java.util.logging.Logger;
+import javax.annotation.Nullable;
 
 /**
  * Utility methods for access to UNIX filesystem calls not exposed by the Java
@@ -225,6 +232,24 @@ public final class NativePosixFiles {
    */
   public static native void utime(String path, boolean now, int modtime) throws IOException;
 
+  /**
+   * Like {@link #chmod} for every one of {@code paths}, with a single native call that spreads
+   * large batches over a few native threads. If {@code regularFilesOnly} is true, paths that are
+   * not regular files (without following symbolic links) are left alone, which is how the
+   * outputs of actions are made read-only.
+   *
+   * @return the errno of every path, 0 where the call succeeded or the path was left alone.
+   */
+  public static native int[] chmodBatch(String[] paths, int mode, boolean regularFilesOnly);
+
+  /**
+   * Like {@link #utime} for every one of {@code paths}, with a single native call that spreads
+   * large batches over a few native threads.
+   *
+   * @return the errno of every path, 0 where the call succeeded.
+   */
+  public static native int[] utimeBatch(String[] paths, boolean now, int modtime);
+
   /**
    * Native wrapper around POSIX mkdir(2) syscall.
    *
@@ -319,7 +344,6 @@ public final class NativePosixFiles {
      */
     private final byte[] types;
 
-    /** called from JNI */
     public Dirents(String[] names, byte[] types) {
       this.names = names;
       this.types = types;
@@ -356,12 +380,366 @@ public final class NativePosixFiles {
    */
   public static Dirents readdir(String path, ReadTypes readTypes) throws IOException {
     // Passing enums to native code is possible, but onerous; we use a char instead.
-    return readdir(path, readTypes.getCode());
+    byte[] packed = readdirNative(path, readTypes.getCode());
+    // Every entry is a type byte, which is 0 for NONE, followed by its NUL-terminated name.
+    int count = 0;
+    for (int i = 1; i < packed.length; i++) {
+      if (packed[i] == 0) {
+        count++;
+        i++;  // Skip the type byte of the next entry.
+      }
+    }
+    String[] names = new String[count];
+    byte[] types = readTypes == ReadTypes.NONE ? null : new byte[count];
+    int start = 0;
+    for (int i = 0; i < count; i++) {
+      if (types != null) {
+        types[i] = packed[start];
+      }
+      int end = start + 1;
+      while (packed[end] != 0) {
+        end++;
+      }
+      names[i] = new String(packed, start + 1, end - start - 1, StandardCharsets.ISO_8859_1);
+      start = end + 1;
+    }
+    return new Dirents(names, types);
+  }
+
+  private static native byte[] readdirNative(String path, char typeCode)
+      throws IOException;
+
+  // Layout of the stat records filled by readdirWithStat and statBatch; keep in sync with struct
+  // StatRecord in unix_jni.cc. The records are in the byte order of the machine.
+  private static final int STAT_MODE = 0;
+  private static final int STAT_ERRNO = 4;
+  private static final int STAT_ATIME = 8;
+  private static final int STAT_ATIMENSEC = 12;
+  private static final int STAT_MTIME = 16;
+  private static final int STAT_MTIMENSEC = 20;
+  private static final int STAT_CTIME = 24;
+  private static final int STAT_CTIMENSEC = 28;
+  private static final int STAT_DEV = 32;
+  private static final int STAT_NAME_LENGTH = 36;
+  private static final int STAT_SIZE = 40;
+  private static final int STAT_INO = 48;
+  private static final int STAT_RECORD_SIZE = 56;
+
+  /** Returns the stat buffer of the record at "offset", or null if the stat call failed. */
+  private static FileStatus getStatusAt(ByteBuffer records, int offset) {
+    if (records.getInt(offset + STAT_ERRNO) != 0) {
+      return null;
+    }
+    return new FileStatus(
+        records.getInt(offset + STAT_MODE),
+        records.getInt(offset + STAT_ATIME),
+        records.getInt(offset + STAT_ATIMENSEC),
+        records.getInt(offset + STAT_MTIME),
+        records.getInt(offset + STAT_MTIMENSEC),
+        records.getInt(offset + STAT_CTIME),
+        records.getInt(offset + STAT_CTIMENSEC),
+        records.getLong(offset + STAT_SIZE),
+        records.getInt(offset + STAT_DEV),
+        records.getLong(offset + STAT_INO));
+  }
+
+  /**
+   * The entries of a directory together with their stat buffers, as returned by {@link
+   * #readdirWithStat}. Everything is kept in the array filled by the native code; names and
+   * {@link FileStatus} objects are only created when asked for.
+   */
+  public static final class DirentsWithStat {
+    private final ByteBuffer records;
+    /** The offset of each record in "records". */
+    private final int[] offsets;
+
+    private DirentsWithStat(byte[] records) {
+      this.records = ByteBuffer.wrap(records).order(ByteOrder.nativeOrder());
+      int count = 0;
+      for (int offset = 0; offset < records.length; count++) {
+        offset += STAT_RECORD_SIZE + this.records.getInt(offset + STAT_NAME_LENGTH);
+      }
+      this.offsets = new int[count];
+      for (int i = 0, offset = 0; i < count; i++) {
+        offsets[i] = offset;
+        offset += STAT_RECORD_SIZE + this.records.getInt(offset + STAT_NAME_LENGTH);
+      }
+    }
+
+    public int size() {
+      return offsets.length;
+    }
+
+    public String getName(int i) {
+      int offset = offsets[i];
+      return new String(records.array(), offset + STAT_RECORD_SIZE,
+          records.getInt(offset + STAT_NAME_LENGTH), StandardCharsets.ISO_8859_1);
+    }
+
+    /** Returns the errno of stat'ing the i-th entry, or 0 if that succeeded. */
+    public int getErrno(int i) {
+      return records.getInt(offsets[i] + STAT_ERRNO);
+    }
+
+    /** Returns the stat buffer of the i-th entry, or null if it could not be stat'ed. */
+    public FileStatus getStatus(int i) {
+      return getStatusAt(records, offsets[i]);
+    }
+  }
+
+  /**
+   * Reads a directory and stats all its entries relative to the directory, in a single native
+   * call. This is much cheaper than a {@link #readdir} followed by a {@link #stat} per entry.
+   *
+   * @param path the directory to read.
+   * @param followSymlinks whether to stat the targets of symlinks rather than the symlinks.
+   * @return the directory entries (excluding "." and "..") in the order they were returned by
+   *   the system, with their stat buffers; an entry that could not be stat'ed (e.g. a dangling
+   *   symlink when following symlinks) has an errno instead.
+   * @throws IOException if the directory could not be read.
+   */
+  public static DirentsWithStat readdirWithStat(String path, boolean followSymlinks)
+      throws IOException {
+    return new DirentsWithStat(readdirWithStatNative(path, followSymlinks));
   }
 
-  private static native Dirents readdir(String path, char typeCode)
+  private static native byte[] readdirWithStatNative(String path, boolean followSymlinks)
       throws IOException;
 
+  /**
+   * Stats many files with a single native call, spreading large batches over a few native
+   * threads. An instance keeps its result buffer, so that it can be reused for the next batch
+   * without allocating. Not thread-safe.
+   */
+  public static final class StatBatch {
+    private ByteBuffer records = ByteBuffer.allocateDirect(0);
+    private int size;
+
+    /**
+     * Stats (or lstats, if {@code followSymlinks} is false) all of {@code paths}, replacing the
+     * results of the previous call. Failures are reported per path by {@link #getErrno}.
+     */
+    public void stat(String[] paths, boolean followSymlinks) {
+      if (records.capacity() < paths.length * STAT_RECORD_SIZE) {
+        records = ByteBuffer.allocateDirect(paths.length * STAT_RECORD_SIZE)
+            .order(ByteOrder.nativeOrder());
+      }
+      size = paths.length;
+      if (size > 0) {
+        statBatchNative(paths, followSymlinks, records);
+      }
+    }
+
+    /** Returns the number of paths stat'ed by the last call to {@link #stat}. */
+    public int size() {
+      return size;
+    }
+
+    /** Returns the errno of stat'ing the i-th path, or 0 if that succeeded. */
+    public int getErrno(int i) {
+      checkIndex(i);
+      return records.getInt(i * STAT_RECORD_SIZE + STAT_ERRNO);
+    }
+
+    /** Returns the stat buffer of the i-th path, or null if it could not be stat'ed. */
+    public FileStatus getStatus(int i) {
+      checkIndex(i);
+      return getStatusAt(records, i * STAT_RECORD_SIZE);
+    }
+
+    private void checkIndex(int i) {
+      if (i < 0 || i >= size) {
+        throw new IndexOutOfBoundsException(i + " (size " + size + ")");
+      }
+    }
+  }
+
+  private static native void statBatchNative(String[] paths, boolean followSymlinks,
+      ByteBuffer out);
+
+  /**
+   * A reusable buffer for the result of stat'ing a single file, for callers that only look at a
+   * few fields and would otherwise allocate a {@link FileStatus} per call. Not thread-safe.
+   */
+  public static final class StatBuffer {
+    // The fields that stat can be restricted to; keep in sync with enum StatFields in unix_jni.h.
+    /** The file type and permissions, as returned by {@link #getMode}. */
+    public static final int TYPE = 1 << 0;
+    public static final int SIZE = 1 << 1;
+    public static final int ACCESS_TIME = 1 << 2;
+    public static final int MODIFIED_TIME = 1 << 3;
+    public static final int CHANGE_TIME = 1 << 4;
+    public static final int INODE = 1 << 5;
+    public static final int ALL_FIELDS = (1 << 6) - 1;
+    /**
+     * Not a field: lets network file systems such as NFS answer from their attribute cache
+     * instead of asking the server, so the result may be slightly stale.
+     */
+    public static final int DONT_SYNC = 1 << 8;
+
+    private final ByteBuffer record =
+        ByteBuffer.allocateDirect(STAT_RECORD_SIZE).order(ByteOrder.nativeOrder());
+
+    /**
+     * Stats (or lstats, if {@code followSymlinks} is false) {@code path} into this buffer,
+     * replacing the result of the previous call.
+     *
+     * @return 0 on success, or the errno of the failed call, in which case all fields are zero.
+     */
+    public int stat(String path, boolean followSymlinks) {
+      return stat(path, followSymlinks, ALL_FIELDS);
+    }
+
+    /**
+     * Like {@link #stat(String, boolean)}, but only asks for {@code fields}, a combination of
+     * the constants above. On Linux this uses statx(2), which spares file systems such as NFS and
+     * FUSE from revalidating the attributes not asked for. Fields not asked for may be zero; the
+     * device number is always filled in.
+     */
+    public int stat(String path, boolean followSymlinks, int fields) {
+      return statIntoNative(path, followSymlinks, fields, record);
+    }
+
+    /** Returns the errno of the last call to {@link #stat}, or 0 if that succeeded. */
+    public int getErrno() {
+      return record.getInt(STAT_ERRNO);
+    }
+
+    public int getMode() {
+      return record.getInt(STAT_MODE);
+    }
+
+    public long getSize() {
+      return record.getLong(STAT_SIZE);
+    }
+
+    public long getLastModifiedTime() {
+      return FileStatus.unsignedIntToLong(record.getInt(STAT_MTIME));
+    }
+
+    public long getFractionalLastModifiedTime() {
+      return FileStatus.unsignedIntToLong(record.getInt(STAT_MTIMENSEC));
+    }
+
+    public long getLastChangeTime() {
+      return FileStatus.unsignedIntToLong(record.getInt(STAT_CTIME));
+    }
+
+    public long getFractionalLastChangeTime() {
+      return FileStatus.unsignedIntToLong(record.getInt(STAT_CTIMENSEC));
+    }
+
+    public int getDeviceNumber() {
+      return record.getInt(STAT_DEV);
+    }
+
+    public long getInodeNumber() {
+      return record.getLong(STAT_INO);
+    }
+
+    /** Returns a copy of the last result, or null if the last call failed. */
+    public FileStatus getStatus() {
+      return getStatusAt(record, 0);
+    }
+  }
+
+  private static native int statIntoNative(String path, boolean followSymlinks, int fields,
+      ByteBuffer out);
+
+  /**
+   * A packed list of files to unlink, directories and symlinks to create below a directory with
+   * {@link #createTree}. Paths are relative to that directory and use '/' as separator. An
+   * instance can be cleared and reused for the next tree. Not thread-safe.
+   */
+  public static final class TreeManifest {
+    // Every entry is a kind byte and the NUL-terminated path, followed by the NUL-terminated
+    // target for symlinks; keep in sync with enum TreeEntryKind in unix_jni.cc.
+    private ByteBuffer buffer = ByteBuffer.allocateDirect(4096);
+    private int size;
+
+    /** Adds a file or symlink to unlink, unless it does not exist. */
+    public TreeManifest addUnlink(String path) {
+      return add('u', path, null);
+    }
+
+    /** Adds a directory to create, unless it is already there. */
+    public TreeManifest addDirectory(String path) {
+      return add('d', path, null);
+    }
+
+    /** Adds a symlink to create that points to {@code target}. */
+    public TreeManifest addSymlink(String path, String target) {
+      return add('s', path, target);
+    }
+
+    /** Returns the number of entries. */
+    public int size() {
+      return size;
+    }
+
+    /** Removes all entries. */
+    public void clear() {
+      buffer.clear();
+      size = 0;
+    }
+
+    private TreeManifest add(char kind, String path, @Nullable String target) {
+      byte[] pathBytes = path.getBytes(StandardCharsets.ISO_8859_1);
+      byte[] targetBytes =
+          target == null ? null : target.getBytes(StandardCharsets.ISO_8859_1);
+      int length = 2 + pathBytes.length + (target == null ? 0 : targetBytes.length + 1);
+      if (buffer.remaining() < length) {
+        ByteBuffer larger =
+            ByteBuffer.allocateDirect(Math.max(buffer.capacity() * 2, buffer.position() + length));
+        buffer.flip();
+        larger.put(buffer);
+        buffer = larger;
+      }
+      buffer.put((byte) kind).put(pathBytes).put((byte) 0);
+      if (targetBytes != null) {
+        buffer.put(targetBytes).put((byte) 0);
+      }
+      size++;
+      return this;
+    }
+  }
+
+  /**
+   * Applies {@code manifest} below the directory {@code root} with a single native call, which
+   * opens {@code root} once and makes every change relative to it, spreading large manifests over
+   * a few native threads. It first unlinks the files to unlink, then creates the directories, by
+   * depth so that parents need not come before their children, and finally the symlinks. Parents
+   * of entries must be in the manifest or exist already.
+   *
+   * @throws IOException for the first entry of the manifest that failed, after all of them were
+   *   tried; an existing symlink is reported as a failure, not replaced.
+   */
+  public static void createTree(String root, TreeManifest manifest) throws IOException {
+    if (manifest.size > 0) {
+      createTreeNative(root, manifest.buffer, manifest.buffer.position(), manifest.size);
+    }
+  }
+
+  private static native void createTreeNative(String root, ByteBuffer manifest, int length,
+      int count) throws IOException;
+
+  /**
+   * Replaces {@code dst} with a copy of the file {@code src}, with the same permissions. Where
+   * the file system supports it (btrfs and XFS reflinks, APFS clones), the copy shares the data
+   * of {@code src} and takes no time; otherwise it is copied within the kernel if possible.
+   *
+   * @throws IOException if the copy failed for any reason.
+   */
+  public static native void cloneOrCopy(String src, String dst) throws IOException;
+
+  /**
+   * Like {@link #cloneOrCopy} for every {@code srcs[i]} and {@code dsts[i]}, with a single native
+   * call that spreads the copies over a few native threads.
+   *
+   * @throws IOException for the first copy that failed, after all of them were tried.
+   */
+  public static native void cloneOrCopyBatch(String[] srcs, String[] dsts) throws IOException;
+
   /**
    * Native wrapper around POSIX rename(2) syscall.
    *
@@ -442,6 +820,121 @@ public final class NativePosixFiles {
     return HashCode.fromBytes(md5sumAsBytes(path));
   }
 
+  /** The digest functions supported by {@link #digests}. */
+  public enum DigestFunction {
+    MD5(0, 16),
+    SHA256(1, 32),
+    /** XXH64, a fast hash that is not cryptographically secure. */
+    XXHASH64(2, 8),
+    /** SHA-1, the digest function of the remote execution protocol. */
+    SHA1(3, 20);
+
+    // Keep in sync with enum DigestFunction in unix_jni.cc.
+    private final int code;
+    private final int digestLength;
+
+    private DigestFunction(int code, int digestLength) {
+      this.code = code;
+      this.digestLength = digestLength;
+    }
+
+    public int getDigestLength() {
+      return digestLength;
+    }
+  }
+
+  /**
+   * Computes the digests of many files with a single native call, reading them on a few native
+   * threads.
+   *
+   * @param paths the files to digest.
+   * @param function the digest function to use.
+   * @return the digest of each file, in the order of {@code paths}.
+   * @throws IOException if any of the files could not be read.
+   */
+  public static byte[][] digests(String[] paths, DigestFunction function) throws IOException {
+    byte[] all = digestBatchNative(paths, function.code);
+    byte[][] result = new byte[paths.length][];
+    for (int i = 0; i < paths.length; i++) {
+      result[i] = Arrays.copyOfRange(all, i * function.digestLength,
+          (i + 1) * function.digestLength);
+    }
+    return result;
+  }
+
+  private static native byte[] digestBatchNative(String[] paths, int function)
+      throws IOException;
+
+  /**
+   * Computes the digests of all the regular files below a directory, such as a tree artifact,
+   * with a single native call, reading them on a few native threads. Symbolic links to files are
+   * followed. The digests are cached by the inode, size, mtime and ctime of the files, so the files
+   * that did not change since a previous call are not read again.
+   *
+   * @param path the directory.
+   * @param function the digest function to use.
+   * @return the digest of each file by its path relative to {@code path}, sorted by path.
+   * @throws IOException if the directory could not be read, or if it contains special files or
+   *     symbolic links to directories.
+   */
+  public static SortedMap<String, byte[]> digestTree(String path, DigestFunction function)
+      throws IOException {
+    byte[] packed = digestTreeNative(path, function.code);
+    SortedMap<String, byte[]> result = new TreeMap<>();
+    for (int start = 0; start < packed.length; ) {
+      int end = start;
+      while (packed[end] != 0) {
+        end++;
+      }
+      result.put(
+          new String(packed, start, end - start, StandardCharsets.ISO_8859_1),
+          Arrays.copyOfRange(packed, end + 1, end + 1 + function.digestLength));
+      start = end + 1 + function.digestLength;
+    }
+    return result;
+  }
+
+  private static native byte[] digestTreeNative(String path, int function) throws IOException;
+
+  /**
+   * Reads the extended attribute {@code name}, such as a digest precomputed by the file system,
+   * of many files with a single native call, spreading large batches over a few native threads.
+   *
+   * @param paths the files whose extended attribute is to be returned.
+   * @param name the name of the extended attribute key.
+   * @param valueLength the length of the values; values of other lengths are treated as
+   *   missing.
+   * @param followSymlinks whether to read the attribute of targets of symlinks (like getxattr)
+   *   rather of the symlinks themselves (like lgetxattr).
+   * @param fallback if not null, the digest function to compute natively for files that do not
+   *   have the attribute; its digests must be {@code valueLength} bytes long.
+   * @return the value for each path, in the order of {@code paths}, or null where the attribute
+   *   is missing and could not be computed by {@code fallback}.
+   */
+  public static byte[][] getxattrBatch(String[] paths, String name, int valueLength,
+      boolean followSymlinks, @Nullable DigestFunction fallback) {
+    if (fallback != null && fallback.digestLength != valueLength) {
+      throw new IllegalArgumentException(
+          fallback + " digests are not " + valueLength + " bytes long");
+    }
+    byte[] records = getxattrBatchNative(paths, name, valueLength, followSymlinks,
+        fallback == null ? -1 : fallback.code);
+    byte[][] result = new byte[paths.length][];
+    int recordLength = 1 + valueLength;
+    for (int i = 0; i < paths.length; i++) {
+      // The first byte of a record is 0 for a missing value, 1 for a value read from the
+      // attribute and 2 for one computed by the fallback; keep in sync with unix_jni.cc.
+      if (records[i * recordLength] != 0) {
+        result[i] = Arrays.copyOfRange(records, i * recordLength + 1, (i + 1) * recordLength);
+      }
+    }
+    return result;
+  }
+
+  private static native byte[] getxattrBatchNative(String[] paths, String name,
+      int valueLength, boolean followSymlinks, int fallback);
+
+
   /**
    * Removes entire directory tree. Doesn't follow symlinks.
    *
@@ -17,6 +17,8 @@ package com.google.devtools.build.lib.unix;
 import com.google.devtools.build.lib.UnixJniLoader;
 
 import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 
 /**
  * Utility methods for access to UNIX system calls not exposed by the Java
@@ -40,4 +42,124 @@ public class NativePosixSystem {
    * @throws IOException iff the sysctlbyname() syscall failed.
    */
   public static native long sysctlbynameGetLong(String name) throws IOException;
+
+  /**
+   * Samples the load of the machine (CPU use and pressure, available memory and swap) on a
+   * native thread, from /proc on Linux and host_statistics on macOS. Reading the latest sample
+   * takes no syscall or JNI call, so it is cheap enough to do for every scheduling decision.
+   */
+  public static final class LoadSampler implements AutoCloseable {
+    // Slots of the buffer filled by the native thread, as longs; keep in sync with enum LoadSlot
+    // in unix_jni.cc. The sequence is odd while the sampler writes the other slots.
+    private static final int SEQUENCE = 0;
+    private static final int SAMPLES = 1;
+    private static final int CPU_BUSY = 2;
+    private static final int MEMORY_TOTAL = 3;
+    private static final int MEMORY_AVAILABLE = 4;
+    private static final int SWAP_TOTAL = 5;
+    private static final int SWAP_FREE = 6;
+    private static final int CPU_PRESSURE = 7;
+    private static final int MEMORY_PRESSURE = 8;
+    private static final int IO_PRESSURE = 9;
+    private static final int SLOTS = 10;
+
+    private final ByteBuffer slots;
+    private long nativeSampler;
+
+    /** Starts sampling every {@code intervalMillis}. */
+    public LoadSampler(int intervalMillis) {
+      if (intervalMillis <= 0) {
+        throw new IllegalArgumentException("interval must be positive: " + intervalMillis);
+      }
+      slots = ByteBuffer.allocateDirect(SLOTS * 8).order(ByteOrder.nativeOrder());
+      nativeSampler = startLoadSampler(slots, intervalMillis);
+    }
+
+    /** Returns the latest sample. Thread-safe. */
+    public Load get() {
+      long[] values = new long[SLOTS];
+      while (true) {
+        long sequence = slots.getLong(SEQUENCE * 8);
+        if ((sequence & 1) == 0) {
+          for (int i = SEQUENCE + 1; i < SLOTS; i++) {
+            values[i] = slots.getLong(i * 8);
+          }
+          if (slots.getLong(SEQUENCE * 8) == sequence) {
+            return new Load(values);
+          }
+        }
+        Thread.yield();
+      }
+    }
+
+    /** Stops sampling; the last sample can still be read. */
+    @Override
+    public synchronized void close() {
+      if (nativeSampler != 0) {
+        stopLoadSampler(nativeSampler);
+        nativeSampler = 0;
+      }
+    }
+  }
+
+  /**
+   * A sample of {@link LoadSampler}. Values that the platform does not provide are -1.
+   * Percentages are in hundredths of a percent.
+   */
+  public static final class Load {
+    private final long[] values;
+
+    private Load(long[] values) {
+      this.values = values;
+    }
+
+    /** Returns the number of samples taken so far; 0 means there is no data yet. */
+    public long getSamples() {
+      return values[LoadSampler.SAMPLES];
+    }
+
+    /** Returns the share of time all CPUs were busy over the last interval. */
+    public long getCpuBusy() {
+      return values[LoadSampler.CPU_BUSY];
+    }
+
+    public long getMemoryTotalBytes() {
+      return values[LoadSampler.MEMORY_TOTAL];
+    }
+
+    /** Returns the memory that can be used without swapping, including reclaimable caches. */
+    public long getMemoryAvailableBytes() {
+      return values[LoadSampler.MEMORY_AVAILABLE];
+    }
+
+    public long getSwapTotalBytes() {
+      return values[LoadSampler.SWAP_TOTAL];
+    }
+
+    public long getSwapFreeBytes() {
+      return values[LoadSampler.SWAP_FREE];
+    }
+
+    /**
+     * Returns the share of the last 10 seconds in which some tasks waited for a CPU, from Linux
+     * pressure stall information.
+     */
+    public long getCpuPressure() {
+      return values[LoadSampler.CPU_PRESSURE];
+    }
+
+    /** Like {@link #getCpuPressure}, for tasks waiting on memory, e.g. for reclaim or swap. */
+    public long getMemoryPressure() {
+      return values[LoadSampler.MEMORY_PRESSURE];
+    }
+
+    /** Like {@link #getCpuPressure}, for tasks waiting on I/O. */
+    public long getIoPressure() {
+      return values[LoadSampler.IO_PRESSURE];
+    }
+  }
+
+  private static native long startLoadSampler(ByteBuffer slots, int intervalMillis);
+
+  private static native void stopLoadSampler(long sampler);
 }
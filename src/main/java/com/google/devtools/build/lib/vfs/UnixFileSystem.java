@@ -190,9 +190,57 @@ public class UnixFileSystem extends AbstractFileSystemWithCustomStat {
     }
   }
 
+  // Per-thread buffers for the existence, type and permission checks below, which only look at
+  // the mode of a file and so need not allocate a FileStatus for every call.
+  private static final ThreadLocal<NativePosixFiles.StatBuffer> statBuffers =
+      new ThreadLocal<NativePosixFiles.StatBuffer>() {
+        @Override
+        protected NativePosixFiles.StatBuffer initialValue() {
+          return new NativePosixFiles.StatBuffer();
+        }
+      };
+
+  /** Returns the st_mode of {@code path}, or -1 if it cannot be stat'ed. */
+  private int statMode(Path path, boolean followSymlinks) {
+    String name = path.getPathString();
+    long startTime = Profiler.nanoTimeMaybe();
+    try {
+      NativePosixFiles.StatBuffer stat = statBuffers.get();
+      return stat.stat(name, followSymlinks, NativePosixFiles.StatBuffer.TYPE) == 0
+          ? stat.getMode()
+          : -1;
+    } finally {
+      profiler.logSimpleTask(startTime, ProfilerTask.VFS_STAT, name);
+    }
+  }
+
   @Override
   protected boolean exists(Path path, boolean followSymlinks) {
-    return statNullable(path, followSymlinks) != null;
+    return statMode(path, followSymlinks) != -1;
+  }
+
+  @Override
+  protected boolean isFile(Path path, boolean followSymlinks) {
+    int mode = statMode(path, followSymlinks);
+    return mode != -1 && com.google.devtools.build.lib.unix.FileStatus.isFile(mode);
+  }
+
+  @Override
+  protected boolean isSpecialFile(Path path, boolean followSymlinks) {
+    int mode = statMode(path, followSymlinks);
+    return mode != -1 && com.google.devtools.build.lib.unix.FileStatus.isSpecialFile(mode);
+  }
+
+  @Override
+  protected boolean isSymbolicLink(Path path) {
+    int mode = statMode(path, false);
+    return mode != -1 && com.google.devtools.build.lib.unix.FileStatus.isSymbolicLink(mode);
+  }
+
+  @Override
+  protected boolean isDirectory(Path path, boolean followSymlinks) {
+    int mode = statMode(path, followSymlinks);
+    return mode != -1 && com.google.devtools.build.lib.unix.FileStatus.isDirectory(mode);
   }
 
   /**
@@ -225,19 +273,28 @@ public class UnixFileSystem extends AbstractFileSystemWithCustomStat {
     }
   }
 
+  /** Returns the permission bits of {@code path}, following symlinks. */
+  private int permissions(Path path) throws IOException {
+    int mode = statMode(path, true);
+    // On failure, stat again just to throw the proper exception.
+    return mode != -1
+        ? mode & com.google.devtools.build.lib.unix.FileStatus.S_IRWXA
+        : statInternal(path, true).getPermissions();
+  }
+
   @Override
   protected boolean isReadable(Path path) throws IOException {
-    return (statInternal(path, true).getPermissions() & 0400) != 0;
+    return (permissions(path) & 0400) != 0;
   }
 
   @Override
   protected boolean isWritable(Path path) throws IOException {
-    return (statInternal(path, true).getPermissions() & 0200) != 0;
+    return (permissions(path) & 0200) != 0;
   }
 
   @Override
   protected boolean isExecutable(Path path) throws IOException {
-    return (statInternal(path, true).getPermissions() & 0100) != 0;
+    return (permissions(path) & 0100) != 0;
   }
 
   /**
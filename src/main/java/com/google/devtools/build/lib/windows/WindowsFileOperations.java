@@ -15,6 +15,9 @@
 package com.google.devtools.build.lib.windows;
 
 import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.StandardCharsets;
 
 /** File operations on Windows. */
 public class WindowsFileOperations {
@@ -43,4 +46,146 @@ public class WindowsFileOperations {
         throw new IOException(error[0]);
     }
   }
+
+  static native byte[] nativeReadDirectory(
+      String path, boolean readReparseTargets, String[] error);
+
+  /**
+   * The entries of a directory with their attributes, as read by {@link #readDirectory}. Like
+   * {@code Dirents} on Unix, they come from a single buffer filled by native code.
+   */
+  public static final class DirectoryEntries {
+    // Keep the layout in sync with src/main/native/windows_file_operations.cc.
+    private static final int HEADER_SIZE = 48;
+    private static final int FILE_ATTRIBUTE_DIRECTORY = 0x10;
+    private static final int FILE_ATTRIBUTE_REPARSE_POINT = 0x400;
+    private static final int IO_REPARSE_TAG_MOUNT_POINT = 0xA0000003;
+    private static final int IO_REPARSE_TAG_SYMLINK = 0xA000000C;
+
+    private final ByteBuffer buffer;
+    private final int[] offsets;
+
+    private DirectoryEntries(byte[] packed) {
+      buffer = ByteBuffer.wrap(packed).order(ByteOrder.nativeOrder());
+      int count = 0;
+      for (int offset = 0; offset < packed.length; count++) {
+        offset += entrySize(offset);
+      }
+      offsets = new int[count];
+      for (int i = 0, offset = 0; i < count; i++) {
+        offsets[i] = offset;
+        offset += entrySize(offset);
+      }
+    }
+
+    private int entrySize(int offset) {
+      return HEADER_SIZE + 2 * (buffer.getInt(offset + 4) + buffer.getInt(offset + 44));
+    }
+
+    /** Returns the number of entries, without "." and "..". */
+    public int size() {
+      return offsets.length;
+    }
+
+    /** Returns the name of the {@code i}th entry. */
+    public String getName(int i) {
+      int nameLength = buffer.getInt(offsets[i] + 4);
+      return new String(
+          buffer.array(), offsets[i] + HEADER_SIZE, 2 * nameLength, StandardCharsets.UTF_16LE);
+    }
+
+    /** Returns the {@code FILE_ATTRIBUTE_*} flags of the {@code i}th entry. */
+    public int getAttributes(int i) {
+      return buffer.getInt(offsets[i]);
+    }
+
+    /** Returns whether the {@code i}th entry is a directory, or a junction to one. */
+    public boolean isDirectory(int i) {
+      return (getAttributes(i) & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    }
+
+    /** Returns whether the {@code i}th entry is a junction or symlink. */
+    public boolean isReparsePoint(int i) {
+      return (getAttributes(i) & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+    }
+
+    /**
+     * Returns whether the {@code i}th entry is a junction or a directory symlink, like {@link
+     * #isJunction}.
+     */
+    public boolean isJunction(int i) {
+      return isDirectory(i) && isReparsePoint(i);
+    }
+
+    /** Returns whether the {@code i}th entry is a symlink, to a file or a directory. */
+    public boolean isSymlink(int i) {
+      return isReparsePoint(i) && getReparseTag(i) == IO_REPARSE_TAG_SYMLINK;
+    }
+
+    /** Returns the {@code IO_REPARSE_TAG_*} of the {@code i}th entry, or 0 if it has none. */
+    public int getReparseTag(int i) {
+      return buffer.getInt(offsets[i] + 40);
+    }
+
+    /**
+     * Returns the target of the {@code i}th entry if it is a junction or symlink, as it was
+     * created, or null if it isn't one or its target was not read.
+     */
+    public String getReparseTarget(int i) {
+      int targetLength = buffer.getInt(offsets[i] + 44);
+      if (targetLength == 0) {
+        return null;
+      }
+      int nameLength = buffer.getInt(offsets[i] + 4);
+      return new String(
+          buffer.array(),
+          offsets[i] + HEADER_SIZE + 2 * nameLength,
+          2 * targetLength,
+          StandardCharsets.UTF_16LE);
+    }
+
+    /** Returns the size of the {@code i}th entry in bytes. */
+    public long getSize(int i) {
+      return buffer.getLong(offsets[i] + 8);
+    }
+
+    /** Returns the creation time of the {@code i}th entry in milliseconds since the epoch. */
+    public long getCreationTimeMillis(int i) {
+      return buffer.getLong(offsets[i] + 16);
+    }
+
+    /** Returns the last access time of the {@code i}th entry in milliseconds since the epoch. */
+    public long getLastAccessTimeMillis(int i) {
+      return buffer.getLong(offsets[i] + 24);
+    }
+
+    /** Returns the last write time of the {@code i}th entry in milliseconds since the epoch. */
+    public long getLastWriteTimeMillis(int i) {
+      return buffer.getLong(offsets[i] + 32);
+    }
+  }
+
+  /**
+   * Lists the directory `path` with FindFirstFileExW, which returns the attributes, size and
+   * times of the entries along with their names, so they need not be stat'ed one by one.
+   */
+  public static DirectoryEntries readDirectory(String path) throws IOException {
+    return readDirectory(path, false);
+  }
+
+  /**
+   * Like {@link #readDirectory(String)}, and also reads the targets of the junctions and symlinks
+   * in the directory if {@code readReparseTargets}, saving a call of {@link #isJunction} and of
+   * {@code readSymbolicLink} per entry in tree walks.
+   */
+  public static DirectoryEntries readDirectory(String path, boolean readReparseTargets)
+      throws IOException {
+    WindowsJniLoader.loadJni();
+    String[] error = new String[] {null};
+    byte[] packed = nativeReadDirectory(path, readReparseTargets, error);
+    if (packed == null) {
+      throw new IOException(error[0]);
+    }
+    return new DirectoryEntries(packed);
+  }
 }
@@ -68,7 +68,8 @@ public class WindowsProcesses {
    * Reads data from the stream into the given array. {@code stream} should come from {@link
    * #nativeGetStdout(long)} or {@link #nativeGetStderr(long)}.
    *
-   * <p>Blocks until either some data was read or the process is terminated.
+   * <p>Blocks until either some data was read or the process is terminated. Reads at most 64 KB
+   * at a time.
    *
    * @return the number of bytes read, 0 on EOF, or -1 if there was an error.
    */
@@ -85,6 +86,23 @@ public class WindowsProcesses {
    */
   static native int nativeWaitFor(long process, long timeout);
 
+  /** Notified by {@link #nativeNotifyOnExit} once the process exits or times out. */
+  interface ExitCallback {
+    /**
+     * Called on a thread of the Windows thread pool, with 0 if the process finished, or 1 if it
+     * timed out and was terminated along with its job. Must not delete the process.
+     */
+    void processExited(int waitResult);
+  }
+
+  /**
+   * Like {@link #nativeWaitFor}, but without blocking a thread: calls {@code callback} once the
+   * given process terminates, or after {@code timeout} milliseconds if that is non-negative.
+   *
+   * @return whether the callback could be registered
+   */
+  static native boolean nativeNotifyOnExit(long process, long timeout, ExitCallback callback);
+
   /**
    * Returns the exit code of the process. Throws {@code IllegalStateException} if something
    * goes wrong.
@@ -101,6 +119,37 @@ public class WindowsProcesses {
    */
   static native boolean nativeTerminate(long process);
 
+  // Indices of the results of nativeGetResourceUsage; keep in sync with windows_processes.cc.
+  public static final int USAGE_USER_TIME_MILLIS = 0;
+  public static final int USAGE_KERNEL_TIME_MILLIS = 1;
+  public static final int USAGE_READ_BYTES = 2;
+  public static final int USAGE_WRITE_BYTES = 3;
+  public static final int USAGE_READ_OPERATIONS = 4;
+  public static final int USAGE_WRITE_OPERATIONS = 5;
+  public static final int USAGE_PEAK_MEMORY_BYTES = 6;
+  public static final int USAGE_TOTAL_PROCESSES = 7;
+  public static final int USAGE_COUNT = 8;
+
+  /**
+   * Stores the resources used so far by the given process and its descendants, as accounted by its
+   * job object, in {@code usage}, indexed by the {@code USAGE_*} constants. It has to be called
+   * before {@link #nativeDeleteProcess(long)}.
+   *
+   * @return whether that succeeded; it fails if the process could not get a job object of its
+   *     own, which is the case for a Bazel in a job itself on Windows 7
+   */
+  static native boolean nativeGetResourceUsage(long process, long[] usage);
+
+  /**
+   * Limits the given process and its descendants to {@code cpuRatePercent} percent of the CPU
+   * time of all processors and {@code memoryLimitBytes} bytes of committed memory in total. A
+   * limit of 0 means none; allocations past the memory limit fail. CPU rate limits need Windows 8.
+   *
+   * @return whether the limits could be set
+   */
+  static native boolean nativeSetResourceLimits(
+      long process, int cpuRatePercent, long memoryLimitBytes);
+
   /**
    * Releases the native data structures associated with the process.
    *
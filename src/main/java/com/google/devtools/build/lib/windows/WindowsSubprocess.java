@@ -142,25 +142,47 @@ public class WindowsSubprocess implements Subprocess {
             : new ProcessInputStream(WindowsProcesses.nativeGetStderr(nativeProcess));
     stdinStream = new ProcessOutputStream();
     waitLatch = new CountDownLatch(1);
-    // Every Windows process we start consumes a thread here. This is suboptimal, but seems to be
-    // the sanest way to reconcile WaitForMultipleObjects() and Java-style interruption.
-    WAITER_POOL.submit(new Runnable() {
-        @Override public void run() {
-          waiterThreadFunc();
-        }
-    });
+    // The thread pool of Windows waits for the process, and calls us back when it exits. Only if
+    // that fails does a thread of ours block until it does.
+    boolean notified =
+        WindowsProcesses.nativeNotifyOnExit(
+            nativeProcess,
+            timeoutMillis,
+            new WindowsProcesses.ExitCallback() {
+              @Override
+              public void processExited(int waitResult) {
+                WindowsSubprocess.this.processExited(waitResult);
+              }
+            });
+    if (!notified) {
+      // Clears the error of the registration, which the waiter thread makes up for.
+      WindowsProcesses.nativeProcessGetLastError(nativeProcess);
+      WAITER_POOL.submit(new Runnable() {
+          @Override public void run() {
+            waiterThreadFunc();
+          }
+      });
+    }
   }
 
   private void waiterThreadFunc() {
-    switch (WindowsProcesses.nativeWaitFor(nativeProcess, timeoutMillis)) {
+    int waitResult = WindowsProcesses.nativeWaitFor(nativeProcess, timeoutMillis);
+    if (waitResult == 1) {
+      // Timeout. Terminate the process if we can.
+      WindowsProcesses.nativeTerminate(nativeProcess);
+    }
+    processExited(waitResult);
+  }
+
+  private void processExited(int waitResult) {
+    switch (waitResult) {
       case 0:
         // Excellent, process finished in time.
         break;
 
       case 1:
-        // Timeout. Terminate the process if we can.
+        // Timeout; the process was terminated.
         timedout.set(true);
-        WindowsProcesses.nativeTerminate(nativeProcess);
         break;
 
       case 2:
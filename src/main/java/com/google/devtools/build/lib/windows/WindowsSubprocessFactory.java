@@ -15,6 +15,9 @@
 package com.google.devtools.build.lib.windows;
 
 import com.google.common.base.Charsets;
+import com.google.common.cache.Cache;
+import com.google.common.cache.CacheBuilder;
+import com.google.common.collect.ImmutableMap;
 import com.google.devtools.build.lib.shell.Subprocess;
 import com.google.devtools.build.lib.shell.SubprocessBuilder;
 import com.google.devtools.build.lib.shell.SubprocessBuilder.StreamAction;
@@ -30,6 +33,14 @@ import java.util.TreeMap;
 public class WindowsSubprocessFactory implements Subprocess.Factory {
   public static final WindowsSubprocessFactory INSTANCE = new WindowsSubprocessFactory();
 
+  /**
+   * The environment blocks of the environments processes were recently created with. Actions
+   * share a handful of environments, so most spawns reuse a block instead of sorting and encoding
+   * their environment again. Native code doesn't modify the blocks.
+   */
+  private final Cache<ImmutableMap<String, String>, byte[]> envBlocks =
+      CacheBuilder.newBuilder().maximumSize(64).build();
+
   private WindowsSubprocessFactory() {
     // Singleton
   }
@@ -39,7 +50,7 @@ public class WindowsSubprocessFactory implements Subprocess.Factory {
     WindowsJniLoader.loadJni();
 
     String commandLine = WindowsProcesses.quoteCommandLine(builder.getArgv());
-    byte[] env = builder.getEnv() == null ? null : convertEnvToNative(builder.getEnv());
+    byte[] env = builder.getEnv() == null ? null : getEnvBlock(builder.getEnv());
 
     String stdoutPath = getRedirectPath(builder.getStdout(), builder.getStdoutFile());
     String stderrPath = getRedirectPath(builder.getStderr(), builder.getStderrFile());
@@ -84,6 +95,17 @@ public class WindowsSubprocessFactory implements Subprocess.Factory {
     return null;
   }
 
+  /** Returns the environment block of {@code env}, from {@link #envBlocks} if it is there. */
+  private byte[] getEnvBlock(Map<String, String> env) throws IOException {
+    ImmutableMap<String, String> key = ImmutableMap.copyOf(env);
+    byte[] block = envBlocks.getIfPresent(key);
+    if (block == null) {
+      block = convertEnvToNative(key);
+      envBlocks.put(key, block);
+    }
+    return block;
+  }
+
   /**
    * Converts an environment map to the format expected in lpEnvironment by CreateProcess().
    */
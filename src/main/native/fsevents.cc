@@ -15,8 +15,8 @@
 #include <jni.h>
 #include <pthread.h>
 #include <stdlib.h>
-#include <list>
 #include <string>
+#include <unordered_set>
 
 // A structure to pass around the FSEvents info and the list of paths.
 struct JNIEventsDiffAwareness {
@@ -24,8 +24,10 @@ struct JNIEventsDiffAwareness {
   CFRunLoopRef runLoop;
   // FSEvents stream reference (reference to the listened stream)
   FSEventStreamRef stream;
-  // List of paths that have been changed since last polling
-  std::list<std::string> paths;
+  // Set of paths that have been changed since last polling
+  std::unordered_set<std::string> paths;
+  // Whether events were lost since last polling, so that paths is incomplete.
+  bool eventsDropped;
   // Mutex to protect concurrent access of paths.
   // FsEventsDiffAwarenessCallback fill that list which is emptied
   // by the MacOSXEventsDiffAwareness#poll() method.
@@ -54,7 +56,14 @@ void FsEventsDiffAwarenessCallback(ConstFSEventStreamRef streamRef,
       static_cast<JNIEventsDiffAwareness *>(clientCallBackInfo);
   pthread_mutex_lock(&(info->mutex));
   for (int i = 0; i < numEvents; i++) {
-    info->paths.push_back(std::string(paths[i]));
+    // The kernel or fseventsd could not keep up and coalesced the events
+    // below paths[i] into this one, or dropped them altogether.
+    if (eventFlags[i] & (kFSEventStreamEventFlagMustScanSubDirs |
+                         kFSEventStreamEventFlagUserDropped |
+                         kFSEventStreamEventFlagKernelDropped)) {
+      info->eventsDropped = true;
+    }
+    info->paths.insert(paths[i]);
   }
   pthread_mutex_unlock(&(info->mutex));
 }
@@ -65,6 +74,8 @@ Java_com_google_devtools_build_lib_skyframe_MacOSXFsEventsDiffAwareness_create(
     jdouble latency) {
   // Create a FSEventStreamContext to pass around (env, fsEventsDiffAwareness)
   JNIEventsDiffAwareness *info = new JNIEventsDiffAwareness;
+  info->eventsDropped = false;
+  pthread_mutex_init(&(info->mutex), NULL);
 
   FSEventStreamContext context;
   context.version = 0;
@@ -83,18 +94,27 @@ Java_com_google_devtools_build_lib_skyframe_MacOSXFsEventsDiffAwareness_create(
         CFStringCreateWithCString(NULL, pathCStr, kCFStringEncodingUTF8);
     env->ReleaseStringUTFChars(path, pathCStr);
   }
-  CFArrayRef pathsToWatch =
-      CFArrayCreate(NULL, (const void **)pathsArray, 1, NULL);
+  CFArrayRef pathsToWatch = CFArrayCreate(NULL, (const void **)pathsArray,
+                                          length, &kCFTypeArrayCallBacks);
+  for (int i = 0; i < length; i++) {
+    CFRelease(pathsArray[i]);
+  }
   delete[] pathsArray;
   info->stream = FSEventStreamCreate(
       NULL, &FsEventsDiffAwarenessCallback, &context, pathsToWatch,
       kFSEventStreamEventIdSinceNow, static_cast<CFAbsoluteTime>(latency),
       kFSEventStreamCreateFlagFileEvents);
+  CFRelease(pathsToWatch);
+  if (info->stream == NULL) {
+    // E.g. fseventsd is not running; the caller falls back to kqueue.
+    pthread_mutex_destroy(&(info->mutex));
+    delete info;
+    env->ThrowNew(env->FindClass("java/io/IOException"),
+                  "FSEventStreamCreate failed");
+    return;
+  }
 
   // Save the info pointer to FSEventsDiffAwareness#nativePointer
-  jbyteArray array = env->NewByteArray(sizeof(info));
-  env->SetByteArrayRegion(array, 0, sizeof(info),
-                          reinterpret_cast<const jbyte *>(&info));
   jclass clazz = env->GetObjectClass(fsEventsDiffAwareness);
   jfieldID fid = env->GetFieldID(clazz, "nativePointer", "J");
   env->SetLongField(fsEventsDiffAwareness, fid, reinterpret_cast<jlong>(info));
@@ -118,21 +138,37 @@ Java_com_google_devtools_build_lib_skyframe_MacOSXFsEventsDiffAwareness_run(
   CFRunLoopRun();
 }
 
-extern "C" JNIEXPORT jobjectArray JNICALL
+// Returns the paths changed since the last call, in UTF-8 and each followed
+// by a NUL byte, or NULL if events were dropped since the last call.
+extern "C" JNIEXPORT jbyteArray JNICALL
 Java_com_google_devtools_build_lib_skyframe_MacOSXFsEventsDiffAwareness_poll(
     JNIEnv *env, jobject fsEventsDiffAwareness) {
   JNIEventsDiffAwareness *info = GetInfo(env, fsEventsDiffAwareness);
+  std::unordered_set<std::string> paths;
+  bool eventsDropped;
   pthread_mutex_lock(&(info->mutex));
+  paths.swap(info->paths);
+  eventsDropped = info->eventsDropped;
+  info->eventsDropped = false;
+  pthread_mutex_unlock(&(info->mutex));
+  if (eventsDropped) {
+    return NULL;
+  }
 
-  jclass classString = env->FindClass("java/lang/String");
-  jobjectArray result =
-      env->NewObjectArray(info->paths.size(), classString, NULL);
-  int i = 0;
-  for (auto it = info->paths.begin(); it != info->paths.end(); it++, i++) {
-    env->SetObjectArrayElement(result, i, env->NewStringUTF(it->c_str()));
+  size_t size = 0;
+  for (const std::string &path : paths) {
+    size += path.size() + 1;
+  }
+  std::string packed;
+  packed.reserve(size);
+  for (const std::string &path : paths) {
+    packed.append(path.c_str(), path.size() + 1);
+  }
+  jbyteArray result = env->NewByteArray(size);
+  if (result != NULL) {
+    env->SetByteArrayRegion(result, 0, size,
+                            reinterpret_cast<const jbyte *>(packed.data()));
   }
-  info->paths.clear();
-  pthread_mutex_unlock(&(info->mutex));
   return result;
 }
 
@@ -146,5 +182,6 @@ Java_com_google_devtools_build_lib_skyframe_MacOSXFsEventsDiffAwareness_doClose(
                                      kCFRunLoopDefaultMode);
   FSEventStreamInvalidate(info->stream);
   FSEventStreamRelease(info->stream);
+  pthread_mutex_destroy(&(info->mutex));
   delete info;
 }
@@ -0,0 +1,507 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The Linux counterpart of fsevents.cc: reports the paths that changed under
+// a directory, for LinuxFsNotifyDiffAwareness.
+//
+// If the process may use fanotify with FAN_REPORT_DFID_NAME (Linux 5.9 and
+// CAP_SYS_ADMIN), a single mark on the whole filesystem reports every change,
+// however deep. Otherwise, every directory of the tree gets an inotify watch.
+// Either way, if the kernel drops events, poll() returns null and the caller
+// has to check every file.
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <jni.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/fanotify.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "unix_jni.h"
+
+// Older C libraries lack the constants for reporting the names of the changed
+// entries.
+#if defined(FAN_REPORT_DFID_NAME)
+#define HAVE_FANOTIFY_FID 1
+#endif
+
+static const uint32_t kInotifyMask =
+    IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM |
+    IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW |
+    IN_EXCL_UNLINK;
+
+// The state of one watched tree.
+struct JNIFsNotifyDiffAwareness {
+  // The watched directory, without a trailing slash.
+  std::string root;
+  // The fanotify descriptor if fanotify is true, or else the inotify one.
+  int fd;
+  bool fanotify;
+  // A descriptor of the root, to resolve the file handles of fanotify.
+  int mount_fd;
+  // Written to by doClose to wake up run().
+  int wake_pipe[2];
+  // The directory each inotify watch is for. Only used by create and run.
+  std::unordered_map<int, std::string> watches;
+  int root_wd;
+
+  // The fields below are protected by mutex, taken by run() to add paths and
+  // by poll() to take them.
+  pthread_mutex_t mutex;
+  // The paths that have been changed since the last poll.
+  std::unordered_set<std::string> paths;
+  // Whether events were lost since the last poll.
+  bool overflow;
+  // Whether doClose was called; run() then frees this structure.
+  bool closing;
+};
+
+static bool IsDirectory(const std::string &path, struct dirent *entry) {
+  if (entry->d_type != DT_UNKNOWN) {
+    return entry->d_type == DT_DIR;
+  }
+  portable_stat_struct statbuf;
+  return portable_lstat(path.c_str(), &statbuf) == 0 &&
+         S_ISDIR(statbuf.st_mode);
+}
+
+// Adds the entries below "dir" to "changed", and if inotify is used, watches
+// "dir" and every directory below it. Returns false if not every directory
+// could be watched; directories that disappear in the meantime are fine.
+static bool WatchTree(JNIFsNotifyDiffAwareness *info, const std::string &dir,
+                      std::vector<std::string> *changed) {
+  if (!info->fanotify) {
+    // Watch first, so that no entry created while we list the directory goes
+    // unnoticed.
+    int wd = inotify_add_watch(info->fd, dir.c_str(), kInotifyMask);
+    if (wd < 0) {
+      return errno == ENOENT || errno == ENOTDIR || errno == EACCES;
+    }
+    info->watches[wd] = dir;
+  }
+  DIR *d = opendir(dir.c_str());
+  if (d == NULL) {
+    return true;
+  }
+  bool ok = true;
+  struct dirent *entry;
+  while (ok && (entry = readdir(d)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+    std::string path = dir + "/" + entry->d_name;
+    if (changed != NULL) {
+      changed->push_back(path);
+    }
+    if (IsDirectory(path, entry)) {
+      ok = WatchTree(info, path, changed);
+    }
+  }
+  closedir(d);
+  return ok;
+}
+
+// Removes the inotify watches of "dir" and of the directories below it.
+static void UnwatchTree(JNIFsNotifyDiffAwareness *info,
+                        const std::string &dir) {
+  for (auto it = info->watches.begin(); it != info->watches.end();) {
+    const std::string &path = it->second;
+    if (path.compare(0, dir.size(), dir) == 0 &&
+        (path.size() == dir.size() || path[dir.size()] == '/')) {
+      inotify_rm_watch(info->fd, it->first);
+      it = info->watches.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// Adds the paths reported by the inotify events in "buf" to "changed".
+// Returns false if events were lost.
+static bool ReadInotifyEvents(JNIFsNotifyDiffAwareness *info, const char *buf,
+                              ssize_t len, std::vector<std::string> *changed) {
+  bool ok = true;
+  for (const char *p = buf; p < buf + len;) {
+    const struct inotify_event *event =
+        reinterpret_cast<const struct inotify_event *>(p);
+    p += sizeof(struct inotify_event) + event->len;
+    if (event->mask & IN_Q_OVERFLOW) {
+      ok = false;
+      continue;
+    }
+    auto it = info->watches.find(event->wd);
+    if (it == info->watches.end()) {
+      // A watch we removed ourselves.
+      continue;
+    }
+    if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+      // The parent directory reports the change; only the root has none.
+      if (event->wd == info->root_wd) {
+        ok = false;
+      }
+      if (event->mask & IN_IGNORED) {
+        info->watches.erase(it);
+      }
+      continue;
+    }
+    std::string path = it->second;
+    if (event->len > 0) {
+      path.append("/").append(event->name);
+    }
+    changed->push_back(path);
+    if (event->mask & IN_ISDIR) {
+      if (event->mask & IN_MOVED_FROM) {
+        UnwatchTree(info, path);
+      } else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+        ok = WatchTree(info, path, changed) && ok;
+      }
+    }
+  }
+  return ok;
+}
+
+#if defined(HAVE_FANOTIFY_FID)
+
+static const uint64_t kFanotifyMask = FAN_CREATE | FAN_DELETE | FAN_MODIFY |
+                                      FAN_ATTRIB | FAN_MOVED_FROM |
+                                      FAN_MOVED_TO | FAN_ONDIR;
+
+// Returns whether a mount point other than "root" itself is below "root",
+// which a filesystem mark would not see into.
+static bool HasMountsBelow(const std::string &root) {
+  FILE *mountinfo = fopen("/proc/self/mountinfo", "r");
+  if (mountinfo == NULL) {
+    return true;
+  }
+  bool found = false;
+  char line[4096];
+  while (!found && fgets(line, sizeof(line), mountinfo) != NULL) {
+    // The mount point is the fifth field, with spaces and such escaped.
+    char mount_point[4096];
+    if (sscanf(line, "%*s %*s %*s %*s %4095s", mount_point) == 1) {
+      found = strncmp(mount_point, root.c_str(), root.size()) == 0 &&
+              mount_point[root.size()] == '/';
+    }
+  }
+  fclose(mountinfo);
+  return found;
+}
+
+// Sets up a filesystem mark for "info->root". Returns false, with errno set,
+// if fanotify cannot be used.
+static bool InitFanotify(JNIFsNotifyDiffAwareness *info) {
+  info->fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME |
+                               FAN_UNLIMITED_QUEUE | FAN_NONBLOCK |
+                               FAN_CLOEXEC,
+                           O_RDONLY | O_CLOEXEC);
+  if (info->fd < 0) {
+    return false;
+  }
+  if (HasMountsBelow(info->root) ||
+      fanotify_mark(info->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+                    kFanotifyMask, AT_FDCWD, info->root.c_str()) < 0) {
+    close(info->fd);
+    return false;
+  }
+  info->mount_fd = open(info->root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (info->mount_fd < 0) {
+    close(info->fd);
+    return false;
+  }
+  info->fanotify = true;
+  return true;
+}
+
+// Stores the path of the directory with the file handle "handle" in "path".
+// Returns false if it no longer exists.
+static bool ResolveHandle(JNIFsNotifyDiffAwareness *info,
+                          struct file_handle *handle, std::string *path) {
+  int fd = open_by_handle_at(info->mount_fd, handle, O_PATH | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  char proc_path[32];
+  snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+  char target[PATH_MAX];
+  ssize_t len = readlink(proc_path, target, sizeof(target));
+  close(fd);
+  if (len < 0 || len == sizeof(target)) {
+    return false;
+  }
+  path->assign(target, len);
+  static const char kDeleted[] = " (deleted)";
+  return path->size() < sizeof(kDeleted) - 1 ||
+         path->compare(path->size() - sizeof(kDeleted) + 1, std::string::npos,
+                       kDeleted) != 0;
+}
+
+// Adds the paths below the root reported by the fanotify events in "buf" to
+// "changed". Returns false if events were lost.
+static bool ReadFanotifyEvents(JNIFsNotifyDiffAwareness *info,
+                               const char *buf, ssize_t len,
+                               std::vector<std::string> *changed) {
+  bool ok = true;
+  const struct fanotify_event_metadata *event =
+      reinterpret_cast<const struct fanotify_event_metadata *>(buf);
+  for (; FAN_EVENT_OK(event, len); event = FAN_EVENT_NEXT(event, len)) {
+    if (event->vers != FANOTIFY_METADATA_VERSION ||
+        (event->mask & FAN_Q_OVERFLOW)) {
+      ok = false;
+      continue;
+    }
+    const char *record = reinterpret_cast<const char *>(event) +
+                         event->metadata_len;
+    const char *end = reinterpret_cast<const char *>(event) + event->event_len;
+    while (record < end) {
+      const struct fanotify_event_info_fid *fid =
+          reinterpret_cast<const struct fanotify_event_info_fid *>(record);
+      record += fid->hdr.len;
+      if (fid->hdr.len == 0) {
+        break;
+      }
+      if (fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME) {
+        continue;
+      }
+      struct file_handle *handle = reinterpret_cast<struct file_handle *>(
+          const_cast<unsigned char *>(fid->handle));
+      const char *name =
+          reinterpret_cast<const char *>(handle->f_handle) +
+          handle->handle_bytes;
+      std::string path;
+      if (!ResolveHandle(info, handle, &path)) {
+        // The directory is gone, which its own parent reports.
+        continue;
+      }
+      if (strcmp(name, ".") != 0) {
+        path.append("/").append(name);
+      }
+      if (path == info->root &&
+          (event->mask & (FAN_DELETE | FAN_MOVED_FROM))) {
+        ok = false;
+      }
+      if (path.compare(0, info->root.size(), info->root) != 0 ||
+          path.size() <= info->root.size() ||
+          path[info->root.size()] != '/') {
+        continue;
+      }
+      changed->push_back(path);
+      // Nothing below a directory moved here from elsewhere is reported.
+      if ((event->mask & FAN_ONDIR) && (event->mask & FAN_MOVED_TO)) {
+        WatchTree(info, path, changed);
+      }
+    }
+  }
+  return ok;
+}
+
+#endif  // HAVE_FANOTIFY_FID
+
+// Frees "info" and the descriptors it holds.
+static void DeleteInfo(JNIFsNotifyDiffAwareness *info) {
+  close(info->fd);
+  if (info->mount_fd >= 0) {
+    close(info->mount_fd);
+  }
+  close(info->wake_pipe[0]);
+  close(info->wake_pipe[1]);
+  pthread_mutex_destroy(&info->mutex);
+  delete info;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_skyframe_LinuxFsNotifyDiffAwareness_create(
+    JNIEnv *env, jobject fsNotifyDiffAwareness, jstring root) {
+  JNIFsNotifyDiffAwareness *info = new JNIFsNotifyDiffAwareness;
+  const char *root_chars = GetStringLatin1Chars(env, root);
+  if (root_chars == NULL) {
+    delete info;
+    return;
+  }
+  info->root = root_chars;
+  ReleaseStringLatin1Chars(root_chars);
+  while (info->root.size() > 1 && info->root[info->root.size() - 1] == '/') {
+    info->root.erase(info->root.size() - 1);
+  }
+  info->fd = -1;
+  info->fanotify = false;
+  info->mount_fd = -1;
+  info->root_wd = -1;
+  info->overflow = false;
+  info->closing = false;
+  if (pipe2(info->wake_pipe, O_CLOEXEC) < 0) {
+    ::PostException(env, errno, "pipe2");
+    delete info;
+    return;
+  }
+  pthread_mutex_init(&info->mutex, NULL);
+
+#if defined(HAVE_FANOTIFY_FID)
+  if (!InitFanotify(info)) {
+    info->fd = -1;
+  }
+#endif
+  if (!info->fanotify) {
+    info->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (info->fd < 0) {
+      ::PostException(env, errno, "inotify_init1");
+      DeleteInfo(info);
+      return;
+    }
+    if (!WatchTree(info, info->root, NULL) || info->watches.empty()) {
+      int error = info->watches.empty() ? errno : ENOSPC;
+      ::PostException(env, error, "inotify_add_watch on tree " + info->root);
+      DeleteInfo(info);
+      return;
+    }
+    for (const auto &watch : info->watches) {
+      if (watch.second == info->root) {
+        info->root_wd = watch.first;
+      }
+    }
+  }
+
+  // Save the info pointer to LinuxFsNotifyDiffAwareness#nativePointer
+  jclass clazz = env->GetObjectClass(fsNotifyDiffAwareness);
+  jfieldID fid = env->GetFieldID(clazz, "nativePointer", "J");
+  env->SetLongField(fsNotifyDiffAwareness, fid, reinterpret_cast<jlong>(info));
+}
+
+static JNIFsNotifyDiffAwareness *GetInfo(JNIEnv *env,
+                                         jobject fsNotifyDiffAwareness) {
+  jclass clazz = env->GetObjectClass(fsNotifyDiffAwareness);
+  jfieldID fid = env->GetFieldID(clazz, "nativePointer", "J");
+  jlong field = env->GetLongField(fsNotifyDiffAwareness, fid);
+  return reinterpret_cast<JNIFsNotifyDiffAwareness *>(field);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_skyframe_LinuxFsNotifyDiffAwareness_run(
+    JNIEnv *env, jobject fsNotifyDiffAwareness) {
+  JNIFsNotifyDiffAwareness *info = GetInfo(env, fsNotifyDiffAwareness);
+  // Large enough for a few hundred events of either kind; the kernel only
+  // returns whole events.
+  std::vector<char> buf(64 * 1024);
+  std::vector<std::string> changed;
+  for (;;) {
+    struct pollfd fds[2];
+    fds[0].fd = info->fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = info->wake_pipe[0];
+    fds[1].events = POLLIN;
+    if (::poll(fds, 2, -1) < 0 && errno != EINTR) {
+      pthread_mutex_lock(&info->mutex);
+      info->overflow = true;
+      pthread_mutex_unlock(&info->mutex);
+      break;
+    }
+    pthread_mutex_lock(&info->mutex);
+    bool closing = info->closing;
+    pthread_mutex_unlock(&info->mutex);
+    if (closing) {
+      break;
+    }
+
+    bool ok = true;
+    ssize_t len;
+    while ((len = read(info->fd, &buf[0], buf.size())) > 0) {
+#if defined(HAVE_FANOTIFY_FID)
+      if (info->fanotify) {
+        ok = ReadFanotifyEvents(info, &buf[0], len, &changed) && ok;
+        continue;
+      }
+#endif
+      ok = ReadInotifyEvents(info, &buf[0], len, &changed) && ok;
+    }
+    if (len < 0 && errno != EAGAIN && errno != EINTR) {
+      ok = false;
+    }
+
+    pthread_mutex_lock(&info->mutex);
+    info->paths.insert(changed.begin(), changed.end());
+    info->overflow = info->overflow || !ok;
+    pthread_mutex_unlock(&info->mutex);
+    changed.clear();
+  }
+
+  // Only a failing poll(2) gets here before doClose; wait for it.
+  pthread_mutex_lock(&info->mutex);
+  while (!info->closing) {
+    pthread_mutex_unlock(&info->mutex);
+    char c;
+    if (read(info->wake_pipe[0], &c, 1) < 0 && errno != EINTR) {
+      return;
+    }
+    pthread_mutex_lock(&info->mutex);
+  }
+  pthread_mutex_unlock(&info->mutex);
+  DeleteInfo(info);
+}
+
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_google_devtools_build_lib_skyframe_LinuxFsNotifyDiffAwareness_poll(
+    JNIEnv *env, jobject fsNotifyDiffAwareness) {
+  JNIFsNotifyDiffAwareness *info = GetInfo(env, fsNotifyDiffAwareness);
+  pthread_mutex_lock(&info->mutex);
+  if (info->overflow) {
+    info->overflow = false;
+    info->paths.clear();
+    pthread_mutex_unlock(&info->mutex);
+    return NULL;
+  }
+
+  jclass classString = env->FindClass("java/lang/String");
+  jobjectArray result =
+      env->NewObjectArray(info->paths.size(), classString, NULL);
+  int i = 0;
+  for (auto it = info->paths.begin(); result != NULL && it != info->paths.end();
+       it++, i++) {
+    jstring path = NewStringLatin1(env, it->c_str());
+    if (path == NULL) {
+      result = NULL;
+      break;
+    }
+    env->SetObjectArrayElement(result, i, path);
+    env->DeleteLocalRef(path);
+  }
+  info->paths.clear();
+  pthread_mutex_unlock(&info->mutex);
+  return result;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_skyframe_LinuxFsNotifyDiffAwareness_doClose(
+    JNIEnv *env, jobject fsNotifyDiffAwareness) {
+  JNIFsNotifyDiffAwareness *info = GetInfo(env, fsNotifyDiffAwareness);
+  // run() frees info once it sees closing, which it cannot before we release
+  // the mutex.
+  pthread_mutex_lock(&info->mutex);
+  info->closing = true;
+  char c = 0;
+  if (write(info->wake_pipe[1], &c, 1) < 0) {
+    // The pipe is empty, so this cannot fail.
+  }
+  pthread_mutex_unlock(&info->mutex);
+}
@@ -0,0 +1,502 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The kqueue counterpart of fsnotify.cc: reports the paths that changed under
+// a directory, for KqueueDiffAwareness on FreeBSD (and on OS X when FSEvents
+// cannot be used).
+//
+// EVFILT_VNODE watches an open descriptor, so every directory and regular file
+// of the tree is kept open. Changes to a directory only say that it changed,
+// so it is listed again and compared with its previous entries. The
+// descriptors are limited to half of RLIMIT_NOFILE, shared by all the trees;
+// past that, poll() returns null as if events had been lost and the caller
+// checks every file.
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <jni.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/event.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "unix_jni.h"
+
+// On OS X, descriptors opened only for events do not keep volumes from being
+// unmounted.
+#if defined(O_EVTONLY)
+static const int kOpenFlags = O_EVTONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC;
+#else
+static const int kOpenFlags = O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC;
+#endif
+
+static const unsigned int kVnodeFlags = NOTE_DELETE | NOTE_WRITE |
+                                        NOTE_EXTEND | NOTE_ATTRIB | NOTE_LINK |
+                                        NOTE_RENAME | NOTE_REVOKE;
+
+// The descriptors open for watches, by all the trees.
+static std::atomic<int> global_watch_fds(0);
+
+// Returns how many descriptors all the trees may keep open.
+static int MaxWatchFds() {
+  static int max_watch_fds = -1;
+  if (max_watch_fds < 0) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur == RLIM_INFINITY) {
+      max_watch_fds = 4096;
+    } else {
+      max_watch_fds = static_cast<int>(limit.rlim_cur / 2);
+    }
+  }
+  return max_watch_fds;
+}
+
+// A watched file or directory.
+struct KqueueNode {
+  std::string path;
+  bool is_dir;
+  // Set as the udata of its kevent, so that events queued before a watch was
+  // removed are not taken for those of a new one with the same descriptor.
+  intptr_t serial;
+  // The names of the entries of a directory when it was last listed.
+  std::unordered_set<std::string> entries;
+};
+
+// The state of one watched tree.
+struct JNIKqueueDiffAwareness {
+  // The watched directory, without a trailing slash.
+  std::string root;
+  int kq;
+  // Written to by doClose to wake up run().
+  int wake_pipe[2];
+  // The watched files and directories by descriptor, and the descriptors by
+  // path. Only used by create and run.
+  std::unordered_map<int, KqueueNode> nodes;
+  std::unordered_map<std::string, int> fds;
+  int root_fd;
+  intptr_t next_serial;
+
+  // The fields below are protected by mutex, taken by run() to add paths and
+  // by poll() to take them.
+  pthread_mutex_t mutex;
+  // The paths that have been changed since the last poll.
+  std::unordered_set<std::string> paths;
+  // Whether events were lost since the last poll.
+  bool overflow;
+  // Whether doClose was called; run() then frees this structure.
+  bool closing;
+};
+
+// Opens and watches "path", a directory if "is_dir" or else a regular file.
+// Returns its descriptor, or -1 with errno set.
+static int Watch(JNIKqueueDiffAwareness *info, const std::string &path,
+                 bool is_dir) {
+  if (global_watch_fds.fetch_add(1) >= MaxWatchFds()) {
+    global_watch_fds--;
+    errno = EMFILE;
+    return -1;
+  }
+  int fd = open(path.c_str(), kOpenFlags | (is_dir ? O_DIRECTORY : 0));
+  if (fd < 0) {
+    global_watch_fds--;
+    return -1;
+  }
+  intptr_t serial = info->next_serial++;
+  struct kevent change;
+  EV_SET(&change, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, kVnodeFlags, 0,
+         reinterpret_cast<void *>(serial));
+  if (kevent(info->kq, &change, 1, NULL, 0, NULL) < 0) {
+    int error = errno;
+    close(fd);
+    global_watch_fds--;
+    errno = error;
+    return -1;
+  }
+  KqueueNode &node = info->nodes[fd];
+  node.path = path;
+  node.is_dir = is_dir;
+  node.serial = serial;
+  info->fds[path] = fd;
+  return fd;
+}
+
+// Closes the descriptor of a watch, which also removes its kevent.
+static void Unwatch(JNIKqueueDiffAwareness *info, int fd) {
+  auto it = info->nodes.find(fd);
+  if (it == info->nodes.end()) {
+    return;
+  }
+  info->fds.erase(it->second.path);
+  info->nodes.erase(it);
+  close(fd);
+  global_watch_fds--;
+}
+
+// Removes the watches of "dir" and of everything below it.
+static void UnwatchTree(JNIKqueueDiffAwareness *info, const std::string &dir) {
+  std::vector<int> fds;
+  for (const auto &entry : info->fds) {
+    const std::string &path = entry.first;
+    if (path.compare(0, dir.size(), dir) == 0 &&
+        (path.size() == dir.size() || path[dir.size()] == '/')) {
+      fds.push_back(entry.second);
+    }
+  }
+  for (int fd : fds) {
+    Unwatch(info, fd);
+  }
+}
+
+static bool ListDirectory(int dir_fd,
+                          std::unordered_map<std::string, int> *entries);
+
+// Watches "path" and, if it is a directory, everything below it, adding the
+// paths below it to "changed" unless that is NULL. "type" is its DT_* type;
+// symlinks and special files are not watched, their directory reports them.
+// Returns false if not everything could be watched; files that disappear in
+// the meantime are fine.
+static bool WatchTree(JNIKqueueDiffAwareness *info, const std::string &path,
+                      int type, std::vector<std::string> *changed) {
+  if (type != DT_DIR && type != DT_REG) {
+    return true;
+  }
+  bool is_dir = type == DT_DIR;
+  // Watch first, so that no entry created while we list the directory goes
+  // unnoticed.
+  int fd = Watch(info, path, is_dir);
+  if (fd < 0) {
+    return errno == ENOENT || errno == ENOTDIR || errno == ELOOP ||
+           errno == EACCES;
+  }
+  if (!is_dir) {
+    return true;
+  }
+  std::unordered_map<std::string, int> entries;
+  ListDirectory(fd, &entries);
+  bool ok = true;
+  for (const auto &entry : entries) {
+    info->nodes[fd].entries.insert(entry.first);
+    std::string entry_path = path + "/" + entry.first;
+    if (changed != NULL) {
+      changed->push_back(entry_path);
+    }
+    if (ok && info->fds.count(entry_path) == 0) {
+      ok = WatchTree(info, entry_path, entry.second, changed);
+    }
+  }
+  return ok;
+}
+
+// Lists the directory open as "dir_fd" into "entries", mapping the name of
+// each entry to its DT_* type. Returns false if it cannot be read.
+static bool ListDirectory(int dir_fd,
+                          std::unordered_map<std::string, int> *entries) {
+  // fdopendir takes over the descriptor, which has to stay with the watch.
+  int fd = openat(dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  DIR *d = fdopendir(fd);
+  if (d == NULL) {
+    close(fd);
+    return false;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(d)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+    int type = entry->d_type;
+    if (type == DT_UNKNOWN) {
+      struct stat statbuf;
+      if (fstatat(dir_fd, entry->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) == 0) {
+        type = S_ISDIR(statbuf.st_mode)
+                   ? DT_DIR
+                   : S_ISREG(statbuf.st_mode) ? DT_REG : DT_LNK;
+      }
+    }
+    (*entries)[entry->d_name] = type;
+  }
+  closedir(d);
+  return true;
+}
+
+// Compares the directory watched as "fd" with its previous entries, adding
+// the entries that appeared or disappeared to "changed" and watching the new
+// ones. Returns false if not every new entry could be watched.
+static bool RescanDirectory(JNIKqueueDiffAwareness *info, int fd,
+                            std::vector<std::string> *changed) {
+  std::string dir = info->nodes[fd].path;
+  std::unordered_map<std::string, int> entries;
+  if (!ListDirectory(fd, &entries)) {
+    // Deleted, which its parent reports.
+    return true;
+  }
+  bool ok = true;
+  std::unordered_set<std::string> old_entries;
+  old_entries.swap(info->nodes[fd].entries);
+  for (const auto &entry : entries) {
+    std::string path = dir + "/" + entry.first;
+    if (old_entries.erase(entry.first) == 0) {
+      changed->push_back(path);
+      ok = WatchTree(info, path, entry.second, changed) && ok;
+    } else if (info->fds.count(path) == 0) {
+      // Replaced since: the watch of the old one was removed on NOTE_DELETE.
+      changed->push_back(path);
+      ok = WatchTree(info, path, entry.second, changed) && ok;
+    }
+    info->nodes[fd].entries.insert(entry.first);
+  }
+  for (const std::string &name : old_entries) {
+    std::string path = dir + "/" + name;
+    changed->push_back(path);
+    UnwatchTree(info, path);
+  }
+  return ok;
+}
+
+// Adds the paths reported by "event" to "changed". Returns false if the tree
+// can no longer be watched as a whole.
+static bool HandleEvent(JNIKqueueDiffAwareness *info,
+                        const struct kevent &event,
+                        std::vector<std::string> *changed) {
+  int fd = static_cast<int>(event.ident);
+  auto it = info->nodes.find(fd);
+  if (it == info->nodes.end() ||
+      reinterpret_cast<intptr_t>(event.udata) != it->second.serial) {
+    // A watch we removed ourselves.
+    return true;
+  }
+  if (event.flags & EV_ERROR) {
+    return false;
+  }
+  const KqueueNode &node = it->second;
+  if (event.fflags & (NOTE_DELETE | NOTE_RENAME | NOTE_REVOKE)) {
+    // The parent directory reports the change; only the root has none.
+    if (fd == info->root_fd) {
+      return false;
+    }
+    changed->push_back(node.path);
+    if (node.is_dir) {
+      UnwatchTree(info, node.path);
+    } else {
+      Unwatch(info, fd);
+    }
+    return true;
+  }
+  if (fd != info->root_fd &&
+      (event.fflags & (NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB))) {
+    changed->push_back(node.path);
+  }
+  if (node.is_dir && (event.fflags & (NOTE_WRITE | NOTE_LINK))) {
+    return RescanDirectory(info, fd, changed);
+  }
+  return true;
+}
+
+// Frees "info" and the descriptors it holds.
+static void DeleteInfo(JNIKqueueDiffAwareness *info) {
+  for (const auto &node : info->nodes) {
+    close(node.first);
+  }
+  global_watch_fds -= static_cast<int>(info->nodes.size());
+  close(info->kq);
+  close(info->wake_pipe[0]);
+  close(info->wake_pipe[1]);
+  pthread_mutex_destroy(&info->mutex);
+  delete info;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_skyframe_KqueueDiffAwareness_create(
+    JNIEnv *env, jobject kqueueDiffAwareness, jstring root) {
+  JNIKqueueDiffAwareness *info = new JNIKqueueDiffAwareness;
+  const char *root_chars = GetStringLatin1Chars(env, root);
+  if (root_chars == NULL) {
+    delete info;
+    return;
+  }
+  info->root = root_chars;
+  ReleaseStringLatin1Chars(root_chars);
+  while (info->root.size() > 1 && info->root[info->root.size() - 1] == '/') {
+    info->root.erase(info->root.size() - 1);
+  }
+  info->root_fd = -1;
+  info->next_serial = 0;
+  info->overflow = false;
+  info->closing = false;
+  if (pipe(info->wake_pipe) < 0) {
+    ::PostException(env, errno, "pipe");
+    delete info;
+    return;
+  }
+  fcntl(info->wake_pipe[0], F_SETFD, FD_CLOEXEC);
+  fcntl(info->wake_pipe[1], F_SETFD, FD_CLOEXEC);
+  pthread_mutex_init(&info->mutex, NULL);
+
+  info->kq = kqueue();
+  if (info->kq < 0) {
+    ::PostException(env, errno, "kqueue");
+    close(info->wake_pipe[0]);
+    close(info->wake_pipe[1]);
+    pthread_mutex_destroy(&info->mutex);
+    delete info;
+    return;
+  }
+  fcntl(info->kq, F_SETFD, FD_CLOEXEC);
+  struct kevent change;
+  EV_SET(&change, info->wake_pipe[0], EVFILT_READ, EV_ADD, 0, 0, NULL);
+  if (kevent(info->kq, &change, 1, NULL, 0, NULL) < 0) {
+    ::PostException(env, errno, "kevent");
+    DeleteInfo(info);
+    return;
+  }
+
+  if (!WatchTree(info, info->root, DT_DIR, NULL) || info->nodes.empty()) {
+    int error = info->nodes.empty() ? errno : EMFILE;
+    ::PostException(env, error, "kevent on tree " + info->root);
+    DeleteInfo(info);
+    return;
+  }
+  info->root_fd = info->fds[info->root];
+
+  // Save the info pointer to KqueueDiffAwareness#nativePointer
+  jclass clazz = env->GetObjectClass(kqueueDiffAwareness);
+  jfieldID fid = env->GetFieldID(clazz, "nativePointer", "J");
+  env->SetLongField(kqueueDiffAwareness, fid, reinterpret_cast<jlong>(info));
+}
+
+static JNIKqueueDiffAwareness *GetInfo(JNIEnv *env,
+                                       jobject kqueueDiffAwareness) {
+  jclass clazz = env->GetObjectClass(kqueueDiffAwareness);
+  jfieldID fid = env->GetFieldID(clazz, "nativePointer", "J");
+  jlong field = env->GetLongField(kqueueDiffAwareness, fid);
+  return reinterpret_cast<JNIKqueueDiffAwareness *>(field);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_skyframe_KqueueDiffAwareness_run(
+    JNIEnv *env, jobject kqueueDiffAwareness) {
+  JNIKqueueDiffAwareness *info = GetInfo(env, kqueueDiffAwareness);
+  static const int kMaxEvents = 256;
+  struct kevent events[kMaxEvents];
+  const struct timespec no_wait = {0, 0};
+  std::vector<std::string> changed;
+  for (;;) {
+    // Block for the first events, then take what else is queued.
+    int count = kevent(info->kq, NULL, 0, events, kMaxEvents, NULL);
+    if (count < 0 && errno != EINTR) {
+      pthread_mutex_lock(&info->mutex);
+      info->overflow = true;
+      pthread_mutex_unlock(&info->mutex);
+      break;
+    }
+    pthread_mutex_lock(&info->mutex);
+    bool closing = info->closing;
+    pthread_mutex_unlock(&info->mutex);
+    if (closing) {
+      break;
+    }
+
+    bool ok = true;
+    while (count > 0) {
+      for (int i = 0; i < count; i++) {
+        if (events[i].filter == EVFILT_VNODE) {
+          ok = HandleEvent(info, events[i], &changed) && ok;
+        }
+      }
+      if (count < kMaxEvents) {
+        break;
+      }
+      count = kevent(info->kq, NULL, 0, events, kMaxEvents, &no_wait);
+    }
+
+    pthread_mutex_lock(&info->mutex);
+    info->paths.insert(changed.begin(), changed.end());
+    info->overflow = info->overflow || !ok;
+    pthread_mutex_unlock(&info->mutex);
+    changed.clear();
+  }
+
+  // Only a failing kevent(2) gets here before doClose; wait for it.
+  pthread_mutex_lock(&info->mutex);
+  while (!info->closing) {
+    pthread_mutex_unlock(&info->mutex);
+    char c;
+    if (read(info->wake_pipe[0], &c, 1) < 0 && errno != EINTR) {
+      return;
+    }
+    pthread_mutex_lock(&info->mutex);
+  }
+  pthread_mutex_unlock(&info->mutex);
+  DeleteInfo(info);
+}
+
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_google_devtools_build_lib_skyframe_KqueueDiffAwareness_poll(
+    JNIEnv *env, jobject kqueueDiffAwareness) {
+  JNIKqueueDiffAwareness *info = GetInfo(env, kqueueDiffAwareness);
+  pthread_mutex_lock(&info->mutex);
+  if (info->overflow) {
+    info->overflow = false;
+    info->paths.clear();
+    pthread_mutex_unlock(&info->mutex);
+    return NULL;
+  }
+
+  jclass classString = env->FindClass("java/lang/String");
+  jobjectArray result =
+      env->NewObjectArray(info->paths.size(), classString, NULL);
+  int i = 0;
+  for (auto it = info->paths.begin(); result != NULL && it != info->paths.end();
+       it++, i++) {
+    jstring path = NewStringLatin1(env, it->c_str());
+    if (path == NULL) {
+      result = NULL;
+      break;
+    }
+    env->SetObjectArrayElement(result, i, path);
+    env->DeleteLocalRef(path);
+  }
+  info->paths.clear();
+  pthread_mutex_unlock(&info->mutex);
+  return result;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_skyframe_KqueueDiffAwareness_doClose(
+    JNIEnv *env, jobject kqueueDiffAwareness) {
+  JNIKqueueDiffAwareness *info = GetInfo(env, kqueueDiffAwareness);
+  // run() frees info once it sees closing, which it cannot before we release
+  // the mutex.
+  pthread_mutex_lock(&info->mutex);
+  info->closing = true;
+  char c = 0;
+  if (write(info->wake_pipe[1], &c, 1) < 0) {
+    // The pipe is empty, so this cannot fail.
+  }
+  pthread_mutex_unlock(&info->mutex);
+}
@@ -15,16 +15,25 @@
 #include <jni.h>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <poll.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
 
 #include <string>
+#include <vector>
 
 #include "src/main/native/unix_jni.h"
 
@@ -170,6 +179,177 @@ Java_com_google_devtools_build_lib_unix_LocalSocket_accept(JNIEnv *env,
   SetUnixFileDescriptor(env, fd_cli, cli_sock);
 }
 
+// A set of sockets to wait for, each with a key that identifies it to the
+// caller. It's backed by epoll on Linux and by poll() elsewhere.
+struct LocalSocketSelector {
+#if defined(__linux__)
+  int epoll_fd;
+#else
+  // Protects fds and keys, which selectorWait copies before it blocks so
+  // that sockets may be added and removed in the meantime.
+  pthread_mutex_t mutex;
+  std::vector<pollfd> fds;
+  std::vector<jint> keys;
+#endif
+};
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.LocalSocket
+ * Method:    selectorCreate
+ * Signature: ()J
+ */
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_google_devtools_build_lib_unix_LocalSocket_selectorCreate(
+    JNIEnv *env, jclass clazz) {
+  LocalSocketSelector *selector = new LocalSocketSelector;
+#if defined(__linux__)
+  selector->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (selector->epoll_fd < 0) {
+    ::PostException(env, errno, ::ErrorMessage(errno));
+    delete selector;
+    return 0;
+  }
+#else
+  pthread_mutex_init(&selector->mutex, NULL);
+#endif
+  return reinterpret_cast<jlong>(selector);
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.LocalSocket
+ * Method:    selectorAdd
+ * Signature: (JLjava/io/FileDescriptor;I)V
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_unix_LocalSocket_selectorAdd(
+    JNIEnv *env, jclass clazz, jlong selector_long, jobject fd_obj, jint key) {
+  LocalSocketSelector *selector =
+      reinterpret_cast<LocalSocketSelector *>(selector_long);
+  int fd = GetUnixFileDescriptor(env, fd_obj);
+#if defined(__linux__)
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.u64 = static_cast<uint32_t>(key);
+  if (epoll_ctl(selector->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+    ::PostException(env, errno, ::ErrorMessage(errno));
+  }
+#else
+  pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  pthread_mutex_lock(&selector->mutex);
+  selector->fds.push_back(pfd);
+  selector->keys.push_back(key);
+  pthread_mutex_unlock(&selector->mutex);
+#endif
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.LocalSocket
+ * Method:    selectorRemove
+ * Signature: (JLjava/io/FileDescriptor;)V
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_unix_LocalSocket_selectorRemove(
+    JNIEnv *env, jclass clazz, jlong selector_long, jobject fd_obj) {
+  LocalSocketSelector *selector =
+      reinterpret_cast<LocalSocketSelector *>(selector_long);
+  int fd = GetUnixFileDescriptor(env, fd_obj);
+#if defined(__linux__)
+  if (epoll_ctl(selector->epoll_fd, EPOLL_CTL_DEL, fd, NULL) < 0) {
+    ::PostException(env, errno, ::ErrorMessage(errno));
+  }
+#else
+  pthread_mutex_lock(&selector->mutex);
+  for (size_t i = 0; i < selector->fds.size(); ++i) {
+    if (selector->fds[i].fd == fd) {
+      selector->fds.erase(selector->fds.begin() + i);
+      selector->keys.erase(selector->keys.begin() + i);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&selector->mutex);
+#endif
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.LocalSocket
+ * Method:    selectorWait
+ * Signature: (J[IJ)I
+ *
+ * Waits up to timeoutMillis (forever if negative) for sockets to become
+ * readable, or to be hung up, and stores the keys of up to
+ * ready_keys.length of them in ready_keys. Returns how many it stored, which
+ * is 0 on timeout or if interrupted by a signal.
+ */
+extern "C" JNIEXPORT jint JNICALL
+Java_com_google_devtools_build_lib_unix_LocalSocket_selectorWait(
+    JNIEnv *env, jclass clazz, jlong selector_long, jintArray ready_keys,
+    jlong timeoutMillis) {
+  LocalSocketSelector *selector =
+      reinterpret_cast<LocalSocketSelector *>(selector_long);
+  jsize max_ready = env->GetArrayLength(ready_keys);
+  if (max_ready == 0) {
+    return 0;
+  }
+  int timeout = -1;
+  if (timeoutMillis >= 0) {
+    timeout = timeoutMillis > INT32_MAX ? INT32_MAX
+                                        : static_cast<int>(timeoutMillis);
+  }
+  std::vector<jint> keys;
+#if defined(__linux__)
+  std::vector<struct epoll_event> events(max_ready);
+  int count = epoll_wait(selector->epoll_fd, &events[0], max_ready, timeout);
+  for (int i = 0; i < count; ++i) {
+    keys.push_back(static_cast<jint>(events[i].data.u64));
+  }
+#else
+  pthread_mutex_lock(&selector->mutex);
+  std::vector<pollfd> fds = selector->fds;
+  std::vector<jint> fd_keys = selector->keys;
+  pthread_mutex_unlock(&selector->mutex);
+  int count = poll(fds.empty() ? NULL : &fds[0], fds.size(), timeout);
+  for (size_t i = 0; count > 0 && i < fds.size() &&
+                     keys.size() < static_cast<size_t>(max_ready);
+       ++i) {
+    if (fds[i].revents != 0) {
+      keys.push_back(fd_keys[i]);
+    }
+  }
+#endif
+  if (count < 0) {
+    if (errno != EINTR) {
+      ::PostException(env, errno, ::ErrorMessage(errno));
+    }
+    return 0;
+  }
+  if (!keys.empty()) {
+    env->SetIntArrayRegion(ready_keys, 0, keys.size(), &keys[0]);
+  }
+  return keys.size();
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.LocalSocket
+ * Method:    selectorClose
+ * Signature: (J)V
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_unix_LocalSocket_selectorClose(
+    JNIEnv *env, jclass clazz, jlong selector_long) {
+  LocalSocketSelector *selector =
+      reinterpret_cast<LocalSocketSelector *>(selector_long);
+#if defined(__linux__)
+  close(selector->epoll_fd);
+#else
+  pthread_mutex_destroy(&selector->mutex);
+#endif
+  delete selector;
+}
+
 /*
  * Class:     com.google.devtools.build.lib.unix.LocalSocket
  * Method:    close
@@ -236,6 +416,190 @@ Java_com_google_devtools_build_lib_unix_LocalSocket_shutdown(JNIEnv *env,
   }
 }
 
+// The most file descriptors passed with one message, well below what the
+// kernels allow (SCM_MAX_FD is 253 on Linux).
+static const int kMaxPassedFds = 64;
+
+// Returns the address of the direct ByteBuffer, or posts an exception and
+// returns NULL if it is not a direct one.
+static char *GetDirectBufferAddress(JNIEnv *env, jobject buffer) {
+  void *address = env->GetDirectBufferAddress(buffer);
+  if (address == NULL) {
+    ::PostException(env, EINVAL, "not a direct buffer");
+  }
+  return static_cast<char *>(address);
+}
+
+// Returns the number of file descriptors in "fds", which may be NULL, or
+// posts an exception and returns -1 if there are more than kMaxPassedFds.
+static int GetPassedFdCount(JNIEnv *env, jobjectArray fds) {
+  jsize count = fds == NULL ? 0 : env->GetArrayLength(fds);
+  if (count > kMaxPassedFds) {
+    ::PostException(env, EINVAL, "too many file descriptors");
+    return -1;
+  }
+  return count;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.LocalSocket
+ * Method:    receive
+ * Signature: (Ljava/io/FileDescriptor;Ljava/nio/ByteBuffer;II[Ljava/io/FileDescriptor;)I
+ *
+ * Reads up to "length" bytes into the direct buffer at "position", straight
+ * from the socket. The file descriptors passed with them are stored in the
+ * slots of "fds", which may be NULL; the others are left invalid, and the
+ * kernel closes the ones that do not fit. Returns the number of bytes read,
+ * or -1 at the end of the stream.
+ */
+extern "C" JNIEXPORT jint JNICALL
+Java_com_google_devtools_build_lib_unix_LocalSocket_receive(
+    JNIEnv *env, jclass clazz, jobject fd_obj, jobject buffer,
+    jint position, jint length, jobjectArray fds) {
+  int sock = GetUnixFileDescriptor(env, fd_obj);
+  char *address = GetDirectBufferAddress(env, buffer);
+  int max_fds = GetPassedFdCount(env, fds);
+  if (address == NULL || max_fds < 0) {
+    return -1;
+  }
+  struct iovec iov;
+  iov.iov_base = address + position;
+  iov.iov_len = length;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  // A union, so that the control data is suitably aligned.
+  union {
+    struct cmsghdr header;
+    char data[CMSG_SPACE(kMaxPassedFds * sizeof(int))];
+  } control;
+  if (max_fds > 0) {
+    msg.msg_control = control.data;
+    msg.msg_controllen = CMSG_SPACE(max_fds * sizeof(int));
+  }
+  int flags = 0;
+#if defined(MSG_CMSG_CLOEXEC)
+  flags |= MSG_CMSG_CLOEXEC;
+#endif
+  ssize_t received;
+  do {
+    received = recvmsg(sock, &msg, flags);
+  } while (received < 0 && errno == EINTR);
+  if (received < 0) {
+    ::PostException(env, errno, ::ErrorMessage(errno));
+    return -1;
+  }
+  int stored = 0;
+  for (struct cmsghdr *cmsg = max_fds > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+       cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    const unsigned char *data = CMSG_DATA(cmsg);
+    for (int i = 0; i < count; ++i) {
+      int fd;
+      memcpy(&fd, data + i * sizeof(int), sizeof(int));
+      if (stored == max_fds) {
+        close(fd);
+        continue;
+      }
+#if !defined(MSG_CMSG_CLOEXEC)
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+      jobject slot = env->GetObjectArrayElement(fds, stored++);
+      SetUnixFileDescriptor(env, slot, fd);
+      env->DeleteLocalRef(slot);
+    }
+  }
+  if (received == 0 && length > 0) {
+    return -1;
+  }
+  return received;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.LocalSocket
+ * Method:    send
+ * Signature: (Ljava/io/FileDescriptor;[Ljava/nio/ByteBuffer;[I[I[Ljava/io/FileDescriptor;)J
+ *
+ * Writes the "lengths[i]" bytes at "positions[i]" in the direct buffers, in
+ * order, with a single sendmsg(), and passes the file descriptors in "fds",
+ * which may be NULL, with the first byte. Returns the number of bytes
+ * written, which may be fewer than asked for.
+ */
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_google_devtools_build_lib_unix_LocalSocket_send(
+    JNIEnv *env, jclass clazz, jobject fd_obj, jobjectArray buffers,
+    jintArray positions, jintArray lengths, jobjectArray fds) {
+  int sock = GetUnixFileDescriptor(env, fd_obj);
+  int fd_count = GetPassedFdCount(env, fds);
+  if (fd_count < 0) {
+    return -1;
+  }
+  jsize count = env->GetArrayLength(buffers);
+  // The rest is sent by the next call.
+  if (count > IOV_MAX) {
+    count = IOV_MAX;
+  }
+  std::vector<jint> buffer_positions(count);
+  std::vector<jint> buffer_lengths(count);
+  if (count > 0) {
+    env->GetIntArrayRegion(positions, 0, count, &buffer_positions[0]);
+    env->GetIntArrayRegion(lengths, 0, count, &buffer_lengths[0]);
+  }
+  std::vector<struct iovec> iov(count);
+  for (jsize i = 0; i < count; ++i) {
+    jobject buffer = env->GetObjectArrayElement(buffers, i);
+    char *address = GetDirectBufferAddress(env, buffer);
+    env->DeleteLocalRef(buffer);
+    if (address == NULL) {
+      return -1;
+    }
+    iov[i].iov_base = address + buffer_positions[i];
+    iov[i].iov_len = buffer_lengths[i];
+  }
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov.empty() ? NULL : &iov[0];
+  msg.msg_iovlen = count;
+  union {
+    struct cmsghdr header;
+    char data[CMSG_SPACE(kMaxPassedFds * sizeof(int))];
+  } control;
+  if (fd_count > 0) {
+    memset(&control, 0, sizeof(control));
+    msg.msg_control = control.data;
+    msg.msg_controllen = CMSG_SPACE(fd_count * sizeof(int));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(fd_count * sizeof(int));
+    unsigned char *data = CMSG_DATA(cmsg);
+    for (int i = 0; i < fd_count; ++i) {
+      jobject passed = env->GetObjectArrayElement(fds, i);
+      int fd = GetUnixFileDescriptor(env, passed);
+      env->DeleteLocalRef(passed);
+      memcpy(data + i * sizeof(int), &fd, sizeof(int));
+    }
+  }
+  int flags = 0;
+#if defined(MSG_NOSIGNAL)
+  // Report a closed peer as EPIPE rather than killing the server.
+  flags |= MSG_NOSIGNAL;
+#endif
+  ssize_t sent;
+  do {
+    sent = sendmsg(sock, &msg, flags);
+  } while (sent < 0 && errno == EINTR);
+  if (sent < 0) {
+    ::PostException(env, errno, ::ErrorMessage(errno));
+    return -1;
+  }
+  return sent;
+}
+
 // TODO(bazel-team): These methods were removed in JDK8, so they
 // can be removed when we are no longer using JDK7.  See note in
 // LocalSocketImpl.
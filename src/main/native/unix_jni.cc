@@ -19,6 +19,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/resource.h>
@@ -29,14 +30,22 @@
 #include <unistd.h>
 #include <utime.h>
 
+#include <algorithm>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "src/main/native/macros.h"
 #include "src/main/cpp/util/md5.h"
 #include "src/main/cpp/util/port.h"
+#include "src/main/cpp/util/sha1.h"
+#include "src/main/cpp/util/sha256.h"
+#include "src/main/cpp/util/xxhash64.h"
 
 using blaze_util::Md5Digest;
+using blaze_util::Sha1Digest;
+using blaze_util::Sha256Digest;
+using blaze_util::Xxhash64Digest;
 
 ////////////////////////////////////////////////////////////////////////
 // Latin1 <--> java.lang.String conversion functions.
@@ -50,7 +59,7 @@ using blaze_util::Md5Digest;
 /**
  * Returns a new Java String for the specified Latin1 characters.
  */
-static jstring NewStringLatin1(JNIEnv *env, const char *str) {
+jstring NewStringLatin1(JNIEnv *env, const char *str) {
     int len = strlen(str);
     jchar buf[512];
     jchar *str1;
@@ -81,7 +90,7 @@ static jstring NewStringLatin1(JNIEnv *env, const char *str) {
  * are replaced by '?'.  Must be followed by a call to
  * ReleaseStringLatin1Chars.
  */
-static const char *GetStringLatin1Chars(JNIEnv *env, jstring jstr) {
+const char *GetStringLatin1Chars(JNIEnv *env, jstring jstr) {
     jint len = env->GetStringLength(jstr);
     const jchar *str = env->GetStringCritical(jstr, NULL);
     if (str == NULL) {
@@ -109,12 +118,33 @@ static const char *GetStringLatin1Chars(JNIEnv *env, jstring jstr) {
  * Release the Latin1 chars returned by a prior call to
  * GetStringLatin1Chars.
  */
-static void ReleaseStringLatin1Chars(const char *s) {
+void ReleaseStringLatin1Chars(const char *s) {
   if (s != NULL) {
     free(const_cast<char *>(s));
   }
 }
 
+// See unix_jni.h.
+ScopedLatin1Chars::ScopedLatin1Chars(JNIEnv *env, jstring jstr) : chars_(buf_) {
+  jsize len = env->GetStringLength(jstr);
+  if (static_cast<size_t>(len) >= sizeof(buf_)) {
+    chars_ = GetStringLatin1Chars(env, jstr);
+    return;
+  }
+  jchar str[sizeof(buf_)];
+  env->GetStringRegion(jstr, 0, len, str);
+  for (jsize i = 0; i < len; i++) {
+    buf_[i] = str[i] <= 0x00ff ? str[i] : '?';
+  }
+  buf_[len] = 0;
+}
+
+ScopedLatin1Chars::~ScopedLatin1Chars() {
+  if (chars_ != buf_) {
+    ReleaseStringLatin1Chars(chars_);
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////
 
 // See unix_jni.h.
@@ -247,15 +277,17 @@ extern "C" JNIEXPORT jstring JNICALL
 Java_com_google_devtools_build_lib_unix_NativePosixFiles_readlink(JNIEnv *env,
                                                      jclass clazz,
                                                      jstring path) {
-  const char *path_chars = GetStringLatin1Chars(env, path);
+  ScopedLatin1Chars path_chars(env, path);
+  if (path_chars.get() == NULL) {
+    return NULL;
+  }
   char target[PATH_MAX] = "";
   jstring r = NULL;
-  if (readlink(path_chars, target, arraysize(target)) == -1) {
-    ::PostFileException(env, errno, path_chars);
+  if (readlink(path_chars.get(), target, arraysize(target)) == -1) {
+    ::PostFileException(env, errno, path_chars.get());
   } else {
     r = NewStringLatin1(env, target);
   }
-  ReleaseStringLatin1Chars(path_chars);
   return r;
 }
 
@@ -264,24 +296,27 @@ Java_com_google_devtools_build_lib_unix_NativePosixFiles_chmod(JNIEnv *env,
                                                   jclass clazz,
                                                   jstring path,
                                                   jint mode) {
-  const char *path_chars = GetStringLatin1Chars(env, path);
-  if (chmod(path_chars, static_cast<int>(mode)) == -1) {
-    ::PostFileException(env, errno, path_chars);
+  ScopedLatin1Chars path_chars(env, path);
+  if (path_chars.get() == NULL) {
+    return;
+  }
+  if (chmod(path_chars.get(), static_cast<int>(mode)) == -1) {
+    ::PostFileException(env, errno, path_chars.get());
   }
-  ReleaseStringLatin1Chars(path_chars);
 }
 
 static void link_common(JNIEnv *env,
                         jstring oldpath,
                         jstring newpath,
                         int (*link_function)(const char *, const char *)) {
-  const char *oldpath_chars = GetStringLatin1Chars(env, oldpath);
-  const char *newpath_chars = GetStringLatin1Chars(env, newpath);
-  if (link_function(oldpath_chars, newpath_chars) == -1) {
-    ::PostFileException(env, errno, newpath_chars);
+  ScopedLatin1Chars oldpath_chars(env, oldpath);
+  ScopedLatin1Chars newpath_chars(env, newpath);
+  if (oldpath_chars.get() == NULL || newpath_chars.get() == NULL) {
+    return;
+  }
+  if (link_function(oldpath_chars.get(), newpath_chars.get()) == -1) {
+    ::PostFileException(env, errno, newpath_chars.get());
   }
-  ReleaseStringLatin1Chars(oldpath_chars);
-  ReleaseStringLatin1Chars(newpath_chars);
 }
 
 extern "C" JNIEXPORT void JNICALL
@@ -385,27 +420,28 @@ static jobject StatCommon(JNIEnv *env,
                           int (*stat_function)(const char *, portable_stat_struct *),
                           bool should_throw) {
   portable_stat_struct statbuf;
-  const char *path_chars = GetStringLatin1Chars(env, path);
+  ScopedLatin1Chars path_chars(env, path);
+  if (path_chars.get() == NULL) {
+    return NULL;
+  }
   int r;
   int saved_errno = 0;
-  while ((r = stat_function(path_chars, &statbuf)) == -1 && errno == EINTR) { }
+  while ((r = stat_function(path_chars.get(), &statbuf)) == -1 &&
+         errno == EINTR) { }
   if (r == -1) {
     // EACCES ENOENT ENOTDIR ELOOP -> IOException
     // ENAMETOOLONGEFAULT          -> RuntimeException
     // ENOMEM                      -> OutOfMemoryError
 
-    if (PostRuntimeException(env, errno, path_chars)) {
-      ::ReleaseStringLatin1Chars(path_chars);
+    if (PostRuntimeException(env, errno, path_chars.get())) {
       return NULL;
     } else if (should_throw) {
-      ::PostFileException(env, errno, path_chars);
-      ::ReleaseStringLatin1Chars(path_chars);
+      ::PostFileException(env, errno, path_chars.get());
       return NULL;
     } else {
       saved_errno = errno;
     }
   }
-  ::ReleaseStringLatin1Chars(path_chars);
 
   return should_throw
     ? NewFileStatus(env, statbuf)
@@ -462,6 +498,19 @@ Java_com_google_devtools_build_lib_unix_NativePosixFiles_errnoLstat(JNIEnv *env,
   return ::StatCommon(env, path, portable_lstat, false);
 }
 
+// Sets the modification time of "path" to "modtime", or to the current time
+// if "now". Returns -1 with errno set if that failed.
+static int SetModificationTime(const char *path, bool now, jint modtime) {
+#ifdef __linux
+  struct timespec spec[2] = {{0, UTIME_OMIT}, {modtime, now ? UTIME_NOW : 0}};
+  return ::utimensat(AT_FDCWD, path, spec, 0);
+#else
+  struct utimbuf buf = { modtime, modtime };
+  struct utimbuf *bufptr = now ? NULL : &buf;
+  return ::utime(path, bufptr);
+#endif
+}
+
 /*
  * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
  * Method:    utime
@@ -474,23 +523,16 @@ Java_com_google_devtools_build_lib_unix_NativePosixFiles_utime(JNIEnv *env,
                                                   jstring path,
                                                   jboolean now,
                                                   jint modtime) {
-  const char *path_chars = GetStringLatin1Chars(env, path);
-#ifdef __linux
-  struct timespec spec[2] = {{0, UTIME_OMIT}, {modtime, now ? UTIME_NOW : 0}};
-  if (::utimensat(AT_FDCWD, path_chars, spec, 0) == -1) {
-    ::PostFileException(env, errno, path_chars);
+  ScopedLatin1Chars path_chars(env, path);
+  if (path_chars.get() == NULL) {
+    return;
   }
-#else
-  struct utimbuf buf = { modtime, modtime };
-  struct utimbuf *bufptr = now ? NULL : &buf;
-  if (::utime(path_chars, bufptr) == -1) {
+  if (SetModificationTime(path_chars.get(), now, modtime) == -1) {
     // EACCES ENOENT EMULTIHOP ELOOP EINTR
     // ENOTDIR ENOLINK EPERM EROFS   -> IOException
     // EFAULT ENAMETOOLONG           -> RuntimeException
-    ::PostFileException(env, errno, path_chars);
+    ::PostFileException(env, errno, path_chars.get());
   }
-#endif
-  ReleaseStringLatin1Chars(path_chars);
 }
 
 /*
@@ -516,9 +558,12 @@ Java_com_google_devtools_build_lib_unix_NativePosixFiles_mkdir(JNIEnv *env,
                                                   jclass clazz,
                                                   jstring path,
                                                   jint mode) {
-  const char *path_chars = GetStringLatin1Chars(env, path);
+  ScopedLatin1Chars path_chars(env, path);
+  if (path_chars.get() == NULL) {
+    return false;
+  }
   jboolean result = true;
-  if (::mkdir(path_chars, mode) == -1) {
+  if (::mkdir(path_chars.get(), mode) == -1) {
     // EACCES ENOENT ELOOP
     // ENOSPC ENOTDIR EPERM EROFS     -> IOException
     // EFAULT ENAMETOOLONG            -> RuntimeException
@@ -527,33 +572,12 @@ Java_com_google_devtools_build_lib_unix_NativePosixFiles_mkdir(JNIEnv *env,
     if (errno == EEXIST) {
       result = false;
     } else {
-      ::PostFileException(env, errno, path_chars);
+      ::PostFileException(env, errno, path_chars.get());
     }
   }
-  ReleaseStringLatin1Chars(path_chars);
   return result;
 }
 
-static jobject NewDirents(JNIEnv *env,
-                          jobjectArray names,
-                          jbyteArray types) {
-  // See http://java.sun.com/docs/books/jni/html/fldmeth.html#26855
-  static jclass dirents_class = NULL;
-  if (dirents_class == NULL) {  // note: harmless race condition
-    jclass local = env->FindClass("com/google/devtools/build/lib/unix/NativePosixFiles$Dirents");
-    CHECK(local != NULL);
-    dirents_class = static_cast<jclass>(env->NewGlobalRef(local));
-  }
-
-  static jmethodID ctor = NULL;
-  if (ctor == NULL) {  // note: harmless race condition
-    ctor = env->GetMethodID(dirents_class, "<init>", "([Ljava/lang/String;[B)V");
-    CHECK(ctor != NULL);
-  }
-
-  return env->NewObject(dirents_class, ctor, names, types);
-}
-
 static char GetDirentType(struct dirent *entry,
                           int dirfd,
                           bool follow_symlinks) {
@@ -582,31 +606,32 @@ static char GetDirentType(struct dirent *entry,
 
 /*
  * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
- * Method:    readdir
- * Signature: (Ljava/lang/String;Z)Lcom/google/devtools/build/lib/unix/Dirents;
+ * Method:    readdirNative
+ * Signature: (Ljava/lang/String;C)[B
  * Throws:    java.io.IOException
+ *
+ * Returns, for each entry, its type (0 if read_types is 'n'), its name and a
+ * NUL byte. The Java side makes the Dirents from that, which is cheaper than
+ * a JNI string per name.
  */
-extern "C" JNIEXPORT jobject JNICALL
-Java_com_google_devtools_build_lib_unix_NativePosixFiles_readdir(JNIEnv *env,
-                                                    jclass clazz,
-                                                    jstring path,
-                                                    jchar read_types) {
-  const char *path_chars = GetStringLatin1Chars(env, path);
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_readdirNative(
+    JNIEnv *env, jclass clazz, jstring path, jchar read_types) {
+  ScopedLatin1Chars path_chars(env, path);
+  if (path_chars.get() == NULL) {
+    return NULL;
+  }
   DIR *dirh;
-  while ((dirh = ::opendir(path_chars)) == NULL && errno == EINTR) { }
+  while ((dirh = ::opendir(path_chars.get())) == NULL && errno == EINTR) { }
   if (dirh == NULL) {
     // EACCES EMFILE ENFILE ENOENT ENOTDIR -> IOException
     // ENOMEM                              -> OutOfMemoryError
-    ::PostFileException(env, errno, path_chars);
-  }
-  ReleaseStringLatin1Chars(path_chars);
-  if (dirh == NULL) {
+    ::PostFileException(env, errno, path_chars.get());
     return NULL;
   }
   int fd = dirfd(dirh);
 
-  std::vector<std::string> entries;
-  std::vector<jbyte> types;
+  std::vector<char> entries;
   for (;;) {
     // Clear errno beforehand.  Because readdir() is not required to clear it at
     // EOF, this is the only way to reliably distinguish EOF from error.
@@ -619,7 +644,7 @@ Java_com_google_devtools_build_lib_unix_NativePosixFiles_readdir(JNIEnv *env,
       if (errno == EINTR) continue;  // interrupted by a signal
       if (errno == EIO) continue;  // glibc returns this on transient errors
       // Otherwise, this is a real error we should report.
-      ::PostFileException(env, errno, path_chars);
+      ::PostFileException(env, errno, path_chars.get());
       ::closedir(dirh);
       return NULL;
     }
@@ -628,43 +653,417 @@ Java_com_google_devtools_build_lib_unix_NativePosixFiles_readdir(JNIEnv *env,
       if (entry->d_name[1] == '\0') continue;
       if (entry->d_name[1] == '.' && entry->d_name[2] == '\0') continue;
     }
-    entries.push_back(entry->d_name);
-    if (read_types != 'n') {
-      types.push_back(GetDirentType(entry, fd, read_types == 'f'));
+    entries.push_back(read_types == 'n'
+                          ? 0
+                          : GetDirentType(entry, fd, read_types == 'f'));
+    entries.insert(entries.end(), entry->d_name,
+                   entry->d_name + strlen(entry->d_name) + 1);
+  }
+
+  if (::closedir(dirh) < 0 && errno != EINTR) {
+    ::PostFileException(env, errno, path_chars.get());
+    return NULL;
+  }
+
+  jbyteArray result = env->NewByteArray(entries.size());
+  if (result == NULL) {
+    return NULL;  // OutOfMemoryError is pending.
+  }
+  if (!entries.empty()) {
+    env->SetByteArrayRegion(result, 0, entries.size(),
+                            reinterpret_cast<const jbyte *>(&entries[0]));
+  }
+  return result;
+}
+
+// The result of stat'ing one file, as returned by readdirWithStat and
+// statBatch, in the byte order of the machine. In the result of readdirWithStat
+// each record is followed by the name of the entry, which is not
+// NUL-terminated. Keep in sync with NativePosixFiles.
+struct StatRecord {
+  jint mode;
+  jint error;  // errno of the stat call, with all other fields but the name zero
+  jint atime;
+  jint atimensec;
+  jint mtime;
+  jint mtimensec;
+  jint ctime;
+  jint ctimensec;
+  jint dev;
+  jint name_length;  // readdirWithStat only
+  jlong size;
+  jlong ino;
+};
+
+// Fills "record" from the result "r" of a stat call that filled "statbuf", or
+// from errno if it failed.
+static void FillStatRecord(int r, const portable_stat_struct &statbuf,
+                           StatRecord *record) {
+  memset(record, 0, sizeof(*record));
+  if (r == -1) {
+    record->error = errno;
+    return;
+  }
+  record->mode = statbuf.st_mode;
+  record->atime = StatSeconds(statbuf, STAT_ATIME);
+  record->atimensec = StatNanoSeconds(statbuf, STAT_ATIME);
+  record->mtime = StatSeconds(statbuf, STAT_MTIME);
+  record->mtimensec = StatNanoSeconds(statbuf, STAT_MTIME);
+  record->ctime = StatSeconds(statbuf, STAT_CTIME);
+  record->ctimensec = StatNanoSeconds(statbuf, STAT_CTIME);
+  record->dev = static_cast<jint>(statbuf.st_dev);
+  record->size = static_cast<jlong>(statbuf.st_size);
+  record->ino = static_cast<jlong>(statbuf.st_ino);
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    readdirWithStatNative
+ * Signature: (Ljava/lang/String;Z)[B
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_readdirWithStatNative(
+    JNIEnv *env, jclass clazz, jstring path, jboolean follow_symlinks) {
+  ScopedLatin1Chars path_chars(env, path);
+  if (path_chars.get() == NULL) {
+    return NULL;
+  }
+  DIR *dirh;
+  while ((dirh = ::opendir(path_chars.get())) == NULL && errno == EINTR) { }
+  if (dirh == NULL) {
+    // EACCES EMFILE ENFILE ENOENT ENOTDIR -> IOException
+    // ENOMEM                              -> OutOfMemoryError
+    ::PostFileException(env, errno, path_chars.get());
+    return NULL;
+  }
+  int fd = dirfd(dirh);
+  int stat_flags = follow_symlinks ? 0 : AT_SYMLINK_NOFOLLOW;
+
+  // All the records go into one buffer, so that the Java side gets them with a
+  // single array instead of a String and a FileStatus per entry.
+  std::vector<char> records;
+  for (;;) {
+    errno = 0;
+    struct dirent *entry = ::readdir(dirh);
+    if (entry == NULL) {
+      if (errno == 0) break;  // EOF
+      if (errno == EINTR) continue;  // interrupted by a signal
+      if (errno == EIO) continue;  // glibc returns this on transient errors
+      ::PostFileException(env, errno, path_chars.get());
+      ::closedir(dirh);
+      return NULL;
     }
+    // Omit . and .. from results.
+    if (entry->d_name[0] == '.') {
+      if (entry->d_name[1] == '\0') continue;
+      if (entry->d_name[1] == '.' && entry->d_name[2] == '\0') continue;
+    }
+
+    portable_stat_struct statbuf;
+    int r;
+    while ((r = portable_fstatat(fd, entry->d_name, &statbuf, stat_flags)) ==
+               -1 && errno == EINTR) { }
+    StatRecord record;
+    FillStatRecord(r, statbuf, &record);
+    size_t name_length = strlen(entry->d_name);
+    record.name_length = name_length;
+    const char *record_bytes = reinterpret_cast<const char *>(&record);
+    records.insert(records.end(), record_bytes, record_bytes + sizeof(record));
+    records.insert(records.end(), entry->d_name, entry->d_name + name_length);
   }
 
   if (::closedir(dirh) < 0 && errno != EINTR) {
-    ::PostFileException(env, errno, path_chars);
+    ::PostFileException(env, errno, path_chars.get());
     return NULL;
   }
 
-  size_t len = entries.size();
-  jclass jlStringClass = env->GetObjectClass(path);
-  jobjectArray names_obj = env->NewObjectArray(len, jlStringClass, NULL);
-  if (names_obj == NULL && env->ExceptionOccurred()) {
-    return NULL;  // async exception!
+  jbyteArray result = env->NewByteArray(records.size());
+  if (result == NULL) {
+    return NULL;  // OutOfMemoryError is pending.
+  }
+  if (!records.empty()) {
+    env->SetByteArrayRegion(result, 0, records.size(),
+                            reinterpret_cast<const jbyte *>(&records[0]));
+  }
+  return result;
+}
+
+// A range of the items of a batch call, processed by one thread.
+struct BatchRange {
+  void (*work)(size_t begin, size_t end, void *arg);
+  void *arg;
+  size_t begin;
+  size_t end;
+};
+
+static void *BatchThread(void *arg) {
+  const BatchRange *range = reinterpret_cast<BatchRange *>(arg);
+  range->work(range->begin, range->end, range->arg);
+  return NULL;
+}
+
+static const size_t kMaxBatchThreads = 8;
+
+// Calls "work" on consecutive ranges of [0, count) that together cover it, on
+// up to kMaxBatchThreads threads, with at least "min_per_thread" items per extra
+// thread. The calling thread takes a range too, and any range for which no
+// thread could be created. "work" must not call into the JVM.
+static void RunInParallel(size_t count, size_t min_per_thread,
+                          void (*work)(size_t begin, size_t end, void *arg),
+                          void *arg) {
+  size_t num_threads = count / min_per_thread;
+  if (num_threads > kMaxBatchThreads) {
+    num_threads = kMaxBatchThreads;
+  } else if (num_threads == 0) {
+    num_threads = 1;
+  }
+  std::vector<BatchRange> ranges(num_threads);
+  for (size_t t = 0; t < num_threads; ++t) {
+    ranges[t].work = work;
+    ranges[t].arg = arg;
+    ranges[t].begin = count * t / num_threads;
+    ranges[t].end = count * (t + 1) / num_threads;
+  }
+  std::vector<pthread_t> threads(num_threads);
+  std::vector<bool> started(num_threads, false);
+  for (size_t t = 1; t < num_threads; ++t) {
+    started[t] =
+        pthread_create(&threads[t], NULL, BatchThread, &ranges[t]) == 0;
+  }
+  for (size_t t = 0; t < num_threads; ++t) {
+    if (!started[t]) {
+      BatchThread(&ranges[t]);
+    }
+  }
+  for (size_t t = 1; t < num_threads; ++t) {
+    if (started[t]) {
+      pthread_join(threads[t], NULL);
+    }
+  }
+}
+
+// Converts the strings in "paths" for a batch call, as only the calling thread
+// can call into the JVM; null elements stay NULL. Returns false with an
+// exception pending if that failed.
+static bool GetBatchPaths(JNIEnv *env, jobjectArray paths,
+                          std::vector<const char *> *path_chars) {
+  size_t count = env->GetArrayLength(paths);
+  path_chars->assign(count, NULL);
+  for (size_t i = 0; i < count; ++i) {
+    jstring path = static_cast<jstring>(env->GetObjectArrayElement(paths, i));
+    if (path != NULL) {
+      (*path_chars)[i] = GetStringLatin1Chars(env, path);
+      env->DeleteLocalRef(path);
+      if ((*path_chars)[i] == NULL) {  // OutOfMemoryError is pending.
+        for (size_t j = 0; j < i; ++j) {
+          ReleaseStringLatin1Chars((*path_chars)[j]);
+        }
+        path_chars->clear();
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static void ReleaseBatchPaths(const std::vector<const char *> &path_chars) {
+  for (size_t i = 0; i < path_chars.size(); ++i) {
+    ReleaseStringLatin1Chars(path_chars[i]);
+  }
+}
+
+struct StatBatch {
+  const char **paths;
+  char *records;
+  bool follow_symlinks;
+};
+
+static void StatBatchRange(size_t begin, size_t end, void *arg) {
+  const StatBatch *batch = reinterpret_cast<StatBatch *>(arg);
+  for (size_t i = begin; i < end; ++i) {
+    StatRecord record;
+    if (batch->paths[i] == NULL) {
+      memset(&record, 0, sizeof(record));
+      record.error = EINVAL;
+    } else {
+      portable_stat_struct statbuf;
+      int r;
+      while ((r = batch->follow_symlinks
+                      ? portable_stat(batch->paths[i], &statbuf)
+                      : portable_lstat(batch->paths[i], &statbuf)) == -1 &&
+             errno == EINTR) { }
+      FillStatRecord(r, statbuf, &record);
+    }
+    // The buffer comes from Java and need not be aligned for jlongs.
+    memcpy(batch->records + i * sizeof(record), &record, sizeof(record));
+  }
+}
+
+// Batches smaller than this are not worth a thread.
+static const size_t kMinPathsPerStatThread = 512;
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    statBatchNative
+ * Signature: ([Ljava/lang/String;ZLjava/nio/ByteBuffer;)V
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_statBatchNative(
+    JNIEnv *env, jclass clazz, jobjectArray paths, jboolean follow_symlinks,
+    jobject out) {
+  char *records = reinterpret_cast<char *>(env->GetDirectBufferAddress(out));
+  CHECK(records != NULL);
+  size_t count = env->GetArrayLength(paths);
+  CHECK(static_cast<size_t>(env->GetDirectBufferCapacity(out)) >=
+        count * sizeof(StatRecord));
+
+  std::vector<const char *> path_chars;
+  if (!GetBatchPaths(env, paths, &path_chars)) {
+    return;
   }
+  StatBatch batch;
+  batch.paths = count > 0 ? &path_chars[0] : NULL;
+  batch.records = records;
+  batch.follow_symlinks = follow_symlinks;
+  RunInParallel(count, kMinPathsPerStatThread, StatBatchRange, &batch);
+  ReleaseBatchPaths(path_chars);
+}
 
-  for (size_t ii = 0; ii < len; ++ii) {
-    jstring s = NewStringLatin1(env, entries[ii].c_str());
-    if (s == NULL && env->ExceptionOccurred()) {
-      return NULL;  // async exception!
+// What chmodBatch or utimeBatch does to each of its paths.
+struct AttributeBatch {
+  const char **paths;
+  int *errors;
+  // For chmodBatch.
+  mode_t mode;
+  bool regular_files_only;
+  // For utimeBatch.
+  bool now;
+  jint modtime;
+};
+
+static void ChmodBatchRange(size_t begin, size_t end, void *arg) {
+  const AttributeBatch *batch = reinterpret_cast<AttributeBatch *>(arg);
+  for (size_t i = begin; i < end; ++i) {
+    const char *path = batch->paths[i];
+    int error = 0;
+    if (path == NULL) {
+      error = EINVAL;
+    } else {
+      portable_stat_struct statbuf;
+      if (batch->regular_files_only && portable_lstat(path, &statbuf) == -1) {
+        error = errno;
+      } else if (batch->regular_files_only && !S_ISREG(statbuf.st_mode)) {
+        // Left alone.
+      } else if (fchmodat(AT_FDCWD, path, batch->mode, 0) == -1) {
+        error = errno;
+      }
     }
-    env->SetObjectArrayElement(names_obj, ii, s);
+    batch->errors[i] = error;
   }
+}
 
-  jbyteArray types_obj = NULL;
-  if (read_types != 'n') {
-    CHECK(len == types.size());
-    types_obj = env->NewByteArray(len);
-    CHECK(types_obj);
-    if (len > 0) {
-      env->SetByteArrayRegion(types_obj, 0, len, &types[0]);
+static void UtimeBatchRange(size_t begin, size_t end, void *arg) {
+  const AttributeBatch *batch = reinterpret_cast<AttributeBatch *>(arg);
+  for (size_t i = begin; i < end; ++i) {
+    if (batch->paths[i] == NULL) {
+      batch->errors[i] = EINVAL;
+    } else if (SetModificationTime(batch->paths[i], batch->now,
+                                   batch->modtime) == -1) {
+      batch->errors[i] = errno;
+    } else {
+      batch->errors[i] = 0;
     }
   }
+}
+
+// Like stats, these are a syscall or two per path.
+static const size_t kMinPathsPerAttributeThread = kMinPathsPerStatThread;
 
-  return NewDirents(env, names_obj, types_obj);
+// Runs "work" over "paths" for "batch", and returns the errno of every path,
+// or NULL with an exception pending.
+static jintArray RunAttributeBatch(JNIEnv *env, jobjectArray paths,
+                                   void (*work)(size_t, size_t, void *),
+                                   AttributeBatch *batch) {
+  std::vector<const char *> path_chars;
+  if (!GetBatchPaths(env, paths, &path_chars)) {
+    return NULL;
+  }
+  size_t count = path_chars.size();
+  std::vector<int> errors(count);
+  batch->paths = count > 0 ? &path_chars[0] : NULL;
+  batch->errors = count > 0 ? &errors[0] : NULL;
+  RunInParallel(count, kMinPathsPerAttributeThread, work, batch);
+  ReleaseBatchPaths(path_chars);
+
+  jintArray result = env->NewIntArray(count);
+  if (result != NULL && count > 0) {
+    env->SetIntArrayRegion(result, 0, count,
+                           reinterpret_cast<const jint *>(&errors[0]));
+  }
+  return result;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    chmodBatch
+ * Signature: ([Ljava/lang/String;IZ)[I
+ */
+extern "C" JNIEXPORT jintArray JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_chmodBatch(
+    JNIEnv *env, jclass clazz, jobjectArray paths, jint mode,
+    jboolean regular_files_only) {
+  AttributeBatch batch;
+  batch.mode = static_cast<mode_t>(mode);
+  batch.regular_files_only = regular_files_only;
+  return RunAttributeBatch(env, paths, ChmodBatchRange, &batch);
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    utimeBatch
+ * Signature: ([Ljava/lang/String;ZI)[I
+ */
+extern "C" JNIEXPORT jintArray JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_utimeBatch(
+    JNIEnv *env, jclass clazz, jobjectArray paths, jboolean now,
+    jint modtime) {
+  AttributeBatch batch;
+  batch.now = now;
+  batch.modtime = modtime;
+  return RunAttributeBatch(env, paths, UtimeBatchRange, &batch);
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    statIntoNative
+ * Signature: (Ljava/lang/String;ZILjava/nio/ByteBuffer;)I
+ */
+extern "C" JNIEXPORT jint JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_statIntoNative(
+    JNIEnv *env, jclass clazz, jstring path, jboolean follow_symlinks,
+    jint fields, jobject out) {
+  char *records = reinterpret_cast<char *>(env->GetDirectBufferAddress(out));
+  CHECK(records != NULL);
+  CHECK(static_cast<size_t>(env->GetDirectBufferCapacity(out)) >=
+        sizeof(StatRecord));
+  ScopedLatin1Chars path_chars(env, path);
+  if (path_chars.get() == NULL) {
+    return 0;
+  }
+  portable_stat_struct statbuf;
+  int r;
+  while ((r = portable_statx(path_chars.get(), follow_symlinks, fields,
+                             &statbuf)) == -1 &&
+         errno == EINTR) { }
+  // Same as StatCommon: errors that are not about the file itself throw.
+  if (r == -1 && PostRuntimeException(env, errno, path_chars.get())) {
+    return 0;
+  }
+  StatRecord record;
+  FillStatRecord(r, statbuf, &record);
+  memcpy(records, &record, sizeof(record));
+  return record.error;
 }
 
 /*
@@ -678,36 +1077,37 @@ Java_com_google_devtools_build_lib_unix_NativePosixFiles_rename(JNIEnv *env,
                                                    jclass clazz,
                                                    jstring oldpath,
                                                    jstring newpath) {
-  const char *oldpath_chars = GetStringLatin1Chars(env, oldpath);
-  const char *newpath_chars = GetStringLatin1Chars(env, newpath);
-  if (::rename(oldpath_chars, newpath_chars) == -1) {
+  ScopedLatin1Chars oldpath_chars(env, oldpath);
+  ScopedLatin1Chars newpath_chars(env, newpath);
+  if (oldpath_chars.get() == NULL || newpath_chars.get() == NULL) {
+    return;
+  }
+  if (::rename(oldpath_chars.get(), newpath_chars.get()) == -1) {
     // EISDIR EXDEV ENOTEMPTY EEXIST EBUSY
     // EINVAL EMLINK ENOTDIR EACCES EPERM
     // ENOENT EROFS ELOOP ENOSPC           -> IOException
     // EFAULT ENAMETOOLONG                 -> RuntimeException
     // ENOMEM                              -> OutOfMemoryError
-    std::string filename(std::string(oldpath_chars) + " -> " + newpath_chars);
+    std::string filename(std::string(oldpath_chars.get()) + " -> " +
+                         newpath_chars.get());
     ::PostFileException(env, errno, filename.c_str());
   }
-  ReleaseStringLatin1Chars(oldpath_chars);
-  ReleaseStringLatin1Chars(newpath_chars);
 }
 
 static bool delete_common(JNIEnv *env,
                           jstring path,
                           int (*delete_function)(const char *),
                           bool (*error_function)(int)) {
-  const char *path_chars = GetStringLatin1Chars(env, path);
-  if (path_chars == NULL) {
+  ScopedLatin1Chars path_chars(env, path);
+  if (path_chars.get() == NULL) {
       return false;
   }
-  bool ok = delete_function(path_chars) != -1;
+  bool ok = delete_function(path_chars.get()) != -1;
   if (!ok) {
     if (!error_function(errno)) {
-      ::PostFileException(env, errno, path_chars);
+      ::PostFileException(env, errno, path_chars.get());
     }
   }
-  ReleaseStringLatin1Chars(path_chars);
   return ok;
 }
 
@@ -751,11 +1151,13 @@ Java_com_google_devtools_build_lib_unix_NativePosixFiles_mkfifo(JNIEnv *env,
                                                    jclass clazz,
                                                    jstring path,
                                                    jint mode) {
-  const char *path_chars = GetStringLatin1Chars(env, path);
-  if (mkfifo(path_chars, mode) == -1) {
-    ::PostFileException(env, errno, path_chars);
+  ScopedLatin1Chars path_chars(env, path);
+  if (path_chars.get() == NULL) {
+    return;
+  }
+  if (mkfifo(path_chars.get(), mode) == -1) {
+    ::PostFileException(env, errno, path_chars.get());
   }
-  ReleaseStringLatin1Chars(path_chars);
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -768,23 +1170,25 @@ static jbyteArray getxattr_common(JNIEnv *env,
                                   jstring path,
                                   jstring name,
                                   getxattr_func getxattr) {
-  const char *path_chars = GetStringLatin1Chars(env, path);
-  const char *name_chars = GetStringLatin1Chars(env, name);
+  ScopedLatin1Chars path_chars(env, path);
+  ScopedLatin1Chars name_chars(env, name);
+  if (path_chars.get() == NULL || name_chars.get() == NULL) {
+    return NULL;
+  }
 
   // TODO(bazel-team): on ERANGE, try again with larger buffer.
   jbyte value[4096];
   jbyteArray result = NULL;
-  ssize_t size = getxattr(path_chars, name_chars, value, arraysize(value));
+  ssize_t size =
+      getxattr(path_chars.get(), name_chars.get(), value, arraysize(value));
   if (size == -1) {
     if (errno != ENODATA) {
-      ::PostFileException(env, errno, path_chars);
+      ::PostFileException(env, errno, path_chars.get());
     }
   } else {
     result = env->NewByteArray(size);
     env->SetByteArrayRegion(result, 0, size, value);
   }
-  ReleaseStringLatin1Chars(path_chars);
-  ReleaseStringLatin1Chars(name_chars);
   return result;
 }
 
@@ -805,23 +1209,27 @@ Java_com_google_devtools_build_lib_unix_NativePosixFiles_lgetxattr(JNIEnv *env,
 }
 
 
-// Computes MD5 digest of "file", writes result in "result", which
-// must be of length Md5Digest::kDigestLength.  Returns zero on success, or
-// -1 (and sets errno) otherwise.
-static int md5sumAsBytes(const char *file,
-                         jbyte result[Md5Digest::kDigestLength]) {
-  Md5Digest digest;
-  // OPT: Using a 32k buffer would give marginally better performance,
-  // but what is the stack size here?
-  jbyte buf[4096];
+// The size of the buffer that files are read into for digesting. It is
+// allocated on the heap, since we do not know the stack size here.
+static const size_t kDigestBufferSize = 64 * 1024;
+
+// Computes the digest of "file" into "result", reading it through "buf" of
+// kDigestBufferSize bytes. Returns -1 and sets errno on failure.
+template <class Digest>
+static int DigestFile(const char *file, unsigned char *result, char *buf) {
+  Digest digest;
   int fd;
   while ((fd = open(file, O_RDONLY)) == -1 && errno == EINTR) { }
   if (fd == -1) {
     return -1;
   }
-  for (ssize_t len = read(fd, buf, arraysize(buf));
+#ifdef POSIX_FADV_SEQUENTIAL
+  // Only a hint; a failure does not matter.
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  for (ssize_t len = read(fd, buf, kDigestBufferSize);
        len != 0;
-       len = read(fd, buf, arraysize(buf))) {
+       len = read(fd, buf, kDigestBufferSize)) {
     if (len == -1) {
       if (errno == EINTR) {
         continue;
@@ -837,27 +1245,1075 @@ static int md5sumAsBytes(const char *file,
   if (close(fd) < 0 && errno != EINTR) {
     return -1;
   }
-  digest.Finish(reinterpret_cast<unsigned char*>(result));
+  digest.Finish(result);
   return 0;
 }
 
-
 extern "C" JNIEXPORT jbyteArray JNICALL
 Java_com_google_devtools_build_lib_unix_NativePosixFiles_md5sumAsBytes(
     JNIEnv *env, jclass clazz, jstring path) {
-  const char *path_chars = GetStringLatin1Chars(env, path);
-  jbyte value[Md5Digest::kDigestLength];
+  ScopedLatin1Chars path_chars(env, path);
+  if (path_chars.get() == NULL) {
+    return NULL;
+  }
+  std::vector<char> buf(kDigestBufferSize);
+  unsigned char value[Md5Digest::kDigestLength];
   jbyteArray result = NULL;
-  if (md5sumAsBytes(path_chars, value) == 0) {
+  if (DigestFile<Md5Digest>(path_chars.get(), value, &buf[0]) == 0) {
     result = env->NewByteArray(Md5Digest::kDigestLength);
-    env->SetByteArrayRegion(result, 0, Md5Digest::kDigestLength, value);
+    env->SetByteArrayRegion(result, 0, Md5Digest::kDigestLength,
+                            reinterpret_cast<jbyte *>(value));
+  } else {
+    ::PostFileException(env, errno, path_chars.get());
+  }
+  return result;
+}
+
+// The digest functions of digestBatch. Keep in sync with
+// NativePosixFiles.DigestFunction.
+enum DigestFunction {
+  DIGEST_MD5 = 0,
+  DIGEST_SHA256 = 1,
+  DIGEST_XXHASH64 = 2,
+  DIGEST_SHA1 = 3,
+};
+
+typedef int digest_file_func(const char *file, unsigned char *result,
+                             char *buf);
+
+// Looks up the digest function with the given code. Returns false if there is
+// no such function.
+static bool GetDigestFunction(jint function, int *digest_length,
+                              digest_file_func **digest_file) {
+  switch (function) {
+    case DIGEST_MD5:
+      *digest_length = Md5Digest::kDigestLength;
+      *digest_file = DigestFile<Md5Digest>;
+      return true;
+    case DIGEST_SHA256:
+      *digest_length = Sha256Digest::kDigestLength;
+      *digest_file = DigestFile<Sha256Digest>;
+      return true;
+    case DIGEST_XXHASH64:
+      *digest_length = Xxhash64Digest::kDigestLength;
+      *digest_file = DigestFile<Xxhash64Digest>;
+      return true;
+    case DIGEST_SHA1:
+      *digest_length = Sha1Digest::kDigestLength;
+      *digest_file = DigestFile<Sha1Digest>;
+      return true;
+    default:
+      return false;
+  }
+}
+
+struct DigestBatch {
+  const char **paths;
+  unsigned char *digests;
+  int digest_length;
+  digest_file_func *digest_file;
+  int *errors;  // errno per path, 0 if its digest was computed
+};
+
+static void DigestBatchRange(size_t begin, size_t end, void *arg) {
+  const DigestBatch *batch = reinterpret_cast<DigestBatch *>(arg);
+  std::vector<char> buf(kDigestBufferSize);
+  for (size_t i = begin; i < end; ++i) {
+    if (batch->paths[i] == NULL) {
+      batch->errors[i] = EINVAL;
+    } else if (batch->digest_file(batch->paths[i],
+                                  batch->digests + i * batch->digest_length,
+                                  &buf[0]) == -1) {
+      batch->errors[i] = errno;
+    }
+  }
+}
+
+// For MD5, SHA-1 and SHA-256, files of up to this size are read whole and
+// digested kSmallFileBatchSize at a time with Md5Batch, Sha1Batch or
+// Sha256Batch, which use SIMD instructions.
+static const size_t kSmallFileSize = 16 * 1024;
+static const size_t kSmallFileBatchSize = 16;
+
+// Reads "file" into "buf" of kSmallFileSize + 1 bytes. Returns 1 and stores
+// its length in "length" if it fits, 0 if it is larger, and -1 with errno set
+// on failure.
+static int ReadSmallFile(const char *file, char *buf, size_t *length) {
+  int fd;
+  while ((fd = open(file, O_RDONLY)) == -1 && errno == EINTR) { }
+  if (fd == -1) {
+    return -1;
+  }
+  size_t total = 0;
+  while (total <= kSmallFileSize) {
+    ssize_t len = read(fd, buf + total, kSmallFileSize + 1 - total);
+    if (len == 0) {
+      break;
+    } else if (len == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      int read_errno = errno;
+      close(fd);  // prefer read() errors over close().
+      errno = read_errno;
+      return -1;
+    }
+    total += len;
+  }
+  if (close(fd) < 0 && errno != EINTR) {
+    return -1;
+  }
+  *length = total;
+  return total <= kSmallFileSize ? 1 : 0;
+}
+
+// Digests the small files of the range with "digest_batch", the others one by
+// one with DigestFile<Digest>.
+template <typename Digest,
+          void (*digest_batch)(const void *const *, const size_t *, size_t,
+                               unsigned char (*)[Digest::kDigestLength])>
+static void SmallFileBatchRange(size_t begin, size_t end, void *arg) {
+  const DigestBatch *batch = reinterpret_cast<DigestBatch *>(arg);
+  std::vector<char> small_files(kSmallFileBatchSize * (kSmallFileSize + 1));
+  std::vector<char> buf(kDigestBufferSize);
+  for (size_t i = begin; i < end;) {
+    const void *bufs[kSmallFileBatchSize];
+    size_t lengths[kSmallFileBatchSize];
+    size_t indices[kSmallFileBatchSize];
+    size_t n = 0;
+    for (; i < end && n < kSmallFileBatchSize; ++i) {
+      unsigned char *digest = batch->digests + i * Digest::kDigestLength;
+      char *small_file = &small_files[n * (kSmallFileSize + 1)];
+      int r;
+      if (batch->paths[i] == NULL) {
+        batch->errors[i] = EINVAL;
+      } else if ((r = ReadSmallFile(batch->paths[i], small_file,
+                                    &lengths[n])) == -1) {
+        batch->errors[i] = errno;
+      } else if (r == 0) {
+        if (DigestFile<Digest>(batch->paths[i], digest, &buf[0]) == -1) {
+          batch->errors[i] = errno;
+        }
+      } else {
+        bufs[n] = small_file;
+        indices[n] = i;
+        ++n;
+      }
+    }
+    unsigned char digests[kSmallFileBatchSize][Digest::kDigestLength];
+    digest_batch(bufs, lengths, n, digests);
+    for (size_t k = 0; k < n; ++k) {
+      memcpy(batch->digests + indices[k] * Digest::kDigestLength,
+             digests[k], Digest::kDigestLength);
+    }
+  }
+}
+
+// Returns the function digesting a range of a DigestBatch.
+static void (*GetDigestBatchRange(jint function))(size_t, size_t, void *) {
+  switch (function) {
+    case DIGEST_MD5:
+      return SmallFileBatchRange<Md5Digest, blaze_util::Md5Batch>;
+    case DIGEST_SHA256:
+      return SmallFileBatchRange<Sha256Digest, blaze_util::Sha256Batch>;
+    case DIGEST_SHA1:
+      return SmallFileBatchRange<Sha1Digest, blaze_util::Sha1Batch>;
+    default:
+      return DigestBatchRange;
+  }
+}
+
+// Each file takes at least a few syscalls, so even small batches are worth
+// spreading over threads.
+static const size_t kMinPathsPerDigestThread = 4;
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    digestBatchNative
+ * Signature: ([Ljava/lang/String;I)[B
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_digestBatchNative(
+    JNIEnv *env, jclass clazz, jobjectArray paths, jint function) {
+  DigestBatch batch;
+  if (!GetDigestFunction(function, &batch.digest_length, &batch.digest_file)) {
+    ::PostException(env, EINVAL, "Unknown digest function");
+    return NULL;
+  }
+
+  std::vector<const char *> path_chars;
+  if (!GetBatchPaths(env, paths, &path_chars)) {
+    return NULL;
+  }
+  size_t count = path_chars.size();
+  std::vector<unsigned char> digests(count * batch.digest_length);
+  std::vector<int> errors(count, 0);
+  batch.paths = count > 0 ? &path_chars[0] : NULL;
+  batch.digests = count > 0 ? &digests[0] : NULL;
+  batch.errors = count > 0 ? &errors[0] : NULL;
+  RunInParallel(count, kMinPathsPerDigestThread, GetDigestBatchRange(function),
+                &batch);
+
+  jbyteArray result = NULL;
+  size_t failed = 0;
+  while (failed < count && errors[failed] == 0) {
+    ++failed;
+  }
+  if (failed < count) {
+    ::PostFileException(env, errors[failed], path_chars[failed] != NULL
+                                                 ? path_chars[failed]
+                                                 : "null");
   } else {
-    ::PostFileException(env, errno, path_chars);
+    result = env->NewByteArray(digests.size());
+    if (result != NULL && !digests.empty()) {
+      env->SetByteArrayRegion(result, 0, digests.size(),
+                              reinterpret_cast<jbyte *>(&digests[0]));
+    }
   }
-  ReleaseStringLatin1Chars(path_chars);
+  ReleaseBatchPaths(path_chars);
   return result;
 }
 
+// A regular file found by digestTreeNative.
+struct TreeFile {
+  std::string path;  // relative to the root of the tree
+  std::string key;   // of its digest in the digest cache, empty if none
+
+  bool operator<(const TreeFile &other) const { return path < other.path; }
+};
+
+// The digests of the files of the trees digested so far, keyed by the digest
+// function and the device, inode, size, mtime and ctime of the file, which
+// change whenever its contents do, so that the unchanged files of a tree are
+// not read again. Cleared when it reaches kMaxCachedDigests entries.
+static std::unordered_map<std::string, std::string> *digest_cache = NULL;
+static pthread_mutex_t digest_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static const size_t kMaxCachedDigests = 256 * 1024;
+
+// The key of the file in digest_cache, or "" if the file has changed too
+// recently, within the granularity of the timestamps, for the key to tell
+// its next change.
+static std::string DigestCacheKey(const portable_stat_struct &statbuf,
+                                  jint function, time_t now) {
+  if (StatSeconds(statbuf, STAT_CTIME) >= now - 1) {
+    return "";
+  }
+  const int64_t fields[] = {
+      function,
+      static_cast<int64_t>(statbuf.st_dev),
+      static_cast<int64_t>(statbuf.st_ino),
+      static_cast<int64_t>(statbuf.st_size),
+      StatSeconds(statbuf, STAT_MTIME),
+      StatNanoSeconds(statbuf, STAT_MTIME),
+      StatSeconds(statbuf, STAT_CTIME),
+      StatNanoSeconds(statbuf, STAT_CTIME),
+  };
+  return std::string(reinterpret_cast<const char *>(fields), sizeof(fields));
+}
+
+// Appends the regular files in the directory "dir_fd", whose path relative to
+// the root of the tree is "prefix" (empty or ending in '/'), and in its
+// subdirectories, to "files". Symbolic links to files are followed, other
+// symbolic links and special files are errors. Closes dir_fd. Returns 0, or
+// an errno with the relative path it is about in "error_path".
+static int WalkTree(int dir_fd, const std::string &prefix, jint function,
+                    time_t now, std::vector<TreeFile> *files,
+                    std::string *error_path) {
+  DIR *dirh = fdopendir(dir_fd);
+  if (dirh == NULL) {
+    int error = errno;
+    close(dir_fd);
+    *error_path = prefix;
+    return error;
+  }
+  int result = 0;
+  for (;;) {
+    errno = 0;
+    struct dirent *entry = ::readdir(dirh);
+    if (entry == NULL) {
+      if (errno == 0) break;  // EOF
+      if (errno == EINTR) continue;  // interrupted by a signal
+      if (errno == EIO) continue;  // glibc returns this on transient errors
+      result = errno;
+      *error_path = prefix;
+      break;
+    }
+    // Omit . and .. from results.
+    if (entry->d_name[0] == '.') {
+      if (entry->d_name[1] == '\0') continue;
+      if (entry->d_name[1] == '.' && entry->d_name[2] == '\0') continue;
+    }
+    std::string path = prefix + entry->d_name;
+    portable_stat_struct statbuf;
+    int r;
+    while ((r = portable_fstatat(dir_fd, entry->d_name, &statbuf,
+                                 AT_SYMLINK_NOFOLLOW)) == -1 &&
+           errno == EINTR) { }
+    if (r == 0 && S_ISDIR(statbuf.st_mode)) {
+      int fd;
+      while ((fd = openat(dir_fd, entry->d_name,
+                          O_RDONLY | O_DIRECTORY | O_NOFOLLOW)) == -1 &&
+             errno == EINTR) { }
+      if (fd == -1) {
+        result = errno;
+        *error_path = path;
+        break;
+      }
+      result = WalkTree(fd, path + "/", function, now, files, error_path);
+      if (result != 0) {
+        break;
+      }
+      continue;
+    }
+    if (r == 0 && S_ISLNK(statbuf.st_mode)) {
+      while ((r = portable_fstatat(dir_fd, entry->d_name, &statbuf, 0)) ==
+                 -1 && errno == EINTR) { }
+    }
+    if (r == 0 && !S_ISREG(statbuf.st_mode)) {
+      errno = S_ISDIR(statbuf.st_mode) ? EISDIR : EINVAL;
+      r = -1;
+    }
+    if (r == -1) {
+      result = errno;
+      *error_path = path;
+      break;
+    }
+    TreeFile file;
+    file.path = path;
+    file.key = DigestCacheKey(statbuf, function, now);
+    files->push_back(file);
+  }
+  ::closedir(dirh);
+  return result;
+}
+
+struct TreeDigests {
+  const char *root;  // ending in '/'
+  const TreeFile *files;
+  unsigned char *digests;
+  int digest_length;
+  digest_file_func *digest_file;
+  int *errors;  // errno per file, 0 if its digest was computed
+};
+
+static void TreeDigestsRange(size_t begin, size_t end, void *arg) {
+  const TreeDigests *tree = reinterpret_cast<TreeDigests *>(arg);
+  std::vector<char> buf(kDigestBufferSize);
+  for (size_t i = begin; i < end; ++i) {
+    const TreeFile &file = tree->files[i];
+    unsigned char *digest = tree->digests + i * tree->digest_length;
+    if (!file.key.empty()) {
+      pthread_mutex_lock(&digest_cache_mutex);
+      bool found = false;
+      if (digest_cache != NULL) {
+        auto it = digest_cache->find(file.key);
+        if (it != digest_cache->end()) {
+          memcpy(digest, it->second.data(), tree->digest_length);
+          found = true;
+        }
+      }
+      pthread_mutex_unlock(&digest_cache_mutex);
+      if (found) {
+        continue;
+      }
+    }
+    std::string path = std::string(tree->root) + file.path;
+    if (tree->digest_file(path.c_str(), digest, &buf[0]) == -1) {
+      tree->errors[i] = errno;
+      continue;
+    }
+    if (!file.key.empty()) {
+      pthread_mutex_lock(&digest_cache_mutex);
+      if (digest_cache == NULL) {
+        digest_cache = new std::unordered_map<std::string, std::string>();
+      } else if (digest_cache->size() >= kMaxCachedDigests) {
+        digest_cache->clear();
+      }
+      (*digest_cache)[file.key].assign(reinterpret_cast<char *>(digest),
+                                       tree->digest_length);
+      pthread_mutex_unlock(&digest_cache_mutex);
+    }
+  }
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    digestTreeNative
+ * Signature: (Ljava/lang/String;I)[B
+ * Throws:    java.io.IOException
+ *
+ * Returns, for each regular file below the directory, sorted by path, its
+ * path relative to the directory, a NUL byte and its digest.
+ */
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_digestTreeNative(
+    JNIEnv *env, jclass clazz, jstring path, jint function) {
+  TreeDigests tree;
+  if (!GetDigestFunction(function, &tree.digest_length, &tree.digest_file)) {
+    ::PostException(env, EINVAL, "Unknown digest function");
+    return NULL;
+  }
+  ScopedLatin1Chars path_chars(env, path);
+  if (path_chars.get() == NULL) {
+    return NULL;
+  }
+  std::string root = path_chars.get();
+  if (root.empty() || root[root.size() - 1] != '/') {
+    root += '/';
+  }
+
+  int fd;
+  while ((fd = open(path_chars.get(), O_RDONLY | O_DIRECTORY)) == -1 &&
+         errno == EINTR) { }
+  if (fd == -1) {
+    ::PostFileException(env, errno, path_chars.get());
+    return NULL;
+  }
+  std::vector<TreeFile> files;
+  std::string error_path;
+  int error = WalkTree(fd, "", function, time(NULL), &files, &error_path);
+  if (error != 0) {
+    ::PostFileException(env, error, (root + error_path).c_str());
+    return NULL;
+  }
+  std::sort(files.begin(), files.end());
+
+  size_t count = files.size();
+  std::vector<unsigned char> digests(count * tree.digest_length);
+  std::vector<int> errors(count, 0);
+  tree.root = root.c_str();
+  tree.files = count > 0 ? &files[0] : NULL;
+  tree.digests = count > 0 ? &digests[0] : NULL;
+  tree.errors = count > 0 ? &errors[0] : NULL;
+  RunInParallel(count, kMinPathsPerDigestThread, TreeDigestsRange, &tree);
+
+  std::vector<char> entries;
+  for (size_t i = 0; i < count; ++i) {
+    if (errors[i] != 0) {
+      ::PostFileException(env, errors[i], (root + files[i].path).c_str());
+      return NULL;
+    }
+    entries.insert(entries.end(), files[i].path.begin(), files[i].path.end());
+    entries.push_back('\0');
+    entries.insert(entries.end(), &digests[i * tree.digest_length],
+                   &digests[(i + 1) * tree.digest_length]);
+  }
+  jbyteArray result = env->NewByteArray(entries.size());
+  if (result == NULL) {
+    return NULL;  // OutOfMemoryError is pending.
+  }
+  if (!entries.empty()) {
+    env->SetByteArrayRegion(result, 0, entries.size(),
+                            reinterpret_cast<const jbyte *>(&entries[0]));
+  }
+  return result;
+}
+
+// The status of a value returned by getxattrBatch. Keep in sync with
+// NativePosixFiles.getxattrBatch.
+enum XattrBatchStatus {
+  XATTR_MISSING = 0,
+  XATTR_FOUND = 1,
+  XATTR_COMPUTED = 2,
+};
+
+struct XattrBatch {
+  const char **paths;
+  const char *name;
+  size_t value_length;
+  getxattr_func *getxattr;
+  digest_file_func *fallback;  // NULL if there is none
+  // Per path, a status byte followed by value_length bytes of value.
+  unsigned char *records;
+};
+
+static void XattrBatchRange(size_t begin, size_t end, void *arg) {
+  const XattrBatch *batch = reinterpret_cast<XattrBatch *>(arg);
+  std::vector<char> buf;
+  // One more byte than needed, to tell values that are too long.
+  std::vector<unsigned char> value(batch->value_length + 1);
+  for (size_t i = begin; i < end; ++i) {
+    unsigned char *record = batch->records + i * (1 + batch->value_length);
+    record[0] = XATTR_MISSING;
+    if (batch->paths[i] == NULL) {
+      continue;
+    }
+    ssize_t size = batch->getxattr(batch->paths[i], batch->name, &value[0],
+                                   value.size());
+    if (size >= 0 && static_cast<size_t>(size) == batch->value_length) {
+      record[0] = XATTR_FOUND;
+      memcpy(record + 1, &value[0], batch->value_length);
+    } else if (batch->fallback != NULL) {
+      if (buf.empty()) {
+        buf.resize(kDigestBufferSize);
+      }
+      if (batch->fallback(batch->paths[i], record + 1, &buf[0]) == 0) {
+        record[0] = XATTR_COMPUTED;
+      }
+    }
+  }
+}
+
+// Extended attributes are often on network or FUSE file systems, where every
+// call waits for a round trip.
+static const size_t kMinPathsPerXattrThread = 32;
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    getxattrBatchNative
+ * Signature: ([Ljava/lang/String;Ljava/lang/String;IZI)[B
+ */
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_getxattrBatchNative(
+    JNIEnv *env, jclass clazz, jobjectArray paths, jstring name,
+    jint value_length, jboolean follow_symlinks, jint fallback) {
+  XattrBatch batch;
+  batch.value_length = value_length;
+  batch.getxattr =
+      follow_symlinks ? ::portable_getxattr : ::portable_lgetxattr;
+  batch.fallback = NULL;
+  if (fallback >= 0) {
+    int digest_length;
+    if (!GetDigestFunction(fallback, &digest_length, &batch.fallback) ||
+        digest_length != value_length) {
+      ::PostException(env, EINVAL, "Invalid fallback digest function");
+      return NULL;
+    }
+  }
+
+  std::vector<const char *> path_chars;
+  if (!GetBatchPaths(env, paths, &path_chars)) {
+    return NULL;
+  }
+  const char *name_chars = GetStringLatin1Chars(env, name);
+  if (name_chars == NULL) {
+    ReleaseBatchPaths(path_chars);
+    return NULL;
+  }
+  size_t count = path_chars.size();
+  std::vector<unsigned char> records(count * (1 + batch.value_length));
+  batch.paths = count > 0 ? &path_chars[0] : NULL;
+  batch.name = name_chars;
+  batch.records = count > 0 ? &records[0] : NULL;
+  RunInParallel(count, kMinPathsPerXattrThread, XattrBatchRange, &batch);
+  ReleaseStringLatin1Chars(name_chars);
+  ReleaseBatchPaths(path_chars);
+
+  jbyteArray result = env->NewByteArray(records.size());
+  if (result != NULL && !records.empty()) {
+    env->SetByteArrayRegion(result, 0, records.size(),
+                            reinterpret_cast<jbyte *>(&records[0]));
+  }
+  return result;
+}
+
+// The kinds of entries of a manifest for createTree. Keep in sync with
+// NativePosixFiles.TreeManifest.
+enum TreeEntryKind {
+  TREE_UNLINK = 'u',
+  TREE_DIRECTORY = 'd',
+  TREE_SYMLINK = 's',
+};
+
+struct TreeEntry {
+  char kind;
+  const char *path;    // relative to the root
+  const char *target;  // of a symlink, or NULL
+  int error;           // errno, or 0
+};
+
+struct TreeBatch {
+  int root_fd;
+  TreeEntry **entries;
+};
+
+static void TreeBatchRange(size_t begin, size_t end, void *arg) {
+  const TreeBatch *batch = reinterpret_cast<TreeBatch *>(arg);
+  for (size_t i = begin; i < end; ++i) {
+    TreeEntry *entry = batch->entries[i];
+    int r;
+    switch (entry->kind) {
+      case TREE_UNLINK:
+        r = ::unlinkat(batch->root_fd, entry->path, 0);
+        if (r == -1 && errno == ENOENT) {
+          r = 0;
+        }
+        break;
+      case TREE_DIRECTORY:
+        r = ::mkdirat(batch->root_fd, entry->path, 0777);
+        if (r == -1 && errno == EEXIST) {
+          struct stat statbuf;
+          if (::fstatat(batch->root_fd, entry->path, &statbuf, 0) == 0 &&
+              S_ISDIR(statbuf.st_mode)) {
+            r = 0;
+          } else {
+            errno = EEXIST;
+          }
+        }
+        break;
+      case TREE_SYMLINK:
+        r = ::symlinkat(entry->target, batch->root_fd, entry->path);
+        break;
+      default:
+        r = -1;
+        errno = EINVAL;
+    }
+    entry->error = r == -1 ? errno : 0;
+  }
+}
+
+// Parses the manifest of createTree, in which every entry is a kind byte and
+// a NUL-terminated relative path, followed by a NUL-terminated target for
+// symlinks. Returns false if it is malformed.
+static bool ParseTreeManifest(const char *manifest, size_t length,
+                              size_t count, std::vector<TreeEntry> *entries) {
+  entries->resize(count);
+  const char *p = manifest;
+  const char *end = manifest + length;
+  for (size_t i = 0; i < count; ++i) {
+    TreeEntry *entry = &(*entries)[i];
+    if (p >= end) {
+      return false;
+    }
+    entry->kind = *p++;
+    entry->path = p;
+    entry->target = NULL;
+    entry->error = 0;
+    p = static_cast<const char *>(memchr(p, 0, end - p));
+    if (p == NULL) {
+      return false;
+    }
+    ++p;
+    if (entry->kind == TREE_SYMLINK) {
+      entry->target = p;
+      p = static_cast<const char *>(memchr(p, 0, end - p));
+      if (p == NULL) {
+        return false;
+      }
+      ++p;
+    }
+    // Absolute paths would ignore the root.
+    if (entry->path[0] == '\0' || entry->path[0] == '/') {
+      entry->error = EINVAL;
+    }
+  }
+  return p == end;
+}
+
+// Returns the number of directories above "path" in the tree.
+static size_t TreeDepth(const char *path) {
+  size_t depth = 0;
+  for (; *path != '\0'; ++path) {
+    if (*path == '/') {
+      ++depth;
+    }
+  }
+  return depth;
+}
+
+// Each entry is a single syscall relative to the root, so a thread needs a
+// fair number of them to pay off.
+static const size_t kMinEntriesPerTreeThread = 256;
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    createTreeNative
+ * Signature: (Ljava/lang/String;Ljava/nio/ByteBuffer;II)V
+ * Throws:    java.io.IOException
+ *
+ * Opens "root" once and, relative to it, first unlinks the files to unlink,
+ * then creates the directories level by level, so that parents come before
+ * their children whatever their order in the manifest, and finally creates the
+ * symlinks. Each step is spread over a few threads. Throws for the first entry
+ * of the manifest that failed, after all of them were tried.
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_createTreeNative(
+    JNIEnv *env, jclass clazz, jstring root, jobject manifest, jint length,
+    jint count) {
+  const char *manifest_chars =
+      reinterpret_cast<const char *>(env->GetDirectBufferAddress(manifest));
+  CHECK(manifest_chars != NULL);
+  CHECK(length >= 0 && env->GetDirectBufferCapacity(manifest) >= length);
+  std::vector<TreeEntry> entries;
+  if (!ParseTreeManifest(manifest_chars, length, count, &entries)) {
+    ::PostException(env, EINVAL, "Malformed tree manifest");
+    return;
+  }
+
+  ScopedLatin1Chars root_chars(env, root);
+  if (root_chars.get() == NULL) {
+    return;
+  }
+  TreeBatch batch;
+  while ((batch.root_fd = ::open(root_chars.get(),
+                                 O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1 &&
+         errno == EINTR) { }
+  if (batch.root_fd == -1) {
+    ::PostFileException(env, errno, root_chars.get());
+    return;
+  }
+
+  std::vector<TreeEntry *> unlinks;
+  std::vector<std::vector<TreeEntry *> > directories;
+  std::vector<TreeEntry *> symlinks;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    TreeEntry *entry = &entries[i];
+    if (entry->error != 0) {
+      continue;
+    }
+    if (entry->kind == TREE_UNLINK) {
+      unlinks.push_back(entry);
+    } else if (entry->kind == TREE_DIRECTORY) {
+      size_t depth = TreeDepth(entry->path);
+      if (directories.size() <= depth) {
+        directories.resize(depth + 1);
+      }
+      directories[depth].push_back(entry);
+    } else {
+      symlinks.push_back(entry);
+    }
+  }
+
+  if (!unlinks.empty()) {
+    batch.entries = &unlinks[0];
+    RunInParallel(unlinks.size(), kMinEntriesPerTreeThread, TreeBatchRange,
+                  &batch);
+  }
+  for (size_t depth = 0; depth < directories.size(); ++depth) {
+    if (!directories[depth].empty()) {
+      batch.entries = &directories[depth][0];
+      RunInParallel(directories[depth].size(), kMinEntriesPerTreeThread,
+                    TreeBatchRange, &batch);
+    }
+  }
+  if (!symlinks.empty()) {
+    batch.entries = &symlinks[0];
+    RunInParallel(symlinks.size(), kMinEntriesPerTreeThread, TreeBatchRange,
+                  &batch);
+  }
+  ::close(batch.root_fd);
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (entries[i].error != 0) {
+      std::string path = std::string(root_chars.get()) + "/" + entries[i].path;
+      ::PostFileException(env, entries[i].error, path.c_str());
+      return;
+    }
+  }
+}
+
+// Copies the rest of "in_fd" to "out_fd" within the kernel if possible, and
+// through "buf" of kDigestBufferSize bytes if not. Returns -1 with errno set on
+// failure.
+static int CopyFileData(int in_fd, int out_fd, char *buf) {
+  bool in_kernel = true;
+  for (;;) {
+    ssize_t r;
+    if (in_kernel) {
+      r = portable_copy_file_range(in_fd, out_fd, 1 << 30);
+      if (r == -1 && (errno == ENOSYS || errno == EINVAL)) {
+        in_kernel = false;
+        continue;
+      }
+    } else {
+      r = read(in_fd, buf, kDigestBufferSize);
+      for (ssize_t written = 0; written < r;) {
+        ssize_t w = write(out_fd, buf + written, r - written);
+        if (w == -1) {
+          if (errno == EINTR) {
+            continue;
+          }
+          return -1;
+        }
+        written += w;
+      }
+    }
+    if (r == 0) {
+      return 0;
+    } else if (r == -1 && errno != EINTR) {
+      return -1;
+    }
+  }
+}
+
+// Replaces "dst" with a copy of the file "src", cloning it if the file system
+// supports that. Returns -1 with errno set on failure.
+static int CloneOrCopyFile(const char *src, const char *dst, char *buf) {
+  if (unlink(dst) == -1 && errno != ENOENT) {
+    return -1;
+  }
+  if (portable_clonefile(src, dst) == 0) {
+    return 0;
+  } else if (errno != ENOTSUP) {
+    return -1;
+  }
+
+  int in_fd;
+  while ((in_fd = open(src, O_RDONLY | O_CLOEXEC)) == -1 && errno == EINTR) { }
+  if (in_fd == -1) {
+    return -1;
+  }
+  struct stat statbuf;
+  int r = fstat(in_fd, &statbuf);
+  int out_fd = -1;
+  if (r == 0) {
+    while ((out_fd = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                          statbuf.st_mode & 07777)) == -1 &&
+           errno == EINTR) { }
+    r = out_fd == -1 ? -1 : CopyFileData(in_fd, out_fd, buf);
+  }
+  int saved_errno = errno;
+  close(in_fd);
+  if (out_fd != -1) {
+    if (close(out_fd) == -1 && r == 0) {
+      r = -1;
+      saved_errno = errno;
+    }
+    if (r == -1) {
+      unlink(dst);
+    }
+  }
+  errno = saved_errno;
+  return r;
+}
+
+// Posts an IOException for copying "src" to "dst" that failed with "error".
+static void PostCopyException(JNIEnv *env, int error, const char *src,
+                              const char *dst) {
+  std::string filename = std::string(src) + " -> " + dst;
+  ::PostFileException(env, error, filename.c_str());
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    cloneOrCopy
+ * Signature: (Ljava/lang/String;Ljava/lang/String;)V
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_cloneOrCopy(
+    JNIEnv *env, jclass clazz, jstring src, jstring dst) {
+  ScopedLatin1Chars src_chars(env, src);
+  ScopedLatin1Chars dst_chars(env, dst);
+  if (src_chars.get() == NULL || dst_chars.get() == NULL) {
+    return;
+  }
+  std::vector<char> buf(kDigestBufferSize);
+  if (CloneOrCopyFile(src_chars.get(), dst_chars.get(), &buf[0]) == -1) {
+    PostCopyException(env, errno, src_chars.get(), dst_chars.get());
+  }
+}
+
+struct CopyBatch {
+  const char **srcs;
+  const char **dsts;
+  int *errors;
+};
+
+static void CopyBatchRange(size_t begin, size_t end, void *arg) {
+  const CopyBatch *batch = reinterpret_cast<CopyBatch *>(arg);
+  std::vector<char> buf(kDigestBufferSize);
+  for (size_t i = begin; i < end; ++i) {
+    if (batch->srcs[i] == NULL || batch->dsts[i] == NULL) {
+      batch->errors[i] = EINVAL;
+    } else if (CloneOrCopyFile(batch->srcs[i], batch->dsts[i], &buf[0]) ==
+               -1) {
+      batch->errors[i] = errno;
+    } else {
+      batch->errors[i] = 0;
+    }
+  }
+}
+
+// Like digests, every copy takes a few syscalls, and clones take hardly more.
+static const size_t kMinFilesPerCopyThread = 4;
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    cloneOrCopyBatch
+ * Signature: ([Ljava/lang/String;[Ljava/lang/String;)V
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_cloneOrCopyBatch(
+    JNIEnv *env, jclass clazz, jobjectArray srcs, jobjectArray dsts) {
+  if (env->GetArrayLength(srcs) != env->GetArrayLength(dsts)) {
+    ::PostException(env, EINVAL, "Different numbers of sources and targets");
+    return;
+  }
+  std::vector<const char *> src_chars;
+  if (!GetBatchPaths(env, srcs, &src_chars)) {
+    return;
+  }
+  std::vector<const char *> dst_chars;
+  if (!GetBatchPaths(env, dsts, &dst_chars)) {
+    ReleaseBatchPaths(src_chars);
+    return;
+  }
+  size_t count = src_chars.size();
+  std::vector<int> errors(count);
+  CopyBatch batch;
+  batch.srcs = count > 0 ? &src_chars[0] : NULL;
+  batch.dsts = count > 0 ? &dst_chars[0] : NULL;
+  batch.errors = count > 0 ? &errors[0] : NULL;
+  RunInParallel(count, kMinFilesPerCopyThread, CopyBatchRange, &batch);
+  for (size_t i = 0; i < count; ++i) {
+    if (errors[i] != 0) {
+      PostCopyException(env, errors[i],
+                        src_chars[i] != NULL ? src_chars[i] : "null",
+                        dst_chars[i] != NULL ? dst_chars[i] : "null");
+      break;
+    }
+  }
+  ReleaseBatchPaths(src_chars);
+  ReleaseBatchPaths(dst_chars);
+}
+
+// The slots of the buffer filled by a LoadSampler, as jlongs in the byte
+// order of the machine. Keep in sync with NativePosixSystem.LoadSampler.
+enum LoadSlot {
+  // Odd while the other slots are being written; see LoadSampler::Publish.
+  LOAD_SEQUENCE,
+  LOAD_SAMPLES,
+  // Over the last interval, in hundredths of a percent of all CPUs.
+  LOAD_CPU_BUSY,
+  LOAD_MEMORY_TOTAL,
+  LOAD_MEMORY_AVAILABLE,
+  LOAD_SWAP_TOTAL,
+  LOAD_SWAP_FREE,
+  LOAD_CPU_PRESSURE,
+  LOAD_MEMORY_PRESSURE,
+  LOAD_IO_PRESSURE,
+  LOAD_SLOTS,
+};
+
+// Samples the load of the system every interval on a native thread, into a
+// buffer that Java reads without calling into native code.
+struct LoadSampler {
+  jlong *slots;
+  int interval_ms;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  bool stop;  // guarded by mutex
+
+  // Writes "values" into the slots as a sequence lock: readers retry while
+  // the sequence is odd or changed under them.
+  void Publish(const jlong *values) {
+    jlong sequence = slots[LOAD_SEQUENCE];
+    __atomic_store_n(&slots[LOAD_SEQUENCE], sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (int i = LOAD_SEQUENCE + 1; i < LOAD_SLOTS; i++) {
+      __atomic_store_n(&slots[i], values[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&slots[LOAD_SEQUENCE], sequence + 2, __ATOMIC_RELEASE);
+  }
+};
+
+static void *LoadSamplerThread(void *arg) {
+  LoadSampler *sampler = reinterpret_cast<LoadSampler *>(arg);
+  jlong values[LOAD_SLOTS] = {0};
+  LoadSample previous;
+  previous.cpu_busy_ticks = previous.cpu_total_ticks = -1;
+  pthread_mutex_lock(&sampler->mutex);
+  while (!sampler->stop) {
+    pthread_mutex_unlock(&sampler->mutex);
+    LoadSample sample;
+    if (portable_sample_load(&sample) == 0) {
+      values[LOAD_SAMPLES]++;
+      int64_t total = sample.cpu_total_ticks - previous.cpu_total_ticks;
+      values[LOAD_CPU_BUSY] =
+          previous.cpu_total_ticks >= 0 && sample.cpu_total_ticks >= 0 &&
+                  total > 0
+              ? (sample.cpu_busy_ticks - previous.cpu_busy_ticks) * 10000 /
+                    total
+              : -1;
+      values[LOAD_MEMORY_TOTAL] = sample.memory_total_bytes;
+      values[LOAD_MEMORY_AVAILABLE] = sample.memory_available_bytes;
+      values[LOAD_SWAP_TOTAL] = sample.swap_total_bytes;
+      values[LOAD_SWAP_FREE] = sample.swap_free_bytes;
+      values[LOAD_CPU_PRESSURE] = sample.cpu_pressure;
+      values[LOAD_MEMORY_PRESSURE] = sample.memory_pressure;
+      values[LOAD_IO_PRESSURE] = sample.io_pressure;
+      sampler->Publish(values);
+      previous = sample;
+    }
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int64_t deadline_us = now.tv_sec * 1000000LL + now.tv_usec +
+                          sampler->interval_ms * 1000LL;
+    struct timespec deadline;
+    deadline.tv_sec = deadline_us / 1000000;
+    deadline.tv_nsec = (deadline_us % 1000000) * 1000;
+    pthread_mutex_lock(&sampler->mutex);
+    while (!sampler->stop &&
+           pthread_cond_timedwait(&sampler->cond, &sampler->mutex,
+                                  &deadline) != ETIMEDOUT) { }
+  }
+  pthread_mutex_unlock(&sampler->mutex);
+  return NULL;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixSystem
+ * Method:    startLoadSampler
+ * Signature: (Ljava/nio/ByteBuffer;I)J
+ */
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixSystem_startLoadSampler(
+    JNIEnv *env, jclass clazz, jobject buffer, jint interval_ms) {
+  jlong *slots = reinterpret_cast<jlong *>(env->GetDirectBufferAddress(buffer));
+  CHECK(slots != NULL);
+  CHECK(env->GetDirectBufferCapacity(buffer) >=
+        static_cast<jlong>(LOAD_SLOTS * sizeof(jlong)));
+  // The slots are written atomically, which needs them aligned.
+  CHECK(reinterpret_cast<uintptr_t>(slots) % sizeof(jlong) == 0);
+  for (int i = 0; i < LOAD_SLOTS; i++) {
+    slots[i] = i == LOAD_SEQUENCE || i == LOAD_SAMPLES ? 0 : -1;
+  }
+
+  LoadSampler *sampler = new LoadSampler;
+  sampler->slots = slots;
+  sampler->interval_ms = interval_ms;
+  sampler->stop = false;
+  pthread_mutex_init(&sampler->mutex, NULL);
+  pthread_cond_init(&sampler->cond, NULL);
+  int err = pthread_create(&sampler->thread, NULL, LoadSamplerThread, sampler);
+  if (err != 0) {
+    pthread_cond_destroy(&sampler->cond);
+    pthread_mutex_destroy(&sampler->mutex);
+    delete sampler;
+    ::PostException(env, err, "pthread_create");
+    return 0;
+  }
+  return reinterpret_cast<jlong>(sampler);
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixSystem
+ * Method:    stopLoadSampler
+ * Signature: (J)V
+ *
+ * Stops the thread of the sampler and frees it. The buffer is not written to
+ * after this returns.
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixSystem_stopLoadSampler(
+    JNIEnv *env, jclass clazz, jlong sampler_ptr) {
+  LoadSampler *sampler = reinterpret_cast<LoadSampler *>(sampler_ptr);
+  pthread_mutex_lock(&sampler->mutex);
+  sampler->stop = true;
+  pthread_cond_signal(&sampler->cond);
+  pthread_mutex_unlock(&sampler->mutex);
+  pthread_join(sampler->thread, NULL);
+  pthread_cond_destroy(&sampler->cond);
+  pthread_mutex_destroy(&sampler->mutex);
+  delete sampler;
+}
+
 extern "C" JNIEXPORT jlong JNICALL
 Java_com_google_devtools_build_lib_unix_NativePosixSystem_sysctlbynameGetLong(
     JNIEnv *env, jclass clazz, jstring name) {
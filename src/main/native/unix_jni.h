@@ -18,6 +18,7 @@
 #define BAZEL_SRC_MAIN_NATIVE_UNIX_JNI_H__
 
 #include <jni.h>
+#include <stdint.h>
 #include <sys/stat.h>
 
 #include <string>
@@ -63,6 +64,36 @@ extern void PostFileException(JNIEnv *env, int error_number,
 extern void PostSystemException(JNIEnv *env, int error_number,
                                 const char *name);
 
+// Returns a new Java String for the specified Latin1 characters.
+jstring NewStringLatin1(JNIEnv *env, const char *str);
+
+// Returns a nul-terminated Latin1-encoded byte array for the specified Java
+// string, or null on failure. Must be followed by a call to
+// ReleaseStringLatin1Chars.
+const char *GetStringLatin1Chars(JNIEnv *env, jstring jstr);
+
+// Releases the Latin1 chars returned by GetStringLatin1Chars.
+void ReleaseStringLatin1Chars(const char *s);
+
+// Like GetStringLatin1Chars, but strings shorter than the inline buffer (most
+// paths) are converted with a single GetStringRegion into that buffer,
+// without a malloc or a critical region. Released when it goes out of scope.
+class ScopedLatin1Chars {
+ public:
+  ScopedLatin1Chars(JNIEnv *env, jstring jstr);
+  ~ScopedLatin1Chars();
+
+  // Returns the characters, or NULL with an exception pending.
+  const char *get() const { return chars_; }
+
+ private:
+  ScopedLatin1Chars(const ScopedLatin1Chars &);
+  void operator=(const ScopedLatin1Chars &);
+
+  char buf_[256];
+  const char *chars_;
+};
+
 // Returns the standard error message for a given UNIX error number.
 extern std::string ErrorMessage(int error_number);
 
@@ -83,6 +114,28 @@ int StatSeconds(const portable_stat_struct &statbuf, StatTimes t);
 // Returns nanoseconds from a stat buffer.
 int StatNanoSeconds(const portable_stat_struct &statbuf, StatTimes t);
 
+// The fields to fetch with portable_statx. Keep in sync with
+// NativePosixFiles.StatBuffer.
+enum StatFields {
+  STAT_FIELD_TYPE = 1 << 0,  // st_mode: file type and permissions
+  STAT_FIELD_SIZE = 1 << 1,
+  STAT_FIELD_ATIME = 1 << 2,
+  STAT_FIELD_MTIME = 1 << 3,
+  STAT_FIELD_CTIME = 1 << 4,
+  STAT_FIELD_INO = 1 << 5,
+  STAT_ALL_FIELDS = (1 << 6) - 1,
+  // Not a field: lets network file systems answer from their attribute cache
+  // instead of asking the server.
+  STAT_DONT_SYNC = 1 << 8,
+};
+
+// Like stat(2) or lstat(2), but where the system has statx(2) only fetches
+// the "fields" (a mask of StatFields), which spares file systems such as NFS
+// and FUSE from revalidating the other attributes. The other fields of
+// "statbuf" are zero; st_dev is always filled in. Elsewhere, runs stat(2).
+int portable_statx(const char *path, bool follow_symlinks, int fields,
+                   portable_stat_struct *statbuf);
+
 // Runs getxattr(2), if available. If not, sets errno to ENOSYS.
 ssize_t portable_getxattr(const char *path, const char *name, void *value,
                           size_t size);
@@ -94,4 +147,37 @@ ssize_t portable_lgetxattr(const char *path, const char *name, void *value,
 // Run sysctlbyname(3), only available on darwin
 int portable_sysctlbyname(const char *name_chars, long *mibp, size_t *sizep);
 
+// Creates "dst" as a clone of the file "src" that shares its data, on file
+// systems that can do that (btrfs and XFS reflinks, APFS clones). If they
+// cannot, sets errno to ENOTSUP and leaves no "dst" behind.
+int portable_clonefile(const char *src, const char *dst);
+
+// System-wide load, as read by portable_sample_load. Fields that could not be
+// read are -1.
+struct LoadSample {
+  // Time spent by all CPUs since boot, in clock ticks: busy, and in total.
+  int64_t cpu_busy_ticks;
+  int64_t cpu_total_ticks;
+  int64_t memory_total_bytes;
+  // Memory that can be used without swapping, including reclaimable caches.
+  int64_t memory_available_bytes;
+  int64_t swap_total_bytes;
+  int64_t swap_free_bytes;
+  // The share of the last 10 seconds in which some tasks were stalled on the
+  // resource, in hundredths of a percent, from Linux pressure stall
+  // information.
+  int64_t cpu_pressure;
+  int64_t memory_pressure;
+  int64_t io_pressure;
+};
+
+// Fills "sample" with the current load of the system. Returns -1 with errno
+// set if none of it could be read.
+int portable_sample_load(LoadSample *sample);
+
+// Copies up to "size" bytes from "in_fd" to "out_fd" within the kernel,
+// advancing both offsets, like copy_file_range(2). Returns the number of bytes
+// copied, or -1 with errno set to ENOSYS if the platform cannot do that.
+ssize_t portable_copy_file_range(int in_fd, int out_fd, size_t size);
+
 #endif  // BAZEL_SRC_MAIN_NATIVE_UNIX_JNI_H__
@@ -14,9 +14,11 @@
 
 #include "src/main/native/unix_jni.h"
 
+#include <Availability.h>
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <mach/mach.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -24,6 +26,9 @@
 #include <sys/syslimits.h>
 #include <sys/types.h>
 #include <sys/xattr.h>
+#if __MAC_OS_X_VERSION_MIN_REQUIRED >= 101200
+#include <sys/clonefile.h>
+#endif
 
 #include <string>
 
@@ -103,6 +108,12 @@ int StatNanoSeconds(const portable_stat_struct &statbuf, StatTimes t) {
   }
 }
 
+int portable_statx(const char *path, bool follow_symlinks, int fields,
+                   portable_stat_struct *statbuf) {
+  return follow_symlinks ? portable_stat(path, statbuf)
+                         : portable_lstat(path, statbuf);
+}
+
 ssize_t portable_getxattr(const char *path, const char *name, void *value,
                           size_t size) {
   return getxattr(path, name, value, size, 0, 0);
@@ -116,3 +127,76 @@ ssize_t portable_lgetxattr(const char *path, const char *name, void *value,
 int portable_sysctlbyname(const char *name_chars, long *mibp, size_t *sizep) {
   return sysctlbyname(name_chars, mibp, sizep, NULL, 0);
 }
+
+int portable_clonefile(const char *src, const char *dst) {
+#if __MAC_OS_X_VERSION_MIN_REQUIRED >= 101200
+  int r = clonefile(src, dst, 0);
+  if (r == -1 && errno == EXDEV) {
+    errno = ENOTSUP;
+  }
+  return r;
+#else
+  errno = ENOTSUP;
+  return -1;
+#endif
+}
+
+int portable_sample_load(LoadSample *sample) {
+  bool found = false;
+  mach_port_t host = mach_host_self();
+  host_cpu_load_info_data_t cpu;
+  mach_msg_type_number_t count = HOST_CPU_LOAD_INFO_COUNT;
+  sample->cpu_busy_ticks = sample->cpu_total_ticks = -1;
+  if (host_statistics(host, HOST_CPU_LOAD_INFO,
+                      reinterpret_cast<host_info_t>(&cpu),
+                      &count) == KERN_SUCCESS) {
+    int64_t idle = cpu.cpu_ticks[CPU_STATE_IDLE];
+    sample->cpu_total_ticks = idle + cpu.cpu_ticks[CPU_STATE_USER] +
+                              cpu.cpu_ticks[CPU_STATE_SYSTEM] +
+                              cpu.cpu_ticks[CPU_STATE_NICE];
+    sample->cpu_busy_ticks = sample->cpu_total_ticks - idle;
+    found = true;
+  }
+
+  int64_t memsize;
+  size_t size = sizeof(memsize);
+  sample->memory_total_bytes =
+      sysctlbyname("hw.memsize", &memsize, &size, NULL, 0) == 0 ? memsize : -1;
+  vm_statistics64_data_t vm;
+  count = HOST_VM_INFO64_COUNT;
+  vm_size_t page_size;
+  sample->memory_available_bytes = -1;
+  if (host_page_size(host, &page_size) == KERN_SUCCESS &&
+      host_statistics64(host, HOST_VM_INFO64,
+                        reinterpret_cast<host_info64_t>(&vm),
+                        &count) == KERN_SUCCESS) {
+    // Like the "Memory Pressure" of Activity Monitor, count inactive and
+    // purgeable pages as available.
+    sample->memory_available_bytes =
+        static_cast<int64_t>(vm.free_count + vm.inactive_count +
+                             vm.purgeable_count) * page_size;
+    found = true;
+  }
+  mach_port_deallocate(mach_task_self(), host);
+
+  struct xsw_usage swap;
+  size = sizeof(swap);
+  if (sysctlbyname("vm.swapusage", &swap, &size, NULL, 0) == 0) {
+    sample->swap_total_bytes = swap.xsu_total;
+    sample->swap_free_bytes = swap.xsu_avail;
+  } else {
+    sample->swap_total_bytes = sample->swap_free_bytes = -1;
+  }
+  // There is no pressure stall information.
+  sample->cpu_pressure = sample->memory_pressure = sample->io_pressure = -1;
+  if (!found) {
+    errno = ENOSYS;
+    return -1;
+  }
+  return 0;
+}
+
+ssize_t portable_copy_file_range(int in_fd, int out_fd, size_t size) {
+  errno = ENOSYS;
+  return -1;
+}
@@ -70,6 +70,12 @@ int StatNanoSeconds(const portable_stat_struct &statbuf, StatTimes t) {
   }
 }
 
+int portable_statx(const char *path, bool follow_symlinks, int fields,
+                   portable_stat_struct *statbuf) {
+  return follow_symlinks ? portable_stat(path, statbuf)
+                         : portable_lstat(path, statbuf);
+}
+
 ssize_t portable_getxattr(const char *path, const char *name, void *value,
                           size_t size) {
   return extattr_get_file(path, EXTATTR_NAMESPACE_SYSTEM, name, value, size);
@@ -83,3 +89,18 @@ ssize_t portable_lgetxattr(const char *path, const char *name, void *value,
 int portable_sysctlbyname(const char *name_chars, long *mibp, size_t *sizep) {
   return sysctlbyname(name_chars, mibp, sizep, NULL, 0);
 }
+
+int portable_clonefile(const char *src, const char *dst) {
+  errno = ENOTSUP;
+  return -1;
+}
+
+int portable_sample_load(LoadSample *sample) {
+  errno = ENOSYS;
+  return -1;
+}
+
+ssize_t portable_copy_file_range(int in_fd, int out_fd, size_t size) {
+  errno = ENOSYS;
+  return -1;
+}
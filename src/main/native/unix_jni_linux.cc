@@ -15,11 +15,20 @@
 #include "src/main/native/unix_jni.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
 #include <sys/xattr.h>
+#include <unistd.h>
 
+#include <atomic>
 #include <string>
 
 std::string ErrorMessage(int error_number) {
@@ -65,6 +74,55 @@ int StatNanoSeconds(const portable_stat_struct &statbuf, StatTimes t) {
   return 0;
 }
 
+int portable_statx(const char *path, bool follow_symlinks, int fields,
+                   portable_stat_struct *statbuf) {
+#ifdef STATX_BASIC_STATS
+  // Set once the kernel turns out to predate statx (4.11).
+  static std::atomic<bool> no_statx(false);
+  if (fields != STAT_ALL_FIELDS && !no_statx.load(std::memory_order_relaxed)) {
+    unsigned int mask = 0;
+    if (fields & STAT_FIELD_TYPE) mask |= STATX_TYPE | STATX_MODE;
+    if (fields & STAT_FIELD_SIZE) mask |= STATX_SIZE;
+    if (fields & STAT_FIELD_ATIME) mask |= STATX_ATIME;
+    if (fields & STAT_FIELD_MTIME) mask |= STATX_MTIME;
+    if (fields & STAT_FIELD_CTIME) mask |= STATX_CTIME;
+    if (fields & STAT_FIELD_INO) mask |= STATX_INO;
+    int flags = (follow_symlinks ? 0 : AT_SYMLINK_NOFOLLOW) |
+                ((fields & STAT_DONT_SYNC) ? AT_STATX_DONT_SYNC : 0);
+    struct statx stx;
+    if (statx(AT_FDCWD, path, flags, mask, &stx) == 0) {
+      // File systems may return more fields than asked for, or fewer.
+      memset(statbuf, 0, sizeof(*statbuf));
+      statbuf->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+      if (stx.stx_mask & (STATX_TYPE | STATX_MODE)) {
+        statbuf->st_mode = stx.stx_mode;
+      }
+      if (stx.stx_mask & STATX_SIZE) statbuf->st_size = stx.stx_size;
+      if (stx.stx_mask & STATX_INO) statbuf->st_ino = stx.stx_ino;
+      if (stx.stx_mask & STATX_ATIME) {
+        statbuf->st_atim.tv_sec = stx.stx_atime.tv_sec;
+        statbuf->st_atim.tv_nsec = stx.stx_atime.tv_nsec;
+      }
+      if (stx.stx_mask & STATX_MTIME) {
+        statbuf->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+        statbuf->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+      }
+      if (stx.stx_mask & STATX_CTIME) {
+        statbuf->st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+        statbuf->st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+      }
+      return 0;
+    }
+    if (errno != ENOSYS) {
+      return -1;
+    }
+    no_statx.store(true, std::memory_order_relaxed);
+  }
+#endif  // STATX_BASIC_STATS
+  return follow_symlinks ? portable_stat(path, statbuf)
+                         : portable_lstat(path, statbuf);
+}
+
 ssize_t portable_getxattr(const char *path, const char *name, void *value,
                           size_t size) {
   return ::getxattr(path, name, value, size);
@@ -79,3 +137,140 @@ int portable_sysctlbyname(const char *name_chars, long *mibp, size_t *sizep) {
   errno = ENOSYS;
   return -1;
 }
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+int portable_clonefile(const char *src, const char *dst) {
+  int src_fd = open(src, O_RDONLY | O_CLOEXEC);
+  if (src_fd == -1) {
+    return -1;
+  }
+  struct stat statbuf;
+  if (fstat(src_fd, &statbuf) == -1) {
+    int saved_errno = errno;
+    close(src_fd);
+    errno = saved_errno;
+    return -1;
+  }
+  int dst_fd = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                    statbuf.st_mode & 07777);
+  if (dst_fd == -1) {
+    int saved_errno = errno;
+    close(src_fd);
+    errno = saved_errno;
+    return -1;
+  }
+  int r = ioctl(dst_fd, FICLONE, src_fd);
+  int saved_errno = errno;
+  close(src_fd);
+  if (close(dst_fd) == -1 && r == 0) {
+    r = -1;
+    saved_errno = errno;
+  }
+  if (r == -1) {
+    unlink(dst);
+    // The file system cannot clone, or not across file systems, or the kernel
+    // is too old to know FICLONE.
+    if (saved_errno == EOPNOTSUPP || saved_errno == EXDEV ||
+        saved_errno == EINVAL || saved_errno == ENOTTY) {
+      saved_errno = ENOTSUP;
+    }
+  }
+  errno = saved_errno;
+  return r;
+}
+
+// Reads up to "size" - 1 bytes of the file "path" into "buf" and terminates
+// them with a NUL. Returns false if the file could not be read.
+static bool ReadProcFile(const char *path, char *buf, size_t size) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return false;
+  }
+  ssize_t length = read(fd, buf, size - 1);
+  int saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  if (length < 0) {
+    return false;
+  }
+  buf[length] = '\0';
+  return true;
+}
+
+// Returns the value in kB after "key" in the contents of /proc/meminfo, in
+// bytes, or -1 if there is none.
+static int64_t MeminfoBytes(const char *meminfo, const char *key) {
+  const char *line = strstr(meminfo, key);
+  long long kb;
+  if (line == NULL || sscanf(line + strlen(key), " %lld", &kb) != 1) {
+    return -1;
+  }
+  return kb * 1024;
+}
+
+// Returns "some avg10" of the pressure stall information file "path", in
+// hundredths of a percent, or -1 if it cannot be read (before Linux 4.20 or
+// without CONFIG_PSI).
+static int64_t Pressure(const char *path) {
+  char buf[256];
+  unsigned int percent, hundredths;
+  if (!ReadProcFile(path, buf, sizeof(buf)) ||
+      sscanf(buf, "some avg10=%u.%u", &percent, &hundredths) != 2) {
+    return -1;
+  }
+  return percent * 100 + hundredths;
+}
+
+int portable_sample_load(LoadSample *sample) {
+  char buf[4096];
+  bool found = false;
+  sample->cpu_busy_ticks = sample->cpu_total_ticks = -1;
+  if (ReadProcFile("/proc/stat", buf, sizeof(buf))) {
+    unsigned long long ticks[8];
+    if (sscanf(buf, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &ticks[0],
+               &ticks[1], &ticks[2], &ticks[3], &ticks[4], &ticks[5],
+               &ticks[6], &ticks[7]) == 8) {
+      // user nice system idle iowait irq softirq steal
+      int64_t total = 0;
+      for (int i = 0; i < 8; i++) {
+        total += ticks[i];
+      }
+      sample->cpu_total_ticks = total;
+      sample->cpu_busy_ticks = total - ticks[3] - ticks[4];
+      found = true;
+    }
+  }
+  sample->memory_total_bytes = sample->memory_available_bytes = -1;
+  sample->swap_total_bytes = sample->swap_free_bytes = -1;
+  if (ReadProcFile("/proc/meminfo", buf, sizeof(buf))) {
+    sample->memory_total_bytes = MeminfoBytes(buf, "MemTotal:");
+    sample->memory_available_bytes = MeminfoBytes(buf, "MemAvailable:");
+    sample->swap_total_bytes = MeminfoBytes(buf, "SwapTotal:");
+    sample->swap_free_bytes = MeminfoBytes(buf, "SwapFree:");
+    found = true;
+  }
+  sample->cpu_pressure = Pressure("/proc/pressure/cpu");
+  sample->memory_pressure = Pressure("/proc/pressure/memory");
+  sample->io_pressure = Pressure("/proc/pressure/io");
+  if (!found) {
+    return -1;
+  }
+  return 0;
+}
+
+ssize_t portable_copy_file_range(int in_fd, int out_fd, size_t size) {
+#ifdef __NR_copy_file_range
+  // Called through syscall(2), as older C libraries have no wrapper.
+  ssize_t r = syscall(__NR_copy_file_range, in_fd, NULL, out_fd, NULL, size,
+                      0);
+  // Before Linux 5.3 it cannot copy across file systems.
+  if (r != -1 || (errno != ENOSYS && errno != EXDEV && errno != EINVAL &&
+                  errno != EOPNOTSUPP)) {
+    return r;
+  }
+#endif
+  return sendfile(out_fd, in_fd, NULL, size);
+}
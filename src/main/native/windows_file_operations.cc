@@ -13,6 +13,9 @@
 // limitations under the License.
 
 #include <jni.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wchar.h>
 #include <windows.h>
 
 #include <string>
@@ -71,3 +74,185 @@ Java_com_google_devtools_build_lib_windows_WindowsFileOperations_nativeIsJunctio
   env->ReleaseStringUTFChars(path, path_cstr);
   return result;
 }
+
+// Keep in sync with WindowsFileOperations.DirectoryEntries. Each entry of
+// nativeReadDirectory() is, in native byte order: int32 attributes, int32
+// name length in UTF-16 code units, int64 size, int64 creation, last access
+// and last write times in milliseconds since the epoch, int32 reparse tag,
+// int32 reparse target length in UTF-16 code units, then the name and the
+// reparse target.
+
+// The REPARSE_DATA_BUFFER of the DDK, for junctions and symlinks only.
+struct ReparseData {
+  ULONG tag;
+  USHORT data_length;
+  USHORT reserved;
+  USHORT substitute_name_offset;
+  USHORT substitute_name_length;
+  USHORT print_name_offset;
+  USHORT print_name_length;
+  // Symlinks have a ULONG of flags here, junctions don't.
+  WCHAR path_buffer[1];
+};
+
+// The number of milliseconds between 1601-01-01 and 1970-01-01.
+static const int64_t kFileTimeEpochMillis = 11644473600000LL;
+
+static int64_t FileTimeToMillis(const FILETIME& time) {
+  ULARGE_INTEGER value;
+  value.LowPart = time.dwLowDateTime;
+  value.HighPart = time.dwHighDateTime;
+  // FILETIME counts 100 nanoseconds.
+  return static_cast<int64_t>(value.QuadPart / 10000) - kFileTimeEpochMillis;
+}
+
+static void AppendBytes(std::string* out, const void* data, size_t size) {
+  out->append(reinterpret_cast<const char*>(data), size);
+}
+
+// Stores the error message for the last error of "function" on "path" in the
+// first element of "error_msg_holder", if it has one.
+static void ReportError(JNIEnv* env, jobjectArray error_msg_holder,
+                        const char* function, jstring path) {
+  if (error_msg_holder == NULL || env->GetArrayLength(error_msg_holder) == 0) {
+    return;
+  }
+  DWORD error = GetLastError();
+  const char* path_cstr = env->GetStringUTFChars(path, NULL);
+  std::string cause = std::string(function) + "(" + path_cstr + ")";
+  env->ReleaseStringUTFChars(path, path_cstr);
+  SetLastError(error);
+  std::string error_str = GetLastErrorString(cause);
+  env->SetObjectArrayElement(error_msg_holder, 0,
+                             env->NewStringUTF(error_str.c_str()));
+}
+
+// Reads the target of the junction or symlink "path" into "target". Returns
+// false for other reparse points, and if the target cannot be read.
+static bool ReadReparseTarget(const std::wstring& path, std::wstring* target) {
+  HANDLE handle = CreateFileW(
+      path.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+      NULL, OPEN_EXISTING,
+      FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS, NULL);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  // Aligned for the USHORTs and ULONGs of ReparseData.
+  ULONG buffer[MAXIMUM_REPARSE_DATA_BUFFER_SIZE / sizeof(ULONG)];
+  DWORD size = 0;
+  BOOL ok = DeviceIoControl(handle, FSCTL_GET_REPARSE_POINT, NULL, 0, buffer,
+                            sizeof(buffer), &size, NULL);
+  CloseHandle(handle);
+  const ReparseData* data = reinterpret_cast<const ReparseData*>(buffer);
+  if (!ok || size < offsetof(ReparseData, path_buffer)) {
+    return false;
+  }
+  const char* names;
+  if (data->tag == IO_REPARSE_TAG_MOUNT_POINT) {
+    names = reinterpret_cast<const char*>(data->path_buffer);
+  } else if (data->tag == IO_REPARSE_TAG_SYMLINK) {
+    names = reinterpret_cast<const char*>(data->path_buffer) + sizeof(ULONG);
+  } else {
+    return false;
+  }
+  // The offsets and lengths are in bytes. The print name is the path as the
+  // user gave it; the substitute name is the NT path, "\??\C:\...".
+  USHORT offset = data->print_name_offset;
+  USHORT length = data->print_name_length;
+  if (length == 0) {
+    offset = data->substitute_name_offset;
+    length = data->substitute_name_length;
+  }
+  const char* end = reinterpret_cast<const char*>(buffer) + size;
+  if (names + offset + length > end) {
+    return false;
+  }
+  target->assign(reinterpret_cast<const wchar_t*>(names + offset),
+                 length / sizeof(wchar_t));
+  if (target->compare(0, 4, L"\\??\\") == 0) {
+    target->erase(0, 4);
+  }
+  return true;
+}
+
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_com_google_devtools_build_lib_windows_WindowsFileOperations_nativeReadDirectory(
+    JNIEnv* env, jclass clazz, jstring path, jboolean read_reparse_targets,
+    jobjectArray error_msg_holder) {
+  const jchar* path_chars = env->GetStringChars(path, NULL);
+  std::wstring pattern(reinterpret_cast<const wchar_t*>(path_chars),
+                       env->GetStringLength(path));
+  env->ReleaseStringChars(path, path_chars);
+  if (!pattern.empty() && pattern.back() != L'\\' && pattern.back() != L'/') {
+    pattern.push_back(L'\\');
+  }
+  // The directory, to which the names of the entries are appended.
+  const size_t dir_length = pattern.size();
+  pattern.push_back(L'*');
+
+  // FindExInfoBasic skips the short names and FIND_FIRST_EX_LARGE_FETCH asks
+  // for bigger batches from the filesystem; both need Windows 7.
+  WIN32_FIND_DATAW data;
+  HANDLE find = FindFirstFileExW(pattern.c_str(), FindExInfoBasic, &data,
+                                 FindExSearchNameMatch, NULL,
+                                 FIND_FIRST_EX_LARGE_FETCH);
+  std::string entries;
+  if (find == INVALID_HANDLE_VALUE) {
+    if (GetLastError() == ERROR_FILE_NOT_FOUND) {
+      // Only happens for empty root directories, which lack "." and "..".
+      return env->NewByteArray(0);
+    }
+    ReportError(env, error_msg_holder, "FindFirstFileExW", path);
+    return NULL;
+  }
+  do {
+    const wchar_t* name = data.cFileName;
+    if (wcscmp(name, L".") == 0 || wcscmp(name, L"..") == 0) {
+      continue;
+    }
+    int32_t attributes = data.dwFileAttributes;
+    int32_t name_length = wcslen(name);
+    int64_t size =
+        (static_cast<int64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+    int64_t times[3] = {
+        FileTimeToMillis(data.ftCreationTime),
+        FileTimeToMillis(data.ftLastAccessTime),
+        FileTimeToMillis(data.ftLastWriteTime),
+    };
+    // The enumeration has the reparse tags of the entries, so only the
+    // targets of the junctions and symlinks need a call of their own.
+    int32_t reparse_tag = 0;
+    std::wstring target;
+    if (attributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+      reparse_tag = data.dwReserved0;
+      if (read_reparse_targets &&
+          (reparse_tag == IO_REPARSE_TAG_MOUNT_POINT ||
+           reparse_tag == IO_REPARSE_TAG_SYMLINK)) {
+        ReadReparseTarget(pattern.substr(0, dir_length) + name, &target);
+      }
+    }
+    int32_t target_length = target.size();
+    AppendBytes(&entries, &attributes, sizeof(attributes));
+    AppendBytes(&entries, &name_length, sizeof(name_length));
+    AppendBytes(&entries, &size, sizeof(size));
+    AppendBytes(&entries, times, sizeof(times));
+    AppendBytes(&entries, &reparse_tag, sizeof(reparse_tag));
+    AppendBytes(&entries, &target_length, sizeof(target_length));
+    AppendBytes(&entries, name, name_length * sizeof(wchar_t));
+    AppendBytes(&entries, target.data(), target_length * sizeof(wchar_t));
+  } while (FindNextFileW(find, &data));
+  DWORD error = GetLastError();
+  FindClose(find);
+  if (error != ERROR_NO_MORE_FILES) {
+    SetLastError(error);
+    ReportError(env, error_msg_holder, "FindNextFileW", path);
+    return NULL;
+  }
+
+  jbyteArray result = env->NewByteArray(entries.size());
+  if (result != NULL) {
+    env->SetByteArrayRegion(result, 0, entries.size(),
+                            reinterpret_cast<const jbyte*>(entries.data()));
+  }
+  return result;
+}
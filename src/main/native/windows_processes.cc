@@ -20,6 +20,7 @@
 #include <windows.h>
 
 #include <atomic>
+#include <memory>
 #include <string>
 
 #include "src/main/native/windows_error_handling.h"
@@ -30,10 +31,17 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeGetpid(
   return GetCurrentProcessId();
 }
 
+// The most nativeReadStream() reads at once. Pipes rarely hold more.
+static const DWORD kReadBufferSize = 64 * 1024;
+
 struct NativeOutputStream {
   HANDLE handle_;
   std::string error_;
   std::atomic<bool> closed_;
+  // Where nativeReadStream() reads to before copying the bytes it got to the
+  // Java array. Allocated on the first read; reads of a stream are serialized
+  // on the Java side.
+  std::unique_ptr<jbyte[]> buffer_;
   NativeOutputStream()
       : handle_(INVALID_HANDLE_VALUE),
         error_(""),
@@ -59,6 +67,11 @@ struct NativeProcess {
   HANDLE job_;
   DWORD pid_;
   std::string error_;
+  // The registration of nativeNotifyOnExit(), and the global reference to the
+  // WindowsProcesses.ExitCallback to call, until it is called.
+  HANDLE exit_wait_;
+  jobject exit_callback_;
+  jmethodID exit_method_;
 
   NativeProcess()
       : stdin_(INVALID_HANDLE_VALUE),
@@ -66,7 +79,10 @@ struct NativeProcess {
         stderr_(),
         process_(INVALID_HANDLE_VALUE),
         job_(INVALID_HANDLE_VALUE),
-        error_("") {}
+        error_(""),
+        exit_wait_(NULL),
+        exit_callback_(NULL),
+        exit_method_(NULL) {}
 };
 
 static bool NestedJobsSupported() {
@@ -121,8 +137,13 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeCreateProcess(
   HANDLE thread = INVALID_HANDLE_VALUE;
   HANDLE event = INVALID_HANDLE_VALUE;
   PROCESS_INFORMATION process_info = {0};
-  STARTUPINFO startup_info = {0};
+  STARTUPINFOEX startup_info = {0};
   JOBOBJECT_EXTENDED_LIMIT_INFORMATION job_info = {0};
+  HANDLE inherited_handles[3];
+  DWORD inherited_count = 0;
+  SIZE_T attribute_list_size = 0;
+  std::unique_ptr<char[]> attribute_list_buffer;
+  LPPROC_THREAD_ATTRIBUTE_LIST attribute_list = NULL;
 
   if (java_env != NULL) {
     env_size = env->GetArrayLength(java_env);
@@ -141,6 +162,9 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeCreateProcess(
     result->error_ = GetLastErrorString("CreatePipe(stdin)");
     goto cleanup;
   }
+  // Our ends of the pipes are inherited by no process. The child's ends are
+  // only inherited by the child, through the handle list below.
+  SetHandleInformation(result->stdin_, HANDLE_FLAG_INHERIT, 0);
 
   if (stdout_redirect != NULL) {
     stdout_process = CreateFile(
@@ -161,6 +185,7 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeCreateProcess(
       result->error_ = GetLastErrorString("CreatePipe(stdout)");
       goto cleanup;
     }
+    SetHandleInformation(result->stdout_.handle_, HANDLE_FLAG_INHERIT, 0);
   }
 
   if (stderr_redirect != NULL) {
@@ -186,6 +211,7 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeCreateProcess(
       result->error_ = GetLastErrorString("CreatePipe(stderr)");
       goto cleanup;
     }
+    SetHandleInformation(result->stderr_.handle_, HANDLE_FLAG_INHERIT, 0);
   }
 
 
@@ -210,10 +236,40 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeCreateProcess(
       goto cleanup;
   }
 
-  startup_info.hStdInput = stdin_process;
-  startup_info.hStdOutput = stdout_process;
-  startup_info.hStdError = stderr_process;
-  startup_info.dwFlags |= STARTF_USESTDHANDLES;
+  startup_info.StartupInfo.cb = sizeof(startup_info);
+  startup_info.StartupInfo.hStdInput = stdin_process;
+  startup_info.StartupInfo.hStdOutput = stdout_process;
+  startup_info.StartupInfo.hStdError = stderr_process;
+  startup_info.StartupInfo.dwFlags |= STARTF_USESTDHANDLES;
+
+  // Without a handle list, the process would inherit every inheritable handle
+  // of the server, such as the pipes of the processes created concurrently,
+  // and keep them open as long as it runs. The list must not have duplicates.
+  inherited_handles[inherited_count++] = stdin_process;
+  inherited_handles[inherited_count++] = stdout_process;
+  if (stderr_process != stdout_process) {
+    inherited_handles[inherited_count++] = stderr_process;
+  }
+  InitializeProcThreadAttributeList(NULL, 1, 0, &attribute_list_size);
+  attribute_list_buffer.reset(new char[attribute_list_size]);
+  if (!InitializeProcThreadAttributeList(
+          reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(
+              attribute_list_buffer.get()),
+          1, 0, &attribute_list_size)) {
+    result->error_ = GetLastErrorString("InitializeProcThreadAttributeList()");
+    goto cleanup;
+  }
+  attribute_list = reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(
+      attribute_list_buffer.get());
+  if (!UpdateProcThreadAttribute(attribute_list, 0,
+                                 PROC_THREAD_ATTRIBUTE_HANDLE_LIST,
+                                 inherited_handles,
+                                 inherited_count * sizeof(HANDLE), NULL,
+                                 NULL)) {
+    result->error_ = GetLastErrorString("UpdateProcThreadAttribute()");
+    goto cleanup;
+  }
+  startup_info.lpAttributeList = attribute_list;
 
   BOOL ok = CreateProcess(
       NULL,
@@ -223,10 +279,11 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeCreateProcess(
       TRUE,
       CREATE_NO_WINDOW  // Don't create a console window
           | CREATE_NEW_PROCESS_GROUP   // So that Ctrl-Break is not propagated
-          | CREATE_SUSPENDED,  // So that it doesn't start a new job itself
+          | CREATE_SUSPENDED  // So that it doesn't start a new job itself
+          | EXTENDED_STARTUPINFO_PRESENT,  // For the handle list
       env_bytes,
       cwd,
-      &startup_info,
+      &startup_info.StartupInfo,
       &process_info);
 
   if (!ok) {
@@ -284,9 +341,15 @@ cleanup:
     CloseHandle(thread);
   }
 
+  if (attribute_list != NULL) {
+    DeleteProcThreadAttributeList(attribute_list);
+  }
+
   delete[] mutable_commandline;
   if (env_bytes != NULL) {
-    env->ReleaseByteArrayElements(java_env, env_bytes, 0);
+    // The environment block is shared between processes on the Java side and
+    // was not modified, so it's not copied back.
+    env->ReleaseByteArrayElements(java_env, env_bytes, JNI_ABORT);
   }
   env->ReleaseStringUTFChars(java_commandline, commandline);
 
@@ -363,9 +426,18 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeReadStream(
     return -1;
   }
 
-  jbyte* bytes = env->GetByteArrayElements(java_bytes, NULL);
+  // Reading into the Java array directly would mean GetByteArrayElements(),
+  // which may copy the whole array both ways for every read; copy just the
+  // bytes read instead.
+  if (!stream->buffer_) {
+    stream->buffer_.reset(new jbyte[kReadBufferSize]);
+  }
+  DWORD to_read = static_cast<DWORD>(length) < kReadBufferSize
+                      ? static_cast<DWORD>(length)
+                      : kReadBufferSize;
   DWORD bytes_read;
-  if (!ReadFile(stream->handle_, bytes + offset, length, &bytes_read, NULL)) {
+  if (!ReadFile(stream->handle_, stream->buffer_.get(), to_read, &bytes_read,
+                NULL)) {
     // Check if either the other end closed the pipe or we did it with
     // NativeOutputStream.close() . In the latter case, we'll get a "system
     // call interrupted" error.
@@ -379,9 +451,9 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeReadStream(
     }
   } else {
     stream->error_ = "";
+    env->SetByteArrayRegion(java_bytes, offset, bytes_read,
+                            stream->buffer_.get());
   }
-
-  env->ReleaseByteArrayElements(java_bytes, bytes, 0);
   return bytes_read;
 }
 
@@ -398,6 +470,28 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeGetExitCode(
   return exit_code;
 }
 
+// Closes the pipe handles so that any pending nativeReadStream() calls
+// return. This will call CancelIoEx() on the file handles in order to make
+// ReadFile() in nativeReadStream() return; otherwise, CloseHandle() would
+// hang.
+//
+// This protects against a subprocess being created, it passing the write
+// side of the stdout/stderr pipes to a subprocess, then dying. In that case,
+// if we didn't do this, the Java side of the code would hang waiting for the
+// streams to finish.
+//
+// An alternative implementation would be to rely on job control terminating
+// the subprocesses, but we don't want to assume that it's always available.
+static void CloseStreamsOfExitedProcess(NativeProcess* process) {
+  process->stdout_.close();
+  process->stderr_.close();
+
+  if (process->stdin_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(process->stdin_);
+    process->stdin_ = INVALID_HANDLE_VALUE;
+  }
+}
+
 // return values:
 // 0: Wait completed successfully
 // 1: Timeout
@@ -428,27 +522,80 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeWaitFor(
       break;
   }
 
-  // Close the pipe handles so that any pending nativeReadStream() calls
-  // return. This will call CancelIoEx() on the file handles in order to make
-  // ReadFile() in nativeReadStream() return; otherwise, CloseHandle() would
-  // hang.
-  //
-  // This protects against a subprocess being created, it passing the write
-  // side of the stdout/stderr pipes to a subprocess, then dying. In that case,
-  // if we didn't do this, the Java side of the code would hang waiting for the
-  // streams to finish.
-  //
-  // An alternative implementation would be to rely on job control terminating
-  // the subprocesses, but we don't want to assume that it's always available.
-  process->stdout_.close();
-  process->stderr_.close();
+  CloseStreamsOfExitedProcess(process);
+  return result;
+}
 
-  if (process->stdin_ != INVALID_HANDLE_VALUE) {
-    CloseHandle(process->stdin_);
-    process->stdin_ = INVALID_HANDLE_VALUE;
+// The JVM, for the threads running ProcessExited() to attach to.
+static JavaVM* java_vm = NULL;
+
+static bool TerminateProcessAndJob(NativeProcess* process, std::string* error);
+
+// Called by the thread pool of Windows when the process of nativeNotifyOnExit()
+// exits or its timeout expires, once.
+static VOID CALLBACK ProcessExited(PVOID context, BOOLEAN timed_out) {
+  NativeProcess* process = static_cast<NativeProcess*>(context);
+  jint result = 0;
+  if (timed_out) {
+    // Not the error_ of the process, which a Java thread may be using.
+    std::string error;
+    TerminateProcessAndJob(process, &error);
+    result = 1;
+  }
+  CloseStreamsOfExitedProcess(process);
+
+  JNIEnv* env;
+  if (java_vm->AttachCurrentThreadAsDaemon(reinterpret_cast<void**>(&env),
+                                           NULL) != JNI_OK) {
+    return;
+  }
+  jobject callback = process->exit_callback_;
+  process->exit_callback_ = NULL;
+  env->CallVoidMethod(callback, process->exit_method_, result);
+  if (env->ExceptionCheck()) {
+    env->ExceptionDescribe();
+    env->ExceptionClear();
+  }
+  env->DeleteGlobalRef(callback);
+  java_vm->DetachCurrentThread();
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeNotifyOnExit(
+    JNIEnv* env, jclass clazz, jlong process_long, jlong java_timeout,
+    jobject callback) {
+  NativeProcess* process = reinterpret_cast<NativeProcess*>(process_long);
+  if (process->exit_wait_ != NULL) {
+    process->error_ = "Already waiting for the process";
+    return JNI_FALSE;
+  }
+  if (java_vm == NULL && env->GetJavaVM(&java_vm) != JNI_OK) {
+    process->error_ = "GetJavaVM() failed";
+    return JNI_FALSE;
+  }
+  jclass callback_class = env->GetObjectClass(callback);
+  process->exit_method_ =
+      env->GetMethodID(callback_class, "processExited", "(I)V");
+  env->DeleteLocalRef(callback_class);
+  if (process->exit_method_ == NULL) {
+    env->ExceptionClear();
+    process->error_ = "No processExited(int) method in the callback";
+    return JNI_FALSE;
   }
 
-  return result;
+  process->exit_callback_ = env->NewGlobalRef(callback);
+  DWORD win32_timeout = java_timeout < 0 ? INFINITE : java_timeout;
+  if (!RegisterWaitForSingleObject(&process->exit_wait_, process->process_,
+                                   ProcessExited, process, win32_timeout,
+                                   WT_EXECUTEONLYONCE)) {
+    process->error_ = GetLastErrorString("RegisterWaitForSingleObject()");
+    env->DeleteGlobalRef(process->exit_callback_);
+    process->exit_callback_ = NULL;
+    process->exit_wait_ = NULL;
+    return JNI_FALSE;
+  }
+  process->error_ = "";
+  return JNI_TRUE;
 }
 
 extern "C" JNIEXPORT jint JNICALL
@@ -463,19 +610,139 @@ extern "C" JNIEXPORT jboolean JNICALL
 Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeTerminate(
     JNIEnv *env, jclass clazz, jlong process_long) {
   NativeProcess* process = reinterpret_cast<NativeProcess*>(process_long);
+  return TerminateProcessAndJob(process, &process->error_) ? JNI_TRUE
+                                                            : JNI_FALSE;
+}
 
+// Terminates the process and the other processes of its job. Returns whether
+// that succeeded, and sets "error" to why not.
+static bool TerminateProcessAndJob(NativeProcess* process, std::string* error) {
   if (process->job_ != INVALID_HANDLE_VALUE) {
     // In theory, CloseHandle() on process->job_ would work, too, since we set
     // KILL_OBJECT_LIMIT_KILL_ON_JOB_CLOSE, but this is a little more explicit.
     if (!TerminateJobObject(process->job_, 0)) {
-      process->error_ = GetLastErrorString("TerminateJobObject()");
-      return JNI_FALSE;
+      *error = GetLastErrorString("TerminateJobObject()");
+      return false;
     }
   } else if (process->process_ != INVALID_HANDLE_VALUE) {
     if (!TerminateProcess(process->process_, 1)) {
-      process->error_ = GetLastErrorString("TerminateProcess()");
+      *error = GetLastErrorString("TerminateProcess()");
+      return false;
+    }
+  }
+
+  error->clear();
+  return true;
+}
+
+// The indices of the nativeGetResourceUsage() results; keep in sync with
+// WindowsProcesses.java.
+enum ResourceUsageIndex {
+  USAGE_USER_TIME_MILLIS,
+  USAGE_KERNEL_TIME_MILLIS,
+  USAGE_READ_BYTES,
+  USAGE_WRITE_BYTES,
+  USAGE_READ_OPERATIONS,
+  USAGE_WRITE_OPERATIONS,
+  USAGE_PEAK_MEMORY_BYTES,
+  USAGE_TOTAL_PROCESSES,
+  USAGE_COUNT,
+};
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeGetResourceUsage(
+    JNIEnv* env, jclass clazz, jlong process_long, jlongArray java_usage) {
+  NativeProcess* process = reinterpret_cast<NativeProcess*>(process_long);
+
+  if (env->GetArrayLength(java_usage) < USAGE_COUNT) {
+    process->error_ = "Resource usage array too short";
+    return JNI_FALSE;
+  }
+  if (process->job_ == INVALID_HANDLE_VALUE) {
+    process->error_ = "Process is not in a job object of its own";
+    return JNI_FALSE;
+  }
+
+  JOBOBJECT_BASIC_AND_IO_ACCOUNTING_INFORMATION accounting = {0};
+  if (!QueryInformationJobObject(process->job_,
+                                 JobObjectBasicAndIoAccountingInformation,
+                                 &accounting, sizeof(accounting), NULL)) {
+    process->error_ = GetLastErrorString("QueryInformationJobObject()");
+    return JNI_FALSE;
+  }
+  JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits = {0};
+  if (!QueryInformationJobObject(process->job_,
+                                 JobObjectExtendedLimitInformation, &limits,
+                                 sizeof(limits), NULL)) {
+    process->error_ = GetLastErrorString("QueryInformationJobObject()");
+    return JNI_FALSE;
+  }
+
+  // The times are in units of 100 nanoseconds.
+  jlong usage[USAGE_COUNT];
+  usage[USAGE_USER_TIME_MILLIS] =
+      accounting.BasicInfo.TotalUserTime.QuadPart / 10000;
+  usage[USAGE_KERNEL_TIME_MILLIS] =
+      accounting.BasicInfo.TotalKernelTime.QuadPart / 10000;
+  usage[USAGE_READ_BYTES] = accounting.IoInfo.ReadTransferCount;
+  usage[USAGE_WRITE_BYTES] = accounting.IoInfo.WriteTransferCount;
+  usage[USAGE_READ_OPERATIONS] = accounting.IoInfo.ReadOperationCount;
+  usage[USAGE_WRITE_OPERATIONS] = accounting.IoInfo.WriteOperationCount;
+  usage[USAGE_PEAK_MEMORY_BYTES] = limits.PeakJobMemoryUsed;
+  usage[USAGE_TOTAL_PROCESSES] = accounting.BasicInfo.TotalProcesses;
+  env->SetLongArrayRegion(java_usage, 0, USAGE_COUNT, usage);
+  process->error_ = "";
+  return JNI_TRUE;
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeSetResourceLimits(
+    JNIEnv* env, jclass clazz, jlong process_long, jint cpu_rate_percent,
+    jlong memory_limit_bytes) {
+  NativeProcess* process = reinterpret_cast<NativeProcess*>(process_long);
+
+  if (process->job_ == INVALID_HANDLE_VALUE) {
+    process->error_ = "Process is not in a job object of its own";
+    return JNI_FALSE;
+  }
+
+  if (memory_limit_bytes > 0) {
+    // Keep JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE from nativeCreateProcess().
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits = {0};
+    if (!QueryInformationJobObject(process->job_,
+                                   JobObjectExtendedLimitInformation, &limits,
+                                   sizeof(limits), NULL)) {
+      process->error_ = GetLastErrorString("QueryInformationJobObject()");
       return JNI_FALSE;
     }
+    limits.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_JOB_MEMORY;
+    limits.JobMemoryLimit = static_cast<SIZE_T>(memory_limit_bytes);
+    if (!SetInformationJobObject(process->job_,
+                                 JobObjectExtendedLimitInformation, &limits,
+                                 sizeof(limits))) {
+      process->error_ = GetLastErrorString("SetInformationJobObject(memory)");
+      return JNI_FALSE;
+    }
+  }
+
+  if (cpu_rate_percent > 0 && cpu_rate_percent < 100) {
+#ifdef JOB_OBJECT_CPU_RATE_CONTROL_ENABLE
+    // CpuRate is in hundredths of a percent of all the processors, and needs
+    // Windows 8.
+    JOBOBJECT_CPU_RATE_CONTROL_INFORMATION cpu_rate = {0};
+    cpu_rate.ControlFlags =
+        JOB_OBJECT_CPU_RATE_CONTROL_ENABLE | JOB_OBJECT_CPU_RATE_CONTROL_HARD_CAP;
+    cpu_rate.CpuRate = cpu_rate_percent * 100;
+    if (!SetInformationJobObject(process->job_,
+                                 JobObjectCpuRateControlInformation,
+                                 &cpu_rate, sizeof(cpu_rate))) {
+      process->error_ = GetLastErrorString("SetInformationJobObject(cpu)");
+      return JNI_FALSE;
+    }
+#else
+    process->error_ = "CPU rate limits are not supported by this build";
+    return JNI_FALSE;
+#endif
   }
 
   process->error_ = "";
@@ -487,6 +754,15 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeDeleteProcess(
     JNIEnv* env, jclass clazz, jlong process_long) {
   NativeProcess* process = reinterpret_cast<NativeProcess*>(process_long);
 
+  if (process->exit_wait_ != NULL) {
+    // Waits for a running ProcessExited() to return. If it didn't start, it
+    // never will, and the callback is released here.
+    UnregisterWaitEx(process->exit_wait_, INVALID_HANDLE_VALUE);
+    if (process->exit_callback_ != NULL) {
+      env->DeleteGlobalRef(process->exit_callback_);
+    }
+  }
+
   if (process->stdin_ != INVALID_HANDLE_VALUE) {
     CloseHandle(process->stdin_);
   }
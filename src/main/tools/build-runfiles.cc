@@ -19,6 +19,11 @@
 // and any extraneous ones are removed. Second, any missing files are created.
 // Finally, a copy of the input manifest is written to RUNFILES/MANIFEST.
 //
+// If RUNFILES/MANIFEST exists, the previous run completed, so instead of
+// scanning the tree only the entries that differ between that manifest and
+// the input manifest are removed and created. Without it, the tree may be
+// dirty and is scanned in full.
+//
 // The input manifest consists of lines, each containing a relative path within
 // the runfiles, a space, and an optional absolute path.  If this second path
 // is present, a symlink is created pointing to it; otherwise an empty file is
@@ -37,6 +42,31 @@
 // If --use_metadata is supplied, every other line is treated as opaque
 // metadata, and is ignored here.
 //
+// With --manifest_only, no tree is created (and an existing one is removed).
+// Instead, an index of the manifest is written to RUNFILES/MANIFEST.index, for
+// programs that look their runfiles up with RunfilesIndex (see
+// runfiles-index.h).
+//
+// With --threads=N, N threads remove the extraneous files and create the
+// missing ones: directories are created level by level, and the entries of
+// the directories of a level are created in parallel. N is capped by the CPUs
+// available to the process, and --threads=0 uses all of them.
+//
+// With --mode=hardlink, --mode=reflink or --mode=copy, for platforms where
+// symlinks are slow or need privileges, the targets that are regular files are
+// not symlinked but hardlinked, cloned or copied, with the latter modes as the
+// fallbacks of the former. Copies and clones get the permissions and the
+// modification time of their target, which tell whether they are up to date
+// when the previous manifest names the same target; a full scan, which can't
+// tell what they were copied from, creates them again. Other targets, such as
+// directories, are still symlinked. The mode is recorded in
+// RUNFILES/MANIFEST.mode, and a tree created with another mode is scanned in
+// full.
+//
+// With --trace=FILE, or if $BAZEL_NATIVE_TRACE_DIR is set, a trace of the
+// phases is written in the Chrome trace event format (see
+// src/main/cpp/util/trace.h).
+//
 // All output paths must be relative and generally (but not always) begin with
 // <workspace root>. No output path may be equal to another.  No output path may
 // be a path prefix of another.
@@ -47,14 +77,30 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
 
-#include <map>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include "runfiles-index.h"
+#include "src/main/cpp/util/thread_pool.h"
+#include "src/main/cpp/util/trace.h"
 
 // program_invocation_short_name is not portable.
 static const char *argv0;
@@ -88,12 +134,46 @@ enum FileType {
   FILE_TYPE_SYMLINK
 };
 
+// How the entries of the manifest with a target are created.
+enum Mode {
+  MODE_SYMLINK,
+  MODE_HARDLINK,
+  MODE_REFLINK,
+  MODE_COPY
+};
+
+static const char *const kModeNames[] = {"symlink", "hardlink", "reflink",
+                                         "copy"};
+
+#if defined(__APPLE__)
+#define ST_MTIM st_mtimespec
+#define ST_ATIM st_atimespec
+#else
+#define ST_MTIM st_mtim
+#define ST_ATIM st_atim
+#endif
+
+// A string that points into a mapped manifest, or another string that
+// outlives it. Not NUL-terminated.
+struct Span {
+  const char *data;
+  uint32_t size;
+
+  std::string ToString() const { return std::string(data, size); }
+
+  bool operator==(const Span &other) const {
+    return size == other.size &&
+           (size == 0 || memcmp(data, other.data, size) == 0);
+  }
+};
+
 struct FileInfo {
   FileType type;
-  std::string symlink_target;
+  Span symlink_target;
 
   bool operator==(const FileInfo &other) const {
-    return type == other.type && symlink_target == other.symlink_target;
+    return type == other.type && (type != FILE_TYPE_SYMLINK ||
+                                  symlink_target == other.symlink_target);
   }
 
   bool operator!=(const FileInfo &other) const {
@@ -101,107 +181,239 @@ struct FileInfo {
   }
 };
 
-typedef std::map<std::string, FileInfo> FileInfoMap;
+// A path in the runfiles tree, interned as its name in its directory, which
+// is another Node. The paths of the input manifest and of the previous one
+// share the Nodes.
+struct Node {
+  uint32_t parent;
+  uint32_t depth;
+  Span name;
+  // What the input manifest says about the path, if it's in it.
+  FileInfo info;
+  // What the previous manifest says about the path, if it's in it.
+  FileInfo previous_info;
+  bool in_manifest;
+  bool in_previous;
+  // Whether the path already is in the tree as the input manifest says.
+  bool exists;
+  // Whether the path is removed, or is in a directory that is removed.
+  bool removed;
+};
+
+// A file mapped read-only into memory.
+class MappedFile {
+ public:
+  MappedFile() : fd_(-1), data_(NULL), size_(0) {}
+
+  ~MappedFile() {
+    if (data_ != NULL) {
+      munmap(const_cast<char *>(data_), size_);
+    }
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  // Returns whether the file could be mapped, with errno set if not.
+  bool Open(const std::string &path) {
+    fd_ = open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+      return false;
+    }
+    size_ = st.st_size;
+    if (size_ > 0) {
+      void *data = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+      if (data == MAP_FAILED) {
+        return false;
+      }
+      data_ = static_cast<const char *>(data);
+    }
+    return true;
+  }
+
+  int fd() const { return fd_; }
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  int fd_;
+  const char *data_;
+  size_t size_;
+};
+
+static const uint32_t kRootNode = 0;
+static const uint32_t kNoNode = 0xffffffff;
 
 class RunfilesCreator {
  public:
-  explicit RunfilesCreator(const std::string &output_base)
+  RunfilesCreator(const std::string &output_base, int threads,
+                  bool manifest_only, Mode mode)
       : output_base_(output_base),
         output_filename_("MANIFEST"),
-        temp_filename_(output_filename_ + ".tmp") {
+        temp_filename_(output_filename_ + ".tmp"),
+        index_filename_(output_filename_ + ".index"),
+        temp_index_filename_(index_filename_ + ".tmp"),
+        mode_filename_(output_filename_ + ".mode"),
+        threads_(threads),
+        pool_(threads),
+        manifest_only_(manifest_only),
+        mode_(mode),
+        use_metadata_(false),
+        incremental_(false),
+        index_(1024, kNoNode),
+        temp_node_(kNoNode) {
     SetupOutputBase();
     if (chdir(output_base_.c_str()) != 0) {
       PDIE("chdir '%s'", output_base_.c_str());
     }
+
+    Node root = Node();
+    root.parent = kRootNode;
+    root.name.data = ".";
+    root.name.size = 1;
+    root.info.type = FILE_TYPE_DIRECTORY;
+    root.in_manifest = true;
+    root.exists = true;
+    nodes_.push_back(root);
   }
 
   void ReadManifest(const std::string &manifest_file, bool allow_relative,
                     bool use_metadata) {
-    FILE *outfile = fopen(temp_filename_.c_str(), "w");
-    if (!outfile) {
-      PDIE("opening '%s/%s' for writing", output_base_.c_str(),
-           temp_filename_.c_str());
-    }
-    FILE *infile = fopen(manifest_file.c_str(), "r");
-    if (!infile) {
+    TRACE_SPAN("read manifest");
+    use_metadata_ = use_metadata;
+    if (!input_.Open(manifest_file)) {
       PDIE("opening '%s' for reading", manifest_file.c_str());
     }
+    CopyManifest();
 
     // read input manifest
     int lineno = 0;
-    char buf[3 * PATH_MAX];
-    while (fgets(buf, sizeof buf, infile)) {
-      // copy line to output manifest
-      if (fputs(buf, outfile) == EOF) {
-        PDIE("writing to '%s/%s'", output_base_.c_str(),
-             temp_filename_.c_str());
-      }
+    const char *end = input_.data() + input_.size();
+    for (const char *line = input_.data(); line < end;) {
+      const char *newline =
+          static_cast<const char *>(memchr(line, '\n', end - line));
+      const char *line_end = newline != NULL ? newline : end;
+      const int line_length = line_end - line;
+      const char *next_line = line_end + 1;
 
       // parse line
       ++lineno;
       // Skip metadata lines. They are used solely for
       // dependency checking.
-      if (use_metadata && lineno % 2 == 0) continue;
+      if (use_metadata && lineno % 2 == 0) {
+        line = next_line;
+        continue;
+      }
 
-      int n = strlen(buf)-1;
-      if (!n || buf[n] != '\n') {
-        DIE("missing terminator at line %d: '%s'\n", lineno, buf);
+      if (newline == NULL || line_length == 0) {
+        DIE("missing terminator at line %d: '%.*s'\n", lineno, line_length,
+            line);
       }
-      buf[n] = '\0';
-      if (buf[0] ==  '/') {
-        DIE("paths must not be absolute: line %d: '%s'\n", lineno, buf);
+      if (line[0] == '/') {
+        DIE("paths must not be absolute: line %d: '%.*s'\n", lineno,
+            line_length, line);
       }
-      const char *s = strchr(buf, ' ');
+      const char *s =
+          static_cast<const char *>(memchr(line, ' ', line_length));
       if (!s) {
-        DIE("missing field delimiter at line %d: '%s'\n", lineno, buf);
-      } else if (strchr(s+1, ' ')) {
-        DIE("link or target filename contains space on line %d: '%s'\n",
-            lineno, buf);
-      }
-      std::string link(buf, s-buf);
-      const char *target = s+1;
-      if (!allow_relative && target[0] != '\0' && target[0] != '/'
-          && target[1] != ':') {  // Match Windows paths, e.g. C:\foo or C:/foo.
-        DIE("expected absolute path at line %d: '%s'\n", lineno, buf);
-      }
-
-      FileInfo *info = &manifest_[link];
-      if (target[0] == '\0') {
-        // No target means an empty file.
-        info->type = FILE_TYPE_REGULAR;
-      } else {
-        info->type = FILE_TYPE_SYMLINK;
-        info->symlink_target = target;
+        DIE("missing field delimiter at line %d: '%.*s'\n", lineno,
+            line_length, line);
+      } else if (memchr(s + 1, ' ', line_end - (s + 1))) {
+        DIE("link or target filename contains space on line %d: '%.*s'\n",
+            lineno, line_length, line);
+      }
+      Span link = {line, static_cast<uint32_t>(s - line)};
+      Span target = {s + 1, static_cast<uint32_t>(line_end - (s + 1))};
+      if (!allow_relative && target.size > 0 && target.data[0] != '/' &&
+          !(target.size > 1 && target.data[1] == ':')) {
+        // Match Windows paths, e.g. C:\foo or C:/foo.
+        DIE("expected absolute path at line %d: '%.*s'\n", lineno,
+            line_length, line);
       }
 
-      FileInfo parent_info;
-      parent_info.type = FILE_TYPE_DIRECTORY;
-
-      while (true) {
-        int k = link.rfind('/');
-        if (k < 0) break;
-        link.erase(k, std::string::npos);
-        if (!manifest_.insert(std::make_pair(link, parent_info)).second) break;
+      uint32_t node = AddPath(link, false);
+      if (node == kRootNode) {
+        DIE("invalid path at line %d: '%.*s'\n", lineno, line_length, line);
       }
+      Node *info_node = &nodes_[node];
+      info_node->in_manifest = true;
+      info_node->info = FileInfoFor(target);
+      line = next_line;
     }
-    if (fclose(outfile) != 0) {
-      PDIE("writing to '%s/%s'", output_base_.c_str(),
-           temp_filename_.c_str());
-    }
-    fclose(infile);
 
     // Don't delete the temp manifest file.
-    manifest_[temp_filename_].type = FILE_TYPE_REGULAR;
+    Span temp_name = {temp_filename_.c_str(),
+                      static_cast<uint32_t>(temp_filename_.size())};
+    temp_node_ = FindNode(kRootNode, temp_name, true);
+    nodes_[temp_node_].in_manifest = true;
+    nodes_[temp_node_].info.type = FILE_TYPE_REGULAR;
+    // Nor the mode file, which is written once the tree is complete.
+    if (mode_ != MODE_SYMLINK && !manifest_only_) {
+      Span mode_name = {mode_filename_.c_str(),
+                        static_cast<uint32_t>(mode_filename_.size())};
+      uint32_t mode_node = FindNode(kRootNode, mode_name, true);
+      nodes_[mode_node].in_manifest = true;
+      nodes_[mode_node].info.type = FILE_TYPE_REGULAR;
+      nodes_[mode_node].exists = true;
+    }
   }
 
   void CreateRunfiles() {
+    // With an index, the previous manifest doesn't describe the tree.
+    struct stat st;
+    bool indexed = lstat(index_filename_.c_str(), &st) == 0;
+    incremental_ = !manifest_only_ && !indexed &&
+                   PreviousMode() == kModeNames[mode_] &&
+                   ReadPreviousManifest();
+
+    // Until the new manifest is renamed into place, a run over this tree
+    // scans it in full.
     if (unlink(output_filename_.c_str()) != 0 && errno != ENOENT) {
       PDIE("removing previous file at '%s/%s'", output_base_.c_str(),
            output_filename_.c_str());
     }
 
-    ScanTreeAndPrune(".");
-    CreateFiles();
+    {
+      TRACE_SPAN("prune tree");
+      if (incremental_) {
+        PruneChangedEntries();
+      } else {
+        ScanTreeAndPrune(".", kRootNode);
+      }
+    }
+    // The extraneous entries were collected by ScanTreeAndPrune or
+    // PruneChangedEntries; none of them is in another one.
+    std::vector<std::string> doomed_dirs;
+    std::vector<std::string> doomed_files;
+    for (const std::pair<std::string, FileType> &entry : doomed_) {
+      if (entry.second == FILE_TYPE_DIRECTORY) {
+        doomed_dirs.push_back(entry.first);
+      } else {
+        doomed_files.push_back(entry.first);
+      }
+    }
+    doomed_.clear();
+    blaze_util::TraceCounter("doomed files", doomed_files.size());
+    blaze_util::TraceCounter("doomed directories", doomed_dirs.size());
+    {
+      TRACE_SPAN("delete extraneous entries");
+      RunInParallel(doomed_files.size(), [this, &doomed_files](size_t i) {
+        DelTree(doomed_files[i], FILE_TYPE_REGULAR);
+      });
+      DelTrees(doomed_dirs);
+    }
+    if (manifest_only_) {
+      WriteIndex();
+    } else {
+      CreateFiles();
+      if (mode_ != MODE_SYMLINK) {
+        WriteModeFile();
+      }
+    }
 
     // rename output file into place
     if (rename(temp_filename_.c_str(), output_filename_.c_str()) != 0) {
@@ -212,6 +424,315 @@ class RunfilesCreator {
   }
 
  private:
+  // Returns the mode the tree was last created with, "symlink" if there is
+  // no mode file.
+  std::string PreviousMode() {
+    std::string mode;
+    int fd = open(mode_filename_.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return kModeNames[MODE_SYMLINK];
+    }
+    char buffer[32];
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    close(fd);
+    if (n > 0) {
+      mode.assign(buffer, n);
+    }
+    return mode.substr(0, mode.find('\n'));
+  }
+
+  void WriteModeFile() {
+    int fd = open(mode_filename_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+      PDIE("opening '%s/%s' for writing", output_base_.c_str(),
+           mode_filename_.c_str());
+    }
+    const std::string mode = std::string(kModeNames[mode_]) + "\n";
+    if (write(fd, mode.data(), mode.size()) !=
+            static_cast<ssize_t>(mode.size()) ||
+        close(fd) != 0) {
+      PDIE("writing to '%s/%s'", output_base_.c_str(), mode_filename_.c_str());
+    }
+  }
+
+  // Writes the index of the manifest and renames it into place.
+  void WriteIndex() {
+    TRACE_SPAN("write index");
+    std::vector<RunfilesIndexEntry> entries;
+    for (uint32_t i = 1; i < nodes_.size(); ++i) {
+      const Node &node = nodes_[i];
+      if (node.in_manifest && node.info.type != FILE_TYPE_DIRECTORY &&
+          i != temp_node_) {
+        RunfilesIndexEntry entry;
+        entry.path = PathOf(i);
+        entry.target = node.info.symlink_target.ToString();
+        entries.push_back(entry);
+      }
+    }
+    if (!WriteRunfilesIndex(temp_index_filename_, &entries)) {
+      PDIE("writing to '%s/%s'", output_base_.c_str(),
+           temp_index_filename_.c_str());
+    }
+    if (rename(temp_index_filename_.c_str(), index_filename_.c_str()) != 0) {
+      PDIE("renaming '%s/%s' to '%s/%s'",
+           output_base_.c_str(), temp_index_filename_.c_str(),
+           output_base_.c_str(), index_filename_.c_str());
+    }
+  }
+
+  // Copies the input manifest to the temp manifest file.
+  void CopyManifest() {
+    int out_fd = open(temp_filename_.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                      0666);
+    if (out_fd < 0) {
+      PDIE("opening '%s/%s' for writing", output_base_.c_str(),
+           temp_filename_.c_str());
+    }
+
+    size_t copied = 0;
+#if defined(SYS_copy_file_range)
+    // Linux 4.5 and later copy in the kernel, and some file systems share the
+    // blocks. Stop on any error, such as EXDEV before Linux 5.3, and write
+    // the rest from the mapping instead.
+    while (copied < input_.size()) {
+      off_t in_offset = copied;
+      ssize_t n = syscall(SYS_copy_file_range, input_.fd(), &in_offset, out_fd,
+                          NULL, input_.size() - copied, 0);
+      if (n <= 0) {
+        break;
+      }
+      copied += n;
+    }
+#endif
+    while (copied < input_.size()) {
+      ssize_t n = write(out_fd, input_.data() + copied, input_.size() - copied);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        PDIE("writing to '%s/%s'", output_base_.c_str(),
+             temp_filename_.c_str());
+      }
+      copied += n;
+    }
+
+    if (close(out_fd) != 0) {
+      PDIE("writing to '%s/%s'", output_base_.c_str(),
+           temp_filename_.c_str());
+    }
+  }
+
+  // Returns the FileInfo for the target of a manifest line.
+  static FileInfo FileInfoFor(Span target) {
+    FileInfo info;
+    info.symlink_target = target;
+    // No target means an empty file.
+    info.type =
+        target.size == 0 ? FILE_TYPE_REGULAR : FILE_TYPE_SYMLINK;
+    return info;
+  }
+
+  static uint32_t Hash(uint32_t parent, Span name) {
+    // FNV-1a.
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 4; ++i) {
+      hash = (hash ^ ((parent >> (8 * i)) & 0xff)) * 16777619u;
+    }
+    for (uint32_t i = 0; i < name.size; ++i) {
+      hash = (hash ^ static_cast<unsigned char>(name.data[i])) * 16777619u;
+    }
+    return hash;
+  }
+
+  // Returns the Node for "name" in the directory "parent". If there is none,
+  // adds one if "add", or returns kNoNode if not.
+  uint32_t FindNode(uint32_t parent, Span name, bool add) {
+    const size_t mask = index_.size() - 1;
+    size_t slot = Hash(parent, name) & mask;
+    for (; index_[slot] != kNoNode; slot = (slot + 1) & mask) {
+      const Node &node = nodes_[index_[slot]];
+      if (node.parent == parent && node.name == name) {
+        return index_[slot];
+      }
+    }
+    if (!add) {
+      return kNoNode;
+    }
+
+    if (nodes_.size() >= kNoNode - 1) {
+      DIE("too many paths in the manifests\n");
+    }
+    Node node = Node();
+    node.parent = parent;
+    node.depth = nodes_[parent].depth + 1;
+    node.name = name;
+    index_[slot] = nodes_.size();
+    nodes_.push_back(node);
+    if (nodes_.size() * 4 > index_.size() * 3) {
+      GrowIndex();
+    }
+    return nodes_.size() - 1;
+  }
+
+  // Doubles the size of the hash index.
+  void GrowIndex() {
+    std::vector<uint32_t>(index_.size() * 2, kNoNode).swap(index_);
+    const size_t mask = index_.size() - 1;
+    for (uint32_t i = 1; i < nodes_.size(); ++i) {
+      size_t slot = Hash(nodes_[i].parent, nodes_[i].name) & mask;
+      while (index_[slot] != kNoNode) {
+        slot = (slot + 1) & mask;
+      }
+      index_[slot] = i;
+    }
+  }
+
+  // Returns the Node for the relative path "path", adding it and the
+  // directories containing it as needed; these are marked as directories in
+  // the input manifest, or in the previous one if "previous". Empty path
+  // segments are ignored.
+  uint32_t AddPath(Span path, bool previous) {
+    uint32_t node = kRootNode;
+    const char *segment = path.data;
+    const char *end = path.data + path.size;
+    while (true) {
+      const char *slash =
+          static_cast<const char *>(memchr(segment, '/', end - segment));
+      const char *segment_end = slash != NULL ? slash : end;
+      if (segment_end > segment) {
+        Span name = {segment, static_cast<uint32_t>(segment_end - segment)};
+        node = FindNode(node, name, true);
+        if (slash != NULL) {
+          Node *dir = &nodes_[node];
+          if (previous && !dir->in_previous) {
+            dir->in_previous = true;
+            dir->previous_info.type = FILE_TYPE_DIRECTORY;
+          } else if (!previous && !dir->in_manifest) {
+            dir->in_manifest = true;
+            dir->info.type = FILE_TYPE_DIRECTORY;
+          }
+        }
+      }
+      if (slash == NULL) {
+        return node;
+      }
+      segment = slash + 1;
+    }
+  }
+
+  // Returns the path of the Node, relative to the runfiles directory.
+  std::string PathOf(uint32_t node) const {
+    if (node == kRootNode) {
+      return ".";
+    }
+    std::vector<uint32_t> segments;
+    for (; node != kRootNode; node = nodes_[node].parent) {
+      segments.push_back(node);
+    }
+    std::string path;
+    for (size_t i = segments.size(); i-- > 0;) {
+      const Span &name = nodes_[segments[i]].name;
+      path.append(name.data, name.size);
+      if (i > 0) {
+        path.push_back('/');
+      }
+    }
+    return path;
+  }
+
+  // Reads the manifest of the previous run, and returns whether it could.
+  // Unlike ReadManifest, doesn't fail on a malformed manifest but treats it as
+  // missing.
+  bool ReadPreviousManifest() {
+    if (!previous_.Open(output_filename_)) {
+      return false;
+    }
+
+    int lineno = 0;
+    const char *end = previous_.data() + previous_.size();
+    for (const char *line = previous_.data(); line < end;) {
+      const char *newline =
+          static_cast<const char *>(memchr(line, '\n', end - line));
+      ++lineno;
+      if (use_metadata_ && lineno % 2 == 0) {
+        if (newline == NULL) {
+          break;
+        }
+        line = newline + 1;
+        continue;
+      }
+
+      if (newline == NULL || newline == line || line[0] == '/') {
+        return false;
+      }
+      const char *s =
+          static_cast<const char *>(memchr(line, ' ', newline - line));
+      if (!s) {
+        return false;
+      }
+      Span link = {line, static_cast<uint32_t>(s - line)};
+      Span target = {s + 1, static_cast<uint32_t>(newline - (s + 1))};
+      uint32_t node = AddPath(link, true);
+      if (node == kRootNode) {
+        return false;
+      }
+      nodes_[node].in_previous = true;
+      nodes_[node].previous_info = FileInfoFor(target);
+      line = newline + 1;
+    }
+    return true;
+  }
+
+  // Removes the paths of the previous manifest that are not in the input
+  // manifest or differ, and marks the ones that are the same as existing.
+  void PruneChangedEntries() {
+    // A Node comes after the directory containing it.
+    for (uint32_t i = 1; i < nodes_.size(); ++i) {
+      Node *node = &nodes_[i];
+      if (nodes_[node->parent].removed) {
+        node->removed = true;
+        continue;
+      }
+      if (!node->in_previous) {
+        continue;
+      }
+      if (node->in_manifest && node->info == node->previous_info &&
+          (!IsMaterialized(node->info) ||
+           HasContentsOf(PathOf(i), node->info, true))) {
+        node->exists = true;
+        continue;
+      }
+
+      const std::string path = PathOf(i);
+      struct stat st;
+      if (lstat(path.c_str(), &st) != 0) {
+        if (errno == ENOENT) {
+          continue;
+        }
+        PDIE("lstating file '%s'", path.c_str());
+      }
+      FileType actual_type = S_ISDIR(st.st_mode)
+                                 ? FILE_TYPE_DIRECTORY
+                                 : S_ISLNK(st.st_mode) ? FILE_TYPE_SYMLINK
+                                                       : FILE_TYPE_REGULAR;
+      node->removed = true;
+      RemoveEntry(path, actual_type);
+    }
+
+    // The temporary manifest has just been written.
+    nodes_[temp_node_].exists = true;
+  }
+
+  // Removes an entry that doesn't belong in the tree, right away or along with
+  // the others when threads_ > 1.
+  void RemoveEntry(const std::string &path, FileType file_type) {
+    if (threads_ > 1) {
+      doomed_.push_back(std::make_pair(path, file_type));
+    } else {
+      DelTree(path, file_type);
+    }
+  }
+
   void SetupOutputBase() {
     struct stat st;
     if (stat(output_base_.c_str(), &st) != 0) {
@@ -225,7 +746,8 @@ class RunfilesCreator {
     }
   }
 
-  void ScanTreeAndPrune(const std::string &path) {
+  // Scans the directory "path", whose Node is "dir".
+  void ScanTreeAndPrune(const std::string &path, uint32_t dir) {
     // A note on non-empty files:
     // We don't distinguish between empty and non-empty files. That is, if
     // there's a file that has contents, we don't truncate it here, even though
@@ -245,29 +767,37 @@ class RunfilesCreator {
       if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
 
       std::string entry_path = prefix + entry->d_name;
+      std::string actual_target;
       FileInfo actual_info;
       actual_info.type = DentryToFileType(entry_path, entry->d_type);
 
       if (actual_info.type == FILE_TYPE_SYMLINK) {
-        ReadLinkOrDie(entry_path, &actual_info.symlink_target);
+        ReadLinkOrDie(entry_path, &actual_target);
       }
+      actual_info.symlink_target.data = actual_target.data();
+      actual_info.symlink_target.size = actual_target.size();
 
-      FileInfoMap::iterator expected_it = manifest_.find(entry_path);
-      if (expected_it == manifest_.end() ||
-          expected_it->second != actual_info) {
+      Span name = {entry->d_name, static_cast<uint32_t>(strlen(entry->d_name))};
+      uint32_t expected = FindNode(dir, name, false);
+      // With --manifest_only, only the temp manifest file belongs here.
+      if (expected == kNoNode || !nodes_[expected].in_manifest ||
+          (IsMaterialized(nodes_[expected].info)
+               ? !HasContentsOf(entry_path, nodes_[expected].info, false)
+               : nodes_[expected].info != actual_info) ||
+          (manifest_only_ && expected != temp_node_)) {
 #if !defined(__CYGWIN__)
-        DelTree(entry_path, actual_info.type);
+        RemoveEntry(entry_path, actual_info.type);
 #else
         // On Windows, if deleting failed, lamely assume that
         // the link points to the right place.
-        if (!DelTree(entry_path, actual_info.type)) {
-          manifest_.erase(expected_it);
+        if (!DelTree(entry_path, actual_info.type) && expected != kNoNode) {
+          nodes_[expected].exists = true;
         }
 #endif
       } else {
-        manifest_.erase(expected_it);
+        nodes_[expected].exists = true;
         if (actual_info.type == FILE_TYPE_DIRECTORY) {
-          ScanTreeAndPrune(entry_path);
+          ScanTreeAndPrune(entry_path, expected);
         }
       }
 
@@ -279,33 +809,265 @@ class RunfilesCreator {
     closedir(dh);
   }
 
+  // Runs fn(0), ..., fn(n - 1) on up to threads_ threads of the pool.
+  void RunInParallel(size_t n, const std::function<void(size_t)> &fn) {
+    std::atomic<size_t> next(0);
+    auto worker = [&next, n, &fn]() {
+      for (size_t i = next++; i < n; i = next++) {
+        fn(i);
+      }
+    };
+    blaze_util::TaskGroup helpers(&pool_);
+    for (size_t i = 1; i < std::min<size_t>(threads_, n); ++i) {
+      helpers.Schedule(worker);
+    }
+    worker();
+    helpers.Wait();
+  }
+
+  // The most entries of a directory created by one task of CreateFiles, so
+  // that large directories are created in parallel too; copies take longer
+  // than symlinks.
+  static const size_t kEntriesPerTask = 256;
+
   void CreateFiles() {
-    for (FileInfoMap::const_iterator it = manifest_.begin();
-         it != manifest_.end(); ++it) {
-      const std::string &path = it->first;
-      switch (it->second.type) {
-        case FILE_TYPE_DIRECTORY:
-          if (mkdir(path.c_str(), 0777) != 0) {
+    TRACE_SPAN("create missing entries");
+    // Sort the missing entries by depth and directory, so that every directory
+    // exists by the time its contents are created.
+    std::vector<uint32_t> missing;
+    for (uint32_t i = 1; i < nodes_.size(); ++i) {
+      if (nodes_[i].in_manifest && !nodes_[i].exists) {
+        missing.push_back(i);
+      }
+    }
+    blaze_util::TraceCounter("missing entries", missing.size());
+    std::sort(missing.begin(), missing.end(), [this](uint32_t a, uint32_t b) {
+      const Node &x = nodes_[a];
+      const Node &y = nodes_[b];
+      if (x.depth != y.depth) {
+        return x.depth < y.depth;
+      }
+      return x.parent != y.parent ? x.parent < y.parent : a < b;
+    });
+
+    size_t i = 0;
+    while (i < missing.size()) {
+      // The entries of each directory in this level, as [begin, end) ranges
+      // of "missing" of at most kEntriesPerTask entries.
+      const uint32_t depth = nodes_[missing[i]].depth;
+      std::vector<std::pair<size_t, size_t>> dirs;
+      while (i < missing.size() && nodes_[missing[i]].depth == depth) {
+        size_t begin = i;
+        const uint32_t parent = nodes_[missing[i]].parent;
+        while (i < missing.size() && nodes_[missing[i]].parent == parent &&
+               i - begin < kEntriesPerTask) {
+          ++i;
+        }
+        dirs.push_back(std::make_pair(begin, i));
+      }
+      RunInParallel(dirs.size(), [this, &dirs, &missing](size_t k) {
+        CreateFilesIn(&missing[dirs[k].first], &missing[dirs[k].second]);
+      });
+    }
+  }
+
+  // Creates the entries [begin, end) of the manifest, which are in the same
+  // directory.
+  void CreateFilesIn(const uint32_t *begin, const uint32_t *end) {
+    const std::string dir = PathOf(nodes_[*begin].parent);
+    int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd < 0) {
+      PDIE("opening directory '%s'", dir.c_str());
+    }
+
+    for (const uint32_t *it = begin; it != end; ++it) {
+      const Node &node = nodes_[*it];
+      const std::string name = node.name.ToString();
+      const std::string target = node.info.symlink_target.ToString();
+      bool created = CreateFileAt(dir_fd, name, node.info.type, target);
+      if (!created && errno == EEXIST && incremental_) {
+        // Something the previous manifest doesn't know about is in the way.
+        const std::string path = PathOf(*it);
+        struct stat st;
+        LStatOrDie(path, &st);
+        DelTree(path, S_ISDIR(st.st_mode) ? FILE_TYPE_DIRECTORY
+                                          : FILE_TYPE_REGULAR);
+        created = CreateFileAt(dir_fd, name, node.info.type, target);
+      }
+      if (!created) {
+        const std::string path = PathOf(*it);
+        switch (node.info.type) {
+          case FILE_TYPE_DIRECTORY:
             PDIE("mkdir '%s'", path.c_str());
-          }
-          break;
-        case FILE_TYPE_REGULAR:
-          {
-            int fd = open(path.c_str(), O_CREAT|O_EXCL|O_WRONLY, 0555);
-            if (fd < 0) {
-              PDIE("creating empty file '%s'", path.c_str());
+          case FILE_TYPE_REGULAR:
+            PDIE("creating empty file '%s'", path.c_str());
+          case FILE_TYPE_SYMLINK:
+            if (mode_ != MODE_SYMLINK) {
+              PDIE("creating '%s' from '%s'", path.c_str(), target.c_str());
             }
-            close(fd);
+            PDIE("symlinking '%s' -> '%s'", path.c_str(), target.c_str());
+        }
+      }
+    }
+    close(dir_fd);
+  }
+
+  // Creates the entry "name" in the directory "dir_fd". Returns whether that
+  // succeeded.
+  bool CreateFileAt(int dir_fd, const std::string &name, FileType type,
+                    const std::string &symlink_target) {
+    int result = 0;
+    switch (type) {
+      case FILE_TYPE_DIRECTORY:
+        result = mkdirat(dir_fd, name.c_str(), 0777);
+        break;
+      case FILE_TYPE_REGULAR:
+        result = openat(dir_fd, name.c_str(), O_CREAT|O_EXCL|O_WRONLY, 0555);
+        if (result >= 0) {
+          close(result);
+          result = 0;
+        }
+        break;
+      case FILE_TYPE_SYMLINK:
+        if (mode_ != MODE_SYMLINK) {
+          struct stat st;
+          if (stat(symlink_target.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            return CreateCopyAt(dir_fd, name, symlink_target, st);
           }
-          break;
-        case FILE_TYPE_SYMLINK:
-          {
-            const std::string& target = it->second.symlink_target;
-            if (symlink(target.c_str(), path.c_str()) != 0) {
-              PDIE("symlinking '%s' -> '%s'", path.c_str(), target.c_str());
-            }
+        }
+        result = symlinkat(symlink_target.c_str(), dir_fd, name.c_str());
+        break;
+    }
+    return result == 0;
+  }
+
+  // Returns whether the entry for "info" is created as a file with the
+  // contents of its target rather than as a symlink, if the target is a
+  // regular file.
+  bool IsMaterialized(const FileInfo &info) const {
+    return mode_ != MODE_SYMLINK && info.type == FILE_TYPE_SYMLINK;
+  }
+
+  // Returns whether the entry at "path" is what CreateFileAt creates for
+  // "info" with a mode other than symlink: a hardlink of its target, or a
+  // symlink to it if it isn't a regular file, or, if "same_target" (the entry
+  // was created for the same target), a copy or clone with its size and
+  // modification time.
+  bool HasContentsOf(const std::string &path, const FileInfo &info,
+                     bool same_target) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+      return false;
+    }
+    const std::string target = info.symlink_target.ToString();
+    struct stat target_st;
+    if (stat(target.c_str(), &target_st) != 0 ||
+        !S_ISREG(target_st.st_mode)) {
+      std::string actual_target;
+      if (!S_ISLNK(st.st_mode)) {
+        return false;
+      }
+      ReadLinkOrDie(path, &actual_target);
+      return actual_target == target;
+    }
+    if (!S_ISREG(st.st_mode)) {
+      return false;
+    }
+    if (st.st_dev == target_st.st_dev && st.st_ino == target_st.st_ino) {
+      return true;
+    }
+    return same_target && st.st_size == target_st.st_size &&
+           st.ST_MTIM.tv_sec == target_st.ST_MTIM.tv_sec &&
+           st.ST_MTIM.tv_nsec == target_st.ST_MTIM.tv_nsec &&
+           (st.st_mode & 0777) == (target_st.st_mode & 0777);
+  }
+
+  // Creates "name" in "dir_fd" with the contents of "target", a regular file
+  // whose status is "st": as a hardlink with --mode=hardlink, and else as a
+  // clone with --mode=reflink, and else as a copy. Returns whether that
+  // succeeded, with errno set if not.
+  bool CreateCopyAt(int dir_fd, const std::string &name,
+                    const std::string &target, const struct stat &st) {
+    if (mode_ == MODE_HARDLINK) {
+      if (linkat(AT_FDCWD, target.c_str(), dir_fd, name.c_str(),
+                 AT_SYMLINK_FOLLOW) == 0) {
+        return true;
+      }
+      // Across file systems, or beyond the limit of links of the target.
+      if (errno != EXDEV && errno != EMLINK && errno != EPERM &&
+          errno != ENOTSUP) {
+        return false;
+      }
+    }
+
+    int in_fd = open(target.c_str(), O_RDONLY);
+    if (in_fd < 0) {
+      return false;
+    }
+    int out_fd = openat(dir_fd, name.c_str(), O_CREAT | O_EXCL | O_WRONLY,
+                        0600);
+    if (out_fd < 0) {
+      int saved_errno = errno;
+      close(in_fd);
+      errno = saved_errno;
+      return false;
+    }
+    bool cloned = false;
+#if defined(FICLONE)
+    cloned = mode_ != MODE_COPY && ioctl(out_fd, FICLONE, in_fd) == 0;
+#endif
+    struct timespec times[2] = {st.ST_ATIM, st.ST_MTIM};
+    bool ok = (cloned || CopyContents(in_fd, out_fd)) &&
+              fchmod(out_fd, st.st_mode & 0777) == 0 &&
+              futimens(out_fd, times) == 0;
+    int saved_errno = errno;
+    close(in_fd);
+    if (close(out_fd) != 0 && ok) {
+      ok = false;
+      saved_errno = errno;
+    }
+    if (!ok) {
+      unlinkat(dir_fd, name.c_str(), 0);
+      errno = saved_errno;
+    }
+    return ok;
+  }
+
+  // Copies the rest of "in_fd" to "out_fd". Returns whether that succeeded,
+  // with errno set if not.
+  static bool CopyContents(int in_fd, int out_fd) {
+#if defined(SYS_copy_file_range)
+    // As in CopyManifest, the kernel may copy, or share the blocks.
+    while (true) {
+      ssize_t n = syscall(SYS_copy_file_range, in_fd, NULL, out_fd, NULL,
+                          1 << 30, 0);
+      if (n == 0) {
+        return true;
+      } else if (n < 0) {
+        break;
+      }
+    }
+#endif
+    char buffer[64 * 1024];
+    while (true) {
+      ssize_t n = read(in_fd, buffer, sizeof(buffer));
+      if (n == 0) {
+        return true;
+      } else if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      for (ssize_t written = 0; written < n;) {
+        ssize_t w = write(out_fd, buffer + written, n - written);
+        if (w < 0) {
+          if (errno == EINTR) {
+            continue;
           }
-          break;
+          return false;
+        }
+        written += w;
       }
     }
   }
@@ -375,37 +1137,155 @@ class RunfilesCreator {
       return true;
     }
 
-    EnsureDirReadAndWritePerms(path);
+    DelTrees(std::vector<std::string>(1, path));
+    return true;
+  }
 
-    struct dirent *entry;
-    DIR *dh = opendir(path.c_str());
+  // A directory being deleted by DelTrees.
+  struct DoomedDir {
+    std::string path;
+    uint32_t depth;
+  };
+
+  // Deletes the directories "dirs" and everything in them, with up to
+  // threads_ threads. Every directory is a task of the pool that unlinks its
+  // files and schedules its subdirectories. Then the emptied directories are
+  // removed, deepest first.
+  void DelTrees(const std::vector<std::string> &dirs) {
+    std::mutex mutex;
+    std::vector<DoomedDir> emptied;
+    blaze_util::TaskGroup group(&pool_);
+    std::function<void(const DoomedDir &)> empty =
+        [this, &mutex, &emptied, &group, &empty](const DoomedDir &dir) {
+          std::vector<std::string> subdirs;
+          EmptyDirectory(dir.path, &subdirs);
+          for (const std::string &subdir : subdirs) {
+            DoomedDir doomed = {dir.path + '/' + subdir, dir.depth + 1};
+            group.Schedule([&empty, doomed]() { empty(doomed); });
+          }
+          std::lock_guard<std::mutex> lock(mutex);
+          emptied.push_back(dir);
+        };
+    for (const std::string &dir : dirs) {
+      DoomedDir doomed = {dir, 0};
+      group.Schedule([&empty, doomed]() { empty(doomed); });
+    }
+    group.Wait();
+
+    std::sort(emptied.begin(), emptied.end(),
+              [](const DoomedDir &a, const DoomedDir &b) {
+                return a.depth > b.depth;
+              });
+    size_t i = 0;
+    while (i < emptied.size()) {
+      size_t begin = i;
+      while (i < emptied.size() && emptied[i].depth == emptied[begin].depth) {
+        ++i;
+      }
+      RunInParallel(i - begin, [&emptied, begin](size_t k) {
+        const std::string &path = emptied[begin + k].path;
+        int result = rmdir(path.c_str());
+        if (result != 0 && errno == EACCES) {
+          // The directory containing it has no write permission.
+          size_t slash = path.rfind('/');
+          const std::string parent =
+              slash == std::string::npos ? "." : path.substr(0, slash);
+          if (chmod(parent.c_str(), 0700) != 0) {
+            PDIE("chmod '%s'", parent.c_str());
+          }
+          result = rmdir(path.c_str());
+        }
+        if (result != 0) {
+          PDIE("rmdir '%s'", path.c_str());
+        }
+      });
+    }
+  }
+
+  // Deletes everything in the directory "path" except its subdirectories,
+  // whose names are added to "subdirs". The permissions of the directory are
+  // only fixed when they are in the way.
+  void EmptyDirectory(const std::string &path,
+                      std::vector<std::string> *subdirs) {
+    const int kFlags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW;
+    int fd = open(path.c_str(), kFlags);
+    if (fd < 0 && errno == EACCES) {
+      if (chmod(path.c_str(), 0700) != 0) {
+        PDIE("chmod '%s'", path.c_str());
+      }
+      fd = open(path.c_str(), kFlags);
+    }
+    DIR *dh = fd < 0 ? NULL : fdopendir(fd);
     if (!dh) {
       PDIE("opendir '%s'", path.c_str());
     }
+
+    bool fixed_perms = false;
+    struct dirent *entry;
     errno = 0;
     while ((entry = readdir(dh)) != NULL) {
-      if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
-      const std::string entry_path = path + '/' + entry->d_name;
-      FileType entry_file_type = DentryToFileType(entry_path, entry->d_type);
-      DelTree(entry_path, entry_file_type);
+      const char *name = entry->d_name;
+      if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
+
+      bool is_dir = entry->d_type == DT_DIR;
+      if (entry->d_type == DT_UNKNOWN) {
+        struct stat st;
+        if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+          PDIE("lstating file '%s/%s'", path.c_str(), name);
+        }
+        is_dir = S_ISDIR(st.st_mode);
+      }
+
+      if (is_dir) {
+        subdirs->push_back(name);
+      } else {
+        int result = unlinkat(fd, name, 0);
+        if (result != 0 && errno == EACCES && !fixed_perms) {
+          if (fchmod(fd, 0700) != 0) {
+            PDIE("chmod '%s'", path.c_str());
+          }
+          fixed_perms = true;
+          result = unlinkat(fd, name, 0);
+        }
+#if !defined(__CYGWIN__)
+        if (result != 0) {
+          PDIE("unlinking '%s/%s'", path.c_str(), name);
+        }
+#endif
+      }
       errno = 0;
     }
     if (errno != 0) {
       PDIE("readdir '%s'", path.c_str());
     }
     closedir(dh);
-    if (rmdir(path.c_str()) != 0) {
-      PDIE("rmdir '%s'", path.c_str());
-    }
-    return true;
   }
 
  private:
   std::string output_base_;
   std::string output_filename_;
   std::string temp_filename_;
+  std::string index_filename_;
+  std::string temp_index_filename_;
+  std::string mode_filename_;
+  int threads_;
+  blaze_util::ThreadPool pool_;
+  bool manifest_only_;
+  Mode mode_;
+  bool use_metadata_;
+  // Whether the tree is updated according to the previous manifest.
+  bool incremental_;
 
-  FileInfoMap manifest_;
+  MappedFile input_;
+  MappedFile previous_;
+  // All the paths of the manifests, and an open addressing hash index of them
+  // by directory and name.
+  std::vector<Node> nodes_;
+  std::vector<uint32_t> index_;
+  // The Node of the temp manifest file.
+  uint32_t temp_node_;
+  // The extraneous entries found by ScanTreeAndPrune with threads_ > 1.
+  std::vector<std::pair<std::string, FileType>> doomed_;
 };
 
 int main(int argc, char **argv) {
@@ -414,6 +1294,10 @@ int main(int argc, char **argv) {
   argc--; argv++;
   bool allow_relative = false;
   bool use_metadata = false;
+  bool manifest_only = false;
+  Mode mode = MODE_SYMLINK;
+  int threads = 1;
+  const char *trace_file = NULL;
 
   while (argc >= 1) {
     if (strcmp(argv[0], "--allow_relative") == 0) {
@@ -422,6 +1306,33 @@ int main(int argc, char **argv) {
     } else if (strcmp(argv[0], "--use_metadata") == 0) {
       use_metadata = true;
       argc--; argv++;
+    } else if (strcmp(argv[0], "--manifest_only") == 0) {
+      manifest_only = true;
+      argc--; argv++;
+    } else if (strncmp(argv[0], "--threads=", 10) == 0) {
+      threads = atoi(argv[0] + 10);
+      if (threads < 0) {
+        fprintf(stderr, "%s: invalid value for --threads: '%s'\n", argv0,
+                argv[0] + 10);
+        return 1;
+      }
+      argc--; argv++;
+    } else if (strncmp(argv[0], "--mode=", 7) == 0) {
+      const char *name = argv[0] + 7;
+      size_t m = 0;
+      while (m < sizeof(kModeNames) / sizeof(kModeNames[0]) &&
+             strcmp(name, kModeNames[m]) != 0) {
+        ++m;
+      }
+      if (m == sizeof(kModeNames) / sizeof(kModeNames[0])) {
+        fprintf(stderr, "%s: invalid value for --mode: '%s'\n", argv0, name);
+        return 1;
+      }
+      mode = static_cast<Mode>(m);
+      argc--; argv++;
+    } else if (strncmp(argv[0], "--trace=", 8) == 0) {
+      trace_file = argv[0] + 8;
+      argc--; argv++;
     } else {
       break;
     }
@@ -429,7 +1340,9 @@ int main(int argc, char **argv) {
 
   if (argc != 2) {
     fprintf(stderr, "usage: %s "
-            "[--allow_relative] [--use_metadata] "
+            "[--allow_relative] [--use_metadata] [--manifest_only] "
+            "[--threads=N] [--mode=symlink|hardlink|reflink|copy] "
+            "[--trace=FILE] "
             "INPUT RUNFILES\n",
             argv0);
     return 1;
@@ -447,7 +1360,9 @@ int main(int argc, char **argv) {
     manifest_file = std::string(cwd_buf) + '/' + manifest_file;
   }
 
-  RunfilesCreator runfiles_creator(output_base_dir);
+  blaze_util::StartTracing("build-runfiles", trace_file);
+  RunfilesCreator runfiles_creator(
+      output_base_dir, blaze_util::ThreadCount(threads), manifest_only, mode);
   runfiles_creator.ReadManifest(manifest_file, allow_relative, use_metadata);
   runfiles_creator.CreateRunfiles();
 
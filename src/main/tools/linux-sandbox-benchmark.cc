@@ -0,0 +1,217 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// linux-sandbox-benchmark.cc -- measures the latency of setting up sandboxes.
+//
+// Runs a no-op command (/bin/true) in linux-sandbox over and over, with a
+// given number of writable files (-w) and inaccessible files (-i), and
+// reports the median, minimum and maximum over the runs of the total wall
+// time and of the times of the setup phases that linux-sandbox writes to its
+// statistics file (-S).
+//
+// Usage:
+//   linux-sandbox-benchmark [--runs N] [--writable N] [--inaccessible N]
+//                           [--sandbox path] [-- linux-sandbox flags...]
+
+#include <errno.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+extern char **environ;
+
+namespace {
+
+long long MonotonicMicros() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+void CreateFile(const std::string &path) {
+  FILE *file = fopen(path.c_str(), "w");
+  if (file == NULL || fclose(file) != 0) {
+    fprintf(stderr, "Cannot create %s: %s\n", path.c_str(), strerror(errno));
+    exit(1);
+  }
+}
+
+void CreateDirectory(const std::string &path) {
+  if (mkdir(path.c_str(), 0755) < 0) {
+    fprintf(stderr, "Cannot create %s: %s\n", path.c_str(), strerror(errno));
+    exit(1);
+  }
+}
+
+// Reads the "<name> <number>" lines of a statistics file.
+std::map<std::string, long long> ReadStats(const std::string &path) {
+  std::map<std::string, long long> stats;
+  std::ifstream f(path);
+  std::string name;
+  long long value;
+  while (f >> name >> value) {
+    stats[name] = value;
+  }
+  return stats;
+}
+
+// Runs the sandbox once, adding its wall time and the statistics it wrote to
+// "samples".
+void RunSandbox(const std::vector<std::string> &args,
+                const std::string &stats_path,
+                std::map<std::string, std::vector<long long>> *samples) {
+  std::vector<char *> argv;
+  for (const std::string &arg : args) {
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  }
+  argv.push_back(NULL);
+
+  long long start = MonotonicMicros();
+  pid_t pid;
+  int error = posix_spawn(&pid, argv[0], NULL, NULL, argv.data(), environ);
+  if (error != 0) {
+    fprintf(stderr, "Cannot run %s: %s\n", argv[0], strerror(error));
+    exit(1);
+  }
+  int status;
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "%s failed\n", argv[0]);
+    exit(1);
+  }
+  (*samples)["total_us"].push_back(MonotonicMicros() - start);
+
+  for (const auto &stat : ReadStats(stats_path)) {
+    const std::string &name = stat.first;
+    if (name.compare(0, 6, "setup_") == 0 || name == "command_us") {
+      (*samples)[name].push_back(stat.second);
+    }
+  }
+}
+
+}  // namespace
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: linux-sandbox-benchmark [--runs n] [--writable n] "
+          "[--inaccessible n]\n"
+          "                               [--sandbox path] "
+          "[-- linux-sandbox flags...]\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  int runs = 100;
+  int writable = 0;
+  int inaccessible = 0;
+  std::string sandbox = "src/main/tools/linux-sandbox";
+  std::vector<std::string> extra_flags;
+  for (int ii = 1; ii < argc; ++ii) {
+    if (strcmp(argv[ii], "--runs") == 0) {
+      if (++ii == argc || (runs = atoi(argv[ii])) < 1) {
+        usage();
+      }
+    } else if (strcmp(argv[ii], "--writable") == 0) {
+      if (++ii == argc || (writable = atoi(argv[ii])) < 0) {
+        usage();
+      }
+    } else if (strcmp(argv[ii], "--inaccessible") == 0) {
+      if (++ii == argc || (inaccessible = atoi(argv[ii])) < 0) {
+        usage();
+      }
+    } else if (strcmp(argv[ii], "--sandbox") == 0) {
+      if (++ii == argc) {
+        usage();
+      }
+      sandbox = argv[ii];
+    } else if (strcmp(argv[ii], "--") == 0) {
+      extra_flags.assign(argv + ii + 1, argv + argc);
+      break;
+    } else {
+      usage();
+    }
+  }
+
+  // Not below /tmp, which the sandbox hides behind a tmpfs.
+  const char *tmpdir_root = getenv("TEST_TMPDIR");
+  std::string tmpdir = std::string(tmpdir_root ? tmpdir_root : "/var/tmp") +
+                       "/sandbox_bm.XXXXXX";
+  if (mkdtemp(&tmpdir[0]) == NULL) {
+    fprintf(stderr, "Cannot create %s: %s\n", tmpdir.c_str(),
+            strerror(errno));
+    return 1;
+  }
+  std::string work_dir = tmpdir + "/work";
+  CreateDirectory(work_dir);
+  std::string stats_path = tmpdir + "/stats";
+
+  // The -w and -i flags go into a parameter file, like Bazel passes them.
+  std::vector<std::string> files;
+  std::string params_path = tmpdir + "/params";
+  {
+    std::ofstream params(params_path);
+    for (int i = 0; i < writable; ++i) {
+      files.push_back(work_dir + "/w" + std::to_string(i));
+      CreateFile(files.back());
+      params << "-w\n" << files.back() << "\n";
+    }
+    for (int i = 0; i < inaccessible; ++i) {
+      files.push_back(tmpdir + "/i" + std::to_string(i));
+      CreateFile(files.back());
+      params << "-i\n" << files.back() << "\n";
+    }
+  }
+
+  std::vector<std::string> args = {sandbox, "-W", work_dir, "-S", stats_path,
+                                   "@" + params_path};
+  args.insert(args.end(), extra_flags.begin(), extra_flags.end());
+  args.push_back("--");
+  args.push_back("/bin/true");
+
+  std::map<std::string, std::vector<long long>> samples;
+  for (int run = 0; run < runs; ++run) {
+    RunSandbox(args, stats_path, &samples);
+  }
+
+  printf("%d runs, %d writable files, %d inaccessible files\n", runs, writable,
+         inaccessible);
+  printf("%-28s %10s %10s %10s\n", "", "median", "min", "max");
+  for (auto &sample : samples) {
+    std::vector<long long> &values = sample.second;
+    std::sort(values.begin(), values.end());
+    printf("%-28s %10lld %10lld %10lld\n", sample.first.c_str(),
+           values[values.size() / 2], values.front(), values.back());
+  }
+
+  for (const std::string &file : files) {
+    unlink(file.c_str());
+  }
+  unlink(params_path.c_str());
+  unlink(stats_path.c_str());
+  rmdir(work_dir.c_str());
+  rmdir(tmpdir.c_str());
+  return 0;
+}
@@ -24,22 +24,23 @@
   }
 
 #include <errno.h>
+#include <fcntl.h>
+#include <pwd.h>
 #include <sched.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
-#include <fstream>
-#include <iostream>
 #include <memory>
 #include <string>
 #include <vector>
 
-using std::ifstream;
 using std::unique_ptr;
 using std::vector;
 
@@ -64,13 +65,51 @@ static void Usage(char *program_name, const char *fmt, ...) {
           "killing the child with SIGKILL\n"
           "  -l <file>  redirect stdout to a file\n"
           "  -L <file>  redirect stderr to a file\n"
+          "  -S <file>  write the wall time and resource usage of the command, "
+          "and how long\n"
+          "             the phases of setting up the sandbox took, to a file\n"
           "  -w <file>  make a file or directory writable for the sandboxed "
           "process\n"
           "  -i <file>  make a file or directory inaccessible for the "
           "sandboxed process\n"
-          "  -e <dir>  mount an empty tmpfs on a directory\n"
+          "  -e <dir>[:<options>]  mount an empty tmpfs on a directory, with "
+          "tmpfs mount\n"
+          "             options such as size=512M\n"
+          "  -o <dir>[:<options>]  let the command write to this directory in "
+          "an empty\n"
+          "             tmpfs (with options as for -e), whose contents are "
+          "copied into\n"
+          "             the directory when the command exits\n"
+          "  -M <file>  create the inputs listed in this manifest (lines of "
+          "the form\n"
+          "             '<path relative to the working directory> <target>') "
+          "as symlinks\n"
+          "             in the working directory\n"
+          "  -O <dir>  an empty directory on the same filesystem as the "
+          "working directory;\n"
+          "             if set, the inputs of -M are created in a tmpfs which "
+          "is overlaid\n"
+          "             with the working directory instead\n"
+          "  -c <dir>  run the command in a new cgroup below this cgroup v2 "
+          "directory\n"
+          "  -s <file>=<value>  write the value to a file of that cgroup, e.g. "
+          "memory.max=4G,\n"
+          "             pids.max=1000, cpu.max=\"200000 100000\" or "
+          "cpuset.cpus=0-3\n"
+          "  -I <profile>  the isolation besides the filesystem view: 'full' "
+          "(default)\n"
+          "             creates PID, UTS and IPC namespaces, 'fs+pid' only a "
+          "PID namespace\n"
+          "             and 'fs-only' none of them, for trusted commands\n"
           "  -N  if set, a new network namespace will be created\n"
+          "  -n <file>  join the network namespace at this path (e.g. "
+          "/proc/<pid>/ns/net,\n"
+          "             which has to have its loopback interface up) "
+          "instead of creating one\n"
           "  -R  if set, make the uid/gid be root, otherwise use nobody\n"
+          "  -u <uid>:<gid>  use this uid/gid instead of looking up nobody "
+          "(as printed\n"
+          "             by -C)\n"
           "  -D  if set, debug info will be printed\n"
           "  @FILE  read newline-separated arguments from FILE\n"
           "  --  command to run inside sandbox, followed by arguments\n");
@@ -105,6 +144,39 @@ static int CheckNamespacesSupported() {
   return EXIT_SUCCESS;
 }
 
+// Prints the uid and gid of nobody for -u, or nothing if there is no such
+// user. Looking them up can be slow when the password database is remote, so
+// the caller of -C keeps them for the sandboxes it starts.
+static void PrintNobodyIds() {
+  struct passwd *pwd = getpwnam("nobody");
+  if (pwd != NULL) {
+    printf("%d:%d\n", static_cast<int>(pwd->pw_uid),
+           static_cast<int>(pwd->pw_gid));
+  }
+}
+
+// Parses the argument of -e or -o, of the form <dir>[:<tmpfs mount options>],
+// into the directory and its options (NULL if there are none). Only a last
+// colon followed by an option with a value starts the options, so that other
+// colons in directory names remain possible.
+static void ParseTmpfsArgument(char *program_name, char option,
+                               const char *arg, const char **dir,
+                               const char **options) {
+  if (arg[0] != '/') {
+    Usage(program_name, "The -%c option must be used with absolute paths only.",
+          option);
+  }
+  char *copy = strdup(arg);
+  char *colon = strrchr(copy, ':');
+  if (colon != NULL && strchr(colon, '=') != NULL) {
+    *colon = '\0';
+    *options = colon + 1;
+  } else {
+    *options = NULL;
+  }
+  *dir = copy;
+}
+
 // Parses command line flags from an argv array and puts the results into an
 // Options structure passed in as an argument.
 static void ParseCommandLine(unique_ptr<vector<char *>> args) {
@@ -112,12 +184,14 @@ static void ParseCommandLine(unique_ptr<vector<char *>> args) {
   extern int optind, optopt;
   int c;
 
-  while ((c = getopt(args->size(), args->data(), ":CS:W:T:t:l:L:w:i:e:NRD")) !=
-         -1) {
+  while ((c = getopt(args->size(), args->data(),
+                     ":CS:W:T:t:l:L:w:i:e:o:M:O:c:s:I:Nn:Ru:D")) != -1) {
     switch (c) {
       case 'C':
         // Shortcut for the "does this system support sandboxing" check.
-        exit(CheckNamespacesSupported());
+        CheckNamespacesSupported();
+        PrintNobodyIds();
+        exit(EXIT_SUCCESS);
         break;
       case 'W':
         if (opt.working_dir == NULL) {
@@ -159,6 +233,14 @@ static void ParseCommandLine(unique_ptr<vector<char *>> args) {
                 "Cannot redirect stderr to more than one destination.");
         }
         break;
+      case 'S':
+        if (opt.stats_path == NULL) {
+          opt.stats_path = optarg;
+        } else {
+          Usage(args->front(),
+                "Cannot write the statistics to more than one destination.");
+        }
+        break;
       case 'w':
         if (optarg[0] != '/') {
           Usage(args->front(),
@@ -173,19 +255,100 @@ static void ParseCommandLine(unique_ptr<vector<char *>> args) {
         }
         opt.inaccessible_files.push_back(strdup(optarg));
         break;
-      case 'e':
-        if (optarg[0] != '/') {
+      case 'e': {
+        const char *dir, *options;
+        ParseTmpfsArgument(args->front(), 'e', optarg, &dir, &options);
+        opt.tmpfs_dirs.push_back(dir);
+        opt.tmpfs_options.push_back(options);
+        break;
+      }
+      case 'o': {
+        const char *dir, *options;
+        ParseTmpfsArgument(args->front(), 'o', optarg, &dir, &options);
+        opt.staged_dirs.push_back(dir);
+        opt.staged_options.push_back(options);
+        break;
+      }
+      case 'M':
+        if (opt.input_manifest == NULL) {
+          opt.input_manifest = strdup(optarg);
+        } else {
           Usage(args->front(),
-                "The -e option must be used with absolute paths only.");
+                "Multiple input manifests (-M) specified, expected one.");
+        }
+        break;
+      case 'O':
+        if (opt.overlay_work_dir == NULL) {
+          if (optarg[0] != '/') {
+            Usage(args->front(),
+                  "The -O option must be used with absolute paths only.");
+          }
+          opt.overlay_work_dir = strdup(optarg);
+        } else {
+          Usage(args->front(),
+                "Multiple overlay work directories (-O) specified, expected "
+                "one.");
+        }
+        break;
+      case 'c':
+        if (opt.cgroup_parent == NULL) {
+          if (optarg[0] != '/') {
+            Usage(args->front(),
+                  "The -c option must be used with absolute paths only.");
+          }
+          opt.cgroup_parent = strdup(optarg);
+        } else {
+          Usage(args->front(),
+                "Multiple parent cgroups (-c) specified, expected one.");
+        }
+        break;
+      case 's': {
+        const char *equals = strchr(optarg, '=');
+        if (equals == NULL || equals == optarg ||
+            memchr(optarg, '/', equals - optarg) != NULL) {
+          Usage(args->front(),
+                "The -s option must be of the form <file>=<value>: %s", optarg);
+        }
+        opt.cgroup_settings.push_back(strdup(optarg));
+        break;
+      }
+      case 'I':
+        if (strcmp(optarg, "full") == 0) {
+          opt.isolation = ISOLATE_FULL;
+        } else if (strcmp(optarg, "fs+pid") == 0) {
+          opt.isolation = ISOLATE_FS_PID;
+        } else if (strcmp(optarg, "fs-only") == 0) {
+          opt.isolation = ISOLATE_FS_ONLY;
+        } else {
+          Usage(args->front(), "Invalid isolation profile (-I) value: %s",
+                optarg);
         }
-        opt.tmpfs_dirs.push_back(strdup(optarg));
         break;
       case 'N':
         opt.create_netns = true;
         break;
+      case 'n':
+        if (opt.netns_path == NULL) {
+          opt.netns_path = strdup(optarg);
+        } else {
+          Usage(args->front(),
+                "Multiple network namespaces (-n) specified, expected one.");
+        }
+        break;
       case 'R':
         opt.fake_root = true;
         break;
+      case 'u': {
+        char end;
+        if (sscanf(optarg, "%d:%d%c", &opt.inner_uid, &opt.inner_gid, &end) !=
+                2 ||
+            opt.inner_uid < 0 || opt.inner_gid < 0) {
+          Usage(args->front(), "The -u option must be of the form <uid>:<gid>: %s",
+                optarg);
+        }
+        opt.has_inner_ids = true;
+        break;
+      }
       case 'D':
         opt.debug = true;
         break;
@@ -207,32 +370,100 @@ static void ParseCommandLine(unique_ptr<vector<char *>> args) {
   }
 }
 
-// Expands a single argument, expanding options @filename to read in the content
-// of the file and add it to the list of processed arguments.
-unique_ptr<vector<char *>> ExpandArgument(unique_ptr<vector<char *>> expanded,
-                                          char *arg) {
-  if (arg[0] == '@') {
-    const char *filename = arg + 1;  // strip off the '@'.
-    ifstream f(filename);
-
-    if (!f.is_open()) {
-      DIE("opening argument file %s failed", filename);
+// Reads the argument file "filename" and sets *size to its length. Regular
+// files are mapped copy-on-write, so that ExpandArgument can NUL-terminate the
+// lines in place; others (such as pipes) are read into a buffer. The result is
+// never freed, because the arguments point into it.
+static char *ReadArgumentFile(const char *filename, size_t *size) {
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    DIE("opening argument file %s failed", filename);
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    DIE("fstat(%s)", filename);
+  }
+  char *data = NULL;
+  *size = 0;
+  if (S_ISREG(st.st_mode)) {
+    *size = st.st_size;
+    if (*size > 0) {
+      data = static_cast<char *>(
+          mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0));
+      if (data == MAP_FAILED) {
+        DIE("mmap(%s)", filename);
+      }
     }
-
-    for (std::string line; std::getline(f, line);) {
-      if (line.length() > 0) {
-        expanded = ExpandArgument(std::move(expanded), strdup(line.c_str()));
+  } else {
+    size_t capacity = 0;
+    for (;;) {
+      if (*size == capacity) {
+        capacity = capacity > 0 ? 2 * capacity : 4096;
+        data = static_cast<char *>(realloc(data, capacity));
+        if (data == NULL) {
+          DIE("realloc");
+        }
+      }
+      ssize_t n = read(fd, data + *size, capacity - *size);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      } else if (n < 0) {
+        DIE("error while reading from argument file %s", filename);
+      } else if (n == 0) {
+        break;
       }
+      *size += n;
     }
+  }
+  close(fd);
+  return data;
+}
+
+// The part of an argument file that is yet to be expanded.
+struct ArgumentFile {
+  char *next;
+  char *end;
+};
 
-    if (f.bad()) {
-      DIE("error while reading from argument file %s", filename);
+// Expands a single argument, expanding options @filename to read in the content
+// of the file and add it to the list of processed arguments. The lines of the
+// file, which may themselves be @filename options, are NUL-terminated in place
+// rather than copied. Empty lines are skipped.
+static void ExpandArgument(vector<char *> *expanded, char *arg) {
+  // The argument files being read, innermost last.
+  vector<ArgumentFile> files;
+  for (;;) {
+    if (arg != NULL && arg[0] == '@') {
+      size_t size;
+      char *data = ReadArgumentFile(arg + 1, &size);  // strip off the '@'.
+      files.push_back({data, data + size});
+    } else if (arg != NULL) {
+      expanded->push_back(arg);
+    }
+    if (files.empty()) {
+      return;
     }
-  } else {
-    expanded->push_back(arg);
-  }
 
-  return expanded;
+    ArgumentFile *file = &files.back();
+    if (file->next == file->end) {
+      files.pop_back();
+      arg = NULL;
+      continue;
+    }
+    char *line = file->next;
+    char *newline =
+        static_cast<char *>(memchr(line, '\n', file->end - line));
+    if (newline != NULL) {
+      *newline = '\0';
+      file->next = newline + 1;
+    } else {
+      // The last line has no newline to overwrite, and there may be no room
+      // after the mapping for a NUL.
+      line = strndup(line, file->end - line);
+      file->next = file->end;
+    }
+    arg = line[0] != '\0' ? line : NULL;
+  }
 }
 
 // Pre-processes an argument list, expanding options @filename to read in the
@@ -243,7 +474,7 @@ unique_ptr<vector<char *>> ExpandArguments(const vector<char *> &args) {
   expanded->reserve(args.size());
   for (auto arg = args.begin(); arg != args.end(); ++arg) {
     if (strcmp(*arg, "--") != 0) {
-      expanded = ExpandArgument(std::move(expanded), *arg);
+      ExpandArgument(expanded.get(), *arg);
     } else {
       expanded->insert(expanded->end(), arg, args.end());
       break;
@@ -261,7 +492,20 @@ void ParseOptions(int argc, char *argv[]) {
     Usage(args.front(), "No command specified.");
   }
 
+  if (opt.create_netns && opt.netns_path != NULL) {
+    Usage(args.front(), "The -N and -n options are mutually exclusive.");
+  }
+
+  if (!opt.cgroup_settings.empty() && opt.cgroup_parent == NULL) {
+    Usage(args.front(), "The -s option requires a parent cgroup (-c).");
+  }
+
+  if (opt.overlay_work_dir != NULL && opt.input_manifest == NULL) {
+    Usage(args.front(), "The -O option requires an input manifest (-M).");
+  }
+
   opt.tmpfs_dirs.push_back("/tmp");
+  opt.tmpfs_options.push_back(NULL);
 
   if (opt.working_dir == NULL) {
     opt.working_dir = getcwd(NULL, 0);
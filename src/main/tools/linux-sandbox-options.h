@@ -20,6 +20,17 @@
 
 #include <vector>
 
+// Which namespaces the sandbox creates besides those needed for the filesystem
+// view (user and mount), and so which setup steps it can skip (-I).
+enum IsolationProfile {
+  // Also PID, UTS and IPC namespaces, with a new /proc (the default)
+  ISOLATE_FULL,
+  // Also a PID namespace, with a new /proc
+  ISOLATE_FS_PID,
+  // Only the filesystem view
+  ISOLATE_FS_ONLY,
+};
+
 // Options parsing result.
 struct Options {
   // Working directory (-W)
@@ -32,16 +43,42 @@ struct Options {
   const char *stdout_path;
   // Where to redirect stderr (-L)
   const char *stderr_path;
+  // Where to write the resource usage of the command (-S)
+  const char *stats_path;
   // Files to make writable for the sandboxed process (-w)
   std::vector<const char *> writable_files;
   // Files to make inaccessible for the sandboxed process (-i)
   std::vector<const char *> inaccessible_files;
   // Directories where to mount an empty tmpfs (-e)
   std::vector<const char *> tmpfs_dirs;
+  // The mount options of each of those tmpfs, such as size=1G, or NULL
+  std::vector<const char *> tmpfs_options;
+  // Writable directories whose writes go to a tmpfs, copied into them when the
+  // command exits (-o)
+  std::vector<const char *> staged_dirs;
+  // The mount options of each of those tmpfs, or NULL
+  std::vector<const char *> staged_options;
+  // Manifest of the inputs to create in the working directory (-M)
+  const char *input_manifest;
+  // Work directory for the overlayfs mounted on the working directory (-O)
+  const char *overlay_work_dir;
+  // cgroup v2 directory below which to create a cgroup for the command (-c)
+  const char *cgroup_parent;
+  // Settings of that cgroup, as <file>=<value> (-s)
+  std::vector<const char *> cgroup_settings;
+  // The namespaces to create (-I)
+  IsolationProfile isolation;
   // Create a new network namespace (-N)
   bool create_netns;
+  // Network namespace to join instead of creating one (-n)
+  const char *netns_path;
   // Pretend to be root inside the namespace (-R)
   bool fake_root;
+  // The uid and gid to have inside the namespace instead of those of nobody,
+  // so that the password database is not read (-u)
+  bool has_inner_ids;
+  int inner_uid;
+  int inner_gid;
   // Print debugging messages (-D)
   bool debug;
   // Command to run (--)
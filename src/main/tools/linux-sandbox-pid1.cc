@@ -32,6 +32,7 @@
     _exit(EXIT_FAILURE);                                 \
   }
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
@@ -48,15 +49,41 @@
 #include <sys/ioctl.h>
 #include <sys/mount.h>
 #include <sys/prctl.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <fstream>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
 static int global_child_pid;
 static char global_inaccessible_directory[] = "/tmp/empty.XXXXXX";
 static char global_inaccessible_file[] = "/tmp/empty.XXXXXX";
+// The writable files that MountFilesystems bind-mounted.
+static std::vector<const char *> global_writable_mounts;
+// The real directories behind the tmpfs of opt.staged_dirs, open from outside
+// the sandbox.
+static std::vector<int> global_staged_dir_fds;
+
+// When the command was forked, for SetupTimes::command_us.
+static long long global_command_start_us;
+
+// Runs "phase", recording how long it took in global_setup_times.
+static void TimePhase(void (*phase)(), long long SetupTimes::*time) {
+  if (global_setup_times == NULL) {
+    phase();
+    return;
+  }
+  long long start = MonotonicMicros();
+  phase();
+  global_setup_times->*time = MonotonicMicros() - start;
+}
 
 static void SetupSelfDestruction(int *sync_pipe) {
   // We could also poll() on the pipe fd to find out when the parent goes away,
@@ -123,7 +150,10 @@ static void SetupUserNamespace() {
   }
 
   int inner_uid = 0, inner_gid = 0;
-  if (!opt.fake_root) {
+  if (!opt.fake_root && opt.has_inner_ids) {
+    inner_uid = opt.inner_uid;
+    inner_gid = opt.inner_gid;
+  } else if (!opt.fake_root) {
     struct passwd *pwd = getpwnam("nobody");
     if (pwd == NULL) {
       DIE("unable to find passwd entry for user nobody")
@@ -167,7 +197,200 @@ static void SetupHelperFiles() {
   }
 }
 
+typedef std::vector<std::pair<std::string, std::string>> InputManifest;
+
+// Reads the input manifest (-M): one input per line, its path relative to the
+// working directory and the path it is a symlink to, separated by a space.
+static InputManifest ReadInputManifest() {
+  std::ifstream f(opt.input_manifest);
+  if (!f.is_open()) {
+    DIE("opening input manifest %s failed", opt.input_manifest);
+  }
+
+  InputManifest inputs;
+  for (std::string line; std::getline(f, line);) {
+    if (line.empty()) {
+      continue;
+    }
+    size_t space = line.find(' ');
+    if (space == std::string::npos || space == 0 || line[0] == '/') {
+      DIE("invalid line in input manifest %s: %s", opt.input_manifest,
+          line.c_str());
+    }
+    inputs.emplace_back(line.substr(0, space), line.substr(space + 1));
+  }
+
+  if (f.bad()) {
+    DIE("error while reading from input manifest %s", opt.input_manifest);
+  }
+  return inputs;
+}
+
+// Creates the directory and its parents, unless they are in created_dirs.
+static void CreateDirectories(const std::string &path,
+                              std::unordered_set<std::string> *created_dirs) {
+  if (created_dirs->count(path) > 0) {
+    return;
+  }
+  size_t slash = path.rfind('/');
+  if (slash != std::string::npos && slash > 0) {
+    CreateDirectories(path.substr(0, slash), created_dirs);
+  }
+  if (mkdir(path.c_str(), 0755) < 0 && errno != EEXIST) {
+    DIE("mkdir(%s, 0755)", path.c_str());
+  }
+  created_dirs->insert(path);
+}
+
+// Creates the inputs as symlinks below dir. Like the server does, this creates
+// all the parent directories before the first symlink, so that an input nested
+// in another one fails with EEXIST instead of being created through the
+// symlink to a directory.
+static void CreateInputs(const std::string &dir, const InputManifest &inputs) {
+  std::unordered_set<std::string> created_dirs = {dir};
+  for (const auto &input : inputs) {
+    std::string path = dir + "/" + input.first;
+    CreateDirectories(path.substr(0, path.rfind('/')), &created_dirs);
+  }
+
+  for (const auto &input : inputs) {
+    std::string path = dir + "/" + input.first;
+    if (symlink(input.second.c_str(), path.c_str()) < 0) {
+      DIE("symlink(%s, %s)", input.second.c_str(), path.c_str());
+    }
+  }
+}
+
+// Creates the inputs in a tmpfs mounted on the working directory at dir, and
+// mounts an overlayfs on top of it with the real working directory as the
+// upper layer. The inputs are then visible in the working directory without
+// having been created there, and everything written ends up in the real
+// working directory. Returns false if overlayfs cannot be used here (e.g. in
+// a user namespace before Linux 5.11).
+static bool MountInputsOverlay(const std::string &dir,
+                               const InputManifest &inputs) {
+  // The mount options are separated by commas and the layers by colons.
+  if (strpbrk(dir.c_str(), ",:") != NULL ||
+      strpbrk(opt.working_dir, ",:") != NULL ||
+      strpbrk(opt.overlay_work_dir, ",:") != NULL) {
+    PRINT_DEBUG("cannot use overlayfs with these paths");
+    return false;
+  }
+
+  if (mount("tmpfs", dir.c_str(), "tmpfs", MS_NOSUID | MS_NODEV | MS_NOATIME,
+            "mode=0755") < 0) {
+    DIE("mount(tmpfs, %s, tmpfs, MS_NOSUID | MS_NODEV | MS_NOATIME, "
+        "mode=0755)",
+        dir.c_str());
+  }
+  CreateInputs(dir, inputs);
+
+  std::string options = "lowerdir=" + dir + ",upperdir=" + opt.working_dir +
+                        ",workdir=" + opt.overlay_work_dir + ",userxattr";
+  PRINT_DEBUG("overlay: %s", options.c_str());
+  if (mount("overlay", dir.c_str(), "overlay", 0, options.c_str()) < 0) {
+    PRINT_DEBUG("mount(overlay, %s, overlay, 0, %s) failed: %s", dir.c_str(),
+                options.c_str(), strerror(errno));
+    if (umount2(dir.c_str(), MNT_DETACH) < 0) {
+      DIE("umount2(%s, MNT_DETACH)", dir.c_str());
+    }
+    return false;
+  }
+  return true;
+}
+
+// Returns true if path is the working directory or below it.
+static bool IsInWorkingDir(const char *path) {
+  size_t length = strlen(opt.working_dir);
+  return strncmp(path, opt.working_dir, length) == 0 &&
+         (path[length] == '\0' || path[length] == '/');
+}
+
+// Mounts an empty tmpfs with the mount options "options" (or none, if NULL) on
+// "dir" in the sandbox.
+static void MountTmpfs(const char *dir, const char *options) {
+  PRINT_DEBUG("tmpfs: %s%s%s", dir, options != NULL ? " with " : "",
+              options != NULL ? options : "");
+  if (mount("tmpfs", dir + 1, "tmpfs", MS_NOSUID | MS_NODEV | MS_NOATIME,
+            options) < 0) {
+    DIE("mount(tmpfs, %s, tmpfs, MS_NOSUID | MS_NODEV | MS_NOATIME, %s)",
+        dir + 1, options != NULL ? options : "NULL");
+  }
+}
+
+// Returns the mount points of our mount namespace.
+static std::unordered_set<std::string> MountPoints() {
+  FILE *mounts = setmntent("/proc/self/mounts", "r");
+  if (mounts == NULL) {
+    DIE("setmntent");
+  }
+  std::unordered_set<std::string> mount_points;
+  struct mntent *ent;
+  while ((ent = getmntent(mounts)) != NULL) {
+    mount_points.insert(ent->mnt_dir);
+  }
+  endmntent(mounts);
+  return mount_points;
+}
+
+// Returns the closest parent directory of "path" in "paths", or an empty
+// string if there is none.
+static std::string ClosestParentIn(const std::string &path,
+                                   const std::unordered_set<std::string> &paths) {
+  for (size_t i = path.rfind('/'); i != std::string::npos && i > 0;
+       i = path.rfind('/', i - 1)) {
+    std::string parent(path, 0, i);
+    if (paths.count(parent) > 0) {
+      return parent;
+    }
+  }
+  return std::string();
+}
+
+// Returns whether the bind mount of the directory "dir" makes its descendant
+// "path" visible: not if there is a mount point or a symlink on the way, which
+// a bind mount without MS_REC would not carry along.
+static bool IsOnSameMount(const std::string &path, const std::string &dir,
+                          const std::unordered_set<std::string> &mount_points) {
+  for (std::string p = path; p != dir; p.resize(p.rfind('/'))) {
+    struct stat sb;
+    if (mount_points.count(p) > 0 || lstat(p.c_str(), &sb) < 0 ||
+        S_ISLNK(sb.st_mode)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Returns the writable files that need a bind mount of their own. Those that
+// the bind mount of another writable directory makes visible already do not,
+// so that actions with many outputs below a few directories do not pay a
+// mount (and a trip through the namespace lock) for each.
+static std::vector<const char *> WritableMountPaths(
+    const std::unordered_set<std::string> &mount_points) {
+  std::unordered_set<std::string> writable_files(opt.writable_files.begin(),
+                                                 opt.writable_files.end());
+  std::unordered_set<std::string> seen;
+  std::vector<const char *> result;
+  for (const char *writable_file : opt.writable_files) {
+    if (!seen.insert(writable_file).second) {
+      continue;
+    }
+    std::string dir = ClosestParentIn(writable_file, writable_files);
+    if (!dir.empty() && IsOnSameMount(writable_file, dir, mount_points)) {
+      PRINT_DEBUG("writable through %s: %s", dir.c_str(), writable_file);
+      continue;
+    }
+    result.push_back(writable_file);
+  }
+  return result;
+}
+
 static void MountFilesystems() {
+  // Collected before the sandbox adds its own.
+  std::unordered_set<std::string> mount_points = MountPoints();
+  global_writable_mounts = WritableMountPaths(mount_points);
+
   if (mount("/", global_sandbox_root, NULL, MS_BIND | MS_REC, NULL) < 0) {
     DIE("mount(/, %s, NULL, MS_BIND | MS_REC, NULL)", global_sandbox_root);
   }
@@ -176,13 +399,8 @@ static void MountFilesystems() {
     DIE("chdir(%s)", global_sandbox_root);
   }
 
-  for (const char *tmpfs_dir : opt.tmpfs_dirs) {
-    PRINT_DEBUG("tmpfs: %s", tmpfs_dir);
-    if (mount("tmpfs", tmpfs_dir + 1, "tmpfs",
-              MS_NOSUID | MS_NODEV | MS_NOATIME, NULL) < 0) {
-      DIE("mount(tmpfs, %s, tmpfs, MS_NOSUID | MS_NODEV | MS_NOATIME, NULL)",
-          tmpfs_dir + 1);
-    }
+  for (size_t i = 0; i < opt.tmpfs_dirs.size(); ++i) {
+    MountTmpfs(opt.tmpfs_dirs[i], opt.tmpfs_options[i]);
   }
 
   // Make sure that our working directory is a mount point. The easiest way to
@@ -192,7 +410,25 @@ static void MountFilesystems() {
         opt.working_dir + 1);
   }
 
-  for (const char *writable_file : opt.writable_files) {
+  bool inputs_overlaid = false;
+  if (opt.input_manifest != NULL) {
+    InputManifest inputs = ReadInputManifest();
+    std::string dir = global_sandbox_root + std::string(opt.working_dir);
+    if (opt.overlay_work_dir != NULL) {
+      inputs_overlaid = MountInputsOverlay(dir, inputs);
+    }
+    if (!inputs_overlaid) {
+      CreateInputs(dir, inputs);
+    }
+  }
+
+  for (const char *writable_file : global_writable_mounts) {
+    // The overlay is writable already, and bind-mounting the real directory
+    // would hide the inputs in it.
+    if (inputs_overlaid && IsInWorkingDir(writable_file)) {
+      PRINT_DEBUG("writable through the overlay: %s", writable_file);
+      continue;
+    }
     PRINT_DEBUG("writable: %s", writable_file);
     if (mount(writable_file, writable_file + 1, NULL, MS_BIND, NULL) < 0) {
       DIE("mount(%s, %s, NULL, MS_BIND, NULL)", writable_file,
@@ -200,15 +436,43 @@ static void MountFilesystems() {
     }
   }
 
+  // Opened before the tmpfs hides them, to copy the staged writes into later.
+  for (size_t i = 0; i < opt.staged_dirs.size(); ++i) {
+    int fd = open(opt.staged_dirs[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+      DIE("open(%s)", opt.staged_dirs[i]);
+    }
+    global_staged_dir_fds.push_back(fd);
+    MountTmpfs(opt.staged_dirs[i], opt.staged_options[i]);
+  }
+
   SetupHelperFiles();
 
+  // Masking a directory hides everything below it, mounts included, so the
+  // inaccessible paths below another inaccessible directory need no mount.
+  std::vector<const char *> inaccessible_files;
+  std::vector<bool> inaccessible_is_dir;
+  std::unordered_set<std::string> inaccessible_dirs;
   for (const char *inaccessible_file : opt.inaccessible_files) {
     struct stat sb;
     if (stat(inaccessible_file, &sb) < 0) {
       DIE("stat(%s)", inaccessible_file);
     }
+    if (S_ISDIR(sb.st_mode) &&
+        !inaccessible_dirs.insert(inaccessible_file).second) {
+      continue;  // a duplicate
+    }
+    inaccessible_files.push_back(inaccessible_file);
+    inaccessible_is_dir.push_back(S_ISDIR(sb.st_mode));
+  }
 
-    if (S_ISDIR(sb.st_mode)) {
+  for (size_t i = 0; i < inaccessible_files.size(); ++i) {
+    const char *inaccessible_file = inaccessible_files[i];
+    std::string dir = ClosestParentIn(inaccessible_file, inaccessible_dirs);
+    if (!dir.empty()) {
+      PRINT_DEBUG("inaccessible through %s: %s", dir.c_str(),
+                  inaccessible_file);
+    } else if (inaccessible_is_dir[i]) {
       PRINT_DEBUG("inaccessible dir: %s", inaccessible_file);
       if (mount(global_inaccessible_directory, inaccessible_file + 1, NULL,
                 MS_BIND, NULL) < 0) {
@@ -226,33 +490,64 @@ static void MountFilesystems() {
   }
 }
 
-// We later remount everything read-only, except the paths for which this method
-// returns true.
-static bool ShouldBeWritable(char *mnt_dir) {
-  mnt_dir += strlen(global_sandbox_root);
-
-  if (strcmp(mnt_dir, opt.working_dir) == 0) {
-    return true;
-  }
-
-  for (const char *writable_file : opt.writable_files) {
-    if (strcmp(mnt_dir, writable_file) == 0) {
-      return true;
-    }
-  }
+// We later remount everything read-only, except the mounts at these paths
+// (relative to the sandbox root).
+static std::unordered_set<std::string> WritableMounts() {
+  std::unordered_set<std::string> writable_mounts(
+      global_writable_mounts.begin(), global_writable_mounts.end());
+  writable_mounts.insert(opt.tmpfs_dirs.begin(), opt.tmpfs_dirs.end());
+  writable_mounts.insert(opt.staged_dirs.begin(), opt.staged_dirs.end());
+  writable_mounts.insert(opt.working_dir);
+  return writable_mounts;
+}
 
-  for (const char *tmpfs_dir : opt.tmpfs_dirs) {
-    if (strcmp(mnt_dir, tmpfs_dir) == 0) {
-      return true;
+#if defined(SYS_mount_setattr) && defined(MOUNT_ATTR_RDONLY)
+// Makes the mounts read-only with mount_setattr (Linux 5.12 or later): one
+// call for the whole tree under the sandbox root, and one per writable mount
+// to make it writable again. Returns false if that is not supported, or if
+// anything fails, which the remounting fallback then has to deal with.
+static bool SetMountsReadOnlyAttribute(
+    const std::unordered_set<std::string> &writable_mounts) {
+  struct mount_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.attr_set = MOUNT_ATTR_RDONLY;
+  if (syscall(SYS_mount_setattr, AT_FDCWD, global_sandbox_root, AT_RECURSIVE,
+              &attr, sizeof(attr)) < 0) {
+    PRINT_DEBUG("mount_setattr(%s) failed: %s", global_sandbox_root,
+                strerror(errno));
+    return false;
+  }
+
+  memset(&attr, 0, sizeof(attr));
+  attr.attr_clr = MOUNT_ATTR_RDONLY;
+  for (const std::string &writable_mount : writable_mounts) {
+    std::string path = global_sandbox_root + writable_mount;
+    PRINT_DEBUG("remount rw: %s", path.c_str());
+    if (syscall(SYS_mount_setattr, AT_FDCWD, path.c_str(), 0, &attr,
+                sizeof(attr)) < 0) {
+      PRINT_DEBUG("mount_setattr(%s) failed: %s", path.c_str(),
+                  strerror(errno));
+      return false;
     }
   }
-
+  return true;
+}
+#else
+static bool SetMountsReadOnlyAttribute(
+    const std::unordered_set<std::string> &writable_mounts) {
   return false;
 }
+#endif
 
-// Makes the whole filesystem read-only, except for the paths for which
-// ShouldBeWritable returns true.
+// Makes the whole filesystem read-only, except for the mounts in
+// WritableMounts().
 static void MakeFilesystemMostlyReadOnly() {
+  std::unordered_set<std::string> writable_mounts = WritableMounts();
+  if (SetMountsReadOnlyAttribute(writable_mounts)) {
+    return;
+  }
+
+  size_t sandbox_root_length = strlen(global_sandbox_root);
   FILE *mounts = setmntent("/proc/self/mounts", "r");
   if (mounts == NULL) {
     DIE("setmntent");
@@ -290,7 +585,7 @@ static void MakeFilesystemMostlyReadOnly() {
       mountFlags |= MS_RELATIME;
     }
 
-    if (!ShouldBeWritable(ent->mnt_dir)) {
+    if (writable_mounts.count(ent->mnt_dir + sandbox_root_length) == 0) {
       mountFlags |= MS_RDONLY;
     }
 
@@ -409,6 +704,16 @@ static void SpawnChild() {
   IgnoreSignal(SIGTTIN);
   IgnoreSignal(SIGTTOU);
 
+  // Without a PID namespace, the kernel does not kill the processes of the
+  // command when we exit, so keep them as our children to kill them ourselves.
+  if (opt.isolation == ISOLATE_FS_ONLY &&
+      prctl(PR_SET_CHILD_SUBREAPER, 1) < 0) {
+    DIE("prctl(PR_SET_CHILD_SUBREAPER)");
+  }
+
+  if (global_setup_times != NULL) {
+    global_command_start_us = MonotonicMicros();
+  }
   global_child_pid = fork();
 
   if (global_child_pid < 0) {
@@ -419,6 +724,12 @@ static void SpawnChild() {
       DIE("setpgid");
     }
 
+    // Nor does it kill the command if we are killed, e.g. on a timeout.
+    if (opt.isolation == ISOLATE_FS_ONLY &&
+        prctl(PR_SET_PDEATHSIG, SIGKILL) < 0) {
+      DIE("prctl(PR_SET_PDEATHSIG)");
+    }
+
     // Try to assign our terminal to the child process.
     if (tcsetpgrp(STDIN_FILENO, getpgrp()) < 0 && errno != ENOTTY) {
       DIE("tcsetpgrp")
@@ -441,6 +752,113 @@ static void SpawnChild() {
   }
 }
 
+// Copies the regular file "name" in the directory "from_dir" to "to_dir".
+static void CopyFileAt(int from_dir, int to_dir, const char *name,
+                       const struct stat &sb, const std::string &path) {
+  int from = openat(from_dir, name, O_RDONLY | O_CLOEXEC);
+  if (from < 0) {
+    DIE("open(%s)", path.c_str());
+  }
+  int to = openat(to_dir, name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (to < 0) {
+    DIE("open(%s) for writing", path.c_str());
+  }
+  off_t offset = 0;
+  while (offset < sb.st_size) {
+    ssize_t n = sendfile(to, from, &offset, sb.st_size - offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      DIE("sendfile(%s)", path.c_str());
+    }
+  }
+  if (fchmod(to, sb.st_mode & 07777) < 0) {
+    DIE("fchmod(%s)", path.c_str());
+  }
+  if (close(to) < 0) {
+    DIE("close(%s)", path.c_str());
+  }
+  close(from);
+}
+
+// Copies the files, directories and symlinks below the directory "from" into
+// the directory "to", replacing what these have to replace. "path" is the
+// path of "to", for error messages. Closes "from".
+static void CopyTree(int from, int to, const std::string &path) {
+  DIR *dir = fdopendir(from);
+  if (dir == NULL) {
+    DIE("fdopendir(%s)", path.c_str());
+  }
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != NULL) {
+    const char *name = ent->d_name;
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+      continue;
+    }
+    std::string child = path + "/" + name;
+    struct stat sb;
+    if (fstatat(from, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+      DIE("fstatat(%s)", child.c_str());
+    }
+
+    struct stat existing;
+    bool exists = fstatat(to, name, &existing, AT_SYMLINK_NOFOLLOW) == 0;
+    if (exists && !(S_ISDIR(existing.st_mode) && S_ISDIR(sb.st_mode)) &&
+        unlinkat(to, name, S_ISDIR(existing.st_mode) ? AT_REMOVEDIR : 0) < 0) {
+      DIE("unlink(%s)", child.c_str());
+    }
+
+    if (S_ISDIR(sb.st_mode)) {
+      if (!exists && mkdirat(to, name, 0700) < 0) {
+        DIE("mkdir(%s)", child.c_str());
+      }
+      int from_child =
+          openat(from, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      int to_child = openat(to, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (from_child < 0 || to_child < 0) {
+        DIE("open(%s)", child.c_str());
+      }
+      CopyTree(from_child, to_child, child);
+      // Only now, in case the mode does not let us write.
+      if (fchmod(to_child, sb.st_mode & 07777) < 0) {
+        DIE("fchmod(%s)", child.c_str());
+      }
+      close(to_child);
+    } else if (S_ISREG(sb.st_mode)) {
+      CopyFileAt(from, to, name, sb, child);
+    } else if (S_ISLNK(sb.st_mode)) {
+      std::vector<char> target(sb.st_size + 1);
+      ssize_t length = readlinkat(from, name, target.data(), target.size());
+      if (length < 0 || static_cast<size_t>(length) >= target.size()) {
+        DIE("readlink(%s)", child.c_str());
+      }
+      target[length] = '\0';
+      if (symlinkat(target.data(), to, name) < 0) {
+        DIE("symlink(%s)", child.c_str());
+      }
+    } else {
+      PRINT_DEBUG("not copying special file %s", child.c_str());
+    }
+  }
+  closedir(dir);
+}
+
+// Copies what the command wrote to the tmpfs of opt.staged_dirs into the real
+// directories. The tmpfs is on a different file system, so the files cannot
+// be moved (or reflinked); copying them all in one go still writes each only
+// once, without the many small writes and deletions going to the disk.
+static void CopyStagedDirs() {
+  for (size_t i = 0; i < opt.staged_dirs.size(); ++i) {
+    PRINT_DEBUG("copying out: %s", opt.staged_dirs[i]);
+    int from = open(opt.staged_dirs[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (from < 0) {
+      DIE("open(%s)", opt.staged_dirs[i]);
+    }
+    CopyTree(from, global_staged_dir_fds[i], opt.staged_dirs[i]);
+    close(global_staged_dir_fds[i]);
+  }
+}
+
 static void HandleSignal(int signum) {
   if (signum == SIGCHLD) {
     // Our child process or one of its children died.
@@ -451,7 +869,18 @@ static void HandleSignal(int signum) {
         // If the child process we spawned earlier terminated, we'll also
         // terminate. We can simply _exit() here, because the Linux kernel will
         // kindly SIGKILL all remaining processes in our PID namespace once we
-        // exit.
+        // exit. Without one, we kill the process group of the child instead,
+        // and reap it so that it is gone by the time we are.
+        if (opt.isolation == ISOLATE_FS_ONLY) {
+          kill(-global_child_pid, SIGKILL);
+          while (waitpid(-global_child_pid, NULL, 0) > 0) {
+          }
+        }
+        if (global_setup_times != NULL) {
+          global_setup_times->command_us =
+              MonotonicMicros() - global_command_start_us;
+        }
+        CopyStagedDirs();
         if (WIFSIGNALED(status)) {
           _exit(128 + WTERMSIG(status));
         } else {
@@ -487,18 +916,23 @@ static void WaitForChild() {
 }
 
 int Pid1Main(void *sync_pipe_param) {
-  if (getpid() != 1) {
+  if (opt.isolation != ISOLATE_FS_ONLY && getpid() != 1) {
     DIE("Using PID namespaces, but we are not PID 1");
   }
 
   SetupSelfDestruction(reinterpret_cast<int *>(sync_pipe_param));
   SetupMountNamespace();
-  SetupUserNamespace();
-  SetupUtsNamespace();
-  MountFilesystems();
-  MakeFilesystemMostlyReadOnly();
-  MountProc();
-  SetupNetworking();
+  TimePhase(SetupUserNamespace, &SetupTimes::user_namespace_us);
+  if (opt.isolation == ISOLATE_FULL) {
+    SetupUtsNamespace();
+  }
+  TimePhase(MountFilesystems, &SetupTimes::mount_filesystems_us);
+  TimePhase(MakeFilesystemMostlyReadOnly, &SetupTimes::make_read_only_us);
+  if (opt.isolation != ISOLATE_FS_ONLY) {
+    // The /proc of our parent's PID namespace is right without one of our own.
+    TimePhase(MountProc, &SetupTimes::mount_proc_us);
+  }
+  TimePhase(SetupNetworking, &SetupTimes::setup_networking_us);
   EnterSandbox();
   SpawnChild();
   WaitForChild();
@@ -32,7 +32,8 @@
  *  - If linux-sandbox's parent dies, it will kill itself, the process and all
  *    the children.
  *  - Network access is allowed, but can be disabled via -N.
- *  - The process runs as user "nobody", unless fakeroot is enabled (-R).
+ *  - The process runs as user "nobody", unless fakeroot is enabled (-R). The
+ *    ids of nobody, as printed by -C, can be given with -u.
  *  - The hostname and domainname will be set to "sandbox".
  *  - The process runs in its own PID namespace, so other processes on the
  *    system are invisible.
@@ -41,6 +42,7 @@
 #include "linux-sandbox-options.h"
 #include "linux-sandbox-pid1.h"
 #include "linux-sandbox-utils.h"
+#include "linux-sandbox.h"
 
 #define DIE(args...)                                     \
   {                                                      \
@@ -54,25 +56,42 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/sched.h>
 #include <math.h>
+#include <mntent.h>
 #include <sched.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <fstream>
+#include <string>
 #include <vector>
 
 int global_outer_uid;
 int global_outer_gid;
 char global_sandbox_root[] = "/tmp/sandbox.XXXXXX";
+struct SetupTimes *global_setup_times;
+
+long long MonotonicMicros() {
+  struct timespec now;
+  if (clock_gettime(CLOCK_MONOTONIC, &now) < 0) {
+    DIE("clock_gettime");
+  }
+  return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
 
 static int global_child_pid;
 
@@ -82,7 +101,22 @@ static volatile sig_atomic_t global_next_timeout_signal = SIGTERM;
 // The signal that caused us to kill the child (e.g. on timeout).
 static volatile sig_atomic_t global_signal;
 
+// When pid1 was spawned, for the statistics (-S).
+static struct timespec global_start_time;
+
+// The cgroup created for the command (-c), empty if none.
+static std::string global_cgroup;
+
 static void CloseFds() {
+#ifdef SYS_close_range
+  // Closes everything except stdin, stdout and stderr in a single system call
+  // instead of one per open file descriptor. Fall back to /proc/self/fd on
+  // kernels older than 5.9.
+  if (syscall(SYS_close_range, STDERR_FILENO + 1, ~0U, 0) == 0) {
+    return;
+  }
+#endif
+
   DIR *fds = opendir("/proc/self/fd");
   if (fds == NULL) {
     DIE("opendir");
@@ -131,6 +165,93 @@ static void RemoveSandboxRoot() {
   }
 }
 
+static void WriteCgroupFile(const std::string &cgroup, const std::string &file,
+                            const std::string &value) {
+  std::string path = cgroup + "/" + file;
+  int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    DIE("open(%s)", path.c_str());
+  }
+  if (write(fd, value.data(), value.size()) !=
+      static_cast<ssize_t>(value.size())) {
+    DIE("write(%s, %s)", path.c_str(), value.c_str());
+  }
+  if (close(fd) < 0) {
+    DIE("close(%s)", path.c_str());
+  }
+}
+
+// Returns the path of the cgroup v2 we are in.
+static std::string CurrentCgroup() {
+  FILE *mounts = setmntent("/proc/self/mounts", "r");
+  if (mounts == NULL) {
+    DIE("setmntent");
+  }
+  std::string mount_point;
+  struct mntent *ent;
+  while ((ent = getmntent(mounts)) != NULL) {
+    if (strcmp(ent->mnt_type, "cgroup2") == 0) {
+      mount_point = ent->mnt_dir;
+      break;
+    }
+  }
+  endmntent(mounts);
+  if (mount_point.empty()) {
+    DIE("no cgroup2 filesystem mounted");
+  }
+
+  // The cgroup v2 hierarchy is the one with ID 0.
+  std::ifstream f("/proc/self/cgroup");
+  for (std::string line; std::getline(f, line);) {
+    if (line.compare(0, 3, "0::") == 0) {
+      return mount_point + line.substr(3);
+    }
+  }
+  DIE("not in a cgroup v2");
+}
+
+static void RemoveCgroup() {
+  if (rmdir(global_cgroup.c_str()) < 0) {
+    fprintf(stderr, "rmdir(%s): %s\n", global_cgroup.c_str(), strerror(errno));
+  }
+}
+
+// Creates the cgroup for the command below its parent (-c), enables the
+// controllers of its settings (-s) in the parent if needed, and applies them.
+static void SetupCgroup() {
+  std::string parent = opt.cgroup_parent;
+  std::vector<char> cgroup(parent.begin(), parent.end());
+  const char kTemplate[] = "/sandbox.XXXXXX";
+  cgroup.insert(cgroup.end(), kTemplate, kTemplate + sizeof(kTemplate));
+  if (mkdtemp(cgroup.data()) == NULL) {
+    DIE("mkdtemp(%s)", cgroup.data());
+  }
+  global_cgroup = cgroup.data();
+  atexit(RemoveCgroup);
+
+  for (const char *setting : opt.cgroup_settings) {
+    const char *equals = strchr(setting, '=');
+    std::string file(setting, equals);
+    std::string controller = file.substr(0, file.find('.'));
+    if (controller != "cgroup") {
+      // Fails if the controller is enabled already, or cannot be enabled; in
+      // the latter case writing the setting fails below.
+      int fd = open((parent + "/cgroup.subtree_control").c_str(),
+                    O_WRONLY | O_CLOEXEC);
+      if (fd >= 0) {
+        std::string enable = "+" + controller;
+        if (write(fd, enable.data(), enable.size()) < 0) {
+          PRINT_DEBUG("enabling %s in %s failed: %s", controller.c_str(),
+                      parent.c_str(), strerror(errno));
+        }
+        close(fd);
+      }
+    }
+    PRINT_DEBUG("cgroup setting: %s", setting);
+    WriteCgroupFile(global_cgroup, file, equals + 1);
+  }
+}
+
 static void HandleSignal(int signum, void (*handler)(int)) {
   struct sigaction sa;
   memset(&sa, 0, sizeof(sa));
@@ -152,28 +273,115 @@ static void OnTimeout(int sig) {
   }
 }
 
-static void SpawnPid1() {
+#if defined(SYS_clone3) && defined(CLONE_INTO_CGROUP)
+// Spawns pid1 with clone3 (Linux 5.7 or later), which puts it right into the
+// cgroup of the command, if any. As with fork, the child continues on a copy of
+// our stack, so it does not need one of its own. Returns -1 and sets errno if
+// that fails.
+static int Clone3Pid1(int clone_flags, int *sync_pipe) {
+  struct clone_args args;
+  memset(&args, 0, sizeof(args));
+  args.flags = clone_flags & ~CSIGNAL;
+  args.exit_signal = clone_flags & CSIGNAL;
+
+  int cgroup_fd = -1;
+  if (!global_cgroup.empty()) {
+    cgroup_fd = open(global_cgroup.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cgroup_fd < 0) {
+      DIE("open(%s)", global_cgroup.c_str());
+    }
+    args.flags |= CLONE_INTO_CGROUP;
+    args.cgroup = cgroup_fd;
+  }
+
+  int pid = syscall(SYS_clone3, &args, sizeof(args));
+  int clone_errno = errno;
+  if (cgroup_fd >= 0 && close(cgroup_fd) < 0) {
+    DIE("close");
+  }
+  if (pid == 0) {
+    _exit(Pid1Main(sync_pipe));
+  }
+  errno = clone_errno;
+  return pid;
+}
+#else
+static int Clone3Pid1(int clone_flags, int *sync_pipe) {
+  errno = ENOSYS;
+  return -1;
+}
+#endif
+
+// Spawns pid1 with clone, on a stack of its own.
+static int ClonePid1(int clone_flags, int *sync_pipe) {
   const int kStackSize = 1024 * 1024;
   std::vector<char> child_stack(kStackSize);
 
+  // To have pid1 start in the cgroup of the command, we move ourselves there
+  // for the clone.
+  std::string outer_cgroup;
+  if (!global_cgroup.empty()) {
+    outer_cgroup = CurrentCgroup();
+    WriteCgroupFile(global_cgroup, "cgroup.procs", std::to_string(getpid()));
+  }
+
+  // We use clone instead of unshare, because unshare sometimes fails with
+  // EINVAL due to a race condition in the Linux kernel (see
+  // https://lkml.org/lkml/2015/7/28/833).
+  int pid =
+      clone(Pid1Main, child_stack.data() + kStackSize, clone_flags, sync_pipe);
+  if (pid < 0) {
+    DIE("clone");
+  }
+
+  if (!outer_cgroup.empty()) {
+    WriteCgroupFile(outer_cgroup, "cgroup.procs", std::to_string(getpid()));
+  }
+  return pid;
+}
+
+static void SpawnPid1() {
   int sync_pipe[2];
   if (pipe(sync_pipe) < 0) {
     DIE("pipe");
   }
 
-  int clone_flags = CLONE_NEWUSER | CLONE_NEWNS | CLONE_NEWUTS | CLONE_NEWIPC |
-                    CLONE_NEWPID | SIGCHLD;
+  int clone_flags = CLONE_NEWUSER | CLONE_NEWNS | SIGCHLD;
+  if (opt.isolation != ISOLATE_FS_ONLY) {
+    clone_flags |= CLONE_NEWPID;
+  }
+  if (opt.isolation == ISOLATE_FULL) {
+    clone_flags |= CLONE_NEWUTS | CLONE_NEWIPC;
+  }
   if (opt.create_netns) {
     clone_flags |= CLONE_NEWNET;
+  } else if (opt.netns_path != NULL) {
+    // Joined before the new user namespace is created: only here do we have
+    // the capabilities in the user namespace owning the network namespace
+    // (if it was created by the same user). Creating and destroying network
+    // namespaces is slow, so highly parallel builds may prefer a pool of
+    // them, managed outside of the sandbox.
+    int netns_fd = open(opt.netns_path, O_RDONLY | O_CLOEXEC);
+    if (netns_fd < 0) {
+      DIE("open(%s)", opt.netns_path);
+    }
+    if (setns(netns_fd, CLONE_NEWNET) < 0) {
+      DIE("setns(%s, CLONE_NEWNET)", opt.netns_path);
+    }
+    if (close(netns_fd) < 0) {
+      DIE("close");
+    }
   }
 
-  // We use clone instead of unshare, because unshare sometimes fails with
-  // EINVAL due to a race condition in the Linux kernel (see
-  // https://lkml.org/lkml/2015/7/28/833).
-  global_child_pid =
-      clone(Pid1Main, child_stack.data() + kStackSize, clone_flags, sync_pipe);
+  global_child_pid = Clone3Pid1(clone_flags, sync_pipe);
   if (global_child_pid < 0) {
-    DIE("clone");
+    // Older kernels, and seccomp filters which do not allow clone3 yet, fail
+    // with ENOSYS; kernels before 5.7 fail with E2BIG for CLONE_INTO_CGROUP.
+    if (errno != ENOSYS && errno != E2BIG && errno != EINVAL) {
+      DIE("clone3");
+    }
+    PRINT_DEBUG("clone3 failed, falling back to clone: %s", strerror(errno));
+    global_child_pid = ClonePid1(clone_flags, sync_pipe);
   }
 
   // We close the write end of the sync pipe, read a byte and then close the
@@ -192,14 +400,81 @@ static void SpawnPid1() {
   }
 }
 
+// Writes the wall time since pid1 was spawned and the resource usage of pid1
+// and all of the processes it waited for (which includes the command and all
+// of its descendants) to the statistics file (-S).
+static void WriteStats(const struct rusage &rusage) {
+  struct timespec end_time;
+  if (clock_gettime(CLOCK_MONOTONIC, &end_time) < 0) {
+    DIE("clock_gettime");
+  }
+  long long wall_time_ms =
+      (end_time.tv_sec - global_start_time.tv_sec) * 1000LL +
+      (end_time.tv_nsec - global_start_time.tv_nsec) / 1000000;
+
+  FILE *stats = fopen(opt.stats_path, "w");
+  if (stats == NULL) {
+    DIE("fopen(%s)", opt.stats_path);
+  }
+  fprintf(stats,
+          "wall_time_ms %lld\n"
+          "user_time_ms %lld\n"
+          "system_time_ms %lld\n"
+          "max_rss_kb %ld\n"
+          "block_input_ops %ld\n"
+          "block_output_ops %ld\n"
+          "voluntary_context_switches %ld\n"
+          "involuntary_context_switches %ld\n",
+          wall_time_ms,
+          rusage.ru_utime.tv_sec * 1000LL + rusage.ru_utime.tv_usec / 1000,
+          rusage.ru_stime.tv_sec * 1000LL + rusage.ru_stime.tv_usec / 1000,
+          rusage.ru_maxrss, rusage.ru_inblock, rusage.ru_oublock,
+          rusage.ru_nvcsw, rusage.ru_nivcsw);
+  if (global_setup_times != NULL) {
+    const struct SetupTimes &t = *global_setup_times;
+    fprintf(stats,
+            "setup_close_fds_us %lld\n"
+            "setup_spawn_pid1_us %lld\n"
+            "setup_user_namespace_us %lld\n"
+            "setup_mount_filesystems_us %lld\n"
+            "setup_make_read_only_us %lld\n"
+            "setup_mount_proc_us %lld\n"
+            "setup_networking_us %lld\n"
+            "command_us %lld\n",
+            t.close_fds_us, t.spawn_pid1_us, t.user_namespace_us,
+            t.mount_filesystems_us, t.make_read_only_us, t.mount_proc_us,
+            t.setup_networking_us, t.command_us);
+  }
+  if (!global_cgroup.empty()) {
+    // memory.peak needs Linux 5.19 and the memory controller.
+    std::ifstream memory_peak(global_cgroup + "/memory.peak");
+    std::string value;
+    if (std::getline(memory_peak, value)) {
+      fprintf(stats, "cgroup_memory_peak_bytes %s\n", value.c_str());
+    }
+    std::ifstream cpu_stat(global_cgroup + "/cpu.stat");
+    for (std::string line; std::getline(cpu_stat, line);) {
+      fprintf(stats, "cgroup_cpu_%s\n", line.c_str());
+    }
+  }
+  if (fclose(stats) != 0) {
+    DIE("fclose(%s)", opt.stats_path);
+  }
+}
+
 static int WaitForPid1() {
   int err, status;
+  struct rusage rusage;
   do {
-    err = waitpid(global_child_pid, &status, 0);
+    err = wait4(global_child_pid, &status, 0, &rusage);
   } while (err < 0 && errno == EINTR);
 
   if (err < 0) {
-    DIE("waitpid");
+    DIE("wait4");
+  }
+
+  if (opt.stats_path != NULL) {
+    WriteStats(rusage);
   }
 
   if (global_signal > 0) {
@@ -272,18 +547,46 @@ int main(int argc, char *argv[]) {
   global_outer_uid = getuid();
   global_outer_gid = getgid();
 
+  if (opt.stats_path != NULL) {
+    // Shared with pid1, which records the times of its phases there.
+    void *times = mmap(NULL, sizeof(*global_setup_times),
+                       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1,
+                       0);
+    if (times == MAP_FAILED) {
+      DIE("mmap");
+    }
+    global_setup_times = static_cast<struct SetupTimes *>(times);
+  }
+
   // Make sure the sandboxed process does not inherit any accidentally left open
   // file handles from our parent.
+  long long close_fds_start = MonotonicMicros();
   CloseFds();
+  if (global_setup_times != NULL) {
+    global_setup_times->close_fds_us = MonotonicMicros() - close_fds_start;
+  }
 
   SetupSandboxRoot();
   atexit(RemoveSandboxRoot);
 
+  if (opt.cgroup_parent != NULL) {
+    SetupCgroup();
+  }
+
   HandleSignal(SIGALRM, OnTimeout);
   if (opt.timeout_secs > 0) {
     alarm(opt.timeout_secs);
   }
 
+  if (clock_gettime(CLOCK_MONOTONIC, &global_start_time) < 0) {
+    DIE("clock_gettime");
+  }
   SpawnPid1();
+  if (global_setup_times != NULL) {
+    global_setup_times->spawn_pid1_us =
+        MonotonicMicros() -
+        (global_start_time.tv_sec * 1000000LL +
+         global_start_time.tv_nsec / 1000);
+  }
   return WaitForPid1();
 }
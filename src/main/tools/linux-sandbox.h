@@ -19,4 +19,23 @@ extern int global_outer_uid;
 extern int global_outer_gid;
 extern char global_sandbox_root[];
 
+// How long the phases of setting up the sandbox took, in microseconds, for
+// the statistics (-S). pid1 fills in its phases through shared memory.
+struct SetupTimes {
+  long long close_fds_us;
+  long long spawn_pid1_us;  // until pid1 is running
+  long long user_namespace_us;
+  long long mount_filesystems_us;
+  long long make_read_only_us;
+  long long mount_proc_us;
+  long long setup_networking_us;
+  long long command_us;  // from the fork of the command until it exited
+};
+
+// NULL unless the statistics are written.
+extern struct SetupTimes *global_setup_times;
+
+// Returns the time of the monotonic clock in microseconds.
+long long MonotonicMicros();
+
 #endif
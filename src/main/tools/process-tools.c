@@ -16,9 +16,12 @@
 
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <signal.h>
 #include <math.h>
@@ -27,6 +30,13 @@
 #include <string.h>
 #include <fcntl.h>
 
+#ifdef __linux__
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#endif
+
 #include "process-tools.h"
 
 int SwitchToEuid() {
@@ -65,6 +75,38 @@ void RedirectStderr(const char *stderr_path) {
   Redirect(stderr_path, STDERR_FILENO, "stderr");
 }
 
+void SetCloseOnExecOnInheritedFds() {
+#if defined(SYS_close_range)
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+  // A single system call on Linux 5.11 and later.
+  if (syscall(SYS_close_range, STDERR_FILENO + 1, ~0U, CLOSE_RANGE_CLOEXEC) ==
+      0) {
+    return;
+  }
+#endif
+
+  DIR *fds = opendir("/proc/self/fd");
+  if (fds == NULL) {
+    // Not on Linux or /proc is not mounted; leave the file descriptors alone.
+    return;
+  }
+  struct dirent *dent;
+  while ((dent = readdir(fds)) != NULL) {
+    if (isdigit(dent->d_name[0])) {
+      int fd = atoi(dent->d_name);
+      if (fd > STDERR_FILENO && fd != dirfd(fds)) {
+        int flags = fcntl(fd, F_GETFD);
+        if (flags != -1 && !(flags & FD_CLOEXEC)) {
+          fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+        }
+      }
+    }
+  }
+  closedir(fds);
+}
+
 void KillEverything(int pgrp, bool gracefully, double graceful_kill_delay) {
   if (gracefully) {
     kill(-pgrp, SIGTERM);
@@ -136,11 +178,11 @@ void SetTimeout(double timeout_secs) {
   CHECK_CALL(setitimer(ITIMER_REAL, &timer, NULL));
 }
 
-int WaitChild(pid_t pid, const char *name) {
+int WaitChild(pid_t pid, const char *name, struct rusage *rusage) {
   int err, status;
 
   do {
-    err = waitpid(pid, &status, 0);
+    err = wait4(pid, &status, 0, rusage);
   } while (err == -1 && errno == EINTR);
 
   if (err == -1) {
@@ -149,3 +191,353 @@ int WaitChild(pid_t pid, const char *name) {
 
   return status;
 }
+
+#ifdef __linux__
+
+// What an epoll event is about.
+struct EventSource {
+  enum { SOURCE_SIGNAL, SOURCE_FD, SOURCE_EXIT, SOURCE_TIMER } kind;
+  int fd;
+  struct SupervisedChild *child;
+  // Whether the file descriptor is a regular file or the like, which is
+  // always readable and can't be in an epoll set.
+  bool always_ready;
+  // The next file descriptor passed to SuperviseFd.
+  struct EventSource *next;
+};
+
+struct SupervisedChild {
+  pid_t pid;
+  void *data;
+  double kill_delay_secs;
+  // Whether the process group got SIGTERM for the timeout already.
+  bool timed_out;
+  // The pidfd of the child, or -1 if its exit is noticed through SIGCHLD.
+  struct EventSource exit_source;
+  // The timerfd for its timeout and kill delay, or -1 if it has no timeout.
+  struct EventSource timer_source;
+  struct SupervisedChild *next;
+};
+
+struct ChildSupervisor {
+  int epoll_fd;
+  struct EventSource signal_source;
+  sigset_t old_mask;
+  bool use_pidfd;
+  // Whether a SIGCHLD was received and some children may be waiting to be
+  // reaped.
+  bool scan_children;
+  struct SupervisedChild *children;
+  size_t num_children;
+  struct EventSource *fd_sources;
+};
+
+// Returns a pidfd for "pid", or -1 if the kernel doesn't support them.
+static int OpenPidFd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  // pidfd_open(2) is in Linux 5.3 and later.
+  int fd = syscall(SYS_pidfd_open, pid, 0);
+  if (fd >= 0) {
+    CHECK_CALL(fcntl(fd, F_SETFD, FD_CLOEXEC));
+    return fd;
+  }
+  if (errno != ENOSYS) {
+    DIE("pidfd_open(%d) failed: %s\n", pid, strerror(errno));
+  }
+#endif
+  return -1;
+}
+
+static void AddToEpoll(struct ChildSupervisor *supervisor,
+                       struct EventSource *source) {
+  struct epoll_event event = {.events = EPOLLIN, .data.ptr = source};
+  CHECK_CALL(epoll_ctl(supervisor->epoll_fd, EPOLL_CTL_ADD, source->fd,
+                       &event));
+}
+
+// Removes the source from the epoll set and closes its file descriptor, if
+// it has one.
+static void RemoveFromEpoll(struct ChildSupervisor *supervisor,
+                            struct EventSource *source) {
+  if (source->fd == -1) {
+    return;
+  }
+  // Closing the file descriptor isn't enough while a forked child that didn't
+  // exec yet still has a copy of it.
+  CHECK_CALL(epoll_ctl(supervisor->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL));
+  CHECK_CALL(close(source->fd));
+}
+
+// Arms the timer to go off in "secs" seconds.
+static void ArmTimer(int timer_fd, double secs) {
+  struct itimerspec spec = {{0, 0}, {0, 0}};
+  double int_val, fraction_val;
+  fraction_val = modf(secs, &int_val);
+  spec.it_value.tv_sec = (time_t)int_val;
+  spec.it_value.tv_nsec = (long)(fraction_val * 1e9);
+  if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+    // A zero value would disarm the timer.
+    spec.it_value.tv_nsec = 1;
+  }
+  CHECK_CALL(timerfd_settime(timer_fd, 0, &spec, NULL));
+}
+
+struct ChildSupervisor *NewChildSupervisor(const int *signals,
+                                           int num_signals) {
+  struct ChildSupervisor *supervisor = calloc(1, sizeof(*supervisor));
+  CHECK_NOT_NULL(supervisor);
+  CHECK_CALL(supervisor->epoll_fd = epoll_create1(EPOLL_CLOEXEC));
+
+  int self_pidfd = OpenPidFd(getpid());
+  supervisor->use_pidfd = self_pidfd != -1;
+  if (supervisor->use_pidfd) {
+    CHECK_CALL(close(self_pidfd));
+  }
+
+  sigset_t mask;
+  CHECK_CALL(sigemptyset(&mask));
+  for (int i = 0; i < num_signals; ++i) {
+    CHECK_CALL(sigaddset(&mask, signals[i]));
+  }
+  // Blocked even with pidfds, so that a handler doesn't reap our children.
+  CHECK_CALL(sigaddset(&mask, SIGCHLD));
+  CHECK_CALL(sigprocmask(SIG_BLOCK, &mask, &supervisor->old_mask));
+  if (supervisor->use_pidfd) {
+    CHECK_CALL(sigdelset(&mask, SIGCHLD));
+  }
+
+  supervisor->signal_source.kind = SOURCE_SIGNAL;
+  CHECK_CALL(supervisor->signal_source.fd =
+                 signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK));
+  AddToEpoll(supervisor, &supervisor->signal_source);
+  return supervisor;
+}
+
+static void DeleteChild(struct ChildSupervisor *supervisor,
+                        struct SupervisedChild *child) {
+  struct SupervisedChild **link = &supervisor->children;
+  while (*link != child) {
+    link = &(*link)->next;
+  }
+  *link = child->next;
+  --supervisor->num_children;
+
+  RemoveFromEpoll(supervisor, &child->exit_source);
+  RemoveFromEpoll(supervisor, &child->timer_source);
+  free(child);
+}
+
+void DeleteChildSupervisor(struct ChildSupervisor *supervisor) {
+  while (supervisor->children != NULL) {
+    DeleteChild(supervisor, supervisor->children);
+  }
+  while (supervisor->fd_sources != NULL) {
+    UnsuperviseFd(supervisor, supervisor->fd_sources->fd);
+  }
+  CHECK_CALL(close(supervisor->signal_source.fd));
+  CHECK_CALL(close(supervisor->epoll_fd));
+  CHECK_CALL(sigprocmask(SIG_SETMASK, &supervisor->old_mask, NULL));
+  free(supervisor);
+}
+
+void SuperviseFd(struct ChildSupervisor *supervisor, int fd) {
+  struct EventSource *source = calloc(1, sizeof(*source));
+  CHECK_NOT_NULL(source);
+  source->kind = SOURCE_FD;
+  source->fd = fd;
+  source->next = supervisor->fd_sources;
+  supervisor->fd_sources = source;
+
+  struct epoll_event event = {.events = EPOLLIN, .data.ptr = source};
+  if (epoll_ctl(supervisor->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+    if (errno != EPERM) {
+      DIE("epoll_ctl(%d) failed: %s\n", fd, strerror(errno));
+    }
+    source->always_ready = true;
+  }
+}
+
+void UnsuperviseFd(struct ChildSupervisor *supervisor, int fd) {
+  struct EventSource **link = &supervisor->fd_sources;
+  while (*link != NULL && (*link)->fd != fd) {
+    link = &(*link)->next;
+  }
+  if (*link == NULL) {
+    DIE("fd %d is not supervised\n", fd);
+  }
+  struct EventSource *source = *link;
+  *link = source->next;
+  if (!source->always_ready) {
+    CHECK_CALL(epoll_ctl(supervisor->epoll_fd, EPOLL_CTL_DEL, fd, NULL));
+  }
+  free(source);
+}
+
+void SuperviseChild(struct ChildSupervisor *supervisor, pid_t pid,
+                    double timeout_secs, double kill_delay_secs, void *data) {
+  struct SupervisedChild *child = calloc(1, sizeof(*child));
+  CHECK_NOT_NULL(child);
+  child->pid = pid;
+  child->data = data;
+  child->kill_delay_secs = kill_delay_secs;
+  child->timed_out = false;
+
+  child->exit_source.kind = SOURCE_EXIT;
+  child->exit_source.child = child;
+  child->exit_source.fd = supervisor->use_pidfd ? OpenPidFd(pid) : -1;
+  if (child->exit_source.fd != -1) {
+    AddToEpoll(supervisor, &child->exit_source);
+  }
+
+  child->timer_source.kind = SOURCE_TIMER;
+  child->timer_source.child = child;
+  child->timer_source.fd = -1;
+  if (timeout_secs > 0) {
+    CHECK_CALL(child->timer_source.fd =
+                   timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK));
+    ArmTimer(child->timer_source.fd, timeout_secs);
+    AddToEpoll(supervisor, &child->timer_source);
+  }
+
+  child->next = supervisor->children;
+  supervisor->children = child;
+  ++supervisor->num_children;
+}
+
+size_t NumSupervisedChildren(const struct ChildSupervisor *supervisor) {
+  return supervisor->num_children;
+}
+
+void KillSupervisedChildren(struct ChildSupervisor *supervisor) {
+  for (struct SupervisedChild *child = supervisor->children; child != NULL;
+       child = child->next) {
+    kill(-child->pid, SIGKILL);
+  }
+}
+
+// Reaps the child and reports it in "event" if it exited.
+static bool ReapChild(struct ChildSupervisor *supervisor,
+                      struct SupervisedChild *child,
+                      struct SupervisorEvent *event) {
+  int status;
+  pid_t pid;
+  do {
+    pid = wait4(child->pid, &status, WNOHANG, &event->rusage);
+  } while (pid == -1 && errno == EINTR);
+  if (pid == -1) {
+    DIE("wait on pid %d failed\n", child->pid);
+  }
+  if (pid == 0) {
+    return false;
+  }
+
+  event->type = SUPERVISOR_CHILD_EXITED;
+  event->pid = child->pid;
+  event->data = child->data;
+  event->status = status;
+  event->timed_out = child->timed_out;
+  DeleteChild(supervisor, child);
+  return true;
+}
+
+static void OnTimer(struct SupervisedChild *child) {
+  uint64_t expirations;
+  if (read(child->timer_source.fd, &expirations, sizeof(expirations)) < 0) {
+    if (errno == EAGAIN || errno == EINTR) {
+      return;
+    }
+    DIE("read from timerfd failed: %s\n", strerror(errno));
+  }
+
+  if (!child->timed_out) {
+    // Give the process a bit of time to die gracefully.
+    child->timed_out = true;
+    kill(-child->pid, SIGTERM);
+    ArmTimer(child->timer_source.fd, child->kill_delay_secs);
+  } else {
+    kill(-child->pid, SIGKILL);
+  }
+}
+
+// Returns whether a signal is reported in "event".
+static bool OnSignal(struct ChildSupervisor *supervisor,
+                     struct SupervisorEvent *event) {
+  struct signalfd_siginfo info;
+  if (read(supervisor->signal_source.fd, &info, sizeof(info)) < 0) {
+    if (errno == EAGAIN || errno == EINTR) {
+      return false;
+    }
+    DIE("read from signalfd failed: %s\n", strerror(errno));
+  }
+
+  if (info.ssi_signo == SIGCHLD) {
+    // SIGCHLD is not queued, so it may stand for any number of exits.
+    supervisor->scan_children = true;
+    return false;
+  }
+  event->type = SUPERVISOR_SIGNAL;
+  event->signal = info.ssi_signo;
+  return true;
+}
+
+void WaitSupervisorEvent(struct ChildSupervisor *supervisor,
+                         struct SupervisorEvent *event) {
+  for (;;) {
+    if (supervisor->scan_children) {
+      for (struct SupervisedChild *child = supervisor->children; child != NULL;
+           child = child->next) {
+        if (ReapChild(supervisor, child, event)) {
+          return;
+        }
+      }
+      supervisor->scan_children = false;
+    }
+
+    struct EventSource *always_ready = supervisor->fd_sources;
+    while (always_ready != NULL && !always_ready->always_ready) {
+      always_ready = always_ready->next;
+    }
+
+    // One at a time, as handling an event may delete the sources of others.
+    struct epoll_event epoll_event;
+    int n = epoll_wait(supervisor->epoll_fd, &epoll_event, 1,
+                       always_ready != NULL ? 0 : -1);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      DIE("epoll_wait failed: %s\n", strerror(errno));
+    }
+    if (n == 0) {
+      if (always_ready != NULL) {
+        event->type = SUPERVISOR_FD_READY;
+        event->fd = always_ready->fd;
+        return;
+      }
+      continue;
+    }
+
+    struct EventSource *source = epoll_event.data.ptr;
+    switch (source->kind) {
+      case SOURCE_SIGNAL:
+        if (OnSignal(supervisor, event)) {
+          return;
+        }
+        break;
+      case SOURCE_FD:
+        event->type = SUPERVISOR_FD_READY;
+        event->fd = source->fd;
+        return;
+      case SOURCE_EXIT:
+        if (ReapChild(supervisor, source->child, event)) {
+          return;
+        }
+        break;
+      case SOURCE_TIMER:
+        OnTimer(source->child);
+        break;
+    }
+  }
+}
+
+#endif  // __linux__
@@ -15,6 +15,7 @@
 #ifndef PROCESS_TOOLS_H__
 #define PROCESS_TOOLS_H__
 
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <stdbool.h>
 
@@ -58,6 +59,11 @@ void RedirectStdout(const char *stdout_path);
 // Redirect stderr to the file stdout_path (but not if stderr_path is "-").
 void RedirectStderr(const char *stderr_path);
 
+// Mark all file descriptors except stdin, stdout and stderr as close-on-exec,
+// so that the file descriptors leaked to us by our parent are not inherited
+// by the command.
+void SetCloseOnExecOnInheritedFds();
+
 // Make sure the process group "pgrp" and all its subprocesses are killed.
 // If "gracefully" is true, sends SIGTERM first and after a timeout of
 // "graceful_kill_delay" seconds, sends SIGKILL.
@@ -78,8 +84,78 @@ void ClearSignalMask();
 // non-positive.
 void SetTimeout(double timeout_secs);
 
-// Wait for "pid" to exit and return its exit code.
+// Wait for "pid" to exit and return its exit code. If "rusage" is not NULL,
+// the resource usage of the child and its waited-for descendants is stored
+// there.
 // "name" is used for the error message only.
-int WaitChild(pid_t pid, const char *name);
+int WaitChild(pid_t pid, const char *name, struct rusage *rusage);
+
+#ifdef __linux__
+
+// Supervises any number of children, each with its own timeout, without
+// signal handlers or global state: timeouts are timerfds, the exit of a child
+// is noticed through a pidfd (or SIGCHLD on kernels without pidfd_open), and
+// signals are received through a signalfd. All of it is waited for by
+// WaitSupervisorEvent.
+struct ChildSupervisor;
+
+enum SupervisorEventType {
+  // A supervised child exited; it has been reaped and is no longer supervised.
+  SUPERVISOR_CHILD_EXITED,
+  // One of the signals passed to NewChildSupervisor was received.
+  SUPERVISOR_SIGNAL,
+  // A file descriptor passed to SuperviseFd is readable or was hung up.
+  SUPERVISOR_FD_READY,
+};
+
+struct SupervisorEvent {
+  enum SupervisorEventType type;
+  // For SUPERVISOR_CHILD_EXITED: the child, the data it was supervised with,
+  // its wait status and resource usage, and whether it got killed for its
+  // timeout.
+  pid_t pid;
+  void *data;
+  int status;
+  struct rusage rusage;
+  bool timed_out;
+  // For SUPERVISOR_SIGNAL.
+  int signal;
+  // For SUPERVISOR_FD_READY.
+  int fd;
+};
+
+// Create a supervisor that reports the "num_signals" signals in "signals"
+// (e.g. SIGTERM and SIGINT). These signals, and SIGCHLD, are blocked until
+// DeleteChildSupervisor, so children must call ClearSignalMask before exec.
+// Must be called before forking the children to supervise.
+struct ChildSupervisor *NewChildSupervisor(const int *signals, int num_signals);
+
+// Restore the signal mask and free the supervisor. Children that are still
+// being supervised are left alone.
+void DeleteChildSupervisor(struct ChildSupervisor *supervisor);
+
+// Report when "fd" becomes readable or is hung up, until UnsuperviseFd.
+void SuperviseFd(struct ChildSupervisor *supervisor, int fd);
+void UnsuperviseFd(struct ChildSupervisor *supervisor, int fd);
+
+// Supervise the child "pid", which leads its own process group. If
+// "timeout_secs" is positive, the process group gets SIGTERM once it elapsed,
+// and SIGKILL "kill_delay_secs" seconds later.
+void SuperviseChild(struct ChildSupervisor *supervisor, pid_t pid,
+                    double timeout_secs, double kill_delay_secs, void *data);
+
+// Return how many children are being supervised.
+size_t NumSupervisedChildren(const struct ChildSupervisor *supervisor);
+
+// Send SIGKILL to the process groups of all the supervised children. Their
+// exits are still reported.
+void KillSupervisedChildren(struct ChildSupervisor *supervisor);
+
+// Wait for the next event and store it in "event", handling the timeouts in
+// the meantime. Must not be called with nothing left to supervise.
+void WaitSupervisorEvent(struct ChildSupervisor *supervisor,
+                         struct SupervisorEvent *event);
+
+#endif  // __linux__
 
 #endif  // PROCESS_TOOLS_H__
@@ -0,0 +1,241 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define _GNU_SOURCE
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "process-tools.h"
+#include "process-wrapper-batch.h"
+
+// Not in headers on OSX.
+extern char **environ;
+
+#ifdef __linux__
+
+// Returns the field starting at *pos of the request ending at end, and moves
+// *pos past it.
+static char *NextField(char **pos, char *end) {
+  if (*pos >= end) {
+    DIE("truncated request\n");
+  }
+  char *field = *pos;
+  *pos += strlen(field) + 1;
+  return field;
+}
+
+// Runs the command of the request in the child.
+static void ExecRequest(char *const *argv, char **env, const char *cwd,
+                        const char *stdout_path, const char *stderr_path) {
+  CHECK_CALL(setsid());
+  ClearSignalMask();
+
+  // stdin and stdout of process-wrapper are for the requests and results.
+  int null_fd;
+  CHECK_CALL(null_fd = open("/dev/null", O_RDWR));
+  CHECK_CALL(dup2(null_fd, STDIN_FILENO));
+  if (strcmp(stdout_path, "-") == 0) {
+    CHECK_CALL(dup2(null_fd, STDOUT_FILENO));
+  } else {
+    RedirectStdout(stdout_path);
+  }
+  RedirectStderr(stderr_path);
+  if (null_fd > STDERR_FILENO) {
+    CHECK_CALL(close(null_fd));
+  }
+  SetCloseOnExecOnInheritedFds();
+
+  if (cwd[0] != '\0' && chdir(cwd) < 0) {
+    err(EXIT_FAILURE, "chdir(\"%s\")", cwd);
+  }
+
+  // Force umask to include read and execute for everyone, to make
+  // output permissions predictable.
+  umask(022);
+
+  // Looks the command up in the PATH of its environment.
+  environ = env;
+  execvp(argv[0], argv);
+  err(EXIT_FAILURE, "execvp(\"%s\", ...)", argv[0]);
+}
+
+// Parses the request and starts its command.
+static void StartRequest(struct ChildSupervisor *supervisor, char *request,
+                         size_t length) {
+  char *end = request + length;
+  if (length == 0 || end[-1] != '\0') {
+    DIE("request is not NUL-terminated\n");
+  }
+
+  char *pos = request;
+  char *id = NextField(&pos, end);
+  double timeout_secs, kill_delay_secs;
+  if (sscanf(NextField(&pos, end), "%lf", &timeout_secs) != 1) {
+    DIE("timeout_secs is not a real number.\n");
+  }
+  if (sscanf(NextField(&pos, end), "%lf", &kill_delay_secs) != 1) {
+    DIE("kill_delay_secs is not a real number.\n");
+  }
+  char *cwd = NextField(&pos, end);
+  char *stdout_path = NextField(&pos, end);
+  char *stderr_path = NextField(&pos, end);
+  int argc;
+  if (sscanf(NextField(&pos, end), "%d", &argc) != 1 || argc < 1) {
+    DIE("invalid argc\n");
+  }
+
+  char **argv = calloc(argc + 1, sizeof(char *));
+  CHECK_NOT_NULL(argv);
+  for (int i = 0; i < argc; ++i) {
+    argv[i] = NextField(&pos, end);
+  }
+
+  // There are at most as many environment variables as bytes left.
+  char **env = calloc(end - pos + 1, sizeof(char *));
+  CHECK_NOT_NULL(env);
+  for (int i = 0; pos < end; ++i) {
+    env[i] = NextField(&pos, end);
+  }
+
+  pid_t pid;
+  CHECK_CALL(pid = fork());
+  if (pid == 0) {
+    ExecRequest(argv, env, cwd, stdout_path, stderr_path);
+  }
+  free(argv);
+  free(env);
+
+  char *child_id = strdup(id);
+  CHECK_NOT_NULL(child_id);
+  SuperviseChild(supervisor, pid, timeout_secs, kill_delay_secs, child_id);
+}
+
+// Starts the commands of all the complete requests at the beginning of
+// buffer, and returns how many bytes that used up.
+static size_t StartRequests(struct ChildSupervisor *supervisor, char *buffer,
+                            size_t length) {
+  size_t used = 0;
+  while (length - used >= 4) {
+    const unsigned char *header = (const unsigned char *)buffer + used;
+    size_t request_length = ((uint32_t)header[0] << 24) |
+                            ((uint32_t)header[1] << 16) |
+                            ((uint32_t)header[2] << 8) | (uint32_t)header[3];
+    if (length - used - 4 < request_length) {
+      break;
+    }
+    StartRequest(supervisor, buffer + used + 4, request_length);
+    used += 4 + request_length;
+  }
+  return used;
+}
+
+// Reports the exit of a child.
+static void ReportExit(const struct SupervisorEvent *event) {
+  char *id = event->data;
+  // The child is done for, but may have grandchildren that we still have to
+  // kill.
+  kill(-event->pid, SIGKILL);
+
+  if (event->timed_out) {
+    // Don't trust the exit code if we got a timeout.
+    printf("%s signal %d\n", id, SIGALRM);
+  } else if (WIFEXITED(event->status)) {
+    printf("%s exit %d\n", id, WEXITSTATUS(event->status));
+  } else {
+    printf("%s signal %d\n", id, WTERMSIG(event->status));
+  }
+  fflush(stdout);
+  free(id);
+}
+
+int RunBatch() {
+  const int signals[] = {SIGTERM, SIGINT};
+  struct ChildSupervisor *supervisor = NewChildSupervisor(signals, 2);
+  SuperviseFd(supervisor, STDIN_FILENO);
+
+  char *buffer = NULL;
+  size_t length = 0, capacity = 0;
+  bool stdin_open = true;
+  int signal_received = 0;
+
+  while (stdin_open || NumSupervisedChildren(supervisor) > 0) {
+    struct SupervisorEvent event;
+    WaitSupervisorEvent(supervisor, &event);
+    switch (event.type) {
+      case SUPERVISOR_CHILD_EXITED:
+        ReportExit(&event);
+        break;
+      case SUPERVISOR_SIGNAL:
+        if (signal_received == 0) {
+          // Kill everything quickly, as it's typically blocking the return of
+          // the prompt after a user hits "Ctrl-C".
+          signal_received = event.signal;
+          if (stdin_open) {
+            stdin_open = false;
+            UnsuperviseFd(supervisor, STDIN_FILENO);
+          }
+          KillSupervisedChildren(supervisor);
+        }
+        break;
+      case SUPERVISOR_FD_READY: {
+        if (capacity - length < 65536) {
+          capacity = 2 * capacity + 65536;
+          buffer = realloc(buffer, capacity);
+          CHECK_NOT_NULL(buffer);
+        }
+        ssize_t n = read(STDIN_FILENO, buffer + length, capacity - length);
+        if (n < 0 && errno != EINTR) {
+          DIE("read failed\n");
+        } else if (n == 0) {
+          stdin_open = false;
+          UnsuperviseFd(supervisor, STDIN_FILENO);
+        } else if (n > 0) {
+          length += n;
+          size_t used = StartRequests(supervisor, buffer, length);
+          memmove(buffer, buffer + used, length - used);
+          length -= used;
+        }
+        break;
+      }
+    }
+  }
+
+  free(buffer);
+  DeleteChildSupervisor(supervisor);
+  if (signal_received != 0) {
+    UnHandle(signal_received);
+    raise(signal_received);
+  }
+  return length == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#else  // __linux__
+
+int RunBatch() {
+  DIE("--batch is only supported on Linux\n");
+}
+
+#endif  // __linux__
@@ -0,0 +1,38 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PROCESS_WRAPPER_BATCH_H__
+#define PROCESS_WRAPPER_BATCH_H__
+
+// Runs process-wrapper in batch mode (--batch): reads spawn requests from
+// stdin and runs them concurrently, each in its own process group with its own
+// timeout, and writes a line to stdout whenever one of them is done. Returns
+// the exit code of process-wrapper once stdin is closed and all the commands
+// are done. Only supported on Linux.
+//
+// A request is a 4-byte big-endian length followed by that many bytes of
+// NUL-terminated strings:
+//
+//   <id> <timeout-secs> <kill-delay-secs> <working-dir> <stdout-redirect>
+//   <stderr-redirect> <argc> <argv[0]> ... <argv[argc - 1]> [<NAME=VALUE> ...]
+//
+// An empty working directory means the one of process-wrapper, and "-" as the
+// stdout redirect /dev/null (stdout is where the results go). The environment
+// of the command is exactly the NAME=VALUE strings at the end.
+//
+// The result is "<id> exit <code>" or "<id> signal <number>". As without
+// --batch, a command killed for its timeout is reported as dying of SIGALRM.
+int RunBatch();
+
+#endif  // PROCESS_WRAPPER_BATCH_H__
@@ -26,17 +26,22 @@
 
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "process-tools.h"
+#include "process-wrapper-batch.h"
 
 // Not in headers on OSX.
 extern char **environ;
@@ -51,6 +56,10 @@ struct Options {
   double kill_delay_secs;
   const char *stdout_path;
   const char *stderr_path;
+  const char *stats_path;
+  // The most bytes of the command's stdout and of its stderr to keep, or 0 to
+  // keep everything.
+  long long output_limit;
   char *const *args;
 };
 
@@ -59,20 +68,47 @@ struct Options {
 // string for the error message to print.
 static void Usage(char *const *argv) {
   fprintf(stderr,
-          "Usage: %s <timeout-secs> <kill-delay-secs> <stdout-redirect> "
-          "<stderr-redirect> <command> [args] ...\n",
-          argv[0]);
+          "Usage: %s [--stats=<file>] [--output_limit=<bytes>] <timeout-secs> "
+          "<kill-delay-secs> <stdout-redirect> <stderr-redirect> <command> "
+          "[args] ...\n"
+          "       %s --batch\n"
+          "\n"
+          "  --stats=<file>  write the wall time and resource usage of the "
+          "command to a file\n"
+          "  --output_limit=<bytes>  keep at most this much of the command's "
+          "stdout and of\n"
+          "      its stderr: the first and the last half of it, with a note "
+          "of how much\n"
+          "      was left out in between\n"
+          "  --batch  run the commands requested on stdin concurrently (see "
+          "process-wrapper-batch.h)\n",
+          argv[0], argv[0]);
   exit(EXIT_FAILURE);
 }
 
 // Parse the command line flags and return the result in an Options structure
 // passed as argument.
 static void ParseCommandLine(int argc, char *const *argv, struct Options *opt) {
-  if (argc <= 5) {
-    Usage(argv);
+  char *const *program = argv;
+  argv++;
+  argc--;
+  for (; argc > 0 && strncmp(*argv, "--", 2) == 0; argv++, argc--) {
+    if (strncmp(*argv, "--stats=", 8) == 0) {
+      opt->stats_path = *argv + 8;
+    } else if (strncmp(*argv, "--output_limit=", 15) == 0) {
+      if (sscanf(*argv + 15, "%lld", &opt->output_limit) != 1 ||
+          opt->output_limit < 2) {
+        DIE("--output_limit is not a number of bytes above 1.\n");
+      }
+    } else {
+      break;
+    }
+  }
+
+  if (argc <= 4) {
+    Usage(program);
   }
 
-  argv++;
   if (sscanf(*argv++, "%lf", &opt->timeout_secs) != 1) {
     DIE("timeout_secs is not a real number.\n");
   }
@@ -104,53 +140,321 @@ void OnSignal(int sig) {
   }
 }
 
-// Run the command specified by the argv array and kill it after timeout
-// seconds.
-static void SpawnCommand(char *const *argv, double timeout_secs) {
-  CHECK_CALL(global_child_pid = fork());
-  if (global_child_pid == 0) {
+// Write the wall time since start_time and the resource usage of the command
+// to stats_path.
+static void WriteStats(const char *stats_path, const struct timeval *start_time,
+                       const struct rusage *rusage) {
+  struct timeval end_time;
+  CHECK_CALL(gettimeofday(&end_time, NULL));
+  long long wall_time_ms = (end_time.tv_sec - start_time->tv_sec) * 1000LL +
+                           (end_time.tv_usec - start_time->tv_usec) / 1000;
+#ifdef __APPLE__
+  // In bytes instead of kilobytes.
+  long max_rss_kb = rusage->ru_maxrss / 1024;
+#else
+  long max_rss_kb = rusage->ru_maxrss;
+#endif
+
+  FILE *stats = fopen(stats_path, "w");
+  CHECK_NOT_NULL(stats);
+  fprintf(stats,
+          "wall_time_ms %lld\n"
+          "user_time_ms %lld\n"
+          "system_time_ms %lld\n"
+          "max_rss_kb %ld\n"
+          "block_input_ops %ld\n"
+          "block_output_ops %ld\n"
+          "voluntary_context_switches %ld\n"
+          "involuntary_context_switches %ld\n",
+          wall_time_ms,
+          rusage->ru_utime.tv_sec * 1000LL + rusage->ru_utime.tv_usec / 1000,
+          rusage->ru_stime.tv_sec * 1000LL + rusage->ru_stime.tv_usec / 1000,
+          max_rss_kb, rusage->ru_inblock, rusage->ru_oublock, rusage->ru_nvcsw,
+          rusage->ru_nivcsw);
+  if (fclose(stats) != 0) {
+    DIE("fclose(%s) failed\n", stats_path);
+  }
+}
+
+#ifdef __linux__
+// The errno of execvp in the vfork child, which shares our memory.
+static volatile int global_exec_errno;
+#endif
+
+// Relays one of the command's output streams from a pipe to the file
+// descriptor that it would have written to. Once "head_limit" bytes went
+// through, the rest is kept in a ring buffer of "tail_size" bytes, which is
+// written at the end after a note of how many bytes did not fit.
+struct OutputRelay {
+  int pipe_fd;  // the read end of the pipe, or -1 once at its end
+  int out_fd;   // or -1 after a failed write
+  long long head_limit;
+  long long written;
+  char *tail;
+  size_t tail_size;
+  size_t tail_start;
+  size_t tail_length;
+  long long dropped;
+};
+
+// Writes all of "buf" to the relay's output, ignoring failures other than
+// giving up on that output.
+static void WriteRelayOutput(struct OutputRelay *relay, const char *buf,
+                             size_t size) {
+  while (size > 0 && relay->out_fd != -1) {
+    ssize_t n = write(relay->out_fd, buf, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      relay->out_fd = -1;
+      return;
+    }
+    buf += n;
+    size -= n;
+  }
+}
+
+static void InitOutputRelay(struct OutputRelay *relay, int pipe_fd, int out_fd,
+                            long long limit) {
+  memset(relay, 0, sizeof(*relay));
+  relay->pipe_fd = pipe_fd;
+  relay->out_fd = out_fd;
+  relay->head_limit = limit / 2;
+  relay->tail_size = limit - relay->head_limit;
+  relay->tail = malloc(relay->tail_size);
+  CHECK_NOT_NULL(relay->tail);
+  CHECK_CALL(fcntl(pipe_fd, F_SETFL, fcntl(pipe_fd, F_GETFL) | O_NONBLOCK));
+}
+
+// Relays what can be read from the pipe without blocking.
+static void ReadOutputRelay(struct OutputRelay *relay) {
+  char buf[65536];
+  for (;;) {
+    ssize_t n = read(relay->pipe_fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0 && errno == EAGAIN) {
+      return;
+    } else if (n <= 0) {
+      close(relay->pipe_fd);
+      relay->pipe_fd = -1;
+      return;
+    }
+
+    const char *data = buf;
+    size_t size = n;
+    if (relay->written < relay->head_limit) {
+      size_t head = relay->head_limit - relay->written;
+      if (head > size) {
+        head = size;
+      }
+      WriteRelayOutput(relay, data, head);
+      relay->written += head;
+      data += head;
+      size -= head;
+    }
+    // Only the last tail_size bytes of this read can end up in the tail.
+    if (size > relay->tail_size) {
+      relay->dropped += size - relay->tail_size;
+      data += size - relay->tail_size;
+      size = relay->tail_size;
+    }
+    for (; size > 0; ++data, --size) {
+      size_t end = (relay->tail_start + relay->tail_length) % relay->tail_size;
+      relay->tail[end] = *data;
+      if (relay->tail_length < relay->tail_size) {
+        ++relay->tail_length;
+      } else {
+        relay->tail_start = (relay->tail_start + 1) % relay->tail_size;
+        ++relay->dropped;
+      }
+    }
+  }
+}
+
+// Writes the buffered tail and frees the relay's buffer.
+static void FinishOutputRelay(struct OutputRelay *relay) {
+  if (relay->pipe_fd != -1) {
+    close(relay->pipe_fd);
+  }
+  if (relay->dropped > 0) {
+    char note[128];
+    int length = snprintf(note, sizeof(note),
+                          "\n[process-wrapper: %lld bytes of output left "
+                          "out]\n",
+                          relay->dropped);
+    WriteRelayOutput(relay, note, length);
+  }
+  size_t first = relay->tail_size - relay->tail_start;
+  if (first > relay->tail_length) {
+    first = relay->tail_length;
+  }
+  WriteRelayOutput(relay, relay->tail + relay->tail_start, first);
+  WriteRelayOutput(relay, relay->tail, relay->tail_length - first);
+  free(relay->tail);
+}
+
+// Does nothing but interrupt poll in RunOutputRelays.
+static void OnChildExit(int sig) {}
+
+// Relays the command's output until both pipes are at their end, or until the
+// command exited and its descendants that still hold the pipes open have no
+// more output ready.
+static void RunOutputRelays(pid_t pid, struct OutputRelay *relays, int count) {
+  bool exited = false;
+  while (!exited) {
+    struct pollfd fds[2];
+    int num_fds = 0;
+    for (int i = 0; i < count; ++i) {
+      if (relays[i].pipe_fd != -1) {
+        fds[num_fds].fd = relays[i].pipe_fd;
+        fds[num_fds].events = POLLIN;
+        ++num_fds;
+      }
+    }
+    if (num_fds == 0) {
+      break;
+    }
+    // SIGCHLD interrupts poll when the command exits while one of its
+    // descendants keeps a pipe open; the timeout covers a SIGCHLD that came
+    // just before poll.
+    if (poll(fds, num_fds, 1000) < 0 && errno != EINTR) {
+      DIE("poll: %s\n", strerror(errno));
+    }
+    siginfo_t info;
+    info.si_pid = 0;
+    exited = waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 &&
+             info.si_pid == pid;
+    for (int i = 0; i < count; ++i) {
+      if (relays[i].pipe_fd != -1) {
+        ReadOutputRelay(&relays[i]);
+      }
+    }
+  }
+  for (int i = 0; i < count; ++i) {
+    FinishOutputRelay(&relays[i]);
+  }
+}
+
+// Start the command in a new session, with an empty signal mask and the
+// default signal handlers. If "output_pipes" is not NULL, its write ends
+// become the command's stdout and stderr.
+static pid_t StartCommand(char *const *argv, const int (*output_pipes)[2]) {
+  // Force umask to include read and execute for everyone, to make
+  // output permissions predictable.
+  umask(022);
+  SetCloseOnExecOnInheritedFds();
+
+  pid_t pid;
+#ifdef __linux__
+  // Unlike fork, vfork does not copy our page tables. The child only makes
+  // system calls before it execs, and we have not installed any signal
+  // handlers yet which could run in it.
+  CHECK_CALL(pid = vfork());
+  if (pid == 0) {
     // In child.
+    if (output_pipes != NULL &&
+        (dup2(output_pipes[0][1], STDOUT_FILENO) == -1 ||
+         dup2(output_pipes[1][1], STDERR_FILENO) == -1)) {
+      global_exec_errno = errno;
+      _exit(EXIT_FAILURE);
+    }
+    if (setsid() != -1) {
+      ClearSignalMask();
+      execvp(argv[0], argv);
+    }
+    global_exec_errno = errno;
+    _exit(EXIT_FAILURE);
+  }
+  if (global_exec_errno != 0) {
+    errno = global_exec_errno;
+    err(EXIT_FAILURE, "execvp(\"%s\", ...)", argv[0]);
+  }
+#else
+  CHECK_CALL(pid = fork());
+  if (pid == 0) {
+    // In child.
+    if (output_pipes != NULL) {
+      CHECK_CALL(dup2(output_pipes[0][1], STDOUT_FILENO));
+      CHECK_CALL(dup2(output_pipes[1][1], STDERR_FILENO));
+    }
     CHECK_CALL(setsid());
     ClearSignalMask();
 
-    // Force umask to include read and execute for everyone, to make
-    // output permissions predictable.
-    umask(022);
-
     // Does not return unless something went wrong.
     execvp(argv[0], argv);
     err(EXIT_FAILURE, "execvp(\"%s\", ...)", argv[0]);
+  }
+#endif
+  return pid;
+}
+
+// Run the command specified by the argv array and kill it after timeout
+// seconds. If stats_path is not NULL, write the resource usage of the command
+// there once it exited. If output_limit is not 0, relay its stdout and stderr,
+// keeping at most that many bytes of each.
+static void SpawnCommand(char *const *argv, double timeout_secs,
+                         const char *stats_path, long long output_limit) {
+  int output_pipes[2][2];
+  if (output_limit > 0) {
+    CHECK_CALL(pipe(output_pipes[0]));
+    CHECK_CALL(pipe(output_pipes[1]));
+  }
+
+  struct timeval start_time;
+  CHECK_CALL(gettimeofday(&start_time, NULL));
+  global_child_pid =
+      StartCommand(argv, output_limit > 0 ? output_pipes : NULL);
+
+  // Set up a signal handler which kills all subprocesses when the given
+  // signal is triggered.
+  HandleSignal(SIGALRM, OnSignal);
+  HandleSignal(SIGTERM, OnSignal);
+  HandleSignal(SIGINT, OnSignal);
+  SetTimeout(timeout_secs);
+
+  if (output_limit > 0) {
+    CHECK_CALL(close(output_pipes[0][1]));
+    CHECK_CALL(close(output_pipes[1][1]));
+    HandleSignal(SIGCHLD, OnChildExit);
+    struct OutputRelay relays[2];
+    InitOutputRelay(&relays[0], output_pipes[0][0], STDOUT_FILENO,
+                    output_limit);
+    InitOutputRelay(&relays[1], output_pipes[1][0], STDERR_FILENO,
+                    output_limit);
+    RunOutputRelays(global_child_pid, relays, 2);
+  }
+
+  struct rusage rusage;
+  int status = WaitChild(global_child_pid, argv[0], &rusage);
+  if (stats_path != NULL) {
+    WriteStats(stats_path, &start_time, &rusage);
+  }
+
+  // The child is done for, but may have grandchildren that we still have to
+  // kill.
+  kill(-global_child_pid, SIGKILL);
+
+  if (global_signal > 0) {
+    // Don't trust the exit code if we got a timeout or signal.
+    UnHandle(global_signal);
+    raise(global_signal);
+  } else if (WIFEXITED(status)) {
+    exit(WEXITSTATUS(status));
   } else {
-    // In parent.
-
-    // Set up a signal handler which kills all subprocesses when the given
-    // signal is triggered.
-    HandleSignal(SIGALRM, OnSignal);
-    HandleSignal(SIGTERM, OnSignal);
-    HandleSignal(SIGINT, OnSignal);
-    SetTimeout(timeout_secs);
-
-    int status = WaitChild(global_child_pid, argv[0]);
-
-    // The child is done for, but may have grandchildren that we still have to
-    // kill.
-    kill(-global_child_pid, SIGKILL);
-
-    if (global_signal > 0) {
-      // Don't trust the exit code if we got a timeout or signal.
-      UnHandle(global_signal);
-      raise(global_signal);
-    } else if (WIFEXITED(status)) {
-      exit(WEXITSTATUS(status));
-    } else {
-      int sig = WTERMSIG(status);
-      UnHandle(sig);
-      raise(sig);
-    }
+    int sig = WTERMSIG(status);
+    UnHandle(sig);
+    raise(sig);
   }
 }
 
 int main(int argc, char *argv[]) {
+  if (argc == 2 && strcmp(argv[1], "--batch") == 0) {
+    SwitchToEuid();
+    SwitchToEgid();
+    return RunBatch();
+  }
+
   struct Options opt;
   memset(&opt, 0, sizeof(opt));
 
@@ -163,7 +467,7 @@ int main(int argc, char *argv[]) {
   RedirectStdout(opt.stdout_path);
   RedirectStderr(opt.stderr_path);
 
-  SpawnCommand(opt.args, opt.timeout_secs);
+  SpawnCommand(opt.args, opt.timeout_secs, opt.stats_path, opt.output_limit);
 
   return 0;
 }
@@ -0,0 +1,228 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "runfiles-index.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+static const char kMagic[8] = {'R', 'F', 'I', 'N', 'D', 'E', 'X', '1'};
+static const uint32_t kByteOrder = 0x01020304;
+static const size_t kHeaderSize = 24;
+
+static bool PathLess(const RunfilesIndexEntry &a, const RunfilesIndexEntry &b) {
+  return a.path < b.path;
+}
+
+bool WriteRunfilesIndex(const std::string &path,
+                        std::vector<RunfilesIndexEntry> *entries) {
+  std::sort(entries->begin(), entries->end(), PathLess);
+
+  uint64_t strings_size = 0;
+  for (const RunfilesIndexEntry &entry : *entries) {
+    strings_size += entry.path.size() + entry.target.size();
+  }
+  if (strings_size > UINT32_MAX || entries->size() > UINT32_MAX) {
+    errno = EFBIG;
+    return false;
+  }
+
+  FILE *out = fopen(path.c_str(), "w");
+  if (out == NULL) {
+    return false;
+  }
+  const uint32_t num_entries = entries->size();
+  bool ok = fwrite(kMagic, sizeof(kMagic), 1, out) == 1 &&
+            fwrite(&kByteOrder, sizeof(kByteOrder), 1, out) == 1 &&
+            fwrite(&num_entries, sizeof(num_entries), 1, out) == 1 &&
+            fwrite(&strings_size, sizeof(strings_size), 1, out) == 1;
+
+  uint32_t offset = 0;
+  for (size_t i = 0; ok && i < entries->size(); ++i) {
+    const RunfilesIndexEntry &entry = (*entries)[i];
+    uint32_t fields[4];
+    fields[0] = offset;
+    fields[1] = entry.path.size();
+    fields[2] = offset + entry.path.size();
+    fields[3] = entry.target.size();
+    offset += entry.path.size() + entry.target.size();
+    ok = fwrite(fields, sizeof(fields), 1, out) == 1;
+  }
+  for (size_t i = 0; ok && i < entries->size(); ++i) {
+    const RunfilesIndexEntry &entry = (*entries)[i];
+    ok = fwrite(entry.path.data(), 1, entry.path.size(), out) ==
+             entry.path.size() &&
+         fwrite(entry.target.data(), 1, entry.target.size(), out) ==
+             entry.target.size();
+  }
+
+  int saved_errno = errno;
+  if (fclose(out) != 0) {
+    return false;
+  }
+  errno = saved_errno;
+  return ok;
+}
+
+RunfilesIndex::RunfilesIndex()
+    : data_(NULL), size_(0), entries_(NULL), num_entries_(0), strings_(NULL) {}
+
+RunfilesIndex::~RunfilesIndex() { Close(); }
+
+void RunfilesIndex::Close() {
+  if (data_ != NULL) {
+    munmap(const_cast<char *>(data_), size_);
+  }
+  data_ = NULL;
+  size_ = 0;
+  entries_ = NULL;
+  num_entries_ = 0;
+  strings_ = NULL;
+}
+
+bool RunfilesIndex::Open(const std::string &path) {
+  Close();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return false;
+  }
+  if (static_cast<uint64_t>(st.st_size) < kHeaderSize) {
+    close(fd);
+    errno = EINVAL;
+    return false;
+  }
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  int saved_errno = errno;
+  close(fd);
+  if (data == MAP_FAILED) {
+    errno = saved_errno;
+    return false;
+  }
+  data_ = static_cast<const char *>(data);
+  size_ = st.st_size;
+
+  uint32_t byte_order;
+  uint64_t strings_size;
+  memcpy(&byte_order, data_ + 8, sizeof(byte_order));
+  memcpy(&num_entries_, data_ + 12, sizeof(num_entries_));
+  memcpy(&strings_size, data_ + 16, sizeof(strings_size));
+  bool valid = memcmp(data_, kMagic, sizeof(kMagic)) == 0 &&
+               byte_order == kByteOrder &&
+               kHeaderSize + num_entries_ * uint64_t(sizeof(Entry)) +
+                       strings_size ==
+                   size_;
+  if (valid) {
+    entries_ = reinterpret_cast<const Entry *>(data_ + kHeaderSize);
+    strings_ = data_ + kHeaderSize + num_entries_ * sizeof(Entry);
+    for (uint32_t i = 0; valid && i < num_entries_; ++i) {
+      const Entry &entry = entries_[i];
+      valid = uint64_t(entry.path_offset) + entry.path_length <= strings_size &&
+              uint64_t(entry.target_offset) + entry.target_length <=
+                  strings_size;
+    }
+  }
+  if (!valid) {
+    Close();
+    errno = EINVAL;
+    return false;
+  }
+  return true;
+}
+
+// Compares the path of "entry" with the "length" bytes at "path".
+static int ComparePath(const char *strings, uint32_t path_offset,
+                       uint32_t path_length, const char *path, size_t length) {
+  int result = memcmp(strings + path_offset, path, std::min<size_t>(
+                                                       path_length, length));
+  if (result != 0) {
+    return result;
+  }
+  return path_length < length ? -1 : path_length > length ? 1 : 0;
+}
+
+const RunfilesIndex::Entry *RunfilesIndex::LowerBound(const char *path,
+                                                      size_t length) const {
+  size_t low = 0;
+  size_t high = num_entries_;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    const Entry &entry = entries_[mid];
+    if (ComparePath(strings_, entry.path_offset, entry.path_length, path,
+                    length) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return entries_ + low;
+}
+
+bool RunfilesIndex::HasPath(const Entry *entry, const char *path,
+                            size_t length) const {
+  return entry != entries_ + num_entries_ &&
+         ComparePath(strings_, entry->path_offset, entry->path_length, path,
+                     length) == 0;
+}
+
+RunfilesIndex::EntryType RunfilesIndex::Lookup(const std::string &path,
+                                               std::string *target) const {
+  if (path.empty()) {
+    return num_entries_ > 0 ? DIRECTORY : NOT_FOUND;
+  }
+
+  const Entry *entry = LowerBound(path.data(), path.size());
+  if (HasPath(entry, path.data(), path.size())) {
+    if (entry->target_length == 0) {
+      return EMPTY_FILE;
+    }
+    target->assign(strings_ + entry->target_offset, entry->target_length);
+    return SYMLINK;
+  }
+
+  // The entries in the directory "path" sort right after it.
+  const std::string dir = path + '/';
+  entry = LowerBound(dir.data(), dir.size());
+  if (entry != entries_ + num_entries_ && entry->path_length > dir.size() &&
+      memcmp(strings_ + entry->path_offset, dir.data(), dir.size()) == 0) {
+    return DIRECTORY;
+  }
+
+  for (size_t slash = path.rfind('/'); slash != std::string::npos && slash > 0;
+       slash = path.rfind('/', slash - 1)) {
+    entry = LowerBound(path.data(), slash);
+    if (HasPath(entry, path.data(), slash)) {
+      if (entry->target_length == 0) {
+        return NOT_FOUND;
+      }
+      target->assign(strings_ + entry->target_offset, entry->target_length);
+      target->append(path, slash, std::string::npos);
+      return SYMLINK;
+    }
+  }
+  return NOT_FOUND;
+}
@@ -0,0 +1,101 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RUNFILES_INDEX_H__
+#define RUNFILES_INDEX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// A runfiles index is a binary form of a runfiles manifest that can be mapped
+// into memory and searched without parsing it, written by
+// "build-runfiles --manifest_only" as RUNFILES/MANIFEST.index. It lets
+// programs find their runfiles without a runfiles tree on disk.
+//
+// The index is in the byte order of the machine that wrote it:
+//
+//   header:  8-byte magic "RFINDEX1", uint32 0x01020304, uint32 entry count,
+//            uint64 size of the strings
+//   entries: uint32 path offset, uint32 path length, uint32 target offset,
+//            uint32 target length, sorted by path
+//   strings: the paths and targets, not NUL-terminated
+
+// An entry of a runfiles manifest: a path relative to the runfiles directory
+// and the file it stands for. An empty target means an empty file.
+struct RunfilesIndexEntry {
+  std::string path;
+  std::string target;
+};
+
+// Writes the index of "entries", whose paths must be unique, to "path".
+// Returns whether that succeeded, with errno set if not.
+bool WriteRunfilesIndex(const std::string &path,
+                        std::vector<RunfilesIndexEntry> *entries);
+
+// A runfiles index mapped into memory.
+class RunfilesIndex {
+ public:
+  enum EntryType {
+    NOT_FOUND,
+    // Target is the path of the file.
+    SYMLINK,
+    // An empty file, without a target.
+    EMPTY_FILE,
+    // A directory that contains other entries.
+    DIRECTORY,
+  };
+
+  RunfilesIndex();
+  ~RunfilesIndex();
+
+  // Maps the index at "path". Returns whether that succeeded, with errno set
+  // if not; EINVAL means the file is not a valid index.
+  bool Open(const std::string &path);
+
+  // Looks up "path", relative to the runfiles directory. For a path within a
+  // directory that is a symlink, such as "pkg/dir/file" for the entry
+  // "pkg/dir /some/dir", returns SYMLINK and "/some/dir/file" as target.
+  EntryType Lookup(const std::string &path, std::string *target) const;
+
+  // Returns the number of entries.
+  size_t size() const { return num_entries_; }
+
+ private:
+  struct Entry {
+    uint32_t path_offset;
+    uint32_t path_length;
+    uint32_t target_offset;
+    uint32_t target_length;
+  };
+
+  // Returns the first entry whose path is not less than the "length" bytes
+  // at "path".
+  const Entry *LowerBound(const char *path, size_t length) const;
+
+  // Returns whether "entry" has exactly the given path.
+  bool HasPath(const Entry *entry, const char *path, size_t length) const;
+
+  void Close();
+
+  const char *data_;
+  size_t size_;
+  const Entry *entries_;
+  uint32_t num_entries_;
+  const char *strings_;
+};
+
+#endif  // RUNFILES_INDEX_H__
@@ -44,4 +44,11 @@ if [ -n "${EMBEDDED_TOOLS}" ]; then
   (cd ${PACKAGE_DIR}/embedded_tools && unzip -q ${WORKDIR}/${EMBEDDED_TOOLS})
 fi
 
-(cd ${PACKAGE_DIR} && find . -type f | sort | zip -qDX@ ${WORKDIR}/${OUT})
+# The jars are compressed already. Stored as they are, the client copies them
+# out of its binary without reading them (see ExtractBlazeZipProcessor). The
+# other files are then deflated again at level 9, in place: they inflate as
+# fast as at the default level, so the binary gets smaller at no cost to the
+# first run. (zip -9 would compress the jars too, whatever -n says.)
+(cd ${PACKAGE_DIR} &&
+ find . -type f | sort | zip -qDX -0 -@ ${WORKDIR}/${OUT} &&
+ find . -type f ! -name '*.jar' | sort | zip -qDX -9 -@ ${WORKDIR}/${OUT})
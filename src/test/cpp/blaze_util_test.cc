@@ -167,6 +167,18 @@ TEST_F(BlazeUtilTest, ReadJvmVersion) {
   ReadJvmVersionTest();
 }
 
+TEST_F(BlazeUtilTest, IsRemoteTerminal) {
+  unsetenv("SSH_CONNECTION");
+  unsetenv("SSH_TTY");
+  ASSERT_FALSE(IsRemoteTerminal());
+  setenv("SSH_CONNECTION", "10.0.0.1 50000 10.0.0.2 22", 1);
+  ASSERT_TRUE(IsRemoteTerminal());
+  unsetenv("SSH_CONNECTION");
+  setenv("SSH_TTY", "/dev/pts/1", 1);
+  ASSERT_TRUE(IsRemoteTerminal());
+  unsetenv("SSH_TTY");
+}
+
 TEST_F(BlazeUtilTest, MakeDirectories) {
   const char* tmp_dir = getenv("TEST_TMPDIR");
   ASSERT_STRNE(tmp_dir, NULL);
@@ -198,6 +210,17 @@ TEST_F(BlazeUtilTest, MakeDirectories) {
   ASSERT_EQ(-1, ok);
   ASSERT_EQ(ENOTDIR, errno);
 
+  // Nor below a file.
+  ok = MakeDirectories(blaze_util::JoinPath(non_dir, "a/b"), 0755);
+  ASSERT_EQ(-1, ok);
+  ASSERT_EQ(ENOTDIR, errno);
+
+  // Missing parents are created along with the directory.
+  string deep_dir = blaze_util::JoinPath(dir, "a/b/c/d");
+  ASSERT_EQ(0, MakeDirectories(deep_dir, 0700));
+  ASSERT_EQ(0, stat(deep_dir.c_str(), &filestat));
+  ASSERT_TRUE(S_ISDIR(filestat.st_mode));
+
   // Valid symlink should work.
   string symlink = blaze_util::JoinPath(tmp_dir, "z");
   ASSERT_TRUE(Symlink(dir, symlink));
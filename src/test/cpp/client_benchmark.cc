@@ -0,0 +1,442 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// client_benchmark.cc -- measures the latency of the client.
+//
+// Runs the client with a stub in place of the JVM: run as .../bin/java, this
+// program answers "java -version", and otherwise serves the AF_UNIX socket of
+// the output base it is given (--command_port=-1), answering every request
+// with exit code 0 at once. So what is measured is the client alone, from the
+// rc files to the first response of the server.
+//
+// Cold runs use a new output user root and output base each, so the client
+// extracts its data and starts the server. Warm runs share one, with the
+// server running. The client writes the times of its phases to its trace
+// (see src/main/cpp/util/trace.h): parse_options, compute_workspace,
+// install_base_key, lock, extract_data, jvm_version, connect, start_server,
+// wait_for_server and first_response. For them and for the wall time of the
+// runs, the median, minimum and maximum in microseconds are written as JSON.
+//
+// Usage:
+//   client_benchmark [--runs N] [--cold_runs N] [--client path]
+//                    [--output file] [--max_warm_ms N] [-- startup options...]
+//
+// With --max_warm_ms, exits with 1 if the median wall time of the warm runs is
+// longer.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+extern char **environ;
+
+namespace {
+
+// The stub server exits after this long without requests.
+const int kStubIdleMillis = 600 * 1000;
+
+long long MonotonicMicros() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+bool ReadFully(int fd, void *data, size_t size) {
+  char *p = static_cast<char *>(data);
+  while (size > 0) {
+    ssize_t bytes = read(fd, p, size);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes <= 0) {
+      return false;
+    }
+    p += bytes;
+    size -= bytes;
+  }
+  return true;
+}
+
+// Plays the JVM of the client: the version probe, or the server.
+int RunStubJvm(int argc, char **argv) {
+  std::string output_base;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-version") == 0) {
+      fprintf(stderr, "java version \"1.8.0\"\n");
+      return 0;
+    }
+    if (strncmp(argv[i], "--output_base=", 14) == 0) {
+      output_base = argv[i] + 14;
+    }
+  }
+  if (output_base.empty()) {
+    fprintf(stderr, "stub JVM: no --output_base\n");
+    return 1;
+  }
+
+  std::string socket_path = output_base + "/server/server.socket";
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "stub JVM: socket path too long: %s\n",
+            socket_path.c_str());
+    return 1;
+  }
+  strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+  unlink(socket_path.c_str());
+  int server = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server < 0 ||
+      bind(server, reinterpret_cast<struct sockaddr *>(&addr),
+           sizeof(addr)) != 0 ||
+      listen(server, 16) != 0) {
+    fprintf(stderr, "stub JVM: cannot listen on %s: %s\n",
+            socket_path.c_str(), strerror(errno));
+    return 1;
+  }
+
+  // The response is the control tag, the length of the exit code and the
+  // exit code, in big endian.
+  static const unsigned char kResponse[] = {3, 0, 0, 0, 4, 0, 0, 0, 0};
+  for (;;) {
+    struct pollfd pending = {server, POLLIN, 0};
+    if (poll(&pending, 1, kStubIdleMillis) <= 0) {
+      break;
+    }
+    int client = accept(server, NULL, NULL);
+    if (client < 0) {
+      continue;
+    }
+    unsigned char size[4];
+    if (ReadFully(client, size, sizeof(size))) {
+      std::string request((size[0] << 24) | (size[1] << 16) | (size[2] << 8) |
+                              size[3],
+                          '\0');
+      if (ReadFully(client, &request[0], request.size()) &&
+          write(client, kResponse, sizeof(kResponse)) != sizeof(kResponse)) {
+        // The client went away; nothing to do about it.
+      }
+    }
+    close(client);
+  }
+  unlink(socket_path.c_str());
+  return 0;
+}
+
+void CreateFile(const std::string &path) {
+  FILE *file = fopen(path.c_str(), "w");
+  if (file == NULL || fclose(file) != 0) {
+    fprintf(stderr, "Cannot create %s: %s\n", path.c_str(), strerror(errno));
+    exit(1);
+  }
+}
+
+void CreateDirectory(const std::string &path) {
+  if (mkdir(path.c_str(), 0755) < 0) {
+    fprintf(stderr, "Cannot create %s: %s\n", path.c_str(), strerror(errno));
+    exit(1);
+  }
+}
+
+// Runs "args" with the environment "env", its output going to "log". Returns
+// whether it succeeded.
+bool Run(const std::vector<std::string> &args,
+         const std::vector<std::string> &env, const std::string &log) {
+  std::vector<char *> argv;
+  for (const std::string &arg : args) {
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  }
+  argv.push_back(NULL);
+  std::vector<char *> envp;
+  for (const std::string &var : env) {
+    envp.push_back(const_cast<char *>(var.c_str()));
+  }
+  envp.push_back(NULL);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, log.c_str(),
+                                   O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+  pid_t pid;
+  int error = posix_spawn(&pid, argv[0], &actions, NULL, argv.data(),
+                          envp.data());
+  posix_spawn_file_actions_destroy(&actions);
+  if (error != 0) {
+    fprintf(stderr, "Cannot run %s: %s\n", argv[0], strerror(error));
+    exit(1);
+  }
+  int status;
+  return waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+         WEXITSTATUS(status) == 0;
+}
+
+// Reads the durations of the spans of a trace written by trace.cc, one event
+// per line.
+void ReadPhases(const std::string &path,
+                std::map<std::string, std::vector<long long>> *samples) {
+  std::ifstream trace(path);
+  std::string line;
+  while (std::getline(trace, line)) {
+    const std::string kName = "{\"name\":\"";
+    const std::string kDuration = "\"dur\":";
+    size_t name_end = line.find('"', kName.size());
+    size_t duration = line.find(kDuration);
+    if (line.compare(0, kName.size(), kName) != 0 ||
+        line.find("\"ph\":\"X\"") == std::string::npos ||
+        name_end == std::string::npos || duration == std::string::npos) {
+      continue;
+    }
+    (*samples)[line.substr(kName.size(), name_end - kName.size())].push_back(
+        atoll(line.c_str() + duration + kDuration.size()));
+  }
+}
+
+struct Setup {
+  std::string client;
+  std::string tmpdir;
+  std::string jdk;
+  std::vector<std::string> extra_flags;
+  std::vector<std::string> env;
+};
+
+// Runs the client once in the output user root "root", adding its wall time
+// and the times of its phases to "samples".
+void RunClient(const Setup &setup, const std::string &root,
+               std::map<std::string, std::vector<long long>> *samples) {
+  std::vector<std::string> args = {
+      setup.client,
+      "--output_user_root=" + root,
+      "--output_base=" + root + "/base",
+      "--host_javabase=" + setup.jdk,
+      "--nomaster_bazelrc",
+      "--bazelrc=/dev/null",
+      "--command_port=-1",
+      "--max_idle_secs=" + std::to_string(kStubIdleMillis / 1000)};
+  args.insert(args.end(), setup.extra_flags.begin(), setup.extra_flags.end());
+  args.push_back("version");
+
+  std::string trace_dir = setup.tmpdir + "/trace";
+  CreateDirectory(trace_dir);
+  std::vector<std::string> env = setup.env;
+  env.push_back("BAZEL_NATIVE_TRACE_DIR=" + trace_dir);
+  std::string log = setup.tmpdir + "/client.log";
+
+  long long start = MonotonicMicros();
+  if (!Run(args, env, log)) {
+    fprintf(stderr, "%s failed, see %s\n", setup.client.c_str(), log.c_str());
+    exit(1);
+  }
+  (*samples)["total"].push_back(MonotonicMicros() - start);
+
+  Run({"/bin/sh", "-c", "cat \"$0\"/*.trace.json; rm -rf \"$0\"", trace_dir},
+      setup.env, setup.tmpdir + "/trace.json");
+  ReadPhases(setup.tmpdir + "/trace.json", samples);
+}
+
+// Stops the stub server of the output user root "root" and deletes it,
+// including the read-only install base.
+void RemoveRoot(const Setup &setup, const std::string &root) {
+  std::ifstream pid_file(root + "/base/server/server.pid.txt");
+  pid_t pid;
+  if (pid_file >> pid && pid > 0) {
+    kill(pid, SIGTERM);
+  }
+  Run({"/bin/sh", "-c", "chmod -R u+w \"$0\" && rm -rf \"$0\"", root},
+      setup.env, "/dev/null");
+}
+
+void PrintSamples(FILE *out, const char *name, int runs,
+                  std::map<std::string, std::vector<long long>> *samples) {
+  fprintf(out, "  \"%s\": {\n    \"runs\": %d,\n    \"phases_us\": {", name,
+          runs);
+  const char *separator = "\n";
+  for (auto &sample : *samples) {
+    std::vector<long long> &values = sample.second;
+    std::sort(values.begin(), values.end());
+    fprintf(out,
+            "%s      \"%s\": {\"median\": %lld, \"min\": %lld, \"max\": %lld}",
+            separator, sample.first.c_str(), values[values.size() / 2],
+            values.front(), values.back());
+    separator = ",\n";
+  }
+  fprintf(out, "\n    }\n  }");
+}
+
+}  // namespace
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: client_benchmark [--runs n] [--cold_runs n] "
+          "[--client path]\n"
+          "                        [--output file] [--max_warm_ms n] "
+          "[-- startup options...]\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *slash = strrchr(argv[0], '/');
+  if (strcmp(slash == NULL ? argv[0] : slash + 1, "java") == 0) {
+    return RunStubJvm(argc, argv);
+  }
+
+  int runs = 20;
+  int cold_runs = 5;
+  int max_warm_ms = 0;
+  std::string output;
+  Setup setup;
+  setup.client = "src/bazel";
+  for (int ii = 1; ii < argc; ++ii) {
+    if (strcmp(argv[ii], "--runs") == 0) {
+      if (++ii == argc || (runs = atoi(argv[ii])) < 1) {
+        usage();
+      }
+    } else if (strcmp(argv[ii], "--cold_runs") == 0) {
+      if (++ii == argc || (cold_runs = atoi(argv[ii])) < 1) {
+        usage();
+      }
+    } else if (strcmp(argv[ii], "--max_warm_ms") == 0) {
+      if (++ii == argc || (max_warm_ms = atoi(argv[ii])) < 1) {
+        usage();
+      }
+    } else if (strcmp(argv[ii], "--client") == 0) {
+      if (++ii == argc) {
+        usage();
+      }
+      setup.client = argv[ii];
+    } else if (strcmp(argv[ii], "--output") == 0) {
+      if (++ii == argc) {
+        usage();
+      }
+      output = argv[ii];
+    } else if (strcmp(argv[ii], "--") == 0) {
+      setup.extra_flags.assign(argv + ii + 1, argv + argc);
+      break;
+    } else {
+      usage();
+    }
+  }
+
+  char *client = realpath(setup.client.c_str(), NULL);
+  if (client == NULL) {
+    fprintf(stderr, "Cannot find %s: %s\n", setup.client.c_str(),
+            strerror(errno));
+    return 1;
+  }
+  setup.client = client;
+  free(client);
+  char *self = realpath("/proc/self/exe", NULL);
+  if (self == NULL) {
+    fprintf(stderr, "Cannot find /proc/self/exe: %s\n", strerror(errno));
+    return 1;
+  }
+
+  // Short, as the socket path of the output base must fit in sockaddr_un.
+  const char *tmpdir_root = getenv("TEST_TMPDIR");
+  setup.tmpdir = std::string(tmpdir_root ? tmpdir_root : "/tmp") +
+                 "/client_bm.XXXXXX";
+  if (mkdtemp(&setup.tmpdir[0]) == NULL) {
+    fprintf(stderr, "Cannot create %s: %s\n", setup.tmpdir.c_str(),
+            strerror(errno));
+    return 1;
+  }
+  // A JDK whose java is this program, and a workspace to run the client in.
+  setup.jdk = setup.tmpdir + "/jdk";
+  CreateDirectory(setup.jdk);
+  CreateDirectory(setup.jdk + "/bin");
+  CreateDirectory(setup.jdk + "/lib");
+  CreateFile(setup.jdk + "/lib/rt.jar");
+  if (symlink(self, (setup.jdk + "/bin/java").c_str()) != 0) {
+    fprintf(stderr, "Cannot link the stub JVM: %s\n", strerror(errno));
+    return 1;
+  }
+  free(self);
+  char cwd[PATH_MAX];
+  if (!output.empty() && output[0] != '/' && getcwd(cwd, sizeof(cwd)) != NULL) {
+    output = std::string(cwd) + "/" + output;
+  }
+  std::string workspace = setup.tmpdir + "/workspace";
+  CreateDirectory(workspace);
+  CreateFile(workspace + "/WORKSPACE");
+  if (chdir(workspace.c_str()) != 0) {
+    fprintf(stderr, "Cannot chdir to %s: %s\n", workspace.c_str(),
+            strerror(errno));
+    return 1;
+  }
+  for (char **var = environ; *var != NULL; ++var) {
+    if (strncmp(*var, "BAZEL_NATIVE_TRACE_DIR=", 23) != 0) {
+      setup.env.push_back(*var);
+    }
+  }
+
+  std::map<std::string, std::vector<long long>> cold;
+  for (int run = 0; run < cold_runs; ++run) {
+    std::string root = setup.tmpdir + "/cold" + std::to_string(run);
+    RunClient(setup, root, &cold);
+    RemoveRoot(setup, root);
+  }
+
+  // The first run extracts the data and starts the server.
+  std::map<std::string, std::vector<long long>> warm;
+  std::string root = setup.tmpdir + "/warm";
+  RunClient(setup, root, &warm);
+  warm.clear();
+  for (int run = 0; run < runs; ++run) {
+    RunClient(setup, root, &warm);
+  }
+  RemoveRoot(setup, root);
+  Run({"/bin/rm", "-rf", setup.tmpdir}, setup.env, "/dev/null");
+
+  FILE *out = output.empty() ? stdout : fopen(output.c_str(), "w");
+  if (out == NULL) {
+    fprintf(stderr, "Cannot write %s: %s\n", output.c_str(), strerror(errno));
+    return 1;
+  }
+  fprintf(out, "{\n");
+  PrintSamples(out, "cold", cold_runs, &cold);
+  fprintf(out, ",\n");
+  PrintSamples(out, "warm", runs, &warm);
+  fprintf(out, "\n}\n");
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  long long warm_total_us = warm["total"][warm["total"].size() / 2];
+  if (max_warm_ms > 0 && warm_total_us > max_warm_ms * 1000LL) {
+    fprintf(stderr, "The median warm run took %lld ms, more than %d ms\n",
+            warm_total_us / 1000, max_warm_ms);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,106 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "src/main/tools/runfiles-index.h"
+#include "gtest/gtest.h"
+
+using std::string;
+
+class RunfilesIndexTest : public ::testing::Test {
+ protected:
+  void SetUp() {
+    const char* tmp_dir = getenv("TEST_TMPDIR");
+    ASSERT_STRNE(NULL, tmp_dir);
+    index_path_ = string(tmp_dir) + "/MANIFEST.index";
+  }
+
+  void Add(const string& path, const string& target) {
+    RunfilesIndexEntry entry;
+    entry.path = path;
+    entry.target = target;
+    entries_.push_back(entry);
+  }
+
+  string index_path_;
+  std::vector<RunfilesIndexEntry> entries_;
+};
+
+TEST_F(RunfilesIndexTest, LooksUpEntries) {
+  Add("ws/pkg/b", "/real/b");
+  Add("ws/pkg/a", "/real/a");
+  Add("ws/pkg/__init__.py", "");
+  Add("ws/pkg-data", "/real/pkg-data");
+  Add("ws/tree", "/real/tree");
+  ASSERT_TRUE(WriteRunfilesIndex(index_path_, &entries_));
+
+  RunfilesIndex index;
+  ASSERT_TRUE(index.Open(index_path_));
+  ASSERT_EQ(5u, index.size());
+
+  string target;
+  ASSERT_EQ(RunfilesIndex::SYMLINK, index.Lookup("ws/pkg/a", &target));
+  ASSERT_EQ("/real/a", target);
+  ASSERT_EQ(RunfilesIndex::SYMLINK, index.Lookup("ws/pkg/b", &target));
+  ASSERT_EQ("/real/b", target);
+  ASSERT_EQ(RunfilesIndex::SYMLINK, index.Lookup("ws/pkg-data", &target));
+  ASSERT_EQ("/real/pkg-data", target);
+  ASSERT_EQ(RunfilesIndex::EMPTY_FILE,
+            index.Lookup("ws/pkg/__init__.py", &target));
+
+  ASSERT_EQ(RunfilesIndex::DIRECTORY, index.Lookup("ws", &target));
+  ASSERT_EQ(RunfilesIndex::DIRECTORY, index.Lookup("ws/pkg", &target));
+  ASSERT_EQ(RunfilesIndex::DIRECTORY, index.Lookup("", &target));
+
+  ASSERT_EQ(RunfilesIndex::SYMLINK, index.Lookup("ws/tree/x/y", &target));
+  ASSERT_EQ("/real/tree/x/y", target);
+  ASSERT_EQ(RunfilesIndex::SYMLINK, index.Lookup("ws/pkg/a/b", &target));
+  ASSERT_EQ("/real/a/b", target);
+
+  ASSERT_EQ(RunfilesIndex::NOT_FOUND, index.Lookup("ws/pkg/c", &target));
+  ASSERT_EQ(RunfilesIndex::NOT_FOUND, index.Lookup("ws/pk", &target));
+  ASSERT_EQ(RunfilesIndex::NOT_FOUND,
+            index.Lookup("ws/pkg/__init__.py/x", &target));
+  ASSERT_EQ(RunfilesIndex::NOT_FOUND, index.Lookup("other", &target));
+}
+
+TEST_F(RunfilesIndexTest, EmptyIndex) {
+  ASSERT_TRUE(WriteRunfilesIndex(index_path_, &entries_));
+
+  RunfilesIndex index;
+  ASSERT_TRUE(index.Open(index_path_));
+  ASSERT_EQ(0u, index.size());
+  string target;
+  ASSERT_EQ(RunfilesIndex::NOT_FOUND, index.Lookup("", &target));
+  ASSERT_EQ(RunfilesIndex::NOT_FOUND, index.Lookup("a", &target));
+}
+
+TEST_F(RunfilesIndexTest, RejectsInvalidIndex) {
+  FILE* f = fopen(index_path_.c_str(), "w");
+  ASSERT_NE(nullptr, f);
+  fputs("ws/pkg/a /real/a\n", f);
+  fclose(f);
+
+  RunfilesIndex index;
+  ASSERT_FALSE(index.Open(index_path_));
+  ASSERT_EQ(EINVAL, errno);
+  ASSERT_FALSE(index.Open(index_path_ + ".missing"));
+  ASSERT_EQ(ENOENT, errno);
+}
@@ -0,0 +1,64 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/main/cpp/util/histogram.h"
+#include "gtest/gtest.h"
+
+namespace blaze_util {
+
+TEST(HistogramTest, TestEmpty) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(0u, histogram.Count());
+  EXPECT_EQ(0u, histogram.PercentileMicros(0.5));
+  EXPECT_EQ("0 0 0", histogram.ToString());
+}
+
+TEST(HistogramTest, TestBuckets) {
+  LatencyHistogram histogram;
+  histogram.Add(500);               // 0us
+  histogram.Add(1000);              // 1us
+  histogram.Add(3999);              // 3us
+  histogram.Add(4000);              // 4us
+  histogram.Add(1000000);           // 1000us
+  histogram.Add(3600000000000ULL);  // an hour, in the last bucket
+  EXPECT_EQ(6u, histogram.Count());
+  EXPECT_EQ(3600000000ULL, histogram.MaxMicros());
+  EXPECT_EQ(1 + 3 + 4 + 1000 + 3600000000ULL, histogram.SumMicros());
+  EXPECT_EQ("6 3600001008 3600000000 0:1 1:1 2:1 3:1 10:1 31:1",
+            histogram.ToString());
+}
+
+TEST(HistogramTest, TestPercentiles) {
+  LatencyHistogram histogram;
+  for (int i = 0; i < 90; i++) {
+    histogram.Add(100000);  // 100us, in [64, 128)
+  }
+  for (int i = 0; i < 9; i++) {
+    histogram.Add(5000000);  // 5ms, in [4096, 8192)
+  }
+  histogram.Add(20000000);  // 20ms
+  EXPECT_EQ(127u, histogram.PercentileMicros(0.5));
+  EXPECT_EQ(127u, histogram.PercentileMicros(0.9));
+  EXPECT_EQ(8191u, histogram.PercentileMicros(0.91));
+  EXPECT_EQ(8191u, histogram.PercentileMicros(0.99));
+  EXPECT_EQ(20000u, histogram.PercentileMicros(1));
+}
+
+TEST(HistogramTest, TestPercentileCappedAtMaximum) {
+  LatencyHistogram histogram;
+  histogram.Add(100000);
+  EXPECT_EQ(100u, histogram.PercentileMicros(0.5));
+}
+
+}  // namespace blaze_util
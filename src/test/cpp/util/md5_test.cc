@@ -11,6 +11,11 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
+#include <string.h>
+
+#include <string>
+#include <vector>
+
 #include "src/main/cpp/util/md5.h"
 #include "src/main/cpp/util/port.h"
 #include "gtest/gtest.h"
@@ -49,4 +54,40 @@ TEST(BlazeUtil, Basic) {
   }
 }
 
+TEST(BlazeUtil, Batch) {
+  // Lengths around the block and padding boundaries, in an order that puts
+  // buffers of different lengths into the same SIMD group.
+  std::vector<std::string> inputs;
+  for (int length = 300; length >= 0; length -= 1) {
+    std::string input;
+    for (int i = 0; i < length; i++) {
+      input += static_cast<char>(length * 31 + i * 7);
+    }
+    inputs.push_back(input);
+  }
+  inputs.push_back(std::string(100000, 'x'));
+
+  std::vector<const void *> bufs;
+  std::vector<size_t> lengths;
+  for (const std::string &input : inputs) {
+    bufs.push_back(input.data());
+    lengths.push_back(input.size());
+  }
+  std::vector<unsigned char> digests(inputs.size() * Md5Digest::kDigestLength);
+  Md5Batch(&bufs[0], &lengths[0], inputs.size(),
+           reinterpret_cast<unsigned char (*)[Md5Digest::kDigestLength]>(
+               &digests[0]));
+
+  unsigned char expected[Md5Digest::kDigestLength];
+  Md5Digest digest;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    digest.Reset();
+    digest.Update(inputs[i].data(), inputs[i].size());
+    digest.Finish(expected);
+    ASSERT_EQ(0, memcmp(expected, &digests[i * Md5Digest::kDigestLength],
+                        Md5Digest::kDigestLength))
+        << "length " << inputs[i].size();
+  }
+}
+
 }  // namespace blaze_util
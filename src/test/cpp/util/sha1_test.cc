@@ -0,0 +1,112 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "src/main/cpp/util/port.h"
+#include "src/main/cpp/util/sha1.h"
+#include "gtest/gtest.h"
+
+namespace blaze_util {
+
+TEST(Sha1Test, TestVectors) {
+  const char *strs[] = {
+    "",
+    "a",
+    "abc",
+    "message digest",
+    "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+    "12345678901234567890123456789012345678901234567890123456789012345678901234567890"
+  };
+  const char *sha1s[] = {
+    "da39a3ee5e6b4b0d3255bfef95601890afd80709",
+    "86f7e437faa5a7fce15d1ddcb9eaeaea377667b8",
+    "a9993e364706816aba3e25717850c26c9cd0d89d",
+    "c12252ceda8be8994d5fa0290a47231c1d16aae3",
+    "84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+    "50abf5706a150990a08b2c5ea40fa0e585554732",
+  };
+  uint n = arraysize(strs);
+  ASSERT_EQ(n, arraysize(sha1s));
+
+  unsigned char buf[Sha1Digest::kDigestLength];
+  Sha1Digest digest;
+  for (uint i = 0; i < n; i++) {
+    digest.Reset();
+    digest.Update(strs[i], strlen(strs[i]));
+    digest.Finish(buf);
+    ASSERT_EQ(sha1s[i], digest.String());
+  }
+}
+
+TEST(Sha1Test, MillionAsInUnevenPieces) {
+  std::string as(1000, 'a');
+  Sha1Digest digest;
+  for (int i = 0; i < 1000; i++) {
+    // Split each piece so that the input buffer is used.
+    digest.Update(as.data(), 7);
+    digest.Update(as.data() + 7, as.size() - 7);
+  }
+  unsigned char buf[Sha1Digest::kDigestLength];
+  digest.Finish(buf);
+  ASSERT_EQ("34aa973cd4c4daa4f61eeb2bdbad27316534016f",
+            digest.String());
+  ASSERT_EQ(0x34, buf[0]);
+  ASSERT_EQ(0x6f, buf[19]);
+}
+
+TEST(Sha1Test, Batch) {
+  // Lengths around the block and padding boundaries, in an order that puts
+  // buffers of different lengths into the same SIMD group.
+  std::vector<std::string> inputs;
+  for (int length = 300; length >= 0; length -= 1) {
+    std::string input;
+    for (int i = 0; i < length; i++) {
+      input += static_cast<char>(length * 31 + i * 7);
+    }
+    inputs.push_back(input);
+  }
+  inputs.push_back(std::string(100000, 'x'));
+  inputs.push_back("abc");
+
+  std::vector<const void *> bufs;
+  std::vector<size_t> lengths;
+  for (const std::string &input : inputs) {
+    bufs.push_back(input.data());
+    lengths.push_back(input.size());
+  }
+  std::vector<unsigned char> digests(inputs.size() *
+                                     Sha1Digest::kDigestLength);
+  Sha1Batch(
+      &bufs[0], &lengths[0], inputs.size(),
+      reinterpret_cast<unsigned char (*)[Sha1Digest::kDigestLength]>(
+          &digests[0]));
+
+  unsigned char expected[Sha1Digest::kDigestLength];
+  Sha1Digest digest;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    digest.Reset();
+    digest.Update(inputs[i].data(), inputs[i].size());
+    digest.Finish(expected);
+    ASSERT_EQ(0, memcmp(expected, &digests[i * Sha1Digest::kDigestLength],
+                        Sha1Digest::kDigestLength))
+        << "length " << inputs[i].size();
+  }
+  ASSERT_EQ("a9993e364706816aba3e25717850c26c9cd0d89d", digest.String());
+}
+
+}  // namespace blaze_util
@@ -0,0 +1,113 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "src/main/cpp/util/port.h"
+#include "src/main/cpp/util/sha256.h"
+#include "gtest/gtest.h"
+
+namespace blaze_util {
+
+TEST(Sha256Test, TestVectors) {
+  const char *strs[] = {
+    "",
+    "a",
+    "abc",
+    "message digest",
+    "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+    "12345678901234567890123456789012345678901234567890123456789012345678901234567890"
+  };
+  const char *sha256s[] = {
+    "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+    "ca978112ca1bbdcafac231b39a23dc4da786eff8147c4e72b9807785afee48bb",
+    "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+    "f7846f55cf23e14eebeab5b4e1550cad5b509e3348fbc4efa3a1413d393cb650",
+    "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+    "f371bc4a311f2b009eef952dd83ca80e2b60026c8e935592d0f9c308453c813e",
+  };
+  uint n = arraysize(strs);
+  ASSERT_EQ(n, arraysize(sha256s));
+
+  unsigned char buf[Sha256Digest::kDigestLength];
+  Sha256Digest digest;
+  for (uint i = 0; i < n; i++) {
+    digest.Reset();
+    digest.Update(strs[i], strlen(strs[i]));
+    digest.Finish(buf);
+    ASSERT_EQ(sha256s[i], digest.String());
+  }
+}
+
+TEST(Sha256Test, MillionAsInUnevenPieces) {
+  std::string as(1000, 'a');
+  Sha256Digest digest;
+  for (int i = 0; i < 1000; i++) {
+    // Split each piece so that the input buffer is used.
+    digest.Update(as.data(), 7);
+    digest.Update(as.data() + 7, as.size() - 7);
+  }
+  unsigned char buf[Sha256Digest::kDigestLength];
+  digest.Finish(buf);
+  ASSERT_EQ("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+            digest.String());
+  ASSERT_EQ(0xcd, buf[0]);
+  ASSERT_EQ(0xd0, buf[31]);
+}
+
+TEST(Sha256Test, Batch) {
+  // Lengths around the block and padding boundaries, in an order that puts
+  // buffers of different lengths into the same SIMD group.
+  std::vector<std::string> inputs;
+  for (int length = 300; length >= 0; length -= 1) {
+    std::string input;
+    for (int i = 0; i < length; i++) {
+      input += static_cast<char>(length * 31 + i * 7);
+    }
+    inputs.push_back(input);
+  }
+  inputs.push_back(std::string(100000, 'x'));
+  inputs.push_back("abc");
+
+  std::vector<const void *> bufs;
+  std::vector<size_t> lengths;
+  for (const std::string &input : inputs) {
+    bufs.push_back(input.data());
+    lengths.push_back(input.size());
+  }
+  std::vector<unsigned char> digests(inputs.size() *
+                                     Sha256Digest::kDigestLength);
+  Sha256Batch(
+      &bufs[0], &lengths[0], inputs.size(),
+      reinterpret_cast<unsigned char (*)[Sha256Digest::kDigestLength]>(
+          &digests[0]));
+
+  unsigned char expected[Sha256Digest::kDigestLength];
+  Sha256Digest digest;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    digest.Reset();
+    digest.Update(inputs[i].data(), inputs[i].size());
+    digest.Finish(expected);
+    ASSERT_EQ(0, memcmp(expected, &digests[i * Sha256Digest::kDigestLength],
+                        Sha256Digest::kDigestLength))
+        << "length " << inputs[i].size();
+  }
+  ASSERT_EQ("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+            digest.String());
+}
+
+}  // namespace blaze_util
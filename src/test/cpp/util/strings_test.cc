@@ -106,6 +106,14 @@ TEST(BlazeUtil, Replace) {
   Replace("_", "_U", &line);
   Replace(":", "_C", &line);
   ASSERT_EQ("x_U_C_Cy_U_C_U_Uz", line);
+
+  line = "aaa";
+  Replace("a", "aa", &line);
+  ASSERT_EQ("aaaaaa", line);
+
+  line = "none";
+  Replace("", "x", &line);
+  ASSERT_EQ("none", line);
 }
 
 TEST(BlazeUtil, StripWhitespace) {
@@ -215,6 +223,22 @@ TEST(BlazeUtil, Tokenize) {
   EXPECT_EQ("two three", result[1]);
 }
 
+TEST(BlazeUtil, TokenizeRange) {
+  vector<string> result;
+  string str = "build --a # c\nstartup 'x y' tail";
+  size_t newline = str.find('\n');
+  Tokenize(str.data(), newline, '#', &result);
+  ASSERT_EQ(2, result.size());
+  EXPECT_EQ("build", result[0]);
+  EXPECT_EQ("--a", result[1]);
+
+  // Appends to the words, and stops at the end of the range.
+  Tokenize(str.data() + newline + 1, 13, '#', &result);
+  ASSERT_EQ(4, result.size());
+  EXPECT_EQ("startup", result[2]);
+  EXPECT_EQ("x y", result[3]);
+}
+
 static vector<string> SplitQuoted(const string &contents,
                                   const char delimeter) {
   vector<string> result;
@@ -0,0 +1,145 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "src/main/cpp/util/thread_pool.h"
+#include "gtest/gtest.h"
+
+namespace blaze_util {
+
+TEST(ThreadPoolTest, TestThreadCount) {
+  int cpus = AvailableCpus();
+  ASSERT_GE(cpus, 1);
+  ASSERT_EQ(cpus, ThreadCount(0));
+  ASSERT_EQ(cpus, ThreadCount(-1));
+  ASSERT_EQ(1, ThreadCount(1));
+  ASSERT_EQ(cpus, ThreadCount(cpus + 1));
+}
+
+TEST(ThreadPoolTest, TestRunsAllTasks) {
+  for (int threads : {0, 1, 4}) {
+    ThreadPool pool(threads);
+    ASSERT_EQ(threads > 1 ? threads : 1, pool.threads());
+    std::atomic<int> sum(0);
+    for (int i = 1; i <= 1000; ++i) {
+      pool.Schedule([&sum, i] { sum += i; });
+    }
+    pool.Wait();
+    ASSERT_EQ(500500, sum);
+  }
+}
+
+TEST(ThreadPoolTest, TestTasksScheduleTasks) {
+  for (int threads : {1, 4}) {
+    ThreadPool pool(threads);
+    std::atomic<int> leaves(0);
+    // Walks a binary tree of depth 12, like a directory tree.
+    std::function<void(int)> visit = [&](int depth) {
+      if (depth == 0) {
+        ++leaves;
+        return;
+      }
+      pool.Schedule([&visit, depth] { visit(depth - 1); });
+      pool.Schedule([&visit, depth] { visit(depth - 1); });
+    };
+    pool.Schedule([&visit] { visit(12); });
+    pool.Wait();
+    ASSERT_EQ(4096, leaves);
+  }
+}
+
+TEST(ThreadPoolTest, TestNestedTaskGroups) {
+  for (int threads : {1, 4}) {
+    ThreadPool pool(threads);
+    std::atomic<int> inner(0);
+    std::atomic<int> outer(0);
+    TaskGroup group(&pool);
+    for (int i = 0; i < 16; ++i) {
+      group.Schedule([&pool, &inner, &outer] {
+        std::atomic<int> mine(0);
+        TaskGroup nested(&pool);
+        for (int j = 0; j < 16; ++j) {
+          nested.Schedule([&inner, &mine] {
+            ++inner;
+            ++mine;
+          });
+        }
+        nested.Wait();
+        // All tasks of the group are done, whichever threads ran them.
+        ASSERT_EQ(16, mine);
+        ++outer;
+      });
+    }
+    group.Wait();
+    ASSERT_EQ(16, outer);
+    ASSERT_EQ(256, inner);
+  }
+}
+
+TEST(ThreadPoolTest, TestOrderedQueueFinishesInOrder) {
+  for (int threads : {1, 4}) {
+    ThreadPool pool(threads);
+    OrderedQueue queue(&pool, 3);
+    std::vector<int> finished;
+    std::atomic<int> running(0);
+    std::atomic<int> max_running(0);
+    for (int i = 0; i < 100; ++i) {
+      ASSERT_EQ(0, queue.Submit(
+                       [&running, &max_running] {
+                         int now = ++running;
+                         int max = max_running;
+                         while (now > max &&
+                                !max_running.compare_exchange_weak(max, now)) {
+                         }
+                         --running;
+                         return 0;
+                       },
+                       [&finished, i] {
+                         finished.push_back(i);
+                         return 0;
+                       }));
+    }
+    ASSERT_EQ(0, queue.Flush());
+    ASSERT_EQ(100u, finished.size());
+    for (int i = 0; i < 100; ++i) {
+      ASSERT_EQ(i, finished[i]);
+    }
+    ASSERT_LE(max_running, 4);
+  }
+}
+
+TEST(ThreadPoolTest, TestOrderedQueueStopsOnFailure) {
+  ThreadPool pool(4);
+  std::vector<int> finished;
+  {
+    OrderedQueue queue(&pool, 8);
+    int result = 0;
+    for (int i = 0; i < 100 && result == 0; ++i) {
+      result = queue.Submit([i] { return i == 10 ? -1 : 0; },
+                            [&finished, i] {
+                              finished.push_back(i);
+                              return 0;
+                            });
+    }
+    ASSERT_EQ(-1, result == 0 ? queue.Flush() : result);
+    ASSERT_EQ(-1, queue.Submit([] { return 0; }, nullptr));
+  }
+  ASSERT_EQ(10u, finished.size());
+  ASSERT_EQ(9, finished.back());
+}
+
+}  // namespace blaze_util
@@ -0,0 +1,68 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>  // NOLINT
+
+#include "src/main/cpp/util/trace.h"
+#include "gtest/gtest.h"
+
+namespace blaze_util {
+
+static std::string ReadTrace(const std::string &path) {
+  std::ifstream file(path);
+  std::stringstream content;
+  content << file.rdbuf();
+  return content.str();
+}
+
+TEST(TraceTest, TestWritesEvents) {
+  const char *tmp_dir = getenv("TEST_TMPDIR");
+  ASSERT_STRNE(NULL, tmp_dir);
+  std::string path = std::string(tmp_dir) + "/trace.json";
+
+  ASSERT_FALSE(TracingEnabled());
+  { TRACE_SPAN("before"); }
+
+  StartTracing("trace_test", path.c_str());
+  ASSERT_TRUE(TracingEnabled());
+  {
+    TRACE_SPAN("outer");
+    TRACE_SPAN("in \"quotes\"");
+    TraceCounter("files", 7);
+    std::thread thread([] { TRACE_SPAN("other thread"); });
+    thread.join();
+  }
+  FinishTracing();
+  ASSERT_FALSE(TracingEnabled());
+  { TRACE_SPAN("after"); }
+
+  std::string trace = ReadTrace(path);
+  ASSERT_EQ(0u, trace.find("{\"traceEvents\":[\n"));
+  ASSERT_NE(std::string::npos,
+            trace.find("\"args\":{\"name\":\"trace_test\"}}"));
+  ASSERT_NE(std::string::npos, trace.find("{\"name\":\"outer\",\"ph\":\"X\""));
+  ASSERT_NE(std::string::npos, trace.find("{\"name\":\"in \\\"quotes\\\"\""));
+  ASSERT_NE(std::string::npos, trace.find("{\"name\":\"other thread\""));
+  ASSERT_NE(std::string::npos, trace.find("\"args\":{\"value\":7}}"));
+  ASSERT_EQ(std::string::npos, trace.find("before"));
+  ASSERT_EQ(std::string::npos, trace.find("after"));
+  ASSERT_EQ(trace.size() - 4, trace.rfind("\n]}\n"));
+}
+
+}  // namespace blaze_util
@@ -0,0 +1,74 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include <string>
+
+#include "src/main/cpp/util/port.h"
+#include "src/main/cpp/util/xxhash64.h"
+#include "gtest/gtest.h"
+
+namespace blaze_util {
+
+TEST(Xxhash64Test, TestVectors) {
+  const char *strs[] = {
+    "",
+    "a",
+    "abc",
+    "Nobody inspects the spammish repetition",
+  };
+  const char *hashes[] = {
+    "ef46db3751d8e999",
+    "d24ec4f1a98c6e5b",
+    "44bc2cf5ad770999",
+    "fbcea83c8a378bf1",
+  };
+  uint n = arraysize(strs);
+  ASSERT_EQ(n, arraysize(hashes));
+
+  unsigned char buf[Xxhash64Digest::kDigestLength];
+  Xxhash64Digest digest;
+  for (uint i = 0; i < n; i++) {
+    digest.Reset();
+    digest.Update(strs[i], strlen(strs[i]));
+    digest.Finish(buf);
+    ASSERT_EQ(hashes[i], digest.String());
+  }
+  ASSERT_EQ(0xfb, buf[0]);
+  ASSERT_EQ(0xf1, buf[7]);
+}
+
+TEST(Xxhash64Test, UpdateInPieces) {
+  std::string input;
+  for (int i = 0; i < 1000; i++) {
+    input += static_cast<char>(i * 7);
+  }
+  unsigned char buf[Xxhash64Digest::kDigestLength];
+  Xxhash64Digest whole;
+  whole.Update(input.data(), input.size());
+  whole.Finish(buf);
+
+  for (size_t piece = 1; piece < 70; piece += 3) {
+    Xxhash64Digest pieces;
+    for (size_t i = 0; i < input.size(); i += piece) {
+      size_t length = input.size() - i < piece ? input.size() - i : piece;
+      pieces.Update(input.data() + i, length);
+    }
+    pieces.Finish(buf);
+    ASSERT_EQ(whole.String(), pieces.String());
+  }
+}
+
+}  // namespace blaze_util
@@ -0,0 +1,57 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+package com.google.devtools.build.lib.profiler;
+
+import static com.google.common.truth.Truth.assertThat;
+
+import com.google.common.collect.ImmutableList;
+import com.google.devtools.build.lib.profiler.NativeTraces.Event;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for {@link NativeTraces}. */
+@RunWith(JUnit4.class)
+public class NativeTracesTest {
+
+  @Test
+  public void testParse() {
+    String trace =
+        "{\"traceEvents\":[\n"
+            + "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":42,\"tid\":42,"
+            + "\"args\":{\"name\":\"build-runfiles\"}},\n"
+            + "{\"name\":\"read \\\"manifest\\\"\",\"ph\":\"X\",\"ts\":1000,\"dur\":250,"
+            + "\"pid\":42,\"tid\":42},\n"
+            + "{\"name\":\"missing entries\",\"ph\":\"C\",\"ts\":1250,\"pid\":42,\"tid\":43,"
+            + "\"args\":{\"value\":7}}\n"
+            + "]}\n";
+    ImmutableList<Event> events = NativeTraces.parse(trace);
+    assertThat(events).hasSize(2);
+    assertThat(events.get(0).description).isEqualTo("build-runfiles: read \"manifest\"");
+    assertThat(events.get(0).startNanos).isEqualTo(1000000L);
+    assertThat(events.get(0).durationNanos).isEqualTo(250000L);
+    assertThat(events.get(1).description).isEqualTo("build-runfiles: missing entries = 7");
+    assertThat(events.get(1).startNanos).isEqualTo(1250000L);
+    assertThat(events.get(1).durationNanos).isEqualTo(0L);
+  }
+
+  @Test
+  public void testParseSkipsWhatItDoesNotKnow() {
+    assertThat(NativeTraces.parse("")).isEmpty();
+    assertThat(NativeTraces.parse("{\"traceEvents\":[\n{\"name\":\"x\",\"ph\":\"B\"}\n]}"))
+        .isEmpty();
+    assertThat(NativeTraces.parse("{\"name\":\"x\",\"ph\":\"X\",\"ts\":1,\"dur\":2,")
+        .get(0).description).isEqualTo("native tool: x");
+  }
+}
@@ -0,0 +1,57 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.devtools.build.lib.server;
+
+import static com.google.common.truth.Truth.assertThat;
+
+import com.google.devtools.build.lib.server.MemoryPressure.Level;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for {@link MemoryPressure}. */
+@RunWith(JUnit4.class)
+public class MemoryPressureTest {
+
+  private static String psi(String someAvg60, String fullAvg60) {
+    return "some avg10=0.00 avg60=" + someAvg60 + " avg300=0.00 total=1234\n"
+        + "full avg10=0.00 avg60=" + fullAvg60 + " avg300=0.00 total=567\n";
+  }
+
+  @Test
+  public void testStalls() {
+    assertThat(MemoryPressure.fromStalls(psi("0.00", "0.00"))).isEqualTo(Level.NONE);
+    assertThat(MemoryPressure.fromStalls(psi("9.99", "4.99"))).isEqualTo(Level.NONE);
+    assertThat(MemoryPressure.fromStalls(psi("10.00", "0.00"))).isEqualTo(Level.MODERATE);
+    assertThat(MemoryPressure.fromStalls(psi("10.00", "5.00"))).isEqualTo(Level.SEVERE);
+  }
+
+  @Test
+  public void testMalformedStalls() {
+    assertThat(MemoryPressure.fromStalls("")).isEqualTo(Level.NONE);
+    assertThat(MemoryPressure.fromStalls(psi("x", "y"))).isEqualTo(Level.NONE);
+    // Kernels that only report "some".
+    assertThat(MemoryPressure.fromStalls("some avg10=0.00 avg60=50.00 avg300=0.00 total=1\n"))
+        .isEqualTo(Level.MODERATE);
+  }
+
+  @Test
+  public void testAvailable() {
+    assertThat(MemoryPressure.fromAvailable(1000, 500)).isEqualTo(Level.NONE);
+    assertThat(MemoryPressure.fromAvailable(1000, 199)).isEqualTo(Level.MODERATE);
+    assertThat(MemoryPressure.fromAvailable(1000, 99)).isEqualTo(Level.SEVERE);
+    assertThat(MemoryPressure.fromAvailable(0, 0)).isEqualTo(Level.NONE);
+  }
+}
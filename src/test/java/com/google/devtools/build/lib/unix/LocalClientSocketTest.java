@@ -0,0 +1,108 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+package com.google.devtools.build.lib.unix;
+
+import static com.google.common.truth.Truth.assertThat;
+import static java.nio.charset.StandardCharsets.UTF_8;
+
+import java.io.File;
+import java.io.FileDescriptor;
+import java.io.FileOutputStream;
+import java.nio.ByteBuffer;
+import java.nio.file.Files;
+import java.nio.file.Paths;
+import org.junit.After;
+import org.junit.Before;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for the direct buffer operations of {@link LocalClientSocket}. */
+@RunWith(JUnit4.class)
+public class LocalClientSocketTest {
+
+  private File dir;
+  private LocalServerSocket server;
+  private LocalClientSocket client;
+  private LocalClientSocket accepted;
+
+  @Before
+  public void connect() throws Exception {
+    // Socket paths must be short, so stay out of the test's temporary directory.
+    dir = Files.createTempDirectory(Paths.get("/tmp"), "socket").toFile();
+    LocalSocketAddress address = new LocalSocketAddress(new File(dir, "socket"));
+    server = new LocalServerSocket(address);
+    client = new LocalClientSocket(address);
+    accepted = server.acceptLocal();
+  }
+
+  @After
+  public void close() throws Exception {
+    accepted.close();
+    client.close();
+    server.close();
+    new File(dir, "socket").delete();
+    dir.delete();
+  }
+
+  private static ByteBuffer direct(String s) {
+    ByteBuffer buffer = ByteBuffer.allocateDirect(s.length());
+    buffer.put(s.getBytes(UTF_8));
+    buffer.flip();
+    return buffer;
+  }
+
+  @Test
+  public void testGatheredWrite() throws Exception {
+    ByteBuffer hello = direct("hello");
+    ByteBuffer world = direct(" world");
+    world.position(1);
+    assertThat(client.write(hello, world)).isEqualTo(10L);
+    assertThat(hello.hasRemaining()).isFalse();
+    assertThat(world.hasRemaining()).isFalse();
+
+    ByteBuffer dst = ByteBuffer.allocateDirect(16);
+    int read = 0;
+    while (read < 10) {
+      read += accepted.read(dst);
+    }
+    dst.flip();
+    byte[] bytes = new byte[dst.remaining()];
+    dst.get(bytes);
+    assertThat(new String(bytes, UTF_8)).isEqualTo("helloworld");
+
+    client.shutdownOutput();
+    assertThat(accepted.read(ByteBuffer.allocateDirect(1))).isEqualTo(-1);
+  }
+
+  @Test
+  public void testPassesFileDescriptors() throws Exception {
+    File file = new File(dir, "output");
+    try (FileOutputStream out = new FileOutputStream(file)) {
+      assertThat(accepted.send(new ByteBuffer[] {direct("x")},
+          new FileDescriptor[] {out.getFD()})).isEqualTo(1L);
+    }
+    FileDescriptor[] fds = new FileDescriptor[2];
+    assertThat(client.receive(ByteBuffer.allocateDirect(1), fds)).isEqualTo(1);
+    assertThat(fds[0].valid()).isTrue();
+    assertThat(fds[1].valid()).isFalse();
+    // Closing the stream closes the received descriptor.
+    try (FileOutputStream out = new FileOutputStream(fds[0])) {
+      out.write("written by the peer".getBytes(UTF_8));
+    }
+    assertThat(new String(Files.readAllBytes(file.toPath()), UTF_8))
+        .isEqualTo("written by the peer");
+    file.delete();
+  }
+}
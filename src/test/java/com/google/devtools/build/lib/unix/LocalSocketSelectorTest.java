@@ -0,0 +1,63 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.devtools.build.lib.unix;
+
+import static com.google.common.truth.Truth.assertThat;
+
+import java.io.File;
+import java.net.Socket;
+import java.nio.file.Files;
+import java.nio.file.Paths;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for {@link LocalSocketSelector}. */
+@RunWith(JUnit4.class)
+public class LocalSocketSelectorTest {
+
+  @Test
+  public void testReportsReadySockets() throws Exception {
+    // Socket paths must be short, so stay out of the test's temporary directory.
+    File dir = Files.createTempDirectory(Paths.get("/tmp"), "selector").toFile();
+    LocalSocketAddress address = new LocalSocketAddress(new File(dir, "socket"));
+    try (LocalServerSocket server = new LocalServerSocket(address);
+        LocalSocketSelector selector = new LocalSocketSelector()) {
+      selector.add(server, 1);
+      int[] ready = new int[4];
+      assertThat(selector.select(ready, 10)).isEqualTo(0);
+
+      LocalClientSocket client = new LocalClientSocket(address);
+      assertThat(selector.select(ready, -1)).isEqualTo(1);
+      assertThat(ready[0]).isEqualTo(1);
+      Socket accepted = server.accept();
+
+      selector.add(client, 2);
+      accepted.getOutputStream().write('x');
+      accepted.getOutputStream().flush();
+      assertThat(selector.select(ready, -1)).isEqualTo(1);
+      assertThat(ready[0]).isEqualTo(2);
+      assertThat(client.getInputStream().read()).isEqualTo('x');
+
+      selector.remove(client);
+      accepted.close();
+      client.close();
+      assertThat(selector.select(ready, 10)).isEqualTo(0);
+    } finally {
+      new File(dir, "socket").delete();
+      dir.delete();
+    }
+  }
+}
@@ -22,10 +22,13 @@ import com.google.devtools.build.lib.testutil.TestUtils;
 import com.google.devtools.build.lib.vfs.FileSystem;
 import com.google.devtools.build.lib.vfs.FileSystemUtils;
 import com.google.devtools.build.lib.vfs.Path;
+import com.google.devtools.build.lib.vfs.PathFragment;
 import com.google.devtools.build.lib.vfs.UnixFileSystem;
 import java.io.File;
 import java.io.FileNotFoundException;
 import java.io.IOException;
+import java.util.HashMap;
+import java.util.Map;
 import org.junit.Before;
 import org.junit.Test;
 import org.junit.runner.RunWith;
@@ -75,6 +78,94 @@ public class NativePosixFilesTest {
     }
   }
 
+  @Test
+  public void digests() throws Exception {
+    FileSystemUtils.writeContentAsLatin1(testFile, "abc");
+    Path empty = workingDir.getRelative("empty");
+    FileSystemUtils.createEmptyFile(empty);
+    String[] paths = {testFile.getPathString(), empty.getPathString()};
+
+    byte[][] md5s = NativePosixFiles.digests(paths, NativePosixFiles.DigestFunction.MD5);
+    assertThat(HashCode.fromBytes(md5s[0]).toString())
+        .isEqualTo("900150983cd24fb0d6963f7d28e17f72");
+    assertThat(HashCode.fromBytes(md5s[1]).toString())
+        .isEqualTo("d41d8cd98f00b204e9800998ecf8427e");
+    byte[][] sha256s = NativePosixFiles.digests(paths, NativePosixFiles.DigestFunction.SHA256);
+    assertThat(HashCode.fromBytes(sha256s[0]).toString())
+        .isEqualTo("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    byte[][] sha1s = NativePosixFiles.digests(paths, NativePosixFiles.DigestFunction.SHA1);
+    assertThat(HashCode.fromBytes(sha1s[0]).toString())
+        .isEqualTo("a9993e364706816aba3e25717850c26c9cd0d89d");
+    byte[][] xxhashes =
+        NativePosixFiles.digests(paths, NativePosixFiles.DigestFunction.XXHASH64);
+    assertThat(HashCode.fromBytes(xxhashes[0]).toString()).isEqualTo("44bc2cf5ad770999");
+    assertThat(HashCode.fromBytes(xxhashes[1]).toString()).isEqualTo("ef46db3751d8e999");
+  }
+
+  @Test
+  public void digestsThrowsFileNotFoundException() throws Exception {
+    FileSystemUtils.writeContentAsLatin1(testFile, "abc");
+    String missing = workingDir.getRelative("missing").getPathString();
+    try {
+      NativePosixFiles.digests(new String[] {testFile.getPathString(), missing},
+          NativePosixFiles.DigestFunction.SHA256);
+      fail("Expected FileNotFoundException, but wasn't thrown.");
+    } catch (FileNotFoundException e) {
+      assertThat(e).hasMessage(missing + " (No such file or directory)");
+    }
+  }
+
+  @Test
+  public void digestTree() throws Exception {
+    Path tree = workingDir.getRelative("tree");
+    FileSystemUtils.createDirectoryAndParents(tree.getRelative("a/b"));
+    FileSystemUtils.writeContentAsLatin1(tree.getRelative("a/b/c"), "abc");
+    FileSystemUtils.writeContentAsLatin1(tree.getRelative("d"), "");
+    tree.getRelative("e").createSymbolicLink(new PathFragment("a/b/c"));
+
+    // The files have just been written, so they are digested again.
+    for (int i = 0; i < 2; i++) {
+      Map<String, byte[]> digests =
+          NativePosixFiles.digestTree(tree.getPathString(), NativePosixFiles.DigestFunction.SHA1);
+      assertThat(digests.keySet()).containsExactly("a/b/c", "d", "e").inOrder();
+      assertThat(HashCode.fromBytes(digests.get("a/b/c")).toString())
+          .isEqualTo("a9993e364706816aba3e25717850c26c9cd0d89d");
+      assertThat(HashCode.fromBytes(digests.get("d")).toString())
+          .isEqualTo("da39a3ee5e6b4b0d3255bfef95601890afd80709");
+      assertThat(digests.get("e")).isEqualTo(digests.get("a/b/c"));
+    }
+  }
+
+  @Test
+  public void digestTreeThrowsOnSymlinkToDirectory() throws Exception {
+    Path tree = workingDir.getRelative("tree");
+    FileSystemUtils.createDirectoryAndParents(tree.getRelative("a"));
+    tree.getRelative("b").createSymbolicLink(new PathFragment("a"));
+    try {
+      NativePosixFiles.digestTree(tree.getPathString(), NativePosixFiles.DigestFunction.SHA1);
+      fail("Expected IOException, but wasn't thrown.");
+    } catch (IOException e) {
+      assertThat(e).hasMessage(tree.getRelative("b").getPathString() + " (Is a directory)");
+    }
+  }
+
+  @Test
+  public void getxattrBatchFallsBackToDigest() throws Exception {
+    FileSystemUtils.writeContentAsLatin1(testFile, "abc");
+    String missing = workingDir.getRelative("missing").getPathString();
+    String[] paths = {testFile.getPathString(), missing};
+
+    byte[][] values = NativePosixFiles.getxattrBatch(paths, "user.nonexistent", 16, true, null);
+    assertThat(values[0]).isNull();
+    assertThat(values[1]).isNull();
+
+    values = NativePosixFiles.getxattrBatch(paths, "user.nonexistent", 16, true,
+        NativePosixFiles.DigestFunction.MD5);
+    assertThat(HashCode.fromBytes(values[0]).toString())
+        .isEqualTo("900150983cd24fb0d6963f7d28e17f72");
+    assertThat(values[1]).isNull();
+  }
+
   @Test
   public void throwsFileAccessException() throws Exception {
     FileSystemUtils.createEmptyFile(testFile);
@@ -98,6 +189,221 @@ public class NativePosixFilesTest {
     }
   }
 
+  @Test
+  public void readdirWithStat() throws Exception {
+    Path dir = workingDir.getRelative("dir");
+    dir.createDirectory();
+    FileSystemUtils.writeContentAsLatin1(dir.getRelative("file"), "hello");
+    dir.getRelative("subdir").createDirectory();
+    dir.getRelative("link").createSymbolicLink(new PathFragment("file"));
+    dir.getRelative("dangling").createSymbolicLink(new PathFragment("nowhere"));
+
+    for (boolean follow : new boolean[] {false, true}) {
+      NativePosixFiles.DirentsWithStat dirents =
+          NativePosixFiles.readdirWithStat(dir.getPathString(), follow);
+      assertThat(dirents.size()).isEqualTo(4);
+      Map<String, FileStatus> statuses = new HashMap<>();
+      for (int i = 0; i < dirents.size(); i++) {
+        statuses.put(dirents.getName(i), dirents.getStatus(i));
+      }
+      FileStatus file = NativePosixFiles.lstat(dir.getRelative("file").getPathString());
+      assertThat(statuses.get("file").getSize()).isEqualTo(5);
+      assertThat(statuses.get("file").getInodeNumber()).isEqualTo(file.getInodeNumber());
+      assertThat(statuses.get("file").getLastModifiedTime())
+          .isEqualTo(file.getLastModifiedTime());
+      assertThat(statuses.get("subdir").isDirectory()).isTrue();
+      if (follow) {
+        assertThat(statuses.get("link").getInodeNumber()).isEqualTo(file.getInodeNumber());
+        assertThat(statuses.get("dangling")).isNull();
+      } else {
+        assertThat(statuses.get("link").isSymbolicLink()).isTrue();
+        assertThat(statuses.get("dangling").isSymbolicLink()).isTrue();
+      }
+    }
+  }
+
+  @Test
+  public void readdirWithStatThrowsFileNotFoundException() throws Exception {
+    try {
+      NativePosixFiles.readdirWithStat(testFile.getPathString(), false);
+      fail("Expected FileNotFoundException, but wasn't thrown.");
+    } catch (FileNotFoundException e) {
+      assertThat(e).hasMessage(testFile + " (No such file or directory)");
+    }
+  }
+
+  @Test
+  public void statBatch() throws Exception {
+    FileSystemUtils.writeContentAsLatin1(testFile, "hello");
+    Path link = workingDir.getRelative("link");
+    link.createSymbolicLink(testFile);
+    String missing = workingDir.getRelative("missing").getPathString();
+    String[] paths = {testFile.getPathString(), link.getPathString(), missing};
+
+    NativePosixFiles.StatBatch batch = new NativePosixFiles.StatBatch();
+    batch.stat(paths, false);
+    assertThat(batch.size()).isEqualTo(3);
+    assertThat(batch.getStatus(0).getSize()).isEqualTo(5);
+    assertThat(batch.getStatus(1).isSymbolicLink()).isTrue();
+    assertThat(batch.getStatus(2)).isNull();
+    assertThat(batch.getErrno(2)).isEqualTo(ErrnoFileStatus.ENOENT);
+
+    batch.stat(paths, true);
+    assertThat(batch.getStatus(1).getInodeNumber())
+        .isEqualTo(NativePosixFiles.stat(testFile.getPathString()).getInodeNumber());
+
+    // Large enough to be spread over several threads.
+    String[] many = new String[5000];
+    for (int i = 0; i < many.length; i++) {
+      many[i] = paths[i % paths.length];
+    }
+    batch.stat(many, true);
+    for (int i = 0; i < many.length; i++) {
+      assertThat(batch.getErrno(i)).isEqualTo(i % 3 == 2 ? ErrnoFileStatus.ENOENT : 0);
+    }
+    batch.stat(new String[0], true);
+    assertThat(batch.size()).isEqualTo(0);
+  }
+
+  @Test
+  public void statBuffer() throws Exception {
+    FileSystemUtils.writeContentAsLatin1(testFile, "hello");
+    Path link = workingDir.getRelative("link");
+    link.createSymbolicLink(testFile);
+    FileStatus expected = NativePosixFiles.stat(testFile.getPathString());
+
+    NativePosixFiles.StatBuffer stat = new NativePosixFiles.StatBuffer();
+    assertThat(stat.stat(link.getPathString(), true)).isEqualTo(0);
+    assertThat(stat.getSize()).isEqualTo(5);
+    assertThat(stat.getMode()).isEqualTo(expected.getPermissions() | FileStatus.S_IFREG);
+    assertThat(stat.getInodeNumber()).isEqualTo(expected.getInodeNumber());
+    assertThat(stat.getLastModifiedTime()).isEqualTo(expected.getLastModifiedTime());
+    assertThat(stat.getStatus().getDeviceNumber()).isEqualTo(expected.getDeviceNumber());
+
+    assertThat(stat.stat(link.getPathString(), false)).isEqualTo(0);
+    assertThat(FileStatus.isSymbolicLink(stat.getMode())).isTrue();
+
+    // Restricting the fields (statx on Linux) still returns the ones asked for.
+    assertThat(stat.stat(link.getPathString(), true, NativePosixFiles.StatBuffer.TYPE))
+        .isEqualTo(0);
+    assertThat(stat.getMode()).isEqualTo(expected.getPermissions() | FileStatus.S_IFREG);
+    assertThat(stat.getDeviceNumber()).isEqualTo(expected.getDeviceNumber());
+    int fields = NativePosixFiles.StatBuffer.MODIFIED_TIME
+        | NativePosixFiles.StatBuffer.CHANGE_TIME
+        | NativePosixFiles.StatBuffer.DONT_SYNC;
+    assertThat(stat.stat(testFile.getPathString(), false, fields)).isEqualTo(0);
+    assertThat(stat.getFractionalLastModifiedTime())
+        .isEqualTo(expected.getFractionalLastModifiedTime());
+    assertThat(stat.getLastChangeTime()).isEqualTo(expected.getLastChangeTime());
+
+    String missing = workingDir.getRelative("missing").getPathString();
+    assertThat(stat.stat(missing, true)).isEqualTo(ErrnoFileStatus.ENOENT);
+    assertThat(stat.getErrno()).isEqualTo(ErrnoFileStatus.ENOENT);
+    assertThat(stat.getMode()).isEqualTo(0);
+    assertThat(stat.getStatus()).isNull();
+  }
+
+  @Test
+  public void createTree() throws Exception {
+    Path root = workingDir.getRelative("tree");
+    FileSystemUtils.createDirectoryAndParents(root);
+    FileSystemUtils.writeContentAsLatin1(root.getRelative("stale"), "x");
+
+    NativePosixFiles.TreeManifest manifest = new NativePosixFiles.TreeManifest();
+    // Children before their parents, and enough entries to need a larger buffer and threads.
+    for (int i = 0; i < 1000; i++) {
+      manifest.addSymlink("a/b/link" + i, "/target" + i);
+    }
+    manifest.addDirectory("a/b").addDirectory("a").addUnlink("stale").addUnlink("missing");
+    NativePosixFiles.createTree(root.getPathString(), manifest);
+
+    assertThat(root.getRelative("stale").exists()).isFalse();
+    assertThat(root.getRelative("a/b").isDirectory()).isTrue();
+    assertThat(root.getRelative("a/b/link999").readSymbolicLink())
+        .isEqualTo(new PathFragment("/target999"));
+    assertThat(root.getRelative("a/b").getDirectoryEntries()).hasSize(1000);
+
+    manifest.clear();
+    manifest.addDirectory("a").addSymlink("a/b/link5", "/other");
+    try {
+      NativePosixFiles.createTree(root.getPathString(), manifest);
+      fail("Expected IOException, but wasn't thrown.");
+    } catch (IOException e) {
+      assertThat(e).hasMessage(root + "/a/b/link5 (File exists)");
+    }
+  }
+
+  @Test
+  public void cloneOrCopy() throws Exception {
+    FileSystemUtils.writeContentAsLatin1(testFile, "hello");
+    testFile.chmod(0751);
+    Path copy = workingDir.getRelative("copy");
+    FileSystemUtils.writeContentAsLatin1(copy, "old contents");
+
+    NativePosixFiles.cloneOrCopy(testFile.getPathString(), copy.getPathString());
+    assertThat(new String(FileSystemUtils.readContentAsLatin1(copy))).isEqualTo("hello");
+    assertThat(NativePosixFiles.stat(copy.getPathString()).getPermissions()).isEqualTo(0751);
+
+    String[] srcs = new String[20];
+    String[] dsts = new String[20];
+    for (int i = 0; i < srcs.length; i++) {
+      srcs[i] = i == 7 ? workingDir.getRelative("missing").getPathString()
+          : testFile.getPathString();
+      dsts[i] = workingDir.getRelative("copy" + i).getPathString();
+    }
+    try {
+      NativePosixFiles.cloneOrCopyBatch(srcs, dsts);
+      fail("Expected FileNotFoundException, but wasn't thrown.");
+    } catch (FileNotFoundException e) {
+      assertThat(e).hasMessage(srcs[7] + " -> " + dsts[7] + " (No such file or directory)");
+    }
+    assertThat(workingDir.getRelative("copy7").exists()).isFalse();
+    assertThat(new String(FileSystemUtils.readContentAsLatin1(workingDir.getRelative("copy19"))))
+        .isEqualTo("hello");
+  }
+
+  @Test
+  public void chmodAndUtimeBatch() throws Exception {
+    FileSystemUtils.writeContentAsLatin1(testFile, "hello");
+    Path dir = workingDir.getRelative("dir");
+    dir.createDirectory();
+    dir.chmod(0755);
+    Path link = workingDir.getRelative("link");
+    link.createSymbolicLink(testFile);
+    String[] paths = {
+      testFile.getPathString(),
+      dir.getPathString(),
+      link.getPathString(),
+      workingDir.getRelative("missing").getPathString(),
+      null
+    };
+
+    int[] errors = NativePosixFiles.chmodBatch(paths, 0555, true);
+    assertThat(errors).hasLength(5);
+    assertThat(errors[0]).isEqualTo(0);
+    assertThat(errors[1]).isEqualTo(0);
+    assertThat(errors[2]).isEqualTo(0);
+    assertThat(errors[3]).isEqualTo(ErrnoFileStatus.ENOENT);
+    assertThat(errors[4]).isNotEqualTo(0);
+    assertThat(NativePosixFiles.stat(testFile.getPathString()).getPermissions()).isEqualTo(0555);
+    assertThat(NativePosixFiles.stat(dir.getPathString()).getPermissions()).isEqualTo(0755);
+
+    errors = NativePosixFiles.chmodBatch(paths, 0700, false);
+    assertThat(errors[1]).isEqualTo(0);
+    assertThat(NativePosixFiles.stat(dir.getPathString()).getPermissions()).isEqualTo(0700);
+
+    errors = NativePosixFiles.utimeBatch(paths, false, 1000);
+    assertThat(errors).hasLength(5);
+    assertThat(errors[0]).isEqualTo(0);
+    assertThat(errors[1]).isEqualTo(0);
+    assertThat(errors[2]).isEqualTo(0);
+    assertThat(errors[3]).isEqualTo(ErrnoFileStatus.ENOENT);
+    assertThat(errors[4]).isNotEqualTo(0);
+    assertThat(NativePosixFiles.stat(testFile.getPathString()).getLastModifiedTime())
+        .isEqualTo(1000);
+    assertThat(NativePosixFiles.stat(dir.getPathString()).getLastModifiedTime()).isEqualTo(1000);
+  }
+
   @Test
   public void throwsFilePermissionException() throws Exception {
     File foo = new File("/bin");
@@ -0,0 +1,45 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+package com.google.devtools.build.lib.unix;
+
+import static com.google.common.truth.Truth.assertThat;
+
+import com.google.common.collect.Range;
+import com.google.devtools.build.lib.util.OS;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for {@link NativePosixSystem}. */
+@RunWith(JUnit4.class)
+public class NativePosixSystemTest {
+
+  @Test
+  public void loadSampler() throws Exception {
+    if (OS.getCurrent() != OS.LINUX && OS.getCurrent() != OS.DARWIN) {
+      return;  // There is no sampler for other platforms.
+    }
+    NativePosixSystem.Load load;
+    try (NativePosixSystem.LoadSampler sampler = new NativePosixSystem.LoadSampler(10)) {
+      do {
+        Thread.sleep(10);
+        load = sampler.get();
+      } while (load.getSamples() < 2);
+    }
+    assertThat(load.getCpuBusy()).isIn(Range.closed(0L, 10000L));
+    assertThat(load.getMemoryTotalBytes()).isGreaterThan(0L);
+    assertThat(load.getMemoryAvailableBytes()).isAtMost(load.getMemoryTotalBytes());
+    assertThat(load.getSwapFreeBytes()).isAtMost(load.getSwapTotalBytes());
+  }
+}
@@ -159,4 +159,54 @@ public class WindowsFileOperationsTest {
                 linkPath.toPath(), WindowsFileSystem.symlinkOpts(/* followSymlinks */ true)))
         .isFalse();
   }
+
+  @Test
+  public void testReadDirectory() throws Exception {
+    testUtil.scratchFile("dir/file.txt", "hello");
+    testUtil.scratchDir("dir/sub");
+    testUtil.scratchFile("target/hello.txt", "hello");
+    String root = testUtil.scratchDir("dir").getParent().toAbsolutePath().toString();
+    testUtil.createJunctions(ImmutableMap.of("dir/junc", "target"));
+
+    WindowsFileOperations.DirectoryEntries entries =
+        WindowsFileOperations.readDirectory(root + "/dir");
+    Map<String, Integer> indices = new HashMap<>();
+    for (int i = 0; i < entries.size(); i++) {
+      indices.put(entries.getName(i), i);
+    }
+    assertThat(indices.keySet()).containsExactly("file.txt", "sub", "junc");
+
+    int file = indices.get("file.txt");
+    assertThat(entries.isDirectory(file)).isFalse();
+    assertThat(entries.isReparsePoint(file)).isFalse();
+    assertThat(entries.getSize(file)).isEqualTo(5);
+    assertThat(entries.getLastWriteTimeMillis(file))
+        .isEqualTo(new File(root + "/dir/file.txt").lastModified());
+    assertThat(entries.isDirectory(indices.get("sub"))).isTrue();
+    assertThat(entries.isReparsePoint(indices.get("sub"))).isFalse();
+    assertThat(entries.isReparsePoint(indices.get("junc"))).isTrue();
+    assertThat(entries.isJunction(indices.get("junc"))).isTrue();
+    assertThat(entries.isJunction(indices.get("sub"))).isFalse();
+    assertThat(entries.isSymlink(indices.get("junc"))).isFalse();
+    // The targets are only read when asked for.
+    assertThat(entries.getReparseTarget(indices.get("junc"))).isNull();
+
+    entries = WindowsFileOperations.readDirectory(root + "/dir", true);
+    for (int i = 0; i < entries.size(); i++) {
+      if (entries.getName(i).equals("junc")) {
+        assertThat(entries.isJunction(i)).isTrue();
+        assertThat(entries.getReparseTarget(i).replace('\\', '/')).endsWith("/target");
+      } else {
+        assertThat(entries.getReparseTarget(i)).isNull();
+      }
+    }
+
+    assertThat(WindowsFileOperations.readDirectory(root + "/dir/sub").size()).isEqualTo(0);
+    try {
+      WindowsFileOperations.readDirectory(root + "/non-existent");
+      fail("expected to throw");
+    } catch (IOException e) {
+      assertThat(e.getMessage()).contains("FindFirstFileExW");
+    }
+  }
 }
@@ -33,6 +33,9 @@ import java.nio.file.Path;
 import java.nio.file.Paths;
 import java.util.ArrayList;
 import java.util.List;
+import java.util.concurrent.BlockingQueue;
+import java.util.concurrent.LinkedBlockingQueue;
+import java.util.concurrent.TimeUnit;
 
 /**
  * Unit tests for {@link WindowsProcesses}.
@@ -138,6 +141,46 @@ public class WindowsProcessesTest {
     assertNoProcessError();
   }
 
+  @Test
+  public void testNotifyOnExit() throws Exception {
+    process = WindowsProcesses.nativeCreateProcess(mockArgs("X42"), null, null, null, null);
+    final BlockingQueue<Integer> results = new LinkedBlockingQueue<>();
+    assertThat(
+            WindowsProcesses.nativeNotifyOnExit(
+                process,
+                -1,
+                new WindowsProcesses.ExitCallback() {
+                  @Override
+                  public void processExited(int waitResult) {
+                    results.add(waitResult);
+                  }
+                }))
+        .isTrue();
+    assertNoProcessError();
+    assertThat(results.poll(60, TimeUnit.SECONDS)).isEqualTo(0);
+    assertThat(WindowsProcesses.nativeGetExitCode(process)).isEqualTo(42);
+  }
+
+  @Test
+  public void testNotifyOnExitTimesOut() throws Exception {
+    process = WindowsProcesses.nativeCreateProcess(mockArgs("W30"), null, null, null, null);
+    final BlockingQueue<Integer> results = new LinkedBlockingQueue<>();
+    assertThat(
+            WindowsProcesses.nativeNotifyOnExit(
+                process,
+                100,
+                new WindowsProcesses.ExitCallback() {
+                  @Override
+                  public void processExited(int waitResult) {
+                    results.add(waitResult);
+                  }
+                }))
+        .isTrue();
+    assertThat(results.poll(60, TimeUnit.SECONDS)).isEqualTo(1);
+    // The process was terminated.
+    assertThat(WindowsProcesses.nativeWaitFor(process, 10000)).isEqualTo(0);
+  }
+
   @Test
   public void testPartialRead() throws Exception {
     process = WindowsProcesses.nativeCreateProcess(mockArgs("O-HELLO"), null, null, null, null);
@@ -374,6 +417,28 @@ public class WindowsProcessesTest {
     assertThat(new String(buf, 0, len, UTF8).replace("\\", "/")).isEqualTo(dir1);
   }
 
+  @Test
+  public void testResourceUsage() throws Exception {
+    process = WindowsProcesses.nativeCreateProcess(mockArgs("O-HELLO"), null, null, null, null);
+    byte[] buf = new byte[5];
+    assertThat(readStdout(buf, 0, 5)).isEqualTo(5);
+    assertThat(WindowsProcesses.nativeWaitFor(process, -1)).isEqualTo(0);
+    long[] usage = new long[WindowsProcesses.USAGE_COUNT];
+    assertThat(WindowsProcesses.nativeGetResourceUsage(process, usage)).isTrue();
+    assertNoProcessError();
+    assertThat(usage[WindowsProcesses.USAGE_TOTAL_PROCESSES]).isAtLeast(1L);
+    assertThat(usage[WindowsProcesses.USAGE_PEAK_MEMORY_BYTES]).isGreaterThan(0L);
+    assertThat(usage[WindowsProcesses.USAGE_READ_BYTES]).isGreaterThan(0L);
+  }
+
+  @Test
+  public void testMemoryLimit() throws Exception {
+    process = WindowsProcesses.nativeCreateProcess(mockArgs("W5", "X0"), null, null, null, null);
+    assertThat(WindowsProcesses.nativeSetResourceLimits(process, 0, 1L << 30)).isTrue();
+    assertNoProcessError();
+    assertThat(WindowsProcesses.nativeTerminate(process)).isTrue();
+  }
+
   @Test
   public void testTimeout() throws Exception {
     process = WindowsProcesses.nativeCreateProcess(mockArgs("W5", "X0"), null, null, null, null);
@@ -0,0 +1,85 @@
+#!/bin/bash
+#
+# Copyright 2016 The Bazel Authors. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Tests the runfiles tree builder in the modes that materialize the targets
+#
+
+# Load test environment
+
+source $(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)/testenv.sh \
+  || { echo "testenv.sh not found!" >&2; exit 1; }
+
+readonly WORK_DIR="${TEST_TMPDIR}/runfiles"
+readonly TREE="${WORK_DIR}/tree"
+
+function set_up() {
+  rm -rf $WORK_DIR
+  mkdir -p $WORK_DIR/targets
+  # Two targets with the same size, permissions and modification time.
+  echo 5 > $WORK_DIR/targets/five
+  echo 6 > $WORK_DIR/targets/six
+  touch -r $WORK_DIR/targets/five $WORK_DIR/targets/six
+  echo "a/b/f5 $WORK_DIR/targets/five" > $WORK_DIR/manifest1
+  echo "a/b/f5 $WORK_DIR/targets/six" > $WORK_DIR/manifest2
+}
+
+function test_copy() {
+  $build_runfiles --mode=copy $WORK_DIR/manifest1 $TREE &> $TEST_log ||
+    fail "build-runfiles failed"
+  [ -L $TREE/a/b/f5 ] && fail "a/b/f5 is a symlink"
+  assert_equals 5 "$(cat $TREE/a/b/f5)"
+  assert_equals copy "$(cat $TREE/MANIFEST.mode)"
+}
+
+function test_copy_incremental_changed_target() {
+  $build_runfiles --mode=copy $WORK_DIR/manifest1 $TREE &> $TEST_log ||
+    fail "build-runfiles failed"
+  $build_runfiles --mode=copy $WORK_DIR/manifest2 $TREE &> $TEST_log ||
+    fail "build-runfiles failed"
+  assert_equals 6 "$(cat $TREE/a/b/f5)"
+}
+
+# Without the previous manifest, a copy which looks like its new target is
+# not taken for one.
+function test_copy_full_scan_changed_target() {
+  $build_runfiles --mode=copy $WORK_DIR/manifest1 $TREE &> $TEST_log ||
+    fail "build-runfiles failed"
+  rm $TREE/MANIFEST
+  $build_runfiles --mode=copy $WORK_DIR/manifest2 $TREE &> $TEST_log ||
+    fail "build-runfiles failed"
+  assert_equals 6 "$(cat $TREE/a/b/f5)"
+}
+
+function test_copy_then_hardlink_changed_target() {
+  $build_runfiles --mode=copy $WORK_DIR/manifest1 $TREE &> $TEST_log ||
+    fail "build-runfiles failed"
+  $build_runfiles --mode=hardlink $WORK_DIR/manifest2 $TREE &> $TEST_log ||
+    fail "build-runfiles failed"
+  assert_equals 6 "$(cat $TREE/a/b/f5)"
+  assert_equals hardlink "$(cat $TREE/MANIFEST.mode)"
+}
+
+function test_hardlink_full_scan_keeps_links() {
+  $build_runfiles --mode=hardlink $WORK_DIR/manifest1 $TREE &> $TEST_log ||
+    fail "build-runfiles failed"
+  rm $TREE/MANIFEST
+  $build_runfiles --mode=hardlink $WORK_DIR/manifest1 $TREE &> $TEST_log ||
+    fail "build-runfiles failed"
+  [ $TREE/a/b/f5 -ef $WORK_DIR/targets/five ] ||
+    fail "a/b/f5 is not a hardlink of its target"
+}
+
+run_suite "build-runfiles"
@@ -46,6 +46,23 @@ function test_default_user_is_nobody() {
   expect_log "uid=65534(nobody) gid=65534(nogroup) groups=65534(nogroup)"
 }
 
+function test_check_prints_nobody_ids() {
+  $linux_sandbox -C > $TEST_log || fail
+  expect_log "^65534:65534$"
+}
+
+function test_user_ids_passed_through() {
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -u 65534:65534 -- /usr/bin/id \
+    &> $TEST_log || fail
+  expect_log "uid=65534(nobody) gid=65534(nogroup) groups=65534(nogroup)"
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -u 1:1 -- /usr/bin/id &> $TEST_log \
+    || fail
+  expect_log "uid=1(daemon) gid=1(daemon)"
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -u nobody -- /bin/true &> $TEST_log \
+    && fail "-u accepted a user name"
+  expect_log "The -u option must be of the form <uid>:<gid>"
+}
+
 function test_user_switched_to_root() {
   $linux_sandbox $SANDBOX_DEFAULT_OPTS -R -- /usr/bin/id &> $TEST_log || fail
   expect_log "uid=0(root) gid=0(root)"
@@ -62,6 +79,54 @@ function test_ping_loopback() {
   expect_log "1 received"
 }
 
+function test_isolation_profiles() {
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -- /bin/sh -c 'echo $$; hostname' \
+    &> $TEST_log || fail
+  expect_log "^2$"
+  expect_log "^sandbox$"
+
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -I fs+pid -- \
+    /bin/sh -c 'echo $$; hostname' &> $TEST_log || fail
+  expect_log "^2$"
+  expect_not_log "^sandbox$"
+
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -I fs-only -S ${OUT_DIR}/stats -- \
+    /bin/sh -c 'echo $$; touch '"${OUT_DIR}/x" &> $TEST_log && fail
+  expect_not_log "^2$"
+  expect_log "Read-only file system"
+  cp ${OUT_DIR}/stats $TEST_log
+  expect_log "^setup_mount_proc_us 0$"
+
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -I none -- /bin/true &> $TEST_log \
+    && fail "-I accepted an unknown profile"
+  expect_log "Invalid isolation profile (-I) value: none"
+}
+
+function test_isolation_fs_only_kills_left_over_processes() {
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -I fs-only -- \
+    /bin/sh -c '(sleep 1000 & echo $! > pid)' &> $TEST_log \
+    || fail
+  sleep 1
+  kill -0 $(cat ${SANDBOX_DIR}/pid) 2> /dev/null && fail "sleep is still running"
+  true
+}
+
+function test_join_network_namespace() {
+  unshare -Urn sleep 1000 &
+  local holder_pid=$!
+  # Wait for unshare to exec the sleep in the new namespace.
+  while [ "$(readlink /proc/$holder_pid/ns/net)" == \
+          "$(readlink /proc/self/ns/net)" ]; do
+    sleep 0.1
+  done
+  local netns=$(readlink /proc/$holder_pid/ns/net)
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -n /proc/$holder_pid/ns/net -- \
+    /bin/readlink /proc/self/ns/net &> $TEST_log || code=$?
+  kill $holder_pid
+  assert_equals "" "${code:-}"
+  assert_equals "$netns" "$(cat $TEST_log)"
+}
+
 function test_exit_code() {
   $linux_sandbox $SANDBOX_DEFAULT_OPTS -- /bin/bash -c "exit 71" &> $TEST_log || code=$?
   assert_equals 71 "$code"
@@ -112,6 +177,35 @@ function test_redirect_output() {
   assert_equals "err" "$(cat $ERR)"
 }
 
+function test_stats() {
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -S ${OUT_DIR}/stats -- \
+    /bin/bash -c "sleep 1; exit 3" &> $TEST_log || code=$?
+  assert_equals 3 "$code"
+  cp ${OUT_DIR}/stats $TEST_log
+  expect_log "^wall_time_ms [0-9][0-9][0-9][0-9]*$"
+  expect_log "^system_time_ms [0-9]*$"
+  expect_log "^max_rss_kb [1-9][0-9]*$"
+  expect_log "^setup_mount_filesystems_us [1-9][0-9]*$"
+  expect_log "^command_us [1-9][0-9][0-9][0-9][0-9][0-9][0-9]*$"
+}
+
+function test_input_manifest() {
+  mkdir -p ${OUT_DIR}/src/dir ${OUT_DIR}/overlay-work
+  echo "file contents" > ${OUT_DIR}/src/file
+  echo "dir contents" > ${OUT_DIR}/src/dir/file
+  cat > ${OUT_DIR}/inputs.manifest <<EOF
+pkg/file ${OUT_DIR}/src/file
+pkg/dir ${OUT_DIR}/src/dir
+EOF
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -w $SANDBOX_DIR \
+    -M ${OUT_DIR}/inputs.manifest -O ${OUT_DIR}/overlay-work -- \
+    /bin/bash -c "cat pkg/file pkg/dir/file; echo out > pkg/out" \
+    &> $TEST_log || fail
+  expect_log "file contents"
+  expect_log "dir contents"
+  assert_equals "out" "$(cat $SANDBOX_DIR/pkg/out)"
+}
+
 # The test shouldn't fail if the environment doesn't support running it.
 check_supported_platform || exit 0
 check_sandbox_allowed || exit 0
@@ -108,4 +108,53 @@ function test_execvp_error_message() {
   assert_contains "execvp(\"/bin/notexisting\", ...): No such file or directory" "$ERR"
 }
 
+function test_stats() {
+  local code=0
+  $process_wrapper --stats=${OUT_DIR}/stats -1 0 $OUT $ERR /bin/bash -c \
+    "sleep 1; exit 3" &> $TEST_log || code=$?
+  assert_equals 3 "$code"
+  cp ${OUT_DIR}/stats $TEST_log
+  expect_log "^wall_time_ms [0-9][0-9][0-9][0-9]*$"
+  expect_log "^user_time_ms [0-9]*$"
+  expect_log "^max_rss_kb [1-9][0-9]*$"
+}
+
+function test_output_limit() {
+  local code=0
+  $process_wrapper --output_limit=20 -1 0 $OUT $ERR /bin/bash -c \
+    "seq 1 100; echo oops >&2; exit 3" &> $TEST_log || code=$?
+  assert_equals 3 "$code"
+  cp $OUT $TEST_log
+  expect_log "^5$"
+  expect_not_log "^50$"
+  expect_log "272 bytes of output left out"
+  expect_log "^100$"
+  assert_equals "oops" "$(cat $ERR)"
+}
+
+# Writes a request for process-wrapper --batch with the given fields.
+function batch_request() {
+  local payload="${OUT_DIR}/payload"
+  printf '%s\0' "$@" > "$payload"
+  local length=$(wc -c < "$payload")
+  for shift in 24 16 8 0; do
+    printf "\\$(printf '%03o' $(( (length >> shift) & 255 )))"
+  done
+  cat "$payload"
+}
+
+function test_batch() {
+  if [ "${PLATFORM}" != "linux" ]; then
+    return 0 # --batch is only supported on Linux.
+  fi
+  (batch_request a -1 0 "" $OUT $ERR 2 echo hi PATH=/bin:/usr/bin
+   batch_request b -1 0 "" - - 3 /bin/bash -c "exit 71"
+   batch_request c 1 2 "" - - 2 /bin/sleep 10) \
+    | $process_wrapper --batch > $TEST_log || fail
+  expect_log "^a exit 0$"
+  expect_log "^b exit 71$"
+  expect_log "^c signal 14$" # SIGALRM
+  assert_stdout "hi"
+}
+
 run_suite "process-wrapper"
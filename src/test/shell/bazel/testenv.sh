@@ -78,6 +78,9 @@ ijar_path="${BAZEL_RUNFILES}/third_party/ijar/ijar"
 process_wrapper="${BAZEL_RUNFILES}/src/main/tools/process-wrapper"
 linux_sandbox="${BAZEL_RUNFILES}/src/main/tools/linux-sandbox"
 
+# Runfiles tree builder
+build_runfiles="${BAZEL_RUNFILES}/src/main/tools/build-runfiles"
+
 # iOS and Objective-C tooling
 iossim_path="${BAZEL_RUNFILES}/third_party/iossim/iossim"
 actoolwrapper_path="${BAZEL_RUNFILES}/src/tools/xcode/actoolwrapper/actoolwrapper.sh"
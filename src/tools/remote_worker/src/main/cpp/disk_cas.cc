@@ -0,0 +1,418 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/tools/remote_worker/src/main/cpp/disk_cas.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include <vector>
+
+namespace {
+
+const size_t kBufferSize = 64 * 1024;
+
+// Writes all of 'size' bytes at 'data' to 'fd'.
+bool WriteFully(int fd, const void *data, size_t size) {
+  const char *p = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Feeds 'size' bytes at 'data' to 'sha1', which takes at most 4GB at a time.
+void UpdateDigest(blaze_util::Sha1Digest *sha1, const void *data,
+                  size_t size) {
+  const char *p = static_cast<const char *>(data);
+  while (size > 0) {
+    unsigned int n = size > (1u << 30) ? (1u << 30) : size;
+    sha1->Update(p, n);
+    p += n;
+    size -= n;
+  }
+}
+
+std::string FinishDigest(blaze_util::Sha1Digest *sha1) {
+  unsigned char digest[blaze_util::Sha1Digest::kDigestLength];
+  sha1->Finish(digest);
+  return std::string(reinterpret_cast<char *>(digest), sizeof(digest));
+}
+
+// Copies the file 'from' to the new file 'to', created with the given mode:
+// as a clone sharing the blocks of 'from' where the filesystem can do that,
+// otherwise by reading and writing it.
+bool CloneOrCopy(const std::string &from, const std::string &to, mode_t mode,
+                 bool exclusive) {
+  int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    return false;
+  }
+  int out = open(to.c_str(),
+                 O_WRONLY | O_CREAT | O_CLOEXEC | (exclusive ? O_EXCL : O_TRUNC),
+                 mode);
+  if (out < 0) {
+    close(in);
+    return false;
+  }
+  bool ok = false;
+#ifdef FICLONE
+  ok = ioctl(out, FICLONE, in) == 0;
+#endif
+  if (!ok) {
+    ok = true;
+    char buffer[kBufferSize];
+    for (;;) {
+      ssize_t n = read(in, buffer, sizeof(buffer));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      } else if (n < 0) {
+        ok = false;
+        break;
+      } else if (n == 0) {
+        break;
+      } else if (!WriteFully(out, buffer, n)) {
+        ok = false;
+        break;
+      }
+    }
+  }
+  close(in);
+  if (close(out) < 0) {
+    ok = false;
+  }
+  if (!ok) {
+    unlink(to.c_str());
+  }
+  return ok;
+}
+
+bool ReadFile(const std::string &path, std::string *data) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  data->clear();
+  char buffer[kBufferSize];
+  bool ok = true;
+  for (;;) {
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      ok = false;
+      break;
+    } else if (n == 0) {
+      break;
+    }
+    data->append(buffer, n);
+  }
+  close(fd);
+  return ok;
+}
+
+bool MakeDirectory(const std::string &path, std::string *error) {
+  if (mkdir(path.c_str(), 0755) < 0 && errno != EEXIST) {
+    *error = "cannot create " + path + ": " + strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+DiskCas::DiskCas(const std::string &root) : root_(root) {}
+
+bool DiskCas::Init(std::string *error) {
+  if (!MakeDirectory(root_, error) || !MakeDirectory(root_ + "/tmp", error) ||
+      !MakeDirectory(root_ + "/cas", error) ||
+      !MakeDirectory(root_ + "/ac", error)) {
+    return false;
+  }
+  static const char kHexDigits[] = "0123456789abcdef";
+  for (int i = 0; i < 256; ++i) {
+    std::string fanout;
+    fanout += kHexDigits[i >> 4];
+    fanout += kHexDigits[i & 0xf];
+    if (!MakeDirectory(root_ + "/cas/" + fanout, error) ||
+        !MakeDirectory(root_ + "/ac/" + fanout, error)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string DiskCas::Digest(const void *data, size_t size) {
+  blaze_util::Sha1Digest sha1;
+  UpdateDigest(&sha1, data, size);
+  return FinishDigest(&sha1);
+}
+
+std::string DiskCas::Hex(const std::string &digest) {
+  static const char kHexDigits[] = "0123456789abcdef";
+  std::string hex;
+  hex.reserve(2 * digest.size());
+  for (unsigned char c : digest) {
+    hex += kHexDigits[c >> 4];
+    hex += kHexDigits[c & 0xf];
+  }
+  return hex;
+}
+
+std::string DiskCas::BlobPath(const std::string &digest) const {
+  std::string hex = Hex(digest);
+  return root_ + "/cas/" + hex.substr(0, 2) + "/" + hex;
+}
+
+std::string DiskCas::ActionPath(const std::string &action_digest) const {
+  std::string hex = Hex(action_digest);
+  return root_ + "/ac/" + hex.substr(0, 2) + "/" + hex;
+}
+
+bool DiskCas::Contains(const std::string &digest, int64_t size) const {
+  if (digest.size() != blaze_util::Sha1Digest::kDigestLength) {
+    return false;
+  }
+  struct stat st;
+  return stat(BlobPath(digest).c_str(), &st) == 0 &&
+         (size < 0 || st.st_size == size);
+}
+
+int DiskCas::CreateTemp(std::string *path, mode_t mode) const {
+  *path = root_ + "/tmp/blob.XXXXXX";
+  std::vector<char> buffer(path->begin(), path->end());
+  buffer.push_back('\0');
+  int fd = mkostemp(buffer.data(), O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  path->assign(buffer.data());
+  if (fchmod(fd, mode) < 0) {
+    close(fd);
+    unlink(path->c_str());
+    return -1;
+  }
+  return fd;
+}
+
+bool DiskCas::Install(const std::string &temp_path,
+                      const std::string &path) const {
+  if (rename(temp_path.c_str(), path.c_str()) < 0) {
+    unlink(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool DiskCas::WriteBlob(const std::string &path, const std::string &data) {
+  std::string temp_path;
+  int fd = CreateTemp(&temp_path, 0444);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = WriteFully(fd, data.data(), data.size());
+  if (close(fd) < 0 || !ok) {
+    unlink(temp_path.c_str());
+    return false;
+  }
+  return Install(temp_path, path);
+}
+
+std::string DiskCas::Put(const std::string &data) {
+  std::string digest = Digest(data.data(), data.size());
+  if (Contains(digest, data.size())) {
+    return digest;
+  }
+  return WriteBlob(BlobPath(digest), data) ? digest : std::string();
+}
+
+bool DiskCas::PutFile(const std::string &path, std::string *digest,
+                      int64_t *size) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  blaze_util::Sha1Digest sha1;
+  char buffer[kBufferSize];
+  *size = 0;
+  for (;;) {
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      close(fd);
+      return false;
+    } else if (n == 0) {
+      break;
+    }
+    sha1.Update(buffer, n);
+    *size += n;
+  }
+  close(fd);
+  *digest = FinishDigest(&sha1);
+  if (Contains(*digest, *size)) {
+    return true;
+  }
+  // Linking the file into the store saves copying it; another writer may
+  // have stored the same blob meanwhile.
+  std::string blob_path = BlobPath(*digest);
+  if (link(path.c_str(), blob_path.c_str()) == 0 || errno == EEXIST) {
+    chmod(blob_path.c_str(), 0444);
+    return true;
+  }
+  std::string temp_path;
+  fd = CreateTemp(&temp_path, 0444);
+  if (fd < 0) {
+    return false;
+  }
+  close(fd);
+  return CloneOrCopy(path, temp_path, 0444, false) &&
+         Install(temp_path, blob_path);
+}
+
+bool DiskCas::Get(const std::string &digest, std::string *data) const {
+  return digest.size() == blaze_util::Sha1Digest::kDigestLength &&
+         ReadFile(BlobPath(digest), data);
+}
+
+bool DiskCas::Materialize(const std::string &digest, const std::string &path,
+                          bool executable) {
+  if (digest.size() != blaze_util::Sha1Digest::kDigestLength) {
+    return false;
+  }
+  std::string source = BlobPath(digest);
+  mode_t mode = 0444;
+  if (executable) {
+    mode = 0555;
+    std::string twin = source + ".x";
+    if (access(twin.c_str(), F_OK) < 0) {
+      std::string temp_path;
+      int fd = CreateTemp(&temp_path, mode);
+      if (fd < 0) {
+        return false;
+      }
+      close(fd);
+      if (!CloneOrCopy(source, temp_path, mode, false) ||
+          !Install(temp_path, twin)) {
+        return false;
+      }
+    }
+    source = twin;
+  }
+  if (link(source.c_str(), path.c_str()) == 0) {
+    return true;
+  }
+  // Links across filesystems, or beyond the limit of links of a file, are
+  // not possible.
+  return errno != EEXIST && CloneOrCopy(source, path, mode, true);
+}
+
+bool DiskCas::GetActionResult(const std::string &action_digest,
+                              std::string *result) const {
+  return action_digest.size() == blaze_util::Sha1Digest::kDigestLength &&
+         ReadFile(ActionPath(action_digest), result);
+}
+
+bool DiskCas::PutActionResult(const std::string &action_digest,
+                              const std::string &result) {
+  return action_digest.size() == blaze_util::Sha1Digest::kDigestLength &&
+         WriteBlob(ActionPath(action_digest), result);
+}
+
+DiskCas::Upload::Upload(DiskCas *cas, const std::string &digest, int64_t size)
+    : cas_(cas),
+      digest_(digest),
+      size_(size),
+      written_(0),
+      fd_(-1),
+      exists_(cas->Contains(digest, size)),
+      failed_(digest.size() != blaze_util::Sha1Digest::kDigestLength) {
+  if (!exists_ && !failed_) {
+    fd_ = cas_->CreateTemp(&temp_path_, 0444);
+    failed_ = fd_ < 0;
+  }
+}
+
+DiskCas::Upload::~Upload() {
+  if (fd_ >= 0) {
+    close(fd_);
+    unlink(temp_path_.c_str());
+  }
+}
+
+bool DiskCas::Upload::Write(int64_t offset, const void *data, size_t size) {
+  if (offset != written_) {
+    failed_ = true;
+  }
+  if (failed_) {
+    return false;
+  }
+  written_ += size;
+  if (exists_) {
+    return true;
+  }
+  UpdateDigest(&sha1_, data, size);
+  if (!WriteFully(fd_, data, size)) {
+    failed_ = true;
+  }
+  return !failed_;
+}
+
+bool DiskCas::Upload::Commit(std::string *error) {
+  if (failed_) {
+    *error = "cannot write the blob " + Hex(digest_);
+    return false;
+  }
+  if (size_ >= 0 && written_ != size_) {
+    *error = "the blob " + Hex(digest_) + " has " + std::to_string(written_) +
+             " bytes instead of " + std::to_string(size_);
+    return false;
+  }
+  if (exists_) {
+    return true;
+  }
+  int fd = fd_;
+  fd_ = -1;
+  if (close(fd) < 0) {
+    unlink(temp_path_.c_str());
+    *error = "cannot write the blob " + Hex(digest_);
+    return false;
+  }
+  std::string digest = FinishDigest(&sha1_);
+  if (digest != digest_) {
+    unlink(temp_path_.c_str());
+    *error = "the blob " + Hex(digest_) + " has the digest " + Hex(digest);
+    return false;
+  }
+  if (!cas_->Install(temp_path_, cas_->BlobPath(digest_))) {
+    *error = "cannot store the blob " + Hex(digest_);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,125 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_TOOLS_REMOTE_WORKER_SRC_MAIN_CPP_DISK_CAS_H_
+#define SRC_TOOLS_REMOTE_WORKER_SRC_MAIN_CPP_DISK_CAS_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+
+#include "src/main/cpp/util/sha1.h"
+
+/*
+ * A content-addressed store of blobs on the local disk, and the action cache
+ * next to it. Blobs are keyed by the raw SHA-1 digest of their contents (the
+ * 'digest' of a ContentDigest), action results by the digest of their action.
+ *
+ * Under the root directory, a blob lives in cas/<xx>/<hex digest> (where <xx>
+ * are the first two hex digits), read-only, and is materialized as an input
+ * by hardlinking it, or by cloning or copying it where links are not
+ * possible. Its executable twin, <hex digest>.x, is made the first time the
+ * blob is needed as an executable. All files are written to tmp/ first and
+ * renamed into place, so that concurrent readers and writers never see a
+ * partial file. All methods may be called from any thread.
+ */
+class DiskCas {
+ public:
+  explicit DiskCas(const std::string &root);
+
+  // Creates the directories of the store. Returns false with 'error' set
+  // if it cannot.
+  bool Init(std::string *error);
+
+  // Returns the raw digest of 'size' bytes at 'data'.
+  static std::string Digest(const void *data, size_t size);
+
+  // Returns 'digest' in hex.
+  static std::string Hex(const std::string &digest);
+
+  // True if the blob with the given digest is stored, and its size is 'size'
+  // unless that is negative.
+  bool Contains(const std::string &digest, int64_t size) const;
+
+  // Stores 'data' and returns its digest, or the empty string on failure.
+  std::string Put(const std::string &data);
+
+  // Stores the contents of the file at 'path', which may be linked into the
+  // store (and made read-only) rather than copied: the file must not change
+  // afterwards. Sets its digest and size and returns true on success.
+  bool PutFile(const std::string &path, std::string *digest, int64_t *size);
+
+  // Reads the blob with the given digest into 'data'.
+  bool Get(const std::string &digest, std::string *data) const;
+
+  // Creates the file 'path' with the contents of the blob, executable or not.
+  bool Materialize(const std::string &digest, const std::string &path,
+                   bool executable);
+
+  // Returns the path of the stored blob with the given digest.
+  std::string BlobPath(const std::string &digest) const;
+
+  // The action cache, from action digests to serialized ActionResults.
+  bool GetActionResult(const std::string &action_digest,
+                       std::string *result) const;
+  bool PutActionResult(const std::string &action_digest,
+                       const std::string &result);
+
+  // Receives a blob in chunks, such as those of an UploadBlob stream, and
+  // stores it if it has the expected digest and size.
+  class Upload {
+   public:
+    Upload(DiskCas *cas, const std::string &digest, int64_t size);
+    ~Upload();
+
+    // Appends 'size' bytes at 'data', which have to be at 'offset' in the
+    // blob.
+    bool Write(int64_t offset, const void *data, size_t size);
+
+    // Checks and stores the blob. Returns false with 'error' set if it is not
+    // the expected one or cannot be stored.
+    bool Commit(std::string *error);
+
+   private:
+    DiskCas *cas_;
+    std::string digest_;
+    int64_t size_;
+    int64_t written_;
+    // The temporary file, or -1 if the blob was stored already or writing
+    // failed.
+    int fd_;
+    std::string temp_path_;
+    bool exists_;
+    bool failed_;
+    blaze_util::Sha1Digest sha1_;
+
+    Upload(const Upload &) = delete;
+    Upload &operator=(const Upload &) = delete;
+  };
+
+ private:
+  // Creates a temporary file in tmp/ with the given mode, or returns -1.
+  int CreateTemp(std::string *path, mode_t mode) const;
+  // Renames the temporary file into place at 'path'. A file there already
+  // has the same contents, so losing a race to another writer is fine.
+  bool Install(const std::string &temp_path, const std::string &path) const;
+  bool WriteBlob(const std::string &path, const std::string &data);
+  std::string ActionPath(const std::string &action_digest) const;
+
+  std::string root_;
+};
+
+#endif  // SRC_TOOLS_REMOTE_WORKER_SRC_MAIN_CPP_DISK_CAS_H_
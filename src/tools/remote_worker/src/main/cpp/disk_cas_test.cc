@@ -0,0 +1,182 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+
+#include "src/tools/remote_worker/src/main/cpp/disk_cas.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+class DiskCasTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    const char *tmpdir = getenv("TEST_TMPDIR");
+    ASSERT_NE(nullptr, tmpdir);
+    dir_ = std::string(tmpdir) + "/" +
+           ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    system(("rm -rf " + dir_).c_str());
+    ASSERT_EQ(0, mkdir(dir_.c_str(), 0755));
+    cas_.reset(new DiskCas(dir_ + "/cas"));
+    std::string error;
+    ASSERT_TRUE(cas_->Init(&error)) << error;
+  }
+
+  void WriteFile(const std::string &path, const std::string &contents) {
+    FILE *file = fopen(path.c_str(), "w");
+    ASSERT_NE(nullptr, file);
+    fwrite(contents.data(), 1, contents.size(), file);
+    fclose(file);
+  }
+
+  std::string ReadFile(const std::string &path) {
+    std::string contents;
+    FILE *file = fopen(path.c_str(), "r");
+    if (file != nullptr) {
+      char buffer[4096];
+      size_t n;
+      while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        contents.append(buffer, n);
+      }
+      fclose(file);
+    }
+    return contents;
+  }
+
+  std::string dir_;
+  std::unique_ptr<DiskCas> cas_;
+};
+
+TEST_F(DiskCasTest, Digest) {
+  EXPECT_EQ("da39a3ee5e6b4b0d3255bfef95601890afd80709",
+            DiskCas::Hex(DiskCas::Digest("", 0)));
+  EXPECT_EQ("a9993e364706816aba3e25717850c26c9cd0d89d",
+            DiskCas::Hex(DiskCas::Digest("abc", 3)));
+}
+
+TEST_F(DiskCasTest, PutAndGet) {
+  std::string digest = cas_->Put("contents");
+  ASSERT_EQ(DiskCas::Digest("contents", 8), digest);
+  EXPECT_TRUE(cas_->Contains(digest, 8));
+  EXPECT_TRUE(cas_->Contains(digest, -1));
+  EXPECT_FALSE(cas_->Contains(digest, 7));
+  EXPECT_FALSE(cas_->Contains(DiskCas::Digest("other", 5), -1));
+  EXPECT_FALSE(cas_->Contains("short", -1));
+  std::string data;
+  ASSERT_TRUE(cas_->Get(digest, &data));
+  EXPECT_EQ("contents", data);
+  // Storing it again is fine.
+  EXPECT_EQ(digest, cas_->Put("contents"));
+  struct stat st;
+  ASSERT_EQ(0, stat(cas_->BlobPath(digest).c_str(), &st));
+  EXPECT_EQ(0444u, st.st_mode & 0777);
+}
+
+TEST_F(DiskCasTest, PutFile) {
+  std::string path = dir_ + "/output";
+  WriteFile(path, "output contents");
+  std::string digest;
+  int64_t size;
+  ASSERT_TRUE(cas_->PutFile(path, &digest, &size));
+  EXPECT_EQ(DiskCas::Digest("output contents", 15), digest);
+  EXPECT_EQ(15, size);
+  std::string data;
+  ASSERT_TRUE(cas_->Get(digest, &data));
+  EXPECT_EQ("output contents", data);
+}
+
+TEST_F(DiskCasTest, Materialize) {
+  std::string digest = cas_->Put("#!/bin/sh\necho hi\n");
+  std::string input = dir_ + "/input";
+  std::string tool = dir_ + "/tool";
+  ASSERT_TRUE(cas_->Materialize(digest, input, false));
+  ASSERT_TRUE(cas_->Materialize(digest, tool, true));
+  EXPECT_EQ("#!/bin/sh\necho hi\n", ReadFile(input));
+  EXPECT_EQ("#!/bin/sh\necho hi\n", ReadFile(tool));
+  struct stat st;
+  ASSERT_EQ(0, stat(input.c_str(), &st));
+  EXPECT_EQ(0444u, st.st_mode & 0777);
+  ASSERT_EQ(0, stat(tool.c_str(), &st));
+  EXPECT_EQ(0555u, st.st_mode & 0777);
+  // An existing file is not replaced, a missing blob not materialized.
+  EXPECT_FALSE(cas_->Materialize(digest, input, false));
+  EXPECT_FALSE(
+      cas_->Materialize(DiskCas::Digest("x", 1), dir_ + "/missing", false));
+}
+
+TEST_F(DiskCasTest, Upload) {
+  std::string digest = DiskCas::Digest("first second", 12);
+  std::string error;
+  {
+    DiskCas::Upload upload(cas_.get(), digest, 12);
+    ASSERT_TRUE(upload.Write(0, "first ", 6));
+    EXPECT_FALSE(cas_->Contains(digest, -1));
+    ASSERT_TRUE(upload.Write(6, "second", 6));
+    ASSERT_TRUE(upload.Commit(&error)) << error;
+  }
+  std::string data;
+  ASSERT_TRUE(cas_->Get(digest, &data));
+  EXPECT_EQ("first second", data);
+  // Uploading a stored blob again is fine.
+  {
+    DiskCas::Upload upload(cas_.get(), digest, 12);
+    ASSERT_TRUE(upload.Write(0, "first second", 12));
+    EXPECT_TRUE(upload.Commit(&error)) << error;
+  }
+}
+
+TEST_F(DiskCasTest, UploadErrors) {
+  std::string digest = DiskCas::Digest("contents", 8);
+  std::string error;
+  {
+    DiskCas::Upload upload(cas_.get(), digest, 8);
+    ASSERT_TRUE(upload.Write(0, "contentz", 8));
+    EXPECT_FALSE(upload.Commit(&error));
+    EXPECT_NE(std::string::npos, error.find("digest")) << error;
+  }
+  {
+    DiskCas::Upload upload(cas_.get(), digest, 8);
+    ASSERT_TRUE(upload.Write(0, "cont", 4));
+    EXPECT_FALSE(upload.Write(5, "ents", 4));
+    EXPECT_FALSE(upload.Commit(&error));
+  }
+  {
+    DiskCas::Upload upload(cas_.get(), digest, 9);
+    ASSERT_TRUE(upload.Write(0, "contents", 8));
+    EXPECT_FALSE(upload.Commit(&error));
+  }
+  EXPECT_FALSE(cas_->Contains(digest, -1));
+}
+
+TEST_F(DiskCasTest, ActionCache) {
+  std::string action = DiskCas::Digest("action", 6);
+  std::string result;
+  EXPECT_FALSE(cas_->GetActionResult(action, &result));
+  ASSERT_TRUE(cas_->PutActionResult(action, "result"));
+  ASSERT_TRUE(cas_->GetActionResult(action, &result));
+  EXPECT_EQ("result", result);
+  ASSERT_TRUE(cas_->PutActionResult(action, "newer result"));
+  ASSERT_TRUE(cas_->GetActionResult(action, &result));
+  EXPECT_EQ("newer result", result);
+  // The action cache is not part of the blobs.
+  EXPECT_FALSE(cas_->Contains(action, -1));
+}
+
+}  // namespace
@@ -0,0 +1,483 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/tools/remote_worker/src/main/cpp/executor.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT
+
+using build::remote::ActionResult;
+using build::remote::CasStatus;
+using build::remote::Command;
+using build::remote::ContentDigest;
+using build::remote::ExecuteReply;
+using build::remote::ExecuteRequest;
+using build::remote::ExecutionStatus;
+using build::remote::FileNode;
+using build::remote::Output;
+
+namespace {
+
+// True if 'path' is a relative path without empty, "." or ".." segments, so
+// that it stays below the directory it is relative to.
+bool IsSafeRelativePath(const std::string &path) {
+  if (path.empty() || path[0] == '/') {
+    return false;
+  }
+  size_t start = 0;
+  while (start <= path.size()) {
+    size_t end = path.find('/', start);
+    if (end == std::string::npos) {
+      end = path.size();
+    }
+    std::string segment = path.substr(start, end - start);
+    if (segment.empty() || segment == "." || segment == "..") {
+      return false;
+    }
+    start = end + 1;
+  }
+  return true;
+}
+
+// Creates the directory 'path' and its parents below 'root', which exists.
+bool MakeDirectories(const std::string &root, const std::string &path) {
+  size_t start = 0;
+  while (start < path.size()) {
+    size_t end = path.find('/', start);
+    if (end == std::string::npos) {
+      end = path.size();
+    }
+    std::string dir = root + "/" + path.substr(0, end);
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+      return false;
+    }
+    start = end + 1;
+  }
+  return true;
+}
+
+int MakeWritable(const char *path, const struct stat *st, int type,
+                 struct FTW *ftw) {
+  if (type == FTW_D || type == FTW_DNR) {
+    chmod(path, 0755);
+  }
+  return 0;
+}
+
+int RemoveEntry(const char *path, const struct stat *st, int type,
+                struct FTW *ftw) {
+  remove(path);
+  return 0;
+}
+
+// Removes the directory tree at 'path', also where the action made parts of
+// it read-only.
+void RemoveTree(const std::string &path) {
+  nftw(path.c_str(), MakeWritable, 16, FTW_PHYS);
+  nftw(path.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+void AddMissing(CasStatus *status, const ContentDigest &digest) {
+  status->set_succeeded(false);
+  status->set_error(CasStatus::MISSING_DIGEST);
+  *status->add_missing_digest() = digest;
+}
+
+}  // namespace
+
+Executor::Executor(DiskCas *cas, const std::string &work_path,
+                   const std::string &sandbox, int jobs, bool keep_work_dirs)
+    : cas_(cas),
+      work_path_(work_path),
+      sandbox_(sandbox),
+      keep_work_dirs_(keep_work_dirs),
+      next_id_(0),
+      free_jobs_(std::max(jobs, 1)) {}
+
+ContentDigest Executor::DigestOfBlob(const std::string &data) {
+  ContentDigest digest;
+  digest.set_digest(DiskCas::Digest(data.data(), data.size()));
+  digest.set_size_bytes(data.size());
+  return digest;
+}
+
+ContentDigest Executor::DigestOf(const google::protobuf::MessageLite &message) {
+  return DigestOfBlob(message.SerializeAsString());
+}
+
+void Executor::Acquire() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  available_.wait(lock, [this] { return free_jobs_ > 0; });
+  --free_jobs_;
+}
+
+void Executor::Release() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++free_jobs_;
+  available_.notify_one();
+}
+
+bool Executor::MaterializeTree(const ContentDigest &root,
+                               const std::string &dir, CasStatus *status) {
+  std::string blob;
+  FileNode node;
+  if (!cas_->Get(root.digest(), &blob)) {
+    AddMissing(status, root);
+    return false;
+  }
+  if (!node.ParseFromString(blob) || node.has_file_metadata()) {
+    status->set_succeeded(false);
+    status->set_error(CasStatus::NODE_PARSE_ERROR);
+    *status->add_parse_failed_digest() = root;
+    return false;
+  }
+  bool ok = true;
+  for (const FileNode::Child &child : node.child()) {
+    if (!IsSafeRelativePath(child.path())) {
+      status->set_succeeded(false);
+      status->set_error(CasStatus::NODE_PARSE_ERROR);
+      status->set_error_detail("bad input path '" + child.path() + "'");
+      *status->add_parse_failed_digest() = root;
+      return false;
+    }
+    size_t slash = child.path().rfind('/');
+    if (slash != std::string::npos &&
+        !MakeDirectories(dir, child.path().substr(0, slash))) {
+      status->set_succeeded(false);
+      status->set_error_detail("cannot create the parent of " + child.path());
+      return false;
+    }
+    std::string path = dir + "/" + child.path();
+    FileNode child_node;
+    if (!cas_->Get(child.digest().digest(), &blob)) {
+      AddMissing(status, child.digest());
+      ok = false;
+      continue;
+    }
+    if (!child_node.ParseFromString(blob)) {
+      status->set_succeeded(false);
+      status->set_error(CasStatus::NODE_PARSE_ERROR);
+      *status->add_parse_failed_digest() = child.digest();
+      ok = false;
+      continue;
+    }
+    if (child_node.has_file_metadata()) {
+      const ContentDigest &file = child_node.file_metadata().digest();
+      if (!cas_->Contains(file.digest(), -1)) {
+        AddMissing(status, file);
+        ok = false;
+      } else if (!cas_->Materialize(file.digest(), path,
+                                    child_node.file_metadata().executable())) {
+        status->set_succeeded(false);
+        status->set_error_detail("cannot create the input " + child.path());
+        ok = false;
+      }
+    } else if (mkdir(path.c_str(), 0755) < 0 && errno != EEXIST) {
+      status->set_succeeded(false);
+      status->set_error_detail("cannot create the directory " + child.path());
+      ok = false;
+    } else if (!MaterializeTree(child.digest(), path, status)) {
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+bool Executor::StoreTree(const std::string &path, ContentDigest *digest) {
+  DIR *dir = opendir(path.c_str());
+  if (dir == NULL) {
+    return false;
+  }
+  std::vector<std::string> names;
+  while (struct dirent *entry = readdir(dir)) {
+    if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
+      names.push_back(entry->d_name);
+    }
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+
+  FileNode node;
+  for (const std::string &name : names) {
+    std::string child_path = path + "/" + name;
+    struct stat st;
+    if (stat(child_path.c_str(), &st) < 0) {
+      continue;  // A dangling symlink.
+    }
+    FileNode::Child *child = node.add_child();
+    child->set_path(name);
+    if (S_ISDIR(st.st_mode)) {
+      if (!StoreTree(child_path, child->mutable_digest())) {
+        return false;
+      }
+    } else {
+      FileNode file_node;
+      std::string file_digest;
+      int64_t size;
+      if (!cas_->PutFile(child_path, &file_digest, &size)) {
+        return false;
+      }
+      ContentDigest *file = file_node.mutable_file_metadata()->mutable_digest();
+      file->set_digest(file_digest);
+      file->set_size_bytes(size);
+      file_node.mutable_file_metadata()->set_executable(st.st_mode & S_IXUSR);
+      std::string blob = file_node.SerializeAsString();
+      if (cas_->Put(blob).empty()) {
+        return false;
+      }
+      *child->mutable_digest() = DigestOfBlob(blob);
+    }
+  }
+  std::string blob = node.SerializeAsString();
+  if (cas_->Put(blob).empty()) {
+    return false;
+  }
+  *digest = DigestOfBlob(blob);
+  return true;
+}
+
+bool Executor::StoreOutput(const std::string &path, Output *output) {
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0) {
+    return false;
+  }
+  if (S_ISDIR(st.st_mode)) {
+    return StoreTree(path, output->mutable_digest());
+  }
+  std::string digest;
+  int64_t size;
+  if (!cas_->PutFile(path, &digest, &size)) {
+    return false;
+  }
+  build::remote::FileMetadata *file = output->mutable_file_metadata();
+  file->mutable_digest()->set_digest(digest);
+  file->mutable_digest()->set_size_bytes(size);
+  file->set_executable(st.st_mode & S_IXUSR);
+  return true;
+}
+
+int Executor::Run(const Command &command, const std::string &dir,
+                  int64_t timeout_millis, const std::string &stdout_path,
+                  const std::string &stderr_path, std::string *error) {
+  // Everything the child needs is prepared before fork(), after which it may
+  // only make async-signal-safe calls.
+  int timeout_secs =
+      timeout_millis > 0 ? static_cast<int>((timeout_millis + 999) / 1000) : 0;
+  std::vector<std::string> args;
+  if (!sandbox_.empty()) {
+    args = {sandbox_, "-W", dir, "-l", stdout_path, "-L", stderr_path};
+    if (timeout_secs > 0) {
+      args.push_back("-T");
+      args.push_back(std::to_string(timeout_secs));
+    }
+    args.push_back("--");
+  }
+  args.insert(args.end(), command.argv().begin(), command.argv().end());
+  std::vector<std::string> env;
+  for (const Command::EnvironmentEntry &entry : command.environment()) {
+    env.push_back(entry.variable() + "=" + entry.value());
+  }
+  std::vector<char *> argv, envp;
+  for (std::string &arg : args) {
+    argv.push_back(&arg[0]);
+  }
+  argv.push_back(NULL);
+  for (std::string &var : env) {
+    envp.push_back(&var[0]);
+  }
+  envp.push_back(NULL);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    *error = std::string("fork: ") + strerror(errno);
+    return -1;
+  }
+  if (pid == 0) {
+    setpgid(0, 0);
+    if (sandbox_.empty()) {
+      int out = open(stdout_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      int err = open(stderr_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (out < 0 || err < 0 || dup2(out, STDOUT_FILENO) < 0 ||
+          dup2(err, STDERR_FILENO) < 0 || chdir(dir.c_str()) < 0) {
+        _exit(127);
+      }
+      // Without the sandbox, the command is killed by the alarm, which
+      // survives exec.
+      if (timeout_secs > 0) {
+        alarm(timeout_secs);
+      }
+    }
+    execvpe(argv[0], argv.data(), envp.data());
+    _exit(127);
+  }
+  int status;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      *error = std::string("waitpid: ") + strerror(errno);
+      return -1;
+    }
+  }
+  // The processes the command left behind go with it.
+  kill(-pid, SIGKILL);
+  if (WIFEXITED(status)) {
+    return WEXITSTATUS(status);
+  }
+  return 128 + WTERMSIG(status);
+}
+
+void Executor::Execute(const ExecuteRequest &request, ExecuteReply *reply) {
+  const build::remote::Action &action = request.action();
+  ContentDigest action_digest = DigestOf(action);
+  ExecutionStatus *status = reply->mutable_status();
+  status->set_stage(ExecutionStatus::FINISHED);
+
+  std::string blob;
+  if (request.accept_cached() &&
+      cas_->GetActionResult(action_digest.digest(), &blob)) {
+    if (reply->mutable_result()->ParseFromString(blob)) {
+      reply->set_cached_result(true);
+      status->set_succeeded(true);
+      return;
+    }
+    reply->clear_result();
+  }
+
+  Command command;
+  if (!cas_->Get(action.command_digest().digest(), &blob)) {
+    AddMissing(reply->mutable_cas_error(), action.command_digest());
+    status->set_error(ExecutionStatus::MISSING_INPUT);
+    status->set_error_detail("the command is not in the CAS");
+    return;
+  }
+  if (!command.ParseFromString(blob) || command.argv_size() == 0) {
+    status->set_error_detail("cannot parse the command");
+    return;
+  }
+  for (const std::string &output_path : action.output_path()) {
+    std::string path = output_path;
+    if (!path.empty() && path.back() == '/') {
+      path.pop_back();
+    }
+    if (!IsSafeRelativePath(path)) {
+      status->set_error_detail("bad output path '" + output_path + "'");
+      return;
+    }
+  }
+
+  Acquire();
+  struct ReleaseOnExit {
+    Executor *executor;
+    ~ReleaseOnExit() { executor->Release(); }
+  } release = {this};
+
+  std::string dir = work_path_ + "/" + std::to_string(next_id_++);
+  std::string exec_root = dir + "/execroot";
+  if (mkdir(dir.c_str(), 0755) < 0 || mkdir(exec_root.c_str(), 0755) < 0) {
+    status->set_error_detail("cannot create " + exec_root + ": " +
+                             strerror(errno));
+    return;
+  }
+  struct RemoveOnExit {
+    std::string dir;
+    bool keep;
+    ~RemoveOnExit() {
+      if (!keep) {
+        RemoveTree(dir);
+      }
+    }
+  } remove = {dir, keep_work_dirs_};
+
+  CasStatus *cas_status = reply->mutable_cas_error();
+  cas_status->set_succeeded(true);
+  if (!action.input_root_digest().digest().empty() &&
+      !MaterializeTree(action.input_root_digest(), exec_root, cas_status)) {
+    status->set_error(cas_status->missing_digest_size() > 0
+                          ? ExecutionStatus::MISSING_INPUT
+                          : ExecutionStatus::UNKNOWN_ERROR);
+    status->set_error_detail("cannot lay out the inputs");
+    return;
+  }
+  reply->clear_cas_error();
+
+  // Outputs can only be written where their parents exist.
+  for (const std::string &output_path : action.output_path()) {
+    std::string path = output_path;
+    if (path.back() != '/') {
+      size_t slash = path.rfind('/');
+      path = slash == std::string::npos ? "" : path.substr(0, slash);
+    }
+    if (!path.empty() && !MakeDirectories(exec_root, path)) {
+      status->set_error_detail("cannot create the directory of " + path);
+      return;
+    }
+  }
+
+  std::string stdout_path = dir + "/stdout";
+  std::string stderr_path = dir + "/stderr";
+  std::string error;
+  auto start = std::chrono::steady_clock::now();
+  int exit_code = Run(command, exec_root, request.timeout_millis(),
+                      stdout_path, stderr_path, &error);
+  int64_t elapsed_millis =
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start).count();
+  if (exit_code < 0) {
+    status->set_error_detail(error);
+    return;
+  }
+  status->set_executed(true);
+
+  ActionResult *result = reply->mutable_result();
+  result->set_return_code(exit_code);
+  std::string digest;
+  int64_t size;
+  if (cas_->PutFile(stdout_path, &digest, &size)) {
+    result->mutable_stdout_digest()->set_digest(digest);
+    result->mutable_stdout_digest()->set_size_bytes(size);
+  }
+  if (cas_->PutFile(stderr_path, &digest, &size)) {
+    result->mutable_stderr_digest()->set_digest(digest);
+    result->mutable_stderr_digest()->set_size_bytes(size);
+  }
+  for (const std::string &output_path : action.output_path()) {
+    Output output;
+    output.set_path(output_path);
+    if (StoreOutput(exec_root + "/" + output_path, &output)) {
+      *result->add_output() = output;
+    }
+  }
+
+  if (request.timeout_millis() > 0 &&
+      elapsed_millis >= request.timeout_millis()) {
+    status->set_error(ExecutionStatus::DEADLINE_EXCEEDED);
+    status->set_error_detail("timed out after " +
+                             std::to_string(elapsed_millis) + "ms");
+  } else if (exit_code != 0) {
+    status->set_error(ExecutionStatus::EXEC_FAILED);
+  } else {
+    status->set_succeeded(true);
+    cas_->PutActionResult(action_digest.digest(), result->SerializeAsString());
+  }
+}
@@ -0,0 +1,86 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_TOOLS_REMOTE_WORKER_SRC_MAIN_CPP_EXECUTOR_H_
+#define SRC_TOOLS_REMOTE_WORKER_SRC_MAIN_CPP_EXECUTOR_H_ 1
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "src/main/protobuf/remote_protocol.pb.h"
+#include "src/tools/remote_worker/src/main/cpp/disk_cas.h"
+
+/*
+ * Runs the actions of ExecuteRequests: lays out the input tree of an action
+ * from the CAS in a directory of its own, runs its command there (in the
+ * linux-sandbox if there is one) and stores its outputs, standard output and
+ * standard error in the CAS, and its result in the action cache.
+ */
+class Executor {
+ public:
+  // Runs at most 'jobs' actions at a time, each in a new directory below
+  // 'work_path', with the linux-sandbox binary at 'sandbox' unless that is
+  // empty. Work directories are kept with 'keep_work_dirs'.
+  Executor(DiskCas *cas, const std::string &work_path,
+           const std::string &sandbox, int jobs, bool keep_work_dirs);
+
+  // Executes the action of 'request', or takes its result from the action
+  // cache if allowed to, and sets the final 'reply'.
+  void Execute(const build::remote::ExecuteRequest &request,
+               build::remote::ExecuteReply *reply);
+
+  // Returns the digest of 'message', as the CAS would.
+  static build::remote::ContentDigest DigestOf(
+      const google::protobuf::MessageLite &message);
+
+  // Returns the digest of the blob 'data'.
+  static build::remote::ContentDigest DigestOfBlob(const std::string &data);
+
+ private:
+  // Creates the tree of FileNodes with the given root in 'dir'. Adds the
+  // digests of the nodes and blobs missing from the CAS to 'status'.
+  bool MaterializeTree(const build::remote::ContentDigest &root,
+                       const std::string &dir,
+                       build::remote::CasStatus *status);
+  // Stores the file or directory tree at 'path' in the CAS as 'output'.
+  bool StoreOutput(const std::string &path, build::remote::Output *output);
+  bool StoreTree(const std::string &path,
+                 build::remote::ContentDigest *digest);
+  // Runs 'command' in 'dir', with its output and error written to files.
+  // Returns its exit code, or -1 if it could not be started.
+  int Run(const build::remote::Command &command, const std::string &dir,
+          int64_t timeout_millis, const std::string &stdout_path,
+          const std::string &stderr_path, std::string *error);
+
+  void Acquire();
+  void Release();
+
+  DiskCas *cas_;
+  std::string work_path_;
+  std::string sandbox_;
+  bool keep_work_dirs_;
+  std::atomic<int> next_id_;
+
+  // The number of actions that may start running.
+  std::mutex mutex_;
+  std::condition_variable available_;
+  int free_jobs_;
+};
+
+#endif  // SRC_TOOLS_REMOTE_WORKER_SRC_MAIN_CPP_EXECUTOR_H_
@@ -0,0 +1,385 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A native remote execution worker: serves the CasService, the
+// ExecutionCacheService and the ExecuteService of remote_protocol.proto from
+// a DiskCas in its work directory, and runs actions with the Executor.
+//
+// Usage: remote_worker --work_path=dir [--listen_port=n] [--sandbox=path]
+//                      [--jobs=n] [--debug] [--pid_file=file]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <grpc++/security/server_credentials.h>
+#include <grpc++/server.h>
+#include <grpc++/server_builder.h>
+#include <grpc++/server_context.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/main/cpp/util/thread_pool.h"
+#include "src/main/protobuf/remote_protocol.grpc.pb.h"
+#include "src/tools/remote_worker/src/main/cpp/disk_cas.h"
+#include "src/tools/remote_worker/src/main/cpp/executor.h"
+
+using build::remote::CasDownloadBlobRequest;
+using build::remote::CasDownloadReply;
+using build::remote::CasDownloadTreeMetadataReply;
+using build::remote::CasDownloadTreeMetadataRequest;
+using build::remote::CasLookupReply;
+using build::remote::CasLookupRequest;
+using build::remote::CasStatus;
+using build::remote::CasUploadBlobReply;
+using build::remote::CasUploadBlobRequest;
+using build::remote::CasUploadTreeMetadataReply;
+using build::remote::CasUploadTreeMetadataRequest;
+using build::remote::ContentDigest;
+using build::remote::ExecuteReply;
+using build::remote::ExecuteRequest;
+using build::remote::ExecutionCacheReply;
+using build::remote::ExecutionCacheRequest;
+using build::remote::ExecutionStatus;
+using build::remote::FileNode;
+
+namespace {
+
+// The size of the chunks of the blobs streamed to clients.
+const size_t kChunkSize = 1 << 20;
+
+class CasServiceImpl : public build::remote::CasService::Service {
+ public:
+  explicit CasServiceImpl(DiskCas *cas) : cas_(cas) {}
+
+  grpc::Status Lookup(grpc::ServerContext *context,
+                      const CasLookupRequest *request,
+                      CasLookupReply *reply) override {
+    CasStatus *status = reply->mutable_status();
+    status->set_succeeded(true);
+    for (const ContentDigest &digest : request->digest()) {
+      if (!cas_->Contains(digest.digest(), digest.size_bytes())) {
+        status->set_succeeded(false);
+        status->set_error(CasStatus::MISSING_DIGEST);
+        *status->add_missing_digest() = digest;
+      }
+    }
+    return grpc::Status::OK;
+  }
+
+  grpc::Status UploadTreeMetadata(grpc::ServerContext *context,
+                                  const CasUploadTreeMetadataRequest *request,
+                                  CasUploadTreeMetadataReply *reply) override {
+    CasStatus *status = reply->mutable_status();
+    status->set_succeeded(true);
+    for (const FileNode &node : request->tree_node()) {
+      if (cas_->Put(node.SerializeAsString()).empty()) {
+        status->set_succeeded(false);
+        status->set_error_detail("cannot store a tree node");
+      }
+    }
+    return grpc::Status::OK;
+  }
+
+  grpc::Status UploadBlob(grpc::ServerContext *context,
+                          grpc::ServerReader<CasUploadBlobRequest> *reader,
+                          CasUploadBlobReply *reply) override {
+    CasStatus *status = reply->mutable_status();
+    status->set_succeeded(true);
+    std::unique_ptr<DiskCas::Upload> upload;
+    CasUploadBlobRequest request;
+    while (reader->Read(&request)) {
+      const build::remote::BlobChunk &chunk = request.data();
+      // The first chunk of every blob has its digest.
+      if (chunk.has_digest()) {
+        Commit(upload.get(), status);
+        upload.reset(new DiskCas::Upload(cas_, chunk.digest().digest(),
+                                         chunk.digest().size_bytes()));
+      } else if (upload == nullptr) {
+        status->set_succeeded(false);
+        status->set_error_detail("a blob without a digest");
+        return grpc::Status::OK;
+      }
+      upload->Write(chunk.offset(), chunk.data().data(), chunk.data().size());
+    }
+    Commit(upload.get(), status);
+    return grpc::Status::OK;
+  }
+
+  grpc::Status DownloadTreeMetadata(
+      grpc::ServerContext *context,
+      const CasDownloadTreeMetadataRequest *request,
+      CasDownloadTreeMetadataReply *reply) override {
+    CasStatus *status = reply->mutable_status();
+    status->set_succeeded(true);
+    std::vector<ContentDigest> pending = {request->root()};
+    while (!pending.empty()) {
+      ContentDigest digest = pending.back();
+      pending.pop_back();
+      std::string blob;
+      FileNode *node = reply->add_tree_node();
+      if (!cas_->Get(digest.digest(), &blob)) {
+        reply->mutable_tree_node()->RemoveLast();
+        status->set_succeeded(false);
+        status->set_error(CasStatus::MISSING_DIGEST);
+        *status->add_missing_digest() = digest;
+      } else if (!node->ParseFromString(blob)) {
+        reply->mutable_tree_node()->RemoveLast();
+        status->set_succeeded(false);
+        status->set_error(CasStatus::NODE_PARSE_ERROR);
+        *status->add_parse_failed_digest() = digest;
+      } else {
+        for (const FileNode::Child &child : node->child()) {
+          pending.push_back(child.digest());
+        }
+      }
+    }
+    return grpc::Status::OK;
+  }
+
+  // DownloadTree, a zip of a whole tree, is left unimplemented: the clients
+  // download the metadata of the tree and then the blobs they are missing.
+
+  grpc::Status DownloadBlob(
+      grpc::ServerContext *context, const CasDownloadBlobRequest *request,
+      grpc::ServerWriter<CasDownloadReply> *writer) override {
+    CasDownloadReply reply;
+    CasStatus *status = reply.mutable_status();
+    status->set_succeeded(true);
+    status->set_cache_hit(true);
+    for (const ContentDigest &digest : request->digest()) {
+      if (!cas_->Contains(digest.digest(), -1)) {
+        status->set_succeeded(false);
+        status->set_cache_hit(false);
+        status->set_error(CasStatus::MISSING_DIGEST);
+        *status->add_missing_digest() = digest;
+      }
+    }
+    if (!status->succeeded()) {
+      writer->Write(reply);
+      return grpc::Status::OK;
+    }
+    std::vector<char> buffer(kChunkSize);
+    for (const ContentDigest &digest : request->digest()) {
+      int fd = open(cas_->BlobPath(digest.digest()).c_str(),
+                    O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+        return grpc::Status(grpc::StatusCode::INTERNAL,
+                            "cannot read " + DiskCas::Hex(digest.digest()));
+      }
+      // Every blob has at least one chunk, the first with its digest.
+      int64_t offset = 0;
+      bool first = true;
+      for (;;) {
+        ssize_t n = read(fd, buffer.data(), buffer.size());
+        if (n < 0 && errno == EINTR) {
+          continue;
+        } else if (n < 0) {
+          close(fd);
+          return grpc::Status(grpc::StatusCode::INTERNAL,
+                              "cannot read " + DiskCas::Hex(digest.digest()));
+        } else if (n == 0 && !first) {
+          break;
+        }
+        build::remote::BlobChunk *chunk = reply.mutable_data();
+        chunk->Clear();
+        if (first) {
+          *chunk->mutable_digest() = digest;
+          first = false;
+        }
+        chunk->set_offset(offset);
+        chunk->set_data(buffer.data(), n);
+        offset += n;
+        if (!writer->Write(reply)) {
+          close(fd);
+          return grpc::Status::CANCELLED;
+        }
+        // Only the first reply has the status.
+        reply.clear_status();
+        if (n == 0) {
+          break;
+        }
+      }
+      close(fd);
+    }
+    return grpc::Status::OK;
+  }
+
+ private:
+  static void Commit(DiskCas::Upload *upload, CasStatus *status) {
+    std::string error;
+    if (upload != nullptr && !upload->Commit(&error)) {
+      status->set_succeeded(false);
+      status->set_error(CasStatus::DIGEST_MISMATCH);
+      status->set_error_detail(error);
+    }
+  }
+
+  DiskCas *cas_;
+};
+
+class ExecutionCacheServiceImpl
+    : public build::remote::ExecutionCacheService::Service {
+ public:
+  explicit ExecutionCacheServiceImpl(DiskCas *cas) : cas_(cas) {}
+
+  grpc::Status GetCachedResult(grpc::ServerContext *context,
+                               const ExecutionCacheRequest *request,
+                               ExecutionCacheReply *reply) override {
+    std::string blob;
+    reply->mutable_status()->set_succeeded(true);
+    if (cas_->GetActionResult(request->action_digest().digest(), &blob) &&
+        !reply->mutable_result()->ParseFromString(blob)) {
+      reply->clear_result();
+    }
+    return grpc::Status::OK;
+  }
+
+ private:
+  DiskCas *cas_;
+};
+
+class ExecuteServiceImpl : public build::remote::ExecuteService::Service {
+ public:
+  explicit ExecuteServiceImpl(Executor *executor) : executor_(executor) {}
+
+  grpc::Status Execute(grpc::ServerContext *context,
+                       const ExecuteRequest *request,
+                       grpc::ServerWriter<ExecuteReply> *writer) override {
+    ExecuteReply reply;
+    reply.mutable_status()->set_stage(ExecutionStatus::EXECUTING);
+    writer->Write(reply);
+    reply.Clear();
+    executor_->Execute(*request, &reply);
+    writer->Write(reply);
+    return grpc::Status::OK;
+  }
+
+ private:
+  Executor *executor_;
+};
+
+void Usage() {
+  fprintf(stderr,
+          "Usage: remote_worker --work_path=dir [--listen_port=n] "
+          "[--sandbox=path]\n"
+          "                     [--jobs=n] [--debug] [--pid_file=file]\n"
+          "Serves the CAS, the action cache and the execution of actions.\n"
+          "  --work_path  the directory of the CAS and of the actions run\n"
+          "  --listen_port  the port to listen on (default 8080)\n"
+          "  --sandbox  the linux-sandbox binary to run actions with\n"
+          "  --jobs  how many actions to run at a time (default: the "
+          "number of CPUs)\n"
+          "  --debug  keep the directories of the actions run\n"
+          "  --pid_file  where to write the process id once started\n");
+  exit(1);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  std::string work_path, sandbox, pid_file;
+  int listen_port = 8080, jobs = 0;
+  bool debug = false;
+  for (int i = 1; i < argc; ++i) {
+    // Flags take their value as --flag=value or as the next argument.
+    std::string arg = argv[i], value;
+    size_t equals = arg.find('=');
+    bool has_value = equals != std::string::npos;
+    if (has_value) {
+      value = arg.substr(equals + 1);
+      arg.erase(equals);
+    } else if (arg != "--debug" && i + 1 < argc) {
+      value = argv[++i];
+      has_value = true;
+    }
+    if (arg == "--work_path" && has_value) {
+      work_path = value;
+    } else if (arg == "--listen_port" && has_value) {
+      listen_port = atoi(value.c_str());
+    } else if (arg == "--sandbox" && has_value) {
+      sandbox = value;
+    } else if (arg == "--jobs" && has_value) {
+      jobs = atoi(value.c_str());
+    } else if (arg == "--pid_file" && has_value) {
+      pid_file = value;
+    } else if (arg == "--debug" && !has_value) {
+      debug = true;
+    } else {
+      Usage();
+    }
+  }
+  if (work_path.empty() || listen_port <= 0 || listen_port > 65535) {
+    Usage();
+  }
+
+  std::string error;
+  DiskCas cas(work_path + "/cache");
+  if (mkdir(work_path.c_str(), 0755) < 0 && errno != EEXIST) {
+    fprintf(stderr, "cannot create %s: %s\n", work_path.c_str(),
+            strerror(errno));
+    return 1;
+  }
+  if (!cas.Init(&error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  std::string exec_path = work_path + "/exec";
+  if (mkdir(exec_path.c_str(), 0755) < 0 && errno != EEXIST) {
+    fprintf(stderr, "cannot create %s: %s\n", exec_path.c_str(),
+            strerror(errno));
+    return 1;
+  }
+  // A client going away while it is sent a reply must not kill the worker.
+  signal(SIGPIPE, SIG_IGN);
+
+  Executor executor(&cas, exec_path, sandbox, blaze_util::ThreadCount(jobs),
+                    debug);
+  CasServiceImpl cas_service(&cas);
+  ExecutionCacheServiceImpl cache_service(&cas);
+  ExecuteServiceImpl execute_service(&executor);
+
+  grpc::ServerBuilder builder;
+  builder.AddListeningPort("[::]:" + std::to_string(listen_port),
+                           grpc::InsecureServerCredentials());
+  builder.RegisterService(&cas_service);
+  builder.RegisterService(&cache_service);
+  builder.RegisterService(&execute_service);
+  std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+  if (server == nullptr) {
+    fprintf(stderr, "cannot listen on port %d\n", listen_port);
+    return 1;
+  }
+  fprintf(stderr, "*** Serving on port %d.\n", listen_port);
+
+  if (!pid_file.empty()) {
+    FILE *file = fopen(pid_file.c_str(), "w");
+    if (file == NULL) {
+      fprintf(stderr, "cannot write %s: %s\n", pid_file.c_str(),
+              strerror(errno));
+      return 1;
+    }
+    fprintf(file, "%d\n", getpid());
+    fclose(file);
+  }
+  server->Wait();
+  return 0;
+}
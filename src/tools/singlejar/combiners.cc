@@ -13,6 +13,9 @@
 // limitations under the License.
 
 #include "src/tools/singlejar/combiners.h"
+
+#include <algorithm>
+
 #include "src/tools/singlejar/diag.h"
 
 Combiner::~Combiner() {}
@@ -20,18 +23,29 @@ Combiner::~Combiner() {}
 Concatenator::~Concatenator() {}
 
 bool Concatenator::Merge(const CDH *cdh, const LH *lh) {
+  return MergeEntry(cdh, lh, false, nullptr);
+}
+
+bool Concatenator::MergeMapped(const CDH *cdh, const LH *lh,
+                               const std::shared_ptr<const void> &mapping) {
+  return MergeEntry(cdh, lh, true, mapping);
+}
+
+bool Concatenator::MergeEntry(const CDH *cdh, const LH *lh, bool by_reference,
+                              const std::shared_ptr<const void> &mapping) {
   if (insert_newlines_ && buffer_.get() && buffer_->data_size() &&
       '\n' != buffer_->last_byte()) {
     Append("\n", 1);
   }
   CreateBuffer();
   if (Z_NO_COMPRESSION == lh->compression_method()) {
-    buffer_->ReadEntryContents(lh);
-  } else if (Z_DEFLATED == lh->compression_method()) {
-    if (!inflater_.get()) {
-      inflater_.reset(new Inflater());
+    if (by_reference) {
+      buffer_->ReferenceEntryContents(lh, mapping);
+    } else {
+      buffer_->ReadEntryContents(lh);
     }
-    buffer_->DecompressEntryContents(cdh, lh, inflater_.get());
+  } else if (Z_DEFLATED == lh->compression_method()) {
+    buffer_->DecompressEntryContents(cdh, lh, ThreadInflater());
   } else {
     errx(2, "%s is neither stored nor deflated", filename_.c_str());
   }
@@ -143,3 +157,85 @@ PropertyCombiner::~PropertyCombiner() {}
 bool PropertyCombiner::Merge(const CDH *cdh, const LH *lh) {
   return false;  // This should not be called.
 }
+
+void *PropertyCombiner::OutputEntry(bool compress) {
+  std::vector<size_t> order(properties_.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+    return properties_[a].first < properties_[b].first;
+  });
+  Concatenator concatenator(filename_, false);
+  for (size_t i : order) {
+    concatenator.Append(properties_[i].first);
+    concatenator.Append("=", 1);
+    concatenator.Append(properties_[i].second);
+    concatenator.Append("\n", 1);
+  }
+  return concatenator.OutputEntry(compress);
+}
+
+void PropertyCombiner::AddProperty(const char *key, size_t key_length,
+                                   const char *value, size_t value_length) {
+  std::pair<size_t *, bool> got =
+      index_.Emplace(key, key_length, properties_.size());
+  if (got.second) {
+    properties_.emplace_back(std::string(key, key_length),
+                             std::string(value, value_length));
+  } else {
+    properties_[*got.first].second.assign(value, value_length);
+  }
+}
+
+// Parses the lines the way java.util.Properties.load() does, except that
+// the escapes are kept as they are.
+void PropertyCombiner::AddProperties(const char *data, size_t data_size) {
+  const char *end = data + data_size;
+  auto is_blank = [](char c) { return c == ' ' || c == '\t' || c == '\f'; };
+  auto is_eol = [](char c) { return c == '\n' || c == '\r'; };
+  const char *p = data;
+  while (p < end) {
+    while (p < end && (is_blank(*p) || is_eol(*p))) {
+      ++p;
+    }
+    if (p == end) {
+      break;
+    }
+    if (*p == '#' || *p == '!') {
+      while (p < end && !is_eol(*p)) {
+        ++p;
+      }
+      continue;
+    }
+    // The key ends with the first unescaped separator or blank.
+    const char *key = p;
+    while (p < end && !is_eol(*p) && !is_blank(*p) && *p != '=' &&
+           *p != ':') {
+      p += (*p == '\\' && p + 1 < end) ? 2 : 1;
+    }
+    const char *key_end = p;
+    while (p < end && is_blank(*p)) {
+      ++p;
+    }
+    if (p < end && (*p == '=' || *p == ':')) {
+      ++p;
+      while (p < end && is_blank(*p)) {
+        ++p;
+      }
+    }
+    // The value runs to the end of the line, which may be continued by
+    // a trailing backslash.
+    const char *value = p;
+    while (p < end && !is_eol(*p)) {
+      if (*p == '\\' && p + 1 < end) {
+        if (p[1] == '\r' && p + 2 < end && p[2] == '\n') {
+          ++p;
+        }
+        ++p;
+      }
+      ++p;
+    }
+    AddProperty(key, key_end - key, value, p - value);
+  }
+}
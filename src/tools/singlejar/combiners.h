@@ -17,7 +17,10 @@
 
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
+#include "src/tools/singlejar/name_map.h"
 #include "src/tools/singlejar/transient_bytes.h"
 #include "src/tools/singlejar/zip_headers.h"
 
@@ -27,6 +30,13 @@ class Combiner {
   virtual ~Combiner();
   // Merges the contents of the given Zip entry to this instance.
   virtual bool Merge(const CDH *cdh, const LH *lh) = 0;
+  // Same, for an entry of an input jar whose mapping is held by `mapping'.
+  // A combiner may keep that to refer to the entry's data later rather than
+  // copy it now; a null `mapping' means the data outlive the combiner.
+  virtual bool MergeMapped(const CDH *cdh, const LH *lh,
+                           const std::shared_ptr<const void> &mapping) {
+    return Merge(cdh, lh);
+  }
   // Returns a point to the buffer containing Local Header followed by the
   // payload. The caller is responsible of freeing the buffer. If `compress'
   // is not set, the payload is a copy of the bytes held by this combiner.
@@ -46,6 +56,10 @@ class Concatenator : public Combiner {
 
   bool Merge(const CDH *cdh, const LH *lh) override;
 
+  // Stored entries are kept by reference.
+  bool MergeMapped(const CDH *cdh, const LH *lh,
+                   const std::shared_ptr<const void> &mapping) override;
+
   void *OutputEntry(bool compress) override;
 
   void Append(const char *s, size_t n) {
@@ -57,6 +71,14 @@ class Concatenator : public Combiner {
 
   void Append(const std::string &str) { Append(str.c_str(), str.size()); }
 
+  // Appends the "n" bytes at "s" by reference, which "owner" keeps, see
+  // TransientBytes::AppendReference().
+  void AppendReference(const char *s, size_t n,
+                       const std::shared_ptr<const void> &owner) {
+    CreateBuffer();
+    buffer_->AppendReference(reinterpret_cast<const uint8_t *>(s), n, owner);
+  }
+
   const std::string &filename() const { return filename_; }
 
  private:
@@ -65,9 +87,11 @@ class Concatenator : public Combiner {
       buffer_.reset(new TransientBytes());
     }
   }
+  // Merges the entry, by reference if `by_reference' is set and it is stored.
+  bool MergeEntry(const CDH *cdh, const LH *lh, bool by_reference,
+                  const std::shared_ptr<const void> &mapping);
   const std::string filename_;
   std::unique_ptr<TransientBytes> buffer_;
-  std::unique_ptr<Inflater> inflater_;
   bool insert_newlines_;
 };
 
@@ -102,32 +126,44 @@ class XmlCombiner : public Combiner {
   std::unique_ptr<Inflater> inflater_;
 };
 
-// A wrapper around Concatenator allowing to append
-//   NAME=VALUE
-// lines to the contents.
+// Collects NAME=VALUE properties and outputs them sorted by name, one
+// per line. A property added more than once keeps the last value, as it
+// would if the file were loaded by java.util.Properties. The properties are
+// kept as they are written (e.g., the escapes are not interpreted), so the
+// output is the same for the same set of properties, in any order.
 // NOTE that it does not allow merging existing entries.
-class PropertyCombiner : public Concatenator {
+class PropertyCombiner : public Combiner {
  public:
-  PropertyCombiner(const std::string &filename) : Concatenator(filename) {}
-  ~PropertyCombiner();
+  PropertyCombiner(const std::string &filename) : filename_(filename) {}
+  ~PropertyCombiner() override;
 
   bool Merge(const CDH *cdh, const LH *lh) override;
 
+  void *OutputEntry(bool compress) override;
+
+  void AddProperty(const char *key, size_t key_length, const char *value,
+                   size_t value_length);
+
   void AddProperty(const char *key, const char *value) {
-    // TODO(asmundak): deduplicate properties.
-    Append(key);
-    Append("=", 1);
-    Append(value);
-    Append("\n", 1);
+    AddProperty(key, strlen(key), value, strlen(value));
   }
 
   void AddProperty(const std::string &key, const std::string &value) {
-    // TODO(asmundak): deduplicate properties.
-    Append(key);
-    Append("=", 1);
-    Append(value);
-    Append("\n", 1);
+    AddProperty(key.c_str(), key.size(), value.c_str(), value.size());
   }
+
+  // Adds the properties from the contents of a properties file, skipping
+  // the comments and the blank lines.
+  void AddProperties(const char *data, size_t data_size);
+
+  const std::string &filename() const { return filename_; }
+
+ private:
+  const std::string filename_;
+  // The properties in the order they were first added, and the index of
+  // each one by name.
+  std::vector<std::pair<std::string, std::string> > properties_;
+  NameMap<size_t> index_;
 };
 
 #endif  //  SRC_TOOLS_SINGLEJAR_COMBINERS_H_
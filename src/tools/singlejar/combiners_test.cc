@@ -243,4 +243,37 @@ TEST_F(CombinersTest, PropertyCombiner) {
   free(reinterpret_cast<void *>(entry));
 }
 
+// PropertyCombiner sorts the properties and keeps the last value of each.
+TEST_F(CombinersTest, PropertyCombinerDeduplicates) {
+  static const char kPropertiesFile[] =
+      "# comment\n"
+      "  ! another comment\n"
+      "\n"
+      "zeta = last\r\n"
+      "alpha:1\n"
+      "key\\=with\\:separators = value\n"
+      "long=line1\\\n"
+      "    line2\n"
+      "empty\n"
+      "alpha\t2";
+  PropertyCombiner property_combiner("properties");
+  property_combiner.AddProperty("zeta", "first");
+  property_combiner.AddProperties(kPropertiesFile, strlen(kPropertiesFile));
+  property_combiner.AddProperty(string("beta"), string("b"));
+
+  LH *entry = reinterpret_cast<LH *>(property_combiner.OutputEntry(false));
+  ASSERT_NE(nullptr, entry);
+  EXPECT_EQ(
+      "alpha=2\n"
+      "beta=b\n"
+      "empty=\n"
+      "key\\=with\\:separators=value\n"
+      "long=line1\\\n"
+      "    line2\n"
+      "zeta=last\n",
+      string(reinterpret_cast<char *>(entry->data()),
+             entry->uncompressed_file_size()));
+  free(reinterpret_cast<void *>(entry));
+}
+
 }  // namespace
@@ -0,0 +1,129 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/tools/singlejar/compression_policy.h"
+
+#include <ctype.h>
+#include <math.h>
+
+#include <algorithm>
+
+const size_t CompressionPolicy::kSampleBytes;
+const size_t CompressionPolicy::kMinSampleBytes;
+constexpr double CompressionPolicy::kIncompressibleBits;
+
+namespace {
+
+const char *const kDefaultSuffixes[] = {
+    // Images, audio and video.
+    ".png", ".jpg", ".jpeg", ".gif", ".webp", ".mp3", ".ogg", ".mp4",
+    // Archives.
+    ".gz", ".tgz", ".bz2", ".xz", ".zst", ".7z", ".zip", ".jar", ".aar",
+    ".apk",
+};
+
+}  // namespace
+
+CompressionPolicy::CompressionPolicy() : enabled_(true) {
+  for (const char *suffix : kDefaultSuffixes) {
+    suffixes_.push_back(suffix);
+  }
+}
+
+void CompressionPolicy::AddSuffixes(const std::vector<std::string> &suffixes) {
+  for (auto &suffix : suffixes) {
+    if (!suffix.empty()) {
+      suffixes_.push_back(suffix);
+    }
+  }
+}
+
+void CompressionPolicy::AddPrefixes(const std::vector<std::string> &prefixes) {
+  for (auto &prefix : prefixes) {
+    if (!prefix.empty()) {
+      prefixes_.push_back(prefix);
+    }
+  }
+  prefix_matcher_ = PrefixMatcher(prefixes_);
+}
+
+bool CompressionPolicy::MatchesSuffix(const char *name,
+                                      size_t name_length) const {
+  for (auto &suffix : suffixes_) {
+    if (suffix.size() > name_length) {
+      continue;
+    }
+    const char *tail = name + name_length - suffix.size();
+    size_t i = 0;
+    while (i < suffix.size() &&
+           tolower(static_cast<unsigned char>(tail[i])) ==
+               tolower(static_cast<unsigned char>(suffix[i]))) {
+      ++i;
+    }
+    if (i == suffix.size()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CompressionPolicy::ShouldCompress(const char *name, size_t name_length,
+                                       const uint8_t *data,
+                                       size_t size) const {
+  if (!enabled_) {
+    return true;
+  }
+  if (MatchesSuffix(name, name_length) ||
+      (!prefix_matcher_.empty() && prefix_matcher_.Matches(name, name_length))) {
+    return false;
+  }
+  return size < kMinSampleBytes ||
+         SampleEntropy(data, size) < kIncompressibleBits;
+}
+
+double CompressionPolicy::SampleEntropy(const uint8_t *data, size_t size) {
+  size = std::min(size, kSampleBytes);
+  if (size == 0) {
+    return 0;
+  }
+  size_t counts[256] = {};
+  for (size_t i = 0; i < size; ++i) {
+    ++counts[data[i]];
+  }
+  double entropy = 0;
+  for (size_t count : counts) {
+    if (count) {
+      double p = static_cast<double>(count) / size;
+      entropy -= p * log2(p);
+    }
+  }
+  return entropy;
+}
+
+std::string CompressionPolicy::Describe() const {
+  if (!enabled_) {
+    return "-";
+  }
+  std::string description = "s";
+  for (auto &suffix : suffixes_) {
+    description += '\n';
+    description += suffix;
+  }
+  description += "\np";
+  for (auto &prefix : prefixes_) {
+    description += '\n';
+    description += prefix;
+  }
+  return description;
+}
@@ -0,0 +1,78 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_TOOLS_SINGLEJAR_COMPRESSION_POLICY_H_
+#define SRC_TOOLS_SINGLEJAR_COMPRESSION_POLICY_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "src/tools/singlejar/prefix_matcher.h"
+
+/*
+ * Decides whether a stored entry is worth deflating with --compression,
+ * before any compression work is done. Entries whose names end with one of
+ * the suffixes (compared ignoring ASCII case) or begin with one of the
+ * prefixes are left stored, and so are those whose first few KB look random:
+ * images, archives and other data compressed already, which deflate does not
+ * shrink.
+ */
+class CompressionPolicy {
+ public:
+  // Bytes sampled from the beginning of an entry, and the fewest an entry
+  // has to have to be sampled at all: the entropy of a short sample says
+  // little, and deflating a short entry costs little.
+  static const size_t kSampleBytes = 4096;
+  static const size_t kMinSampleBytes = 1024;
+
+  // A sample with at least this many bits of information in a byte is
+  // considered incompressible; deflate needs some redundancy to gain anything.
+  static constexpr double kIncompressibleBits = 7.5;
+
+  // Starts with the suffixes of the common compressed formats.
+  CompressionPolicy();
+
+  void AddSuffixes(const std::vector<std::string> &suffixes);
+  void AddPrefixes(const std::vector<std::string> &prefixes);
+
+  // Without the policy every stored entry is deflated.
+  void set_enabled(bool enabled) { enabled_ = enabled; }
+  bool enabled() const { return enabled_; }
+
+  // True if the name matches none of the suffixes and prefixes and the
+  // stored data, 'size' bytes at 'data', does not look incompressible.
+  bool ShouldCompress(const char *name, size_t name_length,
+                      const uint8_t *data, size_t size) const;
+
+  // Returns the Shannon entropy of the first kSampleBytes bytes at 'data'
+  // (or all of them if there are fewer), in bits per byte.
+  static double SampleEntropy(const uint8_t *data, size_t size);
+
+  // A string that differs for the policies deciding differently, for the
+  // digest of the options of an incremental build.
+  std::string Describe() const;
+
+ private:
+  bool MatchesSuffix(const char *name, size_t name_length) const;
+
+  bool enabled_;
+  std::vector<std::string> suffixes_;
+  std::vector<std::string> prefixes_;
+  PrefixMatcher prefix_matcher_;
+};
+
+#endif  // SRC_TOOLS_SINGLEJAR_COMPRESSION_POLICY_H_
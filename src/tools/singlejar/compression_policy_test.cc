@@ -0,0 +1,121 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "src/tools/singlejar/compression_policy.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// Pseudo-random bytes, the same on every run.
+std::vector<uint8_t> RandomBytes(size_t size) {
+  std::vector<uint8_t> bytes(size);
+  uint32_t seed = 12345;
+  for (auto &byte : bytes) {
+    seed = seed * 1103515245 + 12345;
+    byte = static_cast<uint8_t>(seed >> 24);
+  }
+  return bytes;
+}
+
+std::vector<uint8_t> TextBytes(size_t size) {
+  std::vector<uint8_t> bytes;
+  for (int i = 0; bytes.size() < size; ++i) {
+    std::string line = "line " + std::to_string(i) + "\n";
+    bytes.insert(bytes.end(), line.begin(), line.end());
+  }
+  bytes.resize(size);
+  return bytes;
+}
+
+bool ShouldCompress(const CompressionPolicy &policy, const char *name,
+                    const std::vector<uint8_t> &data) {
+  return policy.ShouldCompress(name, strlen(name), data.data(), data.size());
+}
+
+TEST(CompressionPolicyTest, Entropy) {
+  std::vector<uint8_t> zeroes(10000);
+  EXPECT_EQ(0, CompressionPolicy::SampleEntropy(zeroes.data(), 0));
+  EXPECT_EQ(0, CompressionPolicy::SampleEntropy(zeroes.data(), zeroes.size()));
+  std::vector<uint8_t> all_bytes;
+  for (int i = 0; i < 4096; ++i) {
+    all_bytes.push_back(static_cast<uint8_t>(i));
+  }
+  EXPECT_DOUBLE_EQ(8, CompressionPolicy::SampleEntropy(all_bytes.data(),
+                                                       all_bytes.size()));
+  // Only the first kSampleBytes count.
+  all_bytes.resize(10000);
+  EXPECT_DOUBLE_EQ(8, CompressionPolicy::SampleEntropy(all_bytes.data(),
+                                                       all_bytes.size()));
+  std::vector<uint8_t> random = RandomBytes(4096);
+  EXPECT_LT(CompressionPolicy::kIncompressibleBits,
+            CompressionPolicy::SampleEntropy(random.data(), random.size()));
+  std::vector<uint8_t> text = TextBytes(4096);
+  EXPECT_GT(CompressionPolicy::kIncompressibleBits,
+            CompressionPolicy::SampleEntropy(text.data(), text.size()));
+}
+
+TEST(CompressionPolicyTest, Defaults) {
+  CompressionPolicy policy;
+  std::vector<uint8_t> text = TextBytes(10000);
+  EXPECT_TRUE(ShouldCompress(policy, "a/b.class", text));
+  EXPECT_TRUE(ShouldCompress(policy, "a/b.txt", text));
+  EXPECT_FALSE(ShouldCompress(policy, "a/b.png", text));
+  EXPECT_FALSE(ShouldCompress(policy, "a/b.PNG", text));
+  EXPECT_FALSE(ShouldCompress(policy, "lib/c.jar", text));
+  EXPECT_FALSE(ShouldCompress(policy, ".gz", text));
+  EXPECT_TRUE(ShouldCompress(policy, "gz", text));
+  EXPECT_TRUE(ShouldCompress(policy, "a/b.png.txt", text));
+  // The name does not have to be null-terminated.
+  EXPECT_TRUE(policy.ShouldCompress("a.png.txt", 8, text.data(), text.size()));
+}
+
+TEST(CompressionPolicyTest, Sample) {
+  CompressionPolicy policy;
+  std::vector<uint8_t> random = RandomBytes(10000);
+  EXPECT_FALSE(ShouldCompress(policy, "a/b.bin", random));
+  // Too short to be sampled.
+  random.resize(CompressionPolicy::kMinSampleBytes - 1);
+  EXPECT_TRUE(ShouldCompress(policy, "a/b.bin", random));
+}
+
+TEST(CompressionPolicyTest, Added) {
+  CompressionPolicy policy;
+  std::string before = policy.Describe();
+  policy.AddSuffixes({".so", ""});
+  policy.AddPrefixes({"assets/", ""});
+  EXPECT_NE(before, policy.Describe());
+  std::vector<uint8_t> text = TextBytes(10000);
+  EXPECT_FALSE(ShouldCompress(policy, "lib/x86/libfoo.so", text));
+  EXPECT_FALSE(ShouldCompress(policy, "assets/a.txt", text));
+  EXPECT_FALSE(ShouldCompress(policy, "a.png", text));
+  EXPECT_TRUE(ShouldCompress(policy, "b/assets/a.txt", text));
+  EXPECT_TRUE(ShouldCompress(policy, "a.txt", text));
+}
+
+TEST(CompressionPolicyTest, Disabled) {
+  CompressionPolicy policy;
+  policy.set_enabled(false);
+  EXPECT_FALSE(policy.enabled());
+  EXPECT_TRUE(ShouldCompress(policy, "a.png", TextBytes(10000)));
+  EXPECT_TRUE(ShouldCompress(policy, "a.bin", RandomBytes(10000)));
+  EXPECT_NE(CompressionPolicy().Describe(), policy.Describe());
+}
+
+}  // namespace
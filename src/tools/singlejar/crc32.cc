@@ -0,0 +1,28 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/tools/singlejar/crc32.h"
+
+#include <zlib.h>
+
+uint32_t ComputeCrc32(uint32_t crc, const uint8_t *data, size_t size) {
+  // zlib's crc32 takes 32-bit length.
+  while (size > 0) {
+    uInt chunk_size = size > 0x40000000 ? 0x40000000 : size;
+    crc = crc32(crc, data, chunk_size);
+    data += chunk_size;
+    size -= chunk_size;
+  }
+  return crc;
+}
@@ -0,0 +1,26 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_TOOLS_SINGLEJAR_CRC32_H_
+#define SRC_TOOLS_SINGLEJAR_CRC32_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Updates the running Zip (IEEE 802.3) CRC-32 checksum with given bytes.
+// Same as zlib's crc32(), which folds the data with carry-less
+// multiplication on the CPUs that support it, but for any size.
+uint32_t ComputeCrc32(uint32_t crc, const uint8_t *data, size_t size);
+
+#endif  // SRC_TOOLS_SINGLEJAR_CRC32_H_
@@ -0,0 +1,67 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+
+#include <vector>
+
+#include "src/tools/singlejar/crc32.h"
+#include "gtest/gtest.h"
+
+
+namespace {
+
+// The CRC-32, one bit at a time.
+uint32_t BitwiseCrc32(uint32_t crc, const uint8_t *data, size_t size) {
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320 : 0);
+    }
+  }
+  return ~crc;
+}
+
+TEST(Crc32Test, KnownValues) {
+  EXPECT_EQ(0, ComputeCrc32(0, nullptr, 0));
+  const char kCheck[] = "123456789";
+  EXPECT_EQ(0xCBF43926,
+            ComputeCrc32(0, reinterpret_cast<const uint8_t *>(kCheck), 9));
+}
+
+// Matches the bitwise CRC-32 for all the sizes around the block boundaries
+// of the folding done by zlib, for any alignment, and when the checksum is
+// computed piecemeal.
+TEST(Crc32Test, MatchesBitwiseCrc32) {
+  std::vector<uint8_t> data(4096 + 16);
+  srand(42);
+  for (auto &byte : data) {
+    byte = static_cast<uint8_t>(rand());
+  }
+  for (size_t offset = 0; offset < 16; offset += 5) {
+    for (size_t size = 0; size <= 4096; size += (size < 300 ? 1 : 61)) {
+      const uint8_t *start = data.data() + offset;
+      uint32_t expected = BitwiseCrc32(0, start, size);
+      ASSERT_EQ(expected, ComputeCrc32(0, start, size))
+          << "offset " << offset << ", size " << size;
+      size_t half = size / 2;
+      ASSERT_EQ(expected, ComputeCrc32(ComputeCrc32(0, start, half),
+                                       start + half, size - half))
+          << "offset " << offset << ", size " << size;
+    }
+  }
+}
+
+}  // namespace
@@ -25,6 +25,29 @@
 #define diag_errx(...) errx(__VA_ARGS__)
 #define diag_warn(...) warn(__VA_ARGS__)
 #define diag_warnx(...) warnx(__VA_ARGS__)
+#elif defined(_WIN32)
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// There is no err.h, these follow its output format minus the program name.
+#define diag_err(eval, fmt, ...)                                               \
+  do {                                                                         \
+    int diag_errno = errno;                                                    \
+    fprintf(stderr, fmt ": %s\n", ##__VA_ARGS__, strerror(diag_errno));        \
+    exit(eval);                                                                \
+  } while (0)
+#define diag_errx(eval, fmt, ...)                                              \
+  do {                                                                         \
+    fprintf(stderr, fmt "\n", ##__VA_ARGS__);                                  \
+    exit(eval);                                                                \
+  } while (0)
+#define diag_warn(fmt, ...)                                                    \
+  do {                                                                         \
+    int diag_errno = errno;                                                    \
+    fprintf(stderr, fmt ": %s\n", ##__VA_ARGS__, strerror(diag_errno));        \
+  } while (0)
+#define diag_warnx(fmt, ...) fprintf(stderr, fmt "\n", ##__VA_ARGS__)
 #else
 #error Unknown platform
 #endif
@@ -0,0 +1,94 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/tools/singlejar/incremental_index.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+static const char kIndexHeader[] = "singlejar-index 1\n";
+
+const uint64_t IncrementalIndex::kDigestSeed;
+
+bool IncrementalIndex::Read(const std::string &path) {
+  jars_.clear();
+  jar_by_digest_.clear();
+  FILE *file = fopen(path.c_str(), "r");
+  if (file == nullptr) {
+    return false;
+  }
+  char header[sizeof(kIndexHeader)];
+  bool ok = fgets(header, sizeof(header), file) != nullptr &&
+            std::string(header) == kIndexHeader &&
+            fscanf(file, "options %" SCNx64 "\n", &options_digest_) == 1 &&
+            fscanf(file, "output %" SCNx64 "\n", &output_digest_) == 1;
+  JarRecord record;
+  while (ok) {
+    int fields = fscanf(file, "jar %" SCNx64 " %" SCNu64 " %" SCNu64
+                        " %zu %zu\n",
+                        &record.digest, &record.offset, &record.size,
+                        &record.first_entry, &record.entry_count);
+    if (fields == EOF) {
+      break;
+    }
+    ok = (fields == 5);
+    if (ok) {
+      AddJar(record);
+    }
+  }
+  ok = ok && !ferror(file);
+  fclose(file);
+  if (!ok) {
+    jars_.clear();
+    jar_by_digest_.clear();
+  }
+  return ok;
+}
+
+bool IncrementalIndex::Write(const std::string &path) const {
+  FILE *file = fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    return false;
+  }
+  fputs(kIndexHeader, file);
+  fprintf(file, "options %016" PRIx64 "\n", options_digest_);
+  fprintf(file, "output %016" PRIx64 "\n", output_digest_);
+  for (auto &record : jars_) {
+    fprintf(file, "jar %016" PRIx64 " %" PRIu64 " %" PRIu64 " %zu %zu\n",
+            record.digest, record.offset, record.size, record.first_entry,
+            record.entry_count);
+  }
+  bool ok = !ferror(file);
+  return fclose(file) == 0 && ok;
+}
+
+void IncrementalIndex::AddJar(const JarRecord &record) {
+  jar_by_digest_.emplace(record.digest, jars_.size());
+  jars_.push_back(record);
+}
+
+const IncrementalIndex::JarRecord *IncrementalIndex::FindJar(
+    uint64_t digest) const {
+  auto it = jar_by_digest_.find(digest);
+  return it == jar_by_digest_.end() ? nullptr : &jars_[it->second];
+}
+
+uint64_t IncrementalIndex::Digest(uint64_t digest, const void *data,
+                                  size_t size) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  for (const uint8_t *end = bytes + size; bytes < end; ++bytes) {
+    digest = (digest ^ *bytes) * 1099511628211ULL;
+  }
+  return digest;
+}
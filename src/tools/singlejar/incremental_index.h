@@ -0,0 +1,95 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_TOOLS_SINGLEJAR_INCREMENTAL_INDEX_H_
+#define SRC_TOOLS_SINGLEJAR_INCREMENTAL_INDEX_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * The sidecar of an output jar written with --incremental_base. It tells
+ * which byte range and which Central Directory entries of the output jar
+ * came from each input jar, so that the next run can copy them from the
+ * previous output instead of processing the input jar's entries again.
+ *
+ * An input jar is identified by the digest of its Central Directory
+ * records, which contain the names, sizes, checksums and timestamps of all
+ * its entries. The index also records the digest of the options affecting
+ * the output entries' contents and the digest of the output jar's own
+ * Central Directory, so that a stale or mismatched index is never used.
+ *
+ * The index is a text file:
+ *   singlejar-index 1
+ *   options <options digest>
+ *   output <output Central Directory digest>
+ *   jar <digest> <offset> <size> <first entry> <entry count>
+ *   ...
+ */
+class IncrementalIndex {
+ public:
+  // What an input jar contributed to the output jar.
+  struct JarRecord {
+    uint64_t digest;     // Digest of the input jar's Central Directory.
+    uint64_t offset;     // Output offset of the first entry's local header.
+    uint64_t size;       // Total size of the entries in the output.
+    size_t first_entry;  // The index of the first entry in the output CD.
+    size_t entry_count;
+  };
+
+  IncrementalIndex() : options_digest_(0), output_digest_(0) {}
+
+  // Returns the path of the index file for given output jar.
+  static std::string IndexPath(const std::string &output_jar) {
+    return output_jar + ".index";
+  }
+
+  // Reads the index from given file. Returns false if the file does not
+  // exist or is malformed, in which case the index is empty.
+  bool Read(const std::string &path);
+
+  // Writes the index to given file, returns true on success.
+  bool Write(const std::string &path) const;
+
+  // Appends the record for an input jar. The record added first wins if
+  // several input jars have the same digest.
+  void AddJar(const JarRecord &record);
+
+  // Returns the record for the input jar with given digest or nullptr.
+  const JarRecord *FindJar(uint64_t digest) const;
+
+  // Updates the running digest with given bytes (64-bit FNV-1a).
+  static uint64_t Digest(uint64_t digest, const void *data, size_t size);
+
+  // The initial value of the digest.
+  static const uint64_t kDigestSeed = 14695981039346656037ULL;
+
+  uint64_t options_digest() const { return options_digest_; }
+  void options_digest(uint64_t v) { options_digest_ = v; }
+  uint64_t output_digest() const { return output_digest_; }
+  void output_digest(uint64_t v) { output_digest_ = v; }
+  const std::vector<JarRecord> &jars() const { return jars_; }
+
+ private:
+  uint64_t options_digest_;
+  uint64_t output_digest_;
+  std::vector<JarRecord> jars_;
+  std::unordered_map<uint64_t, size_t> jar_by_digest_;
+};
+
+#endif  //  SRC_TOOLS_SINGLEJAR_INCREMENTAL_INDEX_H_
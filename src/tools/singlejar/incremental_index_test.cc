@@ -0,0 +1,86 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "src/tools/singlejar/incremental_index.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// Returns the path of a file in the test's temporary directory.
+std::string TempPath(const char *name) {
+  const char *tmpdir = getenv("TEST_TMPDIR");
+  return std::string(tmpdir ? tmpdir : "/tmp") + "/" + name;
+}
+
+TEST(IncrementalIndexTest, WriteAndRead) {
+  IncrementalIndex index;
+  index.options_digest(0x123456789abcdef0ULL);
+  index.output_digest(42);
+  index.AddJar(IncrementalIndex::JarRecord{0xfedcba9876543210ULL, 100, 200,
+                                           2, 5});
+  index.AddJar(IncrementalIndex::JarRecord{7, 300, 0, 7, 0});
+  // The first record with given digest wins.
+  index.AddJar(IncrementalIndex::JarRecord{7, 300, 10, 7, 1});
+  std::string path = TempPath("index");
+  ASSERT_TRUE(index.Write(path));
+
+  IncrementalIndex read;
+  ASSERT_TRUE(read.Read(path));
+  EXPECT_EQ(0x123456789abcdef0ULL, read.options_digest());
+  EXPECT_EQ(42, read.output_digest());
+  ASSERT_EQ(3, read.jars().size());
+  const IncrementalIndex::JarRecord *record =
+      read.FindJar(0xfedcba9876543210ULL);
+  ASSERT_NE(nullptr, record);
+  EXPECT_EQ(100, record->offset);
+  EXPECT_EQ(200, record->size);
+  EXPECT_EQ(2, record->first_entry);
+  EXPECT_EQ(5, record->entry_count);
+  record = read.FindJar(7);
+  ASSERT_NE(nullptr, record);
+  EXPECT_EQ(0, record->entry_count);
+  EXPECT_EQ(nullptr, read.FindJar(8));
+}
+
+TEST(IncrementalIndexTest, BadIndex) {
+  IncrementalIndex index;
+  EXPECT_FALSE(index.Read(TempPath("no_such_index")));
+  std::string path = TempPath("bad_index");
+  FILE *file = fopen(path.c_str(), "w");
+  ASSERT_NE(nullptr, file);
+  fputs("singlejar-index 1\noptions 1\noutput 2\njar 3 4\n", file);
+  fclose(file);
+  EXPECT_FALSE(index.Read(path));
+  EXPECT_TRUE(index.jars().empty());
+}
+
+TEST(IncrementalIndexTest, Digest) {
+  EXPECT_EQ(IncrementalIndex::kDigestSeed,
+            IncrementalIndex::Digest(IncrementalIndex::kDigestSeed, "", 0));
+  // Digesting piecemeal is the same as digesting at once.
+  EXPECT_EQ(IncrementalIndex::Digest(IncrementalIndex::kDigestSeed, "abcd", 4),
+            IncrementalIndex::Digest(
+                IncrementalIndex::Digest(IncrementalIndex::kDigestSeed, "ab",
+                                         2),
+                "cd", 2));
+  EXPECT_NE(IncrementalIndex::Digest(IncrementalIndex::kDigestSeed, "ab", 2),
+            IncrementalIndex::Digest(IncrementalIndex::kDigestSeed, "ba", 2));
+}
+
+}  // namespace
@@ -14,12 +14,13 @@
 
 #include "src/tools/singlejar/input_jar.h"
 
-bool InputJar::Open(const std::string &path) {
+bool InputJar::Open(const std::string &path, bool use_index,
+                    MappedFile::Mode mode) {
   if (!path_.empty()) {
     diag_errx(1, "%s:%d: This instance is already handling %s\n", __FILE__,
               __LINE__, path_.c_str());
   }
-  if (!mapped_file_.Open(path)) {
+  if (!mapped_file_.Open(path, mode)) {
     diag_warn("%s:%d: Cannot open input jar %s", __FILE__, __LINE__,
               path.c_str());
     mapped_file_.Close();
@@ -34,6 +35,17 @@ bool InputJar::Open(const std::string &path) {
     return false;
   }
 
+  if (use_index &&
+      index_.Open(InputJarIndex::IndexPath(path), mapped_file_.start(),
+                  mapped_file_.size())) {
+    indexed_ = true;
+    cen_offset_ = index_.header().cen_offset;
+    preamble_size_ = index_.header().preamble_size;
+    cdh_ = CentralDirectoryRecordAt(cen_offset_);
+    path_ = path;
+    return true;
+  }
+
   // Now locate End of Central Directory (ECD) record.
   auto ecd_min = mapped_file_.end() - 65536 - sizeof(ECD);
   if (ecd_min < mapped_file_.start()) {
@@ -143,11 +155,18 @@ bool InputJar::Open(const std::string &path) {
       return false;
     }
   }
+  cen_offset_ = mapped_file_.offset(cdh_);
+  // The Central Directory is walked right away, have it read in one go
+  // rather than fault it in page by page.
+  mapped_file_.Advise(cen_offset_, mapped_file_.size() - cen_offset_,
+                      MADV_WILLNEED);
   path_ = path;
   return true;
 }
 
 bool InputJar::Close() {
+  index_.Close();
+  indexed_ = false;
   mapped_file_.Close();
   path_.clear();
   return true;
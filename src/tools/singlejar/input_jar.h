@@ -21,6 +21,7 @@
 #include <string>
 
 #include "src/tools/singlejar/diag.h"
+#include "src/tools/singlejar/input_jar_index.h"
 #include "src/tools/singlejar/mapped_file.h"
 #include "src/tools/singlejar/zip_headers.h"
 
@@ -37,14 +38,23 @@
  */
 class InputJar {
  public:
-  InputJar() {}
+  InputJar() : indexed_(false) {}
 
   ~InputJar() { Close(); }
 
   int fd() const { return mapped_file_.fd(); }
 
-  // Opens the file, memory maps it and locates Central Directory.
-  bool Open(const std::string& path);
+  // Opens the file, memory maps it and locates Central Directory. If
+  // `use_index' is set and the jar has a valid index, the Central Directory
+  // location is taken from it, and index() returns it. `mode' tells how
+  // the jar is brought into memory, see MappedFile::Mode.
+  bool Open(const std::string& path, bool use_index = false,
+            MappedFile::Mode mode = MappedFile::kMap);
+
+  // The index of this jar, or nullptr.
+  const InputJarIndex *index() const {
+    return indexed_ ? &index_ : nullptr;
+  }
 
   // Returns the next Central Directory Header or NULL.
   const CDH *NextEntry(const LH **local_header_ptr) {
@@ -86,11 +96,27 @@ class InputJar {
     return mapped_file_.offset(lh);
   }
 
+  // The headers at given file offsets, as recorded in the index.
+  const CDH *CentralDirectoryRecordAt(uint64_t offset) const {
+    return reinterpret_cast<const CDH *>(mapped_file_.address(offset));
+  }
+  const LH *LocalHeaderAt(uint64_t offset) const {
+    return reinterpret_cast<const LH *>(mapped_file_.address(offset));
+  }
+
+  // The file offset of the first Central Directory Header.
+  uint64_t CentralDirectoryOffset() const { return cen_offset_; }
+  uint64_t preamble_size() const { return preamble_size_; }
+  const MappedFile &mapped_file() const { return mapped_file_; }
+
  private:
   std::string path_;
   MappedFile mapped_file_;
   const CDH *cdh_;  // current directory entry
+  uint64_t cen_offset_;  // File offset of the first directory entry.
   uint64_t preamble_size_;  // Bytes before the Zip proper.
+  InputJarIndex index_;
+  bool indexed_;
 };
 
 #endif  //  BAZEL_SRC_TOOLS_SINGLEJAR_INPUT_JAR_H_
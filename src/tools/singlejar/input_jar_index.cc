@@ -0,0 +1,85 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/tools/singlejar/input_jar_index.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "src/tools/singlejar/crc32.h"
+#include "src/tools/singlejar/zip_headers.h"
+
+const char InputJarIndex::kMagic[8] = {'S', 'J', 'I', 'N', 'D', 'E', 'X', '1'};
+
+uint32_t InputJarIndex::Checksum(const uint8_t *jar, size_t jar_size,
+                                 uint64_t cen_offset) {
+  return ComputeCrc32(0, jar + cen_offset, jar_size - cen_offset);
+}
+
+bool InputJarIndex::Write(const std::string &path, Header header,
+                          const std::vector<Record> &records) {
+  memcpy(header.magic, kMagic, sizeof(header.magic));
+  header.byte_order = kByteOrder;
+  header.entry_count = records.size();
+  FILE *file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            (records.empty() ||
+             fwrite(records.data(), sizeof(Record), records.size(), file) ==
+                 records.size());
+  return fclose(file) == 0 && ok;
+}
+
+bool InputJarIndex::Open(const std::string &path, const uint8_t *jar,
+                         size_t jar_size) {
+  // Most jars have no index, do not let MappedFile complain about it.
+  struct stat st;
+  if (stat(path.c_str(), &st) || !mapped_file_.Open(path)) {
+    return false;
+  }
+  header_ = reinterpret_cast<const Header *>(mapped_file_.start());
+  records_ = reinterpret_cast<const Record *>(header_ + 1);
+  if (mapped_file_.size() < sizeof(Header) ||
+      memcmp(header_->magic, kMagic, sizeof(kMagic)) ||
+      header_->byte_order != kByteOrder || header_->jar_size != jar_size ||
+      header_->entry_count >
+          (mapped_file_.size() - sizeof(Header)) / sizeof(Record) ||
+      mapped_file_.size() !=
+          sizeof(Header) + header_->entry_count * sizeof(Record) ||
+      header_->cen_offset + sizeof(ECD) > jar_size) {
+    Close();
+    return false;
+  }
+  for (size_t i = 0; i < header_->entry_count; ++i) {
+    if (records_[i].cdh_offset + sizeof(CDH) > jar_size ||
+        records_[i].lh_offset + sizeof(LH) > jar_size) {
+      Close();
+      return false;
+    }
+  }
+  if (Checksum(jar, jar_size, header_->cen_offset) != header_->cen_crc32) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void InputJarIndex::Close() {
+  mapped_file_.Close();
+  header_ = nullptr;
+  records_ = nullptr;
+}
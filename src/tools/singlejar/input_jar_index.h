@@ -0,0 +1,94 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_TOOLS_SINGLEJAR_INPUT_JAR_INDEX_H_
+#define SRC_TOOLS_SINGLEJAR_INPUT_JAR_INDEX_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "src/tools/singlejar/mapped_file.h"
+
+/*
+ * The index of an input jar, written next to it (see IndexPath()) once by
+ * singlejar_index. It contains what scanning the jar yields: the location
+ * of the Central Directory and, for each entry, the offsets of its Central
+ * Directory Header and Local Header, the hash of its name and its name
+ * class. With the index, InputJar does not have to locate the Central
+ * Directory, and JarScanner does not have to walk it.
+ *
+ * The index is a Header followed by a Record per entry, in the native byte
+ * order (the header records it, an index with a different one is ignored).
+ * It is valid only for the jar whose size and the checksum of whose Central
+ * Directory it records, a stale index is ignored, too.
+ */
+class InputJarIndex {
+ public:
+  struct Header {
+    char magic[8];            // kMagic.
+    uint32_t byte_order;      // kByteOrder, in the native byte order.
+    uint32_t cen_crc32;       // CRC-32 of the jar from cen_offset to the end.
+    uint64_t jar_size;
+    uint64_t cen_offset;      // File offset of the first Central Directory
+                              // Header (or of the ECD if there are none).
+    uint64_t preamble_size;   // Bytes before the Zip proper.
+    uint64_t entry_count;
+  };
+
+  struct Record {
+    uint64_t cdh_offset;  // File offsets of the entry's headers.
+    uint64_t lh_offset;
+    uint32_t name_hash;   // NameHash() of the entry's name.
+    uint32_t name_class;  // JarScanner::Classify() of the entry's name.
+  };
+
+  static const char kMagic[8];
+  static const uint32_t kByteOrder = 0x01020304;
+
+  InputJarIndex() : header_(nullptr), records_(nullptr) {}
+
+  // Returns the path of the index of given jar.
+  static std::string IndexPath(const std::string &jar_path) {
+    return jar_path + ".sjindex";
+  }
+
+  // Returns the checksum of the part of the jar starting at cen_offset.
+  static uint32_t Checksum(const uint8_t *jar, size_t jar_size,
+                           uint64_t cen_offset);
+
+  // Writes an index, returns true on success. The magic and the byte order
+  // of the header are filled in.
+  static bool Write(const std::string &path, Header header,
+                    const std::vector<Record> &records);
+
+  // Maps the index from given file and verifies that it matches given jar
+  // contents. Returns false if there is no such file or it does not match.
+  bool Open(const std::string &path, const uint8_t *jar, size_t jar_size);
+
+  void Close();
+
+  const Header &header() const { return *header_; }
+  const Record *records() const { return records_; }
+  size_t size() const { return header_->entry_count; }
+
+ private:
+  MappedFile mapped_file_;
+  const Header *header_;
+  const Record *records_;
+};
+
+#endif  //  SRC_TOOLS_SINGLEJAR_INPUT_JAR_INDEX_H_
@@ -0,0 +1,217 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/tools/singlejar/jar_scanner.h"
+
+#include <string.h>
+
+// True if the name of given length ends with given string literal. The
+// length of the literal is known at compile time, so the comparison is
+// inlined.
+template <size_t N>
+static inline bool EndsWith(const char *name, size_t name_length,
+                            const char (&tail)[N]) {
+  return name_length >= N - 1 &&
+         !memcmp(name + name_length - (N - 1), tail, N - 1);
+}
+
+template <size_t N>
+static inline bool BeginsWith(const char *name, size_t name_length,
+                              const char (&head)[N]) {
+  return name_length >= N - 1 && !memcmp(name, head, N - 1);
+}
+
+JarScanner::JarScanner(const std::vector<std::string> &jar_paths,
+                       const PrefixMatcher &include_prefixes,
+                       int threads, MappedFile::Mode mode)
+    : jar_paths_(jar_paths),
+      include_prefixes_(include_prefixes),
+      mode_(mode),
+      scanned_(jar_paths.size()),
+      next_to_scan_(0),
+      next_to_get_(0),
+      max_ahead_(2 * threads),
+      stopping_(false) {
+  if (threads > 1) {
+    for (int i = 0; i < threads; ++i) {
+      workers_.emplace_back(&JarScanner::ScanLoop, this);
+    }
+  }
+}
+
+JarScanner::~JarScanner() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  retrieved_cond_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+std::unique_ptr<JarScanner::ScannedJar> JarScanner::Get(size_t jar_index) {
+  if (workers_.empty()) {
+    return Scan(jar_index);
+  }
+  std::unique_ptr<ScannedJar> scanned_jar;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    scanned_cond_.wait(lock, [this, jar_index] {
+      return scanned_[jar_index].get() != nullptr;
+    });
+    scanned_jar = std::move(scanned_[jar_index]);
+    next_to_get_ = jar_index + 1;
+  }
+  retrieved_cond_.notify_all();
+  return scanned_jar;
+}
+
+unsigned JarScanner::Classify(const char *file_name,
+                              size_t file_name_length) {
+  if (!file_name_length) {
+    return 0;
+  }
+  unsigned name_class = 0;
+  switch (file_name[file_name_length - 1]) {
+    case '/':
+      return kDirectory;
+    case 's':
+      if (EndsWith(file_name, file_name_length, ".class")) {
+        name_class = kClassFile;
+      }
+      break;
+    case 'F':
+      if (EndsWith(file_name, file_name_length, ".SF")) {
+        name_class = kSignature;
+      }
+      break;
+    case 'A':
+      if (EndsWith(file_name, file_name_length, ".RSA") ||
+          EndsWith(file_name, file_name_length, ".DSA")) {
+        name_class = kSignature;
+      }
+      break;
+  }
+  if (BeginsWith(file_name, file_name_length, "META-INF/services/")) {
+    name_class |= kService;
+  }
+  return name_class;
+}
+
+bool JarScanner::Accept(const char *file_name, size_t file_name_length,
+                        unsigned name_class,
+                        const PrefixMatcher &include_prefixes) {
+  // Let the writer report bad Central Directory records.
+  if (!file_name_length) {
+    return true;
+  }
+  // Ignore *.SF, *.RSA, *.DSA
+  // (TODO(asmundak): should this be done only in META-INF?
+  if (name_class & kSignature) {
+    return false;
+  }
+  return include_prefixes.Matches(file_name, file_name_length);
+}
+
+std::unique_ptr<JarScanner::ScannedJar> JarScanner::Scan(size_t jar_index) {
+  std::unique_ptr<ScannedJar> scanned_jar(new ScannedJar());
+  uint64_t start = MonotonicNanos();
+  InputJar &input_jar = scanned_jar->input_jar;
+  if (!input_jar.Open(jar_paths_[jar_index], true, mode_)) {
+    return scanned_jar;
+  }
+  scanned_jar->opened = true;
+  uint64_t opened = MonotonicNanos();
+  scanned_jar->open_nanos = opened - start;
+  if (const InputJarIndex *index = input_jar.index()) {
+    scanned_jar->indexed = true;
+    const InputJarIndex::Record *records = index->records();
+    for (size_t i = 0; i < index->size(); ++i) {
+      const CDH *jar_entry =
+          input_jar.CentralDirectoryRecordAt(records[i].cdh_offset);
+      if (Accept(jar_entry->file_name(), jar_entry->file_name_length(),
+                 records[i].name_class, include_prefixes_)) {
+        scanned_jar->entries.push_back(
+            Entry{jar_entry, input_jar.LocalHeaderAt(records[i].lh_offset),
+                  records[i].name_class, records[i].name_hash});
+      }
+    }
+  } else {
+    const CDH *jar_entry;
+    const LH *lh;
+    while ((jar_entry = input_jar.NextEntry(&lh))) {
+      const char *file_name = jar_entry->file_name();
+      size_t file_name_length = jar_entry->file_name_length();
+      unsigned name_class = Classify(file_name, file_name_length);
+      if (Accept(file_name, file_name_length, name_class, include_prefixes_)) {
+        scanned_jar->entries.push_back(
+            Entry{jar_entry, lh, name_class,
+                  NameHash(file_name, file_name_length)});
+      }
+    }
+  }
+  scanned_jar->scan_nanos = MonotonicNanos() - opened;
+  return scanned_jar;
+}
+
+bool JarScanner::WriteIndex(const std::string &jar_path,
+                            const std::string &index_path) {
+  InputJar input_jar;
+  if (!input_jar.Open(jar_path)) {
+    return false;
+  }
+  std::vector<InputJarIndex::Record> records;
+  const CDH *jar_entry;
+  const LH *lh;
+  while ((jar_entry = input_jar.NextEntry(&lh))) {
+    const char *file_name = jar_entry->file_name();
+    size_t file_name_length = jar_entry->file_name_length();
+    records.push_back(InputJarIndex::Record{
+        input_jar.CentralDirectoryRecordOffset(jar_entry),
+        input_jar.LocalHeaderOffset(lh), NameHash(file_name, file_name_length),
+        Classify(file_name, file_name_length)});
+  }
+  const MappedFile &mapped_file = input_jar.mapped_file();
+  InputJarIndex::Header header = {};
+  header.jar_size = mapped_file.size();
+  header.cen_offset = input_jar.CentralDirectoryOffset();
+  header.preamble_size = input_jar.preamble_size();
+  header.cen_crc32 = InputJarIndex::Checksum(
+      mapped_file.start(), mapped_file.size(), header.cen_offset);
+  return InputJarIndex::Write(index_path, header, records);
+}
+
+void JarScanner::ScanLoop() {
+  for (;;) {
+    size_t jar_index;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      retrieved_cond_.wait(lock, [this] {
+        return stopping_ || next_to_scan_ >= jar_paths_.size() ||
+               next_to_scan_ < next_to_get_ + max_ahead_;
+      });
+      if (stopping_ || next_to_scan_ >= jar_paths_.size()) {
+        return;
+      }
+      jar_index = next_to_scan_++;
+    }
+    std::unique_ptr<ScannedJar> scanned_jar = Scan(jar_index);
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      scanned_[jar_index] = std::move(scanned_jar);
+    }
+    scanned_cond_.notify_all();
+  }
+}
@@ -0,0 +1,129 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_TOOLS_SINGLEJAR_JAR_SCANNER_H_
+#define SRC_TOOLS_SINGLEJAR_JAR_SCANNER_H_ 1
+
+#include <condition_variable>  // NOLINT
+#include <memory>
+#include <mutex>  // NOLINT
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "src/tools/singlejar/input_jar.h"
+#include "src/tools/singlejar/input_jar_index.h"
+#include "src/tools/singlejar/name_map.h"
+#include "src/tools/singlejar/prefix_matcher.h"
+#include "src/tools/singlejar/stats.h"
+#include "src/tools/singlejar/zip_headers.h"
+
+/*
+ * Scans the input jars ahead of the output jar writer.
+ *
+ * The entries have to be written in the order in which they appear in the
+ * inputs (the first occurrence of a name wins), so the writer has to process
+ * the input jars one by one. What does not depend on the entries written so
+ * far is done here: opening and mapping an input jar, walking its Central
+ * Directory (or reading its index, see InputJarIndex), hashing the entry
+ * names and dropping the entries that are never copied (signature files
+ * and the entries not matching --include_prefixes). With more than one
+ * thread, the worker threads do this for the jars ahead of the one being
+ * written, and the writer picks them up in order by calling Get(), so the
+ * output is the same regardless of the number of threads. The number of
+ * jars scanned ahead is bounded to limit the number of open files.
+ *
+ * With a single thread everything happens in Get().
+ */
+class JarScanner {
+ public:
+  // Entry name classes, see Classify().
+  enum NameClass {
+    kDirectory = 1,  // Ends with '/'.
+    kClassFile = 2,  // Ends with ".class".
+    kService = 4,    // A file in META-INF/services/.
+    kSignature = 8,  // Ends with ".SF", ".RSA" or ".DSA".
+  };
+
+  // An entry to be handled by the writer.
+  struct Entry {
+    const CDH *cdh;
+    const LH *lh;
+    unsigned name_class;  // The result of Classify() for the entry's name.
+    uint32_t name_hash;   // NameHash() of the entry's name.
+  };
+
+  // The result of scanning an input jar.
+  struct ScannedJar {
+    ScannedJar()
+        : opened(false), indexed(false), open_nanos(0), scan_nanos(0) {}
+    InputJar input_jar;
+    std::vector<Entry> entries;
+    bool opened;  // False if the input jar could not be opened.
+    bool indexed;  // True if the entries come from the jar's index.
+    uint64_t open_nanos;  // Time spent opening and mapping the jar.
+    uint64_t scan_nanos;  // Time spent walking its Central Directory.
+  };
+
+  // Scan given input jars using given number of threads, opening them in
+  // given mode. The arguments should outlive this instance.
+  JarScanner(const std::vector<std::string> &jar_paths,
+             const PrefixMatcher &include_prefixes, int threads,
+             MappedFile::Mode mode = MappedFile::kMap);
+
+  // Stops the worker threads.
+  ~JarScanner();
+
+  // Returns the scanned jar with given index, waiting for it if necessary.
+  // The jars have to be retrieved in order, each one once.
+  std::unique_ptr<ScannedJar> Get(size_t jar_index);
+
+  // Returns the NameClass bits describing given entry name. All the
+  // suffixes the writer cares about are told apart by the last character,
+  // so the name is looked at once, and only the matching suffix is compared.
+  static unsigned Classify(const char *file_name, size_t file_name_length);
+
+  // True if an entry with given name and name class should be copied to the
+  // output.
+  static bool Accept(const char *file_name, size_t file_name_length,
+                     unsigned name_class,
+                     const PrefixMatcher &include_prefixes);
+
+  // Writes the index of given jar (see InputJarIndex) to given file.
+  // Returns false if the jar cannot be opened or the index written.
+  static bool WriteIndex(const std::string &jar_path,
+                         const std::string &index_path);
+
+ private:
+  // Opens the jar with given index and collects its entries.
+  std::unique_ptr<ScannedJar> Scan(size_t jar_index);
+  // Worker thread body.
+  void ScanLoop();
+
+  const std::vector<std::string> &jar_paths_;
+  const PrefixMatcher &include_prefixes_;
+  const MappedFile::Mode mode_;
+  // Scanned jars not yet retrieved by the writer.
+  std::vector<std::unique_ptr<ScannedJar> > scanned_;
+  size_t next_to_scan_;
+  size_t next_to_get_;
+  size_t max_ahead_;
+  bool stopping_;
+  std::mutex mutex_;
+  std::condition_variable scanned_cond_;
+  std::condition_variable retrieved_cond_;
+  std::vector<std::thread> workers_;
+};
+
+#endif  //  SRC_TOOLS_SINGLEJAR_JAR_SCANNER_H_
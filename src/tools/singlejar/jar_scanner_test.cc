@@ -0,0 +1,197 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/tools/singlejar/input_jar_index.h"
+#include "src/tools/singlejar/jar_scanner.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+#if !defined(DATA_DIR_TOP)
+#define DATA_DIR_TOP
+#endif
+
+const char kPathLibTest1[] = DATA_DIR_TOP "src/tools/singlejar/libtest1.jar";
+const char kPathLibTest2[] = DATA_DIR_TOP "src/tools/singlejar/libtest2.jar";
+
+// Returns the names of the entries JarScanner yields for given jars,
+// one string per jar.
+std::vector<std::string> ScanNames(const std::vector<std::string> &jar_paths,
+                                   const PrefixMatcher &prefixes,
+                                   int threads) {
+  std::vector<std::string> result;
+  JarScanner jar_scanner(jar_paths, prefixes, threads);
+  for (size_t i = 0; i < jar_paths.size(); ++i) {
+    std::unique_ptr<JarScanner::ScannedJar> scanned_jar = jar_scanner.Get(i);
+    EXPECT_TRUE(scanned_jar->opened) << jar_paths[i];
+    std::string names;
+    for (auto &entry : scanned_jar->entries) {
+      EXPECT_TRUE(entry.cdh->is());
+      EXPECT_TRUE(entry.lh->is());
+      EXPECT_EQ(entry.cdh->file_name_string(), entry.lh->file_name_string());
+      names += entry.cdh->file_name_string();
+      names += '\n';
+    }
+    result.push_back(names);
+  }
+  return result;
+}
+
+// Copies the file, appending given suffix, returns true on success.
+bool CopyFile(const std::string &from, const std::string &to,
+              const std::string &suffix) {
+  std::string contents;
+  FILE *in = fopen(from.c_str(), "rb");
+  if (in == nullptr) {
+    return false;
+  }
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+    contents.append(buffer, n);
+  }
+  fclose(in);
+  contents += suffix;
+  FILE *out = fopen(to.c_str(), "wb");
+  if (out == nullptr) {
+    return false;
+  }
+  bool ok = fwrite(contents.data(), 1, contents.size(), out) == contents.size();
+  return fclose(out) == 0 && ok;
+}
+
+// Returns the name class of given name.
+unsigned Classify(const std::string &name) {
+  return JarScanner::Classify(name.c_str(), name.size());
+}
+
+// True if given name is accepted with given prefixes.
+bool Accept(const std::string &name, const PrefixMatcher &prefixes) {
+  return JarScanner::Accept(name.c_str(), name.size(), Classify(name),
+                            prefixes);
+}
+
+TEST(JarScannerTest, Classify) {
+  EXPECT_EQ(0, Classify(""));
+  EXPECT_EQ(0, Classify("a/b.txt"));
+  EXPECT_EQ(0, Classify("class"));
+  EXPECT_EQ(0, Classify("a/bclass"));
+  EXPECT_EQ(JarScanner::kDirectory, Classify("a/"));
+  EXPECT_EQ(JarScanner::kDirectory, Classify("META-INF/services/"));
+  EXPECT_EQ(JarScanner::kClassFile, Classify("a/b.class"));
+  EXPECT_EQ(JarScanner::kClassFile, Classify(".class"));
+  EXPECT_EQ(JarScanner::kSignature, Classify("META-INF/X.SF"));
+  EXPECT_EQ(JarScanner::kSignature, Classify("X.RSA"));
+  EXPECT_EQ(JarScanner::kSignature, Classify("X.DSA"));
+  EXPECT_EQ(0, Classify("X.ESA"));
+  EXPECT_EQ(JarScanner::kService, Classify("META-INF/services/a.b.C"));
+  EXPECT_EQ(JarScanner::kService | JarScanner::kClassFile,
+            Classify("META-INF/services/a.class"));
+  EXPECT_EQ(0, Classify("META-INF/service"));
+}
+
+TEST(JarScannerTest, Accept) {
+  PrefixMatcher no_prefixes;
+  EXPECT_TRUE(Accept("a/b.class", no_prefixes));
+  EXPECT_FALSE(Accept("META-INF/X.SF", no_prefixes));
+  EXPECT_FALSE(Accept("META-INF/X.RSA", no_prefixes));
+  EXPECT_FALSE(Accept("META-INF/X.DSA", no_prefixes));
+  PrefixMatcher prefixes({"a/", "c/d"});
+  EXPECT_TRUE(Accept("a/b.class", prefixes));
+  EXPECT_TRUE(Accept("c/d/e", prefixes));
+  EXPECT_FALSE(Accept("c/e", prefixes));
+  EXPECT_FALSE(Accept("a", prefixes));
+}
+
+// Scanning in parallel yields the same entries in the same order.
+TEST(JarScannerTest, ParallelScanIsOrdered) {
+  std::vector<std::string> jar_paths;
+  for (int i = 0; i < 20; ++i) {
+    jar_paths.push_back(i % 3 ? kPathLibTest1 : kPathLibTest2);
+  }
+  PrefixMatcher no_prefixes;
+  std::vector<std::string> expected = ScanNames(jar_paths, no_prefixes, 1);
+  ASSERT_EQ(jar_paths.size(), expected.size());
+  EXPECT_NE(std::string::npos, expected[1].find("zip_headers.h"));
+  EXPECT_NE(std::string::npos, expected[0].find("token_stream.h"));
+  EXPECT_EQ(expected, ScanNames(jar_paths, no_prefixes, 4));
+}
+
+// Entries not matching the prefixes are not returned.
+TEST(JarScannerTest, IncludePrefixes) {
+  std::vector<std::string> jar_paths = {kPathLibTest1};
+  PrefixMatcher prefixes({"META-INF/"});
+  std::vector<std::string> names = ScanNames(jar_paths, prefixes, 2);
+  ASSERT_EQ(1, names.size());
+  EXPECT_EQ(std::string::npos, names[0].find("zip_headers.h"));
+  EXPECT_NE(std::string::npos, names[0].find("META-INF/"));
+}
+
+// A jar that cannot be opened is reported as such.
+TEST(JarScannerTest, MissingJar) {
+  std::vector<std::string> jar_paths = {kPathLibTest1, "no/such/file.jar"};
+  PrefixMatcher no_prefixes;
+  JarScanner jar_scanner(jar_paths, no_prefixes, 2);
+  EXPECT_TRUE(jar_scanner.Get(0)->opened);
+  EXPECT_FALSE(jar_scanner.Get(1)->opened);
+}
+
+// The entries read from the index are the same as the scanned ones, and
+// a stale index is not used.
+TEST(JarScannerTest, Index) {
+  const char *tmpdir = getenv("TEST_TMPDIR");
+  ASSERT_NE(nullptr, tmpdir);
+  std::string jar_path = std::string(tmpdir) + "/indexed.jar";
+  std::string index_path = InputJarIndex::IndexPath(jar_path);
+  ASSERT_TRUE(CopyFile(kPathLibTest1, jar_path, ""));
+  unlink(index_path.c_str());
+  std::vector<std::string> jar_paths = {jar_path};
+  PrefixMatcher no_prefixes;
+  std::vector<std::string> expected = ScanNames(jar_paths, no_prefixes, 1);
+
+  ASSERT_TRUE(JarScanner::WriteIndex(jar_path, index_path));
+  {
+    JarScanner jar_scanner(jar_paths, no_prefixes, 1);
+    std::unique_ptr<JarScanner::ScannedJar> scanned_jar = jar_scanner.Get(0);
+    EXPECT_TRUE(scanned_jar->indexed);
+    for (auto &entry : scanned_jar->entries) {
+      EXPECT_EQ(JarScanner::Classify(entry.cdh->file_name(),
+                                     entry.cdh->file_name_length()),
+                entry.name_class);
+      EXPECT_EQ(NameHash(entry.cdh->file_name(), entry.cdh->file_name_length()),
+                entry.name_hash);
+    }
+  }
+  EXPECT_EQ(expected, ScanNames(jar_paths, no_prefixes, 1));
+  PrefixMatcher prefixes({"META-INF/"});
+  EXPECT_NE(expected, ScanNames(jar_paths, prefixes, 1));
+
+  // A zip comment changes the size of the jar.
+  ASSERT_TRUE(CopyFile(kPathLibTest1, jar_path, "x"));
+  {
+    JarScanner jar_scanner(jar_paths, no_prefixes, 1);
+    EXPECT_FALSE(jar_scanner.Get(0)->indexed);
+  }
+  unlink(index_path.c_str());
+}
+
+}  // namespace
@@ -15,11 +15,23 @@
 #ifndef BAZEL_SRC_TOOLS_SINGLEJAR_MAPPED_FILE_H_
 #define BAZEL_SRC_TOOLS_SINGLEJAR_MAPPED_FILE_H_ 1
 
+#include <errno.h>
 #include <fcntl.h>
-#include <sys/mman.h>
 #include <sys/stat.h>
+#include <stdint.h>
+#if defined(_WIN32)
+#include <io.h>
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
 #include <unistd.h>
+#endif
 
+#include <limits>
+#include <memory>
 #include <string>
 
 #include "src/tools/singlejar/diag.h"
@@ -28,15 +40,24 @@
  * A mapped read-only file with auto closing.
  *
  * MappedFile::Open maps a file with specified name to memory as read-only.
- * It is assumed that the address space is large enough for that.
- * MappedFile::Close deletes the mapping. The destructor calls it, too.
+ * It is assumed that the address space is large enough for that. Depending
+ * on the Mode, the pages are faulted in on demand, all read in by mmap, or
+ * the file is read into anonymous memory instead of being mapped.
+ * MappedFile::Close deletes the mapping, unless it is still held through
+ * mapping(). The destructor calls it, too.
  * A predictable set of methods provide conversion between file offsets and
  * mapped addresses, returns map size, etc.
  *
- * The implementation is 64-bit Linux or OSX specific.
+ * There are implementations for Linux, OSX and Windows. A 32-bit build
+ * fails to open the files which do not fit into its address space.
  */
-#if !((defined(__linux) || defined(__APPLE__)) && __SIZEOF_POINTER__ == 8)
-#error This code for 64 bit Unix.
+#if !(defined(__linux) || defined(__APPLE__) || defined(_WIN32))
+#error This code is for Linux, OSX or Windows.
+#endif
+
+#if defined(_WIN32)
+// Advise() does nothing on Windows, these only let the callers compile.
+enum { MADV_SEQUENTIAL = 2, MADV_WILLNEED = 3 };
 #endif
 
 class MappedFile {
@@ -45,36 +66,80 @@ class MappedFile {
 
   ~MappedFile() { Close(); }
 
-  bool Open(const std::string& path) {
+  // How the contents of the file get into memory.
+  enum Mode {
+    // Map the file, its pages are read in as they are touched.
+    kMap,
+    // Map the file and read all of it in right away, which saves taking a
+    // page fault for every page of an input that is going to be copied
+    // whole. Same as kMap where MAP_POPULATE is not available.
+    kMapPopulate,
+    // Read the file into anonymous memory (backed by huge pages if the
+    // kernel can), for the file systems on which mmap is slow or unsafe,
+    // e.g. network ones, where a file changing under the mapping faults.
+    kRead,
+  };
+
+  bool Open(const std::string& path, Mode mode = kMap) {
     if (is_open()) {
       diag_errx(1, "%s:%d: This instance is already open", __FILE__, __LINE__);
     }
-    if ((fd_ = open(path.c_str(), O_RDONLY)) < 0) {
+#if defined(_WIN32)
+    fd_ = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    fd_ = open(path.c_str(), O_RDONLY);
+#endif
+    if (fd_ < 0) {
       diag_warn("%s:%d: open %s:", __FILE__, __LINE__, path.c_str());
       return false;
     }
     // Map the file, even if it is empty (in which case allocate 1 byte to it).
-    struct stat st;
-    if (fstat(fd_, &st) ||
-        (mapped_start_ = static_cast<unsigned char *>(
-             mmap(nullptr, st.st_size ? st.st_size : 1, PROT_READ, MAP_PRIVATE,
-                  fd_, 0))) == MAP_FAILED) {
-      diag_warn("%s:%d: mmap %s:", __FILE__, __LINE__, path.c_str());
-      close(fd_);
-      fd_ = -1;
+    uint64_t file_size;
+    if (!FileSize(&file_size) ||
+        (mapped_start_ = mode == kRead || file_size == 0
+                             ? ReadIn(file_size)
+                             : MapIn(file_size, mode)) == nullptr) {
+      diag_warn("%s:%d: %s %s:", __FILE__, __LINE__,
+                mode == kRead ? "read" : "mmap", path.c_str());
+      CloseFile();
       return false;
     }
-    mapped_end_ = mapped_start_ + st.st_size;
+    mapped_end_ = mapped_start_ + file_size;
     return true;
   }
 
   void Close() {
     if (is_open()) {
-      munmap(mapped_start_, mapped_end_ - mapped_start_);
+      mapping_.reset();
       mapped_start_ = mapped_end_ = nullptr;
-      close(fd_);
-      fd_ = -1;
+      CloseFile();
+    }
+  }
+
+  // Tells the kernel how given range of the file is going to be accessed,
+  // e.g. MADV_WILLNEED to start reading it in the background. It is only
+  // a hint, so the errors are ignored.
+  void Advise(off_t offset, size_t length, int advice) const {
+#if !defined(_WIN32)
+    if (mapped_start_ == nullptr || length == 0) {
+      return;
+    }
+    uintptr_t page_mask = sysconf(_SC_PAGESIZE) - 1;
+    uintptr_t from = reinterpret_cast<uintptr_t>(address(offset)) & ~page_mask;
+    uintptr_t to = reinterpret_cast<uintptr_t>(address(offset)) + length;
+    madvise(reinterpret_cast<void *>(from), to - from, advice);
+#endif
+  }
+
+  // Asks the kernel to drop the file's pages from the page cache. Unmapping
+  // the file does not do that, so the pages of a large input stay cached
+  // long after they are needed. Again, only a hint.
+  void DropCachedPages() const {
+#if defined(POSIX_FADV_DONTNEED)
+    if (fd_ >= 0) {
+      posix_fadvise(fd_, 0, 0, POSIX_FADV_DONTNEED);
     }
+#endif
   }
 
   bool mapped(const void *addr) const {
@@ -90,13 +155,163 @@ class MappedFile {
     return reinterpret_cast<const unsigned char *>(address) - mapped_start_;
   }
   int fd() const { return fd_; }
+
   size_t size() const { return mapped_end_ - mapped_start_; }
   bool is_open() { return fd_ >= 0; }
 
+  // Returns a holder of the mapping, which keeps it (but not the file
+  // descriptor) after Close() until the last copy is released.
+  std::shared_ptr<const void> mapping() const { return mapping_; }
+
  private:
+  // Gets the size of the open file, failing with EFBIG if it cannot be
+  // addressed.
+  bool FileSize(uint64_t *size) const {
+#if defined(_WIN32)
+    struct _stat64 st;
+    if (_fstat64(fd_, &st)) {
+      return false;
+    }
+#else
+    struct stat st;
+    if (fstat(fd_, &st)) {
+      return false;
+    }
+#endif
+    *size = st.st_size;
+    if (*size > std::numeric_limits<size_t>::max() ||
+        *size > static_cast<uint64_t>(std::numeric_limits<off_t>::max())) {
+      errno = EFBIG;
+      return false;
+    }
+    return true;
+  }
+
+  void CloseFile() {
+#if defined(_WIN32)
+    _close(fd_);
+#else
+    close(fd_);
+#endif
+    fd_ = -1;
+  }
+
+#if defined(_WIN32)
+  // Maps the non-empty file. Returns nullptr with errno set on error.
+  unsigned char *MapIn(size_t size, Mode mode) {
+    // There is no MAP_POPULATE, and PrefetchVirtualMemory needs Windows 8.
+    HANDLE file = reinterpret_cast<HANDLE>(_get_osfhandle(fd_));
+    HANDLE file_mapping =
+        CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (file_mapping == nullptr) {
+      errno = EACCES;
+      return nullptr;
+    }
+    // The view keeps the file mapping object.
+    void *view = MapViewOfFile(file_mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(file_mapping);
+    if (view == nullptr) {
+      errno = ENOMEM;
+      return nullptr;
+    }
+    unsigned char *start = static_cast<unsigned char *>(view);
+    mapping_.reset(start, [](unsigned char *start) {
+      UnmapViewOfFile(start);
+    });
+    return start;
+  }
+
+  // Reads the file into committed memory, which is made read-only once
+  // filled. Returns nullptr with errno set on error.
+  unsigned char *ReadIn(size_t size) {
+    unsigned char *data = static_cast<unsigned char *>(VirtualAlloc(
+        nullptr, size ? size : 1, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (data == nullptr) {
+      errno = ENOMEM;
+      return nullptr;
+    }
+    HANDLE file = reinterpret_cast<HANDLE>(_get_osfhandle(fd_));
+    for (uint64_t offset = 0; offset < size;) {
+      OVERLAPPED overlapped = {};
+      overlapped.Offset = static_cast<DWORD>(offset);
+      overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+      DWORD chunk_size = static_cast<DWORD>(
+          std::min<uint64_t>(size - offset, static_cast<uint64_t>(1) << 30));
+      DWORD n = 0;
+      if (!ReadFile(file, data + offset, chunk_size, &n, &overlapped) ||
+          n == 0) {
+        VirtualFree(data, 0, MEM_RELEASE);
+        errno = EIO;
+        return nullptr;
+      }
+      offset += n;
+    }
+    DWORD old_protection;
+    VirtualProtect(data, size ? size : 1, PAGE_READONLY, &old_protection);
+    mapping_.reset(data, [](unsigned char *start) {
+      VirtualFree(start, 0, MEM_RELEASE);
+    });
+    return data;
+  }
+#else
+  // Maps the non-empty file. Returns nullptr with errno set on error.
+  unsigned char *MapIn(size_t size, Mode mode) {
+    int flags = MAP_PRIVATE;
+#if defined(MAP_POPULATE)
+    if (mode == kMapPopulate) {
+      flags |= MAP_POPULATE;
+    }
+#endif
+    void *memory = mmap(nullptr, size, PROT_READ, flags, fd_, 0);
+    if (memory == MAP_FAILED) {
+      return nullptr;
+    }
+    unsigned char *start = static_cast<unsigned char *>(memory);
+    mapping_.reset(start, [size](unsigned char *start) {
+      munmap(start, size);
+    });
+    return start;
+  }
+
+  // Reads the file into anonymous memory, which is made read-only once
+  // filled. Returns nullptr with errno set on error.
+  unsigned char *ReadIn(size_t size) {
+    size_t mapped_size = size ? size : 1;
+    void *memory = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (memory == MAP_FAILED) {
+      return nullptr;
+    }
+#if defined(MADV_HUGEPAGE)
+    // Only a hint, it fails if transparent huge pages are not configured.
+    madvise(memory, mapped_size, MADV_HUGEPAGE);
+#endif
+    unsigned char *data = static_cast<unsigned char *>(memory);
+    for (size_t offset = 0; offset < size;) {
+      ssize_t n = pread(fd_, data + offset, size - offset, offset);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        int saved_errno = n < 0 ? errno : EIO;  // EIO if the file shrank.
+        munmap(memory, mapped_size);
+        errno = saved_errno;
+        return nullptr;
+      }
+      offset += n;
+    }
+    mprotect(memory, mapped_size, PROT_READ);
+    mapping_.reset(data, [mapped_size](unsigned char *start) {
+      munmap(start, mapped_size);
+    });
+    return data;
+  }
+#endif
+
   unsigned char *mapped_start_;
   unsigned char *mapped_end_;
   int fd_;
+  std::shared_ptr<unsigned char> mapping_;
 };
 
 #endif  //  BAZEL_SRC_TOOLS_SINGLEJAR_MAPPED_FILE_H_
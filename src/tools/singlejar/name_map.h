@@ -0,0 +1,170 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_TOOLS_SINGLEJAR_NAME_MAP_H_
+#define SRC_TOOLS_SINGLEJAR_NAME_MAP_H_ 1
+
+#include <stdint.h>
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The hash of an entry name used by NameMap (FNV-1a).
+inline uint32_t NameHash(const char *name, size_t name_length) {
+  uint32_t hash = 2166136261U;
+  for (const char *end = name + name_length; name < end; ++name) {
+    hash = (hash ^ static_cast<uint8_t>(*name)) * 16777619U;
+  }
+  return hash;
+}
+
+/*
+ * A map from the entry names to the values of type V.
+ *
+ * A merge probes the map for every entry of every input jar, and creating a
+ * std::string for the probe (which always involves allocating an object on
+ * the heap) is what std::unordered_map<std::string, V> would require. This
+ * is an open-addressing hash table (with linear probing) which is probed
+ * with the bytes of the name as they are, e.g. in the memory mapped Central
+ * Directory of an input jar. The names of the inserted entries are copied
+ * to an arena owned by the map, so inserting does not allocate either
+ * (except when the arena or the table grows).
+ *
+ * The pointers to the values returned by Find() and Emplace() are
+ * invalidated by the subsequent Emplace().
+ */
+template <class V>
+class NameMap {
+ public:
+  NameMap() : size_(0), arena_free_(nullptr), arena_end_(nullptr) {
+    slots_.resize(kInitialCapacity);
+  }
+
+  // Returns the pointer to the value for given name, or nullptr.
+  V *Find(const char *name, size_t name_length) {
+    Slot *slot = Probe(name, name_length, NameHash(name, name_length));
+    return slot->name ? &slot->value : nullptr;
+  }
+
+  // Inserts given value unless the map already contains given name. Returns
+  // the pointer to the value in the map and true if the value was inserted.
+  std::pair<V *, bool> Emplace(const char *name, size_t name_length,
+                               const V &value) {
+    return Emplace(name, name_length, NameHash(name, name_length), value);
+  }
+
+  // Same as above, with the NameHash() of the name computed beforehand
+  // (e.g., by the thread scanning the input jar).
+  std::pair<V *, bool> Emplace(const char *name, size_t name_length,
+                               uint32_t hash, const V &value) {
+    Slot *slot = Probe(name, name_length, hash);
+    if (slot->name) {
+      return std::make_pair(&slot->value, false);
+    }
+    if (2 * (size_ + 1) > slots_.size()) {
+      Grow();
+      slot = Probe(name, name_length, hash);
+    }
+    slot->name = CopyName(name, name_length);
+    slot->name_length = name_length;
+    slot->hash = hash;
+    slot->value = value;
+    ++size_;
+    return std::make_pair(&slot->value, true);
+  }
+
+  V *Find(const std::string &name) { return Find(name.c_str(), name.size()); }
+
+  std::pair<V *, bool> Emplace(const std::string &name, const V &value) {
+    return Emplace(name.c_str(), name.size(), value);
+  }
+
+  bool Contains(const char *name, size_t name_length) {
+    return Find(name, name_length) != nullptr;
+  }
+
+  bool Contains(const std::string &name) { return Find(name) != nullptr; }
+
+  size_t size() const { return size_; }
+
+ private:
+  static const size_t kInitialCapacity = 1024;  // Has to be a power of 2.
+  static const size_t kArenaChunkSize = 256 * 1024;
+
+  struct Slot {
+    Slot() : name(nullptr), name_length(0), hash(0), value() {}
+    const char *name;  // nullptr if the slot is empty.
+    size_t name_length;
+    uint32_t hash;
+    V value;
+  };
+
+  // Returns the slot containing given name or the empty slot where it
+  // should be inserted.
+  Slot *Probe(const char *name, size_t name_length, uint32_t hash) {
+    size_t mask = slots_.size() - 1;
+    for (size_t index = hash & mask;; index = (index + 1) & mask) {
+      Slot *slot = &slots_[index];
+      if (!slot->name ||
+          (slot->hash == hash && slot->name_length == name_length &&
+           !memcmp(slot->name, name, name_length))) {
+        return slot;
+      }
+    }
+  }
+
+  // Doubles the number of slots.
+  void Grow() {
+    std::vector<Slot> old_slots(2 * slots_.size());
+    slots_.swap(old_slots);
+    size_t mask = slots_.size() - 1;
+    for (auto &old_slot : old_slots) {
+      if (old_slot.name) {
+        size_t index = old_slot.hash & mask;
+        while (slots_[index].name) {
+          index = (index + 1) & mask;
+        }
+        slots_[index] = old_slot;
+      }
+    }
+  }
+
+  // Copies the name to the arena.
+  const char *CopyName(const char *name, size_t name_length) {
+    // Even an empty name needs a non-null pointer.
+    if (arena_free_ == nullptr ||
+        static_cast<size_t>(arena_end_ - arena_free_) < name_length) {
+      size_t chunk_size =
+          name_length > kArenaChunkSize ? name_length : kArenaChunkSize;
+      arena_.emplace_back(new char[chunk_size]);
+      arena_free_ = arena_.back().get();
+      arena_end_ = arena_free_ + chunk_size;
+    }
+    char *copy = arena_free_;
+    memcpy(copy, name, name_length);
+    arena_free_ += name_length;
+    return copy;
+  }
+
+  std::vector<Slot> slots_;
+  size_t size_;
+  std::vector<std::unique_ptr<char[]> > arena_;
+  char *arena_free_;
+  char *arena_end_;
+};
+
+#endif  //  SRC_TOOLS_SINGLEJAR_NAME_MAP_H_
@@ -0,0 +1,81 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+
+#include "src/tools/singlejar/name_map.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+TEST(NameMapTest, EmplaceAndFind) {
+  NameMap<int> name_map;
+  EXPECT_EQ(0, name_map.size());
+  EXPECT_EQ(nullptr, name_map.Find("foo"));
+  auto got = name_map.Emplace("foo", 1);
+  EXPECT_TRUE(got.second);
+  EXPECT_EQ(1, *got.first);
+  got = name_map.Emplace("foo", 2);
+  EXPECT_FALSE(got.second);
+  EXPECT_EQ(1, *got.first);
+  EXPECT_EQ(1, name_map.size());
+  EXPECT_TRUE(name_map.Contains("foo"));
+  EXPECT_FALSE(name_map.Contains("fo"));
+  EXPECT_FALSE(name_map.Contains("foo/"));
+}
+
+// The name does not have to be null-terminated, and the map keeps
+// its own copy.
+TEST(NameMapTest, NameBytes) {
+  NameMap<int> name_map;
+  char buffer[] = "a/b/c.classXYZ";
+  EXPECT_TRUE(name_map.Emplace(buffer, 11, 7).second);
+  buffer[0] = 'z';
+  EXPECT_TRUE(name_map.Contains("a/b/c.class"));
+  EXPECT_FALSE(name_map.Contains(buffer, 11));
+  EXPECT_EQ(7, *name_map.Find("a/b/c.classQ", 11));
+}
+
+TEST(NameMapTest, EmptyName) {
+  NameMap<int> name_map;
+  EXPECT_FALSE(name_map.Contains(""));
+  EXPECT_TRUE(name_map.Emplace("", 3).second);
+  EXPECT_TRUE(name_map.Contains(""));
+  EXPECT_EQ(3, *name_map.Find(""));
+}
+
+// Many entries, causing the table and the arena to grow.
+TEST(NameMapTest, Grow) {
+  NameMap<int> name_map;
+  const int kCount = 100000;
+  for (int i = 0; i < kCount; ++i) {
+    std::string name = "com/google/package" + std::to_string(i % 97) +
+                       "/Class" + std::to_string(i) + ".class";
+    ASSERT_TRUE(name_map.Emplace(name, i).second);
+  }
+  EXPECT_EQ(kCount, name_map.size());
+  for (int i = 0; i < kCount; ++i) {
+    std::string name = "com/google/package" + std::to_string(i % 97) +
+                       "/Class" + std::to_string(i) + ".class";
+    int *value = name_map.Find(name);
+    ASSERT_NE(nullptr, value);
+    EXPECT_EQ(i, *value);
+  }
+  EXPECT_FALSE(name_map.Contains("com/google/package0/Class1.class"));
+  std::string long_name(300000, 'x');
+  EXPECT_TRUE(name_map.Emplace(long_name, -1).second);
+  EXPECT_EQ(-1, *name_map.Find(long_name));
+}
+
+}  // namespace
@@ -24,6 +24,8 @@ void Options::ParseCommandLine(int argc, const char * const argv[]) {
     if (tokens.MatchAndSet("--output", &output_jar) ||
         tokens.MatchAndSet("--main_class", &main_class) ||
         tokens.MatchAndSet("--java_launcher", &java_launcher) ||
+        tokens.MatchAndSet("--incremental_base", &incremental_base) ||
+        tokens.MatchAndSet("--stats", &stats) ||
         tokens.MatchAndSet("--deploy_manifest_lines", &manifest_lines) ||
         tokens.MatchAndSet("--sources", &input_jars) ||
         tokens.MatchAndSet("--resources", &resources) ||
@@ -33,11 +35,23 @@ void Options::ParseCommandLine(int argc, const char * const argv[]) {
         tokens.MatchAndSet("--compression", &force_compression) ||
         tokens.MatchAndSet("--dont_change_compression",
                            &preserve_compression) ||
+        tokens.MatchAndSet("--nocompress_suffixes", &nocompress_suffixes) ||
+        tokens.MatchAndSet("--nocompress_prefixes", &nocompress_prefixes) ||
+        tokens.MatchAndSet("--compress_everything", &compress_everything) ||
         tokens.MatchAndSet("--normalize", &normalize_timestamps) ||
         tokens.MatchAndSet("--no_duplicates", &no_duplicates) ||
+        tokens.MatchAndSet("--check_duplicate_contents",
+                           &check_duplicate_contents) ||
         tokens.MatchAndSet("--verbose", &verbose) ||
         tokens.MatchAndSet("--warn_duplicate_resources",
-                           &warn_duplicate_resources)) {
+                           &warn_duplicate_resources) ||
+        tokens.MatchAndSet("--check_reproducibility",
+                           &check_reproducibility) ||
+        tokens.MatchAndSet("--drop_input_pages", &drop_input_pages) ||
+        tokens.MatchAndSet("--threads", &threads) ||
+        tokens.MatchAndSet("--align", &alignment) ||
+        tokens.MatchAndSet("--max_part_megabytes", &max_part_megabytes) ||
+        tokens.MatchAndSet("--max_part_entries", &max_part_entries)) {
       continue;
     } else if (tokens.MatchAndSet("--build_info_file", &optarg)) {
       build_info_files.push_back(optarg);
@@ -45,14 +59,56 @@ void Options::ParseCommandLine(int argc, const char * const argv[]) {
     } else if (tokens.MatchAndSet("--extra_build_info", &optarg)) {
       build_info_lines.push_back(optarg);
       continue;
+    } else if (tokens.MatchAndSet("--input_access", &optarg)) {
+      if (optarg == "mmap") {
+        input_mode = MappedFile::kMap;
+      } else if (optarg == "populate") {
+        input_mode = MappedFile::kMapPopulate;
+      } else if (optarg == "pread") {
+        input_mode = MappedFile::kRead;
+      } else {
+        diag_errx(1, "--input_access should be mmap, populate or pread, got %s",
+                  optarg.c_str());
+      }
+      continue;
     } else {
       diag_errx(1, "Bad command line argument %s", tokens.token().c_str());
     }
   }
 
+  include_prefix_matcher = PrefixMatcher(include_prefixes);
+  compression_policy.AddSuffixes(nocompress_suffixes);
+  compression_policy.AddPrefixes(nocompress_prefixes);
+  compression_policy.set_enabled(!compress_everything);
+
   if (output_jar.empty()) {
     diag_errx(1, "Use --output <output_jar> to specify the output file name");
   }
+  if (threads < 1) {
+    diag_errx(1, "--threads should be at least 1, got %d", threads);
+  }
+  if (alignment < 0 || alignment > 0xFFFF) {
+    diag_errx(1, "--align should be between 0 and 65535, got %d", alignment);
+  }
+  if (check_reproducibility && !normalize_timestamps) {
+    diag_errx(1, "--check_reproducibility requires --normalize");
+  }
+  if (max_part_megabytes < 0 || max_part_entries < 0) {
+    diag_errx(1, "--max_part_megabytes and --max_part_entries cannot be "
+              "negative");
+  }
+  if (split_output() &&
+      (output_to_stdout() || !incremental_base.empty() ||
+       check_reproducibility)) {
+    diag_errx(1, "An output split into parts cannot be streamed, built "
+              "incrementally or checked for reproducibility");
+  }
+  if (output_to_stdout() && !incremental_base.empty()) {
+    diag_errx(1, "--incremental_base cannot be used with --output -");
+  }
+  if (output_to_stdout() && check_reproducibility) {
+    diag_errx(1, "--check_reproducibility cannot be used with --output -");
+  }
   if (force_compression && preserve_compression) {
     diag_errx(
         1,
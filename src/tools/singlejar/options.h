@@ -18,6 +18,10 @@
 #include <string>
 #include <vector>
 
+#include "src/tools/singlejar/compression_policy.h"
+#include "src/tools/singlejar/mapped_file.h"
+#include "src/tools/singlejar/prefix_matcher.h"
+
 /* Command line options. */
 class Options {
  public:
@@ -26,17 +30,40 @@ class Options {
         force_compression(false),
         normalize_timestamps(false),
         no_duplicates(false),
+        check_duplicate_contents(false),
         no_duplicate_classes(false),
         preserve_compression(false),
+        compress_everything(false),
         verbose(false),
-        warn_duplicate_resources(false) {}
+        warn_duplicate_resources(false),
+        check_reproducibility(false),
+        drop_input_pages(false),
+        threads(1),
+        alignment(0),
+        max_part_megabytes(0),
+        max_part_entries(0),
+        input_mode(MappedFile::kMap) {}
 
   // Parses command line arguments into the fields of this instance.
   void ParseCommandLine(int argc, const char * const argv[]);
 
+  // True if the output goes to the standard output.
+  bool output_to_stdout() const { return output_jar == "-"; }
+
+  // True if the output is split into parts.
+  bool split_output() const {
+    return max_part_megabytes > 0 || max_part_entries > 0;
+  }
+
+  // The output jar, or "-" to stream it to the standard output.
   std::string output_jar;
   std::string main_class;
   std::string java_launcher;
+  // The previous output jar to copy the entries of the unchanged input jars
+  // from.
+  std::string incremental_base;
+  // The file to write the counters and timings to.
+  std::string stats;
   std::vector<std::string> manifest_lines;
   std::vector<std::string> input_jars;
   std::vector<std::string> resources;
@@ -44,14 +71,47 @@ class Options {
   std::vector<std::string> build_info_files;
   std::vector<std::string> build_info_lines;
   std::vector<std::string> include_prefixes;
+  // The include_prefixes, compiled.
+  PrefixMatcher include_prefix_matcher;
   bool exclude_build_data;
   bool force_compression;
   bool normalize_timestamps;
   bool no_duplicates;
+  // Compare the contents of the duplicate plain entries, so that only the
+  // different ones count as duplicates.
+  bool check_duplicate_contents;
   bool no_duplicate_classes;
   bool preserve_compression;
+  // With --compression, the entries to leave stored in addition to those of
+  // the default policy, and whether to deflate every entry regardless.
+  std::vector<std::string> nocompress_suffixes;
+  std::vector<std::string> nocompress_prefixes;
+  bool compress_everything;
+  // The above, compiled.
+  CompressionPolicy compression_policy;
   bool verbose;
   bool warn_duplicate_resources;
+  // Build the output once more with a different number of threads and
+  // verify that the result is the same.
+  bool check_reproducibility;
+  // Drop the pages of an input jar from the page cache once it has been
+  // copied to the output.
+  bool drop_input_pages;
+  // The number of threads scanning the input jars ahead of the writer,
+  // and the number of threads changing the compression of the entries.
+  int threads;
+  // Align the data of the stored entries to this many bytes (0 for none),
+  // so that they can be used from the memory mapped output as they are.
+  int alignment;
+  // Split the output into parts of at most this many megabytes and entries
+  // (0 for no limit): out.jar, out-2.jar, out-3.jar and so on. The manifest
+  // and the build data are in the first part, the combined entries (services
+  // and the like) in the last one. A part has at least one entry.
+  int max_part_megabytes;
+  int max_part_entries;
+  // How the input jars are brought into memory: --input_access mmap (the
+  // default), populate or pread.
+  MappedFile::Mode input_mode;
 };
 
 #endif  // THIRD_PARTY_BAZEL_SRC_TOOLS_SINGLEJAR_OPTIONS_H_
@@ -25,6 +25,9 @@ TEST(OptionsTest, Flags1) {
                         "--compression",
                         "--normalize",
                         "--no_duplicates",
+                        "--check_duplicate_contents",
+                        "--check_reproducibility",
+                        "--drop_input_pages",
                         "--output", "output_jar"};
   Options options;
   options.ParseCommandLine(arraysize(args), args);
@@ -33,10 +36,17 @@ TEST(OptionsTest, Flags1) {
   EXPECT_TRUE(options.force_compression);
   EXPECT_TRUE(options.normalize_timestamps);
   EXPECT_TRUE(options.no_duplicates);
+  EXPECT_TRUE(options.check_duplicate_contents);
+  EXPECT_TRUE(options.check_reproducibility);
+  EXPECT_TRUE(options.drop_input_pages);
   EXPECT_FALSE(options.preserve_compression);
   EXPECT_FALSE(options.verbose);
   EXPECT_FALSE(options.warn_duplicate_resources);
   EXPECT_EQ("output_jar", options.output_jar);
+  EXPECT_EQ(1, options.threads);
+  EXPECT_EQ(0, options.alignment);
+  EXPECT_EQ(MappedFile::kMap, options.input_mode);
+  EXPECT_TRUE(options.incremental_base.empty());
 }
 
 TEST(OptionsTest, Flags2) {
@@ -51,6 +61,9 @@ TEST(OptionsTest, Flags2) {
   ASSERT_FALSE(options.force_compression);
   ASSERT_FALSE(options.normalize_timestamps);
   ASSERT_FALSE(options.no_duplicates);
+  ASSERT_FALSE(options.check_duplicate_contents);
+  ASSERT_FALSE(options.check_reproducibility);
+  ASSERT_FALSE(options.drop_input_pages);
   ASSERT_TRUE(options.preserve_compression);
   ASSERT_TRUE(options.verbose);
   ASSERT_TRUE(options.warn_duplicate_resources);
@@ -63,7 +76,12 @@ TEST(OptionsTest, SingleOptargs) {
                         "--build_info_file", "build_file1",
                         "--extra_build_info", "extra_build_line1",
                         "--build_info_file", "build_file2",
-                        "--extra_build_info", "extra_build_line2"};
+                        "--extra_build_info", "extra_build_line2",
+                        "--threads", "8",
+                        "--align", "4",
+                        "--incremental_base", "old_output_jar",
+                        "--stats", "stats_file",
+                        "--input_access", "pread"};
   Options options;
   options.ParseCommandLine(arraysize(args), args);
 
@@ -76,6 +94,11 @@ TEST(OptionsTest, SingleOptargs) {
   ASSERT_EQ(2, options.build_info_lines.size());
   EXPECT_EQ("extra_build_line1", options.build_info_lines[0]);
   EXPECT_EQ("extra_build_line2", options.build_info_lines[1]);
+  EXPECT_EQ(8, options.threads);
+  EXPECT_EQ(4, options.alignment);
+  EXPECT_EQ("old_output_jar", options.incremental_base);
+  EXPECT_EQ("stats_file", options.stats);
+  EXPECT_EQ(MappedFile::kRead, options.input_mode);
 }
 
 TEST(OptionsTest, MultiOptargs) {
@@ -103,6 +126,60 @@ TEST(OptionsTest, MultiOptargs) {
   EXPECT_EQ("prefix2", options.include_prefixes[1]);
 }
 
+TEST(OptionsTest, CompressionPolicy) {
+  const char *args[] = {"--output", "output_file", "--compression",
+                        "--nocompress_suffixes", ".so", ".dex",
+                        "--nocompress_prefixes", "assets/"};
+  Options options;
+  options.ParseCommandLine(arraysize(args), args);
+
+  ASSERT_EQ(2, options.nocompress_suffixes.size());
+  EXPECT_EQ(".dex", options.nocompress_suffixes[1]);
+  ASSERT_EQ(1, options.nocompress_prefixes.size());
+  EXPECT_FALSE(options.compress_everything);
+  EXPECT_TRUE(options.compression_policy.enabled());
+  const uint8_t data[] = "text";
+  EXPECT_FALSE(options.compression_policy.ShouldCompress("lib/a.so", 8, data,
+                                                         sizeof(data)));
+  EXPECT_FALSE(options.compression_policy.ShouldCompress("assets/a", 8, data,
+                                                         sizeof(data)));
+  EXPECT_TRUE(options.compression_policy.ShouldCompress("lib/a.sx", 8, data,
+                                                        sizeof(data)));
+
+  const char *args2[] = {"--output", "output_file", "--compression",
+                         "--compress_everything"};
+  Options options2;
+  options2.ParseCommandLine(arraysize(args2), args2);
+  EXPECT_FALSE(options2.compression_policy.enabled());
+}
+
+TEST(OptionsTest, OutputToStdout) {
+  const char *args[] = {"--output", "-"};
+  Options options;
+  options.ParseCommandLine(arraysize(args), args);
+  EXPECT_TRUE(options.output_to_stdout());
+
+  const char *args2[] = {"--output", "-", "--incremental_base", "base.jar"};
+  Options options2;
+  EXPECT_DEATH(options2.ParseCommandLine(arraysize(args2), args2),
+               "cannot be used with --output -");
+}
+
+TEST(OptionsTest, SplitOutput) {
+  const char *args[] = {"--output", "out.jar", "--max_part_megabytes", "100",
+                        "--max_part_entries", "65000"};
+  Options options;
+  options.ParseCommandLine(arraysize(args), args);
+  EXPECT_TRUE(options.split_output());
+  EXPECT_EQ(100, options.max_part_megabytes);
+  EXPECT_EQ(65000, options.max_part_entries);
+
+  const char *args2[] = {"--output", "-", "--max_part_entries", "10"};
+  Options options2;
+  EXPECT_DEATH(options2.ParseCommandLine(arraysize(args2), args2),
+               "cannot be streamed");
+}
+
 TEST(OptionsTest, EmptyMultiOptargs) {
   const char *args[] = {"--output", "output_file",
                         "--sources",
@@ -17,38 +17,71 @@
  */
 #include "src/tools/singlejar/output_jar.h"
 
+#include <ctype.h>
 #include <err.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #if defined(__linux)
 #include <sys/sendfile.h>
+#include <sys/syscall.h>
 #endif
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include "src/main/cpp/util/file.h"
 #include "src/tools/singlejar/combiners.h"
 #include "src/tools/singlejar/diag.h"
 #include "src/tools/singlejar/input_jar.h"
 #include "src/tools/singlejar/mapped_file.h"
 #include "src/tools/singlejar/options.h"
+#include "src/tools/singlejar/recompressor.h"
+#include "src/tools/singlejar/resource_loader.h"
 #include "src/tools/singlejar/zip_headers.h"
+#include "src/tools/singlejar/zlib_interface.h"
 
 #include <zlib.h>
 
-#define TODO(cond, msg)                                              \
-  if (!(cond)) {                                                     \
-    diag_errx(2, "%s:%d: TODO(asmundak): " msg, __FILE__, __LINE__); \
-  }
+// Small writes (modified local headers, small entries copied from the input
+// jars) are collected in the output buffer and written out in big chunks.
+static const size_t kOutputBufferSize = 256 * 1024;
+
+// The input jar byte ranges at most this long are copied from the mapped
+// input jar to the output buffer rather than by the kernel: a system call per
+// range costs more than copying the bytes.
+static const size_t kBufferedCopySize = 64 * 1024;
+
+// Only Linux can copy between files within the kernel. Elsewhere, the ranges
+// of any length are written out from the mapped input jar, which beats
+// reading them into a buffer first.
+#if defined(__linux)
+static const bool kCopyWithinKernel = true;
+#else
+static const bool kCopyWithinKernel = false;
+#endif
+
+// The buffer AppendFile reads into where the above is not available.
+static const size_t kAppendBufferSize = 1024 * 1024;
+
+// The size of the Central Directory buffer chunks.
+static const size_t kCenChunkSize = 1024 * 1024;
 
 OutputJar::OutputJar()
     : options_(nullptr),
       fd_(-1),
+      outpos_(0),
+      output_buffer_(new uint8_t[kOutputBufferSize]),
+      output_buffer_used_(0),
+      use_copy_file_range_(true),
+      pending_copy_{-1, 0, nullptr, 0, nullptr},
       entries_(0),
       duplicate_entries_(0),
-      cen_(nullptr),
+      part_(0),
       cen_size_(0),
       cen_capacity_(0),
       spring_handlers_("META-INF/spring.handlers"),
@@ -56,16 +89,17 @@ OutputJar::OutputJar()
       protobuf_meta_handler_("protobuf.meta", false),
       manifest_("META-INF/MANIFEST.MF"),
       build_properties_("build-data.properties") {
-  known_members_.emplace(spring_handlers_.filename(),
+  known_members_.Emplace(spring_handlers_.filename(),
                          EntryInfo{&spring_handlers_});
-  known_members_.emplace(spring_schemas_.filename(),
+  known_members_.Emplace(spring_schemas_.filename(),
                          EntryInfo{&spring_schemas_});
-  known_members_.emplace(manifest_.filename(), EntryInfo{&manifest_});
-  known_members_.emplace(protobuf_meta_handler_.filename(),
+  // The manifest is written before the input jars are read, so their
+  // manifests are ignored.
+  known_members_.Emplace(manifest_.filename(), EntryInfo{&null_combiner_});
+  known_members_.Emplace(protobuf_meta_handler_.filename(),
                          EntryInfo{&protobuf_meta_handler_});
-  manifest_.Append(
-      "Manifest-Version: 1.0\r\n"
-      "Created-By: singlejar\r\n");
+  SetManifestAttribute("Manifest-Version", "1.0");
+  SetManifestAttribute("Created-By", "singlejar");
 }
 
 int OutputJar::Doit(Options *options) {
@@ -73,12 +107,17 @@ int OutputJar::Doit(Options *options) {
     diag_errx(1, "%s:%d: Doit() can be called only once.", __FILE__, __LINE__);
   }
   options_ = options;
+  part_path_ = options_->output_jar;
+  if (!options_->stats.empty()) {
+    stats_.reset(new Stats());
+  }
+  uint64_t start_nanos = MonotonicNanos();
 
   // Register the handler for the build-data.properties file unless
   // --exclude_build_data is present. Otherwise we do not generate this file,
   // and it will be copied from the first source archive containing it.
   if (!options_->exclude_build_data) {
-    known_members_.emplace(build_properties_.filename(),
+    known_members_.Emplace(build_properties_.filename(),
                            EntryInfo{&build_properties_});
   }
 
@@ -96,16 +135,38 @@ int OutputJar::Doit(Options *options) {
     fprintf(stderr, "%ld manifest lines\n", options_->manifest_lines.size());
   }
 
+  // Read the previous output before it is overwritten (it can be the same
+  // file as the output).
+  if (!options_->incremental_base.empty()) {
+    output_index_.options_digest(IncrementalOptionsDigest());
+    if (!OpenIncrementalBase()) {
+      if (options_->verbose) {
+        fprintf(stderr, "Cannot use %s as the incremental base\n",
+                options_->incremental_base.c_str());
+      }
+      CloseIncrementalBase();
+    }
+  }
+
   if (!Open()) {
     exit(1);
   }
 
+  // Start scanning input jars, the worker threads (if any) will be reading
+  // them while the launcher, manifest, and resources are written.
+  jar_scanner_.reset(new JarScanner(options_->input_jars,
+                                    options_->include_prefix_matcher,
+                                    options_->threads,
+                                    options_->input_mode));
+  recompressor_.reset(
+      new Recompressor(options_->threads, options_->force_compression));
+
   // Copy launcher if it is set.
   if (!options_->java_launcher.empty()) {
     const char *const launcher_path = options_->java_launcher.c_str();
     int in_fd = open(launcher_path, O_RDONLY);
     struct stat statbuf;
-    if (fd_ < 0 || fstat(in_fd, &statbuf)) {
+    if (in_fd < 0 || fstat(in_fd, &statbuf)) {
       diag_err(1, "%s", launcher_path);
     }
     ssize_t byte_count = AppendFile(in_fd, nullptr, statbuf.st_size);
@@ -125,23 +186,25 @@ int OutputJar::Doit(Options *options) {
 
   if (!options_->main_class.empty()) {
     build_properties_.AddProperty("main.class", options_->main_class);
-    manifest_.Append("Main-Class: ");
-    manifest_.Append(options_->main_class);
-    manifest_.Append("\r\n");
+    SetManifestAttribute("Main-Class", options_->main_class);
   }
 
+  // Like in the Java singlejar, the attributes from --deploy_manifest_lines
+  // override the ones above.
+  std::string manifest_lines;
   for (auto &manifest_line : options_->manifest_lines) {
     if (!manifest_line.empty()) {
-      manifest_.Append(manifest_line);
+      manifest_lines.append(manifest_line);
       if (manifest_line[manifest_line.size() - 1] != '\n') {
-        manifest_.Append("\r\n");
+        manifest_lines.push_back('\n');
       }
     }
   }
+  AddManifestLines(manifest_lines);
 
   for (auto &build_info_line : options_->build_info_lines) {
-    build_properties_.Append(build_info_line);
-    build_properties_.Append("\n");
+    build_properties_.AddProperties(build_info_line.c_str(),
+                                    build_info_line.size());
   }
 
   for (auto &build_info_file : options_->build_info_files) {
@@ -150,19 +213,9 @@ int OutputJar::Doit(Options *options) {
       diag_err(1, "%s:%d: Bad build info file %s", __FILE__, __LINE__,
                build_info_file.c_str());
     }
-    const char *data = reinterpret_cast<const char *>(mapped_file.start());
-    const char *data_end = reinterpret_cast<const char *>(mapped_file.end());
-    // TODO(asmundak): this isn't right, we should parse properties file.
-    while (data < data_end) {
-      const char *next_data = strchr(static_cast<const char *>(data), '\n');
-      if (next_data) {
-        ++next_data;
-      } else {
-        next_data = data_end;
-      }
-      build_properties_.Append(data, next_data - data);
-      data = next_data;
-    }
+    build_properties_.AddProperties(
+        reinterpret_cast<const char *>(mapped_file.start()),
+        mapped_file.size());
     mapped_file.Close();
   }
 
@@ -187,18 +240,20 @@ int OutputJar::Doit(Options *options) {
   // Ready to write zip entries. Decide whether created entries should be
   // compressed.
   bool compress = options_->force_compression || options_->preserve_compression;
+  // The resources are read while the manifest and build data are written.
+  ResourceLoader resource_loader(classpath_resources_, options_->threads,
+                                 compress);
   // First, write a directory entry for the META-INF, followed by the manifest
   // file, followed by the build properties file.
   AddDirectory("META-INF/");
-  manifest_.Append("\r\n");
-  WriteEntry(manifest_.OutputEntry(compress));
+  WriteManifest(compress);
   if (!options_->exclude_build_data) {
     WriteEntry(build_properties_.OutputEntry(compress));
   }
 
   // Then classpath resources.
-  for (auto &classpath_resource : classpath_resources_) {
-    WriteEntry(classpath_resource->OutputEntry(compress));
+  for (size_t ix = 0; ix < classpath_resources_.size(); ++ix) {
+    WriteEntry(resource_loader.Take(ix));
   }
 
   // Then copy source files' contents.
@@ -208,8 +263,35 @@ int OutputJar::Doit(Options *options) {
     }
   }
 
+  jar_scanner_.reset();
+  recompressor_.reset();
+  if (options_->drop_input_pages) {
+    for (auto &retained_jar : retained_jars_) {
+      retained_jar->input_jar.mapped_file().DropCachedPages();
+    }
+  }
+  retained_jars_.clear();
+
   // All entries written, write Central Directory and close.
   Close();
+  if (stats_) {
+    stats_->Set(Stats::kTotalNanos, MonotonicNanos() - start_nanos);
+    stats_->Set(Stats::kDuplicateEntries, duplicate_entries_);
+    stats_->Set(Stats::kTransientBytesPeak, TransientBytes::memory_peak());
+    stats_->SetResourceUsage();
+    if (!stats_->Write(options_->stats)) {
+      diag_err(1, "%s:%d: Cannot write %s", __FILE__, __LINE__,
+               options_->stats.c_str());
+    }
+  }
+  if (!options_->incremental_base.empty()) {
+    CloseIncrementalBase();
+    std::string index_path = IncrementalIndex::IndexPath(options_->output_jar);
+    if (!output_index_.Write(index_path)) {
+      diag_err(1, "%s:%d: Cannot write %s", __FILE__, __LINE__,
+               index_path.c_str());
+    }
+  }
   return 0;
 }
 
@@ -223,6 +305,33 @@ bool OutputJar::Open() {
   if (fd_ >= 0) {
     diag_errx(1, "%s:%d: Cannot open output archive twice", __FILE__, __LINE__);
   }
+  outpos_ = 0;
+  output_buffer_used_ = 0;
+  // The output is written sequentially and its size is known only at the
+  // end, so it can as well be streamed to a pipe or a socket, e.g. one
+  // uploading it while it is written.
+  if (options_->output_to_stdout()) {
+    fd_ = STDOUT_FILENO;
+    use_copy_file_range_ = false;
+    if (options_->verbose) {
+      fprintf(stderr, "Writing to the standard output\n");
+    }
+    return true;
+  }
+  struct stat st;
+  if (!options_->incremental_base.empty() && stat(path(), &st) == 0 &&
+      !S_ISREG(st.st_mode)) {
+    diag_warnx("%s:%d: %s is not a regular file, cannot use --incremental_base",
+               __FILE__, __LINE__, path());
+    return false;
+  }
+  // The previous output may be still in use as the incremental base, so
+  // create a new file rather than truncating it.
+  if (!options_->incremental_base.empty() && unlink(path()) &&
+      errno != ENOENT) {
+    diag_warn("%s:%d: %s", __FILE__, __LINE__, path());
+    return false;
+  }
   // The output file has read/write/execute permissions for the owner,
   // default for the rest.
   mode_t old_umask = umask(0);
@@ -232,6 +341,8 @@ bool OutputJar::Open() {
     diag_warn("%s:%d: %s", __FILE__, __LINE__, path());
     return false;
   }
+  // A named pipe, say. copy_file_range(2) cannot write to it.
+  use_copy_file_range_ = fstat(fd_, &st) == 0 && S_ISREG(st.st_mode);
   if (options_->verbose) {
     fprintf(stderr, "Writing to %s\n", path());
   }
@@ -240,13 +351,51 @@ bool OutputJar::Open() {
 
 bool OutputJar::AddJar(int jar_path_index) {
   const std::string& input_jar_path = options_->input_jars[jar_path_index];
-  InputJar input_jar;
-  if (!input_jar.Open(input_jar_path)) {
+  // The entries which are never copied (signature files and the entries
+  // filtered out by --include_prefixes) have been dropped by the scanner.
+  std::unique_ptr<JarScanner::ScannedJar> scanned_jar;
+  {
+    ScopedTimer timer(stats_.get(), Stats::kScanWaitNanos);
+    scanned_jar = jar_scanner_->Get(jar_path_index);
+  }
+  if (!scanned_jar->opened) {
     return false;
   }
-  const CDH *jar_entry;
-  const LH *lh;
-  while ((jar_entry = input_jar.NextEntry(&lh))) {
+  if (stats_) {
+    stats_->Add(Stats::kInputJars, 1);
+    stats_->Add(Stats::kInputEntries, scanned_jar->entries.size());
+    stats_->Add(Stats::kOpenNanos, scanned_jar->open_nanos);
+    stats_->Add(Stats::kScanNanos, scanned_jar->scan_nanos);
+    if (scanned_jar->indexed) {
+      stats_->Add(Stats::kIndexedJars, 1);
+    }
+  }
+  InputJar &input_jar = scanned_jar->input_jar;
+  const std::vector<JarScanner::Entry> &jar_entries = scanned_jar->entries;
+  size_t next_to_recompress = 0;
+  // Unlike the Central Directory, the entries are read front to back: have
+  // the kernel read ahead further and drop the pages behind.
+  input_jar.mapped_file().Advise(0, input_jar.CentralDirectoryOffset(),
+                                 MADV_SEQUENTIAL);
+
+  // In the incremental mode, if this input jar was there in the previous run,
+  // the entries to be written are checked against the ones written then, and
+  // if they are the same, they are copied from the previous output.
+  uint64_t jar_digest = 0;
+  const IncrementalIndex::JarRecord *base_record = nullptr;
+  std::vector<size_t> reused_entries;
+  off_t jar_output_position = Position();
+  int jar_first_entry = entries_;
+  if (!options_->incremental_base.empty()) {
+    jar_digest = JarDigest(jar_entries);
+    base_record = base_index_.FindJar(jar_digest);
+  }
+
+  for (size_t entry_index = 0; entry_index < jar_entries.size();
+       ++entry_index) {
+    const CDH *jar_entry = jar_entries[entry_index].cdh;
+    const LH *lh = jar_entries[entry_index].lh;
+    const unsigned name_class = jar_entries[entry_index].name_class;
     const char *file_name = jar_entry->file_name();
     auto file_name_length = jar_entry->file_name_length();
     if (!file_name_length) {
@@ -255,42 +404,18 @@ bool OutputJar::AddJar(int jar_path_index) {
           __FILE__, __LINE__, input_jar_path.c_str(),
           input_jar.CentralDirectoryRecordOffset(jar_entry));
     }
-    // Special files that cannot be handled by looking up known_members_ map:
-    // * ignore *.SF, *.RSA, *.DSA
-    //   (TODO(asmundak): should this be done only in META-INF?
-    //
-    if (ends_with(file_name, file_name_length, ".SF") ||
-        ends_with(file_name, file_name_length, ".RSA") ||
-        ends_with(file_name, file_name_length, ".DSA")) {
-      continue;
-    }
-
-    bool include_entry = true;
-    if (!options_->include_prefixes.empty()) {
-      for (auto& prefix : options_->include_prefixes) {
-        if ((include_entry =
-                 (prefix.size() <= file_name_length &&
-                  0 == strncmp(file_name, prefix.c_str(), prefix.size())))) {
-          break;
-        }
-      }
-    }
-    if (!include_entry) {
-      continue;
-    }
 
-    bool is_file = (file_name[file_name_length - 1] != '/');
-    if (is_file &&
-        begins_with(file_name, file_name_length, "META-INF/services/")) {
+    bool is_file = !(name_class & JarScanner::kDirectory);
+    if (name_class & JarScanner::kService) {
       // The contents of the META-INF/services/<SERVICE> on the output is the
       // concatenation of the META-INF/services/<SERVICE> files from all inputs.
-      std::string service_path(file_name, file_name_length);
-      if (NewEntry(service_path)) {
+      if (NewEntry(file_name, file_name_length)) {
         // Create a concatenator and add it to the known_members_ map.
         // The call to Merge() below will then take care of the rest.
+        std::string service_path(file_name, file_name_length);
         Concatenator *service_handler = new Concatenator(service_path);
         service_handlers_.emplace_back(service_handler);
-        known_members_.emplace(service_path, EntryInfo{service_handler});
+        known_members_.Emplace(service_path, EntryInfo{service_handler});
       }
     } else {
       ExtraHandler(jar_entry);
@@ -301,185 +426,643 @@ bool OutputJar::AddJar(int jar_path_index) {
     // will add either a directory entry whose handler will ignore subsequent
     // duplicates, or an ordinary plain entry, for which we save the index of
     // the first input jar (in order to provide diagnostics on duplicate).
-    auto got =
-        known_members_.emplace(std::string(file_name, file_name_length),
-                               EntryInfo{is_file ? nullptr : &null_combiner_,
-                                         is_file ? jar_path_index: -1});
+    std::pair<EntryInfo *, bool> got;
+    {
+      ScopedTimer timer(stats_.get(), Stats::kDedupNanos);
+      got = known_members_.Emplace(
+          file_name, file_name_length, jar_entries[entry_index].name_hash,
+          EntryInfo{is_file ? nullptr : &null_combiner_,
+                    is_file ? jar_path_index : -1,
+                    options_->check_duplicate_contents ? jar_entry : nullptr,
+                    options_->check_duplicate_contents ? lh : nullptr});
+    }
     if (!got.second) {
-      auto &entry_info = got.first->second;
+      auto &entry_info = *got.first;
       // Handle special entries (the ones that have a combiner).
       if (entry_info.combiner_ != nullptr) {
-        entry_info.combiner_->Merge(jar_entry, lh);
+        ScopedTimer timer(stats_.get(), Stats::kCombineNanos);
+        // Combiners may refer to the entry until the output is closed.
+        entry_info.combiner_->MergeMapped(jar_entry, lh,
+                                          input_jar.mapped_file().mapping());
+        if (stats_) {
+          stats_->Add(Stats::kCombinedEntries, 1);
+        }
         continue;
       }
 
-      // Plain file entry. If duplicates are not allowed, bail out. Otherwise
-      // just ignore this entry.
+      // Plain file entry. With --check_duplicate_contents, an entry with the
+      // same contents as the one already written is not a duplicate.
+      if (entry_info.cdh_ != nullptr) {
+        bool same_contents;
+        {
+          ScopedTimer timer(stats_.get(), Stats::kCompareNanos);
+          same_contents =
+              SameContents(entry_info.cdh_, entry_info.lh_, jar_entry, lh);
+        }
+        if (same_contents) {
+          duplicate_entries_++;
+          continue;
+        }
+        if (stats_) {
+          stats_->Add(Stats::kConflictingEntries, 1);
+        }
+      }
+
+      // If duplicates are not allowed, bail out. Otherwise just ignore this
+      // entry.
       if (options_->no_duplicates ||
           (options_->no_duplicate_classes &&
-           ends_with(file_name, file_name_length, ".class"))) {
+           (name_class & JarScanner::kClassFile))) {
         diag_errx(1, "%s:%d: %.*s is present both in %s and %s", __FILE__,
                   __LINE__, file_name_length, file_name,
                   options_->input_jars[entry_info.input_jar_index_].c_str(),
                   input_jar_path.c_str());
       } else {
+        if (entry_info.cdh_ != nullptr) {
+          diag_warnx("%s:%d: %.*s in %s differs from the one in %s, skipping",
+                     __FILE__, __LINE__, file_name_length, file_name,
+                     input_jar_path.c_str(),
+                     options_->input_jars[entry_info.input_jar_index_].c_str());
+        }
         duplicate_entries_++;
         continue;
       }
     }
 
-    // For the file entries and unless preserve_compression option is set,
-    // decide what to do with an entry depending on force_compress option
-    // and entry's current state:
-    //   force_compress    preserve_compress   compressed    Action
-    //         N                  N                 N        Copy
-    //         N                  N                 Y        Decompress
-    //         N                  Y                 *        Copy
-    //         Y                  *                 N        Compress
-    //         Y                  N                 Y        Copy
-    //         Y                  Y      can't be
-    if (is_file &&
-        !options_->preserve_compression &&
-        ((options_->force_compression &&
-          jar_entry->compression_method() == Z_NO_COMPRESSION) ||
-         (!options_->force_compression && !options_->preserve_compression &&
-          jar_entry->compression_method() == Z_DEFLATED))) {
-      // Change compression.
-      Concatenator combiner(jar_entry->file_name_string());
-      if (!combiner.Merge(jar_entry, lh)) {
-        diag_err(1, "%s:%d: cannot add %.*s", __FILE__, __LINE__,
-                 jar_entry->file_name_length(), jar_entry->file_name());
+    if (base_record != nullptr) {
+      // Unless this jar's entries differ from the previous run's, they will
+      // be copied from the previous output.
+      if (reused_entries.size() < base_record->entry_count &&
+          SameName(base_entries_[base_record->first_entry +
+                                 reused_entries.size()],
+                   file_name, file_name_length)) {
+        reused_entries.push_back(entry_index);
+        continue;
+      }
+      base_record = nullptr;
+      for (size_t reused_index : reused_entries) {
+        WriteJarEntry(input_jar, input_jar_path, jar_entries, reused_index,
+                      &next_to_recompress);
+      }
+    }
+    WriteJarEntry(input_jar, input_jar_path, jar_entries, entry_index,
+                  &next_to_recompress);
+  }
+  if (base_record != nullptr) {
+    // With --align, the entries copied from the previous output stay aligned
+    // only if they move by a multiple of the alignment.
+    if (reused_entries.size() == base_record->entry_count &&
+        (options_->alignment <= 1 ||
+         (static_cast<int64_t>(Position()) -
+          static_cast<int64_t>(base_record->offset)) %
+                 options_->alignment ==
+             0)) {
+      CopyFromBase(*base_record);
+      if (options_->verbose) {
+        fprintf(stderr, "Copied %zu entries of %s from %s\n",
+                reused_entries.size(), input_jar_path.c_str(),
+                options_->incremental_base.c_str());
       }
-      WriteEntry(combiner.OutputEntry(options_->force_compression));
-      continue;
-    }
-
-    // Now we have to copy:
-    //  local header
-    //  file data
-    //  data descriptor, if present.
-    off_t copy_from = jar_entry->local_header_offset();
-    size_t num_bytes = lh->size();
-    if (jar_entry->no_size_in_local_header()) {
-      // The size of the data descriptor varies. The actual data in it is three
-      // uint32's (crc32, compressed size, uncompressed size), but these can be
-      // preceded by the "PK\x7\x8" signature word (alas, 'jar' has it).
-      // Reading the descriptor just to figure out whether we need to copy four
-      // or three words will cost us another page read, let us assume the data
-      // description is always 4 words long at the cost of having an occasional
-      // one word gap between the entries.
-      num_bytes += jar_entry->compressed_file_size() + 4 * sizeof(uint32_t);
     } else {
-      num_bytes += lh->compressed_file_size();
-    }
-    off_t output_position = Position();
-
-    // When normalize_timestamps is set, entry's timestamp is to be set to
-    // 01/01/1980 00:00:00 (or to 01/01/1980 00:00:02, if an entry is a .class
-    // file). This is somewhat expensive because we have to copy the local
-    // header to memory as input jar is memory mapped as read-only. Try to copy
-    // as little as possible.
-    uint16_t normalized_time = 0;
-    bool fix_timestamp = false;
-    if (options_->normalize_timestamps) {
-      if (ends_with(file_name, file_name_length, ".class")) {
-        normalized_time = 1;
+      for (size_t reused_index : reused_entries) {
+        WriteJarEntry(input_jar, input_jar_path, jar_entries, reused_index,
+                      &next_to_recompress);
       }
-      fix_timestamp = jar_entry->last_mod_file_date() != 0 ||
-                      jar_entry->last_mod_file_time() != normalized_time;
     }
-    if (fix_timestamp) {
-      uint8_t lh_buffer[512];
-      size_t lh_size = lh->size();
-      LH *lh_new = lh_size > sizeof(lh_buffer)
-                       ? reinterpret_cast<LH *>(malloc(lh_size))
-                       : reinterpret_cast<LH *>(lh_buffer);
-      // Remove Unix timestamp field.
-      auto field_to_remove = lh->unix_time_extra_field();
-      if (field_to_remove != nullptr) {
-        auto from_end = byte_ptr(lh) + lh->size();
-        size_t removed_size = field_to_remove->size();
-        size_t chunk1_size = byte_ptr(field_to_remove) - byte_ptr(lh);
-        size_t chunk2_size = lh->size() - (chunk1_size + removed_size);
-        memcpy(lh_new, lh, chunk1_size);
-        if (chunk2_size) {
-          memcpy(reinterpret_cast<uint8_t *>(lh_new) + chunk1_size,
-                 from_end - chunk2_size, chunk2_size);
-        }
-        lh_new->extra_fields(lh_new->extra_fields(),
-                             lh->extra_fields_length() - removed_size);
-      } else {
-        memcpy(lh_new, lh, lh_size);
+  }
+  if (!options_->incremental_base.empty()) {
+    output_index_.AddJar(IncrementalIndex::JarRecord{
+        jar_digest, static_cast<uint64_t>(jar_output_position),
+        static_cast<uint64_t>(Position() - jar_output_position),
+        static_cast<size_t>(jar_first_entry),
+        static_cast<size_t>(entries_ - jar_first_entry)});
+  }
+  // The pending copy and the entries submitted to the recompressor point
+  // into the input jar.
+  FlushPendingCopy();
+  recompressor_->Drain();
+  if (options_->check_duplicate_contents) {
+    retained_jars_.emplace_back(std::move(scanned_jar));
+    return true;
+  }
+  if (options_->drop_input_pages) {
+    input_jar.mapped_file().DropCachedPages();
+  }
+  return input_jar.Close();
+}
+
+void OutputJar::WriteJarEntry(InputJar &input_jar,
+                              const std::string &input_jar_path,
+                              const std::vector<JarScanner::Entry> &jar_entries,
+                              size_t entry_index, size_t *next_to_recompress) {
+  const CDH *jar_entry = jar_entries[entry_index].cdh;
+  const LH *lh = jar_entries[entry_index].lh;
+  const unsigned name_class = jar_entries[entry_index].name_class;
+  const char *file_name = jar_entry->file_name();
+  auto file_name_length = jar_entry->file_name_length();
+  bool is_file = !(name_class & JarScanner::kDirectory);
+
+  // For the file entries and unless preserve_compression option is set,
+  // decide what to do with an entry depending on force_compress option
+  // and entry's current state:
+  //   force_compress    preserve_compress   compressed    Action
+  //         N                  N                 N        Copy
+  //         N                  N                 Y        Decompress
+  //         N                  Y                 *        Copy
+  //         Y                  *                 N        Compress,
+  //                                                      unless incompressible
+  //         Y                  N                 Y        Copy
+  //         Y                  Y      can't be
+  if (is_file && ChangeCompression(jar_entry, lh)) {
+    // Change compression. Let the recompressor's worker threads (if any)
+    // work on the entries ahead of this one while this one is handled.
+    for (*next_to_recompress = std::max(*next_to_recompress, entry_index + 1);
+         *next_to_recompress < jar_entries.size() &&
+         recompressor_->CanSubmit();
+         ++*next_to_recompress) {
+      const JarScanner::Entry &ahead = jar_entries[*next_to_recompress];
+      auto ahead_name_length = ahead.cdh->file_name_length();
+      if (ahead_name_length &&
+          ahead.cdh->file_name()[ahead_name_length - 1] != '/' &&
+          ChangeCompression(ahead.cdh, ahead.lh) &&
+          NewEntry(ahead.cdh->file_name(), ahead_name_length)) {
+        recompressor_->Submit(*next_to_recompress, ahead.cdh, ahead.lh);
       }
+    }
+    void *recompressed;
+    {
+      ScopedTimer timer(stats_.get(), Stats::kRecompressWaitNanos);
+      recompressed = recompressor_->Take(entry_index, jar_entry, lh);
+    }
+    const LH *recompressed_lh = reinterpret_cast<const LH *>(recompressed);
+    StartPartIfFull(recompressed_lh->size() + recompressed_lh->in_zip_size() +
+                    jar_entry->size());
+    if (stats_) {
+      stats_->Add(Stats::kRecompressedEntries, 1);
+      stats_->Add(Stats::kRecompressedInputBytes,
+                  jar_entry->compressed_file_size());
+      stats_->Add(Stats::kRecompressedOutputBytes,
+                  recompressed_lh->in_zip_size());
+    }
+    WriteEntry(recompressed);
+    return;
+  }
+
+  // Now we have to copy:
+  //  local header
+  //  file data
+  //  data descriptor, if present.
+  off_t copy_from = input_jar.LocalHeaderOffset(lh);
+  const uint8_t *copy_from_address = byte_ptr(lh);
+  size_t num_bytes = lh->size();
+  if (jar_entry->no_size_in_local_header()) {
+    // The size of the data descriptor varies. The actual data in it is three
+    // uint32's (crc32, compressed size, uncompressed size), but these can be
+    // preceded by the "PK\x7\x8" signature word (alas, 'jar' has it).
+    // Reading the descriptor just to figure out whether we need to copy four
+    // or three words will cost us another page read, let us assume the data
+    // description is always 4 words long at the cost of having an occasional
+    // one word gap between the entries.
+    num_bytes += jar_entry->compressed_file_size() + 4 * sizeof(uint32_t);
+  } else {
+    num_bytes += lh->compressed_file_size();
+  }
+  StartPartIfFull(num_bytes + jar_entry->size());
+  off_t output_position = Position();
+
+  // When normalize_timestamps is set, entry's timestamp is to be set to
+  // 01/01/1980 00:00:00 (or to 01/01/1980 00:00:02, if an entry is a .class
+  // file), and the extra fields recording the file system attributes of
+  // the machine the input was created on are removed. This is somewhat
+  // expensive because we have to copy the local header to memory as input
+  // jar is memory mapped as read-only. Try to copy as little as possible.
+  uint16_t normalized_time = 0;
+  bool fix_timestamp = false;
+  if (options_->normalize_timestamps) {
+    if (name_class & JarScanner::kClassFile) {
+      normalized_time = 1;
+    }
+    fix_timestamp = jar_entry->last_mod_file_date() != 0 ||
+                    jar_entry->last_mod_file_time() != normalized_time ||
+                    StableExtraFields(jar_entry->extra_fields(),
+                                      jar_entry->extra_fields_length(),
+                                      nullptr) !=
+                        jar_entry->extra_fields_length() ||
+                    StableExtraFields(lh->extra_fields(),
+                                      lh->extra_fields_length(),
+                                      nullptr) != lh->extra_fields_length();
+  }
+
+  // With --align, a stored entry whose data would not be aligned has its
+  // local header padded with an alignment extra field.
+  uint16_t padding = 0;
+  if (options_->alignment > 1 && is_file &&
+      jar_entry->compression_method() == Z_NO_COMPRESSION) {
+    uint16_t extra_fields_length =
+        fix_timestamp ? StableExtraFields(lh->extra_fields(),
+                                          lh->extra_fields_length(), nullptr)
+                      : lh->extra_fields_length();
+    padding = AlignmentExtraField::padded_size(
+        output_position + sizeof(LH) + lh->file_name_length() +
+            extra_fields_length,
+        options_->alignment);
+    if (extra_fields_length + padding > 0xFFFF) {
+      padding = 0;
+    }
+  }
+  if (fix_timestamp || padding) {
+    uint8_t lh_buffer[512];
+    size_t lh_size = lh->size();
+    LH *lh_new = lh_size + padding > sizeof(lh_buffer)
+                     ? reinterpret_cast<LH *>(malloc(lh_size + padding))
+                     : reinterpret_cast<LH *>(lh_buffer);
+    memcpy(lh_new, lh, lh->extra_fields() - byte_ptr(lh));
+    uint16_t extra_fields_length = lh->extra_fields_length();
+    if (fix_timestamp) {
+      // Copy the header without the volatile extra fields.
+      extra_fields_length =
+          StableExtraFields(lh->extra_fields(), lh->extra_fields_length(),
+                            lh_new->extra_fields());
       lh_new->last_mod_file_date(33);
       lh_new->last_mod_file_time(normalized_time);
-      // Now write these few bytes and adjust read/write positions accordingly.
-      if (!WriteBytes(reinterpret_cast<uint8_t *>(lh_new), lh_new->size())) {
-        diag_err(1, "%s:%d: Cannot copy modified local header for %.*s",
-                 __FILE__, __LINE__, file_name_length, file_name);
+    } else {
+      memcpy(lh_new->extra_fields(), lh->extra_fields(), extra_fields_length);
+    }
+    if (padding) {
+      reinterpret_cast<AlignmentExtraField *>(lh_new->extra_fields() +
+                                              extra_fields_length)
+          ->init(padding, options_->alignment);
+    }
+    lh_new->extra_fields(lh_new->extra_fields(),
+                         extra_fields_length + padding);
+    // Now write these few bytes and adjust read/write positions accordingly.
+    if (!WriteBytes(reinterpret_cast<uint8_t *>(lh_new), lh_new->size())) {
+      diag_err(1, "%s:%d: Cannot copy modified local header for %.*s",
+               __FILE__, __LINE__, file_name_length, file_name);
+    }
+    copy_from += lh_size;
+    copy_from_address += lh_size;
+    num_bytes -= lh_size;
+    if (reinterpret_cast<uint8_t *>(lh_new) != lh_buffer) {
+      free(lh_new);
+    }
+  }
+
+  // Do the actual copy. The entries copied verbatim are usually adjacent
+  // in the input jar, so the copy is deferred in the hope that it can be
+  // coalesced with the next entry's.
+  AppendJarBytes(input_jar.fd(), copy_from, copy_from_address, num_bytes,
+                 input_jar_path.c_str());
+  if (stats_) {
+    stats_->Add(Stats::kCopiedEntries, 1);
+    stats_->Add(Stats::kCopiedBytes, num_bytes);
+    if (is_file && options_->force_compression &&
+        jar_entry->compression_method() == Z_NO_COMPRESSION) {
+      stats_->Add(Stats::kIncompressibleEntries, 1);
+    }
+  }
+
+  // Append central directory header for this file to the output central
+  // directory we are building.
+  if (fix_timestamp) {
+    // Remove the volatile extra fields.
+    const uint8_t *extra_fields = jar_entry->extra_fields();
+    uint16_t extra_fields_length = jar_entry->extra_fields_length();
+    uint16_t stable_length =
+        StableExtraFields(extra_fields, extra_fields_length, nullptr);
+    uint8_t cdh_buffer[512];
+    size_t cdh_size = jar_entry->size() - extra_fields_length + stable_length;
+    CDH *cdh = cdh_size > sizeof(cdh_buffer)
+                   ? reinterpret_cast<CDH *>(malloc(cdh_size))
+                   : reinterpret_cast<CDH *>(cdh_buffer);
+    memcpy(cdh, jar_entry, extra_fields - byte_ptr(jar_entry));
+    StableExtraFields(extra_fields, extra_fields_length, cdh->extra_fields());
+    cdh->extra_fields(cdh->extra_fields(), stable_length);
+    memcpy(cdh->extra_fields() + stable_length,
+           extra_fields + extra_fields_length, jar_entry->comment_length());
+    cdh->last_mod_file_time(normalized_time);
+    cdh->last_mod_file_date(33);
+    AppendToDirectoryBuffer(cdh, output_position);
+    if (reinterpret_cast<uint8_t *>(cdh) != cdh_buffer) {
+      free(cdh);
+    }
+  } else {
+    AppendToDirectoryBuffer(jar_entry, output_position);
+  }
+  ++entries_;
+}
+
+uint16_t OutputJar::StableExtraFields(const uint8_t *extra_fields,
+                                      uint16_t extra_fields_length,
+                                      uint8_t *out) {
+  const uint8_t *end = extra_fields + extra_fields_length;
+  uint16_t out_length = 0;
+  while (extra_fields < end) {
+    auto extra_field = reinterpret_cast<const ExtraField *>(extra_fields);
+    if (end - extra_fields < static_cast<ptrdiff_t>(sizeof(ExtraField)) ||
+        end - extra_fields < extra_field->size()) {
+      // Malformed, keep the rest as it is.
+      size_t rest = end - extra_fields;
+      if (out != nullptr) {
+        memcpy(out + out_length, extra_fields, rest);
       }
-      copy_from += lh_size;
-      num_bytes -= lh_size;
-      if (reinterpret_cast<uint8_t *>(lh_new) != lh_buffer) {
-        free(lh_buffer);
+      return out_length + rest;
+    }
+    if (!extra_field->is_volatile()) {
+      if (out != nullptr) {
+        memcpy(out + out_length, extra_field, extra_field->size());
       }
+      out_length += extra_field->size();
     }
+    extra_fields += extra_field->size();
+  }
+  return out_length;
+}
+
+bool OutputJar::ChangeCompression(const CDH *jar_entry, const LH *lh) const {
+  if (options_->preserve_compression) {
+    return false;
+  }
+  if (!options_->force_compression) {
+    return jar_entry->compression_method() == Z_DEFLATED;
+  }
+  return jar_entry->compression_method() == Z_NO_COMPRESSION &&
+         options_->compression_policy.ShouldCompress(
+             jar_entry->file_name(), jar_entry->file_name_length(), lh->data(),
+             jar_entry->uncompressed_file_size());
+}
+
+uint64_t OutputJar::JarDigest(
+    const std::vector<JarScanner::Entry> &jar_entries) {
+  uint64_t digest = IncrementalIndex::kDigestSeed;
+  for (auto &entry : jar_entries) {
+    digest = IncrementalIndex::Digest(digest, entry.cdh, entry.cdh->size());
+  }
+  return digest;
+}
+
+uint64_t OutputJar::IncrementalOptionsDigest() const {
+  // Everything affecting the contents of the entries copied from the input
+  // jars.
+  std::string options = options_->force_compression ? "c" : "-";
+  options += options_->preserve_compression ? "p" : "-";
+  options += options_->normalize_timestamps ? "n" : "-";
+  if (options_->alignment > 1) {
+    options += "a" + std::to_string(options_->alignment);
+  }
+  for (auto &prefix : options_->include_prefixes) {
+    options += '\n';
+    options += prefix;
+  }
+  if (options_->force_compression) {
+    options += '\0';
+    options += options_->compression_policy.Describe();
+  }
+  return IncrementalIndex::Digest(IncrementalIndex::kDigestSeed,
+                                  options.data(), options.size());
+}
+
+bool OutputJar::SameName(const CDH *cdh, const char *file_name,
+                         size_t file_name_length) {
+  return cdh->file_name_length() == file_name_length &&
+         !memcmp(cdh->file_name(), file_name, file_name_length);
+}
+
+namespace {
 
-    // Do the actual copy. Use sendfile, avoiding copying the data to user
-    // space and back.
-    ssize_t n_copied = AppendFile(input_jar.fd(), &copy_from, num_bytes);
-    if (n_copied < 0) {
-      diag_err(1, "%s:%d: Cannot copy %ld bytes of %.*s from %s", __FILE__,
-               __LINE__, num_bytes, file_name_length, file_name,
-               input_jar_path.c_str());
-    } else if (static_cast<size_t>(n_copied) != num_bytes) {
-      diag_err(1, "%s:%d: Copied only %ld bytes out of %ld from %s", __FILE__,
-               __LINE__, n_copied, num_bytes, input_jar_path.c_str());
-    }
-
-    // Append central directory header for this file to the output central
-    // directory we are building.
-    TODO(output_position < 0xFFFFFFFF, "Handle Zip64");
-
-    CDH *out_cdh;
-    auto field_to_remove =
-        fix_timestamp ? jar_entry->unix_time_extra_field() : nullptr;
-    if (field_to_remove != nullptr) {
-      // Remove extra fields.
-      auto from_start = byte_ptr(jar_entry);
-      auto from_end = from_start + jar_entry->size();
-      size_t removed_size = field_to_remove->size();
-      size_t chunk1_size = byte_ptr(field_to_remove) - from_start;
-      size_t chunk2_size = jar_entry->size() - (chunk1_size + removed_size);
-      out_cdh =
-          reinterpret_cast<CDH *>(ReserveCdr(jar_entry->size() - removed_size));
-      memcpy(out_cdh, jar_entry, chunk1_size);
-      if (chunk2_size) {
-        memcpy(reinterpret_cast<uint8_t *>(out_cdh) + chunk1_size,
-               from_end - chunk2_size, chunk2_size);
+// Reads the uncompressed contents of a stored or deflated entry piece by
+// piece. A stored entry is returned as a single piece, pointing into the
+// input jar.
+class EntryReader {
+ public:
+  EntryReader(const CDH *cdh, const LH *lh)
+      : stored_(cdh->compression_method() == Z_NO_COMPRESSION),
+        in_(lh->data()),
+        in_end_(lh->data() + InZipSize(cdh)),
+        done_(false),
+        error_(false) {}
+
+  // The size of the entry's data in the input jar.
+  static size_t InZipSize(const CDH *cdh) {
+    return cdh->compression_method() ? cdh->compressed_file_size()
+                                     : cdh->uncompressed_file_size();
+  }
+
+  // Returns the size of the next piece and its address in *data, or 0 when
+  // there is no more data (or it cannot be inflated, which error() tells).
+  size_t Next(const uint8_t **data) {
+    if (done_) {
+      return 0;
+    }
+    if (stored_) {
+      done_ = true;
+      *data = in_;
+      return in_end_ - in_;
+    }
+    if (!inflater_) {
+      inflater_.reset(new Inflater());
+      buffer_.reset(new uint8_t[kBufferSize]);
+      FeedInflater();
+    }
+    for (;;) {
+      if (in_ < in_end_ && inflater_->next_in() == in_) {
+        FeedInflater();
+      }
+      int rc = inflater_->Inflate(buffer_.get(), kBufferSize);
+      size_t out_size = kBufferSize - inflater_->available_out();
+      if (rc == Z_STREAM_END) {
+        done_ = true;
+      } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+        done_ = error_ = true;
+        return 0;
+      }
+      if (out_size || done_) {
+        *data = buffer_.get();
+        return out_size;
+      }
+      if (in_ == in_end_ && inflater_->next_in() == in_) {
+        // Truncated stream.
+        done_ = error_ = true;
+        return 0;
       }
-      out_cdh->extra_fields(out_cdh->extra_fields(),
-                            jar_entry->extra_fields_length() - removed_size);
-    } else {
-      out_cdh = AppendToDirectoryBuffer(jar_entry);
     }
-    out_cdh->local_header_offset32(output_position);
-    if (fix_timestamp) {
-      out_cdh->last_mod_file_time(normalized_time);
-      out_cdh->last_mod_file_date(33);
+  }
+
+  bool error() const { return error_; }
+
+ private:
+  // Hands the next piece of the input to the inflater, in the pieces the
+  // 32-bit zlib sizes can represent.
+  void FeedInflater() {
+    size_t in_size = std::min(static_cast<size_t>(in_end_ - in_),
+                              static_cast<size_t>(1) << 30);
+    inflater_->DataToInflate(in_, in_size);
+    in_ += in_size;
+  }
+
+  static const size_t kBufferSize = 64 * 1024;
+  const bool stored_;
+  const uint8_t *in_;  // The input not handed to the inflater yet.
+  const uint8_t *const in_end_;
+  bool done_;
+  bool error_;
+  std::unique_ptr<Inflater> inflater_;
+  std::unique_ptr<uint8_t[]> buffer_;
+};
+
+}  // namespace
+
+bool OutputJar::SameContents(const CDH *cdh1, const LH *lh1, const CDH *cdh2,
+                             const LH *lh2) {
+  if (cdh1->crc32() != cdh2->crc32() ||
+      cdh1->uncompressed_file_size() != cdh2->uncompressed_file_size()) {
+    return false;
+  }
+  for (const CDH *cdh : {cdh1, cdh2}) {
+    if (cdh->compression_method() != Z_NO_COMPRESSION &&
+        cdh->compression_method() != Z_DEFLATED) {
+      return false;
+    }
+  }
+  // The same compressed bytes mean the same contents.
+  size_t in_zip_size = EntryReader::InZipSize(cdh1);
+  if (cdh1->compression_method() == cdh2->compression_method() &&
+      in_zip_size == EntryReader::InZipSize(cdh2) &&
+      !memcmp(lh1->data(), lh2->data(), in_zip_size)) {
+    return true;
+  }
+  EntryReader reader1(cdh1, lh1);
+  EntryReader reader2(cdh2, lh2);
+  const uint8_t *data1 = nullptr;
+  const uint8_t *data2 = nullptr;
+  size_t size1 = 0;
+  size_t size2 = 0;
+  for (;;) {
+    if (!size1) {
+      size1 = reader1.Next(&data1);
+    }
+    if (!size2) {
+      size2 = reader2.Next(&data2);
+    }
+    if (!size1 || !size2) {
+      return !size1 && !size2 && !reader1.error() && !reader2.error();
+    }
+    size_t size = std::min(size1, size2);
+    if (memcmp(data1, data2, size)) {
+      return false;
+    }
+    data1 += size;
+    data2 += size;
+    size1 -= size;
+    size2 -= size;
+  }
+}
+
+bool OutputJar::OpenIncrementalBase() {
+  const std::string &base_path = options_->incremental_base;
+  IncrementalIndex &index = base_index_;
+  if (!index.Read(IncrementalIndex::IndexPath(base_path)) ||
+      index.options_digest() != IncrementalOptionsDigest()) {
+    return false;
+  }
+  base_jar_.reset(new InputJar());
+  if (!base_jar_->Open(base_path)) {
+    return false;
+  }
+  uint64_t digest = IncrementalIndex::kDigestSeed;
+  const CDH *cdh;
+  const LH *lh;
+  while ((cdh = base_jar_->NextEntry(&lh))) {
+    if (!lh->is()) {
+      return false;
+    }
+    digest = IncrementalIndex::Digest(digest, cdh, cdh->size());
+    base_entries_.push_back(cdh);
+  }
+  if (digest != index.output_digest()) {
+    return false;
+  }
+  for (auto &record : index.jars()) {
+    if (record.entry_count &&
+        (record.first_entry + record.entry_count > base_entries_.size() ||
+         base_entries_[record.first_entry]->local_header_offset() !=
+             record.offset)) {
+      return false;
     }
+  }
+  return true;
+}
+
+void OutputJar::CloseIncrementalBase() {
+  base_index_ = IncrementalIndex();
+  base_entries_.clear();
+  base_jar_.reset();
+}
+
+void OutputJar::CopyFromBase(const IncrementalIndex::JarRecord &record) {
+  if (!record.entry_count) {
+    return;
+  }
+  off_t output_position = Position();
+  const LH *lh = base_jar_->LocalHeader(base_entries_[record.first_entry]);
+  AppendJarBytes(base_jar_->fd(), base_jar_->LocalHeaderOffset(lh),
+                 byte_ptr(lh), record.size, options_->incremental_base.c_str());
+  if (stats_) {
+    stats_->Add(Stats::kReusedEntries, record.entry_count);
+    stats_->Add(Stats::kReusedBytes, record.size);
+  }
+  for (size_t i = 0; i < record.entry_count; ++i) {
+    const CDH *base_entry = base_entries_[record.first_entry + i];
+    AppendToDirectoryBuffer(base_entry, base_entry->local_header_offset() -
+                                            record.offset + output_position);
     ++entries_;
   }
-  return input_jar.Close();
 }
 
-off_t OutputJar::Position() {
-  off_t position = lseek(fd_, 0, SEEK_CUR);
-  if (position == (off_t)-1) {
-    diag_err(1, "%s:%d: lseek", __FILE__, __LINE__);
+off_t OutputJar::Position() { return outpos_ + pending_copy_.count; }
+
+void OutputJar::AppendJarBytes(int in_fd, off_t in_offset,
+                               const uint8_t *in_address, size_t count,
+                               const char *in_path) {
+  if (pending_copy_.count && pending_copy_.fd == in_fd &&
+      pending_copy_.offset + static_cast<off_t>(pending_copy_.count) ==
+          in_offset) {
+    pending_copy_.count += count;
+    return;
+  }
+  FlushPendingCopy();
+  pending_copy_.fd = in_fd;
+  pending_copy_.offset = in_offset;
+  pending_copy_.address = in_address;
+  pending_copy_.count = count;
+  pending_copy_.path = in_path;
+}
+
+void OutputJar::FlushPendingCopy() {
+  size_t count = pending_copy_.count;
+  if (!count) {
+    return;
+  }
+  pending_copy_.count = 0;
+  ScopedTimer timer(stats_.get(), Stats::kCopyNanos);
+  // A small range is copied from the mapped input jar to the output buffer,
+  // a larger one within the kernel.
+  if (!kCopyWithinKernel || count <= kBufferedCopySize) {
+    if (!WriteBytes(pending_copy_.address, count)) {
+      diag_err(1, "%s:%d: Cannot copy %zu bytes from %s", __FILE__, __LINE__,
+               count, pending_copy_.path);
+    }
+    return;
+  }
+  off_t offset = pending_copy_.offset;
+  ssize_t n_copied = AppendFile(pending_copy_.fd, &offset, count);
+  if (n_copied < 0) {
+    diag_err(1, "%s:%d: Cannot copy %zu bytes from %s", __FILE__, __LINE__,
+             count, pending_copy_.path);
+  } else if (static_cast<size_t>(n_copied) != count) {
+    diag_errx(1, "%s:%d: Copied only %zd bytes out of %zu from %s", __FILE__,
+              __LINE__, n_copied, count, pending_copy_.path);
   }
-  TODO(position < 0xFFFFFFFF, "Handle Zip64");
-  return position;
 }
 
 // Writes an entry. The argument is the pointer to the contiguos block of
@@ -525,12 +1108,43 @@ void OutputJar::WriteEntry(void *buffer) {
 
   uint8_t *data = reinterpret_cast<uint8_t *>(entry);
   off_t output_position = Position();
-  if (!WriteBytes(data, entry->data() + entry->in_zip_size() - data)) {
+  uint16_t padding = 0;
+  if (entry->compression_method() == Z_NO_COMPRESSION) {
+    padding = AlignmentExtraField::padded_size(output_position + entry->size(),
+                                               options_->alignment);
+    if (entry->extra_fields_length() + padding > 0xFFFF) {
+      padding = 0;
+    }
+  }
+  if (padding) {
+    // With --align, pad the header so that the stored data is aligned.
+    uint8_t header_buffer[512];
+    size_t header_size = entry->size();
+    uint8_t *header = header_size + padding > sizeof(header_buffer)
+                          ? reinterpret_cast<uint8_t *>(
+                                malloc(header_size + padding))
+                          : header_buffer;
+    memcpy(header, entry, header_size);
+    reinterpret_cast<AlignmentExtraField *>(header + header_size)
+        ->init(padding, options_->alignment);
+    LH *lh = reinterpret_cast<LH *>(header);
+    lh->extra_fields(lh->extra_fields(),
+                     entry->extra_fields_length() + padding);
+    if (!WriteBytes(header, header_size + padding) ||
+        !WriteBytes(entry->data(), entry->in_zip_size())) {
+      diag_err(1, "%s:%d: write", __FILE__, __LINE__);
+    }
+    if (header != header_buffer) {
+      free(header);
+    }
+  } else if (!WriteBytes(data, entry->data() + entry->in_zip_size() - data)) {
     diag_err(1, "%s:%d: write", __FILE__, __LINE__);
   }
-  // Data written, allocate CDH space and populate CDH.
-  CDH *cdh = reinterpret_cast<CDH *>(
-      ReserveCdh(sizeof(CDH) + entry->file_name_length()));
+  // Data written, populate CDH. The sizes that do not fit into 32 bits are
+  // in the local header's Zip64 extra field, and go to the CDH's one.
+  size_t cdh_size = sizeof(CDH) + entry->file_name_length();
+  std::unique_ptr<uint8_t[]> cdh_buffer(new uint8_t[cdh_size]);
+  CDH *cdh = reinterpret_cast<CDH *>(memset(cdh_buffer.get(), 0, cdh_size));
   cdh->signature();
   // Note: do not set the version to Unix 3.0 spec, otherwise
   // unzip will think that 'external_attributes' field contains access mode
@@ -541,17 +1155,14 @@ void OutputJar::WriteEntry(void *buffer) {
   cdh->last_mod_file_time(entry->last_mod_file_time());
   cdh->last_mod_file_date(entry->last_mod_file_date());
   cdh->crc32(entry->crc32());
-  TODO(entry->compressed_file_size32() != 0xFFFFFFFF, "Handle Zip64");
-  cdh->compressed_file_size32(entry->compressed_file_size32());
-  TODO(entry->uncompressed_file_size32() != 0xFFFFFFFF, "Handle Zip64");
-  cdh->uncompressed_file_size32(entry->uncompressed_file_size32());
   cdh->file_name(entry->file_name(), entry->file_name_length());
   cdh->extra_fields(nullptr, 0);
   cdh->comment_length(0);
   cdh->start_disk_nr(0);
   cdh->internal_attributes(0);
   cdh->external_attributes(0);
-  cdh->local_header_offset32(output_position);
+  AppendToDirectoryBuffer(cdh, entry->compressed_file_size(),
+                          entry->uncompressed_file_size(), output_position);
   ++entries_;
   free(reinterpret_cast<void *>(entry));
 }
@@ -569,27 +1180,107 @@ void OutputJar::AddDirectory(const char *path) {
   lh->uncompressed_file_size32(0);
   lh->file_name(path, n_path);
   lh->extra_fields(nullptr, 0);
-  known_members_.emplace(path, EntryInfo{&null_combiner_});
+  known_members_.Emplace(path, n_path, EntryInfo{&null_combiner_});
   WriteEntry(lh);
 }
 
-// Appends a Central Directory Entry to the directory buffer.
-CDH *OutputJar::AppendToDirectoryBuffer(const CDH *cdh) {
-  size_t cdh_size = cdh->size();
-  return reinterpret_cast<CDH *>(
-      memcpy(reinterpret_cast<CDH *>(ReserveCdr(cdh_size)), cdh, cdh_size));
+CDH *OutputJar::AppendToDirectoryBuffer(const CDH *cdh,
+                                        uint64_t local_header_offset) {
+  return AppendToDirectoryBuffer(cdh, cdh->compressed_file_size(),
+                                 cdh->uncompressed_file_size(),
+                                 local_header_offset);
 }
 
-uint8_t *OutputJar::ReserveCdr(size_t chunk_size) {
-  if (cen_size_ + chunk_size > cen_capacity_) {
-    cen_capacity_ += 1000000;
-    cen_ = reinterpret_cast<uint8_t *>(realloc(cen_, cen_capacity_));
-    if (!cen_) {
-      diag_errx(1, "%s:%d: Cannot allocate %ld bytes for the directory",
-                __FILE__, __LINE__, cen_capacity_);
+CDH *OutputJar::AppendToDirectoryBuffer(const CDH *cdh,
+                                        uint64_t compressed_size,
+                                        uint64_t uncompressed_size,
+                                        uint64_t local_header_offset) {
+  const uint64_t kZip64Marker = 0xFFFFFFFF;
+  const Zip64ExtraField *zip64 = cdh->zip64_extra_field();
+  uint64_t zip64_attrs[3];
+  int zip64_attr_count = 0;
+  // The Zip64 extra field has them in this order.
+  for (uint64_t value :
+       {uncompressed_size, compressed_size, local_header_offset}) {
+    if (value >= kZip64Marker) {
+      zip64_attrs[zip64_attr_count++] = value;
     }
   }
-  uint8_t *entry = cen_ + cen_size_;
+
+  CDH *out_cdh;
+  if (zip64 == nullptr && zip64_attr_count == 0) {
+    // The common case: copy as it is.
+    size_t cdh_size = cdh->size();
+    out_cdh = reinterpret_cast<CDH *>(memcpy(ReserveCdr(cdh_size), cdh,
+                                             cdh_size));
+  } else {
+    // Replace the Zip64 extra field (if any) with the one holding the
+    // values above, keeping the other extra fields.
+    const uint8_t *extra_fields = cdh->extra_fields();
+    size_t extra_fields_length = cdh->extra_fields_length();
+    size_t before_zip64 = extra_fields_length;
+    size_t after_zip64 = 0;
+    if (zip64 != nullptr) {
+      before_zip64 = byte_ptr(zip64) - extra_fields;
+      after_zip64 = extra_fields_length - before_zip64 -
+                    std::min<size_t>(zip64->size(),
+                                     extra_fields_length - before_zip64);
+    }
+    size_t zip64_size =
+        zip64_attr_count
+            ? sizeof(Zip64ExtraField) + zip64_attr_count * sizeof(uint64_t)
+            : 0;
+    size_t out_extra_fields_length = zip64_size + before_zip64 + after_zip64;
+    if (out_extra_fields_length > 0xFFFF) {
+      diag_errx(1, "%s:%d: No room for Zip64 extra field of %.*s", __FILE__,
+                __LINE__, cdh->file_name_length(), cdh->file_name());
+    }
+    out_cdh = reinterpret_cast<CDH *>(
+        ReserveCdr(sizeof(CDH) + cdh->file_name_length() +
+                   out_extra_fields_length + cdh->comment_length()));
+    memcpy(out_cdh, cdh, extra_fields - byte_ptr(cdh));
+    uint8_t *out_extra_fields = out_cdh->extra_fields();
+    if (zip64_attr_count) {
+      Zip64ExtraField *out_zip64 =
+          reinterpret_cast<Zip64ExtraField *>(out_extra_fields);
+      out_zip64->signature();
+      out_zip64->payload_size(zip64_attr_count * sizeof(uint64_t));
+      for (int i = 0; i < zip64_attr_count; ++i) {
+        out_zip64->attr64(i, zip64_attrs[i]);
+      }
+      if (out_cdh->version_to_extract() < 45) {
+        out_cdh->version_to_extract(45);  // 4.5 (Zip64 support)
+      }
+    }
+    memcpy(out_extra_fields + zip64_size, extra_fields, before_zip64);
+    memcpy(out_extra_fields + zip64_size + before_zip64,
+           extra_fields + extra_fields_length - after_zip64, after_zip64);
+    out_cdh->extra_fields(out_extra_fields, out_extra_fields_length);
+    memcpy(out_extra_fields + out_extra_fields_length,
+           extra_fields + extra_fields_length, cdh->comment_length());
+  }
+  out_cdh->compressed_file_size32(std::min(compressed_size, kZip64Marker));
+  out_cdh->uncompressed_file_size32(std::min(uncompressed_size, kZip64Marker));
+  out_cdh->local_header_offset32(std::min(local_header_offset, kZip64Marker));
+  return out_cdh;
+}
+
+uint8_t *OutputJar::ReserveCdr(size_t chunk_size) {
+  // The directory is kept in a list of chunks rather than in a single
+  // buffer, so that growing it does not copy what has been already added.
+  if (cen_chunks_.empty() ||
+      cen_chunks_.back().used + chunk_size > cen_chunks_.back().capacity) {
+    size_t capacity = std::max(kCenChunkSize, chunk_size);
+    cen_chunks_.emplace_back();
+    CenChunk &chunk = cen_chunks_.back();
+    chunk.data.reset(new uint8_t[capacity]);
+    chunk.used = 0;
+    chunk.capacity = capacity;
+    cen_capacity_ += capacity;
+  }
+  CenChunk &chunk = cen_chunks_.back();
+  uint8_t *entry = chunk.data.get() + chunk.used;
+  chunk.used += chunk_size;
   cen_size_ += chunk_size;
   return entry;
 }
@@ -604,26 +1295,55 @@ bool OutputJar::Close() {
     return true;
   }
 
-  for (auto &service_handler : service_handlers_) {
-    WriteEntry(service_handler->OutputEntry(options_->force_compression));
+  {
+    ScopedTimer timer(stats_.get(), Stats::kCombineNanos);
+    // The service files are written in the name order rather than in the
+    // order they have been encountered in, so that the output depends only
+    // on the set of the input entries.
+    std::sort(service_handlers_.begin(), service_handlers_.end(),
+              [](const std::unique_ptr<Concatenator> &a,
+                 const std::unique_ptr<Concatenator> &b) {
+                return a->filename() < b->filename();
+              });
+    for (auto &service_handler : service_handlers_) {
+      WriteEntry(service_handler->OutputEntry(options_->force_compression));
+    }
+    for (auto &extra_combiner : extra_combiners_) {
+      WriteEntry(extra_combiner->OutputEntry(options_->force_compression));
+    }
+    WriteEntry(spring_handlers_.OutputEntry(options_->force_compression));
+    WriteEntry(spring_schemas_.OutputEntry(options_->force_compression));
+    WriteEntry(
+        protobuf_meta_handler_.OutputEntry(options_->force_compression));
   }
-  for (auto &extra_combiner : extra_combiners_) {
-    WriteEntry(extra_combiner->OutputEntry(options_->force_compression));
+  if (!ClosePart()) {
+    return false;
   }
-  WriteEntry(spring_handlers_.OutputEntry(options_->force_compression));
-  WriteEntry(spring_schemas_.OutputEntry(options_->force_compression));
-  WriteEntry(protobuf_meta_handler_.OutputEntry(options_->force_compression));
-  // TODO(asmundak): handle manifest;
-  off_t output_position = lseek(fd_, 0, SEEK_CUR);
-  if (output_position == (off_t)-1) {
-    diag_err(1, "%s:%d: lseek", __FILE__, __LINE__);
+  if (stats_) {
+    stats_->Set(Stats::kOutputParts, part_ + 1);
   }
+  // Remove the parts left over from a previous run split into more parts.
+  if (options_->split_output()) {
+    for (int part = part_ + 1;
+         !unlink(PartPath(options_->output_jar, part).c_str()); ++part) {
+    }
+  }
+  return true;
+}
+
+bool OutputJar::ClosePart() {
+  FlushPendingCopy();
+  off_t output_position = outpos_;
   bool write_zip64_ecd = output_position >= 0xFFFFFFFF || entries_ >= 0xFFFF ||
                          cen_size_ >= 0xFFFFFFFF;
 
-  TODO(output_position < 0xFFFFFFFF, "Handle Zip64");
-
   size_t cen_size = cen_size_;  // Save it before ReserveCdh updates it.
+  uint64_t cen_digest = IncrementalIndex::kDigestSeed;
+  for (auto &chunk : cen_chunks_) {
+    cen_digest =
+        IncrementalIndex::Digest(cen_digest, chunk.data.get(), chunk.used);
+  }
+  output_index_.output_digest(cen_digest);
   if (write_zip64_ecd) {
     ECD64 *ecd64 = reinterpret_cast<ECD64 *>(ReserveCdh(sizeof(ECD64)));
     ECD64Locator *ecd64_locator =
@@ -662,10 +1382,21 @@ bool OutputJar::Close() {
   }
 
   // Save Central Directory and wrap up.
-  if (!WriteBytes(cen_, cen_size_)) {
-    diag_err(1, "%s:%d: Cannot write central directory", __FILE__, __LINE__);
+  {
+    ScopedTimer timer(stats_.get(), Stats::kCenWriteNanos);
+    if (!WriteCentralDirectory()) {
+      diag_err(1, "%s:%d: Cannot write central directory", __FILE__, __LINE__);
+    }
   }
-  free(cen_);
+  if (stats_) {
+    stats_->Add(Stats::kOutputEntries, entries_);
+    stats_->Add(Stats::kOutputBytes, outpos_);
+    stats_->Add(Stats::kCenBytes, cen_size_);
+    stats_->Max(Stats::kCenPeakCapacity, cen_capacity_);
+  }
+  cen_chunks_.clear();
+  cen_size_ = 0;
+  cen_capacity_ = 0;
 
   if (close(fd_)) {
     diag_err(1, "%s:%d: %s", __FILE__, __LINE__, path());
@@ -684,9 +1415,197 @@ bool OutputJar::Close() {
   return true;
 }
 
+void OutputJar::StartPartIfFull(size_t entry_size) {
+  if (!options_->split_output() || entries_ == 0) {
+    return;
+  }
+  uint64_t part_size = static_cast<uint64_t>(Position()) + cen_size_;
+  if ((options_->max_part_entries <= 0 ||
+       entries_ < options_->max_part_entries) &&
+      (options_->max_part_megabytes <= 0 ||
+       part_size + entry_size <=
+           static_cast<uint64_t>(options_->max_part_megabytes) << 20)) {
+    return;
+  }
+  if (!ClosePart()) {
+    diag_errx(1, "%s:%d: Cannot write %s", __FILE__, __LINE__, path());
+  }
+  entries_ = 0;
+  part_path_ = PartPath(options_->output_jar, ++part_);
+  if (!Open()) {
+    exit(1);
+  }
+}
+
+std::string OutputJar::PartPath(const std::string &output_jar, int part) {
+  if (part == 0) {
+    return output_jar;
+  }
+  std::string suffix = "-" + std::to_string(part + 1);
+  size_t dot = output_jar.rfind('.');
+  size_t slash = output_jar.rfind('/');
+  if (dot == std::string::npos || dot == 0 ||
+      (slash != std::string::npos && dot <= slash + 1)) {
+    return output_jar + suffix;
+  }
+  return output_jar.substr(0, dot) + suffix + output_jar.substr(dot);
+}
+
+bool OutputJar::WriteCentralDirectory() {
+  FlushPendingCopy();
+  if (!FlushOutputBuffer()) {
+    return false;
+  }
+  std::vector<struct iovec> iov;
+  for (auto &chunk : cen_chunks_) {
+    iov.push_back(iovec{chunk.data.get(), chunk.used});
+  }
+  // Write all the chunks with as few calls as possible, taking care of
+  // the partial writes.
+  size_t next = 0;
+  for (;;) {
+    while (next < iov.size() && !iov[next].iov_len) {
+      ++next;
+    }
+    if (next == iov.size()) {
+      return true;
+    }
+    int iov_count = static_cast<int>(
+        std::min(iov.size() - next, static_cast<size_t>(IOV_MAX)));
+    ssize_t n_written = writev(fd_, &iov[next], iov_count);
+    if (stats_) {
+      stats_->Add(Stats::kWriteCalls, 1);
+    }
+    if (n_written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    outpos_ += n_written;
+    size_t remaining = static_cast<size_t>(n_written);
+    while (remaining > 0) {
+      if (remaining >= iov[next].iov_len) {
+        remaining -= iov[next].iov_len;
+        ++next;
+      } else {
+        iov[next].iov_base =
+            reinterpret_cast<uint8_t *>(iov[next].iov_base) + remaining;
+        iov[next].iov_len -= remaining;
+        remaining = 0;
+      }
+    }
+  }
+}
+
+// Returns whether the manifest attribute names "a" and "b" are the same.
+static bool SameAttributeName(const std::string &a, const std::string &b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (tolower(static_cast<unsigned char>(a[i])) !=
+        tolower(static_cast<unsigned char>(b[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void OutputJar::SetManifestAttribute(const std::string &name,
+                                     const std::string &value) {
+  for (auto &attribute : manifest_attributes_) {
+    if (SameAttributeName(attribute.first, name)) {
+      attribute.second = value;
+      return;
+    }
+  }
+  manifest_attributes_.emplace_back(name, value);
+}
+
+void OutputJar::AddManifestLines(const std::string &lines) {
+  std::string name;
+  std::string value;
+  bool in_sections = !manifest_sections_.empty();
+  size_t line_start = 0;
+  while (line_start < lines.size()) {
+    size_t line_end = lines.find('\n', line_start);
+    if (line_end == std::string::npos) {
+      line_end = lines.size();
+    }
+    size_t next_line = line_end + 1;
+    if (line_end > line_start && lines[line_end - 1] == '\r') {
+      --line_end;
+    }
+    std::string line = lines.substr(line_start, line_end - line_start);
+    line_start = next_line;
+
+    if (in_sections) {
+      // The sections are written as they are, only the line endings change.
+      manifest_sections_.append(line);
+      manifest_sections_.append("\r\n");
+    } else if (line.empty()) {
+      // An empty line ends the main section.
+      in_sections = true;
+    } else if (line[0] == ' ') {
+      // A continuation of the previous line.
+      if (name.empty()) {
+        diag_errx(1, "%s:%d: Bad manifest continuation line '%s'", __FILE__,
+                  __LINE__, line.c_str());
+      }
+      value.append(line, 1, std::string::npos);
+    } else {
+      size_t colon = line.find(": ");
+      if (colon == 0 || colon == std::string::npos) {
+        diag_errx(1, "%s:%d: Bad manifest line '%s'", __FILE__, __LINE__,
+                  line.c_str());
+      }
+      if (!name.empty()) {
+        SetManifestAttribute(name, value);
+      }
+      name = line.substr(0, colon);
+      value = line.substr(colon + 2);
+    }
+  }
+  if (!name.empty()) {
+    SetManifestAttribute(name, value);
+  }
+}
+
+void OutputJar::WriteManifest(bool compress) {
+  // The manifest lines may be at most 72 bytes long, the longer ones are
+  // continued on the following lines, which start with a space. The lines
+  // are not broken within a UTF-8 sequence.
+  static const size_t kMaxLineLength = 72;
+  for (auto &attribute : manifest_attributes_) {
+    const std::string line = attribute.first + ": " + attribute.second;
+    size_t max_length = kMaxLineLength;
+    for (size_t start = 0; start < line.size();) {
+      size_t length = std::min(max_length, line.size() - start);
+      if (start + length < line.size()) {
+        while (length > 1 &&
+               (static_cast<unsigned char>(line[start + length]) & 0xC0) ==
+                   0x80) {
+          --length;
+        }
+      }
+      if (start > 0) {
+        manifest_.Append(" ");
+      }
+      manifest_.Append(line.data() + start, length);
+      manifest_.Append("\r\n");
+      start += length;
+      max_length = kMaxLineLength - 1;
+    }
+  }
+  manifest_.Append("\r\n");
+  manifest_.Append(manifest_sections_);
+  WriteEntry(manifest_.OutputEntry(compress));
+}
+
 void OutputJar::ClasspathResource(const std::string &resource_name,
                                   const std::string &resource_path) {
-  if (known_members_.count(resource_name)) {
+  if (known_members_.Contains(resource_name)) {
     if (options_->warn_duplicate_resources) {
       diag_warnx(
           "%s:%d: Duplicate resource name %s in the --classpath_resource or "
@@ -698,91 +1617,145 @@ void OutputJar::ClasspathResource(const std::string &resource_name,
       return;
     }
   }
-  MappedFile mapped_file;
-  if (!mapped_file.Open(resource_path)) {
-    diag_err(1, "%s:%d: %s", __FILE__, __LINE__, resource_path.c_str());
-  }
-  Concatenator *classpath_resource = new Concatenator(resource_name);
-  classpath_resource->Append(
-      reinterpret_cast<const char *>(mapped_file.start()), mapped_file.size());
-  classpath_resources_.emplace_back(classpath_resource);
-  known_members_.emplace(resource_name, EntryInfo{classpath_resource});
+  // The resource is only read when it is written, before the input jars,
+  // so the entries of the jars with the same name are dropped.
+  classpath_resources_.push_back(
+      ResourceLoader::Resource{resource_name, resource_path});
+  known_members_.Emplace(resource_name, EntryInfo{&null_combiner_});
 }
 
-#if defined(__APPLE__)
+#if !defined(__linux)
 ssize_t OutputJar::AppendFile(int in_fd, off_t *in_offset, size_t count) {
+  FlushPendingCopy();
   if (!count) {
     return 0;
   }
-  uint8_t buffer[8192];
-  ssize_t total_written = 0;
-
-  // If the input file position (the offset in the input file) has been  passed,
-  // that's where we start, and the input file position has to be restored after
-  // we are done copying.
-  const off_t offset_error = static_cast<off_t>(-1);
-  off_t old_input_offset = offset_error;
-  if (in_offset) {
-    if (offset_error == (old_input_offset = lseek(in_fd, 0, SEEK_CUR)) ||
-        offset_error == lseek(in_fd, *in_offset, SEEK_SET)) {
-      return -1;
-    }
-  }
+  // Read in large chunks, which are written out bypassing the output buffer.
+  // If the input file position (the offset in the input file) has been
+  // passed, that's where the reads start, and the input file position is
+  // left alone.
+  std::unique_ptr<uint8_t[]> buffer(
+      new uint8_t[std::min(count, kAppendBufferSize)]);
+  size_t total_written = 0;
   while (total_written < count) {
+    size_t chunk_size = std::min(kAppendBufferSize, count - total_written);
     ssize_t n_read =
-        read(in_fd, buffer, std::min(sizeof(buffer), count - total_written));
+        in_offset ? pread(in_fd, buffer.get(), chunk_size,
+                          *in_offset + static_cast<off_t>(total_written))
+                  : read(in_fd, buffer.get(), chunk_size);
+    if (stats_) {
+      stats_->Add(Stats::kCopyCalls, 1);
+    }
     if (n_read > 0) {
-      if (!WriteBytes(buffer, n_read)) {
+      if (!WriteBytes(buffer.get(), n_read)) {
         return -1;
       }
       total_written += n_read;
     } else if (n_read == 0) {
       break;
-    } else if (EAGAIN != errno) {
+    } else if (errno != EINTR && errno != EAGAIN) {
       return -1;
     }
   }
-
-  // If the input file position has been passed, update it and restore
-  // the read position in the input file.
   if (in_offset) {
-    if (offset_error == lseek(in_fd, old_input_offset, SEEK_SET)) {
-      return -1;
-    }
     *in_offset += total_written;
   }
   return total_written;
 }
 
-#elif defined(__linux)
+#else
+// copy_file_range(2) may be missing from the C library even if the kernel
+// has it.
+static ssize_t CopyFileRange(int in_fd, off_t *in_offset, int out_fd,
+                             size_t count) {
+#if defined(__NR_copy_file_range)
+  return syscall(__NR_copy_file_range, in_fd, in_offset, out_fd, nullptr,
+                 count, 0);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
 ssize_t OutputJar::AppendFile(int in_fd, off_t *in_offset, size_t count) {
-  // sendfile call is interruptable and has to be handled the same way as write
-  // call.
-  for (size_t to_write = count; to_write > 0;) {
-    ssize_t written = sendfile(fd_, in_fd, in_offset, to_write);
+  FlushPendingCopy();
+  if (!FlushOutputBuffer()) {
+    return -1;
+  }
+  // Prefer copy_file_range, which copies within the kernel and can share
+  // the extents on the file systems supporting reflinks, and fall back
+  // to sendfile if it is not supported for this pair of files. Both calls
+  // are interruptable and have to be handled the same way as write call.
+  size_t to_write = count;
+  while (to_write > 0) {
+    ssize_t written;
+    if (use_copy_file_range_) {
+      written = CopyFileRange(in_fd, in_offset, fd_, to_write);
+      if (stats_) {
+        stats_->Add(Stats::kCopyCalls, 1);
+      }
+      if ((written < 0 && errno != EINTR) ||
+          (written == 0 && to_write == count)) {
+        use_copy_file_range_ = false;
+        continue;
+      }
+    } else {
+      written = sendfile(fd_, in_fd, in_offset, to_write);
+      if (stats_) {
+        stats_->Add(Stats::kCopyCalls, 1);
+      }
+    }
     if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
       return written;
     } else if (written == 0) {
-      return static_cast<ssize_t>(count - to_write);
+      break;
     }
     to_write -= static_cast<size_t>(written);
   }
-  return static_cast<ssize_t>(count);
+  outpos_ += count - to_write;
+  return static_cast<ssize_t>(count - to_write);
 }
 #endif
 
 void OutputJar::ExtraCombiner(const std::string &entry_name,
                               Combiner *combiner) {
   extra_combiners_.emplace_back(combiner);
-  known_members_.emplace(entry_name, EntryInfo{combiner});
+  known_members_.Emplace(entry_name, EntryInfo{combiner});
 }
 
-bool OutputJar::WriteBytes(uint8_t *buffer, size_t count) {
-  for (uint8_t *buffer_end = buffer + count; buffer < buffer_end;) {
+bool OutputJar::WriteBytes(const void *buffer, size_t count) {
+  FlushPendingCopy();
+  if (output_buffer_used_ + count > kOutputBufferSize &&
+      !FlushOutputBuffer()) {
+    return false;
+  }
+  outpos_ += count;
+  if (count >= kOutputBufferSize) {
+    return WriteFully(reinterpret_cast<const uint8_t *>(buffer), count);
+  }
+  memcpy(output_buffer_.get() + output_buffer_used_, buffer, count);
+  output_buffer_used_ += count;
+  return true;
+}
+
+bool OutputJar::FlushOutputBuffer() {
+  size_t count = output_buffer_used_;
+  output_buffer_used_ = 0;
+  return WriteFully(output_buffer_.get(), count);
+}
+
+bool OutputJar::WriteFully(const uint8_t *buffer, size_t count) {
+  for (const uint8_t *buffer_end = buffer + count; buffer < buffer_end;) {
     ssize_t n_written = write(fd_, buffer, buffer_end - buffer);
+    if (stats_) {
+      stats_->Add(Stats::kWriteCalls, 1);
+    }
     if (n_written > 0) {
       buffer += n_written;
-    } else if (EAGAIN == errno) {
+    } else if (n_written < 0 && errno != EINTR) {
       return false;
     }
   }
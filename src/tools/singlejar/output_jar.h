@@ -18,11 +18,18 @@
 #include <stdint.h>
 #include <memory>
 #include <string>
-#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "src/tools/singlejar/combiners.h"
+#include "src/tools/singlejar/incremental_index.h"
+#include "src/tools/singlejar/input_jar.h"
+#include "src/tools/singlejar/jar_scanner.h"
+#include "src/tools/singlejar/name_map.h"
 #include "src/tools/singlejar/options.h"
+#include "src/tools/singlejar/recompressor.h"
+#include "src/tools/singlejar/resource_loader.h"
+#include "src/tools/singlejar/stats.h"
 
 /*
  * Jar file we are writing.
@@ -40,8 +47,12 @@ class OutputJar {
   void ExtraCombiner(const std::string& entry_name, Combiner *combiner);
   // Additional file handler to be redefined by a subclass.
   virtual void ExtraHandler(const CDH *entry);
-  // Return jar path.
-  const char *path() const { return options_->output_jar.c_str(); }
+  // Return jar path, that of the part being written if the output is split.
+  const char *path() const { return part_path_.c_str(); }
+  // Returns the path of given part (counting from 0) of the output split
+  // with --max_part_megabytes or --max_part_entries: the output itself for
+  // the first part, out-2.jar for the second part of out.jar and so on.
+  static std::string PartPath(const std::string &output_jar, int part);
 
  protected:
   // The purpose  of these two tiny utility methods is to avoid creating a
@@ -58,7 +69,10 @@ class OutputJar {
   }
   // True if an entry with given name have not been added to this archive.
   bool NewEntry(const std::string& entry_name) {
-    return known_members_.count(entry_name) == 0;
+    return !known_members_.Contains(entry_name);
+  }
+  bool NewEntry(const char *entry_name, size_t entry_name_length) {
+    return !known_members_.Contains(entry_name, entry_name_length);
   }
 
  private:
@@ -66,52 +80,169 @@ class OutputJar {
   bool Open();
   // Add the contents of the given input jar.
   bool AddJar(int jar_path_index);
+  // Write the given entry of the input jar currently being added.
+  void WriteJarEntry(InputJar &input_jar, const std::string &input_jar_path,
+                     const std::vector<JarScanner::Entry> &jar_entries,
+                     size_t entry_index, size_t *next_to_recompress);
+  // Read the previous output and its index for --incremental_base. Returns
+  // false if they cannot be used.
+  bool OpenIncrementalBase();
+  // Forget the previous output.
+  void CloseIncrementalBase();
+  // Copy the entries which came from an unchanged input jar from the previous
+  // output.
+  void CopyFromBase(const IncrementalIndex::JarRecord &record);
+  // Returns the digest identifying an input jar in the incremental index.
+  static uint64_t JarDigest(const std::vector<JarScanner::Entry> &jar_entries);
+  // Returns the digest of the options the incremental index depends on.
+  uint64_t IncrementalOptionsDigest() const;
+  // Copies the extra fields other than the volatile ones (see
+  // ExtraField::is_volatile) to `out' unless it is null, returns their
+  // total size.
+  static uint16_t StableExtraFields(const uint8_t *extra_fields,
+                                    uint16_t extra_fields_length,
+                                    uint8_t *out);
+  // True if two entries have the same uncompressed contents. The CRC-32 and
+  // the sizes are compared first, the bytes only if they match.
+  static bool SameContents(const CDH *cdh1, const LH *lh1, const CDH *cdh2,
+                           const LH *lh2);
+  // True if given Central Directory Header has given file name.
+  static bool SameName(const CDH *cdh, const char *file_name,
+                       size_t file_name_length);
+  // True if the compression of given file entry has to be changed. With
+  // --compression, the stored entries the compression policy deems
+  // incompressible are left stored.
+  bool ChangeCompression(const CDH *jar_entry, const LH *lh) const;
   // Returns the current output position.
   off_t Position();
   // Write Jar entry.
   void WriteEntry(void *local_header_and_payload);
   // Write a directory entry.
   void AddDirectory(const char *path);
-  // Append given Central Directory Header to CEN (Central Directory) buffer.
-  CDH *AppendToDirectoryBuffer(const CDH *cdh);
+  // Append given Central Directory Header to CEN (Central Directory) buffer,
+  // with given local header offset.
+  CDH *AppendToDirectoryBuffer(const CDH *cdh, uint64_t local_header_offset);
+  // Same, with given sizes, too. The values which do not fit into 32 bits
+  // are recorded in the Zip64 extra field, which replaces the one `cdh' may
+  // have.
+  CDH *AppendToDirectoryBuffer(const CDH *cdh, uint64_t compressed_size,
+                               uint64_t uncompressed_size,
+                               uint64_t local_header_offset);
   // Reserve space in CEN buffer.
   uint8_t *ReserveCdr(size_t chunk_size);
   // Reserve space for the Central Directory Header in CEN buffer.
   uint8_t *ReserveCdh(size_t size);
   // Close output.
   bool Close();
+  // Write the Central Directory of the part being written and close it.
+  bool ClosePart();
+  // When the output is split, starts the next part unless the current one
+  // has room for an entry of given size, including its Central Directory
+  // Header.
+  void StartPartIfFull(size_t entry_size);
+  // Write the Central Directory buffer to the output file, return true on
+  // success.
+  bool WriteCentralDirectory();
+  // Set the main attribute of the manifest with given name, replacing the
+  // value set earlier, if any (attribute names are case-insensitive).
+  void SetManifestAttribute(const std::string &name, const std::string &value);
+  // Add the manifest contents given by --deploy_manifest_lines: the main
+  // attributes, possibly followed by an empty line and per-entry sections.
+  void AddManifestLines(const std::string &lines);
+  // Write the manifest, with the lines wrapped at 72 bytes.
+  void WriteManifest(bool compress);
   // Set classpath resource with given resource name and path.
   void ClasspathResource(const std::string& resource_name,
                          const std::string& resource_path);
   // Copy the bytes from the given file.
   ssize_t AppendFile(int in_fd, off_t *in_offset, size_t count);
-  // Write bytes to the output file, return true on success.
-  bool WriteBytes(uint8_t *buffer, size_t count);
+  // Copy the bytes from the given input jar, which is also mapped at given
+  // address. The copy is deferred and coalesced with the subsequent
+  // adjacent ranges until FlushPendingCopy is called or other output
+  // happens.
+  void AppendJarBytes(int in_fd, off_t in_offset, const uint8_t *in_address,
+                      size_t count, const char *in_path);
+  // Copy the pending input jar bytes.
+  void FlushPendingCopy();
+  // Write bytes to the output file, return true on success. Small writes
+  // are buffered.
+  bool WriteBytes(const void *buffer, size_t count);
+  // Write out the contents of the output buffer, return true on success.
+  bool FlushOutputBuffer();
+  // Write bytes to the output file bypassing the buffer.
+  bool WriteFully(const uint8_t *buffer, size_t count);
 
 
   Options *options_;
   struct EntryInfo {
-    EntryInfo(Combiner *combiner, int index = -1)
-        : combiner_(combiner), input_jar_index_(index) {}
+    EntryInfo(Combiner *combiner = nullptr, int index = -1,
+              const CDH *cdh = nullptr, const LH *lh = nullptr)
+        : combiner_(combiner), input_jar_index_(index), cdh_(cdh), lh_(lh) {}
     Combiner *combiner_;
     int input_jar_index_;  // Input jar index for the plain entry or -1.
+    // The plain entry, with --check_duplicate_contents only.
+    const CDH *cdh_;
+    const LH *lh_;
   };
 
-  std::unordered_map<std::string, struct EntryInfo> known_members_;
+  NameMap<struct EntryInfo> known_members_;
+  std::unique_ptr<JarScanner> jar_scanner_;
+  std::unique_ptr<Recompressor> recompressor_;
+  // With --check_duplicate_contents, the input jars are kept mapped until
+  // the output is closed, so that the duplicates can be compared with the
+  // entries written out.
+  std::vector<std::unique_ptr<JarScanner::ScannedJar> > retained_jars_;
+  // The previous output, its index and its Central Directory entries in the
+  // incremental mode.
+  std::unique_ptr<InputJar> base_jar_;
+  IncrementalIndex base_index_;
+  std::vector<const CDH *> base_entries_;
+  // The index of the output.
+  IncrementalIndex output_index_;
+  // The counters for --stats, null unless it is present.
+  std::unique_ptr<Stats> stats_;
   int fd_;
+  // Output position, including the buffered bytes but not the pending copy.
+  off_t outpos_;
+  std::unique_ptr<uint8_t[]> output_buffer_;
+  size_t output_buffer_used_;
+  bool use_copy_file_range_;
+  // The input jar bytes to be copied to the output.
+  struct PendingCopy {
+    int fd;
+    off_t offset;
+    const uint8_t *address;
+    size_t count;
+    const char *path;
+  } pending_copy_;
+  // The entries of the part being written.
   int entries_;
   int duplicate_entries_;
-  uint8_t *cen_;
+  // The part being written and its path.
+  int part_;
+  std::string part_path_;
+  // The Central Directory being built.
+  struct CenChunk {
+    std::unique_ptr<uint8_t[]> data;
+    size_t used;
+    size_t capacity;
+  };
+  std::vector<CenChunk> cen_chunks_;
   size_t cen_size_;
   size_t cen_capacity_;
   Concatenator spring_handlers_;
   Concatenator spring_schemas_;
   Concatenator protobuf_meta_handler_;
   Concatenator manifest_;
+  // The main attributes of the manifest, in the order they were set.
+  std::vector<std::pair<std::string, std::string> > manifest_attributes_;
+  // The per-entry sections of the manifest, with CRLF line endings.
+  std::string manifest_sections_;
   PropertyCombiner build_properties_;
   NullCombiner null_combiner_;
   std::vector<std::unique_ptr<Concatenator> > service_handlers_;
-  std::vector<std::unique_ptr<Concatenator> > classpath_resources_;
+  // The --classpath_resources and --resources, in order; see ResourceLoader.
+  std::vector<ResourceLoader::Resource> classpath_resources_;
   std::vector<std::unique_ptr<Combiner> > extra_combiners_;
 };
 
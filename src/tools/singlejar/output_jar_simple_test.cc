@@ -13,6 +13,9 @@
 // limitations under the License.
 
 #include <stdlib.h>
+#include <sys/stat.h>
+
+#include <thread>
 
 #include "src/main/cpp/blaze_util.h"
 #include "src/main/cpp/util/file.h"
@@ -253,6 +256,43 @@ TEST_F(OutputJarSimpleTest, DeployManifestLines) {
       manifest);
 }
 
+// --deploy_manifest_lines override the attributes set by singlejar, and are
+// merged with the continuation lines.
+TEST_F(OutputJarSimpleTest, DeployManifestLinesMerge) {
+  string out_path = OutputFilePath("out.jar");
+  CreateOutput(out_path, {"--main_class", "com.google.my.Main",
+                          "--deploy_manifest_lines", "main-class: Other",
+                          "property1: foo", " bar",
+                          "\nName: com/google/my/\nSealed: true"});
+  string manifest = GetEntryContents(out_path, "META-INF/MANIFEST.MF");
+  EXPECT_EQ(
+      "Manifest-Version: 1.0\r\n"
+      "Created-By: singlejar\r\n"
+      "Main-Class: Other\r\n"
+      "property1: foobar\r\n"
+      "\r\n"
+      "Name: com/google/my/\r\n"
+      "Sealed: true\r\n",
+      manifest);
+}
+
+// The manifest lines longer than 72 bytes are continued on the next lines.
+TEST_F(OutputJarSimpleTest, ManifestLongLines) {
+  string out_path = OutputFilePath("out.jar");
+  string value(150, 'x');
+  CreateOutput(out_path,
+               {"--deploy_manifest_lines", "Class-Path: " + value});
+  string manifest = GetEntryContents(out_path, "META-INF/MANIFEST.MF");
+  EXPECT_EQ(
+      "Manifest-Version: 1.0\r\n"
+      "Created-By: singlejar\r\n"
+      "Class-Path: " + value.substr(0, 60) + "\r\n"
+      " " + value.substr(60, 71) + "\r\n"
+      " " + value.substr(131) + "\r\n"
+      "\r\n",
+      manifest);
+}
+
 // --extra_build_info option
 TEST_F(OutputJarSimpleTest, ExtraBuildInfo) {
   string out_path = OutputFilePath("out.jar");
@@ -461,6 +501,16 @@ TEST_F(OutputJarSimpleTest, Normalize) {
         << entry_name << ": CDH should not have Unix Time extra field";
     ASSERT_EQ(nullptr, lh->unix_time_extra_field())
         << entry_name << ": LH should not have Unix Time extra field";
+    // Nor the owner's UID/GID.
+    ASSERT_EQ(nullptr,
+              ExtraField::find(0x7875, cdh->extra_fields(),
+                               cdh->extra_fields() +
+                                   cdh->extra_fields_length()))
+        << entry_name << ": CDH should not have UID/GID extra field";
+    ASSERT_EQ(nullptr,
+              ExtraField::find(0x7875, lh->extra_fields(),
+                               lh->extra_fields() + lh->extra_fields_length()))
+        << entry_name << ": LH should not have UID/GID extra field";
   }
   input_jar.Close();
 }
@@ -595,6 +645,36 @@ TEST_F(OutputJarSimpleTest, DontChangeCompressionOption) {
   input_jar.Close();
 }
 
+// Test --align option: the data of each stored entry starts at the file
+// offset which is a multiple of the alignment, including the entries
+// copied from the input as is.
+TEST_F(OutputJarSimpleTest, AlignOption) {
+  string cp_res_path = CreateTextFile("cp_res", "line1\nline2\n");
+  string out_path = OutputFilePath("out.jar");
+  CreateOutput(out_path,
+               {"--align", "4096", "--sources",
+                DATA_DIR_TOP "src/tools/singlejar/libtest1.jar",
+                DATA_DIR_TOP "src/tools/singlejar/stored.jar", "--resources",
+                cp_res_path});
+  InputJar input_jar;
+  ASSERT_TRUE(input_jar.Open(out_path));
+  const LH *lh;
+  const CDH *cdh;
+  int stored_files = 0;
+  while ((cdh = input_jar.NextEntry(&lh))) {
+    string entry_name = lh->file_name_string();
+    if (lh->compression_method() != Z_NO_COMPRESSION ||
+        entry_name.back() == '/') {
+      continue;
+    }
+    ++stored_files;
+    EXPECT_EQ(0, input_jar.mapped_file().offset(lh->data()) % 4096)
+        << "Entry " << entry_name << " is not aligned.";
+  }
+  input_jar.Close();
+  EXPECT_LT(0, stored_files);
+}
+
 const char kBuildDataFile[] = "build-data.properties";
 
 // Test --exclude_build_data option when none of the source archives contain
@@ -627,4 +707,258 @@ TEST_F(OutputJarSimpleTest, ExcludeBuildData2) {
   EXPECT_EQ("build: foo", GetEntryContents(out_path, kBuildDataFile));
 }
 
+// Writes the output jar with a fresh OutputJar instance.
+static void RunOutputJar(const std::vector<string> &args) {
+  std::vector<const char *> option_list;
+  for (auto &arg : args) {
+    option_list.push_back(arg.c_str());
+  }
+  Options options;
+  options.ParseCommandLine(option_list.size(), option_list.data());
+  OutputJar output_jar;
+  ASSERT_EQ(0, output_jar.Doit(&options));
+}
+
+// The output written with --incremental_base is the same as the one written
+// from scratch, whether the input jars have changed or not.
+TEST_F(OutputJarSimpleTest, IncrementalBase) {
+  string out_path = OutputFilePath("out.jar");
+  string index_path = out_path + ".index";
+  string lib1 = DATA_DIR_TOP "src/tools/singlejar/libtest1.jar";
+  string lib2 = DATA_DIR_TOP "src/tools/singlejar/libtest2.jar";
+  unlink(index_path.c_str());
+  for (auto &sources : std::vector<std::vector<string>>{
+           {lib1, lib2}, {lib1, lib2}, {lib2, lib1}, {lib2}, {lib1, lib2}}) {
+    std::vector<string> args = {"--output", out_path, "--normalize",
+                                "--sources"};
+    args.insert(args.end(), sources.begin(), sources.end());
+    RunOutputJar(args);
+    string expected;
+    ASSERT_TRUE(blaze::ReadFile(out_path, &expected));
+
+    args.push_back("--incremental_base");
+    args.push_back(out_path);
+    RunOutputJar(args);
+    string index;
+    ASSERT_TRUE(blaze::ReadFile(index_path, &index));
+    // Now the index is there.
+    RunOutputJar(args);
+    string actual;
+    ASSERT_TRUE(blaze::ReadFile(out_path, &actual));
+    EXPECT_EQ(expected, actual);
+    EXPECT_EQ(0, VerifyZip(out_path));
+    string actual_index;
+    ASSERT_TRUE(blaze::ReadFile(index_path, &actual_index));
+    EXPECT_EQ(index, actual_index);
+  }
+}
+
+// With --check_duplicate_contents, the duplicates with the same contents are
+// skipped even with --no_duplicates, however they are compressed.
+TEST_F(OutputJarSimpleTest, CheckDuplicateContents) {
+  string out_dir = OutputFilePath("");
+  string contents;
+  for (int i = 0; i < 1000; ++i) {
+    contents += "line " + std::to_string(i % 7) + "\n";
+  }
+  std::vector<string> zips;
+  for (const char *zip_options : {"-0", "-1", "-9"}) {
+    string zip_name = string("dup") + zip_options + ".zip";
+    CreateTextFile("dup.txt", contents.c_str());
+    unlink(OutputFilePath(zip_name).c_str());
+    ASSERT_EQ(0, RunCommand("cd ", out_dir.c_str(), ";", "zip", "-m",
+                            zip_options, zip_name.c_str(), "dup.txt",
+                            nullptr));
+    zips.push_back(OutputFilePath(zip_name));
+  }
+  string out_path = OutputFilePath("out.jar");
+  std::vector<string> args = {"--output", out_path, "--no_duplicates",
+                              "--check_duplicate_contents", "--sources"};
+  args.insert(args.end(), zips.begin(), zips.end());
+  RunOutputJar(args);
+  EXPECT_EQ(contents, GetEntryContents(out_path, "dup.txt"));
+
+  CreateTextFile("dup.txt", (contents + "more\n").c_str());
+  unlink(OutputFilePath("other.zip").c_str());
+  ASSERT_EQ(0, RunCommand("cd ", out_dir.c_str(), ";", "zip", "-m",
+                          "other.zip", "dup.txt", nullptr));
+  args.push_back(OutputFilePath("other.zip"));
+  EXPECT_DEATH(RunOutputJar(args), "dup.txt is present both in");
+}
+
+// The output does not depend on the number of threads.
+TEST_F(OutputJarSimpleTest, ThreadsDoNotChangeOutput) {
+  string out_path = OutputFilePath("out.jar");
+  string expected;
+  for (const char *threads : {"1", "2", "8"}) {
+    RunOutputJar({"--output", out_path, "--normalize", "--threads", threads,
+                  "--sources", DATA_DIR_TOP "src/tools/singlejar/libtest1.jar",
+                  DATA_DIR_TOP "src/tools/singlejar/libtest2.jar"});
+    string actual;
+    ASSERT_TRUE(blaze::ReadFile(out_path, &actual));
+    if (expected.empty()) {
+      expected = actual;
+    } else {
+      EXPECT_EQ(expected, actual) << threads << " threads";
+    }
+  }
+}
+
+// Nor on whether it is streamed to a pipe rather than written to a file.
+TEST_F(OutputJarSimpleTest, StreamingDoesNotChangeOutput) {
+  string out_path = OutputFilePath("out.jar");
+  string fifo_path = OutputFilePath("out.fifo");
+  unlink(fifo_path.c_str());
+  ASSERT_EQ(0, mkfifo(fifo_path.c_str(), 0600));
+  // The name of the output is part of the build data.
+  std::vector<string> args = {"--output", out_path, "--exclude_build_data",
+                              "--normalize", "--sources",
+                              DATA_DIR_TOP "src/tools/singlejar/libtest1.jar",
+                              DATA_DIR_TOP "src/tools/singlejar/libtest2.jar"};
+  RunOutputJar(args);
+  string expected;
+  ASSERT_TRUE(blaze::ReadFile(out_path, &expected));
+
+  string streamed;
+  std::thread reader([&fifo_path, &streamed] {
+    EXPECT_TRUE(blaze::ReadFile(fifo_path, &streamed));
+  });
+  args[1] = fifo_path;
+  RunOutputJar(args);
+  reader.join();
+  EXPECT_EQ(expected, streamed);
+}
+
+// Nor on the way the input jars are read.
+TEST_F(OutputJarSimpleTest, InputAccessDoesNotChangeOutput) {
+  string out_path = OutputFilePath("out.jar");
+  string expected;
+  for (const char *input_access : {"mmap", "populate", "pread"}) {
+    RunOutputJar({"--output", out_path, "--normalize", "--input_access",
+                  input_access, "--sources",
+                  DATA_DIR_TOP "src/tools/singlejar/libtest1.jar",
+                  DATA_DIR_TOP "src/tools/singlejar/libtest2.jar"});
+    string actual;
+    ASSERT_TRUE(blaze::ReadFile(out_path, &actual));
+    if (expected.empty()) {
+      expected = actual;
+    } else {
+      EXPECT_EQ(expected, actual) << "--input_access " << input_access;
+    }
+  }
+}
+
+// With --compression, the stored entries the compression policy deems
+// incompressible are left stored, unless --compress_everything is given.
+TEST_F(OutputJarSimpleTest, CompressionPolicy) {
+  string out_dir = OutputFilePath("");
+  string text;
+  for (int i = 0; i < 1000; ++i) {
+    text += "line " + std::to_string(i) + "\n";
+  }
+  string random;
+  uint32_t seed = 12345;
+  for (int i = 0; i < 8192; ++i) {
+    seed = seed * 1103515245 + 12345;
+    random += static_cast<char>(seed >> 24);
+  }
+  ASSERT_TRUE(blaze::WriteFile(text, OutputFilePath("text.txt")));
+  ASSERT_TRUE(blaze::WriteFile(text, OutputFilePath("image.png")));
+  mkdir(OutputFilePath("skipped").c_str(), 0777);
+  ASSERT_TRUE(blaze::WriteFile(text, OutputFilePath("skipped/text.txt")));
+  ASSERT_TRUE(blaze::WriteFile(random, OutputFilePath("random.bin")));
+  unlink(OutputFilePath("stored.zip").c_str());
+  ASSERT_EQ(0, RunCommand("cd ", out_dir.c_str(), ";", "zip", "-0", "-m",
+                          "stored.zip", "text.txt", "image.png",
+                          "skipped/text.txt", "random.bin", nullptr));
+
+  string out_path = OutputFilePath("out.jar");
+  const std::vector<string> args = {
+      "--output", out_path, "--sources", OutputFilePath("stored.zip"),
+      "--compression", "--nocompress_prefixes", "skipped/"};
+  for (bool compress_everything : {false, true}) {
+    std::vector<string> run_args = args;
+    if (compress_everything) {
+      run_args.push_back("--compress_everything");
+    }
+    RunOutputJar(run_args);
+    InputJar input_jar;
+    ASSERT_TRUE(input_jar.Open(out_path));
+    const LH *lh;
+    const CDH *cdh;
+    while ((cdh = input_jar.NextEntry(&lh))) {
+      string entry_name = cdh->file_name_string();
+      if (entry_name == "text.txt") {
+        EXPECT_EQ(Z_DEFLATED, cdh->compression_method());
+      } else if (entry_name == "image.png" ||
+                 entry_name == "skipped/text.txt") {
+        EXPECT_EQ(compress_everything ? Z_DEFLATED : Z_NO_COMPRESSION,
+                  cdh->compression_method())
+            << entry_name;
+      } else if (entry_name == "random.bin") {
+        // Deflating it does not make it any smaller, either.
+        EXPECT_EQ(Z_NO_COMPRESSION, cdh->compression_method());
+      }
+    }
+    input_jar.Close();
+    EXPECT_EQ(text, GetEntryContents(out_path, "image.png"));
+  }
+}
+
+TEST_F(OutputJarSimpleTest, PartPath) {
+  EXPECT_EQ("a/out.jar", OutputJar::PartPath("a/out.jar", 0));
+  EXPECT_EQ("a/out-2.jar", OutputJar::PartPath("a/out.jar", 1));
+  EXPECT_EQ("a/out-11.jar", OutputJar::PartPath("a/out.jar", 10));
+  EXPECT_EQ("a.b/out-2", OutputJar::PartPath("a.b/out", 1));
+  EXPECT_EQ("a/.jar-2", OutputJar::PartPath("a/.jar", 1));
+  EXPECT_EQ("out-2.x.jar", OutputJar::PartPath("out-2.x.jar", 0));
+  EXPECT_EQ("out-2.x-3.jar", OutputJar::PartPath("out-2.x.jar", 2));
+}
+
+// With --max_part_entries, the output is split into parts holding the same
+// entries as the output written in one piece, the manifest in the first one.
+TEST_F(OutputJarSimpleTest, SplitOutput) {
+  string out_path = OutputFilePath("out.jar");
+  std::vector<string> args = {"--output", out_path, "--sources",
+                              DATA_DIR_TOP "src/tools/singlejar/libtest1.jar",
+                              DATA_DIR_TOP "src/tools/singlejar/libtest2.jar"};
+  RunOutputJar(args);
+  std::vector<string> expected;
+  InputJar input_jar;
+  ASSERT_TRUE(input_jar.Open(out_path));
+  const LH *lh;
+  const CDH *cdh;
+  while ((cdh = input_jar.NextEntry(&lh))) {
+    expected.push_back(cdh->file_name_string());
+  }
+  input_jar.Close();
+  ASSERT_LT(3u, expected.size());
+
+  // A part left over from a previous run split into more parts.
+  size_t parts = (expected.size() + 2) / 3;
+  string stale_path = OutputJar::PartPath(out_path, parts);
+  ASSERT_TRUE(blaze::WriteFile("stale", stale_path));
+  args.push_back("--max_part_entries");
+  args.push_back("3");
+  RunOutputJar(args);
+  std::vector<string> actual;
+  for (size_t part = 0; part < parts; ++part) {
+    string part_path = OutputJar::PartPath(out_path, part);
+    EXPECT_EQ(0, VerifyZip(part_path));
+    ASSERT_TRUE(input_jar.Open(part_path));
+    size_t part_entries = 0;
+    while ((cdh = input_jar.NextEntry(&lh))) {
+      actual.push_back(cdh->file_name_string());
+      ++part_entries;
+    }
+    input_jar.Close();
+    EXPECT_GE(3u, part_entries) << part_path;
+    EXPECT_LT(0u, part_entries) << part_path;
+  }
+  EXPECT_EQ(expected, actual);
+  EXPECT_NE("", GetEntryContents(out_path, "META-INF/MANIFEST.MF"));
+  struct stat st;
+  EXPECT_NE(0, stat(stale_path.c_str(), &st));
+}
+
 }  // namespace
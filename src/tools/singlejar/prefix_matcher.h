@@ -0,0 +1,82 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_TOOLS_SINGLEJAR_PREFIX_MATCHER_H_
+#define SRC_TOOLS_SINGLEJAR_PREFIX_MATCHER_H_ 1
+
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/*
+ * Tells whether a name begins with any of the given prefixes, in logarithmic
+ * time. The prefixes are sorted, and the ones beginning with another prefix
+ * are dropped. In a set where no prefix begins with another one, a name can
+ * only begin with the greatest prefix not greater than the name: any prefix
+ * between that one and the name would begin with it, too.
+ *
+ * An empty matcher (no prefixes) matches every name.
+ */
+class PrefixMatcher {
+ public:
+  PrefixMatcher() {}
+
+  explicit PrefixMatcher(const std::vector<std::string> &prefixes)
+      : prefixes_(prefixes) {
+    std::sort(prefixes_.begin(), prefixes_.end());
+    // After sorting, the prefixes beginning with another one follow it.
+    size_t kept = 0;
+    for (size_t i = 0; i < prefixes_.size(); ++i) {
+      if (kept == 0 || !BeginsWith(prefixes_[i].data(), prefixes_[i].size(),
+                                   prefixes_[kept - 1])) {
+        prefixes_[kept++] = prefixes_[i];
+      }
+    }
+    prefixes_.resize(kept);
+  }
+
+  bool empty() const { return prefixes_.empty(); }
+
+  // True if given name begins with one of the prefixes, or there are none.
+  bool Matches(const char *name, size_t name_length) const {
+    if (prefixes_.empty()) {
+      return true;
+    }
+    // Find the first prefix greater than the name.
+    auto it = std::upper_bound(
+        prefixes_.begin(), prefixes_.end(), name_length,
+        [name](size_t length, const std::string &prefix) {
+          int rc = memcmp(name, prefix.data(), std::min(length, prefix.size()));
+          return rc < 0 || (rc == 0 && length < prefix.size());
+        });
+    return it != prefixes_.begin() && BeginsWith(name, name_length, *(it - 1));
+  }
+
+  bool Matches(const std::string &name) const {
+    return Matches(name.data(), name.size());
+  }
+
+ private:
+  static bool BeginsWith(const char *name, size_t name_length,
+                         const std::string &prefix) {
+    return prefix.size() <= name_length &&
+           !memcmp(name, prefix.data(), prefix.size());
+  }
+
+  std::vector<std::string> prefixes_;
+};
+
+#endif  //  SRC_TOOLS_SINGLEJAR_PREFIX_MATCHER_H_
@@ -0,0 +1,86 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+#include <vector>
+
+#include "src/tools/singlejar/prefix_matcher.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// True if the name begins with one of the prefixes, the obvious way.
+bool Expected(const std::string &name,
+              const std::vector<std::string> &prefixes) {
+  if (prefixes.empty()) {
+    return true;
+  }
+  for (auto &prefix : prefixes) {
+    if (name.compare(0, prefix.size(), prefix) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+TEST(PrefixMatcherTest, Empty) {
+  PrefixMatcher matcher;
+  EXPECT_TRUE(matcher.empty());
+  EXPECT_TRUE(matcher.Matches(""));
+  EXPECT_TRUE(matcher.Matches("a/b"));
+}
+
+TEST(PrefixMatcherTest, Matches) {
+  PrefixMatcher matcher({"c/d", "a/", "c/d/e", "b"});
+  EXPECT_FALSE(matcher.empty());
+  EXPECT_TRUE(matcher.Matches("a/b.class"));
+  EXPECT_TRUE(matcher.Matches("a/"));
+  EXPECT_FALSE(matcher.Matches("a"));
+  EXPECT_TRUE(matcher.Matches("b"));
+  EXPECT_TRUE(matcher.Matches("bar"));
+  EXPECT_TRUE(matcher.Matches("c/d"));
+  EXPECT_TRUE(matcher.Matches("c/d/e/f"));
+  EXPECT_TRUE(matcher.Matches("c/dx"));
+  EXPECT_FALSE(matcher.Matches("c/e"));
+  EXPECT_FALSE(matcher.Matches(""));
+  EXPECT_FALSE(matcher.Matches("A/"));
+  // The name does not have to be null-terminated.
+  EXPECT_FALSE(matcher.Matches("a/b", 1));
+  EXPECT_TRUE(matcher.Matches("a/b", 2));
+}
+
+TEST(PrefixMatcherTest, EmptyPrefixMatchesEverything) {
+  PrefixMatcher matcher({"x", ""});
+  EXPECT_TRUE(matcher.Matches(""));
+  EXPECT_TRUE(matcher.Matches("a"));
+}
+
+// The matcher agrees with checking every prefix.
+TEST(PrefixMatcherTest, SameAsLinearSearch) {
+  std::vector<std::string> prefixes;
+  for (int i = 0; i < 300; ++i) {
+    prefixes.push_back("com/p" + std::to_string(i % 37) + "/" +
+                       std::to_string(i));
+  }
+  prefixes.push_back("com/p5");
+  prefixes.push_back("org/");
+  PrefixMatcher matcher(prefixes);
+  for (int i = 0; i < 5000; ++i) {
+    std::string name = (i % 11 ? "com/p" : "org") + std::to_string(i % 41) +
+                       "/" + std::to_string(i % 331) + "/X.class";
+    EXPECT_EQ(Expected(name, prefixes), matcher.Matches(name)) << name;
+  }
+}
+
+}  // namespace
@@ -0,0 +1,134 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/tools/singlejar/recompressor.h"
+
+#include <stdlib.h>
+
+#include "src/tools/singlejar/combiners.h"
+#include "src/tools/singlejar/diag.h"
+
+Recompressor::Recompressor(int threads, bool compress)
+    : compress_(compress), max_pending_(4 * threads), stopping_(false) {
+  if (threads > 1) {
+    for (int i = 0; i < threads; ++i) {
+      workers_.emplace_back(&Recompressor::RecompressLoop, this);
+    }
+  }
+}
+
+Recompressor::~Recompressor() {
+  Drain();
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  submitted_cond_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+bool Recompressor::CanSubmit() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return parallel() && jobs_.size() < max_pending_;
+}
+
+void Recompressor::Submit(size_t entry_index, const CDH *cdh, const LH *lh) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!jobs_.empty() && jobs_.back()->index_ >= entry_index) {
+      diag_errx(2, "%s:%d: Internal error: entry %zu submitted after %zu",
+                __FILE__, __LINE__, entry_index, jobs_.back()->index_);
+    }
+    jobs_.emplace_back(new Job(entry_index, cdh, lh));
+  }
+  submitted_cond_.notify_one();
+}
+
+void *Recompressor::Take(size_t entry_index, const CDH *cdh, const LH *lh) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Skip the entries the writer decided not to use.
+  while (!jobs_.empty() && jobs_.front()->index_ < entry_index) {
+    PopJob(&lock);
+  }
+  if (!jobs_.empty() && jobs_.front()->index_ == entry_index &&
+      !jobs_.front()->started_) {
+    // Not picked up by a worker yet, no point in waiting.
+    jobs_.pop_front();
+  }
+  if (jobs_.empty() || jobs_.front()->index_ != entry_index) {
+    lock.unlock();
+    return Recompress(cdh, lh, compress_);
+  }
+  done_cond_.wait(lock, [this] { return jobs_.front()->done_; });
+  void *result = jobs_.front()->result_;
+  jobs_.pop_front();
+  return result;
+}
+
+void Recompressor::Drain() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!jobs_.empty()) {
+    PopJob(&lock);
+  }
+}
+
+void *Recompressor::Recompress(const CDH *cdh, const LH *lh, bool compress) {
+  // The input jar stays open until the recompressor is drained.
+  Concatenator combiner(cdh->file_name_string());
+  if (!combiner.MergeMapped(cdh, lh, nullptr)) {
+    diag_err(1, "%s:%d: cannot add %.*s", __FILE__, __LINE__,
+             cdh->file_name_length(), cdh->file_name());
+  }
+  return combiner.OutputEntry(compress);
+}
+
+void Recompressor::RecompressLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    Job *job = nullptr;
+    submitted_cond_.wait(lock, [this, &job] {
+      for (auto &pending : jobs_) {
+        if (!pending->started_) {
+          job = pending.get();
+          return true;
+        }
+      }
+      return stopping_;
+    });
+    if (job == nullptr) {
+      return;
+    }
+    job->started_ = true;
+    lock.unlock();
+    void *result = Recompress(job->cdh_, job->lh_, compress_);
+    lock.lock();
+    job->result_ = result;
+    job->done_ = true;
+    done_cond_.notify_all();
+  }
+}
+
+void Recompressor::PopJob(std::unique_lock<std::mutex> *lock) {
+  Job *job = jobs_.front().get();
+  if (job->started_) {
+    done_cond_.wait(*lock, [job] { return job->done_; });
+  } else {
+    // Make sure no worker picks it up.
+    job->started_ = job->done_ = true;
+  }
+  free(job->result_);
+  jobs_.pop_front();
+}
@@ -0,0 +1,103 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_TOOLS_SINGLEJAR_RECOMPRESSOR_H_
+#define SRC_TOOLS_SINGLEJAR_RECOMPRESSOR_H_ 1
+
+#include <stddef.h>
+
+#include <condition_variable>  // NOLINT
+#include <deque>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "src/tools/singlejar/zip_headers.h"
+
+/*
+ * Changes the compression of input jar entries (i.e., compresses stored
+ * entries or decompresses deflated ones) in a pool of worker threads.
+ *
+ * The writer submits the entries it is going to need, identified by their
+ * index in the input jar, in increasing index order, and then takes the
+ * results in the same order. An entry that was submitted but turned out not
+ * to be needed (e.g., it is a duplicate) is just skipped by Take(). The
+ * number of pending entries is bounded, use CanSubmit() to check whether
+ * more can be submitted. Take() changes the compression of an entry on
+ * the calling thread if the entry has not been submitted or picked up by a
+ * worker yet. Call Drain() before the input jar is closed.
+ *
+ * Without worker threads everything happens in Take().
+ */
+class Recompressor {
+ public:
+  Recompressor(int threads, bool compress);
+
+  // Stops the worker threads. Same as Drain(), the results not taken are
+  // discarded.
+  ~Recompressor();
+
+  // True if the entries are processed by worker threads.
+  bool parallel() const { return !workers_.empty(); }
+
+  // True if one more entry can be submitted.
+  bool CanSubmit();
+
+  // Schedules changing the compression of the given entry.
+  void Submit(size_t entry_index, const CDH *cdh, const LH *lh);
+
+  // Returns the buffer containing the Local Header followed by the payload
+  // with the compression changed, see Combiner::OutputEntry. The caller is
+  // responsible for freeing the buffer.
+  void *Take(size_t entry_index, const CDH *cdh, const LH *lh);
+
+  // Waits for the worker threads to finish with the submitted entries
+  // and discards the results.
+  void Drain();
+
+  // Changes the compression of a single entry.
+  static void *Recompress(const CDH *cdh, const LH *lh, bool compress);
+
+ private:
+  struct Job {
+    Job(size_t index, const CDH *cdh, const LH *lh)
+        : index_(index), cdh_(cdh), lh_(lh), result_(nullptr),
+          started_(false), done_(false) {}
+    size_t index_;
+    const CDH *cdh_;
+    const LH *lh_;
+    void *result_;
+    bool started_;
+    bool done_;
+  };
+
+  // Worker thread body.
+  void RecompressLoop();
+  // Removes the job at the front of the queue, waiting for it to be finished
+  // if it is running. The lock has to be held.
+  void PopJob(std::unique_lock<std::mutex> *lock);
+
+  const bool compress_;
+  const size_t max_pending_;
+  // Submitted jobs in the index order.
+  std::deque<std::unique_ptr<Job> > jobs_;
+  bool stopping_;
+  std::mutex mutex_;
+  std::condition_variable submitted_cond_;
+  std::condition_variable done_cond_;
+  std::vector<std::thread> workers_;
+};
+
+#endif  //  SRC_TOOLS_SINGLEJAR_RECOMPRESSOR_H_
@@ -0,0 +1,121 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "src/tools/singlejar/input_jar.h"
+#include "src/tools/singlejar/recompressor.h"
+#include "src/tools/singlejar/zip_headers.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+#if !defined(DATA_DIR_TOP)
+#define DATA_DIR_TOP
+#endif
+
+const char kPathLibTest1[] = DATA_DIR_TOP "src/tools/singlejar/libtest1.jar";
+
+struct JarEntry {
+  const CDH *cdh;
+  const LH *lh;
+};
+
+class RecompressorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(input_jar_.Open(kPathLibTest1));
+    const CDH *cdh;
+    const LH *lh;
+    while ((cdh = input_jar_.NextEntry(&lh))) {
+      const char *name = cdh->file_name();
+      if (name[cdh->file_name_length() - 1] != '/') {
+        entries_.push_back(JarEntry{cdh, lh});
+      }
+    }
+    ASSERT_LT(1, entries_.size());
+  }
+
+  // Returns the contents of the LH+payload buffer and frees it.
+  static std::string Contents(void *buffer) {
+    const LH *lh = reinterpret_cast<const LH *>(buffer);
+    std::string contents(reinterpret_cast<const char *>(lh),
+                         lh->data() + lh->in_zip_size() - byte_ptr(lh));
+    free(buffer);
+    return contents;
+  }
+
+  InputJar input_jar_;
+  std::vector<JarEntry> entries_;
+};
+
+// All the entries processed by the worker threads match the serial results.
+TEST_F(RecompressorTest, ParallelMatchesSerial) {
+  for (bool compress : {false, true}) {
+    Recompressor recompressor(4, compress);
+    ASSERT_TRUE(recompressor.parallel());
+    size_t submitted = 0;
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      for (submitted = std::max(submitted, i);
+           submitted < entries_.size() && recompressor.CanSubmit();
+           ++submitted) {
+        recompressor.Submit(submitted, entries_[submitted].cdh,
+                            entries_[submitted].lh);
+      }
+      void *buffer = recompressor.Take(i, entries_[i].cdh, entries_[i].lh);
+      ASSERT_NE(nullptr, buffer);
+      const LH *lh = reinterpret_cast<const LH *>(buffer);
+      EXPECT_TRUE(lh->is());
+      EXPECT_EQ(entries_[i].cdh->file_name_string(), lh->file_name_string());
+      EXPECT_EQ(entries_[i].cdh->uncompressed_file_size(),
+                lh->uncompressed_file_size());
+      EXPECT_EQ(Contents(Recompressor::Recompress(entries_[i].cdh,
+                                                  entries_[i].lh, compress)),
+                Contents(buffer));
+    }
+  }
+}
+
+// Submitted entries which are not taken are skipped.
+TEST_F(RecompressorTest, SkipAndDrain) {
+  Recompressor recompressor(2, false);
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    recompressor.Submit(i, entries_[i].cdh, entries_[i].lh);
+  }
+  size_t last = entries_.size() - 1;
+  void *buffer = recompressor.Take(last, entries_[last].cdh, entries_[last].lh);
+  EXPECT_EQ(Contents(Recompressor::Recompress(entries_[last].cdh,
+                                              entries_[last].lh, false)),
+            Contents(buffer));
+  recompressor.Submit(last + 1, entries_[0].cdh, entries_[0].lh);
+  recompressor.Drain();
+  EXPECT_TRUE(recompressor.CanSubmit());
+}
+
+// Without worker threads nothing can be submitted, Take does the job.
+TEST_F(RecompressorTest, Serial) {
+  Recompressor recompressor(1, true);
+  EXPECT_FALSE(recompressor.parallel());
+  EXPECT_FALSE(recompressor.CanSubmit());
+  void *buffer = recompressor.Take(0, entries_[0].cdh, entries_[0].lh);
+  EXPECT_EQ(Contents(Recompressor::Recompress(entries_[0].cdh, entries_[0].lh,
+                                              true)),
+            Contents(buffer));
+}
+
+}  // namespace
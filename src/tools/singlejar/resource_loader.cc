@@ -0,0 +1,114 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/tools/singlejar/resource_loader.h"
+
+#include <stdlib.h>
+
+#include "src/tools/singlejar/combiners.h"
+#include "src/tools/singlejar/diag.h"
+#include "src/tools/singlejar/mapped_file.h"
+
+ResourceLoader::ResourceLoader(const std::vector<Resource> &resources,
+                               int threads, bool compress)
+    : resources_(resources),
+      compress_(compress),
+      max_ahead_(4 * threads),
+      results_(resources.size(), nullptr),
+      done_(resources.size(), false),
+      next_to_load_(0),
+      next_to_take_(0),
+      stopping_(false) {
+  if (threads > 1 && resources.size() > 1) {
+    for (int i = 0; i < threads; ++i) {
+      workers_.emplace_back(&ResourceLoader::LoadLoop, this);
+    }
+  }
+}
+
+ResourceLoader::~ResourceLoader() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  taken_cond_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+  for (void *result : results_) {
+    free(result);
+  }
+}
+
+void *ResourceLoader::Take(size_t index) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (index < next_to_take_ || index >= resources_.size()) {
+    diag_errx(2, "%s:%d: Internal error: resource %zu taken after %zu",
+              __FILE__, __LINE__, index, next_to_take_);
+  }
+  next_to_take_ = index + 1;
+  void *result;
+  if (index >= next_to_load_) {
+    // Not picked up by a worker yet, no point in waiting. The ones skipped
+    // are not needed.
+    next_to_load_ = index + 1;
+    lock.unlock();
+    result = Load(resources_[index], compress_);
+    lock.lock();
+  } else {
+    done_cond_.wait(lock, [this, index] { return done_[index]; });
+    result = results_[index];
+    results_[index] = nullptr;
+  }
+  taken_cond_.notify_all();
+  return result;
+}
+
+void *ResourceLoader::Load(const Resource &resource, bool compress) {
+  MappedFile mapped_file;
+  if (!mapped_file.Open(resource.path)) {
+    diag_err(1, "%s:%d: %s", __FILE__, __LINE__, resource.path.c_str());
+  }
+  // The entry is made straight from the mapped file, which the combiner
+  // keeps until it is destroyed.
+  Concatenator combiner(resource.name);
+  combiner.AppendReference(reinterpret_cast<const char *>(mapped_file.start()),
+                           mapped_file.size(), mapped_file.mapping());
+  void *entry = combiner.OutputEntry(compress);
+  if (entry == nullptr) {
+    diag_errx(1, "%s:%d: Cannot allocate the entry for %s", __FILE__,
+              __LINE__, resource.path.c_str());
+  }
+  return entry;
+}
+
+void ResourceLoader::LoadLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    taken_cond_.wait(lock, [this] {
+      return stopping_ || (next_to_load_ < resources_.size() &&
+                           next_to_load_ < next_to_take_ + max_ahead_);
+    });
+    if (stopping_) {
+      return;
+    }
+    size_t index = next_to_load_++;
+    lock.unlock();
+    void *result = Load(resources_[index], compress_);
+    lock.lock();
+    results_[index] = result;
+    done_[index] = true;
+    done_cond_.notify_all();
+  }
+}
@@ -0,0 +1,84 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_TOOLS_SINGLEJAR_RESOURCE_LOADER_H_
+#define SRC_TOOLS_SINGLEJAR_RESOURCE_LOADER_H_ 1
+
+#include <stddef.h>
+
+#include <condition_variable>  // NOLINT
+#include <mutex>  // NOLINT
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+/*
+ * Reads the files added to the output with --resources and
+ * --classpath_resources and makes their entries, compressed or not, in a
+ * pool of worker threads.
+ *
+ * The writer takes the entries in the order of the files, and the workers
+ * only work a bounded number of files ahead of it, so that only a few
+ * entries are held in memory at any time. Take() makes the entry on the
+ * calling thread if no worker has picked the file up yet.
+ *
+ * Without worker threads everything happens in Take().
+ */
+class ResourceLoader {
+ public:
+  struct Resource {
+    std::string name;  // The name of the entry.
+    std::string path;  // The file.
+  };
+
+  // Starts reading the files, unless there are no worker threads.
+  ResourceLoader(const std::vector<Resource> &resources, int threads,
+                 bool compress);
+
+  // Stops the worker threads, the entries not taken are discarded.
+  ~ResourceLoader();
+
+  // True if the files are read by worker threads.
+  bool parallel() const { return !workers_.empty(); }
+
+  // Returns the buffer containing the Local Header followed by the payload
+  // of the entry for the resource at given index, see Combiner::OutputEntry.
+  // The indices have to be increasing. The caller is responsible for freeing
+  // the buffer.
+  void *Take(size_t index);
+
+  // Makes the entry of a single resource.
+  static void *Load(const Resource &resource, bool compress);
+
+ private:
+  // Worker thread body.
+  void LoadLoop();
+
+  const std::vector<Resource> resources_;
+  const bool compress_;
+  const size_t max_ahead_;
+  // The entries of the resources, once made, until taken.
+  std::vector<void *> results_;
+  std::vector<bool> done_;
+  // The next resource to be picked up by a worker, and the next to be taken.
+  size_t next_to_load_;
+  size_t next_to_take_;
+  bool stopping_;
+  std::mutex mutex_;
+  std::condition_variable taken_cond_;
+  std::condition_variable done_cond_;
+  std::vector<std::thread> workers_;
+};
+
+#endif  //  SRC_TOOLS_SINGLEJAR_RESOURCE_LOADER_H_
@@ -0,0 +1,113 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "src/tools/singlejar/resource_loader.h"
+#include "src/tools/singlejar/zip_headers.h"
+#include "gtest/gtest.h"
+
+#include <zlib.h>
+
+namespace {
+
+const size_t kResourceCount = 20;
+
+class ResourceLoaderTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    const char *tmpdir = getenv("TEST_TMPDIR");
+    for (size_t i = 0; i < kResourceCount; ++i) {
+      std::string path = std::string(tmpdir ? tmpdir : "/tmp") +
+                         "/resource" + std::to_string(i);
+      // The first one is empty, the others compress well.
+      std::string contents;
+      for (size_t line = 0; line < i * 100; ++line) {
+        contents += "line " + std::to_string(line % 7) + "\n";
+      }
+      FILE *file = fopen(path.c_str(), "wb");
+      ASSERT_NE(nullptr, file);
+      ASSERT_EQ(contents.size(),
+                fwrite(contents.data(), 1, contents.size(), file));
+      ASSERT_EQ(0, fclose(file));
+      resources_.push_back(ResourceLoader::Resource{
+          "res/r" + std::to_string(i), path});
+      contents_.push_back(contents);
+    }
+  }
+
+  // Returns the contents of the LH+payload buffer and frees it.
+  static std::string Contents(void *buffer) {
+    const LH *lh = reinterpret_cast<const LH *>(buffer);
+    std::string contents(reinterpret_cast<const char *>(lh),
+                         lh->data() + lh->in_zip_size() - byte_ptr(lh));
+    free(buffer);
+    return contents;
+  }
+
+  std::vector<ResourceLoader::Resource> resources_;
+  std::vector<std::string> contents_;
+};
+
+// The entries made by the worker threads match the serial ones.
+TEST_F(ResourceLoaderTest, ParallelMatchesSerial) {
+  for (bool compress : {false, true}) {
+    ResourceLoader loader(resources_, 4, compress);
+    ASSERT_TRUE(loader.parallel());
+    for (size_t i = 0; i < kResourceCount; ++i) {
+      void *buffer = loader.Take(i);
+      ASSERT_NE(nullptr, buffer);
+      const LH *lh = reinterpret_cast<const LH *>(buffer);
+      EXPECT_TRUE(lh->is());
+      EXPECT_EQ(resources_[i].name, lh->file_name_string());
+      EXPECT_EQ(contents_[i].size(), lh->uncompressed_file_size());
+      if (!compress || i == 0) {
+        EXPECT_EQ(Z_NO_COMPRESSION, lh->compression_method());
+        EXPECT_EQ(contents_[i],
+                  std::string(reinterpret_cast<const char *>(lh->data()),
+                              lh->in_zip_size()));
+      } else {
+        EXPECT_EQ(Z_DEFLATED, lh->compression_method());
+      }
+      EXPECT_EQ(Contents(ResourceLoader::Load(resources_[i], compress)),
+                Contents(buffer));
+    }
+  }
+}
+
+// The resources not taken are skipped, the ones made ahead are discarded.
+TEST_F(ResourceLoaderTest, Skip) {
+  ResourceLoader loader(resources_, 2, true);
+  EXPECT_EQ(Contents(ResourceLoader::Load(resources_[3], true)),
+            Contents(loader.Take(3)));
+  size_t last = kResourceCount - 1;
+  EXPECT_EQ(Contents(ResourceLoader::Load(resources_[last], true)),
+            Contents(loader.Take(last)));
+}
+
+// Without worker threads, Take does the job.
+TEST_F(ResourceLoaderTest, Serial) {
+  ResourceLoader loader(resources_, 1, false);
+  EXPECT_FALSE(loader.parallel());
+  for (size_t i = 0; i < kResourceCount; ++i) {
+    EXPECT_EQ(Contents(ResourceLoader::Load(resources_[i], false)),
+              Contents(loader.Take(i)));
+  }
+}
+
+}  // namespace
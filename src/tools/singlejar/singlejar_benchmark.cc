@@ -0,0 +1,363 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmarks for the singlejar hot paths. Generates synthetic input
+// jars, then measures the throughput of
+//   InputJar::NextEntry, i.e. walking the Central Directory,
+//   OutputJar::AddJar, i.e. merging the input jars into an output jar,
+//   TransientBytes::ReadEntryContents/DecompressEntryContents/CompressOut,
+//   NameMap lookups (OutputJar::known_members_).
+//
+// Usage:
+//   singlejar_benchmark [--jars N] [--entries N] [--entry_size BYTES]
+//                       [--duplicates PERCENT] [--iterations N]
+//                       [--threads N] [--stored]
+// Every input jar has --entries entries, --duplicates percent of which have
+// the names shared by all the jars, so that they are dropped as duplicates
+// by singlejar.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/tools/singlejar/crc32.h"
+#include "src/tools/singlejar/diag.h"
+#include "src/tools/singlejar/input_jar.h"
+#include "src/tools/singlejar/mapped_file.h"
+#include "src/tools/singlejar/name_map.h"
+#include "src/tools/singlejar/options.h"
+#include "src/tools/singlejar/output_jar.h"
+#include "src/tools/singlejar/stats.h"
+#include "src/tools/singlejar/token_stream.h"
+#include "src/tools/singlejar/transient_bytes.h"
+#include "src/tools/singlejar/zip_headers.h"
+#include "src/tools/singlejar/zlib_interface.h"
+
+namespace {
+
+struct BenchmarkOptions {
+  BenchmarkOptions()
+      : jars(100),
+        entries(1000),
+        entry_size(2000),
+        duplicates(10),
+        iterations(5),
+        threads(1),
+        stored(false) {}
+  int jars;
+  int entries;
+  int entry_size;
+  int duplicates;
+  int iterations;
+  int threads;
+  bool stored;
+};
+
+// Returns the contents of a synthetic entry, compressible roughly as well
+// as a class file is.
+std::string EntryContents(int size, unsigned seed) {
+  static const char *const kWords[] = {
+      "java/lang/Object", "<init>", "()V", "Code", "LineNumberTable",
+      "java/lang/String", "toString", "(I)Ljava/lang/String;", "this",
+      "SourceFile", "valueOf", "StackMapTable", "Ljava/util/List;"};
+  std::string contents;
+  contents.reserve(size);
+  while (contents.size() < static_cast<size_t>(size)) {
+    seed = seed * 1103515245 + 12345;
+    contents += kWords[(seed >> 16) % (sizeof(kWords) / sizeof(kWords[0]))];
+    contents += static_cast<char>(seed >> 8);
+  }
+  contents.resize(size);
+  return contents;
+}
+
+// Returns the deflated (raw, as in Zip) bytes.
+std::string Deflate(const std::string &data) {
+  Deflater deflater;
+  std::string out(data.size() + data.size() / 1000 + 64, '\0');
+  deflater.next_out = reinterpret_cast<uint8_t *>(&out[0]);
+  deflater.avail_out = out.size();
+  deflater.avail_in = data.size();
+  int ret = deflater.Deflate(reinterpret_cast<const uint8_t *>(data.data()),
+                             data.size(), Z_FINISH);
+  if (ret != Z_STREAM_END) {
+    diag_errx(1, "%s:%d: deflate returned %d", __FILE__, __LINE__, ret);
+  }
+  out.resize(deflater.total_out);
+  return out;
+}
+
+// Appends a POD header of given size to the string and returns it.
+template <class T>
+T *AppendHeader(std::string *out, size_t size) {
+  size_t offset = out->size();
+  out->append(size, '\0');
+  return reinterpret_cast<T *>(&(*out)[offset]);
+}
+
+// Writes a synthetic jar with given entry names.
+void CreateJar(const std::string &path, const std::vector<std::string> &names,
+               const BenchmarkOptions &options, unsigned seed) {
+  std::string jar;
+  std::string cen;
+  for (auto &name : names) {
+    std::string contents = EntryContents(options.entry_size, seed++);
+    std::string data = options.stored ? contents : Deflate(contents);
+    uint16_t method = options.stored ? Z_NO_COMPRESSION : Z_DEFLATED;
+    uint32_t crc = ComputeCrc32(
+        0, reinterpret_cast<const uint8_t *>(contents.data()), contents.size());
+    uint32_t local_header_offset = jar.size();
+    LH *lh = AppendHeader<LH>(&jar, sizeof(LH) + name.size());
+    lh->signature();
+    lh->version(20);
+    lh->compression_method(method);
+    lh->last_mod_file_date(33);
+    lh->crc32(crc);
+    lh->compressed_file_size32(data.size());
+    lh->uncompressed_file_size32(contents.size());
+    lh->file_name(name.data(), name.size());
+    lh->extra_fields(nullptr, 0);
+    jar += data;
+
+    CDH *cdh = AppendHeader<CDH>(&cen, sizeof(CDH) + name.size());
+    cdh->signature();
+    cdh->version(20);
+    cdh->version_to_extract(20);
+    cdh->compression_method(method);
+    cdh->last_mod_file_date(33);
+    cdh->crc32(crc);
+    cdh->compressed_file_size32(data.size());
+    cdh->uncompressed_file_size32(contents.size());
+    cdh->file_name(name.data(), name.size());
+    cdh->extra_fields(nullptr, 0);
+    cdh->comment_length(0);
+    cdh->local_header_offset32(local_header_offset);
+  }
+  uint32_t cen_offset = jar.size();
+  jar += cen;
+  ECD *ecd = AppendHeader<ECD>(&jar, sizeof(ECD));
+  ecd->signature();
+  ecd->this_disk_entries16(names.size());
+  ecd->total_entries16(names.size());
+  ecd->cen_size32(cen.size());
+  ecd->cen_offset32(cen_offset);
+
+  FILE *file = fopen(path.c_str(), "wb");
+  if (file == nullptr || fwrite(jar.data(), jar.size(), 1, file) != 1 ||
+      fclose(file)) {
+    diag_err(1, "%s:%d: Cannot write %s", __FILE__, __LINE__, path.c_str());
+  }
+}
+
+// Returns the entry names of the input jar with given index.
+std::vector<std::string> EntryNames(int jar_index,
+                                    const BenchmarkOptions &options) {
+  std::vector<std::string> names;
+  int shared = options.entries * options.duplicates / 100;
+  for (int i = 0; i < options.entries; ++i) {
+    std::string name =
+        i < shared ? "com/example/common/Shared"
+                   : "com/example/lib" + std::to_string(jar_index) + "/Class";
+    names.push_back(name + std::to_string(i) + ".class");
+  }
+  return names;
+}
+
+// Prints the result of a benchmark: the time per item and the throughput.
+void Report(const char *name, uint64_t nanos, uint64_t items, uint64_t bytes) {
+  printf("%-28s %12.1f ns/item %10.1f items/s", name,
+         static_cast<double>(nanos) / items, items * 1e9 / nanos);
+  if (bytes) {
+    printf(" %10.1f MB/s", bytes * 1e3 / nanos);
+  }
+  printf("\n");
+}
+
+void BenchmarkNextEntry(const std::vector<std::string> &jar_paths,
+                        const BenchmarkOptions &options) {
+  uint64_t items = 0;
+  uint64_t start = MonotonicNanos();
+  for (int iteration = 0; iteration < options.iterations; ++iteration) {
+    for (auto &jar_path : jar_paths) {
+      InputJar input_jar;
+      if (!input_jar.Open(jar_path)) {
+        diag_errx(1, "%s:%d: Cannot open %s", __FILE__, __LINE__,
+                  jar_path.c_str());
+      }
+      const CDH *cdh;
+      const LH *lh;
+      while ((cdh = input_jar.NextEntry(&lh))) {
+        ++items;
+      }
+    }
+  }
+  Report("InputJar::NextEntry", MonotonicNanos() - start, items, 0);
+}
+
+void BenchmarkAddJar(const std::string &tmpdir,
+                     const std::vector<std::string> &jar_paths,
+                     const BenchmarkOptions &options, bool compression) {
+  std::string out_path = tmpdir + "/out.jar";
+  std::string threads = std::to_string(options.threads);
+  std::vector<const char *> args = {"--output", out_path.c_str(), "--normalize",
+                                    "--threads", threads.c_str()};
+  if (compression) {
+    args.push_back("--compression");
+  }
+  args.push_back("--sources");
+  uint64_t bytes = 0;
+  for (auto &jar_path : jar_paths) {
+    args.push_back(jar_path.c_str());
+    MappedFile mapped_file;
+    if (mapped_file.Open(jar_path)) {
+      bytes += mapped_file.size();
+    }
+  }
+  uint64_t items = 0;
+  uint64_t start = MonotonicNanos();
+  for (int iteration = 0; iteration < options.iterations; ++iteration) {
+    Options singlejar_options;
+    singlejar_options.ParseCommandLine(args.size(), args.data());
+    OutputJar output_jar;
+    output_jar.Doit(&singlejar_options);
+    items += jar_paths.size() * options.entries;
+  }
+  Report(compression ? "OutputJar::AddJar compress" : "OutputJar::AddJar",
+         MonotonicNanos() - start, items, bytes * options.iterations);
+  unlink(out_path.c_str());
+}
+
+void BenchmarkTransientBytes(const std::string &jar_path,
+                             const BenchmarkOptions &options) {
+  InputJar input_jar;
+  if (!input_jar.Open(jar_path)) {
+    diag_errx(1, "%s:%d: Cannot open %s", __FILE__, __LINE__,
+              jar_path.c_str());
+  }
+  std::vector<std::pair<const CDH *, const LH *> > entries;
+  const CDH *cdh;
+  const LH *lh;
+  while ((cdh = input_jar.NextEntry(&lh))) {
+    entries.emplace_back(cdh, lh);
+  }
+  uint64_t read_nanos = 0;
+  uint64_t compress_nanos = 0;
+  uint64_t bytes = 0;
+  Inflater inflater;
+  std::unique_ptr<uint8_t[]> buffer(new uint8_t[options.entry_size + 64]);
+  for (int iteration = 0; iteration < options.iterations; ++iteration) {
+    for (auto &entry : entries) {
+      TransientBytes transient_bytes;
+      uint64_t start = MonotonicNanos();
+      if (entry.second->compression_method() == Z_NO_COMPRESSION) {
+        transient_bytes.ReadEntryContents(entry.second);
+      } else {
+        transient_bytes.DecompressEntryContents(entry.first, entry.second,
+                                                &inflater);
+      }
+      uint64_t read = MonotonicNanos();
+      uint32_t checksum;
+      uint64_t bytes_written;
+      transient_bytes.CompressOut(buffer.get(), &checksum, &bytes_written);
+      compress_nanos += MonotonicNanos() - read;
+      read_nanos += read - start;
+      bytes += transient_bytes.data_size();
+    }
+  }
+  uint64_t items = entries.size() * options.iterations;
+  Report(options.stored ? "TransientBytes::ReadEntry"
+                        : "TransientBytes::Decompress",
+         read_nanos, items, bytes);
+  Report("TransientBytes::CompressOut", compress_nanos, items, bytes);
+}
+
+void BenchmarkNameMap(const BenchmarkOptions &options) {
+  std::vector<std::string> names;
+  for (int jar_index = 0; jar_index < options.jars; ++jar_index) {
+    std::vector<std::string> jar_names = EntryNames(jar_index, options);
+    names.insert(names.end(), jar_names.begin(), jar_names.end());
+  }
+  uint64_t items = 0;
+  uint64_t found = 0;
+  uint64_t start = MonotonicNanos();
+  for (int iteration = 0; iteration < options.iterations; ++iteration) {
+    NameMap<int> name_map;
+    for (auto &name : names) {
+      if (!name_map.Emplace(name.data(), name.size(), 0).second) {
+        ++found;
+      }
+      ++items;
+    }
+  }
+  Report("NameMap::Emplace", MonotonicNanos() - start, items, 0);
+  printf("%" PRIu64 " duplicate names per iteration\n",
+         found / options.iterations);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  BenchmarkOptions options;
+  ArgTokenStream tokens(argc - 1, argv + 1);
+  while (!tokens.AtEnd()) {
+    if (!tokens.MatchAndSet("--jars", &options.jars) &&
+        !tokens.MatchAndSet("--entries", &options.entries) &&
+        !tokens.MatchAndSet("--entry_size", &options.entry_size) &&
+        !tokens.MatchAndSet("--duplicates", &options.duplicates) &&
+        !tokens.MatchAndSet("--iterations", &options.iterations) &&
+        !tokens.MatchAndSet("--threads", &options.threads) &&
+        !tokens.MatchAndSet("--stored", &options.stored)) {
+      diag_errx(1, "Bad command line argument %s", tokens.token().c_str());
+    }
+  }
+  if (options.jars < 1 || options.entries < 1 || options.entry_size < 0 ||
+      options.duplicates < 0 || options.duplicates > 100 ||
+      options.iterations < 1 || options.threads < 1) {
+    diag_errx(1, "Bad benchmark parameters");
+  }
+
+  const char *tmpdir_root = getenv("TEST_TMPDIR");
+  std::string tmpdir =
+      std::string(tmpdir_root ? tmpdir_root : "/tmp") + "/singlejar_bm.XXXXXX";
+  if (mkdtemp(&tmpdir[0]) == nullptr) {
+    diag_err(1, "%s:%d: Cannot create %s", __FILE__, __LINE__, tmpdir.c_str());
+  }
+  std::vector<std::string> jar_paths;
+  for (int jar_index = 0; jar_index < options.jars; ++jar_index) {
+    jar_paths.push_back(tmpdir + "/in" + std::to_string(jar_index) + ".jar");
+    CreateJar(jar_paths.back(), EntryNames(jar_index, options), options,
+              jar_index * options.entries);
+  }
+  printf("%d jars, %d entries of %d bytes each, %d%% duplicates, %s\n",
+         options.jars, options.entries, options.entry_size, options.duplicates,
+         options.stored ? "stored" : "deflated");
+
+  BenchmarkNextEntry(jar_paths, options);
+  BenchmarkAddJar(tmpdir, jar_paths, options, false);
+  BenchmarkAddJar(tmpdir, jar_paths, options, true);
+  BenchmarkTransientBytes(jar_paths[0], options);
+  BenchmarkNameMap(options);
+
+  for (auto &jar_path : jar_paths) {
+    unlink(jar_path.c_str());
+  }
+  rmdir(tmpdir.c_str());
+  return 0;
+}
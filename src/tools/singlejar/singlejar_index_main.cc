@@ -0,0 +1,37 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Writes the index of an input jar, see InputJarIndex. Usage:
+//   singlejar_index <input jar> [<index file>]
+// The index file defaults to the one singlejar looks for, <input jar>.sjindex.
+
+#include <string>
+
+#include "src/tools/singlejar/diag.h"
+#include "src/tools/singlejar/input_jar_index.h"
+#include "src/tools/singlejar/jar_scanner.h"
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 3) {
+    diag_errx(1, "Usage: %s <input jar> [<index file>]", argv[0]);
+  }
+  std::string jar_path = argv[1];
+  std::string index_path =
+      argc > 2 ? argv[2] : InputJarIndex::IndexPath(jar_path);
+  if (!JarScanner::WriteIndex(jar_path, index_path)) {
+    diag_err(1, "%s:%d: Cannot write the index of %s to %s", __FILE__,
+             __LINE__, jar_path.c_str(), index_path.c_str());
+  }
+  return 0;
+}
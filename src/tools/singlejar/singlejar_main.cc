@@ -12,12 +12,111 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "src/tools/singlejar/diag.h"
+#include "src/tools/singlejar/mapped_file.h"
 #include "src/tools/singlejar/options.h"
 #include "src/tools/singlejar/output_jar.h"
+#include "third_party/ijar/worker.h"
 
-int main(int argc, char *argv[]) {
+// Builds the output once more, with a different number of threads, and
+// verifies that the result is the same. The first output is set aside
+// meanwhile, as the output path is recorded in the build data. Returns the
+// exit code.
+static int CheckReproducibility(const Options &options) {
+  struct stat st;
+  if (stat(options.output_jar.c_str(), &st) || !S_ISREG(st.st_mode)) {
+    diag_warnx("%s:%d: %s is not a regular file, cannot check "
+               "reproducibility", __FILE__, __LINE__,
+               options.output_jar.c_str());
+    return 1;
+  }
+  std::string first_output = options.output_jar + ".first";
+  if (rename(options.output_jar.c_str(), first_output.c_str())) {
+    diag_warn("%s:%d: Cannot rename %s", __FILE__, __LINE__,
+              options.output_jar.c_str());
+    return 1;
+  }
+  Options check_options = options;
+  check_options.threads = options.threads > 1 ? 1 : 4;
+  check_options.incremental_base.clear();
+  check_options.stats.clear();
+  check_options.verbose = false;
+  OutputJar check_jar;
+  int rc = check_jar.Doit(&check_options);
+  bool same = false;
+  size_t offset = 0;
+  if (!rc) {
+    MappedFile output;
+    MappedFile check_output;
+    if (!output.Open(first_output) ||
+        !check_output.Open(options.output_jar)) {
+      rc = 1;
+    }
+    size_t size = std::min(output.size(), check_output.size());
+    same = output.size() == check_output.size() &&
+           !memcmp(output.start(), check_output.start(), size);
+    while (!same && offset < size &&
+           output.start()[offset] == check_output.start()[offset]) {
+      ++offset;
+    }
+  }
+  // Keep the first output.
+  if (rename(first_output.c_str(), options.output_jar.c_str())) {
+    diag_warn("%s:%d: Cannot rename %s", __FILE__, __LINE__,
+              first_output.c_str());
+    return 1;
+  }
+  if (rc) {
+    return rc;
+  }
+  if (!same) {
+    diag_warnx("%s is not reproducible: built with %d and %d threads, the "
+               "outputs differ at offset %zu",
+               options.output_jar.c_str(), options.threads,
+               check_options.threads, offset);
+    return 1;
+  }
+  return 0;
+}
+
+// Builds the output jar for the given command line (without the program
+// name), returns the exit code.
+static int Run(int argc, const char *const argv[], bool worker) {
   Options options;
-  options.ParseCommandLine(argc - 1, argv + 1);
+  options.ParseCommandLine(argc, argv);
+  if (worker && options.output_to_stdout()) {
+    // The standard output carries the work responses.
+    diag_warnx("--output - cannot be used by a persistent worker");
+    return 1;
+  }
   OutputJar output_jar;
-  return output_jar.Doit(&options);
+  int rc = output_jar.Doit(&options);
+  if (!rc && options.check_reproducibility) {
+    rc = CheckReproducibility(options);
+  }
+  return rc;
+}
+
+int main(int argc, char *argv[]) {
+  if (!devtools_ijar::IsPersistentWorker(argc, argv)) {
+    return Run(argc - 1, argv + 1, false);
+  }
+  // Each work request holds the command line of one singlejar run.
+  return devtools_ijar::RunPersistentWorker(
+      [](const std::vector<std::string> &arguments) {
+        std::vector<const char *> request_argv;
+        for (auto &argument : arguments) {
+          request_argv.push_back(argument.c_str());
+        }
+        return Run(request_argv.size(), request_argv.data(), true);
+      });
 }
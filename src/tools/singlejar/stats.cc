@@ -0,0 +1,95 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/tools/singlejar/stats.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+const char *Stats::Name(Counter counter) {
+  static const char *const kNames[kCounterCount] = {
+      "total_nanos",
+      "open_nanos",
+      "scan_nanos",
+      "scan_wait_nanos",
+      "dedup_nanos",
+      "compare_nanos",
+      "copy_nanos",
+      "recompress_wait_nanos",
+      "combine_nanos",
+      "cen_write_nanos",
+      "input_jars",
+      "indexed_jars",
+      "input_entries",
+      "duplicate_entries",
+      "conflicting_entries",
+      "copied_entries",
+      "copied_bytes",
+      "reused_entries",
+      "reused_bytes",
+      "recompressed_entries",
+      "recompressed_input_bytes",
+      "recompressed_output_bytes",
+      "incompressible_entries",
+      "combined_entries",
+      "output_entries",
+      "output_bytes",
+      "output_parts",
+      "cen_bytes",
+      "cen_peak_capacity",
+      "transient_bytes_peak",
+      "write_calls",
+      "copy_calls",
+      "peak_rss_kb",
+      "minor_faults",
+      "major_faults",
+      "voluntary_context_switches",
+      "involuntary_context_switches",
+  };
+  return kNames[counter];
+}
+
+void Stats::SetResourceUsage() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage)) {
+    return;
+  }
+  // ru_maxrss is in kilobytes on Linux and in bytes on macOS.
+#if defined(__APPLE__)
+  Set(kPeakRssKb, usage.ru_maxrss / 1024);
+#else
+  Set(kPeakRssKb, usage.ru_maxrss);
+#endif
+  Set(kMinorFaults, usage.ru_minflt);
+  Set(kMajorFaults, usage.ru_majflt);
+  Set(kVoluntaryContextSwitches, usage.ru_nvcsw);
+  Set(kInvoluntaryContextSwitches, usage.ru_nivcsw);
+}
+
+bool Stats::Write(const std::string &path) const {
+  FILE *file = fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    return false;
+  }
+  fputs("{\n", file);
+  for (int i = 0; i < kCounterCount; ++i) {
+    fprintf(file, "  \"%s\": %" PRIu64 "%s\n",
+            Name(static_cast<Counter>(i)), counters_[i],
+            i + 1 < kCounterCount ? "," : "");
+  }
+  fputs("}\n", file);
+  bool ok = !ferror(file);
+  return fclose(file) == 0 && ok;
+}
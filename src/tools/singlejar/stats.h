@@ -0,0 +1,125 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_TOOLS_SINGLEJAR_STATS_H_
+#define SRC_TOOLS_SINGLEJAR_STATS_H_ 1
+
+#include <stdint.h>
+#include <time.h>
+
+#include <string>
+
+// Returns the monotonic clock time in nanoseconds.
+inline uint64_t MonotonicNanos() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * The counters reported by --stats. The times are in nanoseconds. The
+ * jars are opened and scanned, and the entries recompressed, on several
+ * threads, so the corresponding times are the totals over all the threads,
+ * while the *_wait_nanos ones are the time the writer thread was blocked.
+ */
+class Stats {
+ public:
+  enum Counter {
+    kTotalNanos,  // The whole run.
+    kOpenNanos,  // Opening and mapping the input jars.
+    kScanNanos,  // Walking their Central Directories.
+    kScanWaitNanos,  // The writer waiting for the scanned jars.
+    kDedupNanos,  // Looking up the entry names.
+    kCompareNanos,  // Comparing the contents of the duplicate entries.
+    kCopyNanos,  // Copying the entries verbatim.
+    kRecompressWaitNanos,  // Getting the recompressed entries.
+    kCombineNanos,  // Merging into and writing out the combined entries.
+    kCenWriteNanos,  // Writing the Central Directory.
+    kInputJars,
+    kIndexedJars,  // The input jars scanned using their index.
+    kInputEntries,  // The entries left after filtering.
+    kDuplicateEntries,
+    kConflictingEntries,  // The duplicates with different contents.
+    kCopiedEntries,
+    kCopiedBytes,
+    kReusedEntries,  // Copied from --incremental_base.
+    kReusedBytes,
+    kRecompressedEntries,
+    kRecompressedInputBytes,
+    kRecompressedOutputBytes,
+    kIncompressibleEntries,  // Left stored by the compression policy.
+    kCombinedEntries,  // The input entries handled by a combiner.
+    kOutputEntries,
+    kOutputBytes,
+    kOutputParts,  // With --max_part_megabytes or --max_part_entries.
+    kCenBytes,
+    kCenPeakCapacity,
+    kTransientBytesPeak,  // Peak memory held by the combiner buffers.
+    kWriteCalls,  // write(2) calls.
+    kCopyCalls,  // copy_file_range(2), sendfile(2) or AppendFile read calls.
+    kPeakRssKb,
+    kMinorFaults,
+    kMajorFaults,
+    kVoluntaryContextSwitches,
+    kInvoluntaryContextSwitches,
+    kCounterCount  // Has to be the last.
+  };
+
+  Stats() : counters_() {}
+
+  void Add(Counter counter, uint64_t value) { counters_[counter] += value; }
+
+  void Set(Counter counter, uint64_t value) { counters_[counter] = value; }
+
+  void Max(Counter counter, uint64_t value) {
+    if (counters_[counter] < value) {
+      counters_[counter] = value;
+    }
+  }
+
+  uint64_t Get(Counter counter) const { return counters_[counter]; }
+
+  // Sets the counters obtained from getrusage(2).
+  void SetResourceUsage();
+
+  // Writes the counters to given file as a JSON object. Returns true on
+  // success.
+  bool Write(const std::string &path) const;
+
+  // Returns the name of given counter in the output.
+  static const char *Name(Counter counter);
+
+ private:
+  uint64_t counters_[kCounterCount];
+};
+
+// Adds the time spent in its scope to given counter, unless `stats' is null.
+class ScopedTimer {
+ public:
+  ScopedTimer(Stats *stats, Stats::Counter counter)
+      : stats_(stats), counter_(counter), start_(stats ? MonotonicNanos() : 0) {}
+
+  ~ScopedTimer() {
+    if (stats_) {
+      stats_->Add(counter_, MonotonicNanos() - start_);
+    }
+  }
+
+ private:
+  Stats *stats_;
+  Stats::Counter counter_;
+  uint64_t start_;
+};
+
+#endif  //  SRC_TOOLS_SINGLEJAR_STATS_H_
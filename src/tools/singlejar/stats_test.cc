@@ -0,0 +1,64 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+
+#include <string>
+
+#include "src/main/cpp/blaze_util.h"
+#include "src/tools/singlejar/stats.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+TEST(StatsTest, Counters) {
+  Stats stats;
+  EXPECT_EQ(0, stats.Get(Stats::kCopiedBytes));
+  stats.Add(Stats::kCopiedBytes, 10);
+  stats.Add(Stats::kCopiedBytes, 5);
+  EXPECT_EQ(15, stats.Get(Stats::kCopiedBytes));
+  stats.Max(Stats::kCenPeakCapacity, 7);
+  stats.Max(Stats::kCenPeakCapacity, 3);
+  EXPECT_EQ(7, stats.Get(Stats::kCenPeakCapacity));
+  stats.Set(Stats::kCenBytes, 1);
+  EXPECT_EQ(1, stats.Get(Stats::kCenBytes));
+  {
+    ScopedTimer timer(&stats, Stats::kCopyNanos);
+  }
+  ScopedTimer no_timer(nullptr, Stats::kCopyNanos);
+  stats.SetResourceUsage();
+  EXPECT_LT(0, stats.Get(Stats::kPeakRssKb));
+}
+
+// Every counter is written with its name.
+TEST(StatsTest, Write) {
+  Stats stats;
+  stats.Set(Stats::kTotalNanos, 123);
+  stats.Set(Stats::kInvoluntaryContextSwitches, 456);
+  const char *tmpdir = getenv("TEST_TMPDIR");
+  std::string path = std::string(tmpdir ? tmpdir : "/tmp") + "/stats.json";
+  ASSERT_TRUE(stats.Write(path));
+  std::string contents;
+  ASSERT_TRUE(blaze::ReadFile(path, &contents));
+  EXPECT_EQ('{', contents.front());
+  EXPECT_NE(std::string::npos, contents.find("\"total_nanos\": 123,\n"));
+  EXPECT_NE(std::string::npos,
+            contents.find("\"involuntary_context_switches\": 456\n}"));
+  for (int i = 0; i < Stats::kCounterCount; ++i) {
+    std::string name = Stats::Name(static_cast<Stats::Counter>(i));
+    EXPECT_NE(std::string::npos, contents.find("\"" + name + "\": ")) << name;
+  }
+}
+
+}  // namespace
@@ -15,11 +15,15 @@
 #ifndef THIRD_PARTY_BAZEL_SRC_TOOLS_SINGLEJAR_TOKEN_STREAM_H_
 #define THIRD_PARTY_BAZEL_SRC_TOOLS_SINGLEJAR_TOKEN_STREAM_H_ 1
 
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "src/tools/singlejar/diag.h"
@@ -52,124 +56,151 @@ class ArgTokenStream {
    */
 
  private:
-  // Internal class to handle indirect command files.
+  // Internal class to handle indirect command files. The file is read in
+  // one go, and the runs of ordinary characters are appended to the token
+  // at once rather than character by character: the command files list
+  // tens of thousands of jars.
   class FileTokenStream {
    public:
     FileTokenStream(const char *filename) {
-      if (!(fp_ = fopen(filename, "r"))) {
+      FILE *fp = fopen(filename, "r");
+      if (!fp) {
         diag_err(1, "%s", filename);
       }
+      char buffer[65536];
+      size_t n_read;
+      while ((n_read = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        contents_.append(buffer, n_read);
+      }
+      if (ferror(fp)) {
+        diag_err(1, "%s", filename);
+      }
+      fclose(fp);
       filename_ = filename;
-      next_char();
+      remove_line_continuations();
+      pos_ = contents_.data();
+      end_ = pos_ + contents_.size();
     }
 
-    ~FileTokenStream() { close(); }
-
     // Assign next token to TOKEN, return true on success, false on EOF.
     bool next_token(std::string *token) {
-      if (!fp_) {
-        return false;
-      }
-      *token = "";
-      while (current_char_ != EOF && isspace(current_char_)) {
-        next_char();
+      token->clear();
+      while (pos_ < end_ && is_space(*pos_)) {
+        ++pos_;
       }
-      if (current_char_ == EOF) {
-        close();
+      if (pos_ == end_) {
         return false;
       }
       for (;;) {
-        if (current_char_ == '\'' || current_char_ == '"') {
-          process_quoted(token);
-          if (isspace(current_char_)) {
-            next_char();
-            return true;
-          } else {
-            next_char();
-          }
-        } else if (current_char_ == '\\') {
-          next_char();
-          if ((current_char_ != EOF)) {
-            token->push_back(current_char_);
-            next_char();
-          } else {
+        const char *run_end = pos_;
+        while (run_end < end_ && !is_special(*run_end)) {
+          ++run_end;
+        }
+        token->append(pos_, run_end);
+        pos_ = run_end;
+        if (pos_ == end_) {
+          return true;
+        }
+        char c = *pos_++;
+        if (c == '\'' || c == '"') {
+          process_quoted(c, token);
+          // Skip the closing quote.
+          ++pos_;
+        } else if (c == '\\') {
+          if (pos_ == end_) {
             diag_errx(1, "Expected character after \\, got EOF in %s",
                       filename_.c_str());
           }
-        } else if (current_char_ == EOF || isspace(current_char_)) {
-          next_char();
-          return true;
+          token->push_back(*pos_++);
         } else {
-          token->push_back(current_char_);
-          next_char();
+          // Whitespace ends the token.
+          return true;
         }
       }
     }
 
    private:
-    void close() {
-      if (fp_) {
-        fclose(fp_);
-        fp_ = nullptr;
+    // Drops backslash followed by the newline.
+    void remove_line_continuations() {
+      size_t from = contents_.find("\\\n");
+      if (from == std::string::npos) {
+        return;
+      }
+      size_t to = from;
+      while (from < contents_.size()) {
+        if (contents_[from] == '\\' && from + 1 < contents_.size() &&
+            contents_[from + 1] == '\n') {
+          from += 2;
+        } else {
+          contents_[to++] = contents_[from++];
+        }
       }
-      filename_.clear();
+      contents_.resize(to);
     }
 
-    // Append the quoted string to the TOKEN. The quote character (which can be
-    // single or double quote) is in the current character. Everything up to the
-    // matching quote character is appended.
-    void process_quoted(std::string *token) {
-      char quote = current_char_;
-      next_char();
-      while (current_char_ != quote) {
-        if (current_char_ == '\\' && quote == '"') {
-          // In the "-quoted token, \" stands for ", and \x
-          // is copied literally for any other x.
-          next_char();
-          if (current_char_ == '"') {
-            token->push_back('"');
-            next_char();
-          } else if (current_char_ != EOF) {
-            token->push_back('\\');
-            token->push_back(current_char_);
-            next_char();
-          } else {
-            diag_errx(1, "No closing %c in %s", quote, filename_.c_str());
-          }
-        } else if (current_char_ != EOF) {
-          token->push_back(current_char_);
-          next_char();
-        } else {
+    // Append the quoted string to the TOKEN. The opening QUOTE character
+    // (which can be single or double quote) has been consumed. Everything up
+    // to the matching quote character is appended, which is left current.
+    void process_quoted(char quote, std::string *token) {
+      for (;;) {
+        const char *run_end = pos_;
+        while (run_end < end_ && *run_end != quote &&
+               (*run_end != '\\' || quote != '"')) {
+          ++run_end;
+        }
+        token->append(pos_, run_end);
+        pos_ = run_end;
+        if (pos_ == end_) {
+          diag_errx(1, "No closing %c in %s", quote, filename_.c_str());
+        }
+        if (*pos_ == quote) {
+          return;
+        }
+        // In the "-quoted token, \" stands for ", and \x
+        // is copied literally for any other x.
+        if (++pos_ == end_) {
           diag_errx(1, "No closing %c in %s", quote, filename_.c_str());
         }
+        if (*pos_ != '"') {
+          token->push_back('\\');
+        }
+        token->push_back(*pos_++);
       }
     }
 
-    // Get the next character from the input stream. Skip backslash followed
-    // by the newline.
-    void next_char() {
-      if (feof(fp_)) {
-        current_char_ = EOF;
-        return;
-      }
-      current_char_ = getc(fp_);
-      // Eat "\\\n" sequence.
-      while (current_char_ == '\\') {
-        int c = getc(fp_);
-        if (c == '\n') {
-          current_char_ = getc(fp_);
-        } else {
-          if (c != EOF) {
-            ungetc(c, fp_);
+    static bool is_space(char c) {
+      return character_class(c) == kSpace;
+    }
+
+    // True for the characters which end a run of ordinary ones.
+    static bool is_special(char c) {
+      return character_class(c) != kOrdinary;
+    }
+
+    enum CharacterClass { kOrdinary, kSpace, kQuoteOrEscape };
+
+    static CharacterClass character_class(char c) {
+      // The same set as isspace() in the C locale.
+      static const struct Table {
+        Table() {
+          memset(classes, kOrdinary, sizeof(classes));
+          for (unsigned char c : {' ', '\t', '\n', '\v', '\f', '\r'}) {
+            classes[c] = kSpace;
+          }
+          for (unsigned char c : {'\'', '"', '\\'}) {
+            classes[c] = kQuoteOrEscape;
           }
-          break;
         }
-      }
+        uint8_t classes[256];
+      } table;
+      return static_cast<CharacterClass>(
+          table.classes[static_cast<unsigned char>(c)]);
     }
 
-    FILE *fp_;
+    std::string contents_;
     std::string filename_;
-    int current_char_;
+    const char *pos_;
+    const char *end_;
   };
 
  public:
@@ -207,6 +238,31 @@ class ArgTokenStream {
     return true;
   }
 
+  // Process --OPTION NUMBER
+  // If the current token is --OPTION, parse the next token as a decimal
+  // integer, assign it to OPTARG, proceed to the next token after it and
+  // return true.
+  bool MatchAndSet(const char *option, int *optarg) {
+    if (token_.compare(option) != 0) {
+      return false;
+    }
+    next();
+    if (AtEnd()) {
+      diag_errx(1, "%s requires argument", option);
+    }
+    char *end;
+    errno = 0;
+    long value = strtol(token_.c_str(), &end, 10);
+    if (token_.empty() || *end || errno || value < INT_MIN ||
+        value > INT_MAX) {
+      diag_errx(1, "%s requires a numeric argument, got %s", option,
+                token_.c_str());
+    }
+    *optarg = static_cast<int>(value);
+    next();
+    return true;
+  }
+
   // Process --OPTION OPTARG1 OPTARG2 ...
   // If a current token is --OPTION, push_back all subsequent tokens up to the
   // next option to the OPTARGS array, proceed to the next option and return
@@ -217,7 +273,8 @@ class ArgTokenStream {
     }
     next();
     while (!AtEnd() && '-' != token_.at(0)) {
-      optargs->push_back(token_);
+      // next() assigns the token anew.
+      optargs->push_back(std::move(token_));
       next();
     }
     return true;
@@ -79,6 +79,39 @@ TEST(TokenStreamTest, CommandFile) {
   EXPECT_TRUE(token_stream.AtEnd());
 }
 
+// A command file with many tokens, some of them continued across lines.
+TEST(TokenStreamTest, LargeCommandFile) {
+  std::string command_file_path =
+      singlejar_test_util::OutputFilePath("many_tokens");
+  FILE *fp = fopen(command_file_path.c_str(), "w");
+  ASSERT_NE(nullptr, fp);
+  fprintf(fp, "--sources");
+  const int kJars = 100000;
+  for (int i = 0; i < kJars; ++i) {
+    if (i % 3 == 0) {
+      fprintf(fp, "\n'path/to/lib\\\n%d.jar'", i);
+    } else {
+      fprintf(fp, "\npath/to/lib%d\\\n.jar", i);
+    }
+  }
+  fprintf(fp, "\n--output\tout\\ put.jar\n");
+  fclose(fp);
+
+  std::string command_file_arg = std::string("@") + command_file_path;
+  const char *args[] = {command_file_arg.c_str()};
+  ArgTokenStream token_stream(ARRAY_SIZE(args), args);
+  std::vector<std::string> jars;
+  ASSERT_TRUE(token_stream.MatchAndSet("--sources", &jars));
+  ASSERT_EQ(kJars, jars.size());
+  for (int i = 0; i < kJars; ++i) {
+    ASSERT_EQ("path/to/lib" + std::to_string(i) + ".jar", jars[i]);
+  }
+  std::string output;
+  ASSERT_TRUE(token_stream.MatchAndSet("--output", &output));
+  EXPECT_EQ("out put.jar", output);
+  EXPECT_TRUE(token_stream.AtEnd());
+}
+
 // '--arg1 optval1 --arg2' command line.
 TEST(TokenStreamTest, OptargOne) {
   const char *args[] = {"--arg1", "optval1", "--arg2", "--arg3", "optval3"};
@@ -95,6 +128,19 @@ TEST(TokenStreamTest, OptargOne) {
   EXPECT_TRUE(token_stream.AtEnd());
 }
 
+// '--arg1 42 --arg2 -1' command line.
+TEST(TokenStreamTest, OptargInt) {
+  const char *args[] = {"--arg1", "42", "--arg2", "-1"};
+  ArgTokenStream token_stream(ARRAY_SIZE(args), args);
+  int optval = 0;
+  EXPECT_FALSE(token_stream.MatchAndSet("--foo", &optval));
+  ASSERT_TRUE(token_stream.MatchAndSet("--arg1", &optval));
+  EXPECT_EQ(42, optval);
+  ASSERT_TRUE(token_stream.MatchAndSet("--arg2", &optval));
+  EXPECT_EQ(-1, optval);
+  EXPECT_TRUE(token_stream.AtEnd());
+}
+
 // '--arg1 value1 value2 --arg2' command line.
 TEST(TokenStreamTest, OptargMulti) {
   const char *args[] = {"--arg1", "value11", "value12",
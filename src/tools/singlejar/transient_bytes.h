@@ -14,10 +14,19 @@
 #ifndef SRC_TOOLS_SINGLEJAR_TRANSIENT_BYTES_H_
 #define SRC_TOOLS_SINGLEJAR_TRANSIENT_BYTES_H_
 
+#include <errno.h>
 #include <inttypes.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <ostream>
+#include <string>
+#include <vector>
 
+#include "src/tools/singlejar/crc32.h"
 #include "src/tools/singlejar/diag.h"
 #include "src/tools/singlejar/zip_headers.h"
 #include "src/tools/singlejar/zlib_interface.h"
@@ -30,22 +39,41 @@
  * Use Append() to append a sequence of bytes or a string.
  * Use Write() to write out the contents, it will compress the entry if
  * necessary.
+ * Once the data held in memory exceed the spill threshold, the full chunks
+ * are moved to an (unlinked) temporary file, so that a huge entry, e.g. a
+ * concatenation of many META-INF/services files, does not need to be kept
+ * in memory until it is written out.
+ * The chunks come from a free list shared by all the instances, since one is
+ * created for every recompressed entry.
+ * Use AppendReference() to add bytes that are already in memory, e.g. a
+ * stored entry of a mapped input jar, without copying them.
  */
 class TransientBytes {
  public:
-  TransientBytes()
+  // The default amount of data kept in memory.
+  static const uint64_t kDefaultSpillThreshold = 64 * 1024 * 1024;
+
+  explicit TransientBytes(uint64_t spill_threshold = kDefaultSpillThreshold)
       : allocated_(0),
         data_size_(0),
         first_block_(nullptr),
-        last_block_(nullptr) {}
+        last_block_(nullptr),
+        spill_threshold_(spill_threshold),
+        spill_fd_(-1),
+        spilled_size_(0),
+        referenced_size_(0) {}
 
   ~TransientBytes() {
     while (first_block_) {
       auto block = first_block_;
       first_block_ = first_block_->next_block_;
-      delete block;
+      FreeBlock(block);
+      MemoryInUse() -= sizeof(DataBlock);
     }
     last_block_ = nullptr;
+    if (spill_fd_ >= 0) {
+      close(spill_fd_);
+    }
   }
 
   // Appends raw bytes.
@@ -59,6 +87,18 @@ class TransientBytes {
     }
   }
 
+  // Appends the "data_size" bytes at "data" by reference. They must stay
+  // unchanged as long as this instance uses them, which "owner" (if not null)
+  // ensures by keeping it.
+  void AppendReference(const uint8_t *data, uint64_t data_size,
+                       std::shared_ptr<const void> owner) {
+    if (data_size == 0) {
+      return;
+    }
+    references_.push_back(Reference{data_size_, data, data_size, owner});
+    referenced_size_ += data_size;
+  }
+
   // Same, but for a string.
   void Append(const char *str) {
     Append(reinterpret_cast<const uint8_t *>(str), strlen(str));
@@ -69,6 +109,12 @@ class TransientBytes {
     Append(lh->data(), lh->uncompressed_file_size());
   }
 
+  // Same, but by reference; see AppendReference().
+  void ReferenceEntryContents(const LH *lh,
+                              std::shared_ptr<const void> owner) {
+    AppendReference(lh->data(), lh->uncompressed_file_size(), owner);
+  }
+
   // Appends the contents of the compressed Zip entry. Resets the inflater
   // used to decompress.
   void DecompressEntryContents(const CDH *cdh, const LH *lh,
@@ -146,45 +192,39 @@ class TransientBytes {
   uint16_t CompressOut(uint8_t *buffer, uint32_t *checksum,
                        uint64_t *bytes_written) {
     *checksum = 0;
-    uint64_t to_compress = data_size();
-    if (to_compress == 0) {
+    if (data_size() == 0) {
       *bytes_written = 0;
       return Z_NO_COMPRESSION;
     }
 
-    Deflater deflater;
+    Deflater &deflater = *ThreadDeflater();
     deflater.next_out = buffer;
     uint16_t compression_method = Z_DEFLATED;
 
-    // Feed data blocks to the deflater one by one, but break if the compressed
-    // size exceeds the original size.
-    for (auto data_block = first_block_;
-         data_block && compression_method != Z_NO_COMPRESSION;
-         data_block = data_block->next_block_) {
+    // Feed data chunks to the deflater one by one, but break if the
+    // compressed size exceeds the original size.
+    ForEachChunk([&](const uint8_t *chunk, uint32_t chunk_size,
+                     uint64_t remaining) {
       // The compressed size should not exceed the original size less the number
       // of bytes already compressed. And, it should not exceed 4GB-1.
       deflater.avail_out = std::min(data_size() - deflater.total_out,
                                     static_cast<uint64_t>(0xFFFFFFFF));
-      // Out of the total number of bytes that remain to be compressed, we
-      // can compress no more than this block.
-      uint32_t chunk_size = static_cast<uint32_t>(std::min(
-          static_cast<uint64_t>(sizeof(data_block->data_)), to_compress));
-      *checksum = crc32(*checksum, data_block->data_, chunk_size);
+      *checksum = ComputeCrc32(*checksum, chunk, chunk_size);
       deflater.avail_in = chunk_size;
-      to_compress -= chunk_size;
-      int ret = deflater.Deflate(data_block->data_, chunk_size,
-                                 to_compress ? Z_NO_FLUSH : Z_FINISH);
+      int ret = deflater.Deflate(chunk, chunk_size,
+                                 remaining ? Z_NO_FLUSH : Z_FINISH);
       if (ret == Z_OK) {
         if (!deflater.avail_out) {
           // We ran out of space in the output buffer, which means
           // that deflated size exceeds original size. Leave the loop
           // and just copy the data.
           compression_method = Z_NO_COMPRESSION;
+          return false;
         }
       } else if (ret == Z_BUF_ERROR && !deflater.avail_in) {
         // We ran out of data block, this is not a error.
       } else if (ret == Z_STREAM_END) {
-        if (data_block->next_block_ || to_compress) {
+        if (remaining) {
           diag_errx(2,
                     "%s:%d: Internal error: deflate() call at the end, but "
                     "there is more data to compress!",
@@ -194,7 +234,8 @@ class TransientBytes {
         diag_errx(2, "%s:%d: deflate error %d(%s)", __FILE__, __LINE__, ret,
                   deflater.msg);
       }
-    }
+      return true;
+    });
     if (compression_method != Z_NO_COMPRESSION) {
       *bytes_written = deflater.total_out;
       return compression_method;
@@ -208,21 +249,40 @@ class TransientBytes {
 
   // Copies the bytes to the buffer and sets the checksum.
   void CopyOut(uint8_t *buffer, uint32_t *checksum) {
-    uint64_t to_copy = data_size();
-    uint8_t *buffer_end = buffer + to_copy;
     *checksum = 0;
-    for (auto data_block = first_block_; data_block;
-         data_block = data_block->next_block_) {
-      size_t chunk_size =
-          std::min(static_cast<uint64_t>(sizeof(data_block->data_)), to_copy);
-      *checksum = crc32(*checksum, data_block->data_, chunk_size);
-      memcpy(buffer_end - to_copy, data_block->data_, chunk_size);
-      to_copy -= chunk_size;
-    }
+    ForEachChunk([&](const uint8_t *chunk, uint32_t chunk_size,
+                     uint64_t remaining) {
+      *checksum = ComputeCrc32(*checksum, chunk, chunk_size);
+      memcpy(buffer, chunk, chunk_size);
+      buffer += chunk_size;
+      return true;
+    });
   }
 
   // Number of data bytes.
-  uint64_t data_size() const { return data_size_; }
+  uint64_t data_size() const { return data_size_ + referenced_size_; }
+
+  // The peak amount of memory held by all the instances.
+  static uint64_t memory_peak() { return MemoryPeak(); }
+
+  // The number of free blocks kept for new instances.
+  static size_t pooled_blocks() {
+    BlockPool &pool = Pool();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    return pool.size;
+  }
+
+  // Frees the pooled blocks. This is for testing.
+  static void ReleasePooledBlocks() {
+    BlockPool &pool = Pool();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    while (pool.free_blocks) {
+      DataBlock *block = pool.free_blocks;
+      pool.free_blocks = block->next_block_;
+      delete block;
+    }
+    pool.size = 0;
+  }
 
   // This is mostly for testing: stream out contents to a Sink instance.
   // The class Sink has to have
@@ -230,16 +290,11 @@ class TransientBytes {
   //
   template <class Sink>
   void stream_out(const Sink &sink) const {
-    uint64_t to_copy = data_size();
-    for (auto data_block = first_block_; data_block;
-         data_block = data_block->next_block_) {
-      uint64_t chunk_size = sizeof(data_block->data_);
-      if (chunk_size > to_copy) {
-        chunk_size = to_copy;
-      }
-      sink.operator()(data_block->data_, chunk_size);
-      to_copy -= chunk_size;
-    }
+    ForEachChunk([&sink](const uint8_t *chunk, uint32_t chunk_size,
+                         uint64_t remaining) {
+      sink.operator()(chunk, chunk_size);
+      return true;
+    });
   }
 
   uint8_t last_byte() const {
@@ -247,6 +302,9 @@ class TransientBytes {
       diag_errx(1, "%s:%d: last_char() cannot be called if buffer is empty",
                 __FILE__, __LINE__);
     }
+    if (!references_.empty() && references_.back().offset == data_size_) {
+      return references_.back().data[references_.back().size - 1];
+    }
     if (free_size() >= sizeof(last_block_->data_)) {
       diag_errx(1, "%s:%d: internal error: the last data block is empty",
                 __FILE__, __LINE__);
@@ -255,10 +313,156 @@ class TransientBytes {
   }
 
  private:
+  // The amount of memory held by all the instances (which can be used on
+  // several threads), and its peak.
+  static std::atomic<uint64_t> &MemoryInUse() {
+    static std::atomic<uint64_t> memory_in_use(0);
+    return memory_in_use;
+  }
+  static std::atomic<uint64_t> &MemoryPeak() {
+    static std::atomic<uint64_t> memory_peak(0);
+    return memory_peak;
+  }
+
+  // Calls consumer(chunk, chunk_size, remaining) for the consecutive chunks
+  // of the data, where `remaining' is the number of bytes following the
+  // chunk, until it returns false.
+  template <class Consumer>
+  void ForEachChunk(Consumer consumer) const {
+    uint64_t remaining = data_size();
+    size_t next_reference = 0;
+    uint64_t owned_offset = 0;  // Of the next owned byte.
+    // Hands out the references that come before the next owned byte.
+    auto references = [&]() {
+      for (; next_reference < references_.size() &&
+             references_[next_reference].offset == owned_offset;
+           ++next_reference) {
+        const Reference &reference = references_[next_reference];
+        for (uint64_t offset = 0; offset < reference.size;) {
+          // The chunk size is 32-bit.
+          uint32_t chunk_size = static_cast<uint32_t>(
+              std::min(reference.size - offset, static_cast<uint64_t>(1) << 30));
+          remaining -= chunk_size;
+          if (!consumer(reference.data + offset, chunk_size, remaining)) {
+            return false;
+          }
+          offset += chunk_size;
+        }
+      }
+      return true;
+    };
+    // Hands out owned bytes, split where references go.
+    auto owned = [&](const uint8_t *chunk, uint32_t chunk_size) {
+      while (chunk_size > 0) {
+        if (!references()) {
+          return false;
+        }
+        uint32_t piece = chunk_size;
+        if (next_reference < references_.size()) {
+          piece = static_cast<uint32_t>(
+              std::min(static_cast<uint64_t>(piece),
+                       references_[next_reference].offset - owned_offset));
+        }
+        owned_offset += piece;
+        remaining -= piece;
+        if (!consumer(chunk, piece, remaining)) {
+          return false;
+        }
+        chunk += piece;
+        chunk_size -= piece;
+      }
+      return true;
+    };
+
+    if (spilled_size_) {
+      std::unique_ptr<DataBlock> read_block(new DataBlock());
+      for (uint64_t offset = 0; offset < spilled_size_;) {
+        uint32_t chunk_size = static_cast<uint32_t>(
+            std::min(static_cast<uint64_t>(sizeof(read_block->data_)),
+                     spilled_size_ - offset));
+        ReadSpilled(offset, read_block->data_, chunk_size);
+        offset += chunk_size;
+        if (!owned(read_block->data_, chunk_size)) {
+          return;
+        }
+      }
+    }
+    for (auto data_block = first_block_; data_block;
+         data_block = data_block->next_block_) {
+      uint32_t chunk_size = static_cast<uint32_t>(
+          std::min(static_cast<uint64_t>(sizeof(data_block->data_)),
+                   data_size_ - owned_offset));
+      if (!owned(data_block->data_, chunk_size)) {
+        return;
+      }
+    }
+    references();
+  }
+
+  // Moves the data blocks to the spill file.
+  void Spill() {
+    if (spill_fd_ < 0) {
+      const char *tmpdir = getenv("TMPDIR");
+      std::string path = std::string(tmpdir && *tmpdir ? tmpdir : "/tmp") +
+                         "/singlejar.XXXXXX";
+      spill_fd_ = mkstemp(&path[0]);
+      if (spill_fd_ < 0) {
+        diag_err(1, "%s:%d: Cannot create temporary file %s", __FILE__,
+                 __LINE__, path.c_str());
+      }
+      unlink(path.c_str());
+    }
+    while (first_block_) {
+      auto block = first_block_;
+      size_t written = 0;
+      while (written < sizeof(block->data_)) {
+        ssize_t n = write(spill_fd_, block->data_ + written,
+                          sizeof(block->data_) - written);
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        if (n <= 0) {
+          diag_err(1, "%s:%d: Cannot write temporary file", __FILE__,
+                   __LINE__);
+        }
+        written += n;
+      }
+      spilled_size_ += sizeof(block->data_);
+      first_block_ = block->next_block_;
+      FreeBlock(block);
+      MemoryInUse() -= sizeof(DataBlock);
+    }
+    last_block_ = nullptr;
+  }
+
+  // Reads the spilled bytes at given offset.
+  void ReadSpilled(uint64_t offset, uint8_t *buffer, size_t count) const {
+    while (count > 0) {
+      ssize_t n = pread(spill_fd_, buffer, count, offset);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        diag_err(1, "%s:%d: Cannot read temporary file", __FILE__, __LINE__);
+      }
+      buffer += n;
+      offset += n;
+      count -= n;
+    }
+  }
+
   // Ensures there is some space to write to, returns the amount available.
   uint64_t ensure_space() {
     if (!free_size()) {
-      auto *data_block = new DataBlock();
+      if (allocated_ - spilled_size_ >= spill_threshold_) {
+        Spill();
+      }
+      auto *data_block = NewBlock();
+      uint64_t in_use = (MemoryInUse() += sizeof(DataBlock));
+      uint64_t peak = MemoryPeak();
+      while (peak < in_use &&
+             !MemoryPeak().compare_exchange_weak(peak, in_use)) {
+      }
       if (last_block_) {
         last_block_->next_block_ = data_block;
       }
@@ -304,10 +508,70 @@ class TransientBytes {
     uint8_t *End() { return data_ + sizeof(data_); }
   };
 
+  // The free blocks. Blocks are too large for malloc to keep them around, so
+  // without this every instance would map and fault in fresh memory.
+  struct BlockPool {
+    std::mutex mutex;
+    DataBlock *free_blocks = nullptr;
+    size_t size = 0;
+  };
+  // At most this many free blocks (16MB) are kept.
+  static const size_t kMaxPooledBlocks = 64;
+
+  static BlockPool &Pool() {
+    static BlockPool pool;
+    return pool;
+  }
+
+  static DataBlock *NewBlock() {
+    BlockPool &pool = Pool();
+    {
+      std::lock_guard<std::mutex> lock(pool.mutex);
+      if (pool.free_blocks) {
+        DataBlock *block = pool.free_blocks;
+        pool.free_blocks = block->next_block_;
+        --pool.size;
+        block->next_block_ = nullptr;
+        return block;
+      }
+    }
+    return new DataBlock();
+  }
+
+  static void FreeBlock(DataBlock *block) {
+    BlockPool &pool = Pool();
+    {
+      std::lock_guard<std::mutex> lock(pool.mutex);
+      if (pool.size < kMaxPooledBlocks) {
+        block->next_block_ = pool.free_blocks;
+        pool.free_blocks = block;
+        ++pool.size;
+        return;
+      }
+    }
+    delete block;
+  }
+
   uint64_t allocated_;
   uint64_t data_size_;
   struct DataBlock *first_block_;
   struct DataBlock *last_block_;
+  const uint64_t spill_threshold_;
+  int spill_fd_;
+  // The number of bytes at the beginning of the data which are in the spill
+  // file rather than in the data blocks.
+  uint64_t spilled_size_;
+
+  // Bytes appended by reference, which go before the owned byte at `offset'
+  // (counting the spilled ones).
+  struct Reference {
+    uint64_t offset;
+    const uint8_t *data;
+    uint64_t size;
+    std::shared_ptr<const void> owner;
+  };
+  std::vector<Reference> references_;
+  uint64_t referenced_size_;
 };
 
 #endif  // SRC_TOOLS_SINGLEJAR_TRANSIENT_BYTES_H_
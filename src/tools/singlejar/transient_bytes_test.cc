@@ -13,11 +13,15 @@
 // limitations under the License.
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include <fstream>
 #include <ios>
 #include <iostream>
 #include <memory>
 #include <sstream>
+#include <string>
 
 #include "src/tools/singlejar/input_jar.h"
 #include "src/tools/singlejar/test_util.h"
@@ -61,7 +65,11 @@ class TransientBytesTest : public ::testing::Test {
 
   static void TearDownTestCase() { unlink(kCompressedJar); }
 
-  void SetUp() override { transient_bytes_.reset(new TransientBytes); }
+  void SetUp() override {
+    // The pool is shared by all the tests, start each one with an empty one.
+    TransientBytes::ReleasePooledBlocks();
+    transient_bytes_.reset(new TransientBytes);
+  }
 
   // The value of the byte at a given position in a file created by the
   // CreateFile method below.
@@ -336,4 +344,120 @@ TEST_F(TransientBytesTest, CopyOut) {
   ASSERT_EQ(0xE8B7BE43, crc32);
 }
 
+// The blocks of destroyed instances are reused by new ones.
+TEST_F(TransientBytesTest, ReusesBlocks) {
+  transient_bytes_.reset();
+  size_t pooled = TransientBytes::pooled_blocks();
+  {
+    TransientBytes bytes;
+    for (int i = 0; i < 10000; ++i) {
+      bytes.Append(kBytesSmall);
+    }
+  }
+  size_t freed = TransientBytes::pooled_blocks() - pooled;
+  EXPECT_LT(0, freed);
+  {
+    TransientBytes bytes;
+    bytes.Append(kBytesSmall);
+    EXPECT_EQ(pooled + freed - 1, TransientBytes::pooled_blocks());
+    std::ostringstream out;
+    out << bytes;
+    EXPECT_EQ(kBytesSmall, out.str());
+  }
+  EXPECT_EQ(pooled + freed, TransientBytes::pooled_blocks());
+}
+
+// The data moved to the spill file are output the same way as the data
+// kept in memory.
+TEST_F(TransientBytesTest, Spill) {
+  // Spill every full block.
+  TransientBytes spilled(1);
+  uint64_t data_size = 0;
+  srand(42);
+  for (int i = 0; i < 100000; ++i) {
+    std::string line = "line " + std::to_string(i) + " " +
+                       std::to_string(rand() % 1000) + "\n";
+    transient_bytes_->Append(line.c_str());
+    spilled.Append(line.c_str());
+    data_size += line.size();
+  }
+  ASSERT_EQ(data_size, spilled.data_size());
+  EXPECT_EQ(transient_bytes_->last_byte(), spilled.last_byte());
+
+  std::ostringstream expected_stream;
+  std::ostringstream actual_stream;
+  expected_stream << *transient_bytes_;
+  actual_stream << spilled;
+  EXPECT_EQ(expected_stream.str(), actual_stream.str());
+
+  std::unique_ptr<uint8_t[]> expected(new uint8_t[data_size]);
+  std::unique_ptr<uint8_t[]> actual(new uint8_t[data_size]);
+  uint32_t expected_crc32;
+  uint32_t actual_crc32;
+  transient_bytes_->CopyOut(expected.get(), &expected_crc32);
+  spilled.CopyOut(actual.get(), &actual_crc32);
+  EXPECT_EQ(expected_crc32, actual_crc32);
+  EXPECT_EQ(0, memcmp(expected.get(), actual.get(), data_size));
+
+  uint64_t expected_size;
+  uint64_t actual_size;
+  EXPECT_EQ(Z_DEFLATED, transient_bytes_->CompressOut(
+                            expected.get(), &expected_crc32, &expected_size));
+  EXPECT_EQ(Z_DEFLATED,
+            spilled.CompressOut(actual.get(), &actual_crc32, &actual_size));
+  EXPECT_EQ(expected_crc32, actual_crc32);
+  ASSERT_EQ(expected_size, actual_size);
+  EXPECT_EQ(0, memcmp(expected.get(), actual.get(), expected_size));
+}
+
+// The bytes appended by reference are output in place, and are kept alive
+// by their owner.
+TEST_F(TransientBytesTest, AppendReference) {
+  // Spill every full block.
+  TransientBytes referencing(1);
+  std::string data;
+  std::weak_ptr<const void> weak_owner;
+  srand(42);
+  for (int i = 0; i < 20000; ++i) {
+    std::string line = "line " + std::to_string(i) + " " +
+                       std::to_string(rand() % 1000) + "\n";
+    data += line;
+    if (i % 3) {
+      referencing.Append(line.c_str());
+    } else {
+      std::shared_ptr<std::string> owner(new std::string(line));
+      weak_owner = owner;
+      referencing.AppendReference(
+          reinterpret_cast<const uint8_t *>(owner->data()), owner->size(),
+          owner);
+    }
+  }
+  EXPECT_FALSE(weak_owner.expired());
+  ASSERT_EQ(data.size(), referencing.data_size());
+  EXPECT_EQ('\n', referencing.last_byte());
+
+  std::ostringstream out;
+  out << referencing;
+  EXPECT_EQ(data, out.str());
+
+  transient_bytes_->Append(data.c_str());
+  std::unique_ptr<uint8_t[]> expected(new uint8_t[data.size()]);
+  std::unique_ptr<uint8_t[]> actual(new uint8_t[data.size()]);
+  uint32_t expected_crc32;
+  uint32_t actual_crc32;
+  transient_bytes_->CopyOut(expected.get(), &expected_crc32);
+  referencing.CopyOut(actual.get(), &actual_crc32);
+  EXPECT_EQ(expected_crc32, actual_crc32);
+  EXPECT_EQ(0, memcmp(expected.get(), actual.get(), data.size()));
+
+  // Only references.
+  TransientBytes referenced;
+  referenced.AppendReference(reinterpret_cast<const uint8_t *>(kBytesSmall),
+                             strlen(kBytesSmall), nullptr);
+  EXPECT_EQ(kBytesSmall[strlen(kBytesSmall) - 1], referenced.last_byte());
+  std::ostringstream referenced_out;
+  referenced_out << referenced;
+  EXPECT_EQ(kBytesSmall, referenced_out.str());
+}
+
 }  // namespace
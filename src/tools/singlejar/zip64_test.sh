@@ -58,4 +58,33 @@ function test_65Kentries() {
     { echo Expected 65536 entries, got "$n_entries" >&2; exit 1; }
 }
 
+# Test that an archive over 4GB can be created, with the entries past 4GB
+# located through the Zip64 extra fields of their Central Directory headers.
+function test_over4GB() {
+  local -r top="$TEST_TMPDIR/over4GB"
+  mkdir -p "$top/a" "$top/b"
+  dd if=/dev/zero of="$top/a/big" bs=1M count=2200
+  dd if=/dev/zero of="$top/b/big" bs=1M count=2200
+  echo "last entry" > "$top/b/last.txt"
+  local -r injar1="$TEST_TMPDIR/in1.jar"
+  local -r injar2="$TEST_TMPDIR/in2.jar"
+  local -r outzip="$TEST_TMPDIR/out4GB.zip"
+  rm -f "$injar1" "$injar2" "$outzip"
+  # Store the entries so that the output gets over 4GB.
+  (cd "$top/a" && "$jartool" -c0f "$injar1" big)
+  (cd "$top/b" && "$jartool" -c0f "$injar2" big last.txt)
+  rm -rf "$top"
+
+  "$singlejar" --output "$outzip" --sources "$injar1" "$injar2"
+  rm -f "$injar1" "$injar2"
+  local -r outsize=$(stat -c %s "$outzip" 2>/dev/null || stat -f %z "$outzip")
+  ((outsize > 4294967296)) || \
+    { echo Expected the output over 4GB, got "$outsize" bytes >&2; exit 1; }
+  mkdir -p "$top"
+  (cd "$top" && "$jartool" -xf "$outzip" last.txt)
+  [[ "$(cat "$top/last.txt")" == "last entry" ]] || \
+    { echo Cannot extract the entry past 4GB >&2; exit 1; }
+  rm -f "$outzip"
+}
+
 run_suite "singlejar Zip64 handling"
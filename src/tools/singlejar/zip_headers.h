@@ -26,8 +26,9 @@
 
 #if defined(__linux)
 #include <endian.h>
-#elif defined(__APPLE__)
-// Hopefully OSX will keep running solely on little endian CPUs, so:
+#elif defined(__APPLE__) || defined(_WIN32)
+// Hopefully OSX and Windows will keep running solely on little endian CPUs,
+// so:
 #define le16toh(x) (x)
 #define le32toh(x) (x)
 #define le64toh(x) (x)
@@ -90,6 +91,13 @@ class ExtraField {
 
   uint16_t size() const { return sizeof(ExtraField) + payload_size(); }
 
+  // True if this field records the file system attributes of the machine
+  // the archive was created on: the timestamps (the extended timestamp,
+  // the PKWARE and the Info-ZIP Unix fields) or the owner's UID/GID.
+  bool is_volatile() const {
+    return is(0x5455) || is(0x000d) || is(0x5855) || is(0x7875);
+  }
+
  protected:
   uint16_t tag_;
   uint16_t payload_size_;
@@ -165,6 +173,46 @@ class UnixTimeExtraField : public ExtraField {
 static_assert(5 == sizeof(UnixTimeExtraField),
               "UnixTimeExtraField layout is incorrect");
 
+/* Alignment Extra Field, the one Android's zipalign uses (tag 0xd935).
+ * It contains the alignment followed by zeros, and pads the Local Header
+ * so that the data of a stored entry starts at a multiple of the alignment.
+ */
+class AlignmentExtraField : public ExtraField {
+ public:
+  bool is() const { return ExtraField::is(0xd935); }
+  void signature() { ExtraField::signature(0xd935); }
+
+  // Returns the size of the field which makes the data, at data_offset
+  // without the field, start at a multiple of alignment, or 0 if the data
+  // is aligned already.
+  static uint16_t padded_size(uint64_t data_offset, uint16_t alignment) {
+    if (alignment <= 1) {
+      return 0;
+    }
+    uint16_t size = (alignment - data_offset % alignment) % alignment;
+    while (size != 0 && size < sizeof(AlignmentExtraField)) {
+      size += alignment;
+    }
+    return size;
+  }
+
+  // Fills in the field of given size (as returned by padded_size()).
+  void init(uint16_t size, uint16_t alignment) {
+    signature();
+    payload_size(size - sizeof(ExtraField));
+    alignment_ = htole16(alignment);
+    memset(padding_, 0, size - sizeof(AlignmentExtraField));
+  }
+
+  uint16_t alignment() const { return le16toh(alignment_); }
+
+ private:
+  uint16_t alignment_;
+  uint8_t padding_[];
+} __attribute__((packed));
+static_assert(6 == sizeof(AlignmentExtraField),
+              "AlignmentExtraField layout is incorrect");
+
 /* Local Header precedes each archive file data (section 4.3.7).  */
 class LH {
  public:
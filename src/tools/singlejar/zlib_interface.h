@@ -96,6 +96,8 @@ struct Deflater : z_stream {
 
   ~Deflater() { deflateEnd(this); }
 
+  void reset() { deflateReset(this); }
+
   int Deflate(const uint8_t *data, uint32_t data_size, int flag) {
     next_in = const_cast<uint8_t *>(data);
     avail_in = data_size;
@@ -103,4 +105,23 @@ struct Deflater : z_stream {
   }
 };
 
+// The zlib contexts are costly to set up (the deflater's state alone is some
+// 256KB), so the ones used to process a single entry at a time are kept per
+// thread, and reset rather than made anew for every entry. The caller must be
+// done with the returned context before it asks for it again.
+
+// Returns the reset inflater of the calling thread.
+inline Inflater *ThreadInflater() {
+  static thread_local Inflater inflater;
+  inflater.reset();
+  return &inflater;
+}
+
+// Returns the reset deflater of the calling thread.
+inline Deflater *ThreadDeflater() {
+  static thread_local Deflater deflater;
+  deflater.reset();
+  return &deflater;
+}
+
 #endif  // BAZEL_SRC_TOOLS_SINGLEJAR_ZLIB_INTERFACE_H_
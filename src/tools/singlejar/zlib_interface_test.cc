@@ -91,4 +91,33 @@ TEST(ZlibInterfaceTest, InflateToChunks) {
   EXPECT_EQ(0, memcmp(bytes, uncompressed, sizeof(bytes)));
 }
 
+// The thread contexts are the same objects every time, reset in between.
+TEST(ZlibInterfaceTest, ThreadContexts) {
+  uint8_t compressed[2][256];
+  size_t compressed_size[2];
+  for (int i = 0; i < 2; ++i) {
+    Deflater *deflater = ThreadDeflater();
+    EXPECT_EQ(0, deflater->total_out);
+    deflater->next_out = compressed[i];
+    deflater->avail_out = sizeof(compressed[i]);
+    EXPECT_EQ(Z_STREAM_END,
+              deflater->Deflate(bytes, sizeof(bytes), Z_FINISH));
+    compressed_size[i] = deflater->total_out;
+  }
+  EXPECT_EQ(ThreadDeflater(), ThreadDeflater());
+  ASSERT_EQ(compressed_size[0], compressed_size[1]);
+  EXPECT_EQ(0, memcmp(compressed[0], compressed[1], compressed_size[0]));
+
+  for (int i = 0; i < 2; ++i) {
+    Inflater *inflater = ThreadInflater();
+    EXPECT_EQ(0, inflater->total_out());
+    inflater->DataToInflate(compressed[i], compressed_size[i]);
+    uint8_t uncompressed[256];
+    EXPECT_EQ(Z_STREAM_END,
+              inflater->Inflate(uncompressed, sizeof(uncompressed)));
+    EXPECT_EQ(sizeof(bytes), inflater->total_out());
+    EXPECT_EQ(0, memcmp(bytes, uncompressed, sizeof(bytes)));
+  }
+}
+
 }  //  namespace
@@ -38,20 +38,31 @@ trap "rm -rf \"$TEMPDIR\"" EXIT
 # actool and ibtool appear to depend on the same code base.
 # Radar 21045660 ibtool has difficulty dealing with relative paths.
 
+# All the paths are resolved with a single realpath call, PATHINDICES holding
+# the indices of their arguments in TOOLARGS.
 TOOLARGS=()
+PATHS=()
+PATHINDICES=()
 LASTARG=""
 for i in $@; do
   if [ "$LASTARG" = "--output-partial-info-plist" ]; then
     touch "$i"
   fi
   if [ -e "$i" ]; then
-    ARG=$("${REALPATH}" "$i")
-    TOOLARGS+=("$ARG")
-  else
-    TOOLARGS+=("$i")
+    PATHINDICES+=("${#TOOLARGS[@]}")
+    PATHS+=("$i")
   fi
+  TOOLARGS+=("$i")
   LASTARG="$i"
 done
+if [ "${#PATHS[@]}" -gt 0 ]; then
+  REALPATHS=$("${REALPATH}" "${PATHS[@]}")
+  INDEX=0
+  while IFS= read -r ARG; do
+    TOOLARGS[${PATHINDICES[$INDEX]}]="$ARG"
+    INDEX=$((INDEX + 1))
+  done <<< "$REALPATHS"
+fi
 
 # If we are running into problems figuring out actool issues, there are a couple
 # of env variables that may help. Both of the following must be set to work.
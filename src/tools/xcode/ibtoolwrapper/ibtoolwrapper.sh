@@ -43,15 +43,26 @@ FULLPATH=$("${REALPATH}" "$FULLPATH")
 # IBTool needs to have absolute paths sent to it, so we call realpaths on
 # on all arguments seeing if we can expand them.
 # Radar 21045660 ibtool has difficulty dealing with relative paths.
+# All the paths are resolved with a single realpath call, PATHINDICES holding
+# the indices of their arguments in TOOLARGS.
 TOOLARGS=()
+PATHS=()
+PATHINDICES=()
 for i in $@; do
   if [ -e "$i" ]; then
-    ARG=$("${REALPATH}" "$i")
-    TOOLARGS+=("$ARG")
-  else
-    TOOLARGS+=("$i")
+    PATHINDICES+=("${#TOOLARGS[@]}")
+    PATHS+=("$i")
   fi
+  TOOLARGS+=("$i")
 done
+if [ "${#PATHS[@]}" -gt 0 ]; then
+  REALPATHS=$("${REALPATH}" "${PATHS[@]}")
+  INDEX=0
+  while IFS= read -r ARG; do
+    TOOLARGS[${PATHINDICES[$INDEX]}]="$ARG"
+    INDEX=$((INDEX + 1))
+  done <<< "$REALPATHS"
+fi
 
 # If we are running into problems figuring out ibtool issues, there are a couple
 # of env variables that may help. Both of the following must be set to work.
@@ -20,6 +20,9 @@
 //  component to not exist:
 //  http://www.gnu.org/software/coreutils/manual/html_node/realpath-invocation.html
 //  Debian requires all components to exist.
+//  Like the GNU version, it takes any number of paths and prints one resolved
+//  path per line, so that scripts can resolve all their paths with a single
+//  process.
 //
 
 #include <errno.h>
@@ -29,10 +32,10 @@
 #include <string.h>
 #include <unistd.h>
 
-// Print a simple error message and exit.
-static void PrintError(const char *argv[]) {
-  fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
-  exit(1);
+// Print a simple error message for the path and return 1.
+static int PrintError(const char *path) {
+  fprintf(stderr, "%s: %s\n", path, strerror(errno));
+  return 1;
 }
 
 // Concatenate two paths together adding a '/' if appropriate.
@@ -56,18 +59,14 @@ static char *JoinPaths(const char *path1, const char* path2) {
   return outPath;
 }
 
-// Since this is a simple utility that quits immediately, we are not worrying
-// about making the code more complex by freeing up any memory allocations.
-int main(int argc, const char *argv[]) {
-  if (argc != 2) {
-    fprintf(stderr, "realpath <path>\n");
-    return 1;
-  }
-  const char *path = argv[1];
+// Resolves the path and prints it. Returns 0 on success, 1 on error.
+// Since this is a simple utility that quits soon, we are not worrying about
+// making the code more complex by freeing up the memory allocations.
+static int PrintRealPath(const char *path) {
   char *goodPath = realpath(path, NULL);
   if (goodPath == NULL) {
     if ((errno != ENOENT) || (strlen(path) == 0)) {
-      PrintError(argv);
+      return PrintError(path);
     }
 
     // If only the last element is missing, then call realpath on the parent
@@ -79,25 +78,39 @@ int main(int argc, const char *argv[]) {
     char *dirCopy = strdup(path);
     char *baseCopy = strdup(path);
     if (dirCopy == NULL || baseCopy == NULL) {
-      PrintError(argv);
+      return PrintError(path);
     }
     char *dir = dirname(dirCopy);
     if (dir == NULL) {
-      PrintError(argv);
+      return PrintError(path);
     }
     char *base = basename(baseCopy);
     if (base == NULL) {
-      PrintError(argv);
+      return PrintError(path);
     }
     char *realdir = realpath(dir, NULL);
     if (realdir == NULL) {
-      PrintError(argv);
+      return PrintError(path);
     }
     goodPath = JoinPaths(realdir, base);
     if (goodPath == NULL) {
-      PrintError(argv);
+      return PrintError(path);
     }
   }
   fprintf(stdout, "%s\n", goodPath);
   return 0;
 }
+
+// As with GNU realpath, an error for one path does not stop the others from
+// being resolved, but makes the exit code 1.
+int main(int argc, const char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "realpath <path>...\n");
+    return 1;
+  }
+  int result = 0;
+  for (int i = 1; i < argc; i++) {
+    result |= PrintRealPath(argv[i]);
+  }
+  return result;
+}
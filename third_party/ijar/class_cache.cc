@@ -0,0 +1,164 @@
+// Copyright 2015 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// class_cache.cc -- on-disk cache of the stripped classes.
+//
+// An entry is named after the CRC-32 and the Adler-32 of the input class
+// and its length, and contains:
+//
+//   magic          4 bytes  kEntryMagic
+//   keep           1 byte   the result of StripClass()
+//   input length   8 bytes
+//   output length  8 bytes
+//   input class, then the stripped class
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "third_party/ijar/class_cache.h"
+#include <zlib.h>
+
+namespace devtools_ijar {
+
+// Change whenever StripClass() changes its output, so that the entries
+// written by an older ijar are not used.
+static const u4 kEntryMagic = 0x696a6301;
+static const size_t kHeaderSize = 4 + 1 + 8 + 8;
+
+// Reads the whole file, returns false on error.
+static bool ReadFile(const std::string& path, std::vector<u1>* contents) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0;
+  if (ok) {
+    contents->resize(st.st_size);
+    size_t done = 0;
+    while (ok && done < contents->size()) {
+      ssize_t n = read(fd, contents->data() + done, contents->size() - done);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      ok = n > 0;
+      done += ok ? n : 0;
+    }
+  }
+  close(fd);
+  return ok;
+}
+
+// Writes the buffer to the file, returns false on error.
+static bool WriteFully(int fd, const u1* data, size_t length) {
+  while (length > 0) {
+    ssize_t n = write(fd, data, length);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += n;
+    length -= n;
+  }
+  return true;
+}
+
+ClassCache::ClassCache(const char* dir) : dir_(dir) {
+  if (mkdir(dir, 0777) < 0 && errno != EEXIST) {
+    fprintf(stderr, "WARNING: cannot create class cache %s: %s\n", dir,
+            strerror(errno));
+  }
+}
+
+std::string ClassCache::EntryPath(const u1* classdata, size_t length) {
+  uLong crc = crc32(0L, Z_NULL, 0);
+  uLong adler = adler32(0L, Z_NULL, 0);
+  // zlib takes the length as uInt.
+  for (size_t done = 0; done < length;) {
+    uInt chunk = length - done > (1U << 30) ? (1U << 30) : length - done;
+    crc = crc32(crc, classdata + done, chunk);
+    adler = adler32(adler, classdata + done, chunk);
+    done += chunk;
+  }
+  char name[64];
+  snprintf(name, sizeof(name), "/%08lx%08lx-%zx", crc & 0xffffffffUL,
+           adler & 0xffffffffUL, length);
+  return dir_ + name;
+}
+
+bool ClassCache::Lookup(const u1* classdata, size_t length, bool* keep,
+                        u1** output, size_t* output_length) {
+  std::vector<u1> entry;
+  if (!ReadFile(EntryPath(classdata, length), &entry) ||
+      entry.size() < kHeaderSize) {
+    return false;
+  }
+  const u1* p = entry.data();
+  if (get_u4le(p) != kEntryMagic) {
+    return false;
+  }
+  u1 kept = get_u1(p);
+  u8 in_length = get_u8le(p);
+  u8 out_length = get_u8le(p);
+  if (in_length != length ||
+      entry.size() - kHeaderSize - length != out_length ||
+      memcmp(p, classdata, length) != 0) {
+    return false;
+  }
+  p += length;
+  *output = reinterpret_cast<u1*>(malloc(out_length == 0 ? 1 : out_length));
+  memcpy(*output, p, out_length);
+  *output_length = out_length;
+  *keep = kept != 0;
+  return true;
+}
+
+void ClassCache::Store(const u1* classdata, size_t length, bool keep,
+                       const u1* output, size_t output_length) {
+  std::string path = EntryPath(classdata, length);
+  std::string tmp_path = path + ".tmpXXXXXX";
+  int fd = mkstemp(&tmp_path[0]);
+  if (fd < 0) {
+    return;
+  }
+  u1 header[kHeaderSize];
+  u1* q = header;
+  put_u4le(q, kEntryMagic);
+  put_u1(q, keep ? 1 : 0);
+  put_u8le(q, length);
+  put_u8le(q, output_length);
+  bool ok = WriteFully(fd, header, sizeof(header)) &&
+            WriteFully(fd, classdata, length) &&
+            WriteFully(fd, output, output_length);
+  if (close(fd) < 0) {
+    ok = false;
+  }
+  if (!ok || rename(tmp_path.c_str(), path.c_str()) < 0) {
+    unlink(tmp_path.c_str());
+  }
+}
+
+}  // namespace devtools_ijar
@@ -0,0 +1,62 @@
+// Copyright 2015 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// class_cache.h -- on-disk cache of the stripped classes.
+//
+
+#ifndef INCLUDED_THIRD_PARTY_IJAR_CLASS_CACHE_H
+#define INCLUDED_THIRD_PARTY_IJAR_CLASS_CACHE_H
+
+#include <stddef.h>
+
+#include <string>
+
+#include "third_party/ijar/common.h"
+
+namespace devtools_ijar {
+
+// A cache of the StripClass() results, kept in a directory and keyed by the
+// contents of the input class, so that it can be shared by the ijar runs on
+// all the jars, e.g. between the rebuilds of a library. An entry holds a
+// copy of the input class, which is compared with the class being looked
+// up, so a hash collision is a miss rather than a wrong result.
+//
+// Entries are written to a temporary file which is then renamed, so the
+// cache can be used by several threads and processes at once. Failing to
+// read or write the cache is not an error: the class is stripped anyway.
+class ClassCache {
+ public:
+  explicit ClassCache(const char* dir);
+
+  // Looks up the class of given length. On a hit, returns true, and sets
+  // *keep to the result of StripClass() and *output to the stripped class,
+  // allocated with malloc(), of length *output_length.
+  bool Lookup(const u1* classdata, size_t length, bool* keep, u1** output,
+              size_t* output_length);
+
+  // Records the result of stripping the class.
+  void Store(const u1* classdata, size_t length, bool keep, const u1* output,
+             size_t output_length);
+
+ private:
+  // Returns the path of the entry for the class.
+  std::string EntryPath(const u1* classdata, size_t length);
+
+  std::string dir_;
+};
+
+}  // namespace devtools_ijar
+
+#endif  // INCLUDED_THIRD_PARTY_IJAR_CLASS_CACHE_H
@@ -32,11 +32,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
 #include <set>
 #include <sstream>
 #include <string>
 #include <vector>
 
+#include "third_party/ijar/classfile.h"
 #include "third_party/ijar/common.h"
 
 namespace {
@@ -110,21 +112,137 @@ enum TARGET_TYPE {
 
 struct Constant;
 
-// TODO(adonovan) these globals are unfortunate
-static std::vector<Constant*>        const_pool_in; // input constant pool
-static std::vector<Constant*>        const_pool_out; // output constant_pool
-static std::set<std::string>         used_class_names;
-static Constant *                    class_name;
+// A bump allocator for the objects describing a parsed class. A class is
+// made of hundreds of small objects (constants, attributes, annotations
+// and so on) which all die together when the class has been written out,
+// so instead of allocating and freeing each of them, they are carved out
+// of large chunks, and the whole lot is dropped by rewinding the arena to
+// where it was before the class was read. The chunks are kept for the
+// next class.
+class Arena {
+ public:
+  // The position of the arena, see GetMark() and Rewind().
+  struct Mark {
+    size_t chunk;
+    size_t used;
+  };
+
+  Arena() : chunk_(0), used_(0) {}
+
+  ~Arena() {
+    for (size_t i = 0; i < chunks_.size(); ++i) {
+      free(chunks_[i].start);
+    }
+  }
+
+  void *Allocate(size_t size) {
+    size = (size + kAlignment - 1) & ~(kAlignment - 1);
+    while (chunk_ < chunks_.size() && used_ + size > chunks_[chunk_].size) {
+      ++chunk_;
+      used_ = 0;
+    }
+    if (chunk_ == chunks_.size()) {
+      Chunk chunk;
+      chunk.size = size > kChunkSize ? size : kChunkSize;
+      chunk.start = reinterpret_cast<u1*>(malloc(chunk.size));
+      if (chunk.start == NULL) {
+        fprintf(stderr, "Out of memory allocating %zu bytes\n", chunk.size);
+        abort();
+      }
+      chunks_.push_back(chunk);
+    }
+    void *result = chunks_[chunk_].start + used_;
+    used_ += size;
+    return result;
+  }
+
+  Mark GetMark() const {
+    Mark mark = {chunk_, used_};
+    return mark;
+  }
+
+  // Frees everything allocated since the mark was taken.
+  void Rewind(const Mark &mark) {
+    chunk_ = mark.chunk;
+    used_ = mark.used;
+  }
+
+ private:
+  static const size_t kAlignment = 16;
+  static const size_t kChunkSize = 64 * 1024;
+
+  struct Chunk {
+    u1 *start;
+    size_t size;
+  };
+
+  std::vector<Chunk> chunks_;
+  size_t chunk_;  // The chunk being allocated from.
+  size_t used_;   // Bytes allocated from it.
+};
+
+// The arena of the calling thread.
+static thread_local Arena thread_arena;
+
+// The state of stripping a single class. StripClass() keeps one on its
+// stack and makes it the current context of the calling thread for the
+// duration of the call, so that the parsing and writing code below does
+// not have to pass it around, and the classes can be stripped on several
+// threads at once.
+struct ClassContext {
+  ClassContext()
+      : classdata(NULL), class_name(NULL),
+        arena_mark(thread_arena.GetMark()) {}
+  // Deletes the constants and releases the arena memory of the class.
+  ~ClassContext();
+
+  // The input constant pool is only indexed when the class is read: each
+  // entry is found at the offset recorded here (0 for the dummy entry and
+  // the second slot of a long or double), and its Constant is created when
+  // the entry is first used. The entries the output does not refer to,
+  // which are most of them, are never parsed.
+  const u1 *classdata;
+  std::vector<u4> const_pool_offsets;
+  std::vector<Constant*> const_pool_in;   // input constant pool
+  std::vector<Constant*> const_pool_out;  // output constant_pool
+  std::set<std::string> used_class_names;
+  Constant *class_name;
+  Arena::Mark arena_mark;
+};
+
+static thread_local ClassContext *current_context = NULL;
+
+// Returns the context of the class being stripped on this thread.
+static inline ClassContext &context() { return *current_context; }
+
+// The base of the classes describing a parsed class, which are allocated
+// in the arena. They are still deleted as usual, which runs their
+// destructors, but the memory is only reclaimed when the class is done.
+struct ArenaObject {
+  static void *operator new(size_t size) {
+    return thread_arena.Allocate(size);
+  }
+  static void operator delete(void *) {}
+};
+
+// Parses the constant pool entry at p.
+static Constant *ReadConstant(const u1 *p);
 
 // Returns the Constant object, given an index into the input constant pool.
 // Note: constant(0) == NULL; this invariant is exploited by the
 // InnerClassesAttribute, inter alia.
 inline Constant *constant(int idx) {
-  if (idx < 0 || (unsigned)idx >= const_pool_in.size()) {
+  ClassContext &class_context = context();
+  if (idx < 0 || (unsigned)idx >= class_context.const_pool_in.size()) {
     fprintf(stderr, "Illegal constant pool index: %d\n", idx);
     abort();
   }
-  return const_pool_in[idx];
+  Constant *&result = class_context.const_pool_in[idx];
+  if (result == NULL && class_context.const_pool_offsets[idx] != 0) {
+    result = ReadConstant(class_context.classdata +
+                          class_context.const_pool_offsets[idx]);
+  }
+  return result;
 }
 
 /**********************************************************************
@@ -134,7 +252,7 @@ inline Constant *constant(int idx) {
  **********************************************************************/
 
 // See sec.4.4 of JVM spec.
-struct Constant {
+struct Constant : ArenaObject {
 
   Constant(u1 tag) :
       slot_(0),
@@ -163,6 +281,7 @@ struct Constant {
   u2 slot() {
     if (slot_ == 0) {
       Keep();
+      std::vector<Constant*> &const_pool_out = context().const_pool_out;
       slot_ = const_pool_out.size(); // BugBot's "narrowing" warning
                                      // is bogus.  The number of
                                      // output constants can't exceed
@@ -183,8 +302,8 @@ struct Constant {
   u1 tag_;
 };
 
-// Extracts class names from a signature and puts them into the global
-// variable used_class_names.
+// Extracts class names from a signature and puts them into the
+// used_class_names of the current context.
 //
 // desc: the descriptor class names should be extracted from.
 // p: the position where the extraction should tart.
@@ -420,7 +539,7 @@ struct Constant_InvokeDynamic : Constant
  **********************************************************************/
 
 // See sec.4.7 of JVM spec.
-struct Attribute {
+struct Attribute : ArenaObject {
 
   virtual ~Attribute() {}
   virtual void Write(u1 *&p) = 0;
@@ -461,7 +580,7 @@ struct ExceptionsAttribute : Attribute {
 // See sec.4.7.6 of JVM spec.
 struct InnerClassesAttribute : Attribute {
 
-  struct Entry {
+  struct Entry : ArenaObject {
     Constant *inner_class_info;
     Constant *outer_class_info;
     Constant *inner_name;
@@ -499,6 +618,8 @@ struct InnerClassesAttribute : Attribute {
     int entry_count;
     int iteration = 0;
 
+    const std::set<std::string> &used_class_names =
+        context().used_class_names;
     do {
       entry_count = kept_entries.size();
       for (int i_entry = 0; i_entry < static_cast<int>(entries_.size());
@@ -507,7 +628,7 @@ struct InnerClassesAttribute : Attribute {
         if (entry->inner_class_info->Kept() ||
             used_class_names.find(entry->inner_class_info->Display()) !=
                 used_class_names.end() ||
-            entry->outer_class_info == class_name) {
+            entry->outer_class_info == context().class_name) {
           if (entry->inner_name == NULL) {
             // JVMS 4.7.6: inner_name_index is zero iff the class is anonymous
             continue;
@@ -582,7 +703,7 @@ struct EnclosingMethodAttribute : Attribute {
 
 // See sec.4.7.16.1 of JVM spec.
 // Used by AnnotationDefault and other attributes.
-struct ElementValue {
+struct ElementValue : ArenaObject {
   virtual ~ElementValue() {}
   virtual void Write(u1 *&p) = 0;
   virtual void ExtractClassNames() {}
@@ -671,7 +792,7 @@ struct ArrayTypeElementValue : ElementValue {
 };
 
 // See sec.4.7.16 of JVM spec.
-struct Annotation {
+struct Annotation : ArenaObject {
   virtual ~Annotation() {
     for (size_t i = 0; i < element_value_pairs_.size(); i++) {
       delete element_value_pairs_[i]->element_value_;
@@ -706,7 +827,7 @@ struct Annotation {
     return value;
   }
   Constant *type_;
-  struct ElementValuePair {
+  struct ElementValuePair : ArenaObject {
     Constant *element_name_;
     ElementValue *element_value_;
   };
@@ -743,7 +864,7 @@ struct Annotation {
 //   element_value_pairs[num_element_value_pairs];
 // }
 //
-struct TypeAnnotation {
+struct TypeAnnotation : ArenaObject {
   virtual ~TypeAnnotation() {
     delete target_info_;
     delete type_path_;
@@ -770,7 +891,7 @@ struct TypeAnnotation {
     return value;
   }
 
-  struct TargetInfo {
+  struct TargetInfo : ArenaObject {
     virtual ~TargetInfo() {}
     virtual void Write(u1 *&p) = 0;
   };
@@ -870,7 +991,7 @@ struct TypeAnnotation {
     }
   }
 
-  struct TypePath {
+  struct TypePath : ArenaObject {
     void Write(u1 *&p) {
       put_u1(p, path_.size());
       for (TypePathEntry entry : path_) {
@@ -1184,7 +1305,7 @@ struct MethodParametersAttribute : Attribute {
     put_u4be(payload_start, p - 4 - payload_start);  // backpatch length
   }
 
-  struct MethodParameter {
+  struct MethodParameter : ArenaObject {
     Constant *name_;
     u2 access_flags_;
   };
@@ -1218,7 +1339,7 @@ struct GeneralAttribute : Attribute {
  *                                                                    *
  **********************************************************************/
 
-struct HasAttrs {
+struct HasAttrs : ArenaObject {
   std::vector<Attribute*> attributes;
 
   void WriteAttrs(u1 *&p);
@@ -1302,6 +1423,7 @@ struct ClassFile : HasAttrs {
     put_u2be(p, major);
     put_u2be(p, minor);
 
+    const std::vector<Constant*> &const_pool_out = context().const_pool_out;
     put_u2be(p, const_pool_out.size());
     for (u2 ii = 1; ii < const_pool_out.size(); ++ii) {
       if (const_pool_out[ii] != NULL) { // NB: NULLs appear after long/double.
@@ -1428,13 +1550,79 @@ void HasAttrs::WriteAttrs(u1 *&p) {
 }
 
 // See sec.4.4 of JVM spec.
-bool ClassFile::ReadConstantPool(const u1 *&p) {
+static Constant *ReadConstant(const u1 *p) {
+  u1 tag = get_u1(p);
+  switch (tag) {
+    case CONSTANT_Class: {
+      u2 name_index = get_u2be(p);
+      return new Constant_Class(name_index);
+    }
+    case CONSTANT_FieldRef:
+    case CONSTANT_Methodref:
+    case CONSTANT_Interfacemethodref: {
+      u2 class_index = get_u2be(p);
+      u2 nti = get_u2be(p);
+      return new Constant_FMIref(tag, class_index, nti);
+    }
+    case CONSTANT_String: {
+      u2 string_index = get_u2be(p);
+      return new Constant_String(string_index);
+    }
+    case CONSTANT_NameAndType: {
+      u2 name_index = get_u2be(p);
+      u2 descriptor_index = get_u2be(p);
+      return new Constant_NameAndType(name_index, descriptor_index);
+    }
+    case CONSTANT_Utf8: {
+      u2 length = get_u2be(p);
+      return new Constant_Utf8(length, p);
+    }
+    case CONSTANT_Integer:
+    case CONSTANT_Float: {
+      u4 bytes = get_u4be(p);
+      return new Constant_IntegerOrFloat(tag, bytes);
+    }
+    case CONSTANT_Long:
+    case CONSTANT_Double: {
+      u4 high_bytes = get_u4be(p);
+      u4 low_bytes = get_u4be(p);
+      return new Constant_LongOrDouble(tag, high_bytes, low_bytes);
+    }
+    case CONSTANT_MethodHandle: {
+      u1 reference_kind = get_u1(p);
+      u2 reference_index = get_u2be(p);
+      return new Constant_MethodHandle(reference_kind, reference_index);
+    }
+    case CONSTANT_MethodType: {
+      u2 descriptor_index = get_u2be(p);
+      return new Constant_MethodType(descriptor_index);
+    }
+    case CONSTANT_InvokeDynamic: {
+      u2 bootstrap_method_attr = get_u2be(p);
+      u2 name_name_type_index = get_u2be(p);
+      return new Constant_InvokeDynamic(bootstrap_method_attr,
+                                        name_name_type_index);
+    }
+    default:
+      // ReadConstantPool() has checked the tags.
+      fprintf(stderr, "Unknown constant: %02x.\n", tag);
+      abort();
+  }
+}
 
-  const_pool_in.clear();
-  const_pool_in.push_back(NULL); // dummy first item
+// Indexes the constant pool, see ClassContext. Only the tags (and the
+// lengths of the UTF-8 strings) are read.
+bool ClassFile::ReadConstantPool(const u1 *&p) {
+  ClassContext &class_context = context();
+  std::vector<u4> &const_pool_offsets = class_context.const_pool_offsets;
+  const u1 *classdata = class_context.classdata;
 
   u2 cp_count = get_u2be(p);
+  const_pool_offsets.clear();
+  const_pool_offsets.reserve(cp_count);
+  const_pool_offsets.push_back(0);  // dummy first item
   for (int ii = 1; ii < cp_count; ++ii) {
+    const_pool_offsets.push_back(p - classdata);
     u1 tag = get_u1(p);
 
     if (devtools_ijar::verbose) {
@@ -1442,80 +1630,41 @@ bool ClassFile::ReadConstantPool(const u1 *&p) {
     }
 
     switch(tag) {
-      case CONSTANT_Class: {
-        u2 name_index = get_u2be(p);
-        const_pool_in.push_back(new Constant_Class(name_index));
+      case CONSTANT_Class:
+      case CONSTANT_String:
+      case CONSTANT_MethodType:
+        p += 2;
+        break;
+      case CONSTANT_MethodHandle:
+        p += 3;
         break;
-      }
       case CONSTANT_FieldRef:
       case CONSTANT_Methodref:
-      case CONSTANT_Interfacemethodref: {
-        u2 class_index = get_u2be(p);
-        u2 nti = get_u2be(p);
-        const_pool_in.push_back(new Constant_FMIref(tag, class_index, nti));
-        break;
-      }
-      case CONSTANT_String: {
-        u2 string_index = get_u2be(p);
-        const_pool_in.push_back(new Constant_String(string_index));
-        break;
-      }
-      case CONSTANT_NameAndType: {
-        u2 name_index = get_u2be(p);
-        u2 descriptor_index = get_u2be(p);
-        const_pool_in.push_back(
-            new Constant_NameAndType(name_index, descriptor_index));
+      case CONSTANT_Interfacemethodref:
+      case CONSTANT_NameAndType:
+      case CONSTANT_Integer:
+      case CONSTANT_Float:
+      case CONSTANT_InvokeDynamic:
+        p += 4;
         break;
-      }
       case CONSTANT_Utf8: {
         u2 length = get_u2be(p);
         if (devtools_ijar::verbose) {
           fprintf(stderr, "Utf8: \"%s\" (%d)\n",
                   std::string((const char*) p, length).c_str(), length);
         }
-
-        const_pool_in.push_back(new Constant_Utf8(length, p));
         p += length;
         break;
       }
-      case CONSTANT_Integer:
-      case CONSTANT_Float: {
-        u4 bytes = get_u4be(p);
-        const_pool_in.push_back(new Constant_IntegerOrFloat(tag, bytes));
-        break;
-      }
       case CONSTANT_Long:
-      case CONSTANT_Double: {
-        u4 high_bytes = get_u4be(p);
-        u4 low_bytes = get_u4be(p);
-        const_pool_in.push_back(
-            new Constant_LongOrDouble(tag, high_bytes, low_bytes));
+      case CONSTANT_Double:
+        p += 8;
         // Longs and doubles occupy two constant pool slots.
         // ("In retrospect, making 8-byte constants take two "constant
         // pool entries was a poor choice." --JVM Spec.)
-        const_pool_in.push_back(NULL);
+        const_pool_offsets.push_back(0);
         ii++;
         break;
-      }
-      case CONSTANT_MethodHandle: {
-        u1 reference_kind = get_u1(p);
-        u2 reference_index = get_u2be(p);
-        const_pool_in.push_back(
-            new Constant_MethodHandle(reference_kind, reference_index));
-        break;
-      }
-      case CONSTANT_MethodType: {
-        u2 descriptor_index = get_u2be(p);
-        const_pool_in.push_back(new Constant_MethodType(descriptor_index));
-        break;
-      }
-      case CONSTANT_InvokeDynamic: {
-        u2 bootstrap_method_attr = get_u2be(p);
-        u2 name_name_type_index = get_u2be(p);
-        const_pool_in.push_back(new Constant_InvokeDynamic(
-            bootstrap_method_attr, name_name_type_index));
-        break;
-      }
       default: {
         fprintf(stderr, "Unknown constant: %02x. Passing class through.\n",
                 tag);
@@ -1524,6 +1673,7 @@ bool ClassFile::ReadConstantPool(const u1 *&p) {
     }
   }
 
+  class_context.const_pool_in.assign(const_pool_offsets.size(), NULL);
   return true;
 }
 
@@ -1553,6 +1703,7 @@ static ClassFile *ReadClass(const void *classdata, size_t length) {
   clazz->major = get_u2be(p);
   clazz->minor = get_u2be(p);
 
+  context().classdata = static_cast<const u1*>(classdata);
   if (!clazz->ReadConstantPool(p)) {
     delete clazz;
     return NULL;
@@ -1560,7 +1711,7 @@ static ClassFile *ReadClass(const void *classdata, size_t length) {
 
   clazz->access_flags = get_u2be(p);
   clazz->this_class = constant(get_u2be(p));
-  class_name = clazz->this_class;
+  context().class_name = clazz->this_class;
 
   u2 super_class_id = get_u2be(p);
   clazz->super_class = super_class_id == 0 ? NULL : constant(super_class_id);
@@ -1656,7 +1807,7 @@ void ParseClassTypeSignatureSuffix(const std::string& desc, size_t* p) {
 void ParseIdentifier(const std::string& desc, size_t* p) {
   size_t next = desc.find_first_of(SIGNATURE_NON_IDENTIFIER_CHARS, *p);
   std::string id = desc.substr(*p, next - *p);
-  used_class_names.insert(id);
+  context().used_class_names.insert(id);
   *p = next;
 }
 
@@ -1759,7 +1910,7 @@ void ExtractClassNames(const std::string& desc, size_t* p) {
 }
 
 void ClassFile::WriteClass(u1 *&p) {
-  used_class_names.clear();
+  context().used_class_names.clear();
   std::vector<Member *> members;
   members.insert(members.end(), fields.begin(), fields.end());
   members.insert(members.end(), methods.begin(), methods.end());
@@ -1782,7 +1933,17 @@ void ClassFile::WriteClass(u1 *&p) {
   delete[] body;
 }
 
+ClassContext::~ClassContext() {
+  for (size_t i = 0; i < const_pool_in.size(); i++) {
+    delete const_pool_in[i];
+  }
+  thread_arena.Rewind(arena_mark);
+}
+
 bool StripClass(u1 *&classdata_out, const u1 *classdata_in, size_t in_length) {
+  ClassContext class_context;
+  ClassContext *previous_context = current_context;
+  current_context = &class_context;
   ClassFile *clazz = ReadClass(classdata_in, in_length);
   bool keep = true;
   if (clazz == NULL) {
@@ -1790,26 +1951,50 @@ bool StripClass(u1 *&classdata_out, const u1 *classdata_in, size_t in_length) {
     put_n(classdata_out, classdata_in, in_length);
   } else if (clazz->IsLocalOrAnonymous()) {
     keep = false;
+    delete clazz;
   } else {
 
     // Constant pool item zero is a dummy entry.  Setting it marks the
     // beginning of the output phase; calls to Constant::slot() will
     // fail if called prior to this.
-    const_pool_out.push_back(NULL);
+    context().const_pool_out.push_back(NULL);
     clazz->WriteClass(classdata_out);
 
     delete clazz;
   }
 
-  // Now clean up all the mess we left behind.
+  // The context cleans up all the mess we left behind.
+  current_context = previous_context;
+  return keep;
+}
 
-  for (size_t i = 0; i < const_pool_in.size(); i++) {
-    delete const_pool_in[i];
+bool CanonicalizeClass(u1 *&canonical_out, const u1 *classdata_in,
+                       size_t in_length) {
+  ClassContext class_context;
+  ClassContext *previous_context = current_context;
+  current_context = &class_context;
+  ClassFile *clazz = ReadClass(classdata_in, in_length);
+  bool canonical = clazz != NULL;
+  if (canonical) {
+    auto by_name_and_descriptor = [](Member *a, Member *b) {
+      std::string a_name = a->name->Display();
+      std::string b_name = b->name->Display();
+      return a_name < b_name ||
+             (a_name == b_name &&
+              a->descriptor->Display() < b->descriptor->Display());
+    };
+    std::sort(clazz->fields.begin(), clazz->fields.end(),
+              by_name_and_descriptor);
+    std::sort(clazz->methods.begin(), clazz->methods.end(),
+              by_name_and_descriptor);
+    // The output constant pool is numbered in the order the constants are
+    // first used, so that it follows the order of the members, too.
+    context().const_pool_out.push_back(NULL);
+    clazz->WriteClass(canonical_out);
+    delete clazz;
   }
-
-  const_pool_in.clear();
-  const_pool_out.clear();
-  return keep;
+  current_context = previous_context;
+  return canonical;
 }
 
 }  // namespace devtools_ijar
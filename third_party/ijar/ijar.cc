@@ -20,38 +20,192 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <condition_variable>  // NOLINT
+#include <deque>
+#include <map>
 #include <memory>
+#include <mutex>  // NOLINT
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
 
+#include "src/main/cpp/util/sha256.h"
+#include "third_party/ijar/class_cache.h"
+#include "third_party/ijar/classfile.h"
+#include "third_party/ijar/worker.h"
 #include "third_party/ijar/zip.h"
 
 namespace devtools_ijar {
 
 bool verbose = false;
 
-// Reads a JVM class from classdata_in (of the specified length), and
-// writes out a simplified class to classdata_out, advancing the
-// pointer. Returns true if the class should be kept.
-bool StripClass(u1*& classdata_out, const u1* classdata_in, size_t in_length);
-
 const char* CLASS_EXTENSION = ".class";
 const size_t CLASS_EXTENSION_LENGTH = strlen(CLASS_EXTENSION);
 
+// With --abi_digest, the ABI digest of x_interface.jar is written to
+// x_interface.jar.abi, in hex followed by a newline.
+const char* ABI_DIGEST_SUFFIX = ".abi";
+
+// The class index (see --class_index) is stored as the last entry of the
+// interface jar, so that the classes can be found with a binary search
+// instead of a scan of the whole jar. It is little endian:
+//
+//   header:  8-byte magic "IJINDEX1", u4 entry count, u4 0 (reserved),
+//            u8 size of the strings
+//   entries: u4 name offset, u4 name length, u8 local header offset of the
+//            class in the interface jar, or CLASS_INDEX_DROPPED for the
+//            local and anonymous classes that were left out; sorted by name
+//   strings: the class names without ".class", e.g. "com/foo/Bar$Baz", not
+//            NUL-terminated
+const char* CLASS_INDEX_NAME = "META-INF/ijar-classes.index";
+const u1 CLASS_INDEX_MAGIC[8] = {'I', 'J', 'I', 'N', 'D', 'E', 'X', '1'};
+const u8 CLASS_INDEX_DROPPED = ~static_cast<u8>(0);
+const size_t CLASS_INDEX_HEADER_SIZE = 24;
+const size_t CLASS_INDEX_ENTRY_SIZE = 16;
+
+// A class of the class index.
+struct IndexedClass {
+  std::string name;
+  u8 offset;
+
+  bool operator<(const IndexedClass& other) const {
+    return name < other.name;
+  }
+};
+
+// The ABI digest of a class (see --abi_digest): the SHA-256 of the canonical
+// form of the stripped class, which does not depend on the order of its
+// members. The digest of an interface jar is the SHA-256 of the names and
+// digests of its classes, sorted by name, so that it does not depend on the
+// order of the classes or on the metadata of the jar either.
+struct ClassAbi {
+  std::string name;
+  std::string digest;
+
+  bool operator<(const ClassAbi& other) const {
+    return name < other.name;
+  }
+};
+
+// Returns the ABI digest of the stripped class, or that of the class as it
+// is if it cannot be parsed.
+static std::string ClassAbiDigest(const u1* classdata, size_t length) {
+  std::vector<u1> canonical(length);
+  u1* p = canonical.data();
+  blaze_util::Sha256Digest digest;
+  if (CanonicalizeClass(p, classdata, length)) {
+    digest.Update(canonical.data(), p - canonical.data());
+  } else {
+    digest.Update(classdata, length);
+  }
+  unsigned char result[blaze_util::Sha256Digest::kDigestLength];
+  digest.Finish(result);
+  return std::string(reinterpret_cast<char*>(result), sizeof(result));
+}
+
+// Returns the ABI digest of an interface jar with given classes, in hex.
+static std::string JarAbiDigest(std::vector<ClassAbi>* classes) {
+  std::sort(classes->begin(), classes->end());
+  blaze_util::Sha256Digest digest;
+  for (const ClassAbi& class_abi : *classes) {
+    digest.Update(class_abi.name.data(), class_abi.name.size() + 1);
+    digest.Update(class_abi.digest.data(), class_abi.digest.size());
+  }
+  unsigned char result[blaze_util::Sha256Digest::kDigestLength];
+  digest.Finish(result);
+  return digest.String();
+}
+
 // ZipExtractorProcessor that select only .class file and use
 // StripClass to generate an interface class, storing as a new file
 // in the specified ZipBuilder.
+//
+// With more than one thread, the classes are inflated and stripped by a
+// pool of worker threads, and the results are added to the ZipBuilder in
+// the order of the input, so the output does not depend on the number of
+// threads. Call Flush() once all the files have been processed.
+//
+// With a ClassCache, the classes found there are not parsed again.
 class JarStripperProcessor : public ZipExtractorProcessor {
  public:
-  JarStripperProcessor() {}
-  virtual ~JarStripperProcessor() {}
+  // The cache, if any, is not owned by JarStripperProcessor.
+  explicit JarStripperProcessor(int threads = 1, ClassCache* cache = NULL);
+  virtual ~JarStripperProcessor();
 
   virtual void Process(const char* filename, const u4 attr,
                        const u1* data, const size_t size);
+  virtual bool ProcessCompressed(const char* filename, const u4 attr,
+                                 const u1* data, const size_t compressed_size,
+                                 const size_t uncompressed_size);
   virtual bool Accept(const char* filename, const u4 attr);
 
+  // Adds the classes still being stripped to the ZipBuilder.
+  void Flush();
+
+  // Records the classes written to the ZipBuilder, and the ones dropped, in
+  // "index" unless it is NULL. The index is not owned by JarStripperProcessor.
+  void SetClassIndex(std::vector<IndexedClass>* index) { index_ = index; }
+
+  // Records the ABI digests of the classes written to the ZipBuilder in
+  // "abi" unless it is NULL. The vector is not owned by JarStripperProcessor.
+  void SetAbi(std::vector<ClassAbi>* abi) { abi_ = abi; }
+
  private:
+  // A class to be stripped by a worker thread.
+  struct Job {
+    std::string filename;
+    std::vector<u1> data;  // The class file, deflated if "compressed".
+    bool compressed;
+    size_t size;           // The length of the class file.
+    u1* output;            // The stripped class, allocated with malloc().
+    size_t output_length;
+    bool keep;             // The result of StripClass().
+    bool abi;              // Whether to compute "abi_digest".
+    std::string abi_digest;
+    bool failed;           // True if the class could not be inflated.
+    bool done;
+  };
+
+  // Queues the job, adding the oldest results to the ZipBuilder if there
+  // are too many pending.
+  void Submit(Job* job);
+  // Waits for the oldest job and adds its result to the ZipBuilder.
+  void WriteOldest();
+  // Inflates and strips the class.
+  void Strip(Job* job, Inflater* inflater);
+  // Strips the class, or takes the result from the cache. Returns the
+  // result of StripClass(), *output is allocated with malloc().
+  bool StripOrLookup(const u1* classdata, size_t length, u1** output,
+                     size_t* output_length);
+  // Worker thread body.
+  void StripLoop();
+  // Adds the class to the index, if any, at the current output offset
+  // unless it is not kept. Call it before adding the class to the ZipBuilder.
+  void AddToIndex(const char* filename, bool keep);
+  // Adds the ABI digest of the class, if it is kept, to "abi_" if set.
+  void AddToAbi(const char* filename, bool keep, const std::string& digest);
+
   // Not owned by JarStripperProcessor, see SetZipBuilder().
   ZipBuilder* builder;
 
+  std::vector<IndexedClass>* index_;
+  std::vector<ClassAbi>* abi_;
+  ClassCache* cache_;
+  const size_t max_pending_;
+  // Submitted jobs in the input order, and the ones not picked up by a
+  // worker yet.
+  std::deque<std::unique_ptr<Job> > jobs_;
+  std::deque<Job*> unstarted_;
+  bool stopping_;
+  std::mutex mutex_;
+  std::condition_variable submitted_cond_;
+  std::condition_variable done_cond_;
+  std::vector<std::thread> workers_;
+
  public:
   // Set the ZipBuilder to add the ijar class to the output zip file.
   // This pointer should not be deleted while this class is still in use and
@@ -61,6 +215,31 @@ class JarStripperProcessor : public ZipExtractorProcessor {
   }
 };
 
+JarStripperProcessor::JarStripperProcessor(int threads, ClassCache* cache)
+    : builder(NULL), index_(NULL), abi_(NULL), cache_(cache),
+      max_pending_(4 * threads),
+      stopping_(false) {
+  if (threads > 1) {
+    for (int i = 0; i < threads; ++i) {
+      workers_.emplace_back(&JarStripperProcessor::StripLoop, this);
+    }
+  }
+}
+
+JarStripperProcessor::~JarStripperProcessor() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  submitted_cond_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+  for (auto& job : jobs_) {
+    free(job->output);
+  }
+}
+
 bool JarStripperProcessor::Accept(const char* filename, const u4 attr) {
   ssize_t offset = strlen(filename) - CLASS_EXTENSION_LENGTH;
   if (offset >= 0) {
@@ -74,53 +253,294 @@ void JarStripperProcessor::Process(const char* filename, const u4 attr,
   if (verbose) {
     fprintf(stderr, "INFO: StripClass: %s\n", filename);
   }
-  u1* buf = reinterpret_cast<u1*>(malloc(size));
-  u1* classdata_out = buf;
-  if (!StripClass(buf, data, size)) {
+  if (!workers_.empty()) {
+    Job* job = new Job();
+    job->filename = filename;
+    job->data.assign(data, data + size);
+    job->compressed = false;
+    job->size = size;
+    Submit(job);
+    return;
+  }
+  u1* classdata_out;
+  size_t out_length;
+  bool keep = StripOrLookup(data, size, &classdata_out, &out_length);
+  AddToIndex(filename, keep);
+  if (abi_ != NULL && keep) {
+    AddToAbi(filename, keep, ClassAbiDigest(classdata_out, out_length));
+  }
+  if (!keep) {
     free(classdata_out);
     return;
   }
-  u1* q = builder->NewFile(filename, 0);
-  size_t out_length = buf - classdata_out;
+  u1* q = builder->NewFile(filename, 0, out_length);
+  if (q == NULL) {
+    fprintf(stderr, "%s\n", builder->GetError());
+    abort();
+  }
   memcpy(q, classdata_out, out_length);
   builder->FinishFile(out_length);
   free(classdata_out);
 }
 
+bool JarStripperProcessor::ProcessCompressed(const char* filename,
+                                             const u4 attr, const u1* data,
+                                             const size_t compressed_size,
+                                             const size_t uncompressed_size) {
+  if (workers_.empty()) {
+    return false;
+  }
+  if (verbose) {
+    fprintf(stderr, "INFO: StripClass: %s\n", filename);
+  }
+  // The input may be unmapped before the job is done, so it is copied.
+  Job* job = new Job();
+  job->filename = filename;
+  job->data.assign(data, data + compressed_size);
+  job->compressed = true;
+  job->size = uncompressed_size;
+  Submit(job);
+  return true;
+}
+
+void JarStripperProcessor::Flush() {
+  while (!jobs_.empty()) {
+    WriteOldest();
+  }
+}
+
+void JarStripperProcessor::Submit(Job* job) {
+  job->output = NULL;
+  job->output_length = 0;
+  job->keep = false;
+  job->abi = abi_ != NULL;
+  job->failed = false;
+  job->done = false;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    jobs_.emplace_back(job);
+    unstarted_.push_back(job);
+  }
+  submitted_cond_.notify_one();
+  while (jobs_.size() > max_pending_) {
+    WriteOldest();
+  }
+}
+
+void JarStripperProcessor::WriteOldest() {
+  std::unique_ptr<Job> job;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cond_.wait(lock, [this] { return jobs_.front()->done; });
+    job = std::move(jobs_.front());
+    jobs_.pop_front();
+  }
+  if (job->failed) {
+    fprintf(stderr, "Unable to inflate %s\n", job->filename.c_str());
+    abort();
+  }
+  AddToIndex(job->filename.c_str(), job->keep);
+  AddToAbi(job->filename.c_str(), job->keep, job->abi_digest);
+  if (job->keep) {
+    u1* q = builder->NewFile(job->filename.c_str(), 0, job->output_length);
+    if (q == NULL) {
+      fprintf(stderr, "%s\n", builder->GetError());
+      abort();
+    }
+    memcpy(q, job->output, job->output_length);
+    builder->FinishFile(job->output_length);
+  }
+  free(job->output);
+}
+
+void JarStripperProcessor::AddToIndex(const char* filename, bool keep) {
+  if (index_ == NULL) {
+    return;
+  }
+  IndexedClass indexed_class;
+  indexed_class.name.assign(filename,
+                            strlen(filename) - CLASS_EXTENSION_LENGTH);
+  indexed_class.offset = keep ? builder->GetSize() : CLASS_INDEX_DROPPED;
+  index_->push_back(indexed_class);
+}
+
+void JarStripperProcessor::AddToAbi(const char* filename, bool keep,
+                                    const std::string& digest) {
+  if (abi_ == NULL || !keep) {
+    return;
+  }
+  ClassAbi class_abi;
+  class_abi.name.assign(filename, strlen(filename) - CLASS_EXTENSION_LENGTH);
+  class_abi.digest = digest;
+  abi_->push_back(class_abi);
+}
+
+void JarStripperProcessor::Strip(Job* job, Inflater* inflater) {
+  const u1* classdata = job->data.data();
+  std::vector<u1> inflated;
+  if (job->compressed) {
+    if (!inflater->Inflate(job->data.data(), job->data.size(), job->size,
+                           &inflated)) {
+      job->failed = true;
+      return;
+    }
+    // The size recorded in the ZIP may be wrong.
+    classdata = inflated.data();
+    job->size = inflated.size();
+  }
+  job->keep = StripOrLookup(classdata, job->size, &job->output,
+                            &job->output_length);
+  if (job->abi && job->keep) {
+    job->abi_digest = ClassAbiDigest(job->output, job->output_length);
+  }
+}
+
+bool JarStripperProcessor::StripOrLookup(const u1* classdata, size_t length,
+                                         u1** output, size_t* output_length) {
+  bool keep;
+  if (cache_ != NULL &&
+      cache_->Lookup(classdata, length, &keep, output, output_length)) {
+    return keep;
+  }
+  u1* buf = reinterpret_cast<u1*>(malloc(length));
+  *output = buf;
+  keep = StripClass(buf, classdata, length);
+  *output_length = buf - *output;
+  if (cache_ != NULL) {
+    cache_->Store(classdata, length, keep, *output, *output_length);
+  }
+  return keep;
+}
+
+void JarStripperProcessor::StripLoop() {
+  Inflater inflater;
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    submitted_cond_.wait(lock,
+                         [this] { return stopping_ || !unstarted_.empty(); });
+    if (unstarted_.empty()) {
+      return;
+    }
+    Job* job = unstarted_.front();
+    unstarted_.pop_front();
+    lock.unlock();
+    Strip(job, &inflater);
+    lock.lock();
+    job->done = true;
+    done_cond_.notify_all();
+  }
+}
+
+// Sorts the index and adds it to the ZIP as a stored file.
+static void WriteClassIndex(std::vector<IndexedClass>* index,
+                            ZipBuilder* out) {
+  std::sort(index->begin(), index->end());
+  u8 strings_size = 0;
+  for (const IndexedClass& indexed_class : *index) {
+    strings_size += indexed_class.name.size();
+  }
+  if (strings_size > 0xffffffff || index->size() > 0xffffffff) {
+    fprintf(stderr, "Too many classes for the class index\n");
+    abort();
+  }
+  size_t length = CLASS_INDEX_HEADER_SIZE +
+                  CLASS_INDEX_ENTRY_SIZE * index->size() + strings_size;
+  u1* q = out->NewFile(CLASS_INDEX_NAME, 0, length);
+  if (q == NULL) {
+    fprintf(stderr, "%s\n", out->GetError());
+    abort();
+  }
+  u1* p = q;
+  put_n(p, CLASS_INDEX_MAGIC, sizeof(CLASS_INDEX_MAGIC));
+  put_u4le(p, index->size());
+  put_u4le(p, 0);
+  put_u8le(p, strings_size);
+  u4 name_offset = 0;
+  for (const IndexedClass& indexed_class : *index) {
+    put_u4le(p, name_offset);
+    put_u4le(p, indexed_class.name.size());
+    put_u8le(p, indexed_class.offset);
+    name_offset += indexed_class.name.size();
+  }
+  for (const IndexedClass& indexed_class : *index) {
+    put_n(p, reinterpret_cast<const u1*>(indexed_class.name.data()),
+          indexed_class.name.size());
+  }
+  if (out->FinishFile(length, false, true) < 0) {
+    fprintf(stderr, "%s\n", out->GetError());
+    abort();
+  }
+}
+
+// Adds the classes still being stripped by "processor" to "out", then the
+// class index unless "index" is NULL, and finishes the jar. Unless "abi" is
+// NULL, sets "abi_digest" to the ABI digest of the jar.
+static void FinishInterfaceJar(JarStripperProcessor* processor,
+                               ZipBuilder* out,
+                               std::vector<IndexedClass>* index,
+                               std::vector<ClassAbi>* abi,
+                               std::string* abi_digest) {
+  processor->Flush();
+  processor->SetClassIndex(NULL);
+  processor->SetAbi(NULL);
+  if (abi != NULL) {
+    *abi_digest = JarAbiDigest(abi);
+  }
+
+  // Add dummy file, since javac doesn't like truly empty jars.
+  if (out->GetNumberFiles() == 0) {
+    out->WriteEmptyFile("dummy");
+  }
+  if (index != NULL) {
+    WriteClassIndex(index, out);
+  }
+  // Finish writing the output file
+  if (out->Finish() < 0) {
+    fprintf(stderr, "%s\n", out->GetError());
+    abort();
+  }
+  processor->SetZipBuilder(NULL);
+}
+
 // Opens "file_in" (a .jar file) for reading, and writes an interface
-// .jar to "file_out".
-void OpenFilesAndProcessJar(const char *file_out, const char *file_in) {
-  JarStripperProcessor processor;
-  std::unique_ptr<ZipExtractor> in(ZipExtractor::Create(file_in, &processor));
+// .jar to "file_out", stripping the classes with given processor, which
+// can be used for more jars afterwards. The data of the classes is aligned
+// to "alignment" bytes unless it is 0. With "class_index", the index of the
+// classes is added to the output as its last file. Unless "abi_digest" is
+// NULL, it is set to the ABI digest of the output.
+void OpenFilesAndProcessJar(const char *file_out, const char *file_in,
+                            JarStripperProcessor* processor, u2 alignment,
+                            bool class_index, std::string* abi_digest) {
+  std::unique_ptr<ZipExtractor> in(ZipExtractor::Create(file_in, processor));
   if (in.get() == NULL) {
     fprintf(stderr, "Unable to open Zip file %s: %s\n", file_in,
             strerror(errno));
     abort();
   }
-  u8 output_length = in->CalculateOutputLength();
-  std::unique_ptr<ZipBuilder> out(ZipBuilder::Create(file_out, output_length));
+  std::unique_ptr<ZipBuilder> out(ZipBuilder::CreateStreaming(file_out));
   if (out.get() == NULL) {
     fprintf(stderr, "Unable to open output file %s: %s\n", file_out,
             strerror(errno));
     abort();
   }
-  processor.SetZipBuilder(out.get());
+  out->SetAlignment(alignment);
+  processor->SetZipBuilder(out.get());
+  std::vector<IndexedClass> index;
+  if (class_index) {
+    processor->SetClassIndex(&index);
+  }
+  std::vector<ClassAbi> abi;
+  if (abi_digest != NULL) {
+    processor->SetAbi(&abi);
+  }
 
   // Process all files in the zip
   if (in->ProcessAll() < 0) {
     fprintf(stderr, "%s\n", in->GetError());
     abort();
   }
-
-  // Add dummy file, since javac doesn't like truly empty jars.
-  if (out->GetNumberFiles() == 0) {
-    out->WriteEmptyFile("dummy");
-  }
-  // Finish writing the output file
-  if (out->Finish() < 0) {
-    fprintf(stderr, "%s\n", out->GetError());
-    abort();
-  }
+  FinishInterfaceJar(processor, out.get(), class_index ? &index : NULL,
+                     abi_digest != NULL ? &abi : NULL, abi_digest);
   // Get all file size
   size_t in_length = in->GetSize();
   size_t out_length = out->GetSize();
@@ -131,24 +551,436 @@ void OpenFilesAndProcessJar(const char *file_out, const char *file_in) {
   }
 }
 
+// Reads the whole file into "contents", returns false on errors.
+static bool ReadFile(const char* path, std::string* contents) {
+  FILE* fp = fopen(path, "rb");
+  if (fp == NULL) {
+    return false;
+  }
+  char buffer[65536];
+  size_t n;
+  contents->clear();
+  while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+    contents->append(buffer, n);
+  }
+  bool ok = !ferror(fp);
+  fclose(fp);
+  return ok;
+}
+
+// Adds the files and directories under "dir" (relative to "root", empty or
+// ending with '/') to "entries", sorted, the directories with a trailing '/'
+// and before their contents.
+static void ListClassesDir(const std::string& root, const std::string& dir,
+                           std::vector<std::string>* entries) {
+  std::string path = root + "/" + dir;
+  DIR* d = opendir(path.c_str());
+  if (d == NULL) {
+    fprintf(stderr, "Unable to open directory %s: %s\n", path.c_str(),
+            strerror(errno));
+    abort();
+  }
+  std::vector<std::string> names;
+  struct dirent* ent;
+  while ((ent = readdir(d)) != NULL) {
+    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+      continue;
+    }
+    std::string name = dir + ent->d_name;
+    struct stat st;
+    if (stat((root + "/" + name).c_str(), &st) < 0) {
+      fprintf(stderr, "Unable to stat %s/%s: %s\n", root.c_str(),
+              name.c_str(), strerror(errno));
+      abort();
+    }
+    if (S_ISDIR(st.st_mode)) {
+      name += '/';
+    }
+    names.push_back(name);
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+  for (const std::string& name : names) {
+    entries->push_back(name);
+    if (name.back() == '/') {
+      ListClassesDir(root, name, entries);
+    }
+  }
+}
+
+// Adds a deflated file with given contents to "out".
+static void AddFullJarFile(ZipBuilder* out, const char* filename,
+                           const std::string& contents) {
+  u1* q = out->NewFile(filename, 0, contents.size());
+  if (q == NULL) {
+    fprintf(stderr, "%s\n", out->GetError());
+    abort();
+  }
+  memcpy(q, contents.data(), contents.size());
+  if (out->FinishFile(contents.size(), true, true) < 0) {
+    fprintf(stderr, "%s\n", out->GetError());
+    abort();
+  }
+}
+
+// Packages the output of javac in "classes_dir" into the jar "full_jar" and
+// writes its interface jar to "interface_jar" in the same pass, so that each
+// class is read once and the full jar is never read back, as it would be by
+// a separate ijar run. The full jar starts with the manifest of the
+// directory, or a default one like JarCreator's, and its files are deflated
+// and sorted by path. The other arguments are as for OpenFilesAndProcessJar.
+void PackageClassesDir(const char* full_jar, const char* interface_jar,
+                       const char* classes_dir,
+                       JarStripperProcessor* processor, u2 alignment,
+                       bool class_index, std::string* abi_digest) {
+  std::unique_ptr<ZipBuilder> full(ZipBuilder::CreateStreaming(full_jar));
+  if (full.get() == NULL) {
+    fprintf(stderr, "Unable to open output file %s: %s\n", full_jar,
+            strerror(errno));
+    abort();
+  }
+  std::unique_ptr<ZipBuilder> out(ZipBuilder::CreateStreaming(interface_jar));
+  if (out.get() == NULL) {
+    fprintf(stderr, "Unable to open output file %s: %s\n", interface_jar,
+            strerror(errno));
+    abort();
+  }
+  out->SetAlignment(alignment);
+  processor->SetZipBuilder(out.get());
+  std::vector<IndexedClass> index;
+  if (class_index) {
+    processor->SetClassIndex(&index);
+  }
+  std::vector<ClassAbi> abi;
+  if (abi_digest != NULL) {
+    processor->SetAbi(&abi);
+  }
+
+  std::vector<std::string> entries;
+  ListClassesDir(classes_dir, "", &entries);
+  static const char kManifestName[] = "META-INF/MANIFEST.MF";
+  std::string contents;
+  std::string manifest_path = std::string(classes_dir) + "/" + kManifestName;
+  if (!ReadFile(manifest_path.c_str(), &contents)) {
+    contents = "Manifest-Version: 1.0\r\nCreated-By: blaze\r\n\r\n";
+  }
+  if (full->WriteEmptyFile("META-INF/") < 0) {
+    fprintf(stderr, "%s\n", full->GetError());
+    abort();
+  }
+  AddFullJarFile(full.get(), kManifestName, contents);
+
+  size_t in_length = 0;
+  for (const std::string& entry : entries) {
+    const char* filename = entry.c_str();
+    if (entry == "META-INF/" || entry == kManifestName) {
+      continue;
+    }
+    if (entry.back() == '/') {
+      if (full->WriteEmptyFile(filename) < 0) {
+        fprintf(stderr, "%s\n", full->GetError());
+        abort();
+      }
+      continue;
+    }
+    std::string path = std::string(classes_dir) + "/" + entry;
+    if (!ReadFile(path.c_str(), &contents)) {
+      fprintf(stderr, "Unable to read %s: %s\n", path.c_str(),
+              strerror(errno));
+      abort();
+    }
+    in_length += contents.size();
+    AddFullJarFile(full.get(), filename, contents);
+    if (processor->Accept(filename, 0)) {
+      processor->Process(filename, 0,
+                         reinterpret_cast<const u1*>(contents.data()),
+                         contents.size());
+    }
+  }
+  if (full->Finish() < 0) {
+    fprintf(stderr, "%s\n", full->GetError());
+    abort();
+  }
+  FinishInterfaceJar(processor, out.get(), class_index ? &index : NULL,
+                     abi_digest != NULL ? &abi : NULL, abi_digest);
+  if (verbose) {
+    fprintf(stderr, "INFO: produced jars: %s -> %s, %s (%d%%).\n",
+            classes_dir, full_jar, interface_jar,
+            in_length == 0 ? 100 :
+                static_cast<int>(100.0 * out->GetSize() / in_length));
+  }
+}
+
+// Reads the jars to process from the file: one path per line, an input
+// jar followed by its interface jar.
+static void ReadBatchFile(const char* batch_file,
+                          std::vector<std::string>* jars) {
+  FILE* fp = fopen(batch_file, "r");
+  if (fp == NULL) {
+    fprintf(stderr, "Unable to open %s: %s\n", batch_file, strerror(errno));
+    exit(1);
+  }
+  char line[PATH_MAX + 2];
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    size_t len = strlen(line);
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      line[--len] = 0;
+    }
+    if (len > 0) {
+      jars->push_back(line);
+    }
+  }
+  fclose(fp);
+  if (jars->size() % 2 != 0) {
+    fprintf(stderr, "%s: no interface jar for %s\n", batch_file,
+            jars->back().c_str());
+    exit(1);
+  }
+}
+
+// The interface jars made by a persistent worker, keyed by the digest of
+// the input jar, as sent in the WorkRequest, and the options that change
+// the output. Bazel sends the same input jars again and again, e.g. when
+// only one of the libraries of a target changed, and their interface jars
+// are then copied from here without reading the input jars at all. Holds
+// at most kMaxSize bytes of jars, dropping the oldest ones first.
+class InterfaceJarCache {
+ public:
+  InterfaceJarCache() : size_(0) {}
+
+  // Looks up the interface jar for "key", returns NULL on a miss.
+  const std::string* Lookup(const std::string& key) const {
+    auto it = jars_.find(key);
+    return it == jars_.end() ? NULL : &it->second;
+  }
+
+  void Store(const std::string& key, std::string* jar) {
+    if (jar->size() > kMaxSize || jars_.count(key) > 0) {
+      return;
+    }
+    while (size_ + jar->size() > kMaxSize) {
+      auto oldest = jars_.find(order_.front());
+      size_ -= oldest->second.size();
+      jars_.erase(oldest);
+      order_.pop_front();
+    }
+    size_ += jar->size();
+    jars_[key].swap(*jar);
+    order_.push_back(key);
+  }
+
+ private:
+  static const size_t kMaxSize = 256 << 20;
+
+  std::map<std::string, std::string> jars_;
+  std::deque<std::string> order_;
+  size_t size_;
+};
+
+// Writes "contents" to the file, returns false on errors.
+static bool WriteFile(const char* path, const std::string& contents) {
+  FILE* fp = fopen(path, "wb");
+  if (fp == NULL) {
+    return false;
+  }
+  bool ok = fwrite(contents.data(), 1, contents.size(), fp) ==
+            contents.size();
+  return fclose(fp) == 0 && ok;
+}
+
+// Processes the input jars listed in "batch_file" (or just "file_in" if it
+// is NULL), see OpenFilesAndProcessJar(). The jars share the worker threads
+// and the cache. With "jar_cache", the input jars which have a digest in
+// "inputs" have their interface jar looked up there before being read. With
+// "abi_digest", the ABI digest of each interface jar is written next to it,
+// to its path with ABI_DIGEST_SUFFIX appended.
+static void ProcessJars(const char* batch_file, const char* file_out,
+                        const char* file_in, int threads,
+                        const char* cache_dir, u2 alignment,
+                        bool class_index, bool abi_digest,
+                        const std::vector<WorkInput>* inputs,
+                        InterfaceJarCache* jar_cache) {
+  std::vector<std::string> jars;
+  if (batch_file != NULL) {
+    ReadBatchFile(batch_file, &jars);
+  } else {
+    jars.push_back(file_in);
+    jars.push_back(file_out);
+  }
+  std::map<std::string, std::string> digests;
+  if (jar_cache != NULL && inputs != NULL) {
+    for (const WorkInput& input : *inputs) {
+      if (!input.digest.empty()) {
+        digests[input.path] = input.digest;
+      }
+    }
+  }
+  std::unique_ptr<ClassCache> cache;
+  if (cache_dir != NULL) {
+    cache.reset(new ClassCache(cache_dir));
+  }
+  JarStripperProcessor processor(threads, cache.get());
+  for (size_t i = 0; i < jars.size(); i += 2) {
+    const char* jar_in = jars[i].c_str();
+    const char* jar_out = jars[i + 1].c_str();
+    std::string abi_path = std::string(jar_out) + ABI_DIGEST_SUFFIX;
+    std::string key;
+    auto digest = digests.find(jars[i]);
+    if (digest != digests.end()) {
+      key = digest->second + '\0' + std::to_string(alignment) +
+            (class_index ? "i" : "");
+      const std::string* jar = jar_cache->Lookup(key);
+      const std::string* abi =
+          abi_digest ? jar_cache->Lookup(key + ABI_DIGEST_SUFFIX) : NULL;
+      if (jar != NULL && (!abi_digest || abi != NULL) &&
+          WriteFile(jar_out, *jar) &&
+          (!abi_digest || WriteFile(abi_path.c_str(), *abi))) {
+        if (verbose) {
+          fprintf(stderr, "INFO: reused interface jar: %s -> %s.\n", jar_in,
+                  jar_out);
+        }
+        continue;
+      }
+    }
+    if (verbose) {
+      fprintf(stderr, "INFO: writing to '%s'.\n", jar_out);
+    }
+    std::string abi;
+    OpenFilesAndProcessJar(jar_out, jar_in, &processor, alignment,
+                           class_index, abi_digest ? &abi : NULL);
+    if (abi_digest) {
+      abi += '\n';
+      if (!WriteFile(abi_path.c_str(), abi)) {
+        fprintf(stderr, "Unable to write %s: %s\n", abi_path.c_str(),
+                strerror(errno));
+        abort();
+      }
+    }
+    std::string jar;
+    if (!key.empty() && ReadFile(jar_out, &jar)) {
+      if (abi_digest) {
+        jar_cache->Store(key + ABI_DIGEST_SUFFIX, &abi);
+      }
+      jar_cache->Store(key, &jar);
+    }
+  }
+}
+
+// Writes the full jar "full_jar" and the interface jar "interface_jar" of
+// the classes in "classes_dir", see PackageClassesDir() and ProcessJars().
+// The interface jar is not looked up in or added to a cache of interface
+// jars, since the full jar is an output here.
+static void ProcessClassesDir(const char* classes_dir, const char* full_jar,
+                              const char* interface_jar, int threads,
+                              const char* cache_dir, u2 alignment,
+                              bool class_index, bool abi_digest) {
+  std::unique_ptr<ClassCache> cache;
+  if (cache_dir != NULL) {
+    cache.reset(new ClassCache(cache_dir));
+  }
+  JarStripperProcessor processor(threads, cache.get());
+  if (verbose) {
+    fprintf(stderr, "INFO: writing to '%s' and '%s'.\n", full_jar,
+            interface_jar);
+  }
+  std::string abi;
+  PackageClassesDir(full_jar, interface_jar, classes_dir, &processor,
+                    alignment, class_index, abi_digest ? &abi : NULL);
+  if (abi_digest) {
+    std::string abi_path = std::string(interface_jar) + ABI_DIGEST_SUFFIX;
+    abi += '\n';
+    if (!WriteFile(abi_path.c_str(), abi)) {
+      fprintf(stderr, "Unable to write %s: %s\n", abi_path.c_str(),
+              strerror(errno));
+      abort();
+    }
+  }
+}
+
 }  // namespace devtools_ijar
 
 //
 // main method
 //
 static void usage() {
-  fprintf(stderr, "Usage: ijar [-v] x.jar [x_interface.jar>]\n");
+  fprintf(stderr, "Usage: ijar [-v] [--threads n] [--cache_dir dir] "
+          "[--align n] [--class_index] [--abi_digest] x.jar "
+          "[x_interface.jar>]\n");
+  fprintf(stderr, "       ijar [-v] [--threads n] [--cache_dir dir] "
+          "[--align n] [--class_index] [--abi_digest] --batch file\n");
+  fprintf(stderr, "       ijar [-v] [--threads n] [--cache_dir dir] "
+          "[--align n] [--class_index] [--abi_digest] --from_dir dir "
+          "x.jar\n            [x_interface.jar]\n");
   fprintf(stderr, "Creates an interface jar from the specified jar file.\n");
+  fprintf(stderr, "With --batch, creates the interface jars for all the jars "
+          "listed in the file,\none path per line: x.jar, "
+          "x_interface.jar, y.jar, y_interface.jar...\n");
+  fprintf(stderr, "With --from_dir, writes x.jar with the files of the "
+          "directory, e.g. the output\nof javac, and its interface jar in "
+          "one pass.\n");
+  fprintf(stderr, "With --threads, the classes are stripped in parallel.\n");
+  fprintf(stderr, "With --cache_dir, the stripped classes are cached in the "
+          "directory.\n");
+  fprintf(stderr, "With --align, the classes start at multiples of n bytes, "
+          "so that they can be\nused directly from a memory mapped jar.\n");
+  fprintf(stderr, "With --class_index, adds %s, a sorted index of the\n"
+          "classes, including the local and anonymous ones left out.\n",
+          devtools_ijar::CLASS_INDEX_NAME);
+  fprintf(stderr, "With --abi_digest, writes x_interface.jar%s, a digest of "
+          "the interface of\nthe classes that does not depend on their order "
+          "or the order of their\nmembers.\n", devtools_ijar::ABI_DIGEST_SUFFIX);
+  fprintf(stderr, "With --persistent_worker, runs as a persistent worker "
+          "taking the above\narguments in work requests on stdin.\n");
   exit(1);
 }
 
-int main(int argc, char **argv) {
+// Runs ijar with given command line, returns the exit code. A persistent
+// worker passes the inputs of the request and its cache of interface jars.
+static int Run(int argc, char **argv,
+               const std::vector<devtools_ijar::WorkInput>* inputs,
+               devtools_ijar::InterfaceJarCache* jar_cache) {
+  devtools_ijar::verbose = false;
   const char *filename_in = NULL;
   const char *filename_out = NULL;
+  int threads = 1;
+  const char *cache_dir = NULL;
+  int alignment = 0;
+  const char *batch_file = NULL;
+  const char *classes_dir = NULL;
+  bool class_index = false;
+  bool abi_digest = false;
 
   for (int ii = 1; ii < argc; ++ii) {
     if (strcmp(argv[ii], "-v") == 0) {
       devtools_ijar::verbose = true;
+    } else if (strcmp(argv[ii], "--threads") == 0) {
+      if (++ii == argc || (threads = atoi(argv[ii])) < 1) {
+        usage();
+      }
+    } else if (strcmp(argv[ii], "--cache_dir") == 0) {
+      if (++ii == argc) {
+        usage();
+      }
+      cache_dir = argv[ii];
+    } else if (strcmp(argv[ii], "--align") == 0) {
+      if (++ii == argc || (alignment = atoi(argv[ii])) < 1 ||
+          alignment > 0xffff) {
+        usage();
+      }
+    } else if (strcmp(argv[ii], "--class_index") == 0) {
+      class_index = true;
+    } else if (strcmp(argv[ii], "--abi_digest") == 0) {
+      abi_digest = true;
+    } else if (strcmp(argv[ii], "--batch") == 0) {
+      if (++ii == argc) {
+        usage();
+      }
+      batch_file = argv[ii];
+    } else if (strcmp(argv[ii], "--from_dir") == 0) {
+      if (++ii == argc) {
+        usage();
+      }
+      classes_dir = argv[ii];
     } else if (filename_in == NULL) {
       filename_in = argv[ii];
     } else if (filename_out == NULL) {
@@ -158,13 +990,14 @@ int main(int argc, char **argv) {
     }
   }
 
-  if (filename_in == NULL) {
+  if ((filename_in == NULL) == (batch_file == NULL) ||
+      (batch_file != NULL && classes_dir != NULL)) {
     usage();
   }
 
   // Guess output filename from input:
   char filename_out_buf[PATH_MAX];
-  if (filename_out == NULL) {
+  if (batch_file == NULL && filename_out == NULL) {
     size_t len = strlen(filename_in);
     if (len > 4 && strncmp(filename_in + len - 4, ".jar", 4) == 0) {
       strcpy(filename_out_buf, filename_in);
@@ -177,10 +1010,33 @@ int main(int argc, char **argv) {
     }
   }
 
-  if (devtools_ijar::verbose) {
-    fprintf(stderr, "INFO: writing to '%s'.\n", filename_out);
+  if (classes_dir != NULL) {
+    // filename_in is the full jar, written from the directory.
+    devtools_ijar::ProcessClassesDir(classes_dir, filename_in, filename_out,
+                                     threads, cache_dir, alignment,
+                                     class_index, abi_digest);
+    return 0;
   }
-
-  devtools_ijar::OpenFilesAndProcessJar(filename_out, filename_in);
+  devtools_ijar::ProcessJars(batch_file, filename_out, filename_in, threads,
+                             cache_dir, alignment, class_index, abi_digest,
+                             inputs, jar_cache);
   return 0;
 }
+
+int main(int argc, char **argv) {
+  if (!devtools_ijar::IsPersistentWorker(argc, argv)) {
+    return Run(argc, argv, NULL, NULL);
+  }
+  devtools_ijar::InterfaceJarCache jar_cache;
+  return devtools_ijar::RunPersistentWorker(devtools_ijar::WorkFunction(
+      [argv, &jar_cache](
+          const std::vector<std::string>& arguments,
+          const std::vector<devtools_ijar::WorkInput>& inputs) {
+        std::vector<char*> request_argv(1, argv[0]);
+        for (auto& argument : arguments) {
+          request_argv.push_back(const_cast<char*>(argument.c_str()));
+        }
+        return Run(request_argv.size(), request_argv.data(), &inputs,
+                   &jar_cache);
+      }));
+}
@@ -0,0 +1,752 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ijar_benchmark.cc -- benchmarks for StripClass and the ijar binary.
+//
+// Generates a corpus of synthetic class files of the kinds ijar sees most:
+//   pojo:      small classes with a few fields and accessors,
+//   proto:     huge generated protocol buffer classes,
+//   annotated: classes with annotations on the class, fields, methods and
+//              parameters,
+//   kotlin:    Kotlin classes, with their large kotlin.Metadata annotation,
+// then measures for each kind
+//   StripClass, in process: the time, the number and size of the
+//     allocations (operator new; the malloc() calls are not counted), and
+//     the output to input size ratio, per class;
+//   the ijar binary on a jar of these classes (OpenFilesAndProcessJar):
+//     the wall and CPU time per class and the size ratio.
+// The jars given with --jar are measured with the ijar binary too, to
+// benchmark a real corpus.
+//
+// Usage:
+//   ijar_benchmark [--classes N] [--iterations N] [--threads N]
+//                  [--ijar path] [--jar x.jar]...
+
+#include <errno.h>
+#include <inttypes.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "third_party/ijar/classfile.h"
+#include "third_party/ijar/common.h"
+#include "third_party/ijar/zip.h"
+
+extern char** environ;
+
+namespace devtools_ijar {
+bool verbose = false;
+}  // namespace devtools_ijar
+
+// The allocations with operator new of the whole program are counted.
+static std::atomic<uint64_t> allocation_count(0);
+static std::atomic<uint64_t> allocation_bytes(0);
+
+void* operator new(size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+namespace {
+
+using devtools_ijar::u1;
+using devtools_ijar::u2;
+using devtools_ijar::u4;
+
+enum ClassKind { POJO, PROTO, ANNOTATED, KOTLIN, NUM_CLASS_KINDS };
+
+const char* const kClassKindNames[NUM_CLASS_KINDS] = {"pojo", "proto",
+                                                      "annotated", "kotlin"};
+
+// Access flags.
+const u2 ACC_PUBLIC = 0x0001;
+const u2 ACC_PRIVATE = 0x0002;
+const u2 ACC_STATIC = 0x0008;
+const u2 ACC_FINAL = 0x0010;
+const u2 ACC_SUPER = 0x0020;
+
+// Writes a class file: the constant pool entries are added as they are
+// referenced, the fields, methods and attributes are written to separate
+// buffers with the Put methods.
+class ClassWriter {
+ public:
+  ClassWriter() : pool_count_(1) {}
+
+  // Constant pool entries, returning their indices. The UTF-8 entries
+  // and the classes are shared.
+  u2 Utf8(const std::string& s) {
+    auto found = utf8_.find(s);
+    if (found != utf8_.end()) {
+      return found->second;
+    }
+    Put1(&pool_, 1);
+    Put2(&pool_, s.size());
+    pool_ += s;
+    return utf8_[s] = pool_count_++;
+  }
+
+  u2 Class(const std::string& name) {
+    auto found = classes_.find(name);
+    if (found != classes_.end()) {
+      return found->second;
+    }
+    u2 name_index = Utf8(name);
+    Put1(&pool_, 7);
+    Put2(&pool_, name_index);
+    return classes_[name] = pool_count_++;
+  }
+
+  u2 String(const std::string& s) { return Entry(8, Utf8(s)); }
+
+  u2 Integer(u4 value) {
+    Put1(&pool_, 3);
+    Put4(&pool_, value);
+    return pool_count_++;
+  }
+
+  u2 NameAndType(const std::string& name, const std::string& descriptor) {
+    return Entry(12, Utf8(name), Utf8(descriptor));
+  }
+
+  u2 FieldRef(const std::string& owner, const std::string& name,
+              const std::string& descriptor) {
+    return Entry(9, Class(owner), NameAndType(name, descriptor));
+  }
+
+  u2 MethodRef(const std::string& owner, const std::string& name,
+               const std::string& descriptor) {
+    return Entry(10, Class(owner), NameAndType(name, descriptor));
+  }
+
+  static void Put1(std::string* out, u1 x) { out->push_back(x); }
+
+  static void Put2(std::string* out, u2 x) {
+    out->push_back(x >> 8);
+    out->push_back(x & 0xff);
+  }
+
+  static void Put4(std::string* out, u4 x) {
+    Put2(out, x >> 16);
+    Put2(out, x & 0xffff);
+  }
+
+  // Appends an attribute with given name and contents.
+  void PutAttribute(std::string* out, const std::string& name,
+                    const std::string& contents) {
+    Put2(out, Utf8(name));
+    Put4(out, contents.size());
+    *out += contents;
+  }
+
+  // Appends a Code attribute, with a LineNumberTable.
+  void PutCode(std::string* out, u2 max_stack, u2 max_locals,
+               const std::string& code) {
+    std::string contents;
+    Put2(&contents, max_stack);
+    Put2(&contents, max_locals);
+    Put4(&contents, code.size());
+    contents += code;
+    Put2(&contents, 0);  // exception_table_length
+    Put2(&contents, 1);  // attributes_count
+    std::string line_numbers;
+    Put2(&line_numbers, 1);
+    Put2(&line_numbers, 0);
+    Put2(&line_numbers, 42);
+    PutAttribute(&contents, "LineNumberTable", line_numbers);
+    PutAttribute(out, "Code", contents);
+  }
+
+  // Adds a field with given attributes, each of them written by
+  // PutAttribute.
+  void AddField(u2 access, const std::string& name,
+                const std::string& descriptor, int attributes_count,
+                const std::string& attributes) {
+    Put2(&fields_, access);
+    Put2(&fields_, Utf8(name));
+    Put2(&fields_, Utf8(descriptor));
+    Put2(&fields_, attributes_count);
+    fields_ += attributes;
+    ++fields_count_;
+  }
+
+  // Adds a method with given attributes, like AddField.
+  void AddMethod(u2 access, const std::string& name,
+                 const std::string& descriptor, int attributes_count,
+                 const std::string& attributes) {
+    Put2(&methods_, access);
+    Put2(&methods_, Utf8(name));
+    Put2(&methods_, Utf8(descriptor));
+    Put2(&methods_, attributes_count);
+    methods_ += attributes;
+    ++methods_count_;
+  }
+
+  // Adds an attribute of the class.
+  void AddAttribute(const std::string& name, const std::string& contents) {
+    PutAttribute(&attributes_, name, contents);
+    ++attributes_count_;
+  }
+
+  // Returns the class file.
+  std::string Finish(u2 access, const std::string& name,
+                     const std::string& super_name) {
+    u2 this_class = Class(name);
+    u2 super_class = Class(super_name);
+    std::string out;
+    Put4(&out, 0xcafebabe);
+    Put2(&out, 0);   // minor_version
+    Put2(&out, 52);  // major_version, Java 8
+    Put2(&out, pool_count_);
+    out += pool_;
+    Put2(&out, access);
+    Put2(&out, this_class);
+    Put2(&out, super_class);
+    Put2(&out, 0);  // interfaces_count
+    Put2(&out, fields_count_);
+    out += fields_;
+    Put2(&out, methods_count_);
+    out += methods_;
+    Put2(&out, attributes_count_);
+    out += attributes_;
+    return out;
+  }
+
+ private:
+  u2 Entry(u1 tag, u2 a) {
+    Put1(&pool_, tag);
+    Put2(&pool_, a);
+    return pool_count_++;
+  }
+
+  u2 Entry(u1 tag, u2 a, u2 b) {
+    Put1(&pool_, tag);
+    Put2(&pool_, a);
+    Put2(&pool_, b);
+    return pool_count_++;
+  }
+
+  std::string pool_;
+  u2 pool_count_;
+  std::map<std::string, u2> utf8_;
+  std::map<std::string, u2> classes_;
+  std::string fields_;
+  int fields_count_ = 0;
+  std::string methods_;
+  int methods_count_ = 0;
+  std::string attributes_;
+  int attributes_count_ = 0;
+};
+
+const char* const kFieldTypes[] = {"I", "J", "Ljava/lang/String;", "Z",
+                                   "Ljava/util/List;", "D"};
+const size_t kNumFieldTypes = sizeof(kFieldTypes) / sizeof(kFieldTypes[0]);
+
+// Adds a constructor calling the one of java.lang.Object.
+void AddConstructor(ClassWriter* w, const std::string& super_name) {
+  std::string code;
+  ClassWriter::Put1(&code, 0x2a);  // aload_0
+  ClassWriter::Put1(&code, 0xb7);  // invokespecial
+  ClassWriter::Put2(&code, w->MethodRef(super_name, "<init>", "()V"));
+  ClassWriter::Put1(&code, 0xb1);  // return
+  std::string attributes;
+  w->PutCode(&attributes, 1, 1, code);
+  w->AddMethod(ACC_PUBLIC, "<init>", "()V", 1, attributes);
+}
+
+// Adds a method returning the field.
+void AddGetter(ClassWriter* w, const std::string& class_name, u2 access,
+               const std::string& method_name, const std::string& field_name,
+               const std::string& descriptor) {
+  std::string code;
+  ClassWriter::Put1(&code, 0x2a);  // aload_0
+  ClassWriter::Put1(&code, 0xb4);  // getfield
+  ClassWriter::Put2(&code, w->FieldRef(class_name, field_name, descriptor));
+  ClassWriter::Put1(&code, 0xb0);  // areturn, close enough for ijar
+  std::string attributes;
+  w->PutCode(&attributes, 2, 1, code);
+  w->AddMethod(access, method_name, "()" + descriptor, 1, attributes);
+}
+
+// Adds a private field with its public getter.
+void AddProperty(ClassWriter* w, const std::string& class_name,
+                 const std::string& name, const std::string& descriptor) {
+  w->AddField(ACC_PRIVATE, name, descriptor, 0, "");
+  AddGetter(w, class_name, ACC_PUBLIC, "get" + name, name, descriptor);
+}
+
+std::string PojoClass(int index) {
+  ClassWriter w;
+  std::string name = "com/example/pojo/Pojo" + std::to_string(index);
+  for (int i = 0; i < 8; ++i) {
+    AddProperty(&w, name, "field" + std::to_string(i),
+                kFieldTypes[(index + i) % kNumFieldTypes]);
+  }
+  AddConstructor(&w, "java/lang/Object");
+  std::string source_file;
+  ClassWriter::Put2(&source_file, w.Utf8("Pojo.java"));
+  w.AddAttribute("SourceFile", source_file);
+  return w.Finish(ACC_PUBLIC | ACC_SUPER, name, "java/lang/Object");
+}
+
+std::string ProtoClass(int index) {
+  ClassWriter w;
+  std::string name = "com/example/proto/Message" + std::to_string(index);
+  std::string builder = name + "$Builder";
+  // Like the generated code: a field number constant, a field, and the
+  // accessors for each field, plus the private serialization methods.
+  for (int i = 0; i < 200; ++i) {
+    std::string field = "field" + std::to_string(i) + "_";
+    std::string constant_value;
+    ClassWriter::Put2(&constant_value, w.Integer(i + 1));
+    std::string attributes;
+    w.PutAttribute(&attributes, "ConstantValue", constant_value);
+    w.AddField(ACC_PUBLIC | ACC_STATIC | ACC_FINAL,
+               "FIELD" + std::to_string(i) + "_FIELD_NUMBER", "I", 1,
+               attributes);
+    const char* descriptor = kFieldTypes[i % kNumFieldTypes];
+    AddProperty(&w, name, field, descriptor);
+    AddGetter(&w, name, ACC_PUBLIC, "has" + field, field, descriptor);
+    AddGetter(&w, name, ACC_PRIVATE, "computeSize" + field, field,
+              descriptor);
+    w.String("default value of " + field);
+  }
+  AddConstructor(&w, "com/google/protobuf/GeneratedMessage");
+  std::string signature;
+  ClassWriter::Put2(&signature,
+                    w.Utf8("Lcom/google/protobuf/GeneratedMessage<L" + name +
+                           ";L" + builder + ";>;"));
+  w.AddAttribute("Signature", signature);
+  std::string inner_classes;
+  ClassWriter::Put2(&inner_classes, 1);
+  ClassWriter::Put2(&inner_classes, w.Class(builder));
+  ClassWriter::Put2(&inner_classes, w.Class(name));
+  ClassWriter::Put2(&inner_classes, w.Utf8("Builder"));
+  ClassWriter::Put2(&inner_classes, ACC_PUBLIC | ACC_STATIC | ACC_FINAL);
+  w.AddAttribute("InnerClasses", inner_classes);
+  return w.Finish(ACC_PUBLIC | ACC_FINAL | ACC_SUPER, name,
+                  "com/google/protobuf/GeneratedMessage");
+}
+
+// Appends an annotation with a string, an enum, a class, an array and a
+// nested annotation element value.
+void PutAnnotation(ClassWriter* w, std::string* out, int index) {
+  ClassWriter::Put2(out, w->Utf8("Lcom/example/Annotation" +
+                                 std::to_string(index % 4) + ";"));
+  ClassWriter::Put2(out, 5);  // num_element_value_pairs
+  ClassWriter::Put2(out, w->Utf8("value"));
+  ClassWriter::Put1(out, 's');
+  ClassWriter::Put2(out, w->Utf8("value " + std::to_string(index)));
+  ClassWriter::Put2(out, w->Utf8("policy"));
+  ClassWriter::Put1(out, 'e');
+  ClassWriter::Put2(out, w->Utf8("Ljava/lang/annotation/RetentionPolicy;"));
+  ClassWriter::Put2(out, w->Utf8("RUNTIME"));
+  ClassWriter::Put2(out, w->Utf8("type"));
+  ClassWriter::Put1(out, 'c');
+  ClassWriter::Put2(out, w->Utf8("Ljava/lang/String;"));
+  ClassWriter::Put2(out, w->Utf8("numbers"));
+  ClassWriter::Put1(out, '[');
+  ClassWriter::Put2(out, 3);
+  for (int i = 0; i < 3; ++i) {
+    ClassWriter::Put1(out, 'I');
+    ClassWriter::Put2(out, w->Integer(index * 3 + i));
+  }
+  ClassWriter::Put2(out, w->Utf8("nested"));
+  ClassWriter::Put1(out, '@');
+  ClassWriter::Put2(out, w->Utf8("Ljava/lang/Deprecated;"));
+  ClassWriter::Put2(out, 0);
+}
+
+// Returns the contents of a RuntimeVisibleAnnotations attribute with
+// "count" annotations.
+std::string Annotations(ClassWriter* w, int count, int index) {
+  std::string contents;
+  ClassWriter::Put2(&contents, count);
+  for (int i = 0; i < count; ++i) {
+    PutAnnotation(w, &contents, index + i);
+  }
+  return contents;
+}
+
+std::string AnnotatedClass(int index) {
+  ClassWriter w;
+  std::string name = "com/example/annotated/Service" + std::to_string(index);
+  for (int i = 0; i < 20; ++i) {
+    std::string field = "dependency" + std::to_string(i);
+    std::string attributes;
+    w.PutAttribute(&attributes, "RuntimeVisibleAnnotations",
+                   Annotations(&w, 2, i));
+    w.AddField(ACC_PRIVATE, field, "Ljava/lang/Object;", 1, attributes);
+
+    std::string code;
+    ClassWriter::Put1(&code, 0x01);  // aconst_null
+    ClassWriter::Put1(&code, 0xb0);  // areturn
+    std::string parameter_annotations;
+    ClassWriter::Put1(&parameter_annotations, 2);  // num_parameters
+    for (int parameter = 0; parameter < 2; ++parameter) {
+      parameter_annotations += Annotations(&w, 1, i + parameter);
+    }
+    std::string method_attributes;
+    w.PutCode(&method_attributes, 1, 3, code);
+    w.PutAttribute(&method_attributes, "RuntimeVisibleAnnotations",
+                   Annotations(&w, 3, i));
+    w.PutAttribute(&method_attributes, "RuntimeVisibleParameterAnnotations",
+                   parameter_annotations);
+    w.PutAttribute(&method_attributes, "RuntimeInvisibleAnnotations",
+                   Annotations(&w, 1, i));
+    w.AddMethod(ACC_PUBLIC, "provide" + std::to_string(i),
+                "(Ljava/lang/String;I)Ljava/lang/Object;", 4,
+                method_attributes);
+  }
+  AddConstructor(&w, "java/lang/Object");
+  w.AddAttribute("RuntimeVisibleAnnotations", Annotations(&w, 6, index));
+  return w.Finish(ACC_PUBLIC | ACC_SUPER, name, "java/lang/Object");
+}
+
+// Returns a string like the protocol buffer encoded Kotlin metadata, using
+// the characters that are one byte long in modified UTF-8.
+std::string KotlinMetadataString(size_t length, unsigned seed) {
+  std::string s;
+  s.reserve(length);
+  while (s.size() < length) {
+    seed = seed * 1103515245 + 12345;
+    s.push_back(1 + (seed >> 16) % 0x7f);
+  }
+  return s;
+}
+
+std::string KotlinClass(int index) {
+  ClassWriter w;
+  std::string name = "com/example/kotlin/Model" + std::to_string(index);
+  for (int i = 0; i < 16; ++i) {
+    AddProperty(&w, name, "property" + std::to_string(i),
+                kFieldTypes[(index + i) % kNumFieldTypes]);
+  }
+  AddConstructor(&w, "java/lang/Object");
+
+  // @kotlin.Metadata(k = 1, mv = {...}, d1 = {...}, d2 = {...})
+  std::string metadata;
+  ClassWriter::Put2(&metadata, 1);  // num_annotations
+  ClassWriter::Put2(&metadata, w.Utf8("Lkotlin/Metadata;"));
+  ClassWriter::Put2(&metadata, 4);
+  ClassWriter::Put2(&metadata, w.Utf8("k"));
+  ClassWriter::Put1(&metadata, 'I');
+  ClassWriter::Put2(&metadata, w.Integer(1));
+  ClassWriter::Put2(&metadata, w.Utf8("mv"));
+  ClassWriter::Put1(&metadata, '[');
+  ClassWriter::Put2(&metadata, 3);
+  for (int version : {1, 1, 5}) {
+    ClassWriter::Put1(&metadata, 'I');
+    ClassWriter::Put2(&metadata, w.Integer(version));
+  }
+  ClassWriter::Put2(&metadata, w.Utf8("d1"));
+  ClassWriter::Put1(&metadata, '[');
+  ClassWriter::Put2(&metadata, 2);
+  for (int i = 0; i < 2; ++i) {
+    ClassWriter::Put1(&metadata, 's');
+    ClassWriter::Put2(&metadata,
+                      w.Utf8(KotlinMetadataString(1500, index * 2 + i)));
+  }
+  ClassWriter::Put2(&metadata, w.Utf8("d2"));
+  ClassWriter::Put1(&metadata, '[');
+  ClassWriter::Put2(&metadata, 17);
+  ClassWriter::Put1(&metadata, 's');
+  ClassWriter::Put2(&metadata, w.Utf8("L" + name + ";"));
+  for (int i = 0; i < 16; ++i) {
+    ClassWriter::Put1(&metadata, 's');
+    ClassWriter::Put2(&metadata, w.Utf8("property" + std::to_string(i)));
+  }
+  w.AddAttribute("RuntimeVisibleAnnotations", metadata);
+  std::string source_file;
+  ClassWriter::Put2(&source_file, w.Utf8("Model.kt"));
+  w.AddAttribute("SourceFile", source_file);
+  return w.Finish(ACC_PUBLIC | ACC_FINAL | ACC_SUPER, name,
+                  "java/lang/Object");
+}
+
+std::string MakeClass(ClassKind kind, int index) {
+  switch (kind) {
+    case POJO:
+      return PojoClass(index);
+    case PROTO:
+      return ProtoClass(index);
+    case ANNOTATED:
+      return AnnotatedClass(index);
+    case KOTLIN:
+      return KotlinClass(index);
+    default:
+      abort();
+  }
+}
+
+uint64_t MonotonicNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t TimevalNanos(const struct timeval& tv) {
+  return tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+}
+
+// A set of classes of one kind, and their total size.
+struct Corpus {
+  std::vector<std::string> classes;
+  uint64_t bytes;
+};
+
+void BenchmarkStripClass(const char* kind_name, const Corpus& corpus,
+                         int iterations) {
+  size_t max_length = 0;
+  for (auto& classfile : corpus.classes) {
+    max_length = std::max(max_length, classfile.size());
+  }
+  std::unique_ptr<u1[]> buffer(new u1[max_length]);
+  uint64_t out_bytes = 0;
+  uint64_t allocations = allocation_count;
+  uint64_t allocated_bytes = allocation_bytes;
+  uint64_t start = MonotonicNanos();
+  for (int iteration = 0; iteration < iterations; ++iteration) {
+    for (auto& classfile : corpus.classes) {
+      u1* out = buffer.get();
+      devtools_ijar::StripClass(
+          out, reinterpret_cast<const u1*>(classfile.data()), classfile.size());
+      out_bytes += out - buffer.get();
+    }
+  }
+  uint64_t nanos = MonotonicNanos() - start;
+  uint64_t items = corpus.classes.size() * iterations;
+  printf("StripClass %-10s %10.1f ns/class %8.1f allocs/class "
+         "%10.1f bytes allocated/class %5.1f%% out/in\n",
+         kind_name, static_cast<double>(nanos) / items,
+         static_cast<double>(allocation_count - allocations) / items,
+         static_cast<double>(allocation_bytes - allocated_bytes) / items,
+         100.0 * out_bytes / (corpus.bytes * iterations));
+}
+
+// Writes the classes to a jar, deflated like the ones from javac.
+void WriteJar(const std::string& path, const char* kind_name,
+              const Corpus& corpus) {
+  std::unique_ptr<devtools_ijar::ZipBuilder> builder(
+      devtools_ijar::ZipBuilder::CreateStreaming(path.c_str()));
+  if (builder.get() == NULL) {
+    fprintf(stderr, "Cannot create %s: %s\n", path.c_str(), strerror(errno));
+    exit(1);
+  }
+  for (size_t i = 0; i < corpus.classes.size(); ++i) {
+    const std::string& classfile = corpus.classes[i];
+    std::string name = std::string("com/example/") + kind_name + "/Class" +
+                       std::to_string(i) + ".class";
+    u1* p = builder->NewFile(name.c_str(), 0, classfile.size());
+    if (p == NULL) {
+      fprintf(stderr, "%s\n", builder->GetError());
+      exit(1);
+    }
+    memcpy(p, classfile.data(), classfile.size());
+    if (builder->FinishFile(classfile.size(), true, true) < 0) {
+      fprintf(stderr, "%s\n", builder->GetError());
+      exit(1);
+    }
+  }
+  if (builder->Finish() < 0) {
+    fprintf(stderr, "%s\n", builder->GetError());
+    exit(1);
+  }
+}
+
+// Returns the number of classes in the jar.
+int CountClasses(const std::string& path) {
+  struct CountingProcessor : public devtools_ijar::ZipExtractorProcessor {
+    CountingProcessor() : count(0) {}
+    bool Accept(const char* filename, const u4 attr) override {
+      size_t length = strlen(filename);
+      if (length > 6 && strcmp(filename + length - 6, ".class") == 0) {
+        ++count;
+      }
+      return false;
+    }
+    void Process(const char* filename, const u4 attr, const u1* data,
+                 const size_t size) override {}
+    int count;
+  } processor;
+  std::unique_ptr<devtools_ijar::ZipExtractor> extractor(
+      devtools_ijar::ZipExtractor::Create(path.c_str(), &processor));
+  if (extractor.get() == NULL || extractor->ProcessAll() < 0) {
+    fprintf(stderr, "Cannot read %s\n", path.c_str());
+    exit(1);
+  }
+  return processor.count;
+}
+
+off_t FileSize(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL || fseeko(file, 0, SEEK_END) != 0) {
+    fprintf(stderr, "Cannot open %s: %s\n", path.c_str(), strerror(errno));
+    exit(1);
+  }
+  off_t size = ftello(file);
+  fclose(file);
+  return size;
+}
+
+// Runs the ijar binary on the jar "iterations" times, reporting the wall
+// and CPU times per class and the size ratio.
+void BenchmarkIjar(const std::string& ijar, const std::string& label,
+                   const std::string& jar, const std::string& interface_jar,
+                   int iterations, int threads) {
+  int classes = CountClasses(jar);
+  std::string threads_arg = std::to_string(threads);
+  uint64_t wall_nanos = 0;
+  uint64_t cpu_nanos = 0;
+  for (int iteration = 0; iteration < iterations; ++iteration) {
+    uint64_t start = MonotonicNanos();
+    const char* args[] = {ijar.c_str(), "--threads", threads_arg.c_str(),
+                          jar.c_str(), interface_jar.c_str(), NULL};
+    pid_t pid;
+    int error = posix_spawn(&pid, ijar.c_str(), NULL, NULL,
+                            const_cast<char* const*>(args), environ);
+    if (error != 0) {
+      fprintf(stderr, "Cannot run %s: %s\n", ijar.c_str(), strerror(error));
+      exit(1);
+    }
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "%s failed on %s\n", ijar.c_str(), jar.c_str());
+      exit(1);
+    }
+    wall_nanos += MonotonicNanos() - start;
+    cpu_nanos += TimevalNanos(usage.ru_utime) + TimevalNanos(usage.ru_stime);
+  }
+  uint64_t items = static_cast<uint64_t>(classes > 0 ? classes : 1) *
+                   iterations;
+  printf("ijar %-16s %10.1f ns/class %10.1f cpu ns/class %5.1f%% out/in\n",
+         label.c_str(), static_cast<double>(wall_nanos) / items,
+         static_cast<double>(cpu_nanos) / items,
+         100.0 * FileSize(interface_jar) / FileSize(jar));
+}
+
+}  // namespace
+
+static void usage() {
+  fprintf(stderr, "Usage: ijar_benchmark [--classes n] [--iterations n] "
+          "[--threads n] [--ijar path]\n"
+          "                      [--jar x.jar]...\n");
+  exit(1);
+}
+
+int main(int argc, char** argv) {
+  int classes = 200;
+  int iterations = 5;
+  int threads = 1;
+  std::string ijar = "third_party/ijar/ijar";
+  std::vector<std::string> jars;
+  for (int ii = 1; ii < argc; ++ii) {
+    if (strcmp(argv[ii], "--classes") == 0) {
+      if (++ii == argc || (classes = atoi(argv[ii])) < 1) {
+        usage();
+      }
+    } else if (strcmp(argv[ii], "--iterations") == 0) {
+      if (++ii == argc || (iterations = atoi(argv[ii])) < 1) {
+        usage();
+      }
+    } else if (strcmp(argv[ii], "--threads") == 0) {
+      if (++ii == argc || (threads = atoi(argv[ii])) < 1) {
+        usage();
+      }
+    } else if (strcmp(argv[ii], "--ijar") == 0) {
+      if (++ii == argc) {
+        usage();
+      }
+      ijar = argv[ii];
+    } else if (strcmp(argv[ii], "--jar") == 0) {
+      if (++ii == argc) {
+        usage();
+      }
+      jars.push_back(argv[ii]);
+    } else {
+      usage();
+    }
+  }
+
+  const char* tmpdir_root = getenv("TEST_TMPDIR");
+  std::string tmpdir =
+      std::string(tmpdir_root ? tmpdir_root : "/tmp") + "/ijar_bm.XXXXXX";
+  if (mkdtemp(&tmpdir[0]) == NULL) {
+    fprintf(stderr, "Cannot create %s: %s\n", tmpdir.c_str(),
+            strerror(errno));
+    return 1;
+  }
+  std::string interface_jar = tmpdir + "/out-interface.jar";
+
+  printf("%d classes of each kind, %d iterations, %d ijar threads\n", classes,
+         iterations, threads);
+  std::vector<Corpus> corpora(NUM_CLASS_KINDS);
+  for (int kind = 0; kind < NUM_CLASS_KINDS; ++kind) {
+    Corpus& corpus = corpora[kind];
+    corpus.bytes = 0;
+    for (int i = 0; i < classes; ++i) {
+      corpus.classes.push_back(MakeClass(static_cast<ClassKind>(kind), i));
+      corpus.bytes += corpus.classes.back().size();
+    }
+    printf("%-10s %10.1f bytes/class\n", kClassKindNames[kind],
+           static_cast<double>(corpus.bytes) / classes);
+  }
+
+  for (int kind = 0; kind < NUM_CLASS_KINDS; ++kind) {
+    BenchmarkStripClass(kClassKindNames[kind], corpora[kind], iterations);
+  }
+
+  for (int kind = 0; kind < NUM_CLASS_KINDS; ++kind) {
+    std::string jar = tmpdir + "/" + kClassKindNames[kind] + ".jar";
+    WriteJar(jar, kClassKindNames[kind], corpora[kind]);
+    BenchmarkIjar(ijar, kClassKindNames[kind], jar, interface_jar, iterations,
+                  threads);
+    unlink(jar.c_str());
+  }
+  for (auto& jar : jars) {
+    size_t slash = jar.rfind('/');
+    std::string label =
+        slash == std::string::npos ? jar : jar.substr(slash + 1);
+    BenchmarkIjar(ijar, label, jar, interface_jar, iterations, threads);
+  }
+
+  unlink(interface_jar.c_str());
+  rmdir(tmpdir.c_str());
+  return 0;
+}
@@ -58,6 +58,10 @@ MappedInputFile::MappedInputFile(const char* name) {
     return;
   }
 
+  // The file is mostly read front to back, and what was read is discarded:
+  // let the kernel read ahead further and drop the pages behind early.
+  madvise(buffer, length, MADV_SEQUENTIAL);
+
   impl_ = new MappedInputFileImpl();
   impl_->fd_ = fd;
   impl_->discarded_ = 0;
@@ -136,6 +136,295 @@ function test_output_bigger_than_input() {
   [[ $W_INTERFACE_JAR_SIZE -gt $W_JAR_SIZE ]] || fail "interface jar should be bigger"
 }
 
+function test_threads_do_not_change_output() {
+  # Tests that stripping the classes in parallel produces the same output
+  $JAVAC -g -d $TEST_TMPDIR/classes $IJAR_SRCDIR/test/A.java \
+    $IJAR_SRCDIR/test/WellCompressed*.java || fail "javac failed"
+  $JAR cf $A_JAR -C $TEST_TMPDIR/classes . || fail "jar failed"
+  $IJAR $A_JAR $A_INTERFACE_JAR || fail "ijar failed"
+  local threads_interface_jar=$TEST_TMPDIR/A-threads-interface.jar
+  $IJAR --threads 4 $A_JAR $threads_interface_jar ||
+    fail "ijar --threads failed"
+  cmp $A_INTERFACE_JAR $threads_interface_jar ||
+    fail "ijar --threads output differs"
+}
+
+function test_cache_does_not_change_output() {
+  # Tests that the classes taken from the cache are the stripped ones
+  $JAVAC -g -d $TEST_TMPDIR/classes $IJAR_SRCDIR/test/A.java \
+    $IJAR_SRCDIR/test/WellCompressed*.java || fail "javac failed"
+  $JAR cf $A_JAR -C $TEST_TMPDIR/classes . || fail "jar failed"
+  $IJAR $A_JAR $A_INTERFACE_JAR || fail "ijar failed"
+  local cache_dir=$TEST_TMPDIR/class_cache
+  local cached_interface_jar=$TEST_TMPDIR/A-cached-interface.jar
+  rm -rf $cache_dir
+  for i in 1 2; do
+    $IJAR --cache_dir $cache_dir $A_JAR $cached_interface_jar ||
+      fail "ijar --cache_dir failed"
+    cmp $A_INTERFACE_JAR $cached_interface_jar ||
+      fail "ijar --cache_dir output differs"
+  done
+  [ -n "$(ls $cache_dir)" ] || fail "the class cache is empty"
+}
+
+function test_batch() {
+  # Tests that the jars processed in one batch are the same as the ones
+  # processed one at a time
+  $JAVAC -g -d $TEST_TMPDIR/classes $IJAR_SRCDIR/test/A.java \
+    $IJAR_SRCDIR/test/WellCompressed*.java || fail "javac failed"
+  $JAR cf $A_JAR -C $TEST_TMPDIR/classes . || fail "jar failed"
+  $IJAR $A_JAR $A_INTERFACE_JAR || fail "ijar failed"
+  $IJAR $TYPEANN2_JAR $TEST_TMPDIR/typeann2-interface.jar ||
+    fail "ijar failed"
+  local batch_file=$TEST_TMPDIR/ijar_batch
+  cat >$batch_file <<EOF
+$A_JAR
+$TEST_TMPDIR/A-batch-interface.jar
+$TYPEANN2_JAR
+$TEST_TMPDIR/typeann2-batch-interface.jar
+EOF
+  $IJAR --threads 2 --batch $batch_file || fail "ijar --batch failed"
+  cmp $A_INTERFACE_JAR $TEST_TMPDIR/A-batch-interface.jar ||
+    fail "ijar --batch output differs"
+  cmp $TEST_TMPDIR/typeann2-interface.jar \
+    $TEST_TMPDIR/typeann2-batch-interface.jar ||
+    fail "ijar --batch output differs"
+}
+
+function test_class_index() {
+  # Tests that --class_index adds the index of all the classes, including
+  # the local and anonymous ones left out, as the last entry
+  $JAVAC -g -d $TEST_TMPDIR/classes $IJAR_SRCDIR/test/LocalAndAnonymous.java ||
+    fail "javac failed"
+  local jar=$TEST_TMPDIR/local.jar
+  local interface_jar=$TEST_TMPDIR/local-interface.jar
+  local index=$TEST_TMPDIR/local-classes.index
+  $JAR cf $jar -C $TEST_TMPDIR/classes . || fail "jar failed"
+  $IJAR --class_index $jar $interface_jar || fail "ijar --class_index failed"
+  [ "$($UNZIP -Z1 $interface_jar | tail -1)" = \
+    "META-INF/ijar-classes.index" ] || fail "the class index is not last"
+  $UNZIP -p $interface_jar META-INF/ijar-classes.index >$index ||
+    fail "cannot extract the class index"
+  [ "$(head -c 8 $index)" = "IJINDEX1" ] || fail "bad class index magic"
+  local class
+  for class in $($UNZIP -Z1 $jar '*.class'); do
+    grep -aqF "${class%.class}" $index || fail "$class is not in the index"
+  done
+  $UNZIP -Z1 $interface_jar | grep -qF 'LocalAndAnonymous$1LocalClass' &&
+    fail "the local class is in the interface jar"
+  grep -aqF 'LocalAndAnonymous$1LocalClass' $index ||
+    fail "the local class is not in the index"
+
+  # The classes are the same as without the index.
+  $IJAR --threads 2 $jar $TEST_TMPDIR/local-noindex-interface.jar ||
+    fail "ijar failed"
+  [ "$($UNZIP -Z1 $interface_jar | sed '$d')" = \
+    "$($UNZIP -Z1 $TEST_TMPDIR/local-noindex-interface.jar)" ] ||
+    fail "--class_index changed the interface jar"
+}
+
+function test_abi_digest() {
+  # Tests that --abi_digest writes a digest that depends neither on the order
+  # of the classes nor on their private members, but does on the public ones
+  local src=$TEST_TMPDIR/abi_src classes=$TEST_TMPDIR/abi_classes
+  local jar=$TEST_TMPDIR/abi.jar
+  local interface_jar=$TEST_TMPDIR/abi-interface.jar
+  local reordered_jar=$TEST_TMPDIR/abi-reordered.jar
+  mkdir -p $src
+  cat >$src/First.java <<EOF
+public class First {
+  public int field;
+  public void method() {}
+  private void hidden() {}
+}
+EOF
+  cat >$src/Second.java <<EOF
+public class Second {
+  public static final String NAME = "second";
+}
+EOF
+  $JAVAC -d $classes $src/*.java || fail "javac failed"
+  (cd $classes && $ZIP -q $jar First.class Second.class &&
+    touch -t 200001010000 First.class &&
+    $ZIP -q $reordered_jar Second.class First.class) || fail "zip failed"
+  $IJAR --abi_digest $jar $interface_jar || fail "ijar --abi_digest failed"
+  $IJAR --abi_digest $reordered_jar $TEST_TMPDIR/abi-reordered-interface.jar ||
+    fail "ijar --abi_digest failed"
+  local digest=$(cat $interface_jar.abi)
+  [ ${#digest} -eq 64 ] || fail "bad digest: $digest"
+  [ "$digest" = "$(cat $TEST_TMPDIR/abi-reordered-interface.jar.abi)" ] ||
+    fail "the order of the classes changed the digest"
+
+  # A private change keeps the digest, a public one changes it.
+  sed -i 's/hidden() {}/hidden() { field = 1; }/' $src/First.java
+  $JAVAC -d $classes $src/First.java || fail "javac failed"
+  rm -f $jar
+  (cd $classes && $ZIP -q $jar First.class Second.class) || fail "zip failed"
+  $IJAR --abi_digest $jar $interface_jar || fail "ijar --abi_digest failed"
+  [ "$digest" = "$(cat $interface_jar.abi)" ] ||
+    fail "a private change changed the digest"
+  sed -i 's/void method() {}/int method() { return 0; }/' $src/First.java
+  $JAVAC -d $classes $src/First.java || fail "javac failed"
+  rm -f $jar
+  (cd $classes && $ZIP -q $jar First.class Second.class) || fail "zip failed"
+  $IJAR --abi_digest $jar $interface_jar || fail "ijar --abi_digest failed"
+  [ "$digest" != "$(cat $interface_jar.abi)" ] ||
+    fail "a public change did not change the digest"
+}
+
+function test_from_dir() {
+  # Tests that --from_dir writes the full jar of a directory of classes, and
+  # the same interface jar as ijar on that full jar
+  local src=$TEST_TMPDIR/from_dir_src classes=$TEST_TMPDIR/from_dir_classes
+  local jar=$TEST_TMPDIR/from_dir.jar
+  mkdir -p $src $classes/res
+  cat >$src/First.java <<EOF
+package p;
+public class First {
+  public void method() {}
+  private void hidden() {}
+}
+EOF
+  $JAVAC -d $classes $src/First.java || fail "javac failed"
+  echo data >$classes/res/data.txt
+  $IJAR --abi_digest --from_dir $classes $jar ||
+    fail "ijar --from_dir failed"
+  $UNZIP -l $jar >$TEST_log || fail "unzip failed"
+  expect_log "META-INF/MANIFEST.MF"
+  expect_log "p/First.class"
+  expect_log "res/data.txt"
+  $UNZIP -p $jar res/data.txt | grep -q data || fail "bad res/data.txt"
+  $UNZIP -l $TEST_TMPDIR/from_dir-interface.jar >$TEST_log ||
+    fail "unzip failed"
+  expect_log "p/First.class"
+  expect_not_log "res/data.txt"
+
+  $IJAR --abi_digest $jar $TEST_TMPDIR/from_jar-interface.jar ||
+    fail "ijar failed"
+  cmp $TEST_TMPDIR/from_dir-interface.jar \
+    $TEST_TMPDIR/from_jar-interface.jar ||
+    fail "the interface jars differ"
+  cmp $TEST_TMPDIR/from_dir-interface.jar.abi \
+    $TEST_TMPDIR/from_jar-interface.jar.abi || fail "the digests differ"
+}
+
+# Writes the length-delimited WorkRequest with given arguments, each of them
+# and the whole request shorter than 128 bytes.
+function write_work_request() {
+  local length=0 arg
+  for arg in "$@"; do
+    length=$((length + 2 + ${#arg}))
+  done
+  printf "\\x$(printf %02x $length)"
+  for arg in "$@"; do
+    printf "\\x0a\\x$(printf %02x ${#arg})%s" "$arg"
+  done
+}
+
+# Writes the length-delimited WorkRequest with given arguments, and with the
+# input "$1" having digest "$2". The input, each argument and the whole
+# request must be shorter than 128 bytes.
+function write_work_request_with_input() {
+  local path="$1" digest="$2" length input_length arg
+  shift 2
+  input_length=$((4 + ${#path} + ${#digest}))
+  length=$((2 + input_length))
+  for arg in "$@"; do
+    length=$((length + 2 + ${#arg}))
+  done
+  printf "\\x$(printf %02x $length)"
+  for arg in "$@"; do
+    printf "\\x0a\\x$(printf %02x ${#arg})%s" "$arg"
+  done
+  printf "\\x12\\x$(printf %02x $input_length)"
+  printf "\\x0a\\x$(printf %02x ${#path})%s" "$path"
+  printf "\\x12\\x$(printf %02x ${#digest})%s" "$digest"
+}
+
+function test_persistent_worker() {
+  # Tests that a persistent worker writes the same interface jars, and
+  # answers each work request with an empty (successful) response
+  $JAVAC -g -d $TEST_TMPDIR/classes $IJAR_SRCDIR/test/A.java ||
+    fail "javac failed"
+  $JAR cf $A_JAR -C $TEST_TMPDIR/classes . || fail "jar failed"
+  $IJAR $A_JAR $A_INTERFACE_JAR || fail "ijar failed"
+  local ijar="$(cd $(dirname $IJAR) && pwd)/$(basename $IJAR)"
+  (cd $TEST_TMPDIR &&
+    { write_work_request A.jar A-worker1-interface.jar
+      write_work_request A.jar A-worker2-interface.jar; } |
+    $ijar --persistent_worker >worker_responses) ||
+    fail "ijar --persistent_worker failed"
+  [ "$(od -An -tx1 $TEST_TMPDIR/worker_responses | tr -d ' \n')" = "0000" ] ||
+    fail "unexpected work responses"
+  cmp $A_INTERFACE_JAR $TEST_TMPDIR/A-worker1-interface.jar ||
+    fail "ijar --persistent_worker output differs"
+  cmp $A_INTERFACE_JAR $TEST_TMPDIR/A-worker2-interface.jar ||
+    fail "ijar --persistent_worker output differs"
+}
+
+function test_persistent_worker_reuses_interface_jars() {
+  # Tests that a persistent worker reuses the interface jar of an input it
+  # has already seen with the same digest, without reading it again: the
+  # second request names a jar which does not exist
+  $JAVAC -g -d $TEST_TMPDIR/classes $IJAR_SRCDIR/test/A.java ||
+    fail "javac failed"
+  $JAR cf $A_JAR -C $TEST_TMPDIR/classes . || fail "jar failed"
+  $IJAR $A_JAR $A_INTERFACE_JAR || fail "ijar failed"
+  local ijar="$(cd $(dirname $IJAR) && pwd)/$(basename $IJAR)"
+  (cd $TEST_TMPDIR &&
+    { write_work_request_with_input A.jar digest1 \
+        A.jar A-worker1-interface.jar
+      write_work_request_with_input missing.jar digest1 \
+        missing.jar A-worker2-interface.jar; } |
+    $ijar --persistent_worker >worker_responses) ||
+    fail "ijar --persistent_worker failed"
+  [ "$(od -An -tx1 $TEST_TMPDIR/worker_responses | tr -d ' \n')" = "0000" ] ||
+    fail "unexpected work responses"
+  cmp $A_INTERFACE_JAR $TEST_TMPDIR/A-worker1-interface.jar ||
+    fail "ijar --persistent_worker output differs"
+  cmp $A_INTERFACE_JAR $TEST_TMPDIR/A-worker2-interface.jar ||
+    fail "ijar --persistent_worker did not reuse the interface jar"
+}
+
+function test_persistent_worker_failed_request() {
+  # Tests that a persistent worker answers a request that fails with the
+  # exit code of ijar (134: it aborts) and its message, and goes on with the
+  # next request
+  $JAVAC -g -d $TEST_TMPDIR/classes $IJAR_SRCDIR/test/A.java ||
+    fail "javac failed"
+  $JAR cf $A_JAR -C $TEST_TMPDIR/classes . || fail "jar failed"
+  $IJAR $A_JAR $A_INTERFACE_JAR || fail "ijar failed"
+  local ijar="$(cd $(dirname $IJAR) && pwd)/$(basename $IJAR)"
+  (cd $TEST_TMPDIR &&
+    { write_work_request missing.jar missing-interface.jar
+      write_work_request A.jar A-worker-interface.jar; } |
+    $ijar --persistent_worker >worker_responses) ||
+    fail "ijar --persistent_worker failed"
+  local responses="$(od -An -tx1 $TEST_TMPDIR/worker_responses | tr -d ' \n')"
+  [[ "$responses" =~ ^..08860112.*00$ ]] ||
+    fail "unexpected work responses: $responses"
+  grep -q "Unable to open Zip file missing.jar" $TEST_TMPDIR/worker_responses ||
+    fail "the work response has no error message"
+  cmp $A_INTERFACE_JAR $TEST_TMPDIR/A-worker-interface.jar ||
+    fail "ijar --persistent_worker output differs"
+}
+
+function test_data_before_zip() {
+  # Tests that the entries are found when something precedes the zip data,
+  # e.g. in a self-extracting archive
+  $JAVAC -g -d $TEST_TMPDIR/classes $IJAR_SRCDIR/test/A.java ||
+    fail "javac failed"
+  $JAR cf $A_JAR -C $TEST_TMPDIR/classes . || fail "jar failed"
+  $IJAR $A_JAR $A_INTERFACE_JAR || fail "ijar failed"
+  local prefixed_jar=$TEST_TMPDIR/A-prefixed.jar
+  local prefixed_interface_jar=$TEST_TMPDIR/A-prefixed-interface.jar
+  (echo "#!/bin/sh"; cat $A_JAR) > $prefixed_jar
+  $IJAR $prefixed_jar $prefixed_interface_jar ||
+    fail "ijar failed on the prefixed jar"
+  cmp $A_INTERFACE_JAR $prefixed_interface_jar ||
+    fail "ijar output differs for the prefixed jar"
+}
+
 function test_class_more_64k() {
   # Tests that ijar can handle class bodies longer than 64K
   # First, generate the input file
@@ -148,6 +148,28 @@ function test_zipper_compression() {
       || fail "Unzip after zipper output differ"
 }
 
+function test_zipper_compression_level() {
+  echo -n > ${TEST_TMPDIR}/a
+  for i in $(seq 1 1000); do
+    echo -n "a" >> ${TEST_TMPDIR}/a
+  done
+  # Level 0 stores the files.
+  $ZIPPER cf ${TEST_TMPDIR}/stored.zip ${TEST_TMPDIR}/a
+  $ZIPPER cCf ${TEST_TMPDIR}/output.zip -l 0 ${TEST_TMPDIR}/a
+  cmp ${TEST_TMPDIR}/stored.zip ${TEST_TMPDIR}/output.zip \
+      || fail "zipper -l 0 compressed the file"
+
+  $ZIPPER cCf ${TEST_TMPDIR}/output.zip -l 1 ${TEST_TMPDIR}/a
+  local out_size=$(cat ${TEST_TMPDIR}/output.zip | wc -c | xargs)
+  local in_size=$(cat ${TEST_TMPDIR}/a | wc -c | xargs)
+  check_gt "${in_size}" "${out_size}" "Output size is greater than input size"
+  rm -fr ${TEST_TMPDIR}/out
+  mkdir -p ${TEST_TMPDIR}/out
+  (cd ${TEST_TMPDIR}/out && $UNZIP -q ${TEST_TMPDIR}/output.zip)
+  diff ${TEST_TMPDIR}/a ${TEST_TMPDIR}/out/a &> $TEST_log \
+      || fail "Unzip after zipper -l 1 output differ"
+}
+
 function test_zipper_specify_path() {
   mkdir -p ${TEST_TMPDIR}/files
   echo "toto" > ${TEST_TMPDIR}/files/a.txt
@@ -168,4 +190,62 @@ function test_zipper_specify_path() {
       || fail "Unzip after zipper output is not expected"
 }
 
+function test_zipper_threads() {
+  mkdir -p ${TEST_TMPDIR}/test/path/to/some
+  mkdir -p ${TEST_TMPDIR}/test/some/other/path
+  touch ${TEST_TMPDIR}/test/path/to/some/empty_file
+  for i in $(seq 1 20); do
+    seq 1 $((i * 100)) > ${TEST_TMPDIR}/test/path/to/some/file$i
+  done
+  echo "tata" > ${TEST_TMPDIR}/test/file
+  filelist="$(cd ${TEST_TMPDIR}/test && find . | sed 's|^./||' | grep -v '^.$')"
+
+  # The output does not depend on the number of threads.
+  (cd ${TEST_TMPDIR}/test && $ZIPPER cC ${TEST_TMPDIR}/output.zip ${filelist})
+  (cd ${TEST_TMPDIR}/test &&
+      $ZIPPER cC ${TEST_TMPDIR}/threads.zip -j 4 ${filelist})
+  cmp ${TEST_TMPDIR}/output.zip ${TEST_TMPDIR}/threads.zip \
+      || fail "zipper -j output differs"
+
+  rm -fr ${TEST_TMPDIR}/out
+  mkdir -p ${TEST_TMPDIR}/out
+  (cd ${TEST_TMPDIR} && $ZIPPER x ${TEST_TMPDIR}/threads.zip -d out -j 4)
+  diff -r ${TEST_TMPDIR}/test ${TEST_TMPDIR}/out &> $TEST_log \
+      || fail "Unzip using zipper -j after zipper output differ"
+}
+
+
+# Writes the length-delimited WorkRequest with given arguments, each of them
+# and the whole request shorter than 128 bytes.
+function write_work_request() {
+  local length=0 arg
+  for arg in "$@"; do
+    length=$((length + 2 + ${#arg}))
+  done
+  printf "\\x$(printf %02x $length)"
+  for arg in "$@"; do
+    printf "\\x0a\\x$(printf %02x ${#arg})%s" "$arg"
+  done
+}
+
+function test_zipper_persistent_worker() {
+  rm -fr ${TEST_TMPDIR}/worker
+  mkdir -p ${TEST_TMPDIR}/worker
+  cd ${TEST_TMPDIR}/worker
+  seq 1 1000 > a
+  $ZIPPER cC expected.zip a
+  # The compression level of the first request does not leak into the
+  # second one, and each request gets an empty (successful) response.
+  { write_work_request cC stored.zip -l 0 a
+    write_work_request cC output.zip a; } |
+    $ZIPPER --persistent_worker >worker_responses ||
+    fail "zipper --persistent_worker failed"
+  [ "$(od -An -tx1 worker_responses | tr -d ' \n')" = "0000" ] ||
+    fail "unexpected work responses"
+  cmp expected.zip output.zip || fail "zipper --persistent_worker output differs"
+  local stored_size=$(cat stored.zip | wc -c | xargs)
+  local out_size=$(cat output.zip | wc -c | xargs)
+  check_gt "${stored_size}" "${out_size}" "-l 0 was used for the second request"
+}
+
 run_suite "zipper tests"
@@ -0,0 +1,462 @@
+// Copyright 2015 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// worker.cc -- persistent worker support for ijar and singlejar.
+//
+// The messages are small, so rather than depending on the protobuf
+// library, this reads and writes the protocol buffer wire format of the
+// few fields it needs directly. Each message is preceded by its length, as
+// a varint.
+//
+
+#include "third_party/ijar/worker.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace devtools_ijar {
+
+// Protocol buffer wire types.
+static const int kVarint = 0;
+static const int kFixed64 = 1;
+static const int kLengthDelimited = 2;
+static const int kFixed32 = 5;
+
+// The fields of WorkRequest and WorkResponse.
+static const int kArgumentsField = 1;
+static const int kInputsField = 2;
+static const int kRequestIdField = 3;
+static const int kInputPathField = 1;
+static const int kInputDigestField = 2;
+static const int kExitCodeField = 1;
+static const int kOutputField = 2;
+
+static void PutVarint(uint64_t value, std::string* out) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+// Reads the varint at *p, advancing *p, or returns false if the input ends
+// before it does.
+static bool GetVarint(const char** p, const char* end, uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+    uint8_t byte = static_cast<uint8_t>(*(*p)++);
+    *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Reads the length of the next message from "in". Returns false at the
+// end of the input.
+static bool ReadLength(FILE* in, uint64_t* length) {
+  *length = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = fgetc(in);
+    if (c == EOF) {
+      return false;
+    }
+    *length |= static_cast<uint64_t>(c & 0x7f) << shift;
+    if ((c & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool IsPersistentWorker(int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--persistent_worker") == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Reads the field at *p, advancing *p past it. Sets "field" to its number,
+// and either "value" to its value if it is a varint, or "data" and "value"
+// to its contents and their length if it is length-delimited; the fixed
+// size fields are skipped. Returns false if the message is malformed.
+static bool GetField(const char** p, const char* end, int* field,
+                     uint64_t* value, const char** data) {
+  uint64_t key;
+  if (!GetVarint(p, end, &key)) {
+    return false;
+  }
+  *field = static_cast<int>(key >> 3);
+  *data = NULL;
+  switch (key & 7) {
+    case kVarint:
+      return GetVarint(p, end, value);
+    case kFixed64:
+    case kFixed32: {
+      size_t size = (key & 7) == kFixed64 ? 8 : 4;
+      if (static_cast<size_t>(end - *p) < size) {
+        return false;
+      }
+      *p += size;
+      *field = 0;
+      return true;
+    }
+    case kLengthDelimited:
+      if (!GetVarint(p, end, value) ||
+          *value > static_cast<uint64_t>(end - *p)) {
+        return false;
+      }
+      *data = *p;
+      *p += *value;
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Parses the Input message of given size at "p".
+static bool ParseInput(const char* p, size_t size, WorkInput* input) {
+  const char* end = p + size;
+  while (p < end) {
+    int field;
+    uint64_t value;
+    const char* data;
+    if (!GetField(&p, end, &field, &value, &data)) {
+      return false;
+    }
+    if (data != NULL && field == kInputPathField) {
+      input->path.assign(data, value);
+    } else if (data != NULL && field == kInputDigestField) {
+      input->digest.assign(data, value);
+    }
+  }
+  return true;
+}
+
+bool ParseWorkRequest(const std::string& message,
+                      std::vector<std::string>* arguments,
+                      std::vector<WorkInput>* inputs, int* request_id) {
+  arguments->clear();
+  inputs->clear();
+  *request_id = 0;
+  const char* p = message.data();
+  const char* end = p + message.size();
+  while (p < end) {
+    int field;
+    uint64_t value;
+    const char* data;
+    if (!GetField(&p, end, &field, &value, &data)) {
+      return false;
+    }
+    if (data == NULL) {
+      if (field == kRequestIdField) {
+        // An int32, sign-extended to 64 bits if negative.
+        *request_id = static_cast<int>(static_cast<int64_t>(value));
+      }
+    } else if (field == kArgumentsField) {
+      arguments->push_back(std::string(data, value));
+    } else if (field == kInputsField) {
+      inputs->push_back(WorkInput());
+      if (!ParseInput(data, value, &inputs->back())) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Appends the int32 field with given value, unless it is 0.
+static void PutInt32Field(int field, int value, std::string* message) {
+  if (value != 0) {
+    PutVarint(field << 3 | kVarint, message);
+    // A negative int32 is sign-extended to 64 bits.
+    PutVarint(static_cast<uint64_t>(static_cast<int64_t>(value)), message);
+  }
+}
+
+std::string SerializeWorkResponse(int exit_code, const std::string& output,
+                                  int request_id) {
+  // The fields having the default value are omitted, as in proto3.
+  std::string message;
+  PutInt32Field(kExitCodeField, exit_code, &message);
+  if (!output.empty()) {
+    PutVarint(kOutputField << 3 | kLengthDelimited, &message);
+    PutVarint(output.size(), &message);
+    message += output;
+  }
+  PutInt32Field(kRequestIdField, request_id, &message);
+  return message;
+}
+
+// Writes the message preceded by its length to "out".
+static bool WriteDelimited(const std::string& message, FILE* out) {
+  std::string delimited;
+  PutVarint(message.size(), &delimited);
+  delimited += message;
+  return fwrite(delimited.data(), 1, delimited.size(), out) ==
+             delimited.size() &&
+         fflush(out) == 0;
+}
+
+// Reads the next length-delimited message from "in". Returns false at the
+// end of the input, or if it ends within the message.
+static bool ReadDelimited(FILE* in, std::string* message) {
+  uint64_t length;
+  if (!ReadLength(in, &length)) {
+    return false;
+  }
+  message->assign(length, 0);
+  return fread(&(*message)[0], 1, length, in) == length;
+}
+
+// The tools exit or abort on fatal errors, so the requests are worked on
+// in a child process, which is kept for the requests that follow, along
+// with whatever the tool caches in memory. The parent forwards each request
+// to it and gets back the exit code; everything the child writes to its
+// stdout and stderr goes through a pipe and becomes the output of the
+// response. If the child terminates in the middle of a request, the parent
+// answers it with a failure and starts another child for the next one.
+struct Child {
+  pid_t pid;
+  FILE* requests;  // The requests to the child.
+  FILE* results;   // The exit codes of the requests, as varints.
+  int output_fd;   // The stdout and stderr of the child.
+};
+
+// The loop of the child: reads the requests from "requests" until it is
+// closed and writes their exit codes to "results".
+static void ChildLoop(const WorkFunction& work, FILE* requests,
+                      FILE* results) {
+  std::string message;
+  while (ReadDelimited(requests, &message)) {
+    std::vector<std::string> arguments;
+    std::vector<WorkInput> inputs;
+    int request_id;
+    ParseWorkRequest(message, &arguments, &inputs, &request_id);
+    int exit_code = work(arguments, inputs);
+    fflush(stdout);
+    fflush(stderr);
+    std::string result;
+    PutVarint(static_cast<uint32_t>(exit_code), &result);
+    if (fwrite(result.data(), 1, result.size(), results) != result.size() ||
+        fflush(results) != 0) {
+      break;
+    }
+  }
+  exit(0);
+}
+
+// Forks the child. Returns false if it cannot be started.
+static bool StartChild(const WorkFunction& work, FILE* responses,
+                       Child* child) {
+  int request_pipe[2], result_pipe[2], output_pipe[2];
+  if (pipe(request_pipe) < 0) {
+    perror("pipe");
+    return false;
+  }
+  if (pipe(result_pipe) < 0) {
+    perror("pipe");
+    close(request_pipe[0]);
+    close(request_pipe[1]);
+    return false;
+  }
+  if (pipe(output_pipe) < 0) {
+    perror("pipe");
+    close(request_pipe[0]);
+    close(request_pipe[1]);
+    close(result_pipe[0]);
+    close(result_pipe[1]);
+    return false;
+  }
+  fflush(stdout);
+  fflush(stderr);
+  child->pid = fork();
+  if (child->pid < 0) {
+    perror("fork");
+    for (int fd : {request_pipe[0], request_pipe[1], result_pipe[0],
+                   result_pipe[1], output_pipe[0], output_pipe[1]}) {
+      close(fd);
+    }
+    return false;
+  }
+  if (child->pid == 0) {
+    signal(SIGPIPE, SIG_DFL);
+    fclose(responses);
+    close(request_pipe[1]);
+    close(result_pipe[0]);
+    close(output_pipe[0]);
+    dup2(output_pipe[1], 1);
+    dup2(output_pipe[1], 2);
+    close(output_pipe[1]);
+    ChildLoop(work, fdopen(request_pipe[0], "r"), fdopen(result_pipe[1], "w"));
+  }
+  close(request_pipe[0]);
+  close(result_pipe[1]);
+  close(output_pipe[1]);
+  child->requests = fdopen(request_pipe[1], "w");
+  child->results = fdopen(result_pipe[0], "r");
+  child->output_fd = output_pipe[0];
+  return true;
+}
+
+// Closes the pipes to the child and waits for it to terminate. Returns
+// the exit code to report for a request it has not finished.
+static int StopChild(Child* child, std::string* output) {
+  fclose(child->requests);
+  fclose(child->results);
+  close(child->output_fd);
+  int status;
+  while (waitpid(child->pid, &status, 0) < 0 && errno == EINTR) {
+  }
+  child->pid = -1;
+  if (WIFSIGNALED(status)) {
+    *output += "Terminated by signal " + std::to_string(WTERMSIG(status)) +
+               "\n";
+    return 128 + WTERMSIG(status);
+  }
+  int exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+  return exit_code != 0 ? exit_code : 1;
+}
+
+// Sends the request to the child and collects its output until it has
+// finished. Returns its exit code.
+static int RunInChild(Child* child, const std::string& message,
+                      std::string* output) {
+  if (!WriteDelimited(message, child->requests)) {
+    // The child is gone, its output says why.
+    *output += "Cannot send the work request to the worker process\n";
+  }
+  // The result comes after all the output; the pipes are read alternately,
+  // so that the child never blocks on a full output pipe.
+  int result_fd = fileno(child->results);
+  bool output_open = true;
+  for (;;) {
+    struct pollfd fds[2] = {{child->output_fd, POLLIN, 0},
+                            {result_fd, POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      return StopChild(child, output);
+    }
+    if (fds[0].revents != 0) {
+      char buffer[4096];
+      ssize_t n = read(child->output_fd, buffer, sizeof(buffer));
+      if (n > 0) {
+        output->append(buffer, n);
+        continue;
+      }
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      // The child has terminated, the result pipe is closed too.
+      output_open = false;
+    }
+    if (!output_open || fds[1].revents != 0) {
+      break;
+    }
+  }
+  uint64_t exit_code;  // A varint, like the lengths.
+  if (!output_open || !ReadLength(child->results, &exit_code)) {
+    return StopChild(child, output);
+  }
+  // Whatever is still in the output pipe was written before the result.
+  for (;;) {
+    struct pollfd fd = {child->output_fd, POLLIN, 0};
+    char buffer[4096];
+    ssize_t n;
+    if (poll(&fd, 1, 0) <= 0 ||
+        (n = read(child->output_fd, buffer, sizeof(buffer))) <= 0) {
+      break;
+    }
+    output->append(buffer, n);
+  }
+  return static_cast<int>(static_cast<uint32_t>(exit_code));
+}
+
+int RunPersistentWorker(
+    const std::function<int(const std::vector<std::string>&)>& work) {
+  return RunPersistentWorker(
+      WorkFunction([&work](const std::vector<std::string>& arguments,
+                           const std::vector<WorkInput>&) {
+        return work(arguments);
+      }));
+}
+
+int RunPersistentWorker(const WorkFunction& work) {
+  // The responses go to the original stdout, anything else written there
+  // would break the protocol.
+  FILE* responses = fdopen(dup(1), "w");
+  if (responses == NULL) {
+    perror("fdopen");
+    return 1;
+  }
+  dup2(2, 1);
+  // A child that is gone is noticed when its pipes are closed.
+  signal(SIGPIPE, SIG_IGN);
+  Child child = {-1, NULL, NULL, -1};
+  int worker_exit_code = 0;
+  uint64_t length;
+  while (ReadLength(stdin, &length)) {
+    std::string message(length, 0);
+    if (fread(&message[0], 1, length, stdin) != length) {
+      fprintf(stderr, "Cannot read the work request\n");
+      worker_exit_code = 1;
+      break;
+    }
+    std::vector<std::string> arguments;
+    std::vector<WorkInput> inputs;
+    int request_id;
+    int exit_code;
+    std::string output;
+    if (!ParseWorkRequest(message, &arguments, &inputs, &request_id)) {
+      // The request itself is answered with a failure, the next one is
+      // still delimited.
+      exit_code = 1;
+      output = "Cannot parse the work request\n";
+    } else if (child.pid < 0 && !StartChild(work, responses, &child)) {
+      exit_code = 1;
+      output = "Cannot start the worker process\n";
+    } else {
+      exit_code = RunInChild(&child, message, &output);
+    }
+    if (!WriteDelimited(SerializeWorkResponse(exit_code, output, request_id),
+                        responses)) {
+      perror("Cannot write the work response");
+      worker_exit_code = 1;
+      break;
+    }
+  }
+  if (child.pid >= 0) {
+    std::string output;
+    StopChild(&child, &output);
+  }
+  fclose(responses);
+  return worker_exit_code;
+}
+
+}  // namespace devtools_ijar
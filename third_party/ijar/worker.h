@@ -0,0 +1,78 @@
+// Copyright 2015 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// worker.h -- persistent worker support for ijar and singlejar.
+//
+
+#ifndef INCLUDED_THIRD_PARTY_IJAR_WORKER_H
+#define INCLUDED_THIRD_PARTY_IJAR_WORKER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace devtools_ijar {
+
+// True if the tool has been started as a persistent worker, i.e. with the
+// --persistent_worker flag.
+bool IsPersistentWorker(int argc, char** argv);
+
+// An input of a WorkRequest: the path of the file and its digest, as
+// computed by Bazel (empty if it did not send one). The digest changes
+// whenever the contents of the file do.
+struct WorkInput {
+  std::string path;
+  std::string digest;
+};
+
+// Does the work of a request, given its arguments and inputs, and returns
+// the exit code.
+typedef std::function<int(const std::vector<std::string>&,
+                          const std::vector<WorkInput>&)>
+    WorkFunction;
+
+// Runs the tool as a persistent worker: reads the WorkRequests (see
+// src/main/protobuf/worker_protocol.proto) from stdin until it is closed,
+// calls "work" with the arguments of each request, and writes the
+// WorkResponse with the exit code returned by "work" to stdout. Whatever
+// is written to stdout and stderr while "work" runs is returned as the
+// output of the response. The tools write to the process-wide stdout and
+// stderr, so the requests run one at a time; requests that have an id get
+// it back in their response. "work" runs in a child process, which is kept
+// from one request to the next; if it exits or aborts, the request gets a
+// response with a non-zero exit code and another child takes the next one.
+// A request which is not a valid WorkRequest gets a failure response too.
+// Returns the exit code of the worker: 0 once stdin is closed, 1 if a
+// request cannot be read or a response cannot be written.
+int RunPersistentWorker(
+    const std::function<int(const std::vector<std::string>&)>& work);
+
+// As above, but also passes the inputs of each request to "work", so that
+// it can reuse what it has computed for inputs it has already seen.
+int RunPersistentWorker(const WorkFunction& work);
+
+// The arguments, inputs and request_id of the WorkRequest "message".
+// Returns false if it is not a valid WorkRequest.
+bool ParseWorkRequest(const std::string& message,
+                      std::vector<std::string>* arguments,
+                      std::vector<WorkInput>* inputs, int* request_id);
+
+// The WorkResponse message.
+std::string SerializeWorkResponse(int exit_code, const std::string& output,
+                                  int request_id);
+
+}  // namespace devtools_ijar
+
+#endif  // INCLUDED_THIRD_PARTY_IJAR_WORKER_H
@@ -33,6 +33,7 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <limits.h>
+#include <algorithm>
 #include <limits>
 #include <vector>
 
@@ -48,6 +49,14 @@
 #define EOCD_SIGNATURE                0x06054b50
 #define DATA_DESCRIPTOR_SIGNATURE     0x08074b50
 
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define ALIGNMENT_EXTRA_FIELD_TAG 0xd935
+// tag, payload size and alignment
+#define ALIGNMENT_EXTRA_FIELD_MIN_SIZE 6
+
 #define U2_MAX 0xffff
 #define U4_MAX 0xffffffffUL
 
@@ -97,8 +106,6 @@ class InputZipFile : public ZipExtractor {
     return input_file_->Length();
   }
 
-  virtual u8 CalculateOutputLength();
-
   virtual bool ProcessCentralDirEntry(const u1 *&p, size_t *compressed_size,
                                       size_t *uncompressed_size, char *filename,
                                       size_t filename_size, u4 *attr,
@@ -122,15 +129,16 @@ class InputZipFile : public ZipExtractor {
 
   const u1* central_dir_current_;  // central dir input cursor
 
-  // Buffer size is initially INITIAL_BUFFER_SIZE. It doubles in size every
-  // time it is found too small, until it reaches MAX_BUFFER_SIZE. If that is
-  // not enough, we bail out. We only decompress class files, so they should
-  // be smaller than 64K anyway, but we give a little leeway.
-  // MAX_BUFFER_SIZE must be bigger than the size of the biggest file in the
-  // ZIP. It is set to 2GB here because no one has audited the code for 64-bit
-  // cleanliness.
+  // True if the local headers are in the same order as the central
+  // directory entries, the input that was read can then be unmapped.
+  bool local_headers_in_order_;
+
+  // Buffer size is initially INITIAL_BUFFER_SIZE. Before a file is
+  // decompressed, it is grown to the uncompressed size recorded in the ZIP,
+  // so it is reallocated at most once per file, and only for a file bigger
+  // than any seen before. If the recorded size turns out to be too small,
+  // the buffer doubles in size until the file fits.
   static const size_t INITIAL_BUFFER_SIZE = 256 * 1024;  // 256K
-  static const size_t MAX_BUFFER_SIZE = std::numeric_limits<int32_t>::max();
   static const size_t MAX_MAPPED_REGION = 32 * 1024 * 1024;
 
   // These metadata fields are the fields of the ZIP header of the file being
@@ -151,6 +159,8 @@ class InputZipFile : public ZipExtractor {
   // can call realloc.
   u1 *uncompressed_data_;
   size_t uncompressed_data_allocated_;
+  // The zlib state, reused for each file.
+  Inflater inflater_;
 
   // Copy of the last filename entry - Null-terminated.
   char filename[PATH_MAX];
@@ -182,7 +192,12 @@ class InputZipFile : public ZipExtractor {
     return 0;
   }
 
-  // Read one entry from input zip file
+  // Returns the local header at given offset from the central directory,
+  // or NULL if there is none.
+  const u1 *LocalHeader(u4 offset);
+
+  // Read one entry from input zip file, p points past the signature of its
+  // local header.
   int ProcessLocalFileEntry(size_t compressed_size, size_t uncompressed_size);
 
   // Uncompress a file from the archive using zlib. The pointer returned
@@ -190,13 +205,64 @@ class InputZipFile : public ZipExtractor {
   // cursor to the first byte after the compressed data.
   u1* UncompressFile();
 
-  // Skip a file
-  int SkipFile(const bool compressed);
+  // Grows the buffer for decompressed data to at least given size.
+  bool ReserveUncompressedData(size_t size);
 
   // Process a file
   int ProcessFile(const bool compressed);
 };
 
+// Returns the length of the alignment extra field that makes the data, at
+// data_offset without the field, start at a multiple of the alignment, or
+// 0 if it does already.
+static u2 AlignmentPadding(u8 data_offset, u2 alignment) {
+  if (alignment <= 1) {
+    return 0;
+  }
+  u2 padding = (alignment - data_offset % alignment) % alignment;
+  while (padding != 0 && padding < ALIGNMENT_EXTRA_FIELD_MIN_SIZE) {
+    padding += alignment;
+  }
+  return padding;
+}
+
+// Writes the alignment extra field of given length (as returned by
+// AlignmentPadding()).
+static void PutAlignmentExtraField(u1 *&q, u2 length, u2 alignment) {
+  put_u2le(q, ALIGNMENT_EXTRA_FIELD_TAG);
+  put_u2le(q, length - 4);
+  put_u2le(q, alignment);
+  memset(q, 0, length - ALIGNMENT_EXTRA_FIELD_MIN_SIZE);
+  q += length - ALIGNMENT_EXTRA_FIELD_MIN_SIZE;
+}
+
+// An entry of the output zip file, as recorded in the central directory.
+struct LocalFileEntry {
+  // Start of the local header (in the output buffer).
+  size_t local_header_offset;
+
+  // Sizes of the file entry
+  size_t uncompressed_length;
+  size_t compressed_length;
+
+  // Compression method
+  u2 compression_method;
+
+  // CRC32
+  u4 crc32;
+
+  // external attributes field
+  u4 external_attr;
+
+  // Start/length of the file_name in the local header.
+  u1 *file_name;
+  u2 file_name_length;
+
+  // Start/length of the extra_field in the local header.
+  const u1 *extra_field;
+  u2 extra_field_length;
+};
+
 //
 // A class implementing ZipBuilder that represent an open zip file for writing.
 //
@@ -206,7 +272,8 @@ class OutputZipFile : public ZipBuilder {
       output_file_(NULL),
       filename_(filename),
       estimated_size_(estimated_size),
-      finished_(false) {
+      finished_(false),
+      alignment_(0) {
     errmsg[0] = 0;
   }
 
@@ -221,6 +288,9 @@ class OutputZipFile : public ZipBuilder {
   virtual u1* NewFile(const char* filename, const u4 attr);
   virtual int FinishFile(size_t filelength, bool compress = false,
                          bool compute_crc = false);
+  virtual void SetAlignment(u2 alignment) { alignment_ = alignment; }
+  virtual int AddPreparedFile(const char* filename, const u4 attr,
+                              const PreparedFile& file);
   virtual int WriteEmptyFile(const char *filename);
   virtual size_t GetSize() {
     return Offset(q);
@@ -232,36 +302,11 @@ class OutputZipFile : public ZipBuilder {
   bool Open();
 
  private:
-  struct LocalFileEntry {
-    // Start of the local header (in the output buffer).
-    size_t local_header_offset;
-
-    // Sizes of the file entry
-    size_t uncompressed_length;
-    size_t compressed_length;
-
-    // Compression method
-    u2 compression_method;
-
-    // CRC32
-    u4 crc32;
-
-    // external attributes field
-    u4 external_attr;
-
-    // Start/length of the file_name in the local header.
-    u1 *file_name;
-    u2 file_name_length;
-
-    // Start/length of the extra_field in the local header.
-    const u1 *extra_field;
-    u2 extra_field_length;
-  };
-
   MappedOutputFile* output_file_;
   const char* filename_;
   u8 estimated_size_;
   bool finished_;
+  u2 alignment_;
 
   // OutputZipFile is responsible for maintaining the following
   // pointers. They are allocated by the Create() method before
@@ -313,35 +358,44 @@ class OutputZipFile : public ZipBuilder {
 // Implementation of InputZipFile
 //
 bool InputZipFile::ProcessNext() {
-  // Process the next entry in the central directory. Also make sure that the
-  // content pointer is in sync.
+  // The central directory drives the iteration, and the local header of an
+  // entry is found through the offset recorded there. The entries that are
+  // not accepted are therefore skipped without touching their local header
+  // and data, or having to find where the data ends.
   size_t compressed, uncompressed;
   u4 offset;
   if (!ProcessCentralDirEntry(central_dir_current_, &compressed, &uncompressed,
                               filename, PATH_MAX, &attr, &offset)) {
     return false;
   }
-
-  // There might be an offset specified in the central directory that does
-  // not match the file offset, if so, correct the pointer.
-  if (offset != 0 && (p != (zipdata_in_ + in_offset_ + offset))) {
-    p = zipdata_in_ + offset;
+  if (!processor->Accept(filename, attr)) {
+    return true;
   }
 
-  if (EnsureRemaining(4, "signature") < 0) {
-    return false;
-  }
-  u4 signature = get_u4le(p);
-  if (signature == LOCAL_FILE_HEADER_SIGNATURE) {
-    if (ProcessLocalFileEntry(compressed, uncompressed) < 0) {
-      return false;
-    }
-  } else {
+  p = LocalHeader(offset);
+  if (p == NULL) {
     error("local file header signature for file %s not found\n", filename);
     return false;
   }
+  p += 4;  // skip the signature
+  return ProcessLocalFileEntry(compressed, uncompressed) == 0;
+}
 
-  return true;
+const u1 *InputZipFile::LocalHeader(u4 offset) {
+  // The offsets are relative to the start of the archive, which is not the
+  // start of the file if something was prepended to it. Some tools adjust
+  // the offsets of the entries for that, but not the offset of the central
+  // directory, so also try the offset as if it were relative to the file.
+  size_t length = input_file_->Length();
+  size_t candidates[] = {in_offset_ + offset, offset};
+  for (size_t candidate : candidates) {
+    const u1 *header = zipdata_in_ + candidate;
+    if (candidate < length && length - candidate >= 4 &&
+        get_u4le(header) == LOCAL_FILE_HEADER_SIGNATURE) {
+      return zipdata_in_ + candidate;
+    }
+  }
+  return NULL;
 }
 
 int InputZipFile::ProcessLocalFileEntry(
@@ -406,113 +460,97 @@ int InputZipFile::ProcessLocalFileEntry(
     }
   }
 
-  if (processor->Accept(filename, attr)) {
-    if (ProcessFile(is_compressed) < 0) {
-      return -1;
-    }
-  } else {
-    if (SkipFile(is_compressed) < 0) {
-      return -1;
-    }
-  }
-
-  if (general_purpose_bit_flag_ & GENERAL_PURPOSE_BIT_FLAG_COMPRESSED) {
-    // Skip the data descriptor. Some implementations do not put the signature
-    // here, so check if the next 4 bytes are a signature, and if so, skip the
-    // next 12 bytes (for CRC, compressed/uncompressed size), otherwise skip
-    // the next 8 bytes (because the value just read was the CRC).
-    u4 signature = get_u4le(p);
-    if (signature == DATA_DESCRIPTOR_SIGNATURE) {
-      p += 4 * 3;
-    } else {
-      p += 4 * 2;
-    }
+  if (ProcessFile(is_compressed) < 0) {
+    return -1;
   }
 
+  // The data descriptor, if any, is not needed: the next local header is
+  // found through the central directory. The input before the cursor is
+  // unmapped in whole regions, as many as there are, so that a big entry does
+  // not leave the mapping trailing behind.
   size_t bytes_processed = p - zipdata_in_;
-  if (bytes_processed > bytes_unmapped_ + MAX_MAPPED_REGION) {
-    input_file_->Discard(MAX_MAPPED_REGION);
-    bytes_unmapped_ += MAX_MAPPED_REGION;
+  if (local_headers_in_order_ &&
+      bytes_processed > bytes_unmapped_ + MAX_MAPPED_REGION) {
+    size_t bytes_to_unmap = (bytes_processed - bytes_unmapped_) /
+                            MAX_MAPPED_REGION * MAX_MAPPED_REGION;
+    input_file_->Discard(bytes_to_unmap);
+    bytes_unmapped_ += bytes_to_unmap;
   }
 
   return 0;
 }
 
-int InputZipFile::SkipFile(const bool compressed) {
-  if (!compressed) {
-    // In this case, compressed_size_ == uncompressed_size_ (since the file is
-    // uncompressed), so we can use either.
-    if (compressed_size_ != uncompressed_size_) {
-      return error("compressed size != uncompressed size, although the file "
-                   "is uncompressed.\n");
-    }
-  }
+// zlib counts the bytes in uInt, so the input and the output are fed to it
+// in pieces of at most this many bytes.
+static const size_t kMaxInflateChunk = 1 << 30;
 
-  if (EnsureRemaining(compressed_size_, "file_data") < 0) {
-    return -1;
+bool InputZipFile::ReserveUncompressedData(size_t size) {
+  if (size <= uncompressed_data_allocated_) {
+    return true;
   }
-  p += compressed_size_;
-  return 0;
+  u1 *new_data = reinterpret_cast<u1*>(realloc(uncompressed_data_, size));
+  if (new_data == NULL) {
+    error("cannot allocate %zu bytes to decompress %s\n", size, filename);
+    return false;
+  }
+  uncompressed_data_ = new_data;
+  uncompressed_data_allocated_ = size;
+  return true;
 }
 
 u1* InputZipFile::UncompressFile() {
   size_t in_offset = p - zipdata_in_;
   size_t remaining = input_file_->Length() - in_offset;
-  z_stream stream;
-
-  stream.zalloc = Z_NULL;
-  stream.zfree = Z_NULL;
-  stream.opaque = Z_NULL;
-  stream.avail_in = remaining;
-  stream.next_in = (Bytef *) p;
+  z_stream *stream = inflater_.Reset();
+  if (stream == NULL) {
+    error("inflateInit failed\n");
+    return NULL;
+  }
+  stream->avail_in = 0;
+  stream->next_in = (Bytef *) p;
 
-  int ret = inflateInit2(&stream, -MAX_WBITS);
-  if (ret != Z_OK) {
-    error("inflateInit: %d\n", ret);
+  // One byte more than recorded, so that a file of the recorded size ends
+  // without the buffer being found too small.
+  if (!ReserveUncompressedData(static_cast<size_t>(uncompressed_size_) + 1)) {
     return NULL;
   }
 
-  int uncompressed_until_now = 0;
+  size_t uncompressed_until_now = 0;
 
   while (true) {
-    stream.avail_out = uncompressed_data_allocated_ - uncompressed_until_now;
-    stream.next_out = uncompressed_data_ + uncompressed_until_now;
-    int old_avail_out = stream.avail_out;
+    if (stream->avail_in == 0) {
+      size_t consumed = reinterpret_cast<const u1*>(stream->next_in) - p;
+      stream->avail_in = std::min(remaining - consumed, kMaxInflateChunk);
+    }
+    stream->avail_out = std::min(
+        uncompressed_data_allocated_ - uncompressed_until_now,
+        kMaxInflateChunk);
+    stream->next_out = uncompressed_data_ + uncompressed_until_now;
+    size_t old_avail_out = stream->avail_out;
 
-    ret = inflate(&stream, Z_SYNC_FLUSH);
-    int uncompressed_now = old_avail_out - stream.avail_out;
-    uncompressed_until_now += uncompressed_now;
+    int ret = inflate(stream, Z_SYNC_FLUSH);
+    uncompressed_until_now += old_avail_out - stream->avail_out;
 
     switch (ret) {
       case Z_STREAM_END: {
         // zlib said that there is no more data to decompress.
 
-        u1 *new_p = reinterpret_cast<u1*>(stream.next_in);
+        u1 *new_p = reinterpret_cast<u1*>(stream->next_in);
         compressed_size_ = new_p - p;
         uncompressed_size_ = uncompressed_until_now;
         p = new_p;
-        inflateEnd(&stream);
         return uncompressed_data_;
       }
 
       case Z_OK: {
-        // zlib said that there is no more room in the buffer allocated for
-        // the decompressed data. Enlarge that buffer and try again.
+        // zlib said that there is no more room in the piece of the buffer it
+        // was given, or it needs more input. Enlarge the buffer if it is
+        // full and try again.
 
-        if (uncompressed_data_allocated_ == MAX_BUFFER_SIZE) {
-          error("ijar does not support decompressing files "
-                "larger than %dMB.\n",
-                (int) (MAX_BUFFER_SIZE/(1024*1024)));
+        if (uncompressed_until_now == uncompressed_data_allocated_ &&
+            !ReserveUncompressedData(2 * uncompressed_data_allocated_)) {
           return NULL;
         }
-
-        uncompressed_data_allocated_ *= 2;
-        if (uncompressed_data_allocated_ > MAX_BUFFER_SIZE) {
-          uncompressed_data_allocated_ = MAX_BUFFER_SIZE;
-        }
-
-        uncompressed_data_ = reinterpret_cast<u1*>(
-            realloc(uncompressed_data_, uncompressed_data_allocated_));
         break;
       }
 
@@ -531,6 +569,15 @@ u1* InputZipFile::UncompressFile() {
 int InputZipFile::ProcessFile(const bool compressed) {
   const u1 *file_data;
   if (compressed) {
+    // The sizes come from the central directory if the local header does
+    // not have them, so the processor can be trusted with them.
+    size_t remaining = input_file_->Length() - (p - zipdata_in_);
+    if (compressed_size_ <= remaining &&
+        processor->ProcessCompressed(filename, attr, p, compressed_size_,
+                                     uncompressed_size_)) {
+      p += compressed_size_;
+      return 0;
+    }
     file_data = UncompressFile();
     if (file_data == NULL) {
       return -1;
@@ -546,6 +593,11 @@ int InputZipFile::ProcessFile(const bool compressed) {
     if (EnsureRemaining(compressed_size_, "file_data") < 0) {
       return -1;
     }
+    if (processor->ProcessStored(filename, attr, p - zipdata_in_,
+                                 uncompressed_size_)) {
+      p += compressed_size_;
+      return 0;
+    }
     file_data = p;
     p += compressed_size_;
   }
@@ -554,6 +606,71 @@ int InputZipFile::ProcessFile(const bool compressed) {
 }
 
 
+bool Inflate(const u1* in, size_t in_length, size_t expected_length,
+             std::vector<u1>* out) {
+  Inflater inflater;
+  return inflater.Inflate(in, in_length, expected_length, out);
+}
+
+Inflater::Inflater() : stream_(NULL) {}
+
+Inflater::~Inflater() {
+  if (stream_ != NULL) {
+    inflateEnd(stream_);
+    delete stream_;
+  }
+}
+
+z_stream* Inflater::Reset() {
+  if (stream_ != NULL) {
+    return inflateReset(stream_) == Z_OK ? stream_ : NULL;
+  }
+  z_stream* stream = new z_stream;
+  stream->zalloc = Z_NULL;
+  stream->zfree = Z_NULL;
+  stream->opaque = Z_NULL;
+  stream->avail_in = 0;
+  stream->next_in = Z_NULL;
+  if (inflateInit2(stream, -MAX_WBITS) != Z_OK) {
+    delete stream;
+    return NULL;
+  }
+  stream_ = stream;
+  return stream_;
+}
+
+bool Inflater::Inflate(const u1* in, size_t in_length, size_t expected_length,
+                       std::vector<u1>* out) {
+  z_stream* stream = Reset();
+  if (stream == NULL) {
+    return false;
+  }
+  stream->avail_in = 0;
+  stream->next_in = const_cast<Bytef *>(in);
+  // One byte more than expected, so that the stream of the expected length
+  // ends without the output being found too small.
+  out->resize(expected_length + 1);
+  size_t in_left = in_length;
+  size_t out_length = 0;
+  int ret;
+  do {
+    if (out_length == out->size()) {
+      out->resize(2 * out->size());
+    }
+    if (stream->avail_in == 0) {
+      stream->avail_in = std::min(in_left, kMaxInflateChunk);
+      in_left -= stream->avail_in;
+    }
+    stream->next_out = out->data() + out_length;
+    stream->avail_out = std::min(out->size() - out_length, kMaxInflateChunk);
+    size_t old_avail_out = stream->avail_out;
+    ret = inflate(stream, Z_NO_FLUSH);
+    out_length += old_avail_out - stream->avail_out;
+  } while (ret == Z_OK);
+  out->resize(out_length);
+  return ret == Z_STREAM_END;
+}
+
 // Reads and returns some metadata of the next file from the central directory:
 // - compressed size
 // - uncompressed size
@@ -600,42 +717,6 @@ bool InputZipFile::ProcessCentralDirEntry(const u1 *&p, size_t *compressed_size,
   return true;
 }
 
-// Gives a maximum bound on the size of the interface JAR. Basically, adds
-// the difference between the compressed and uncompressed sizes to the size
-// of the input file.
-u8 InputZipFile::CalculateOutputLength() {
-  const u1* current = central_dir_;
-
-  u8 compressed_size = 0;
-  u8 uncompressed_size = 0;
-  u8 skipped_compressed_size = 0;
-  u4 attr;
-  u4 offset;
-  char filename[PATH_MAX];
-
-  while (true) {
-    size_t file_compressed, file_uncompressed;
-    if (!ProcessCentralDirEntry(current,
-                                &file_compressed, &file_uncompressed,
-                                filename, PATH_MAX, &attr, &offset)) {
-      break;
-    }
-
-    if (processor->Accept(filename, attr)) {
-      compressed_size += (u8) file_compressed;
-      uncompressed_size += (u8) file_uncompressed;
-    } else {
-      skipped_compressed_size += file_compressed;
-    }
-  }
-
-  // The worst case is when the output is simply the input uncompressed. The
-  // metadata in the zip file will stay the same, so the file will grow by the
-  // difference between the compressed and uncompressed sizes.
-  return (u8) input_file_->Length() - skipped_compressed_size
-      + (uncompressed_size - compressed_size);
-}
-
 // An end of central directory record, sized for optional zip64 contents.
 struct EndOfCentralDirectoryRecord {
   u4 number_of_this_disk;
@@ -895,6 +976,20 @@ bool InputZipFile::Open() {
   central_dir_ = central_dir;
   central_dir_current_ = central_dir;
   p = zipdata_in_ + in_offset_;
+
+  local_headers_in_order_ = true;
+  const u1 *current = central_dir_;
+  u4 last_offset = 0;
+  while (local_headers_in_order_) {
+    size_t compressed, uncompressed;
+    u4 attr, offset;
+    if (!ProcessCentralDirEntry(current, &compressed, &uncompressed, filename,
+                                PATH_MAX, &attr, &offset)) {
+      break;
+    }
+    local_headers_in_order_ = offset >= last_offset;
+    last_offset = offset;
+  }
   errmsg[0] = 0;
   return true;
 }
@@ -946,11 +1041,14 @@ int OutputZipFile::WriteEmptyFile(const char *filename) {
   return 0;
 }
 
-void OutputZipFile::WriteCentralDirectory() {
+// Writes the central directory of given entries to q, advancing it. The
+// central directory starts at given offset of the output file.
+static void WriteCentralDirectory(const std::vector<LocalFileEntry*> &entries,
+                                  u8 start_offset, u1 *&q) {
   // central directory:
   const u1 *central_directory_start = q;
-  for (size_t ii = 0; ii < entries_.size(); ++ii) {
-    LocalFileEntry *entry = entries_[ii];
+  for (size_t ii = 0; ii < entries.size(); ++ii) {
+    LocalFileEntry *entry = entries[ii];
     put_u4le(q, CENTRAL_FILE_HEADER_SIGNATURE);
     put_u2le(q, 0);  // version made by
 
@@ -977,8 +1075,8 @@ void OutputZipFile::WriteCentralDirectory() {
   }
   u8 central_directory_size = q - central_directory_start;
 
-  if (entries_.size() > U2_MAX || central_directory_size > U4_MAX ||
-      Offset(central_directory_start) > U4_MAX) {
+  if (entries.size() > U2_MAX || central_directory_size > U4_MAX ||
+      start_offset > U4_MAX) {
     u1 *zip64_end_of_central_directory_start = q;
 
     put_u4le(q, ZIP64_EOCD_SIGNATURE);
@@ -988,17 +1086,18 @@ void OutputZipFile::WriteCentralDirectory() {
     put_u2le(q, 0);  // version needed to extract
     put_u4le(q, 0);  // number of this disk
     put_u4le(q, 0);  // # of the disk with the start of the central directory
-    put_u8le(q, entries_.size());  // # central dir entries on this disk
-    put_u8le(q, entries_.size());  // total # entries in the central directory
+    put_u8le(q, entries.size());  // # central dir entries on this disk
+    put_u8le(q, entries.size());  // total # entries in the central directory
     put_u8le(q, central_directory_size);  // size of the central directory
     // offset of start of central directory wrt starting disk
-    put_u8le(q, Offset(central_directory_start));
+    put_u8le(q, start_offset);
 
     put_u4le(q, ZIP64_EOCD_LOCATOR_SIGNATURE);
     // number of the disk with the start of the zip64 end of central directory
     put_u4le(q, 0);
     // relative offset of the zip64 end of central directory record
-    put_u8le(q, Offset(zip64_end_of_central_directory_start));
+    put_u8le(q, start_offset + (zip64_end_of_central_directory_start -
+                                central_directory_start));
     // total number of disks
     put_u4le(q, 1);
 
@@ -1006,31 +1105,33 @@ void OutputZipFile::WriteCentralDirectory() {
     put_u2le(q, 0);  // number of this disk
     put_u2le(q, 0);  // # of disk with the start of the central directory
     // # central dir entries on this disk
-    put_u2le(q, entries_.size() > 0xffff ? 0xffff : entries_.size());
+    put_u2le(q, entries.size() > 0xffff ? 0xffff : entries.size());
     // total # entries in the central directory
-    put_u2le(q, entries_.size() > 0xffff ? 0xffff : entries_.size());
+    put_u2le(q, entries.size() > 0xffff ? 0xffff : entries.size());
     // size of the central directory
     put_u4le(q,
              central_directory_size > U4_MAX ? U4_MAX : central_directory_size);
     // offset of start of central
-    put_u4le(q, Offset(central_directory_start) > U4_MAX
-                    ? U4_MAX
-                    : Offset(central_directory_start));
+    put_u4le(q, start_offset > U4_MAX ? U4_MAX : start_offset);
     put_u2le(q, 0);  // .ZIP file comment length
 
   } else {
     put_u4le(q, EOCD_SIGNATURE);
     put_u2le(q, 0);  // number of this disk
     put_u2le(q, 0);  // # of the disk with the start of the central directory
-    put_u2le(q, entries_.size());  // # central dir entries on this disk
-    put_u2le(q, entries_.size());  // total # entries in the central directory
+    put_u2le(q, entries.size());  // # central dir entries on this disk
+    put_u2le(q, entries.size());  // total # entries in the central directory
     put_u4le(q, central_directory_size);  // size of the central directory
     // offset of start of central directory wrt starting disk
-    put_u4le(q, Offset(central_directory_start));
+    put_u4le(q, start_offset);
     put_u2le(q, 0);  // .ZIP file comment length
   }
 }
 
+void OutputZipFile::WriteCentralDirectory() {
+  devtools_ijar::WriteCentralDirectory(entries_, Offset(q), q);
+}
+
 u1* OutputZipFile::WriteLocalFileHeader(const char* filename, const u4 attr) {
   off_t file_name_length_ = strlen(filename);
   LocalFileEntry *entry = new LocalFileEntry;
@@ -1054,22 +1155,42 @@ u1* OutputZipFile::WriteLocalFileHeader(const char* filename, const u4 attr) {
   put_u4le(q, entry->crc32);               // crc32
   put_u4le(q, 0);  // compressed_size = placeholder
   put_u4le(q, 0);  // uncompressed_size = placeholder
+  // Whether the file is compressed is not known yet, so all the files are
+  // aligned. The padding is only in the local header.
+  u2 padding = AlignmentPadding(
+      Offset(q) + 4 + file_name_length_ + entry->extra_field_length,
+      alignment_);
   put_u2le(q, entry->file_name_length);
-  put_u2le(q, entry->extra_field_length);
+  put_u2le(q, entry->extra_field_length + padding);
 
   put_n(q, entry->file_name, entry->file_name_length);
   put_n(q, entry->extra_field, entry->extra_field_length);
+  if (padding != 0) {
+    PutAlignmentExtraField(q, padding, alignment_);
+  }
   entries_.push_back(entry);
 
   return header_ptr;
 }
 
-// Try to compress a file entry in memory using the deflate algorithm.
-// It will compress buf (of size length) unless the compressed size is bigger
-// than the input size. The result will overwrite the content of buf and the
-// final size is returned.
-size_t TryDeflate(u1 *buf, size_t length) {
-  u1 *outbuf = reinterpret_cast<u1 *>(malloc(length));
+// The zlib compression level used by Deflate(), see SetCompressionLevel().
+static int compression_level = kDefaultCompressionLevel;
+static_assert(kDefaultCompressionLevel == Z_DEFAULT_COMPRESSION,
+              "the default compression level must be zlib's");
+
+// Deflate() compresses the first kSampleLength bytes of the files at least
+// kMinSampledLength long on their own first, and stores the file if the
+// sample does not compress: the files that are compressed already (images,
+// nested archives) would only waste the time to deflate them in full.
+static const size_t kSampleLength = 1024;
+static const size_t kMinSampledLength = 8 * kSampleLength;
+
+void SetCompressionLevel(int level) {
+  compression_level = level;
+}
+
+// Same as Deflate() below, without looking at a sample first.
+static size_t DeflateAll(const u1 *buf, size_t length, u1 *outbuf) {
   z_stream stream;
 
   // Initialize the z_stream strcut for reading from buf and wrinting in outbuf.
@@ -1080,28 +1201,69 @@ size_t TryDeflate(u1 *buf, size_t length) {
   stream.avail_in = length;
   stream.total_out = length;
   stream.avail_out = length;
-  stream.next_in = buf;
+  stream.next_in = const_cast<u1 *>(buf);
   stream.next_out = outbuf;
 
   // deflateInit2 negative windows size prevent the zlib wrapper to be used.
-  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+  if (deflateInit2(&stream, compression_level, Z_DEFLATED,
                   -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
     // Failure to compress => return the buffer uncompressed
-    free(outbuf);
     return length;
   }
 
-  if (deflate(&stream, Z_FINISH) == Z_STREAM_END) {
-    // Compression successful and fits in outbuf, let's copy the result in buf.
+  if (deflate(&stream, Z_FINISH) == Z_STREAM_END &&
+      stream.total_out < length) {
+    // Compression successful and fits in outbuf.
     length = stream.total_out;
-    memcpy(buf, outbuf, length);
   }
 
   deflateEnd(&stream);
+  return length;
+}
+
+// Compresses the length bytes at buf to outbuf, which should be at least
+// as long, using the deflate algorithm. Returns the compressed size, or
+// length if the data does not compress (the contents of outbuf are then
+// undefined).
+static size_t Deflate(const u1 *buf, size_t length, u1 *outbuf) {
+  if (compression_level == 0) {
+    return length;
+  }
+  if (length >= kMinSampledLength &&
+      DeflateAll(buf, kSampleLength, outbuf) == kSampleLength) {
+    return length;
+  }
+  return DeflateAll(buf, length, outbuf);
+}
+
+// Try to compress a file entry in memory using the deflate algorithm.
+// It will compress buf (of size length) unless the compressed size is bigger
+// than the input size. The result will overwrite the content of buf and the
+// final size is returned.
+size_t TryDeflate(u1 *buf, size_t length) {
+  u1 *outbuf = reinterpret_cast<u1 *>(malloc(length));
+  size_t compressed_length = Deflate(buf, length, outbuf);
+  if (compressed_length < length) {
+    memcpy(buf, outbuf, compressed_length);
+  }
   free(outbuf);
+  return compressed_length;
+}
 
-  // Return the length of the resulting buffer
-  return length;
+void PrepareFile(PreparedFile* file, bool compress) {
+  file->length = file->data.size();
+  file->crc32 = crc32(0, file->data.data(), file->length);
+  file->deflated = false;
+  if (compress && file->length > 0) {
+    std::vector<u1> deflated(file->length);
+    size_t compressed_length =
+        Deflate(file->data.data(), file->length, deflated.data());
+    if (compressed_length < file->length) {
+      deflated.resize(compressed_length);
+      file->data.swap(deflated);
+      file->deflated = true;
+    }
+  }
 }
 
 size_t OutputZipFile::WriteFileSizeInLocalFileHeader(u1 *header_ptr,
@@ -1145,6 +1307,19 @@ u1* OutputZipFile::NewFile(const char* filename, const u4 attr) {
   return q;
 }
 
+int OutputZipFile::AddPreparedFile(const char* filename, const u4 attr,
+                                   const PreparedFile& file) {
+  if (file.deflated) {
+    return error("Cannot add the deflated file %s\n", filename);
+  }
+  u1* q = NewFile(filename, attr);
+  if (q == NULL) {
+    return -1;
+  }
+  memcpy(q, file.data.data(), file.length);
+  return FinishFile(file.length, false, true);
+}
+
 int OutputZipFile::FinishFile(size_t filelength, bool compress,
                               bool compute_crc) {
   u4 crc = 0;
@@ -1200,6 +1375,334 @@ ZipBuilder* ZipBuilder::Create(const char* zip_file, u8 estimated_size) {
   return result;
 }
 
+//
+// A class implementing ZipBuilder that writes the zip file as the files
+// are added.
+//
+class StreamingOutputZipFile : public ZipBuilder {
+ public:
+  explicit StreamingOutputZipFile(const char* filename)
+      : filename_(filename), fd_(-1), finished_(false), offset_(0),
+        file_buffer_(NULL), file_buffer_size_(0), file_max_length_(0),
+        deflate_buffer_(NULL), deflate_buffer_size_(0),
+        write_buffer_used_(0), alignment_(0) {
+    errmsg[0] = 0;
+  }
+
+  virtual ~StreamingOutputZipFile();
+
+  virtual const char* GetError() {
+    if (errmsg[0] == 0) {
+      return NULL;
+    }
+    return errmsg;
+  }
+
+  virtual u1* NewFile(const char* filename, const u4 attr);
+  virtual u1* NewFile(const char* filename, const u4 attr, size_t max_length);
+  virtual int FinishFile(size_t filelength, bool compress = false,
+                         bool compute_crc = false);
+  virtual void SetAlignment(u2 alignment) { alignment_ = alignment; }
+  virtual int AddPreparedFile(const char* filename, const u4 attr,
+                              const PreparedFile& file);
+  virtual int WriteEmptyFile(const char *filename);
+  virtual size_t GetSize() {
+    return offset_;
+  }
+  virtual int GetNumberFiles() {
+    return entries_.size();
+  }
+  virtual int Finish();
+  bool Open();
+
+ private:
+  // The size of the buffer the output is written through.
+  static const size_t WRITE_BUFFER_SIZE = 1024 * 1024;
+
+  const char* filename_;
+  int fd_;
+  bool finished_;
+  // Offset of the end of the output, including the buffered bytes.
+  u8 offset_;
+
+  // The file being added, see NewFile(), and the scratch buffer to
+  // compress it to. Both are grown as needed and reused.
+  u1* file_buffer_;
+  size_t file_buffer_size_;
+  size_t file_max_length_;
+  u1* deflate_buffer_;
+  size_t deflate_buffer_size_;
+
+  std::vector<u1> write_buffer_;
+  size_t write_buffer_used_;
+
+  u2 alignment_;
+
+  // List of entries to write the central directory
+  std::vector<LocalFileEntry*> entries_;
+
+  // last error
+  char errmsg[4*PATH_MAX];
+
+  int error(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(errmsg, 4*PATH_MAX, fmt, ap);
+    va_end(ap);
+    return -1;
+  }
+
+  // Makes sure that the buffer is at least given size.
+  static bool Reserve(u1** buffer, size_t* buffer_size, size_t size);
+
+  // Records a new entry in the central directory.
+  LocalFileEntry* NewEntry(const char* filename, const u4 attr);
+
+  // Appends an entry with given contents to the output.
+  int AddEntry(LocalFileEntry* entry, const u1* data);
+
+  // Appends the bytes to the output.
+  int Write(const u1* data, size_t length);
+  // Writes out the buffered bytes.
+  int Flush();
+};
+
+StreamingOutputZipFile::~StreamingOutputZipFile() {
+  Finish();
+  for (size_t ii = 0; ii < entries_.size(); ++ii) {
+    delete[] entries_[ii]->file_name;
+    delete entries_[ii];
+  }
+  free(file_buffer_);
+  free(deflate_buffer_);
+}
+
+bool StreamingOutputZipFile::Open() {
+  fd_ = open(filename_, O_CREAT|O_WRONLY|O_TRUNC|O_BINARY, 0644);
+  if (fd_ < 0) {
+    error("open(): %s", strerror(errno));
+    return false;
+  }
+  write_buffer_.resize(WRITE_BUFFER_SIZE);
+  return true;
+}
+
+bool StreamingOutputZipFile::Reserve(u1** buffer, size_t* buffer_size,
+                                     size_t size) {
+  if (size <= *buffer_size && *buffer != NULL) {
+    return true;
+  }
+  // Allocate at least 1 byte so that an empty file has a buffer, too.
+  u1* new_buffer = reinterpret_cast<u1*>(realloc(*buffer, size ? size : 1));
+  if (new_buffer == NULL) {
+    return false;
+  }
+  *buffer = new_buffer;
+  *buffer_size = size;
+  return true;
+}
+
+u1* StreamingOutputZipFile::NewFile(const char* filename, const u4 attr) {
+  error("The length of %s is needed to add it to %s\n", filename, filename_);
+  return NULL;
+}
+
+u1* StreamingOutputZipFile::NewFile(const char* filename, const u4 attr,
+                                    size_t max_length) {
+  if (!Reserve(&file_buffer_, &file_buffer_size_, max_length)) {
+    error("Cannot allocate %zu bytes for %s\n", max_length, filename);
+    return NULL;
+  }
+  NewEntry(filename, attr);
+  file_max_length_ = max_length;
+  return file_buffer_;
+}
+
+LocalFileEntry* StreamingOutputZipFile::NewEntry(const char* filename,
+                                                 const u4 attr) {
+  size_t file_name_length = strlen(filename);
+  LocalFileEntry *entry = new LocalFileEntry;
+  entry->local_header_offset = offset_;
+  entry->file_name_length = file_name_length;
+  entry->file_name = new u1[file_name_length];
+  memcpy(entry->file_name, filename, file_name_length);
+  entry->external_attr = attr;
+  entry->extra_field_length = 0;
+  entry->extra_field = (const u1 *)"";
+  entries_.push_back(entry);
+  return entry;
+}
+
+int StreamingOutputZipFile::FinishFile(size_t filelength, bool compress,
+                                       bool compute_crc) {
+  if (filelength > file_max_length_) {
+    // The buffer has been overrun already, there is no point in going on.
+    fprintf(stderr, "%zu bytes written to a buffer of %zu bytes\n",
+            filelength, file_max_length_);
+    abort();
+  }
+  LocalFileEntry *entry = entries_.back();
+  entry->crc32 = compute_crc ? crc32(0, file_buffer_, filelength) : 0;
+  entry->uncompressed_length = filelength;
+  entry->compressed_length = filelength;
+  entry->compression_method = COMPRESSION_METHOD_STORED;
+  const u1* data = file_buffer_;
+  if (compress && Reserve(&deflate_buffer_, &deflate_buffer_size_,
+                          filelength)) {
+    size_t compressed_length =
+        Deflate(file_buffer_, filelength, deflate_buffer_);
+    if (compressed_length < filelength) {
+      entry->compressed_length = compressed_length;
+      entry->compression_method = COMPRESSION_METHOD_DEFLATED;
+      data = deflate_buffer_;
+    }
+  }
+  return AddEntry(entry, data);
+}
+
+int StreamingOutputZipFile::AddPreparedFile(const char* filename,
+                                            const u4 attr,
+                                            const PreparedFile& file) {
+  LocalFileEntry *entry = NewEntry(filename, attr);
+  entry->crc32 = file.crc32;
+  entry->uncompressed_length = file.length;
+  entry->compressed_length = file.data.size();
+  entry->compression_method =
+      file.deflated ? COMPRESSION_METHOD_DEFLATED : COMPRESSION_METHOD_STORED;
+  return AddEntry(entry, file.data.data());
+}
+
+int StreamingOutputZipFile::WriteEmptyFile(const char *filename) {
+  if (NewFile(filename, 0, 0) == NULL) {
+    return -1;
+  }
+  return FinishFile(0);
+}
+
+int StreamingOutputZipFile::AddEntry(LocalFileEntry* entry, const u1* data) {
+  // Output the ZIP local_file_header, same as OutputZipFile does, except
+  // that the sizes are known already, and only the stored files are
+  // aligned.
+  u2 padding = 0;
+  if (entry->compression_method == COMPRESSION_METHOD_STORED) {
+    padding = AlignmentPadding(offset_ + 30 + entry->file_name_length +
+                                   entry->extra_field_length,
+                               alignment_);
+  }
+  u1 header[30];
+  u1 *q = header;
+  put_u4le(q, LOCAL_FILE_HEADER_SIGNATURE);
+  put_u2le(q, ZIP_VERSION_TO_EXTRACT);     // version to extract
+  put_u2le(q, 0);                          // general purpose bit flag
+  put_u2le(q, entry->compression_method);  // compression method
+  put_u2le(q, 0);                          // last_mod_file_time
+  put_u2le(q, 0);                          // last_mod_file_date
+  put_u4le(q, entry->crc32);               // crc32
+  put_u4le(q, entry->compressed_length);   // compressed_size
+  put_u4le(q, entry->uncompressed_length); // uncompressed_size
+  put_u2le(q, entry->file_name_length);
+  put_u2le(q, entry->extra_field_length + padding);
+  if (Write(header, q - header) < 0 ||
+      Write(entry->file_name, entry->file_name_length) < 0 ||
+      Write(entry->extra_field, entry->extra_field_length) < 0) {
+    return -1;
+  }
+  if (padding != 0) {
+    std::vector<u1> field(padding);
+    u1 *p = field.data();
+    PutAlignmentExtraField(p, padding, alignment_);
+    if (Write(field.data(), padding) < 0) {
+      return -1;
+    }
+  }
+  if (Write(data, entry->compressed_length) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+int StreamingOutputZipFile::Write(const u1* data, size_t length) {
+  if (write_buffer_used_ + length > write_buffer_.size() && Flush() < 0) {
+    return -1;
+  }
+  offset_ += length;
+  if (length < write_buffer_.size()) {
+    memcpy(&write_buffer_[write_buffer_used_], data, length);
+    write_buffer_used_ += length;
+    return 0;
+  }
+  // Too big to be buffered.
+  while (length > 0) {
+    ssize_t written = write(fd_, data, length);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return error("write(): %s", strerror(errno));
+    }
+    data += written;
+    length -= written;
+  }
+  return 0;
+}
+
+int StreamingOutputZipFile::Flush() {
+  const u1* data = write_buffer_.data();
+  size_t length = write_buffer_used_;
+  write_buffer_used_ = 0;
+  while (length > 0) {
+    ssize_t written = write(fd_, data, length);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return error("write(): %s", strerror(errno));
+    }
+    data += written;
+    length -= written;
+  }
+  return 0;
+}
+
+int StreamingOutputZipFile::Finish() {
+  if (finished_ || fd_ < 0) {
+    return 0;
+  }
+  finished_ = true;
+  // The central directory records, zip64 end of central directory record
+  // and locator, and the end of central directory record.
+  size_t central_directory_size =
+      ZIP64_EOCD_FIXED_SIZE + ZIP64_EOCD_LOCATOR_SIZE + 22;
+  for (size_t ii = 0; ii < entries_.size(); ++ii) {
+    central_directory_size +=
+        46 + entries_[ii]->file_name_length + entries_[ii]->extra_field_length;
+  }
+  std::vector<u1> central_directory(central_directory_size);
+  u1 *q = central_directory.data();
+  devtools_ijar::WriteCentralDirectory(entries_, offset_, q);
+  int result = 0;
+  if (Write(central_directory.data(), q - central_directory.data()) < 0 ||
+      Flush() < 0) {
+    result = -1;
+  }
+  if (close(fd_) < 0 && result == 0) {
+    result = error("close(): %s", strerror(errno));
+  }
+  fd_ = -1;
+  return result;
+}
+
+ZipBuilder* ZipBuilder::CreateStreaming(const char* zip_file) {
+  StreamingOutputZipFile* result = new StreamingOutputZipFile(zip_file);
+  if (!result->Open()) {
+    fprintf(stderr, "%s\n", result->GetError());
+    delete result;
+    return NULL;
+  }
+
+  return result;
+}
+
 u8 ZipBuilder::EstimateSize(char **files, char **zip_paths, int nb_entries) {
   struct stat statst;
   // Digital signature field size = 6, End of central directory = 22, Total = 28
@@ -22,8 +22,12 @@
 
 #include <sys/stat.h>
 
+#include <vector>
+
 #include "third_party/ijar/common.h"
 
+struct z_stream_s;  // From zlib.h.
+
 namespace devtools_ijar {
 
 // Tells if this is a directory entry from the mode. This method
@@ -41,6 +45,29 @@ inline mode_t zipattr_to_mode(u4 attr) {
   return ((mode_t) ((attr >> 16) & 0xffff));
 }
 
+// The contents of a file to be added to a ZIP with
+// ZipBuilder::AddPreparedFile(), see PrepareFile().
+struct PreparedFile {
+  std::vector<u1> data;  // The contents, deflated if "deflated" is true.
+  bool deflated;
+  size_t length;         // The length of the uncompressed contents.
+  u4 crc32;
+};
+
+// Sets the zlib compression level, from 0 (store the files) to 9, of the
+// files added with compression by all the ZipBuilders and PrepareFile().
+// The default is zlib's default (6). Call it before adding any file.
+void SetCompressionLevel(int level);
+
+// The level SetCompressionLevel() starts with, which selects zlib's default.
+const int kDefaultCompressionLevel = -1;
+
+// Given the contents of a file in file->data, fills in the rest of *file,
+// deflating the contents if "compress" is true and that makes them smaller.
+// Can be called from any thread, so that files can be prepared in
+// parallel and then added to a ZipBuilder in order.
+void PrepareFile(PreparedFile* file, bool compress);
+
 //
 // Class interface for building ZIP files
 //
@@ -60,6 +87,14 @@ class ZipBuilder {
   // On failure, returns NULL and GetError() will return an non-empty message.
   virtual u1* NewFile(const char* filename, const u4 attr) = 0;
 
+  // Same as above, for a file of at most max_length bytes: the returned
+  // buffer is only guaranteed to be that long. The builders created with
+  // CreateStreaming() need to know it.
+  virtual u1* NewFile(const char* filename, const u4 attr,
+                      size_t max_length) {
+    return NewFile(filename, attr);
+  }
+
   // Finish writing a file and specify its length. After calling this method
   // one should not reuse the pointer given by NewFile. The file can be
   // compressed using the deflate algorithm by setting `compress` to true.
@@ -70,6 +105,20 @@ class ZipBuilder {
                          bool compress = false,
                          bool compute_crc = false) = 0;
 
+  // Makes the data of the files added from now on start at a multiple of
+  // the alignment (e.g., 4, or 4096 for a page), so that the stored ones
+  // can be used from a memory mapped ZIP as they are. The local headers
+  // are padded with the alignment extra field zipalign uses (0xd935). The
+  // builders created with CreateStreaming() only align the stored files,
+  // the others align all of them. 0 or 1 means no alignment.
+  virtual void SetAlignment(u2 alignment) = 0;
+
+  // Adds a file with the contents prepared by PrepareFile(). Only the
+  // builders created with CreateStreaming() support deflated contents.
+  // On failure, returns -1 and GetError() will return an non-empty message.
+  virtual int AddPreparedFile(const char* filename, const u4 attr,
+                              const PreparedFile& file) = 0;
+
   // Write an empty file, it is equivalent to:
   //   NewFile(filename, 0);
   //   FinishFile(0);
@@ -94,12 +143,20 @@ class ZipBuilder {
   virtual int GetNumberFiles() = 0;
 
   // Create a new ZipBuilder writing the file zip_file and the size of the
-  // output will be at most estimated_size. Use ZipBuilder::EstimateSize() or
-  // ZipExtractor::CalculateOuputLength() to have an estimated_size depending on
-  // a list of file to store.
+  // output will be at most estimated_size. Use ZipBuilder::EstimateSize() to
+  // have an estimated_size depending on a list of file to store.
   // On failure, returns NULL. Refer to errno for error code.
   static ZipBuilder* Create(const char* zip_file, u8 estimated_size);
 
+  // Create a new ZipBuilder writing the file zip_file as the files are
+  // added. Unlike the one returned by Create(), it does not need to know
+  // the size of the output in advance, nor does it map it: it only keeps
+  // the file being added, a bounded write buffer and the central directory
+  // in memory. The files have to be added with the three-argument
+  // NewFile().
+  // On failure, returns NULL. Refer to errno for error code.
+  static ZipBuilder* CreateStreaming(const char* zip_file);
+
   // Estimate the maximum size of the ZIP files containing files in the "files"
   // null-terminated array.
   // Returns 0 on error.
@@ -125,6 +182,60 @@ class ZipExtractorProcessor {
   // in the buffer pointed by "data".
   virtual void Process(const char* filename, const u4 attr,
                        const u1* data, const size_t size) = 0;
+
+  // Process a deflated file accepted by Accept without inflating it first.
+  // "data" points to the raw deflate stream of length "compressed_size",
+  // which should inflate to "uncompressed_size" bytes (see Inflate()); it is
+  // only valid during the call. Returns false if the file should be inflated and
+  // passed to Process instead, which is what the default implementation does.
+  virtual bool ProcessCompressed(const char* filename, const u4 attr,
+                                 const u1* data, const size_t compressed_size,
+                                 const size_t uncompressed_size) {
+    return false;
+  }
+
+  // Process a stored (not deflated) file accepted by Accept without reading
+  // its data through memory: the "size" bytes of the file start at "offset"
+  // in the ZIP file, e.g. for copying them with copy_file_range(). Returns
+  // false if the data should be passed to Process instead, which is what the
+  // default implementation does.
+  virtual bool ProcessStored(const char* filename, const u4 attr,
+                             const u8 offset, const size_t size) {
+    return false;
+  }
+};
+
+// Inflates the raw deflate stream of length in_length at "in" to "out",
+// which is resized to the length of the inflated data. expected_length
+// (e.g., the uncompressed size recorded in the ZIP) is where the output
+// starts, it grows as needed. Returns false if the stream is not valid.
+// Can be called from any thread.
+bool Inflate(const u1* in, size_t in_length, size_t expected_length,
+             std::vector<u1>* out);
+
+//
+// Inflates the raw deflate streams one after another, keeping the zlib
+// state (about 40K allocated and initialized by zlib) from one stream to
+// the next. An Inflater can only be used by one thread at a time.
+//
+class Inflater {
+ public:
+  Inflater();
+  ~Inflater();
+
+  // Same as the Inflate() function above.
+  bool Inflate(const u1* in, size_t in_length, size_t expected_length,
+               std::vector<u1>* out);
+
+  // Returns the zlib stream ready to inflate a new raw deflate stream, or
+  // NULL if zlib cannot be initialized.
+  ::z_stream_s* Reset();
+
+ private:
+  Inflater(const Inflater&) = delete;
+  Inflater& operator=(const Inflater&) = delete;
+
+  ::z_stream_s* stream_;  // NULL until first used.
 };
 
 //
@@ -153,13 +264,6 @@ class ZipExtractor {
   // Return the size of the ZIP file.
   virtual size_t GetSize() = 0;
 
-  // Return the size of the resulting zip file by keeping only file
-  // accepted by the processor and storing them uncompressed. This
-  // method can be used to create a ZipBuilder for storing a subset
-  // of the input files.
-  // On error, 0 is returned and GetError() returns a non-empty message.
-  virtual u8 CalculateOutputLength() = 0;
-
   // Create a ZipExtractor that extract the zip file "filename" and process
   // it with "processor".
   // On error, a null pointer is returned and the value of errno should be
@@ -28,10 +28,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>  // NOLINT
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>  // NOLINT
 #include <set>
 #include <string>
+#include <thread>  // NOLINT
+#include <vector>
 
+#include "third_party/ijar/worker.h"
 #include "third_party/ijar/zip.h"
 
 namespace devtools_ijar {
@@ -43,6 +52,145 @@ namespace devtools_ijar {
                          } \
                        } while (0)
 
+//
+// Runs jobs on a pool of worker threads. The part of a job that has to
+// happen in order (e.g., adding a file to the ZipBuilder) runs on the
+// calling thread, in the order the jobs were submitted. The number of
+// pending jobs is bounded, Submit() finishes the oldest ones as needed.
+//
+// Without worker threads, the jobs run in Submit().
+//
+class OrderedPool {
+ public:
+  // A step of a job, returns a negative value on failure.
+  typedef std::function<int()> Step;
+
+  explicit OrderedPool(int threads);
+
+  // True if the jobs run on worker threads.
+  bool parallel() const { return !workers_.empty(); }
+
+  // Stops the worker threads, the jobs not finished are discarded.
+  ~OrderedPool();
+
+  // Runs "work" on a worker thread and then, unless it fails, "finish"
+  // (which may be empty) on the calling thread. Returns -1 if this job or
+  // one submitted before has failed already.
+  int Submit(Step work, Step finish);
+
+  // Waits for the submitted jobs and finishes them. Returns -1 if any of
+  // them has failed.
+  int Flush();
+
+ private:
+  struct Job {
+    Step work;
+    Step finish;
+    int result;
+    bool done;
+  };
+
+  // Waits for the oldest job and finishes it.
+  void FinishOldest();
+  // Worker thread body.
+  void WorkLoop();
+
+  const size_t max_pending_;
+  bool failed_;
+  // Submitted jobs in the order of submission, and the ones not picked up
+  // by a worker yet.
+  std::deque<std::unique_ptr<Job> > jobs_;
+  std::deque<Job*> unstarted_;
+  bool stopping_;
+  std::mutex mutex_;
+  std::condition_variable submitted_cond_;
+  std::condition_variable done_cond_;
+  std::vector<std::thread> workers_;
+};
+
+OrderedPool::OrderedPool(int threads)
+    : max_pending_(4 * threads), failed_(false), stopping_(false) {
+  if (threads > 1) {
+    for (int i = 0; i < threads; ++i) {
+      workers_.emplace_back(&OrderedPool::WorkLoop, this);
+    }
+  }
+}
+
+OrderedPool::~OrderedPool() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    unstarted_.clear();
+    stopping_ = true;
+  }
+  submitted_cond_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+int OrderedPool::Submit(Step work, Step finish) {
+  if (failed_) {
+    return -1;
+  }
+  if (workers_.empty()) {
+    failed_ = work() < 0 || (finish && finish() < 0);
+    return failed_ ? -1 : 0;
+  }
+  Job* job = new Job();
+  job->work = work;
+  job->finish = finish;
+  job->result = 0;
+  job->done = false;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    jobs_.emplace_back(job);
+    unstarted_.push_back(job);
+  }
+  submitted_cond_.notify_one();
+  while (!failed_ && jobs_.size() > max_pending_) {
+    FinishOldest();
+  }
+  return failed_ ? -1 : 0;
+}
+
+int OrderedPool::Flush() {
+  while (!failed_ && !jobs_.empty()) {
+    FinishOldest();
+  }
+  return failed_ ? -1 : 0;
+}
+
+void OrderedPool::FinishOldest() {
+  std::unique_ptr<Job> job;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cond_.wait(lock, [this] { return jobs_.front()->done; });
+    job = std::move(jobs_.front());
+    jobs_.pop_front();
+  }
+  failed_ = job->result < 0 || (job->finish && job->finish() < 0);
+}
+
+void OrderedPool::WorkLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    submitted_cond_.wait(lock,
+                         [this] { return stopping_ || !unstarted_.empty(); });
+    if (unstarted_.empty()) {
+      return;
+    }
+    Job* job = unstarted_.front();
+    unstarted_.pop_front();
+    lock.unlock();
+    int result = job->work();
+    lock.lock();
+    job->result = result;
+    job->done = true;
+    done_cond_.notify_all();
+  }
+}
+
 //
 // A ZipExtractorProcessor that extract files in the ZIP file.
 //
@@ -50,11 +198,13 @@ class UnzipProcessor : public ZipExtractorProcessor {
  public:
   // Create a processor who will extract the given files (or all files if NULL)
   // into output_root if "extract" is set to true and will print the list of
-  // files and their unix modes if "verbose" is set to true.
+  // files and their unix modes if "verbose" is set to true. The files are
+  // inflated and written by the pool.
   UnzipProcessor(const char *output_root, char **files, bool verbose,
-                 bool extract) : output_root_(output_root),
-                                 verbose_(verbose),
-                                 extract_(extract) {
+                 bool extract, OrderedPool *pool) : output_root_(output_root),
+                                                    verbose_(verbose),
+                                                    extract_(extract),
+                                                    pool_(pool) {
     if (files != NULL) {
       for (int i = 0; files[i] != NULL; i++) {
         file_names.insert(std::string(files[i]));
@@ -66,6 +216,9 @@ class UnzipProcessor : public ZipExtractorProcessor {
 
   virtual void Process(const char* filename, const u4 attr,
                        const u1* data, const size_t size);
+  virtual bool ProcessCompressed(const char* filename, const u4 attr,
+                                 const u1* data, const size_t compressed_size,
+                                 const size_t uncompressed_size);
   virtual bool Accept(const char* filename, const u4 attr) {
     // All entry files are accepted by default.
     if (file_names.empty()) {
@@ -77,10 +230,25 @@ class UnzipProcessor : public ZipExtractorProcessor {
   }
 
  private:
+  // Lists the file if verbose, returns its permissions and whether it is a
+  // directory.
+  mode_t List(const char* filename, const u4 attr, bool* isdir);
+  // Writes the file to the output directory, creating its parent
+  // directories.
+  void WriteFile(const std::string& filename, mode_t perm, bool isdir,
+                 const u1* data, const size_t size);
+  // Creates the parent directories of the path, unless they were created
+  // for an earlier file already.
+  void MakeParentDirs(const char* path, mode_t mode);
+
   const char *output_root_;
   const bool verbose_;
   const bool extract_;
+  OrderedPool *pool_;
   std::set<std::string> file_names;
+  // The parent directories of the files written so far.
+  std::set<std::string> created_dirs_;
+  std::mutex created_dirs_mutex_;
 };
 
 // Concatene 2 path, path1 and path2, using / as a directory separator and
@@ -126,36 +294,100 @@ void mkdirs(const char *path, mode_t mode) {
   }
 }
 
-void UnzipProcessor::Process(const char* filename, const u4 attr,
-                             const u1* data, const size_t size) {
+void UnzipProcessor::MakeParentDirs(const char* path, mode_t mode) {
+  const char* last_slash = strrchr(path, '/');
+  if (last_slash == NULL) {
+    return;
+  }
+  std::string parent(path, last_slash - path);
+  // Held while creating the directories, so that no file is written to
+  // one that is recorded but does not exist yet.
+  std::unique_lock<std::mutex> lock(created_dirs_mutex_);
+  if (created_dirs_.count(parent) == 0) {
+    mkdirs(path, mode);
+    created_dirs_.insert(parent);
+  }
+}
+
+mode_t UnzipProcessor::List(const char* filename, const u4 attr,
+                            bool* isdir) {
   mode_t mode = zipattr_to_mode(attr);
   mode_t perm = mode & 0777;
-  bool isdir = (mode & S_IFDIR) != 0;
+  *isdir = (mode & S_IFDIR) != 0;
   if (attr == 0) {
     // Fallback when the external attribute is not set.
-    isdir = filename[strlen(filename)-1] == '/';
+    *isdir = filename[strlen(filename)-1] == '/';
     perm = 0777;
   }
   if (verbose_) {
-    printf("%c %o %s\n", isdir ? 'd' : 'f', perm, filename);
-  }
-  if (extract_) {
-    char path[PATH_MAX];
-    int fd;
-    concat_path(path, PATH_MAX, output_root_, filename);
-    // Directories created must have executable bit set and be owner writeable.
-    // Otherwise, we cannot write or create any file inside.
-    mkdirs(path, perm | S_IWUSR | S_IXUSR);
-    if (!isdir) {
-      fd = open(path, O_CREAT | O_WRONLY, perm);
-      if (fd < 0) {
-        fprintf(stderr, "Cannot open file %s for writing: %s\n",
-                path, strerror(errno));
-        abort();
-      }
-      SYSCALL(write(fd, data, size));
-      SYSCALL(close(fd));
+    printf("%c %o %s\n", *isdir ? 'd' : 'f', perm, filename);
+  }
+  return perm;
+}
+
+void UnzipProcessor::Process(const char* filename, const u4 attr,
+                             const u1* data, const size_t size) {
+  bool isdir;
+  mode_t perm = List(filename, attr, &isdir);
+  if (!extract_) {
+    return;
+  }
+  if (!pool_->parallel()) {
+    WriteFile(filename, perm, isdir, data, size);
+    return;
+  }
+  // The data may be gone before the job runs, so it is copied.
+  std::shared_ptr<std::vector<u1> > contents(
+      new std::vector<u1>(data, data + size));
+  std::string name(filename);
+  pool_->Submit([this, name, perm, isdir, contents]() {
+    WriteFile(name, perm, isdir, contents->data(), contents->size());
+    return 0;
+  }, OrderedPool::Step());
+}
+
+bool UnzipProcessor::ProcessCompressed(const char* filename, const u4 attr,
+                                       const u1* data,
+                                       const size_t compressed_size,
+                                       const size_t uncompressed_size) {
+  if (!extract_ || !pool_->parallel()) {
+    return false;
+  }
+  bool isdir;
+  mode_t perm = List(filename, attr, &isdir);
+  std::shared_ptr<std::vector<u1> > compressed(
+      new std::vector<u1>(data, data + compressed_size));
+  std::string name(filename);
+  pool_->Submit([this, name, perm, isdir, compressed, uncompressed_size]() {
+    std::vector<u1> contents;
+    if (!Inflate(compressed->data(), compressed->size(), uncompressed_size,
+                 &contents)) {
+      fprintf(stderr, "Unable to inflate %s\n", name.c_str());
+      return -1;
     }
+    WriteFile(name, perm, isdir, contents.data(), contents.size());
+    return 0;
+  }, OrderedPool::Step());
+  return true;
+}
+
+void UnzipProcessor::WriteFile(const std::string& filename, mode_t perm,
+                               bool isdir, const u1* data, const size_t size) {
+  char path[PATH_MAX];
+  int fd;
+  concat_path(path, PATH_MAX, output_root_, filename.c_str());
+  // Directories created must have executable bit set and be owner writeable.
+  // Otherwise, we cannot write or create any file inside.
+  MakeParentDirs(path, perm | S_IWUSR | S_IXUSR);
+  if (!isdir) {
+    fd = open(path, O_CREAT | O_WRONLY, perm);
+    if (fd < 0) {
+      fprintf(stderr, "Cannot open file %s for writing: %s\n",
+              path, strerror(errno));
+      abort();
+    }
+    SYSCALL(write(fd, data, size));
+    SYSCALL(close(fd));
   }
 }
 
@@ -172,16 +404,26 @@ void basename(const char *path, char *output, size_t output_size) {
   output[output_size-1] = 0;
 }
 
-// copy size bytes from file descriptor fd into buffer.
+// copy size bytes from file descriptor fd into buffer. The file is read in
+// as few calls as the kernel allows, large reads are capped so that the
+// count fits in a ssize_t everywhere.
 int copy_file_to_buffer(int fd, size_t size, void *buffer) {
   size_t nb_read = 0;
   while (nb_read < size) {
     size_t to_read = size - nb_read;
-    if (to_read > 16384 /* 16K */) {
-      to_read = 16384;
+    if (to_read > (1 << 30) /* 1G */) {
+      to_read = 1 << 30;
     }
     ssize_t r = read(fd, static_cast<uint8_t *>(buffer) + nb_read, to_read);
     if (r < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (r == 0) {
+      // The file got shorter since it was stat()ed.
+      errno = EIO;
       return -1;
     }
     nb_read += r;
@@ -189,9 +431,27 @@ int copy_file_to_buffer(int fd, size_t size, void *buffer) {
   return 0;
 }
 
-// Execute the extraction (or just listing if just v is provided)
+// Read the first size bytes of the file into buffer.
+int read_file(const char *file, size_t size, void *buffer) {
+  int fd = open(file, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open file %s for reading: %s.\n", file,
+            strerror(errno));
+    return -1;
+  }
+  if (copy_file_to_buffer(fd, size, buffer) < 0) {
+    fprintf(stderr, "Can't read file %s: %s.\n", file, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  return 0;
+}
+
+// Execute the extraction (or just listing if just v is provided), writing
+// the files on given number of threads.
 int extract(char *zipfile, char* exdir, char **files, bool verbose,
-            bool extract) {
+            bool extract, int threads) {
   char cwd[PATH_MAX];
   if (getcwd(cwd, PATH_MAX) == NULL) {
     fprintf(stderr, "getcwd() failed: %s.\n", strerror(errno));
@@ -205,7 +465,8 @@ int extract(char *zipfile, char* exdir, char **files, bool verbose,
     strncpy(output_root, cwd, PATH_MAX);
   }
 
-  UnzipProcessor processor(output_root, files, verbose, extract);
+  OrderedPool pool(threads);
+  UnzipProcessor processor(output_root, files, verbose, extract, &pool);
   std::unique_ptr<ZipExtractor> extractor(ZipExtractor::Create(zipfile,
                                                                &processor));
   if (extractor.get() == NULL) {
@@ -218,21 +479,42 @@ int extract(char *zipfile, char* exdir, char **files, bool verbose,
     fprintf(stderr, "%s.\n", extractor->GetError());
     return -1;
   }
-  return 0;
+  return pool.Flush();
 }
 
-// add a file to the zip
-int add_file(std::unique_ptr<ZipBuilder> const &builder, char *file,
-             char *zip_path, bool flatten, bool verbose, bool compress) {
-  struct stat statst;
-  statst.st_size = 0;
-  statst.st_mode = 0666;
-  if (file != NULL) {
-    if (stat(file, &statst) < 0) {
-      fprintf(stderr, "Cannot stat file %s: %s.\n", file, strerror(errno));
+// stat()s the files to add into "stats", on the pool if it is parallel. An
+// entry without a file (an empty file in the zip) gets mode 0666 and size 0.
+// A stat() is cheap next to a job, so a job stats a batch of files.
+int stat_files(char **files, int nb_entries, OrderedPool *pool,
+               std::vector<struct stat> *stats) {
+  static const int kStatBatch = 256;
+  stats->resize(nb_entries);
+  for (int start = 0; start < nb_entries; start += kStatBatch) {
+    int end = std::min(start + kStatBatch, nb_entries);
+    struct stat *batch = stats->data();
+    if (pool->Submit([files, start, end, batch]() {
+          for (int i = start; i < end; i++) {
+            batch[i].st_size = 0;
+            batch[i].st_mode = 0666;
+            if (files[i] != NULL && stat(files[i], &batch[i]) < 0) {
+              fprintf(stderr, "Cannot stat file %s: %s.\n", files[i],
+                      strerror(errno));
+              return -1;
+            }
+          }
+          return 0;
+        }, OrderedPool::Step()) < 0) {
       return -1;
     }
   }
+  return pool->Flush();
+}
+
+// add a file to the zip, reading and compressing it in the pool if it is
+// parallel. "statst" is the result of stat_files() for the file.
+int add_file(std::unique_ptr<ZipBuilder> const &builder, char *file,
+             char *zip_path, const struct stat &statst, bool flatten,
+             bool verbose, bool compress, OrderedPool *pool) {
   char *final_path = zip_path != NULL ? zip_path : file;
 
   bool isdir = (statst.st_mode & S_IFDIR) != 0;
@@ -265,23 +547,41 @@ int add_file(std::unique_ptr<ZipBuilder> const &builder, char *file,
     printf("%c %o %s\n", isdir ? 'd' : 'f', perm, path);
   }
 
-  u1 *buffer = builder->NewFile(path, mode_to_zipattr(statst.st_mode));
+  size_t length = isdir ? 0 : statst.st_size;
+  u4 attr = mode_to_zipattr(statst.st_mode);
+  if (pool->parallel()) {
+    std::shared_ptr<PreparedFile> prepared(new PreparedFile());
+    std::string file_path(length > 0 ? file : "");
+    std::string name(path);
+    ZipBuilder *out = builder.get();
+    return pool->Submit([prepared, file_path, length, compress]() {
+      prepared->data.resize(length);
+      if (length > 0 &&
+          read_file(file_path.c_str(), length, prepared->data.data()) < 0) {
+        return -1;
+      }
+      PrepareFile(prepared.get(), compress);
+      return 0;
+    }, [out, prepared, name, attr]() {
+      if (out->AddPreparedFile(name.c_str(), attr, *prepared) < 0) {
+        fprintf(stderr, "%s\n", out->GetError());
+        return -1;
+      }
+      return 0;
+    });
+  }
+  u1 *buffer = builder->NewFile(path, attr, length);
+  if (buffer == NULL) {
+    fprintf(stderr, "%s\n", builder->GetError());
+    return -1;
+  }
   if (isdir || statst.st_size == 0) {
     builder->FinishFile(0);
   } else {
     // read the input file
-    int fd = open(file, O_RDONLY);
-    if (fd < 0) {
-      fprintf(stderr, "Can't open file %s for reading: %s.\n", file,
-              strerror(errno));
+    if (read_file(file, statst.st_size, buffer) < 0) {
       return -1;
     }
-    if (copy_file_to_buffer(fd, statst.st_size, buffer) < 0) {
-      fprintf(stderr, "Can't read file %s: %s.\n", file, strerror(errno));
-      close(fd);
-      return -1;
-    }
-    close(fd);
     builder->FinishFile(statst.st_size, compress, true);
   }
   return 0;
@@ -299,12 +599,15 @@ char **read_filelist(char *filename) {
   }
   if (fstat(fd, &statst) < 0) {
     fprintf(stderr, "Cannot stat file %s: %s.\n", filename, strerror(errno));
+    close(fd);
     return NULL;
   }
 
   char *data = static_cast<char *>(malloc(statst.st_size));
-  if (copy_file_to_buffer(fd, statst.st_size, data) < 0) {
+  if ((data == NULL && statst.st_size > 0) ||
+      copy_file_to_buffer(fd, statst.st_size, data) < 0) {
     fprintf(stderr, "Can't read file %s: %s.\n", filename, strerror(errno));
+    free(data);
     close(fd);
     return NULL;
   }
@@ -317,13 +620,20 @@ char **read_filelist(char *filename) {
     }
   }
 
+  // The array goes in front of the content, in the same allocation: the
+  // content is moved up rather than copied to a second buffer. The extra
+  // byte terminates a last line without a newline.
   size_t sizeof_array = sizeof(char *) * (nb_entries + 1);
-  void *result = malloc(sizeof_array + statst.st_size);
-  // copy the content
+  void *result = realloc(data, sizeof_array + statst.st_size + 1);
+  if (result == NULL) {
+    fprintf(stderr, "Can't read file %s: %s.\n", filename, strerror(errno));
+    free(data);
+    return NULL;
+  }
   char **filelist = static_cast<char **>(result);
   char *content = static_cast<char *>(result) + sizeof_array;
-  memcpy(content, data, statst.st_size);
-  free(data);
+  memmove(content, result, statst.st_size);
+  content[statst.st_size] = 0;
   // Create the corresponding array
   int j = 1;
   filelist[0] = content;
@@ -375,9 +685,10 @@ char **parse_filelist(char *zipfile, char **file_entries, int nb_entries,
   return files;
 }
 
-// Execute the create operation
+// Execute the create operation, reading and compressing the files on given
+// number of threads
 int create(char *zipfile, char **file_entries, bool flatten, bool verbose,
-           bool compress) {
+           bool compress, int threads) {
   int nb_entries = 0;
   while (file_entries[nb_entries] != NULL) {
     nb_entries++;
@@ -388,11 +699,14 @@ int create(char *zipfile, char **file_entries, bool flatten, bool verbose,
     return -1;
   }
 
-  u8 size = ZipBuilder::EstimateSize(files, zip_paths, nb_entries);
-  if (size == 0) {
+  // Fails if an input is missing, before the output is created. The results
+  // are kept for adding the files.
+  OrderedPool pool(threads);
+  std::vector<struct stat> stats;
+  if (stat_files(files, nb_entries, &pool, &stats) < 0) {
     return -1;
   }
-  std::unique_ptr<ZipBuilder> builder(ZipBuilder::Create(zipfile, size));
+  std::unique_ptr<ZipBuilder> builder(ZipBuilder::CreateStreaming(zipfile));
   if (builder.get() == NULL) {
     fprintf(stderr, "Unable to create zip file %s: %s.\n",
             zipfile, strerror(errno));
@@ -400,11 +714,14 @@ int create(char *zipfile, char **file_entries, bool flatten, bool verbose,
   }
 
   for (int i = 0; i < nb_entries; i++) {
-    if (add_file(builder, files[i], zip_paths[i], flatten, verbose, compress) <
-        0) {
+    if (add_file(builder, files[i], zip_paths[i], stats[i], flatten, verbose,
+                 compress, &pool) < 0) {
       return -1;
     }
   }
+  if (pool.Flush() < 0) {
+    return -1;
+  }
   if (builder->Finish() < 0) {
     fprintf(stderr, "%s\n", builder->GetError());
     return -1;
@@ -419,8 +736,8 @@ int create(char *zipfile, char **file_entries, bool flatten, bool verbose,
 //
 static void usage(char *progname) {
   fprintf(stderr,
-          "Usage: %s [vxc[fC]] x.zip [-d exdir] [[zip_path1=]file1 ... "
-          "[zip_pathn=]filen]\n",
+          "Usage: %s [vxc[fC]] x.zip [-d exdir] [-j threads] [-l level] "
+          "[[zip_path1=]file1 ... [zip_pathn=]filen]\n",
           progname);
   fprintf(stderr, "  v verbose - list all file in x.zip\n");
   fprintf(stderr,
@@ -431,6 +748,11 @@ static void usage(char *progname) {
   fprintf(stderr, "  f flatten - flatten files to use with create operation\n");
   fprintf(stderr,
           "  C compress - compress files when using the create operation\n");
+  fprintf(stderr,
+          "  -j threads - read and compress (or inflate and write) the files "
+          "on that many threads\n");
+  fprintf(stderr,
+          "  -l level - the compression level, from 0 (store) to 9 (best)\n");
   fprintf(stderr, "x and c cannot be used in the same command-line.\n");
   fprintf(stderr,
           "\nFor every file, a path in the zip can be specified. Examples:\n");
@@ -446,7 +768,9 @@ static void usage(char *progname) {
   exit(1);
 }
 
-int main(int argc, char **argv) {
+// Runs a single command. In a persistent worker, nothing may be left over
+// from the previous one.
+static int Run(int argc, char **argv) {
   bool extract = false;
   bool verbose = false;
   bool create = false;
@@ -484,15 +808,37 @@ int main(int argc, char **argv) {
     usage(argv[0]);
   }
 
-  // Calculate the argument index of the first entry file.
-  int filelist_start_index;
-  if (argc > 3 && strcmp(argv[3], "-d") == 0) {
-    filelist_start_index = 5;
-  } else {
-    filelist_start_index = 3;
+  // Parse the options following the zip file, and calculate the argument
+  // index of the first entry file.
+  char* exdir = NULL;
+  int threads = 1;
+  devtools_ijar::SetCompressionLevel(devtools_ijar::kDefaultCompressionLevel);
+  int filelist_start_index = 3;
+  while (argc > filelist_start_index) {
+    if (strcmp(argv[filelist_start_index], "-d") == 0) {
+      exdir = argv[filelist_start_index + 1];
+    } else if (strcmp(argv[filelist_start_index], "-l") == 0) {
+      int level;
+      if (argc == filelist_start_index + 1 ||
+          sscanf(argv[filelist_start_index + 1], "%d", &level) != 1 ||
+          level < 0 || level > 9) {
+        usage(argv[0]);
+      }
+      devtools_ijar::SetCompressionLevel(level);
+    } else if (strcmp(argv[filelist_start_index], "-j") == 0) {
+      if (argc == filelist_start_index + 1 ||
+          (threads = atoi(argv[filelist_start_index + 1])) < 1) {
+        usage(argv[0]);
+      }
+    } else {
+      break;
+    }
+    filelist_start_index += 2;
   }
 
   char** filelist = NULL;
+  // The file list read from an option file, freed at the end.
+  std::unique_ptr<char*, void (*)(void*)> filelist_from_file(NULL, free);
 
   // We have one option file. Read and extract the content.
   if (argc == filelist_start_index + 1 &&
@@ -504,6 +850,7 @@ int main(int argc, char **argv) {
               strerror(errno));
       return -1;
     }
+    filelist_from_file.reset(filelist);
     // We have more than one files. Assume that they are all file entries.
   } else if (argc >= filelist_start_index + 1) {
     filelist = argv + filelist_start_index;
@@ -518,18 +865,30 @@ int main(int argc, char **argv) {
 
   if (create) {
     // Create a zip
-    return devtools_ijar::create(argv[2], filelist, flatten, verbose, compress);
+    return devtools_ijar::create(argv[2], filelist, flatten, verbose, compress,
+                                 threads);
   } else {
     if (flatten) {
       usage(argv[0]);
     }
 
-    char* exdir = NULL;
-    if (argc > 3 && strcmp(argv[3], "-d") == 0) {
-      exdir = argv[4];
-    }
-
     // Extraction / list mode
-    return devtools_ijar::extract(argv[2], exdir, filelist, verbose, extract);
+    return devtools_ijar::extract(argv[2], exdir, filelist, verbose, extract,
+                                  threads);
   }
 }
+
+int main(int argc, char **argv) {
+  if (!devtools_ijar::IsPersistentWorker(argc, argv)) {
+    return Run(argc, argv);
+  }
+  return devtools_ijar::RunPersistentWorker(
+      [argv](const std::vector<std::string>& arguments) {
+        std::vector<char*> request_argv(1, argv[0]);
+        for (auto& argument : arguments) {
+          request_argv.push_back(const_cast<char*>(argument.c_str()));
+        }
+        request_argv.push_back(NULL);
+        return Run(request_argv.size() - 1, request_argv.data());
+      });
+}
@@ -29,6 +29,7 @@
 #endif /* MAKECRCH */
 
 #include "zutil.h"      /* for STDC and FAR definitions */
+#include "crc32_simd.h"
 
 #define local static
 
@@ -213,6 +214,18 @@ unsigned long ZEXPORT crc32(crc, buf, len)
         make_crc_table();
 #endif /* DYNAMIC_CRC_TABLE */
 
+#ifdef CRC32_SIMD
+    if (len >= CRC32_SIMD_MIN_LENGTH && crc32_simd_available()) {
+        uInt blocks = len & ~15U;
+
+        crc = ~crc32_simd_fold((z_crc_t)~crc, buf, blocks) & 0xffffffffUL;
+        buf += blocks;
+        len -= blocks;
+        if (len == 0)
+            return crc;
+    }
+#endif /* CRC32_SIMD */
+
 #ifdef BYFOUR
     if (sizeof(void *) == sizeof(ptrdiff_t)) {
         z_crc_t endian;
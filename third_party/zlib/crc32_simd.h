@@ -0,0 +1,40 @@
+/* crc32_simd.h -- CRC-32 of 16-byte blocks with carry-less multiplication
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+/* WARNING: this file should *not* be used by applications. It is
+   part of the implementation of the compression library and is
+   subject to change. Applications should only use zlib.h.
+ */
+
+#ifndef CRC32_SIMD_H
+#define CRC32_SIMD_H
+
+#include "zutil.h"
+
+/* The folding needs the PCLMULQDQ and SSE4.1 instructions, which are only
+   used if the CPU has them, so that the library runs everywhere. It is
+   compiled with function attributes, without special compiler flags. */
+#if defined(__x86_64__) && defined(__GNUC__) && defined(Z_U4) && \
+    !defined(NO_CRC32_SIMD)
+#  define CRC32_SIMD
+#endif
+
+#ifdef CRC32_SIMD
+
+/* The folding is used for this many bytes and more. */
+#define CRC32_SIMD_MIN_LENGTH 64
+
+/* Nonzero if the CPU can run crc32_simd_fold(). */
+int ZLIB_INTERNAL crc32_simd_available OF((void));
+
+/* Updates the inverted CRC-32 "crc" with "len" bytes of "buf", which is a
+   multiple of 16 of at least CRC32_SIMD_MIN_LENGTH: the caller does the
+   inversions of crc32(). */
+z_crc_t ZLIB_INTERNAL crc32_simd_fold OF((z_crc_t crc,
+                                          const unsigned char FAR *buf,
+                                          uInt len));
+
+#endif /* CRC32_SIMD */
+
+#endif /* CRC32_SIMD_H */